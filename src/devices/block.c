@@ -1,11 +1,90 @@
 #include "devices/block.h"
+#include <hist.h>
+#include <limits.h>
 #include <list.h>
+#include <round.h>
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/ktrace.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
-/* A block device. */
+/* Most sectors a disk's I/O thread merges into one transfer,
+   through its bounce buffer. */
+#define MERGE_SECTORS 16
+
+/* Ticks a request may wait before it is served ahead of the
+   elevator order, so that a steady stream of nearby requests
+   cannot starve a distant one. */
+#define DEADLINE_TICKS (TIMER_FREQ / 2)
+
+/* Priority levels within an I/O class, into which thread
+   priorities are divided, highest first. */
+#define IOPRIO_LEVELS 8
+
+/* Buckets in a device's latency histogram, one per power of two
+   of CPU cycles from submission to completion. */
+#define HIST_BUCKETS 40
+
+/* Pages of trace records kept by -blktrace. */
+#define TRACE_PAGES 16
+
+/* One request, as recorded by -blktrace.  Sixteen fill a sector
+   when the trace is dumped to the scratch device. */
+struct trace_record
+  {
+    int64_t tick;               /* Timer tick when submitted. */
+    uint32_t seq;               /* Number of records before this one. */
+    block_sector_t sector;      /* First sector, on DEV. */
+    tid_t tid;                  /* Submitting thread. */
+    uint16_t cnt;               /* Number of sectors. */
+    uint8_t write;              /* 1 for a write, 0 for a read. */
+    uint8_t type;               /* DEV's type, which names the subsystem. */
+    char dev[8];                /* Device name, e.g. "hdb1", null-padded. */
+  };
+
+/* Records that fit in the trace ring and in one sector. */
+#define TRACE_CNT (TRACE_PAGES * PGSIZE / sizeof (struct trace_record))
+#define TRACE_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (struct trace_record))
+
+/* Where -blktrace sends the trace at shutdown. */
+enum trace_dest
+  {
+    TRACE_OFF,                  /* Not tracing. */
+    TRACE_CONSOLE,              /* Printed, one line per record. */
+    TRACE_SCRATCH               /* Written to the scratch device. */
+  };
+
+/* Ring of the last TRACE_CNT requests, allocated by the first
+   block_register() once tracing is on.  Protected by disabling
+   interrupts. */
+static enum trace_dest trace_dest;
+static struct trace_record *trace_ring;
+static uint32_t trace_seq;              /* Records made so far. */
+
+/* State of a disk's I/O thread. */
+enum worker_state
+  {
+    WORKER_NONE,                        /* Not started yet. */
+    WORKER_RUNNING,                     /* Serving the queue. */
+    WORKER_FAILED                       /* Could not start: requests
+                                           run in the submitter. */
+  };
+
+/* A block device.
+
+   A device with a parent, such as a partition, is a range of
+   its parent's sectors, and requests for it pass straight to the
+   parent.  Each device without a parent, a disk, has a queue of
+   requests served by its own I/O thread, started with the first
+   request.  Disks on different channels thus transfer at the
+   same time, and a thread waiting on one disk does not hold up
+   requests for another. */
 struct block
   {
     struct list_elem list_elem;         /* Element in all_blocks. */
@@ -19,6 +98,28 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+
+    /* Request statistics, kept under the disk's queue_lock, except
+       the histogram, which only the disk's I/O thread updates. */
+    block_sector_t next_sector;         /* Sector after the last request. */
+    unsigned long long seq_cnt;         /* Requests starting there. */
+    unsigned long long random_cnt;      /* Requests starting elsewhere. */
+    unsigned long long hist[HIST_BUCKETS]; /* Latency histogram. */
+
+    struct block *parent;               /* Device holding this one, or null. */
+    block_sector_t start;               /* First sector in PARENT. */
+
+    /* Request queue, for devices without a parent. */
+    struct lock queue_lock;             /* Protects the members below. */
+    struct condition queue_ready;       /* Signaled when QUEUE gains a request. */
+    struct list queue;                  /* Pending requests, oldest first. */
+    block_sector_t head;                /* Sector after the last one served. */
+    enum worker_state worker;           /* State of the I/O thread. */
+    uint8_t *bounce;                    /* MERGE_SECTORS sectors, or null. */
+    unsigned long long request_cnt;     /* Number of requests served. */
+    unsigned long long merge_cnt;       /* Number merged into another. */
+    size_t depth;                       /* Requests in QUEUE. */
+    size_t peak_depth;                  /* Most ever in QUEUE. */
   };
 
 /* List of all block devices. */
@@ -28,6 +129,8 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static void block_transfer (struct block *, block_sector_t, void *,
+                            block_sector_t cnt, bool write);
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -120,9 +223,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_transfer (block, sector, buffer, 1, false);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +234,335 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  block_transfer (block, sector, (void *) buffer, 1, true);
+}
+
+/* Reads the CNT sectors starting at SECTOR from BLOCK into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE bytes.
+   Drivers that support it move them all in one request;
+   otherwise this is the same as CNT calls to block_read(). */
+void
+block_read_multiple (struct block *block, block_sector_t sector, void *buffer,
+                     block_sector_t cnt)
+{
+  if (cnt > 0)
+    block_transfer (block, sector, buffer, cnt, false);
+}
+
+/* Writes the CNT sectors starting at SECTOR to BLOCK from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes, as
+   block_read_multiple() reads them. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      const void *buffer, block_sector_t cnt)
+{
+  if (cnt > 0)
+    block_transfer (block, sector, (void *) buffer, cnt, true);
+}
+
+/* Has DISK's driver transfer CNT sectors between SECTOR and
+   BUFFER, to BUFFER unless WRITE. */
+static void
+execute (struct block *disk, block_sector_t sector, void *buffer,
+         block_sector_t cnt, bool write)
+{
+  const struct block_operations *ops = disk->ops;
+  uint8_t *p = buffer;
+  block_sector_t i;
+
+  if (write && ops->write_multiple != NULL)
+    ops->write_multiple (disk->aux, sector, p, cnt);
+  else if (!write && ops->read_multiple != NULL)
+    ops->read_multiple (disk->aux, sector, p, cnt);
+  else
+    for (i = 0; i < cnt; i++, p += BLOCK_SECTOR_SIZE)
+      if (write)
+        ops->write (disk->aux, sector + i, p);
+      else
+        ops->read (disk->aux, sector + i, p);
+}
+
+/* Finishes request R, recording its latency. */
+static void
+complete (struct block_request *r)
+{
+  KTRACE (KTRACE_BLOCK_DONE, (uintptr_t) r);
+  r->block->hist[hist_bucket (timer_tsc () - r->submit_tsc, HIST_BUCKETS)]++;
+  if (r->done != NULL)
+    r->done (r);
+  else
+    sema_up (&r->finished);
+}
+
+/* Removes and returns the request DISK should serve next, which
+   must have one queued.  Only the requests with the lowest
+   IOPRIO are considered, and of those the one with the lowest
+   sector at or past the head, as in a one-way elevator sweep, or
+   failing that the lowest overall, to start the next sweep;
+   unless the oldest request of any priority is past its
+   deadline, so that background work is delayed but never
+   starved. */
+static struct block_request *
+next_request (struct block *disk)
+{
+  struct block_request *best = NULL, *lowest = NULL;
+  struct list_elem *e;
+  int ioprio = INT_MAX;
+
+  best = list_entry (list_front (&disk->queue), struct block_request, elem);
+  if (timer_elapsed (best->submitted) < DEADLINE_TICKS)
+    {
+      best = NULL;
+      for (e = list_begin (&disk->queue); e != list_end (&disk->queue);
+           e = list_next (e))
+        {
+          struct block_request *r = list_entry (e, struct block_request, elem);
+          if (r->ioprio < ioprio)
+            ioprio = r->ioprio;
+        }
+      for (e = list_begin (&disk->queue); e != list_end (&disk->queue);
+           e = list_next (e))
+        {
+          struct block_request *r = list_entry (e, struct block_request, elem);
+          if (r->ioprio != ioprio)
+            continue;
+          if (lowest == NULL || r->sector < lowest->sector)
+            lowest = r;
+          if (r->sector >= disk->head
+              && (best == NULL || r->sector < best->sector))
+            best = r;
+        }
+      if (best == NULL)
+        best = lowest;
+    }
+  list_remove (&best->elem);
+  return best;
+}
+
+/* Returns a request queued on DISK that starts at SECTOR and is
+   a write if WRITE is true, a read otherwise, or a null pointer
+   if there is none. */
+static struct block_request *
+adjacent_request (struct block *disk, block_sector_t sector, bool write)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&disk->queue); e != list_end (&disk->queue);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (r->sector == sector && r->write == write)
+        return r;
+    }
+  return NULL;
+}
+
+/* A disk's I/O thread.  Serves the requests on the queue of
+   DISK_ one transfer at a time, merging each with those queued
+   for the sectors right after it, up to MERGE_SECTORS in all. */
+static void
+block_worker (void *disk_)
+{
+  struct block *disk = disk_;
+
+  disk->bounce = malloc (MERGE_SECTORS * BLOCK_SECTOR_SIZE);
+  for (;;)
+    {
+      struct block_request *batch[MERGE_SECTORS];
+      block_sector_t total;
+      size_t n, i;
+      bool write;
+
+      lock_acquire (&disk->queue_lock);
+      while (list_empty (&disk->queue))
+        cond_wait (&disk->queue_ready, &disk->queue_lock);
+      batch[0] = next_request (disk);
+      disk->depth--;
+      write = batch[0]->write;
+      total = batch[0]->cnt;
+      for (n = 1; disk->bounce != NULL; n++)
+        {
+          struct block_request *r;
+
+          r = adjacent_request (disk, batch[0]->sector + total, write);
+          if (r == NULL || total + r->cnt > MERGE_SECTORS)
+            break;
+          list_remove (&r->elem);
+          disk->depth--;
+          batch[n] = r;
+          total += r->cnt;
+        }
+      disk->head = batch[0]->sector + total;
+      disk->request_cnt += n;
+      disk->merge_cnt += n - 1;
+      lock_release (&disk->queue_lock);
+
+      if (n == 1)
+        execute (disk, batch[0]->sector, batch[0]->buffer, total, write);
+      else
+        {
+          uint8_t *p;
+
+          if (write)
+            for (i = 0, p = disk->bounce; i < n;
+                 p += batch[i++]->cnt * BLOCK_SECTOR_SIZE)
+              memcpy (p, batch[i]->buffer, batch[i]->cnt * BLOCK_SECTOR_SIZE);
+          execute (disk, batch[0]->sector, disk->bounce, total, write);
+          if (!write)
+            for (i = 0, p = disk->bounce; i < n;
+                 p += batch[i++]->cnt * BLOCK_SECTOR_SIZE)
+              memcpy (batch[i]->buffer, p, batch[i]->cnt * BLOCK_SECTOR_SIZE);
+        }
+      for (i = 0; i < n; i++)
+        complete (batch[i]);
+    }
+}
+
+/* Records in the trace ring that request R, for SECTOR of
+   BLOCK, is being submitted. */
+static void
+trace (struct block *block, block_sector_t sector,
+       const struct block_request *r)
+{
+  struct trace_record *t;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  t = &trace_ring[trace_seq % TRACE_CNT];
+  t->seq = trace_seq++;
+  intr_set_level (old_level);
+
+  t->tick = r->submitted;
+  t->sector = sector;
+  t->tid = thread_tid ();
+  t->cnt = r->cnt;
+  t->write = r->write;
+  t->type = block->type;
+  strlcpy (t->dev, block->name, sizeof t->dev);
+}
+
+/* Puts the block requests the current thread submits from now on
+   in class CLASS.  Kernel threads doing background work call this
+   once at startup. */
+void
+block_set_io_class (enum block_io_class class)
+{
+  ASSERT (class < BLOCK_IO_CLASS_CNT);
+  thread_current ()->io_class = class;
+}
+
+/* Returns the IOPRIO of a request that the current thread
+   submits: its I/O class, then its priority, highest first. */
+static int
+io_priority (void)
+{
+  int level = ((PRI_MAX - thread_get_priority ()) * IOPRIO_LEVELS
+               / (PRI_MAX - PRI_MIN + 1));
+  return thread_current ()->io_class * IOPRIO_LEVELS + level;
+}
+
+/* Initializes R as a request to transfer the CNT sectors
+   starting at SECTOR between a block device and BUFFER: to the
+   device if WRITE is true, else from it.  R->done is null, so
+   the submitter waits for R with block_wait(); it may set
+   R->done and R->aux instead before submitting R. */
+void
+block_request_init (struct block_request *r, bool write,
+                    block_sector_t sector, void *buffer, block_sector_t cnt)
+{
+  r->sector = sector;
+  r->buffer = buffer;
+  r->cnt = cnt;
+  r->write = write;
+  r->done = NULL;
+  r->aux = NULL;
+  sema_init (&r->finished, 0);
+}
+
+/* Queues request R, initialized by block_request_init(), on the
+   disk holding BLOCK and returns at once, unless the disk's I/O
+   thread could not be started.  R and its buffer must stay put
+   until it completes.  Panics if R reaches past the end of
+   BLOCK. */
+void
+block_submit (struct block *block, struct block_request *r)
+{
+  struct block *disk = block;
+  block_sector_t sector = r->sector;
+
+  ASSERT (!intr_context ());
+  ASSERT (r->cnt > 0);
+  check_sector (block, r->sector);
+  check_sector (block, r->sector + r->cnt - 1);
+  if (r->write)
+    {
+      ASSERT (block->type != BLOCK_FOREIGN);
+      block->write_cnt += r->cnt;
+    }
+  else
+    block->read_cnt += r->cnt;
+
+  for (; disk->parent != NULL; disk = disk->parent)
+    r->sector += disk->start;
+  r->submitted = timer_ticks ();
+  r->submit_tsc = timer_tsc ();
+  r->block = block;
+  r->ioprio = io_priority ();
+  if (trace_ring != NULL)
+    trace (block, sector, r);
+  KTRACE (KTRACE_BLOCK_SUBMIT, r->sector, r->cnt, r->write, (uintptr_t) r);
+
+  lock_acquire (&disk->queue_lock);
+  if (sector == block->next_sector)
+    block->seq_cnt++;
+  else
+    block->random_cnt++;
+  block->next_sector = sector + r->cnt;
+  if (disk->worker == WORKER_NONE)
+    {
+      char name[sizeof disk->name + 3];
+
+      snprintf (name, sizeof name, "io-%s", disk->name);
+      disk->worker = (thread_create (name, PRI_MAX, block_worker, disk)
+                      != TID_ERROR ? WORKER_RUNNING : WORKER_FAILED);
+    }
+  if (disk->worker == WORKER_RUNNING)
+    {
+      list_push_back (&disk->queue, &r->elem);
+      if (++disk->depth > disk->peak_depth)
+        disk->peak_depth = disk->depth;
+      cond_signal (&disk->queue_ready, &disk->queue_lock);
+      lock_release (&disk->queue_lock);
+    }
+  else
+    {
+      lock_release (&disk->queue_lock);
+      execute (disk, r->sector, r->buffer, r->cnt, r->write);
+      complete (r);
+    }
+}
+
+/* Waits for request R, submitted with a null R->done, to
+   complete. */
+void
+block_wait (struct block_request *r)
+{
+  ASSERT (r->done == NULL);
+  sema_down (&r->finished);
+}
+
+/* Transfers CNT sectors between SECTOR of BLOCK and BUFFER, to
+   BUFFER unless WRITE, and waits for the transfer to
+   complete. */
+static void
+block_transfer (struct block *block, block_sector_t sector, void *buffer,
+                block_sector_t cnt, bool write)
+{
+  struct block_request r;
+
+  block_request_init (&r, write, sector, buffer, cnt);
+  block_submit (block, &r);
+  block_wait (&r);
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,22 +586,163 @@ block_type (struct block *block)
   return block->type;
 }
 
-/* Prints statistics for each block device used for a Pintos role. */
+/* Returns the number of requests waiting in the queue of the disk
+   that holds BLOCK, which partitions of one disk share.  Read
+   without the queue lock, so it may be stale by the time the
+   caller looks at it. */
+size_t
+block_queue_depth (struct block *block)
+{
+  while (block->parent != NULL)
+    block = block->parent;
+  return block->depth;
+}
+
+/* Prints statistics for each block device used for a Pintos
+   role: sectors and bytes moved, how many requests started where
+   the previous one ended, and a latency histogram listing the
+   nonzero log2 cycle buckets.  Then, for each disk that has
+   served requests, prints how many were merged and the deepest
+   its queue got. */
 void
 block_print_stats (void)
 {
-  int i;
+  struct list_elem *e;
+  int i, b;
 
   for (i = 0; i < BLOCK_ROLE_CNT; i++)
     {
       struct block *block = block_by_role[i];
       if (block != NULL)
         {
+          unsigned long long requests = block->seq_cnt + block->random_cnt;
+
           printf ("%s (%s): %llu reads, %llu writes\n",
                   block->name, block_type_name (block->type),
                   block->read_cnt, block->write_cnt);
+          if (requests == 0)
+            continue;
+          printf ("%s (%s): %llu bytes, %llu requests, "
+                  "%llu%% sequential\n",
+                  block->name, block_type_name (block->type),
+                  (block->read_cnt + block->write_cnt) * BLOCK_SECTOR_SIZE,
+                  requests, block->seq_cnt * 100 / requests);
+          printf ("%s (%s) latency (log2 cycles: requests):",
+                  block->name, block_type_name (block->type));
+          for (b = 0; b < HIST_BUCKETS; b++)
+            if (block->hist[b] > 0)
+              printf (" %d: %llu", b, block->hist[b]);
+          printf ("\n");
         }
     }
+  for (e = list_begin (&all_blocks); e != list_end (&all_blocks);
+       e = list_next (e))
+    {
+      struct block *block = list_entry (e, struct block, list_elem);
+      if (block->parent == NULL && block->request_cnt > 0)
+        printf ("%s: %llu requests, %llu merged, peak queue depth %zu\n",
+                block->name, block->request_cnt, block->merge_cnt,
+                block->peak_depth);
+    }
+}
+
+/* Turns on tracing of block requests, for the trace to be sent
+   to DEST at shutdown: "console", the default if DEST is null, or
+   "scratch".  Returns false if DEST is unknown.  Must be called
+   before any block device is registered. */
+bool
+block_set_trace (const char *dest)
+{
+  ASSERT (list_empty (&all_blocks));
+  if (dest == NULL || !strcmp (dest, "console"))
+    trace_dest = TRACE_CONSOLE;
+  else if (!strcmp (dest, "scratch"))
+    trace_dest = TRACE_SCRATCH;
+  else
+    return false;
+  return true;
+}
+
+/* Returns the subsystem whose requests go to block devices of
+   TYPE. */
+static const char *
+trace_subsystem (enum block_type type)
+{
+  return (type == BLOCK_FILESYS ? "cache"
+          : type == BLOCK_SWAP ? "swap"
+          : "raw");
+}
+
+/* Sends the requests in the trace ring, oldest first, where
+   block_set_trace() said, and stops tracing.
+
+   On the console, each record is a line
+   "blktrace: SEQ TICK DEV OP SECTOR CNT TID SUBSYSTEM".  On the
+   scratch device, sector 0 holds "BLKTRACE", the record count and
+   the record size as 32-bit numbers, and the records follow,
+   TRACE_PER_SECTOR to a sector, as struct trace_record. */
+void
+block_trace_dump (void)
+{
+  struct trace_record *ring = trace_ring;
+  uint32_t cnt = trace_seq < TRACE_CNT ? trace_seq : TRACE_CNT;
+  uint32_t first = trace_seq - cnt;
+  uint32_t i;
+
+  if (ring == NULL)
+    return;
+  trace_ring = NULL;
+
+  if (trace_dest == TRACE_CONSOLE)
+    {
+      printf ("blktrace: %"PRIu32" records, %"PRIu32" dropped\n",
+              cnt, first);
+      for (i = first; i != trace_seq; i++)
+        {
+          struct trace_record *t = &ring[i % TRACE_CNT];
+          printf ("blktrace: %"PRIu32" %"PRId64" %s %c %"PRDSNu" %u %d %s\n",
+                  t->seq, t->tick, t->dev, t->write ? 'W' : 'R',
+                  t->sector, (unsigned) t->cnt, t->tid,
+                  trace_subsystem (t->type));
+        }
+    }
+  else
+    {
+      struct block *scratch = block_get_role (BLOCK_SCRATCH);
+      uint8_t sector[BLOCK_SECTOR_SIZE];
+      uint32_t header[4] = {0, 0, cnt, sizeof (struct trace_record)};
+      block_sector_t sec_no = 0;
+
+      if (scratch == NULL)
+        {
+          printf ("blktrace: no scratch device\n");
+          goto done;
+        }
+      if (block_size (scratch) < 1 + DIV_ROUND_UP (cnt, TRACE_PER_SECTOR))
+        {
+          cnt = (block_size (scratch) - 1) * TRACE_PER_SECTOR;
+          header[2] = cnt;
+        }
+      memcpy (header, "BLKTRACE", 8);
+      memset (sector, 0, sizeof sector);
+      memcpy (sector, header, sizeof header);
+      block_write (scratch, sec_no++, sector);
+      for (i = 0; i < cnt; i++)
+        {
+          memcpy (sector + i % TRACE_PER_SECTOR * sizeof (struct trace_record),
+                  &ring[(trace_seq - cnt + i) % TRACE_CNT],
+                  sizeof (struct trace_record));
+          if ((i + 1) % TRACE_PER_SECTOR == 0 || i + 1 == cnt)
+            {
+              block_write (scratch, sec_no++, sector);
+              memset (sector, 0, sizeof sector);
+            }
+        }
+      printf ("blktrace: %"PRIu32" records written to %s\n",
+              cnt, block_name (scratch));
+    }
+ done:
+  palloc_free_multiple (ring, TRACE_PAGES);
 }
 
 /* Registers a new block device with the given NAME.  If
@@ -191,6 +758,12 @@ block_register (const char *name, enum block_type type,
   struct block *block = malloc (sizeof *block);
   if (block == NULL)
     PANIC ("Failed to allocate memory for block device descriptor");
+  if (trace_dest != TRACE_OFF && trace_ring == NULL && trace_seq == 0)
+    {
+      trace_ring = palloc_get_multiple (0, TRACE_PAGES);
+      if (trace_ring == NULL)
+        printf ("blktrace: not enough memory, tracing off\n");
+    }
 
   list_push_back (&all_blocks, &block->list_elem);
   strlcpy (block->name, name, sizeof block->name);
@@ -200,6 +773,22 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->next_sector = 0;
+  block->seq_cnt = 0;
+  block->random_cnt = 0;
+  memset (block->hist, 0, sizeof block->hist);
+  block->parent = NULL;
+  block->start = 0;
+  lock_init (&block->queue_lock);
+  cond_init (&block->queue_ready);
+  list_init (&block->queue);
+  block->head = 0;
+  block->worker = WORKER_NONE;
+  block->bounce = NULL;
+  block->request_cnt = 0;
+  block->merge_cnt = 0;
+  block->depth = 0;
+  block->peak_depth = 0;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -210,6 +799,17 @@ block_register (const char *name, enum block_type type,
 
   return block;
 }
+
+/* Makes BLOCK the range of sectors of PARENT starting at START,
+   so that requests for BLOCK are queued on PARENT's disk. */
+void
+block_set_parent (struct block *block, struct block *parent,
+                  block_sector_t start)
+{
+  ASSERT (list_empty (&block->queue));
+  block->parent = parent;
+  block->start = start;
+}
 
 /* Returns the block device corresponding to LIST_ELEM, or a null
    pointer if LIST_ELEM is the list end of all_blocks. */
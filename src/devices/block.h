@@ -1,8 +1,11 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,11 +56,66 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, void *,
+                          block_sector_t cnt);
+void block_write_multiple (struct block *, block_sector_t, const void *,
+                           block_sector_t cnt);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
+size_t block_queue_depth (struct block *);
+
+/* I/O priority classes, most urgent first.  A request's class is
+   that of the thread that submits it, foreground unless the
+   thread has called block_set_io_class(). */
+enum block_io_class
+  {
+    BLOCK_IO_FOREGROUND,        /* A thread is waiting for the data. */
+    BLOCK_IO_READAHEAD,         /* Read in case it is wanted soon. */
+    BLOCK_IO_WRITEBACK,         /* Dirty data written in the background. */
+    BLOCK_IO_CLASS_CNT
+  };
+
+void block_set_io_class (enum block_io_class);
+
+/* Asynchronous requests.
+
+   A request is queued on the disk that holds it and carried out
+   later by that disk's I/O thread, which orders the queue to
+   sweep the disk in one direction and merges requests for
+   adjacent sectors.  Requests of a more urgent class, and within
+   a class those of higher priority threads, are served first.
+   The synchronous functions above submit a request and wait for
+   it. */
+struct block_request
+  {
+    struct list_elem elem;      /* Element in a disk's queue. */
+    block_sector_t sector;      /* First sector, on the disk. */
+    void *buffer;               /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    block_sector_t cnt;         /* Number of sectors. */
+    bool write;                 /* From BUFFER to disk? */
+    int64_t submitted;          /* Timer tick when submitted. */
+    uint64_t submit_tsc;        /* Time-stamp counter when submitted. */
+    struct block *block;        /* Device it was submitted to. */
+    int ioprio;                 /* Serving order, lowest first. */
+
+    /* Called by the I/O thread once the request is complete, if
+       non-null.  Otherwise block_wait() returns. */
+    void (*done) (struct block_request *);
+    void *aux;                  /* For DONE's use. */
+    struct semaphore finished;  /* Up'd on completion if DONE is null. */
+  };
+
+void block_request_init (struct block_request *, bool write,
+                         block_sector_t, void *buffer, block_sector_t cnt);
+void block_submit (struct block *, struct block_request *);
+void block_wait (struct block_request *);
 
 /* Statistics. */
 void block_print_stats (void);
+
+/* Tracing. */
+bool block_set_trace (const char *dest);
+void block_trace_dump (void);
 
 /* Lower-level interface to block device drivers. */
 
@@ -65,10 +123,19 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional.  Transfer CNT consecutive sectors in one request;
+       null if the driver can only move a sector at a time. */
+    void (*read_multiple) (void *aux, block_sector_t, void *buffer,
+                           block_sector_t cnt);
+    void (*write_multiple) (void *aux, block_sector_t, const void *buffer,
+                            block_sector_t cnt);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+void block_set_parent (struct block *, struct block *parent,
+                       block_sector_t start);
 
 #endif /* devices/block.h */
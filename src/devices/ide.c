@@ -3,15 +3,25 @@
 #include <debug.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 #include "devices/block.h"
 #include "devices/partition.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   If the controller is a PCI bus master in legacy mode and the
+   disk supports DMA, transfers go by DMA: the controller moves
+   the data itself, following a table of physical regions, and
+   interrupts once at the end, so the CPU is free to run other
+   threads meanwhile.  Otherwise, and for buffers DMA cannot
+   reach, each sector is copied through the data register. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -30,10 +40,24 @@
 #define reg_ctl(CHANNEL) ((CHANNEL)->reg_base + 0x206)  /* Control (w/o). */
 #define reg_alt_status(CHANNEL) reg_ctl (CHANNEL)       /* Alt Status (r/o). */
 
+/* Bus master port addresses, per [SFF-8038i]. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
+/* Bus Master Command Register bits. */
+#define BMC_START 0x01          /* Start/stop the transfer. */
+#define BMC_READ 0x08           /* Write to memory, i.e. read the disk. */
+
+/* Bus Master Status Register bits.  Writing 1 clears them. */
+#define BMS_ERR 0x02            /* Transfer failed. */
+#define BMS_INTR 0x04           /* Disk raised its interrupt. */
+
 /* Alternate Status Register bits. */
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +73,40 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Most sectors one command can move, since the sector count
+   register holds 0 for 256. */
+#define MAX_XFER_SECTORS 256
+
+/* Most sectors per data block we ask for under READ/WRITE
+   MULTIPLE.  One page is all swap or the cache ever moves. */
+#define MAX_MULTIPLE 16
+
+/* PCI configuration space access. */
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+#define PCI_CMD_IO 0x0001       /* Command: respond to I/O ports. */
+#define PCI_CMD_MASTER 0x0004   /* Command: may act as bus master. */
+
+/* A physical region descriptor: one contiguous piece of a DMA
+   transfer, which must not cross a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address, even. */
+    uint16_t size;              /* Bytes, even, or 0 for 64 kB. */
+    uint16_t flags;             /* PRD_EOT in the table's last entry. */
+  };
+
+#define PRD_EOT 0x8000
+
+/* Entries per PRD table.  MAX_XFER_SECTORS sectors, 128 kB,
+   span at most three 64 kB regions. */
+#define PRD_CNT 4
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +115,9 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple;               /* Sectors per data block under READ/WRITE
+                                   MULTIPLE, or 0 if not enabled. */
+    bool dma;                   /* Transfer by DMA? */
   };
 
 /* An ATA channel (aka controller).
@@ -66,11 +127,14 @@ struct channel
     char name[8];               /* Name, e.g. "ide0". */
     uint16_t reg_base;          /* Base I/O port. */
     uint8_t irq;                /* Interrupt in use. */
+    uint16_t bm_base;           /* Bus master I/O base, or 0 if none. */
+    struct prd *prdt;           /* PRD table for DMA transfers. */
 
     struct lock lock;           /* Must acquire to access the controller. */
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
+    struct semaphore *probed;   /* Up'd when ide_init() probing is done. */
 
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
@@ -79,16 +143,30 @@ struct channel
 #define CHANNEL_CNT 2
 static struct channel channels[CHANNEL_CNT];
 
+/* Each channel's PRD table, aligned to its size so that it does
+   not cross a 64 kB boundary. */
+static struct prd prd_tables[CHANNEL_CNT][PRD_CNT]
+  __attribute__ ((aligned (PRD_CNT * sizeof (struct prd))));
+
 static struct block_operations ide_operations;
 
-static void reset_channel (struct channel *);
+static thread_func probe_channel;
+static bool reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
-static void issue_pio_command (struct channel *, uint8_t command);
-static void input_sector (struct channel *, void *);
-static void output_sector (struct channel *, const void *);
+static void set_multiple_mode (struct ata_disk *, int max);
+
+static uint16_t find_bus_master (void);
+static bool dma_transfer (struct ata_disk *, block_sector_t, void *,
+                          block_sector_t cnt, bool write);
+
+static void select_sector (struct ata_disk *, block_sector_t,
+                           block_sector_t cnt);
+static void issue_command (struct channel *, uint8_t command);
+static void input_sector (struct channel *, void *, block_sector_t cnt);
+static void output_sector (struct channel *, const void *,
+                           block_sector_t cnt);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
@@ -97,12 +175,22 @@ static void select_device_wait (const struct ata_disk *);
 
 static void interrupt_handler (struct intr_frame *);
 
-/* Initialize the disk subsystem and detect disks. */
+/* Initialize the disk subsystem and detect disks.
+
+   Resetting a channel takes at least 150 ms, and much longer for
+   a slow disk, so the channels are reset at the same time by a
+   thread each.  The disks found are then identified and
+   registered in a fixed order, so that their partitions are
+   found in the same order on every boot. */
 void
 ide_init (void) 
 {
+  uint16_t bm_base = find_bus_master ();
+  struct semaphore probed;
   size_t chan_no;
 
+  sema_init (&probed, 0);
+
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
     {
       struct channel *c = &channels[chan_no];
@@ -123,6 +211,8 @@ ide_init (void)
         default:
           NOT_REACHED ();
         }
+      c->bm_base = bm_base != 0 ? bm_base + chan_no * 8 : 0;
+      c->prdt = prd_tables[chan_no];
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
@@ -136,32 +226,54 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 0;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
       intr_register_ext (c->irq, interrupt_handler, c->name);
 
-      /* Reset hardware. */
-      reset_channel (c);
+      /* Reset hardware and find the disks, in the background if
+         possible. */
+      c->probed = &probed;
+      if (thread_create (c->name, PRI_DEFAULT, probe_channel, c) == TID_ERROR)
+        probe_channel (c);
+    }
 
-      /* Distinguish ATA hard disks from other devices. */
-      if (check_device_type (&c->devices[0]))
-        check_device_type (&c->devices[1]);
+  /* Read hard disk identity information. */
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    sema_down (&probed);
+  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
+    {
+      struct channel *c = &channels[chan_no];
+      int dev_no;
 
-      /* Read hard disk identity information. */
       for (dev_no = 0; dev_no < 2; dev_no++)
         if (c->devices[dev_no].is_ata)
           identify_ata_device (&c->devices[dev_no]);
     }
 }
+
+/* Resets channel C_ and distinguishes ATA hard disks on it from
+   other devices, then ups the channel's `probed' semaphore. */
+static void
+probe_channel (void *c_) 
+{
+  struct channel *c = c_;
+
+  if (reset_channel (c) && check_device_type (&c->devices[0]))
+    check_device_type (&c->devices[1]);
+  sema_up (c->probed);
+}
 
 /* Disk detection and identification. */
 
 static char *descramble_ata_string (char *, int size);
 
 /* Resets an ATA channel and waits for any devices present on it
-   to finish the reset. */
-static void
+   to finish the reset.  Returns false without waiting if no
+   device is present. */
+static bool
 reset_channel (struct channel *c) 
 {
   bool present[2];
@@ -187,6 +299,8 @@ reset_channel (struct channel *c)
       present[dev_no] = (inb (reg_nsect (c)) == 0x55
                          && inb (reg_lbal (c)) == 0xaa);
     }
+  if (!present[0] && !present[1])
+    return false;
 
   /* Issue soft reset sequence, which selects device 0 as a side effect.
      Also enable interrupts. */
@@ -219,6 +333,7 @@ reset_channel (struct channel *c)
         }
       wait_while_busy (&c->devices[1]);
     }
+  return true;
 }
 
 /* Checks whether device D is an ATA disk and sets D's is_ata
@@ -272,14 +387,14 @@ identify_ata_device (struct ata_disk *d)
      indicating the device's response is ready, and read the data
      into our buffer. */
   select_device_wait (d);
-  issue_pio_command (c, CMD_IDENTIFY_DEVICE);
+  issue_command (c, CMD_IDENTIFY_DEVICE);
   sema_down (&c->completion_wait);
   if (!wait_while_busy (d))
     {
       d->is_ata = false;
       return;
     }
-  input_sector (c, id);
+  input_sector (c, id, 1);
 
   /* Calculate capacity.
      Read model name and serial number. */
@@ -303,6 +418,15 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
+  /* Word 47 holds the most sectors per READ/WRITE MULTIPLE
+     block the disk supports. */
+  set_multiple_mode (d, *(uint16_t *) &id[47 * 2] & 0xff);
+
+  /* Bit 8 of word 49 says whether the disk supports DMA. */
+  d->dma = c->bm_base != 0 && (*(uint16_t *) &id[49 * 2] & 0x100) != 0;
+  if (d->dma)
+    strlcat (extra_info, ", DMA", sizeof extra_info);
+
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
@@ -336,6 +460,33 @@ descramble_ata_string (char *string, int size)
 
   return string;
 }
+
+/* Enables READ/WRITE MULTIPLE on disk D with the largest block
+   size that is a power of two, at most MAX and at most
+   MAX_MULTIPLE.  Leaves it disabled if MAX is 0 or the disk
+   refuses. */
+static void
+set_multiple_mode (struct ata_disk *d, int max)
+{
+  struct channel *c = d->channel;
+  int cnt;
+
+  d->multiple = 0;
+  if (max > MAX_MULTIPLE)
+    max = MAX_MULTIPLE;
+  if (max < 2)
+    return;
+  for (cnt = 1; cnt * 2 <= max; cnt *= 2)
+    continue;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), cnt);
+  issue_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if ((inb (reg_status (c)) & STA_ERR) == 0)
+    d->multiple = cnt;
+}
 
 /* Reads sector SEC_NO from disk D into BUFFER, which must have
    room for BLOCK_SECTOR_SIZE bytes.
@@ -347,12 +498,15 @@ ide_read (void *d_, block_sector_t sec_no, void *buffer)
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
+  if (!dma_transfer (d, sec_no, buffer, 1, false))
+    {
+      select_sector (d, sec_no, 1);
+      issue_command (c, CMD_READ_SECTOR_RETRY);
+      sema_down (&c->completion_wait);
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
+      input_sector (c, buffer, 1);
+    }
   lock_release (&c->lock);
 }
 
@@ -367,33 +521,129 @@ ide_write (void *d_, block_sector_t sec_no, const void *buffer)
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  if (!dma_transfer (d, sec_no, (void *) buffer, 1, true))
+    {
+      select_sector (d, sec_no, 1);
+      issue_command (c, CMD_WRITE_SECTOR_RETRY);
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
+      output_sector (c, buffer, 1);
+      sema_down (&c->completion_wait);
+    }
+  lock_release (&c->lock);
+}
+
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER.
+   Uses DMA if it can, with one interrupt per command.  Failing
+   that, uses READ MULTIPLE if it is enabled, so that the disk
+   interrupts once per block of D->multiple sectors, or else a
+   single READ SECTOR for all of them. */
+static void
+ide_read_multiple (void *d_, block_sector_t sec_no, void *buffer_,
+                   block_sector_t cnt)
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+  uint8_t *buffer = buffer_;
+  block_sector_t per_block = d->multiple > 0 ? d->multiple : 1;
+
+  lock_acquire (&c->lock);
+  while (cnt > 0)
+    {
+      block_sector_t xfer = cnt < MAX_XFER_SECTORS ? cnt : MAX_XFER_SECTORS;
+      block_sector_t done, n;
+
+      if (dma_transfer (d, sec_no, buffer, xfer, false))
+        {
+          buffer += xfer * BLOCK_SECTOR_SIZE;
+          sec_no += xfer;
+          cnt -= xfer;
+          continue;
+        }
+      select_sector (d, sec_no, xfer);
+      issue_command (c, (d->multiple > 0 ? CMD_READ_MULTIPLE
+                             : CMD_READ_SECTOR_RETRY));
+      for (done = 0; done < xfer; done += n)
+        {
+          n = xfer - done < per_block ? xfer - done : per_block;
+          sema_down (&c->completion_wait);
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                   d->name, sec_no + done);
+          input_sector (c, buffer, n);
+          buffer += n * BLOCK_SECTOR_SIZE;
+        }
+      sec_no += xfer;
+      cnt -= xfer;
+    }
+  lock_release (&c->lock);
+}
+
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER,
+   as ide_read_multiple() reads them.  Returns after the disk
+   has acknowledged receiving all of the data. */
+static void
+ide_write_multiple (void *d_, block_sector_t sec_no, const void *buffer_,
+                    block_sector_t cnt)
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+  const uint8_t *buffer = buffer_;
+  block_sector_t per_block = d->multiple > 0 ? d->multiple : 1;
+
+  lock_acquire (&c->lock);
+  while (cnt > 0)
+    {
+      block_sector_t xfer = cnt < MAX_XFER_SECTORS ? cnt : MAX_XFER_SECTORS;
+      block_sector_t done, n;
+
+      if (dma_transfer (d, sec_no, (void *) buffer, xfer, true))
+        {
+          buffer += xfer * BLOCK_SECTOR_SIZE;
+          sec_no += xfer;
+          cnt -= xfer;
+          continue;
+        }
+      select_sector (d, sec_no, xfer);
+      issue_command (c, (d->multiple > 0 ? CMD_WRITE_MULTIPLE
+                             : CMD_WRITE_SECTOR_RETRY));
+      for (done = 0; done < xfer; done += n)
+        {
+          n = xfer - done < per_block ? xfer - done : per_block;
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                   d->name, sec_no + done);
+          output_sector (c, buffer, n);
+          buffer += n * BLOCK_SECTOR_SIZE;
+          sema_down (&c->completion_wait);
+        }
+      sec_no += xfer;
+      cnt -= xfer;
+    }
   lock_release (&c->lock);
 }
 
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple
   };
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and CNT, at most MAX_XFER_SECTORS, to the disk's
+   sector selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, block_sector_t cnt)
 {
   struct channel *c = d->channel;
 
-  ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= MAX_XFER_SECTORS);
+  ASSERT (sec_no + cnt - 1 < (1UL << 28));
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_XFER_SECTORS ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -404,7 +654,7 @@ select_sector (struct ata_disk *d, block_sector_t sec_no)
 /* Writes COMMAND to channel C and prepares for receiving a
    completion interrupt. */
 static void
-issue_pio_command (struct channel *c, uint8_t command) 
+issue_command (struct channel *c, uint8_t command) 
 {
   /* Interrupts must be enabled or our semaphore will never be
      up'd by the completion handler. */
@@ -414,22 +664,147 @@ issue_pio_command (struct channel *c, uint8_t command)
   outb (reg_command (c), command);
 }
 
-/* Reads a sector from channel C's data register in PIO mode into
-   SECTOR, which must have room for BLOCK_SECTOR_SIZE bytes. */
+/* Reads CNT sectors from channel C's data register in PIO mode
+   into SECTOR, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes. */
 static void
-input_sector (struct channel *c, void *sector) 
+input_sector (struct channel *c, void *sector, block_sector_t cnt) 
 {
-  insw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  insw (reg_data (c), sector, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
-/* Writes SECTOR to channel C's data register in PIO mode.
-   SECTOR must contain BLOCK_SECTOR_SIZE bytes. */
+/* Writes CNT sectors to channel C's data register in PIO mode.
+   SECTOR must contain CNT * BLOCK_SECTOR_SIZE bytes. */
 static void
-output_sector (struct channel *c, const void *sector) 
+output_sector (struct channel *c, const void *sector, block_sector_t cnt) 
 {
-  outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  outsw (reg_data (c), sector, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
+/* Bus master DMA. */
+
+/* Returns the PCI configuration register REG of function FUNC
+   of device DEV on bus 0. */
+static uint32_t
+pci_read_config (int dev, int func, int reg)
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | dev << 11 | func << 8 | reg);
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Sets the PCI configuration register REG of function FUNC of
+   device DEV on bus 0 to DATA. */
+static void
+pci_write_config (int dev, int func, int reg, uint32_t data)
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | dev << 11 | func << 8 | reg);
+  outl (PCI_CONFIG_DATA, data);
+}
+
+/* Looks on PCI bus 0 for an IDE controller that can be a bus
+   master and drives both channels at the legacy ports, and
+   enables bus mastering on it.  Returns its bus master I/O base,
+   or 0 if there is none, in which case transfers use PIO. */
+static uint16_t
+find_bus_master (void)
+{
+  int dev, func;
+
+  for (dev = 0; dev < 32; dev++)
+    for (func = 0; func < 8; func++)
+      {
+        uint32_t class, bar4, cmd;
+
+        if ((pci_read_config (dev, func, 0x00) & 0xffff) == 0xffff)
+          continue;
+
+        /* Class 01h, subclass 01h: IDE.  Programming interface
+           bit 7 means bus master capable; bits 0 and 2 mean a
+           channel is in native mode, with other ports. */
+        class = pci_read_config (dev, func, 0x08);
+        if (class >> 16 != 0x0101 || (class & 0x8000) == 0
+            || (class & 0x0500) != 0)
+          continue;
+
+        /* BAR4 holds the bus master ports, in I/O space. */
+        bar4 = pci_read_config (dev, func, 0x20);
+        if ((bar4 & 1) == 0 || (bar4 & 0xfffc) == 0)
+          continue;
+
+        cmd = pci_read_config (dev, func, 0x04) & 0xffff;
+        pci_write_config (dev, func, 0x04,
+                          cmd | PCI_CMD_IO | PCI_CMD_MASTER);
+        return bar4 & 0xfffc;
+      }
+  return 0;
+}
+
+/* Fills channel C's PRD table to describe the SIZE bytes at
+   BUFFER.  Returns false if DMA cannot reach BUFFER: it is not
+   in the kernel's linear map of physical memory, is not
+   word-aligned, or is in too many pieces. */
+static bool
+build_prd_table (struct channel *c, const void *buffer, size_t size)
+{
+  struct prd *p = c->prdt;
+  uintptr_t phys;
+
+  if (!is_kernel_vaddr (buffer) || ((uintptr_t) buffer & 1) != 0)
+    return false;
+  phys = vtop (buffer);
+  while (size > 0)
+    {
+      size_t n = 0x10000 - (phys & 0xffff);
+      if (n > size)
+        n = size;
+      if (p == c->prdt + PRD_CNT)
+        return false;
+      p->addr = phys;
+      p->size = n;
+      p->flags = 0;
+      p++;
+      phys += n;
+      size -= n;
+    }
+  p[-1].flags = PRD_EOT;
+  return true;
+}
+
+/* Transfers CNT sectors, at most MAX_XFER_SECTORS, between
+   sector SEC_NO of disk D and BUFFER by DMA: to BUFFER if WRITE
+   is false, else from it.  Sleeps until the transfer completes.
+   Returns false, without touching the disk, if D or BUFFER
+   cannot use DMA.  C's lock must be held. */
+static bool
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, void *buffer,
+              block_sector_t cnt, bool write)
+{
+  struct channel *c = d->channel;
+  uint8_t dir = write ? 0 : BMC_READ;
+  uint8_t status;
+
+  if (!d->dma || !build_prd_table (c, buffer, cnt * BLOCK_SECTOR_SIZE))
+    return false;
+
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_command (c), dir);
+  outb (reg_bm_status (c), inb (reg_bm_status (c)) | BMS_ERR | BMS_INTR);
+
+  select_sector (d, sec_no, cnt);
+  issue_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (reg_bm_command (c), dir | BMC_START);
+  sema_down (&c->completion_wait);
+
+  status = inb (reg_bm_status (c));
+  outb (reg_bm_command (c), dir);
+  outb (reg_bm_status (c), status | BMS_ERR | BMS_INTR);
+  wait_while_busy (d);
+  if ((status & BMS_ERR) != 0 || (inb (reg_status (c)) & STA_ERR) != 0)
+    PANIC ("%s: disk %s failed, sector=%"PRDSNu,
+           d->name, write ? "write" : "read", sec_no);
+  return true;
+}
+
 /* Low-level ATA primitives. */
 
 /* Wait up to 10 seconds for the controller to become idle, that
@@ -1,11 +1,19 @@
 #include "devices/input.h"
 #include <debug.h>
+#include <string.h>
 #include "devices/intq.h"
 #include "devices/serial.h"
 
 /* Stores keys from the keyboard and serial port. */
 static struct intq buffer;
 
+/* Line discipline.  Keys are taken from BUFFER a batch at a time
+   into HELD, so that a read stopping at the end of a line leaves
+   the rest for the next one, in order. */
+static bool line_mode;                  /* Read a line at a time? */
+static uint8_t held[INTQ_BUFSIZE];      /* Keys taken but not read. */
+static size_t held_ofs, held_cnt;       /* Offset and count in HELD. */
+
 /* Initializes the input buffer. */
 void
 input_init (void) 
@@ -30,17 +38,74 @@ input_putc (uint8_t key)
 uint8_t
 input_getc (void) 
 {
-  enum intr_level old_level;
   uint8_t key;
 
-  old_level = intr_disable ();
-  key = intq_getc (&buffer);
-  serial_notify ();
-  intr_set_level (old_level);
-  
+  input_read (&key, 1);
   return key;
 }
 
+/* Selects whether input_read() works a line at a time. */
+void
+input_set_line_mode (bool enable) 
+{
+  line_mode = enable;
+}
+
+/* Retrieves up to SIZE keys from the input buffer into BUF and
+   returns the number retrieved.  Waits for at least one key if
+   none is buffered, then returns whatever is available.  In line
+   mode, instead waits until the keys end a line, with a carriage
+   return or new-line, or fill BUF.
+
+   Keys are taken a batch at a time with interrupts off and copied
+   to BUF with interrupts on, so BUF may be in user memory that is
+   not yet paged in. */
+size_t
+input_read (uint8_t *buf, size_t size) 
+{
+  size_t done = 0;
+
+  while (done < size) 
+    {
+      enum intr_level old_level;
+      uint8_t keys[INTQ_BUFSIZE];
+      size_t cnt, i;
+      bool eol = false;
+
+      old_level = intr_disable ();
+      if (held_cnt == 0)
+        {
+          if (done > 0 && !line_mode && intq_empty (&buffer))
+            {
+              intr_set_level (old_level);
+              break;
+            }
+          held_ofs = 0;
+          held_cnt = intq_read (&buffer, held, sizeof held);
+          serial_notify ();
+        }
+      cnt = held_cnt < size - done ? held_cnt : size - done;
+      if (line_mode)
+        for (i = 0; i < cnt; i++)
+          if (held[held_ofs + i] == '\r' || held[held_ofs + i] == '\n')
+            {
+              cnt = i + 1;
+              eol = true;
+              break;
+            }
+      memcpy (keys, held + held_ofs, cnt);
+      held_ofs += cnt;
+      held_cnt -= cnt;
+      intr_set_level (old_level);
+
+      memcpy (buf + done, keys, cnt);
+      done += cnt;
+      if (eol)
+        break;
+    }
+  return done;
+}
+
 /* Returns true if the input buffer is full,
    false otherwise.
    Interrupts must be off. */
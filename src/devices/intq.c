@@ -1,17 +1,19 @@
 #include "devices/intq.h"
 #include <debug.h>
+#include <string.h>
 #include "threads/thread.h"
 
 static int next (int pos);
-static void wait (struct intq *q, struct thread **waiter);
-static void signal (struct intq *q, struct thread **waiter);
+static size_t used (const struct intq *);
+static void wait (struct intq *q, struct list *waiters);
+static void signal (struct intq *q, struct list *waiters);
 
 /* Initializes interrupt queue Q. */
 void
 intq_init (struct intq *q) 
 {
-  lock_init (&q->lock);
-  q->not_full = q->not_empty = NULL;
+  list_init (&q->not_full);
+  list_init (&q->not_empty);
   q->head = q->tail = 0;
 }
 
@@ -31,49 +33,99 @@ intq_full (const struct intq *q)
   return next (q->head) == q->tail;
 }
 
-/* Removes a byte from Q and returns it.
-   If Q is empty, sleeps until a byte is added.
-   When called from an interrupt handler, Q must not be empty. */
-uint8_t
-intq_getc (struct intq *q) 
+/* Removes up to SIZE bytes from Q into BUF, as many as it holds,
+   and returns the number removed.  If Q is empty, sleeps until a
+   byte is added.  When called from an interrupt handler, Q must
+   not be empty. */
+size_t
+intq_read (struct intq *q, uint8_t *buf, size_t size) 
 {
-  uint8_t byte;
-  
+  size_t cnt = 0;
+
   ASSERT (intr_get_level () == INTR_OFF);
+  if (size == 0)
+    return 0;
   while (intq_empty (q)) 
     {
       ASSERT (!intr_context ());
-      lock_acquire (&q->lock);
       wait (q, &q->not_empty);
-      lock_release (&q->lock);
     }
-  
-  byte = q->buf[q->tail];
-  q->tail = next (q->tail);
+
+  /* Copy up to the end of the buffer, then from its start. */
+  while (cnt < size && !intq_empty (q))
+    {
+      size_t chunk = (q->head > q->tail ? q->head : INTQ_BUFSIZE) - q->tail;
+      if (chunk > size - cnt)
+        chunk = size - cnt;
+      memcpy (buf + cnt, q->buf + q->tail, chunk);
+      q->tail = (q->tail + chunk) % INTQ_BUFSIZE;
+      cnt += chunk;
+    }
+
   signal (q, &q->not_full);
-  return byte;
+  if (!intq_empty (q))
+    signal (q, &q->not_empty);
+  return cnt;
 }
 
-/* Adds BYTE to the end of Q.
-   If Q is full, sleeps until a byte is removed.
-   When called from an interrupt handler, Q must not be full. */
-void
-intq_putc (struct intq *q, uint8_t byte) 
+/* Adds up to SIZE bytes from BUF to the end of Q, as many as fit,
+   and returns the number added.  If Q is full, sleeps until a
+   byte is removed.  When called from an interrupt handler, Q must
+   not be full. */
+size_t
+intq_write (struct intq *q, const uint8_t *buf, size_t size) 
 {
+  size_t cnt = 0;
+
   ASSERT (intr_get_level () == INTR_OFF);
+  if (size == 0)
+    return 0;
   while (intq_full (q))
     {
       ASSERT (!intr_context ());
-      lock_acquire (&q->lock);
       wait (q, &q->not_full);
-      lock_release (&q->lock);
     }
 
-  q->buf[q->head] = byte;
-  q->head = next (q->head);
+  while (cnt < size && !intq_full (q))
+    {
+      size_t room = INTQ_BUFSIZE - 1 - used (q);
+      size_t chunk = INTQ_BUFSIZE - q->head;
+      if (chunk > room)
+        chunk = room;
+      if (chunk > size - cnt)
+        chunk = size - cnt;
+      memcpy (q->buf + q->head, buf + cnt, chunk);
+      q->head = (q->head + chunk) % INTQ_BUFSIZE;
+      cnt += chunk;
+    }
+
   signal (q, &q->not_empty);
+  if (!intq_full (q))
+    signal (q, &q->not_full);
+  return cnt;
+}
+
+/* Removes a byte from Q and returns it.
+   If Q is empty, sleeps until a byte is added.
+   When called from an interrupt handler, Q must not be empty. */
+uint8_t
+intq_getc (struct intq *q) 
+{
+  uint8_t byte;
+
+  intq_read (q, &byte, 1);
+  return byte;
 }
-
+
+/* Adds BYTE to the end of Q.
+   If Q is full, sleeps until a byte is removed.
+   When called from an interrupt handler, Q must not be full. */
+void
+intq_putc (struct intq *q, uint8_t byte) 
+{
+  intq_write (q, &byte, 1);
+}
+
 /* Returns the position after POS within an intq. */
 static int
 next (int pos) 
@@ -81,34 +133,40 @@ next (int pos)
   return (pos + 1) % INTQ_BUFSIZE;
 }
 
-/* WAITER must be the address of Q's not_empty or not_full
-   member.  Waits until the given condition is true. */
+/* Returns the number of bytes in Q. */
+static size_t
+used (const struct intq *q)
+{
+  return (q->head - q->tail + INTQ_BUFSIZE) % INTQ_BUFSIZE;
+}
+
+/* WAITERS must be Q's not_empty or not_full list.  Sleeps on it
+   until woken by signal(); the caller must check the condition
+   again. */
 static void
-wait (struct intq *q UNUSED, struct thread **waiter) 
+wait (struct intq *q UNUSED, struct list *waiters) 
 {
   ASSERT (!intr_context ());
   ASSERT (intr_get_level () == INTR_OFF);
-  ASSERT ((waiter == &q->not_empty && intq_empty (q))
-          || (waiter == &q->not_full && intq_full (q)));
+  ASSERT ((waiters == &q->not_empty && intq_empty (q))
+          || (waiters == &q->not_full && intq_full (q)));
 
-  *waiter = thread_current ();
+  list_push_back (waiters, &thread_current ()->elem);
   thread_block ();
 }
 
-/* WAITER must be the address of Q's not_empty or not_full
-   member, and the associated condition must be true.  If a
-   thread is waiting for the condition, wakes it up and resets
-   the waiting thread. */
+/* WAITERS must be Q's not_empty or not_full list, and the
+   associated condition must be true.  If a thread is waiting for
+   the condition, wakes up the one that has waited longest.  A
+   woken thread that leaves the condition true wakes the next. */
 static void
-signal (struct intq *q UNUSED, struct thread **waiter) 
+signal (struct intq *q UNUSED, struct list *waiters) 
 {
   ASSERT (intr_get_level () == INTR_OFF);
-  ASSERT ((waiter == &q->not_empty && !intq_empty (q))
-          || (waiter == &q->not_full && !intq_full (q)));
+  ASSERT ((waiters == &q->not_empty && !intq_empty (q))
+          || (waiters == &q->not_full && !intq_full (q)));
 
-  if (*waiter != NULL) 
-    {
-      thread_unblock (*waiter);
-      *waiter = NULL;
-    }
+  if (!list_empty (waiters))
+    thread_unblock (list_entry (list_pop_front (waiters),
+                                struct thread, elem));
 }
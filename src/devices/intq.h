@@ -1,8 +1,9 @@
 #ifndef DEVICES_INTQ_H
 #define DEVICES_INTQ_H
 
+#include <list.h>
+#include <stddef.h>
 #include "threads/interrupt.h"
-#include "threads/synch.h"
 
 /* An "interrupt queue", a circular buffer shared between
    kernel threads and external interrupt handlers.
@@ -15,7 +16,12 @@
    and condition variables from threads/synch.h cannot be used in
    this case, as they normally would, because they can only
    protect kernel threads from one another, not from interrupt
-   handlers. */
+   handlers.  Any number of threads may wait to read or to write;
+   each is woken in turn as the queue changes.
+
+   intq_read() and intq_write() move as many bytes as they can at
+   once, so a reader or writer of many bytes wakes and disables
+   interrupts once per batch rather than once per byte. */
 
 /* Queue buffer size, in bytes. */
 #define INTQ_BUFSIZE 64
@@ -23,10 +29,9 @@
 /* A circular queue of bytes. */
 struct intq
   {
-    /* Waiting threads. */
-    struct lock lock;           /* Only one thread may wait at once. */
-    struct thread *not_full;    /* Thread waiting for not-full condition. */
-    struct thread *not_empty;   /* Thread waiting for not-empty condition. */
+    /* Waiting threads, in the order they started waiting. */
+    struct list not_full;       /* Threads waiting for not-full condition. */
+    struct list not_empty;      /* Threads waiting for not-empty condition. */
 
     /* Queue. */
     uint8_t buf[INTQ_BUFSIZE];  /* Buffer. */
@@ -37,6 +42,8 @@ struct intq
 void intq_init (struct intq *);
 bool intq_empty (const struct intq *);
 bool intq_full (const struct intq *);
+size_t intq_read (struct intq *, uint8_t *, size_t);
+size_t intq_write (struct intq *, const uint8_t *, size_t);
 uint8_t intq_getc (struct intq *);
 void intq_putc (struct intq *, uint8_t);
 
@@ -0,0 +1,135 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A block device held in memory.
+
+   The disk's sectors live in pages from the kernel pool, which
+   need not be contiguous, so an array maps each run of
+   SECTORS_PER_PAGE sectors to its page.  Starting zeroed, the
+   disk must be formatted or filled before it is useful, and its
+   contents are lost at power off.  It registers as BLOCK_RAW, so
+   it takes a role only when named, e.g. -filesys=ram0. */
+
+/* Sectors in one page. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Size to create, in kB, set by -ramdisk; 0 means no ramdisk. */
+static size_t ramdisk_kb;
+
+/* Pages holding the disk's sectors, and how many there are. */
+static uint8_t **ramdisk_pages;
+static size_t ramdisk_page_cnt;
+
+static struct block_operations ramdisk_operations;
+
+/* Sets the size of the ramdisk ramdisk_init() creates to KB
+   kilobytes, rounded up to whole pages. */
+void
+ramdisk_set_size (size_t kb)
+{
+  ramdisk_kb = kb;
+}
+
+/* Creates and registers the ramdisk as "ram0", if a size was
+   set.  Panics if the kernel pool cannot hold it. */
+void
+ramdisk_init (void)
+{
+  size_t i;
+
+  if (ramdisk_kb == 0)
+    return;
+
+  ramdisk_page_cnt = DIV_ROUND_UP (ramdisk_kb * 1024, PGSIZE);
+  ramdisk_pages = malloc (ramdisk_page_cnt * sizeof *ramdisk_pages);
+  if (ramdisk_pages == NULL)
+    PANIC ("ramdisk: not enough memory for page table");
+  for (i = 0; i < ramdisk_page_cnt; i++)
+    {
+      ramdisk_pages[i] = palloc_get_page (PAL_ZERO);
+      if (ramdisk_pages[i] == NULL)
+        PANIC ("ramdisk: not enough kernel memory for %zu kB",
+               ramdisk_kb);
+    }
+
+  block_register ("ram0", BLOCK_RAW, "ramdisk",
+                  ramdisk_page_cnt * SECTORS_PER_PAGE,
+                  &ramdisk_operations, NULL);
+}
+
+/* Returns the address of SECTOR's data. */
+static uint8_t *
+sector_addr (block_sector_t sector)
+{
+  ASSERT (sector / SECTORS_PER_PAGE < ramdisk_page_cnt);
+  return (ramdisk_pages[sector / SECTORS_PER_PAGE]
+          + sector % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE);
+}
+
+/* Reads CNT sectors starting at SECTOR into BUFFER, copying up
+   to a page at a time. */
+static void
+ramdisk_read_multiple (void *aux UNUSED, block_sector_t sector,
+                       void *buffer_, block_sector_t cnt)
+{
+  uint8_t *buffer = buffer_;
+
+  while (cnt > 0)
+    {
+      block_sector_t chunk = SECTORS_PER_PAGE - sector % SECTORS_PER_PAGE;
+      if (chunk > cnt)
+        chunk = cnt;
+      memcpy (buffer, sector_addr (sector), chunk * BLOCK_SECTOR_SIZE);
+      buffer += chunk * BLOCK_SECTOR_SIZE;
+      sector += chunk;
+      cnt -= chunk;
+    }
+}
+
+/* Writes CNT sectors from BUFFER starting at SECTOR. */
+static void
+ramdisk_write_multiple (void *aux UNUSED, block_sector_t sector,
+                        const void *buffer_, block_sector_t cnt)
+{
+  const uint8_t *buffer = buffer_;
+
+  while (cnt > 0)
+    {
+      block_sector_t chunk = SECTORS_PER_PAGE - sector % SECTORS_PER_PAGE;
+      if (chunk > cnt)
+        chunk = cnt;
+      memcpy (sector_addr (sector), buffer, chunk * BLOCK_SECTOR_SIZE);
+      buffer += chunk * BLOCK_SECTOR_SIZE;
+      sector += chunk;
+      cnt -= chunk;
+    }
+}
+
+/* Reads SECTOR into BUFFER. */
+static void
+ramdisk_read (void *aux, block_sector_t sector, void *buffer)
+{
+  ramdisk_read_multiple (aux, sector, buffer, 1);
+}
+
+/* Writes BUFFER to SECTOR. */
+static void
+ramdisk_write (void *aux, block_sector_t sector, const void *buffer)
+{
+  ramdisk_write_multiple (aux, sector, buffer, 1);
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    ramdisk_read_multiple,
+    ramdisk_write_multiple
+  };
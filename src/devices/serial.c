@@ -1,12 +1,15 @@
 #include "devices/serial.h"
 #include <debug.h>
+#include <list.h>
+#include <string.h>
 #include "devices/input.h"
-#include "devices/intq.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* Register definitions for the 16550A UART used in PCs.
    The 16550A has a lot more going on than shown here, but this
@@ -37,6 +40,15 @@
 #define IER_RECV 0x01           /* Interrupt when data received. */
 #define IER_XMIT 0x02           /* Interrupt when transmit finishes. */
 
+/* FIFO Control Register bits. */
+#define FCR_ENABLE 0x01         /* Enable the FIFOs. */
+#define FCR_CLEAR_RX 0x02       /* Empty the receive FIFO. */
+#define FCR_CLEAR_TX 0x04       /* Empty the transmit FIFO. */
+#define FCR_TRIGGER_8 0x80      /* Receive interrupt at 8 bytes. */
+
+/* Interrupt Identification Register bits. */
+#define IIR_FIFO 0xc0           /* Both set when the FIFOs are enabled. */
+
 /* Line Control Register bits. */
 #define LCR_N81 0x03            /* No parity, 8 data bits, 1 stop bit. */
 #define LCR_DLAB 0x80           /* Divisor Latch Access Bit (DLAB). */
@@ -48,12 +60,50 @@
 #define LSR_DR 0x01             /* Data Ready: received data byte is in RBR. */
 #define LSR_THRE 0x20           /* THR Empty. */
 
+/* Depth of the 16550A's transmit FIFO. */
+#define FIFO_DEPTH 16
+
 /* Transmission mode. */
 static enum { UNINIT, POLL, QUEUE } mode;
 
-/* Data to be transmitted. */
-static struct intq txq;
-
+/* Bytes written to the transmit FIFO per THR Empty interrupt:
+   FIFO_DEPTH once the FIFOs are on, or 1 if the UART has none. */
+static int xmit_batch = 1;
+
+/* Data to be transmitted, in a ring drained by the transmit
+   interrupt.  It is much larger than an intq, so that a burst of
+   console output is queued and the writer goes on at once.  The
+   size is a power of 2: TXQ_DEFAULT bytes of static storage, or
+   whatever -serial-buf asked for, in pages taken by
+   serial_init_queue(). */
+#define TXQ_DEFAULT 4096
+#define TXQ_MIN 256
+#define TXQ_MAX (64 * 1024)
+static uint8_t txq_default[TXQ_DEFAULT];
+static uint8_t *txq = txq_default;
+static size_t txq_size = TXQ_DEFAULT;
+static size_t txq_request;              /* Size from -serial-buf, or 0. */
+static size_t txq_head;                 /* Next byte to queue. */
+static size_t txq_tail;                 /* Next byte to send. */
+
+/* Threads sleeping until the transmit ring has room. */
+static struct list txq_waiters;
+
+/* Bytes received, in a ring of their own, until there is room
+   for them in the input buffer.  The input buffer is a small
+   intq shared with the keyboard; keeping the receive interrupt
+   on while it is full, instead of letting the UART's FIFO
+   overrun, keeps a burst of input from being lost. */
+#define RXQ_SIZE 1024
+static uint8_t rxq[RXQ_SIZE];
+static size_t rxq_head;                 /* Next byte to store. */
+static size_t rxq_tail;                 /* Next byte for the input buffer. */
+
+static size_t txq_used (void);
+static bool txq_empty (void);
+static uint8_t txq_getc (void);
+static bool rxq_full (void);
+static void rxq_deliver (void);
 static void set_serial (int bps);
 static void putc_poll (uint8_t);
 static void write_ier (void);
@@ -71,10 +121,28 @@ init_poll (void)
   outb (FCR_REG, 0);                    /* Disable FIFO. */
   set_serial (9600);                    /* 9.6 kbps, N-8-1. */
   outb (MCR_REG, MCR_OUT2);             /* Required to enable interrupts. */
-  intq_init (&txq);
+  txq_head = txq_tail = 0;
+  rxq_head = rxq_tail = 0;
+  list_init (&txq_waiters);
   mode = POLL;
 } 
 
+/* Asks for a transmit ring of SIZE bytes, rounded up to a power
+   of 2, in place of the default, from when serial_init_queue()
+   is called.  Returns false if SIZE is out of range. */
+bool
+serial_set_buffer_size (size_t size)
+{
+  size_t request = TXQ_MIN;
+
+  if (size == 0 || size > TXQ_MAX)
+    return false;
+  while (request < size)
+    request *= 2;
+  txq_request = request;
+  return true;
+}
+
 /* Initializes the serial port device for queued interrupt-driven
    I/O.  With interrupt-driven I/O we don't waste CPU time
    waiting for the serial device to become ready. */
@@ -87,6 +155,30 @@ serial_init_queue (void)
     init_poll ();
   ASSERT (mode == POLL);
 
+  /* The ring is empty while polling, so it can be swapped now.
+     Without the pages, the default ring will do. */
+  if (txq_request > TXQ_DEFAULT)
+    {
+      uint8_t *ring = palloc_get_multiple (0, txq_request / PGSIZE);
+      if (ring != NULL)
+        {
+          txq = ring;
+          txq_size = txq_request;
+        }
+    }
+  else if (txq_request != 0)
+    txq_size = txq_request;
+
+  /* Turn the FIFOs on, so that one transmit interrupt can send
+     FIFO_DEPTH bytes and one receive interrupt can take several.
+     A lone byte received still interrupts, after a few character
+     times. */
+  outb (FCR_REG, FCR_ENABLE | FCR_CLEAR_RX | FCR_CLEAR_TX | FCR_TRIGGER_8);
+  if ((inb (IIR_REG) & IIR_FIFO) == IIR_FIFO)
+    xmit_batch = FIFO_DEPTH;
+  else
+    outb (FCR_REG, 0);
+
   intr_register_ext (0x20 + 4, serial_interrupt, "serial");
   mode = QUEUE;
   old_level = intr_disable ();
@@ -97,32 +189,67 @@ serial_init_queue (void)
 /* Sends BYTE to the serial port. */
 void
 serial_putc (uint8_t byte) 
+{
+  serial_write (&byte, 1);
+}
+
+/* Sends the SIZE bytes in BUFFER to the serial port.  In queued
+   mode they are only copied into the transmit ring, as many at a
+   time as fit, with interrupts disabled once for the lot, and the
+   interrupt enable register is updated once at the end rather
+   than per byte. */
+void
+serial_write (const uint8_t *buffer, size_t size) 
 {
   enum intr_level old_level = intr_disable ();
 
   if (mode != QUEUE)
     {
       /* If we're not set up for interrupt-driven I/O yet,
-         use dumb polling to transmit a byte. */
+         use dumb polling to transmit the bytes. */
       if (mode == UNINIT)
         init_poll ();
-      putc_poll (byte); 
+      while (size-- > 0)
+        putc_poll (*buffer++); 
     }
   else 
     {
-      /* Otherwise, queue a byte and update the interrupt enable
-         register. */
-      if (old_level == INTR_OFF && intq_full (&txq)) 
+      while (size > 0)
         {
-          /* Interrupts are off and the transmit queue is full.
-             If we wanted to wait for the queue to empty,
-             we'd have to reenable interrupts.
-             That's impolite, so we'll send a character via
-             polling instead. */
-          putc_poll (intq_getc (&txq)); 
+          size_t room = txq_size - 1 - txq_used ();
+          size_t chunk;
+
+          if (room == 0)
+            {
+              if (old_level == INTR_OFF || intr_context ())
+                {
+                  /* Interrupts are off and the transmit queue is
+                     full.  If we wanted to wait for the queue to
+                     empty, we'd have to reenable interrupts.
+                     That's impolite, so we'll send a character
+                     via polling instead. */
+                  putc_poll (txq_getc ()); 
+                }
+              else
+                {
+                  /* Sleep until the interrupt handler has sent
+                     some of the queue. */
+                  write_ier ();
+                  list_push_back (&txq_waiters, &thread_current ()->elem);
+                  thread_block ();
+                }
+              continue;
+            }
+
+          /* Copy as much as fits before the ring wraps. */
+          chunk = size < room ? size : room;
+          if (chunk > txq_size - txq_head)
+            chunk = txq_size - txq_head;
+          memcpy (txq + txq_head, buffer, chunk);
+          txq_head = (txq_head + chunk) & (txq_size - 1);
+          buffer += chunk;
+          size -= chunk;
         }
-
-      intq_putc (&txq, byte); 
       write_ier ();
     }
   
@@ -135,12 +262,13 @@ void
 serial_flush (void) 
 {
   enum intr_level old_level = intr_disable ();
-  while (!intq_empty (&txq))
-    putc_poll (intq_getc (&txq));
+  while (!txq_empty ())
+    putc_poll (txq_getc ());
   intr_set_level (old_level);
 }
 
-/* The fullness of the input buffer may have changed.  Reassess
+/* The fullness of the input buffer may have changed.  Moves any
+   bytes waiting in the receive ring into it, and reassesses
    whether we should block receive interrupts.
    Called by the input buffer routines when characters are added
    to or removed from the buffer. */
@@ -149,7 +277,10 @@ serial_notify (void)
 {
   ASSERT (intr_get_level () == INTR_OFF);
   if (mode == QUEUE)
-    write_ier ();
+    {
+      rxq_deliver ();
+      write_ier ();
+    }
 }
 
 /* Configures the serial port for BPS bits per second. */
@@ -182,12 +313,12 @@ write_ier (void)
 
   /* Enable transmit interrupt if we have any characters to
      transmit. */
-  if (!intq_empty (&txq))
+  if (!txq_empty ())
     ier |= IER_XMIT;
 
   /* Enable receive interrupt if we have room to store any
      characters we receive. */
-  if (!input_full ())
+  if (!rxq_full ())
     ier |= IER_RECV;
   
   outb (IER_REG, ier);
@@ -214,15 +345,87 @@ serial_interrupt (struct intr_frame *f UNUSED)
   inb (IIR_REG);
 
   /* As long as we have room to receive a byte, and the hardware
-     has a byte for us, receive a byte.  */
-  while (!input_full () && (inb (LSR_REG) & LSR_DR) != 0)
-    input_putc (inb (RBR_REG));
+     has a byte for us, receive a byte, then pass on what the
+     input buffer has room for.  */
+  while (!rxq_full () && (inb (LSR_REG) & LSR_DR) != 0)
+    {
+      rxq[rxq_head] = inb (RBR_REG);
+      rxq_head = (rxq_head + 1) % RXQ_SIZE;
+    }
+  rxq_deliver ();
+
+  /* THR Empty means the whole transmit FIFO is, so fill it
+     without asking again before each byte. */
+  if (!txq_empty () && (inb (LSR_REG) & LSR_THRE) != 0)
+    {
+      int i;
+      for (i = 0; i < xmit_batch && !txq_empty (); i++)
+        outb (THR_REG, txq_getc ());
+    }
 
-  /* As long as we have a byte to transmit, and the hardware is
-     ready to accept a byte for transmission, transmit a byte. */
-  while (!intq_empty (&txq) && (inb (LSR_REG) & LSR_THRE) != 0) 
-    outb (THR_REG, intq_getc (&txq));
+  /* Wake up writers waiting for room in the queue once it is
+     half empty, so that they do not wake for every byte sent. */
+  while (txq_used () < txq_size / 2 && !list_empty (&txq_waiters))
+    thread_unblock (list_entry (list_pop_front (&txq_waiters),
+                                struct thread, elem));
 
   /* Update interrupt enable register based on queue status. */
   write_ier ();
 }
+
+/* Returns the number of bytes in the transmit ring. */
+static size_t
+txq_used (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  return (txq_head - txq_tail) & (txq_size - 1);
+}
+
+/* Returns true if the transmit ring is empty. */
+static bool
+txq_empty (void) 
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  return txq_head == txq_tail;
+}
+
+/* Removes and returns the next byte to transmit. */
+static uint8_t
+txq_getc (void) 
+{
+  uint8_t byte;
+
+  ASSERT (!txq_empty ());
+  byte = txq[txq_tail];
+  txq_tail = (txq_tail + 1) & (txq_size - 1);
+  return byte;
+}
+
+/* Returns true if the receive ring has no room for another byte. */
+static bool
+rxq_full (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  return (rxq_head + 1) % RXQ_SIZE == rxq_tail;
+}
+
+/* Moves bytes from the receive ring into the input buffer while
+   it has room.  input_putc() calls back into serial_notify(), so
+   calls made meanwhile return at once. */
+static void
+rxq_deliver (void)
+{
+  static bool delivering;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  if (delivering)
+    return;
+  delivering = true;
+  while (rxq_tail != rxq_head && !input_full ())
+    {
+      uint8_t byte = rxq[rxq_tail];
+      rxq_tail = (rxq_tail + 1) % RXQ_SIZE;
+      input_putc (byte);
+    }
+  delivering = false;
+}
@@ -4,14 +4,28 @@
 #include "devices/kbd.h"
 #include "devices/serial.h"
 #include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/io.h"
+#include "threads/ktrace.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/workqueue.h"
 #ifdef USERPROG
 #include "userprog/exception.h"
+#include "userprog/syscall.h"
 #endif
 #ifdef FILESYS
 #include "devices/block.h"
 #include "filesys/filesys.h"
+#include "filesys/cache.h"
+#include "filesys/journal.h"
+#endif
+#ifdef VM
+#include "vm/swap.h"
+#include "vm/zswap.h"
 #endif
 
 /* Keyboard control register port. */
@@ -20,6 +34,7 @@
 /* How to shut down when shutdown() is called. */
 static enum shutdown_type how = SHUTDOWN_NONE;
 
+static void power_off (void) NO_RETURN;
 static void print_stats (void);
 
 /* Shuts down the machine in the way configured by
@@ -87,12 +102,27 @@ shutdown_reboot (void)
 void
 shutdown_power_off (void)
 {
-  const char s[] = "Shutdown";
-  const char *p;
-
 #ifdef FILESYS
   filesys_done ();
 #endif
+  power_off ();
+}
+
+/* Powers down at once, without shutting down the file system, so
+   that the disk is left as a power failure would leave it.  For
+   testing crash recovery. */
+void
+shutdown_crash (void)
+{
+  power_off ();
+}
+
+/* Prints statistics and powers off. */
+static void
+power_off (void)
+{
+  const char s[] = "Shutdown";
+  const char *p;
 
   print_stats ();
 
@@ -130,12 +160,27 @@ print_stats (void)
 {
   timer_print_stats ();
   thread_print_stats ();
+  intr_print_stats ();
+  palloc_print_stats ();
+  lock_print_stats ();
+  malloc_print_stats ();
+  slab_print_stats ();
+  workqueue_print_stats ();
+  ktrace_dump ();
 #ifdef FILESYS
   block_print_stats ();
+  block_trace_dump ();
+  cache_print_stats ();
+  journal_print_stats ();
+#endif
+#ifdef VM
+  swap_print_stats ();
+  zswap_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
 #ifdef USERPROG
   exception_print_stats ();
+  syscall_print_stats ();
 #endif
 }
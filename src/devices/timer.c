@@ -7,6 +7,9 @@
 #include "threads/interrupt.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
+#ifdef USERPROG
+#include "userprog/uinfo.h"
+#endif
   
 /* See [8254] for hardware details of the 8254 timer chip. */
 
@@ -20,32 +23,189 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* Timer wheel of pending events.  An event expiring at tick T
+   lives in slot T % TIMER_WHEEL_SLOTS, so arming and cancelling
+   are O(1) and each tick only looks at one slot; events more than
+   one revolution away stay in their slot until their tick comes
+   round.  Protected by disabling interrupts. */
+#define TIMER_WHEEL_SLOTS 256
+static struct list timer_wheel[TIMER_WHEEL_SLOTS];
+
+/* Ticks at which the periodic work of timer_tick() is next due,
+   so that a tick with nothing due costs one comparison.  No wheel
+   event expires before NEXT_EVENT_TICK, though there may be none
+   at it, if the event it was set for has been cancelled; the
+   MLFQS next recomputes priorities or the load average at
+   NEXT_MLFQS_TICK; NEXT_DUE is the earlier of the two.  Protected
+   by disabling interrupts. */
+static int64_t next_event_tick = INT64_MAX;
+static int64_t next_mlfqs_tick = INT64_MAX;
+static int64_t next_due = INT64_MAX;
+
+/* Tickless mode.  Instead of a periodic interrupt, channel 0
+   runs one-shot countdowns reprogrammed by every interrupt.
+   While the CPU is idle the countdown is stretched over several
+   ticks up to the next due event, and sub-tick sleeps get a
+   countdown of their own instead of busy-waiting.  `ticks' keeps
+   advancing in whole ticks; skipped ticks are replayed when the
+   interrupt finally arrives. */
+#define PIT_TICK ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+static bool tickless;
+static int64_t now_cycles;      /* PIT cycles up to the countdown's start. */
+static uint16_t programmed;     /* Length of the countdown running now. */
+static bool idle_stretch;       /* Countdown spans skipped idle ticks? */
+static struct list hires_list;  /* Sub-tick events, soonest first. */
+
+/* Sampling profiler, turned on by -prof.  Each tick records the
+   kernel code address the timer interrupted in PROFILE, an open
+   addressing table from address to sample count.  Samples from
+   user mode, and addresses that find the table full, are only
+   counted.  timer_print_stats() prints the table for
+   utils/pintos-prof to symbolize. */
+#define PROFILE_SLOTS 4096
+struct profile_slot
+  {
+    uintptr_t eip;              /* Interrupted address, or 0 if empty. */
+    unsigned cnt;               /* Samples at EIP. */
+  };
+static bool profiling;
+static struct profile_slot profile[PROFILE_SLOTS];
+static unsigned long long profile_cnt;      /* All samples. */
+static unsigned long long profile_user_cnt; /* Samples in user mode. */
+static unsigned long long profile_lost_cnt; /* Samples with no slot. */
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* Nanosecond clock.  timer_calibrate() counts CPU cycles over
+   TSC_CALIBRATE_TICKS ticks, and then timer_tsc_to_ns() converts
+   cycles to nanoseconds as (CYCLES * tsc_mult) >> tsc_shift, with
+   no division.  Until then, timer_ns() counts whole ticks. */
+#define TSC_CALIBRATE_TICKS 5
+#define NS_PER_TICK (1000000000 / TIMER_FREQ)
+static uint64_t tsc_hz;         /* Cycles per second, 0 if uncalibrated. */
+static uint32_t tsc_mult;       /* Nanoseconds per cycle << tsc_shift. */
+static int tsc_shift;
+static uint64_t tsc_base;       /* Cycle counter at a tick boundary... */
+static uint64_t tsc_base_ns;    /* ...and the time of that boundary. */
+
+/* Calibration from an earlier boot, given by -timer-cal, or 0 to
+   measure. */
+static unsigned given_loops_per_tick;
+static uint32_t given_cycles_per_tick;
+
 static intr_handler_func timer_interrupt;
+static void calibrate_tsc (void);
+static void set_tsc_rate (uint64_t hz, uint64_t tsc, int64_t tick);
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
+static void timer_run_events (void);
+static void timer_run_due (void);
+static int64_t mlfqs_next (int64_t after);
+static void timer_wake_thread (void *thread);
+static void timer_tick (bool idle);
+static void timer_program_next (void);
+static int64_t timer_cycles (void);
+static void timer_hires_sleep (int64_t cycles);
+static void profile_sample (const struct intr_frame *, unsigned weight);
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
 void
 timer_init (void) 
 {
-  pit_configure_channel (0, 2, TIMER_FREQ);
+  size_t i;
+
+  for (i = 0; i < TIMER_WHEEL_SLOTS; i++)
+    list_init (&timer_wheel[i]);
+  list_init (&hires_list);
+  if (thread_mlfqs)
+    next_mlfqs_tick = next_due = mlfqs_next (ticks);
+  if (tickless)
+    {
+      programmed = PIT_TICK;
+      pit_start_oneshot (0, programmed);
+    }
+  else
+    pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
 
-/* Calibrates loops_per_tick, used to implement brief delays. */
+/* Selects tickless mode.  Must be called before timer_init(). */
+void
+timer_set_tickless (bool enable)
+{
+  tickless = enable;
+}
+
+/* Selects sampling profiling of the kernel on each tick. */
+void
+timer_set_profiling (bool enable)
+{
+  profiling = enable;
+}
+
+/* Called by the scheduler, with interrupts off, when the idle
+   thread is about to hand the CPU to a thread that became ready.
+   Cuts a stretched idle countdown short so that the skipped ticks
+   are replayed, and normal ticking resumes, right away. */
+void
+timer_idle_exit (void)
+{
+  bool expired;
+  uint16_t count;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!idle_stretch)
+    return;
+
+  /* If the countdown has expired, or is about to, its interrupt
+     is already on the way. */
+  count = pit_read_counter (0, &expired);
+  if (expired || count < PIT_TICK / 16)
+    return;
+  now_cycles += programmed - count;
+  programmed = 1;
+  pit_start_oneshot (0, programmed);
+}
+
+/* Makes timer_calibrate() use LOOPS_PER_TICK and CYCLES_PER_TICK,
+   as printed by an earlier boot on the same machine, instead of
+   spending a quarter second or so measuring them.  Must be called
+   before timer_calibrate(). */
+void
+timer_set_calibration (unsigned loops_per_tick, uint32_t cycles_per_tick)
+{
+  ASSERT (loops_per_tick > 0 && cycles_per_tick > 0);
+
+  given_loops_per_tick = loops_per_tick;
+  given_cycles_per_tick = cycles_per_tick;
+}
+
+/* Calibrates loops_per_tick, used to implement brief delays, and
+   the CPU cycle counter, used by timer_ns(). */
 void
 timer_calibrate (void) 
 {
   unsigned high_bit, test_bit;
 
   ASSERT (intr_get_level () == INTR_ON);
+
+  if (given_loops_per_tick != 0)
+    {
+      loops_per_tick = given_loops_per_tick;
+      set_tsc_rate ((uint64_t) given_cycles_per_tick * TIMER_FREQ,
+                    timer_tsc (), timer_ticks ());
+      printf ("Timer calibration given: %'"PRIu64" loops/s, "
+              "%'"PRIu64" cycles/s.\n",
+              (uint64_t) loops_per_tick * TIMER_FREQ, tsc_hz);
+      return;
+    }
+
   printf ("Calibrating timer...  ");
 
   /* Approximate loops_per_tick as the largest power-of-two
@@ -63,7 +223,42 @@ timer_calibrate (void)
     if (!too_many_loops (high_bit | test_bit))
       loops_per_tick |= test_bit;
 
-  printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
+  printf ("%'"PRIu64" loops/s, ", (uint64_t) loops_per_tick * TIMER_FREQ);
+
+  calibrate_tsc ();
+  printf ("%'"PRIu64" cycles/s (-timer-cal=%u,%"PRIu64").\n",
+          tsc_hz, loops_per_tick, tsc_hz / TIMER_FREQ);
+}
+
+/* Returns the number of nanoseconds since the OS booted.  Fine
+   grained after timer_calibrate(), which the time is not allowed
+   to go back across. */
+uint64_t
+timer_ns (void) 
+{
+  if (tsc_hz == 0)
+    return timer_ticks () * NS_PER_TICK;
+  return tsc_base_ns + timer_tsc_to_ns (timer_tsc () - tsc_base);
+}
+
+/* Converts CYCLES of the CPU cycle counter, as differences of
+   timer_tsc() values, to nanoseconds.  Returns 0 before
+   timer_calibrate(). */
+uint64_t
+timer_tsc_to_ns (uint64_t cycles) 
+{
+  uint32_t high = cycles >> 32, low = cycles;
+
+  return ((((uint64_t) high * tsc_mult) << (32 - tsc_shift))
+          + (((uint64_t) low * tsc_mult) >> tsc_shift));
+}
+
+/* Returns the number of CPU cycles per second, or 0 before
+   timer_calibrate(). */
+uint64_t
+timer_tsc_hz (void) 
+{
+  return tsc_hz;
 }
 
 /* Returns the number of timer ticks since the OS booted. */
@@ -92,10 +287,20 @@ timer_sleep (int64_t ticks)
   if (ticks <= 0) return;
 
   ASSERT (intr_get_level () == INTR_ON);
+  struct timer_event event;
+  timer_event_init (&event, timer_wake_thread, thread_current ());
+
   enum intr_level old_level = intr_disable ();
-  thread_sleep (ticks);
+  timer_event_add (&event, timer_ticks () + ticks);
+  thread_block ();
   intr_set_level (old_level);
+}
 
+/* Timer event callback for timer_sleep(). */
+static void
+timer_wake_thread (void *thread)
+{
+  thread_unblock (thread);
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -165,28 +370,356 @@ timer_ndelay (int64_t ns)
 void
 timer_print_stats (void) 
 {
+  size_t i;
+
   printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
+  if (!profiling)
+    return;
+  printf ("Profile: %llu samples, %llu in user mode, %llu lost\n",
+          profile_cnt, profile_user_cnt, profile_lost_cnt);
+  for (i = 0; i < PROFILE_SLOTS; i++)
+    if (profile[i].eip != 0)
+      printf ("Profile sample: %#"PRIxPTR" %u\n",
+              profile[i].eip, profile[i].cnt);
 }
 
+/* Initializes EVENT to call FUNC with AUX once it expires. */
+void
+timer_event_init (struct timer_event *event, timer_event_func *func,
+                  void *aux)
+{
+  ASSERT (event != NULL);
+  ASSERT (func != NULL);
+
+  event->func = func;
+  event->aux = aux;
+  event->pending = false;
+}
+
+/* Arms EVENT to fire at tick EXPIRES, or on the next tick if
+   EXPIRES has already passed.  EVENT must not be pending. */
+void
+timer_event_add (struct timer_event *event, int64_t expires)
+{
+  enum intr_level old_level;
+
+  ASSERT (!event->pending);
+
+  old_level = intr_disable ();
+  if (expires <= ticks)
+    expires = ticks + 1;
+  event->expires = expires;
+  event->pending = true;
+  list_push_back (&timer_wheel[expires % TIMER_WHEEL_SLOTS], &event->elem);
+  if (expires < next_event_tick)
+    next_event_tick = expires;
+  if (expires < next_due)
+    next_due = expires;
+  intr_set_level (old_level);
+}
+
+/* Disarms EVENT.  Returns true if it was pending, false if it
+   had already fired or was never armed. */
+bool
+timer_event_cancel (struct timer_event *event)
+{
+  enum intr_level old_level = intr_disable ();
+  bool pending = event->pending;
+
+  if (pending)
+    {
+      list_remove (&event->elem);
+      event->pending = false;
+    }
+  intr_set_level (old_level);
+  return pending;
+}
+
+/* Fires the events in the current tick's wheel slot that are
+   due, then finds the tick the next event expires at.  Called
+   from the timer interrupt. */
+static void
+timer_run_events (void)
+{
+  struct list *slot = &timer_wheel[ticks % TIMER_WHEEL_SLOTS];
+  struct list_elem *e = list_begin (slot);
+  int64_t next = INT64_MAX;
+  int64_t t;
+
+  while (e != list_end (slot))
+    {
+      struct timer_event *event = list_entry (e, struct timer_event, elem);
+      e = list_next (e);
+      if (event->expires <= ticks)
+        {
+          list_remove (&event->elem);
+          event->pending = false;
+          event->func (event->aux);
+        }
+    }
+
+  /* Walk the slots ahead.  An event in slot T expires at tick T
+     or a whole number of revolutions later, so once the earliest
+     seen is no later than T, no later slot holds an earlier one. */
+  for (t = ticks + 1; t <= ticks + TIMER_WHEEL_SLOTS && next > t - 1; t++)
+    {
+      slot = &timer_wheel[t % TIMER_WHEEL_SLOTS];
+      for (e = list_begin (slot); e != list_end (slot); e = list_next (e))
+        {
+          int64_t expires = list_entry (e, struct timer_event, elem)->expires;
+          if (expires < next)
+            next = expires;
+        }
+    }
+  next_event_tick = next;
+}
+
+/* Does the periodic work of timer_tick() that is due at this
+   tick: expired timer events and MLFQS bookkeeping. */
+static void
+timer_run_due (void)
+{
+  if (ticks >= next_event_tick)
+    timer_run_events ();
+  if (ticks >= next_mlfqs_tick)
+    {
+      if (ticks % TIMER_FREQ == 0)
+        update_load_avg ();
+      if (ticks % 4 == 0)
+        update_priority_running ();
+      next_mlfqs_tick = mlfqs_next (ticks);
+    }
+  next_due = next_event_tick < next_mlfqs_tick ? next_event_tick : next_mlfqs_tick;
+}
+
+/* Returns the first tick after AFTER at which the MLFQS
+   recomputes the running thread's priority, every fourth tick,
+   or the load average, once a second. */
+static int64_t
+mlfqs_next (int64_t after)
+{
+  int64_t priority = (after / 4 + 1) * 4;
+  int64_t load_avg = (after / TIMER_FREQ + 1) * TIMER_FREQ;
+  return priority < load_avg ? priority : load_avg;
+}
+
+/* Returns the PIT cycles since boot in tickless mode.
+   Interrupts must be off. */
+static int64_t
+timer_cycles (void)
+{
+  bool expired;
+  uint16_t count = pit_read_counter (0, &expired);
+
+  if (expired)
+    return now_cycles + programmed + (uint16_t) -count;
+  return now_cycles + programmed - count;
+}
+
+/* Programs the next one-shot countdown: normally to the next tick
+   boundary, further out if the CPU is idle and no event is due
+   sooner, and earlier if a sub-tick sleep ends first. */
+static void
+timer_program_next (void)
+{
+  int64_t t = ticks + 1;
+  int64_t target, count;
+
+  if (thread_cpu_idle ())
+    while (t < next_event_tick && (t + 1) * PIT_TICK - now_cycles <= UINT16_MAX)
+      t++;
+  idle_stretch = t > ticks + 1;
+  target = t * PIT_TICK;
+
+  if (!list_empty (&hires_list))
+    {
+      struct timer_event *event
+        = list_entry (list_front (&hires_list), struct timer_event, elem);
+      if (event->expires < target)
+        target = event->expires;
+    }
+
+  count = target - now_cycles;
+  programmed = count < 1 ? 1 : count > UINT16_MAX ? UINT16_MAX : count;
+  pit_start_oneshot (0, programmed);
+}
+
+/* Arms a one-shot countdown CYCLES PIT cycles from now and
+   sleeps until it fires.  Tickless mode only. */
+static void
+timer_hires_sleep (int64_t cycles)
+{
+  struct timer_event event;
+  struct list_elem *e;
+  bool expired;
+  uint16_t count;
+
+  timer_event_init (&event, timer_wake_thread, thread_current ());
+
+  enum intr_level old_level = intr_disable ();
+  event.expires = timer_cycles () + cycles;
+  event.pending = true;
+  for (e = list_begin (&hires_list); e != list_end (&hires_list);
+       e = list_next (e))
+    if (list_entry (e, struct timer_event, elem)->expires > event.expires)
+      break;
+  list_insert (e, &event.elem);
+
+  /* Bring the interrupt forward if this sleep ends before the
+     countdown in progress, unless that is about to fire anyway. */
+  count = pit_read_counter (0, &expired);
+  if (!expired && count >= PIT_TICK / 16
+      && event.expires < now_cycles + programmed)
+    {
+      now_cycles += programmed - count;
+      count = event.expires - now_cycles;
+      programmed = count < 1 ? 1 : count;
+      pit_start_oneshot (0, programmed);
+    }
+
+  thread_block ();
+  intr_set_level (old_level);
+}
+
 /* Timer interrupt handler. */
 static void
-timer_interrupt (struct intr_frame *args UNUSED)
+timer_interrupt (struct intr_frame *args)
 {
-  ticks++;
-  thread_tick ();
-  if (thread_mlfqs)
-  {
-    increase_recent_cpu ();
-    if (ticks % TIMER_FREQ == 0)
+  int64_t old_ticks = ticks;
+  bool stretched;
+
+  if (!tickless)
+    {
+      if (profiling)
+        profile_sample (args, 1);
+      timer_tick (false);
+      return;
+    }
+
+  /* Account for the countdown that just expired, including the
+     cycles since it reached zero, then replay every tick boundary
+     it crossed: as idle ticks if the CPU was halted throughout. */
+  now_cycles = timer_cycles ();
+  programmed = 0;
+  stretched = idle_stretch;
+  while (now_cycles >= (ticks + 1) * PIT_TICK)
+    timer_tick (stretched);
+
+  /* Weigh the sample by the ticks the countdown spanned, so that
+     stretched idle time counts for what it lasted and interrupts
+     for sub-tick events count for nothing. */
+  if (profiling && ticks > old_ticks)
+    profile_sample (args, ticks - old_ticks);
+
+  while (!list_empty (&hires_list))
+    {
+      struct timer_event *event
+        = list_entry (list_front (&hires_list), struct timer_event, elem);
+      if (event->expires > now_cycles)
+        break;
+      list_pop_front (&hires_list);
+      event->pending = false;
+      event->func (event->aux);
+    }
+
+  timer_program_next ();
+}
+
+/* Adds WEIGHT samples of the code interrupted with frame F to the
+   profile. */
+static void
+profile_sample (const struct intr_frame *f, unsigned weight)
+{
+  uintptr_t eip = (uintptr_t) f->eip;
+  size_t idx = (eip >> 2) % PROFILE_SLOTS;
+  size_t i;
+
+  profile_cnt += weight;
+  if ((f->cs & 3) != 0)
     {
-      update_load_avg ();
-      update_recent_cpu_for_each ();
+      profile_user_cnt += weight;
+      return;
     }
-    if (ticks % 4 == 0)
+  for (i = 0; i < PROFILE_SLOTS; i++)
     {
-      update_priority_for_each ();
+      struct profile_slot *s = &profile[(idx + i) % PROFILE_SLOTS];
+      if (s->eip == eip || s->eip == 0)
+        {
+          s->eip = eip;
+          s->cnt += weight;
+          return;
+        }
     }
-  }
+  profile_lost_cnt += weight;
+}
+
+/* Advances time by one tick: scheduler accounting, including
+   the running thread's recent_cpu under the MLFQS, then due timer
+   events and MLFQS bookkeeping, if any is due.  IDLE means the
+   tick was spent halted in a stretched idle countdown. */
+static void
+timer_tick (bool idle)
+{
+  ticks++;
+#ifdef USERPROG
+  uinfo_tick (ticks);
+#endif
+  if (idle)
+    thread_tick_idle ();
+  else
+    thread_tick ();
+  if (ticks >= next_due)
+    timer_run_due ();
+}
+
+/* Times the CPU cycle counter against the timer and sets up
+   timer_tsc_to_ns() for the rate found. */
+static void
+calibrate_tsc (void) 
+{
+  int64_t start;
+  uint64_t tsc;
+
+  /* Wait for a timer tick, then count cycles over several. */
+  start = ticks;
+  while (ticks == start)
+    barrier ();
+  start = ticks;
+  tsc = timer_tsc ();
+  while (ticks < start + TSC_CALIBRATE_TICKS)
+    barrier ();
+  set_tsc_rate ((timer_tsc () - tsc) * (TIMER_FREQ / TSC_CALIBRATE_TICKS),
+                tsc, start);
+}
+
+/* Sets up timer_tsc_to_ns() for a cycle counter running at HZ and
+   timer_ns() for the counter having read TSC at the start of
+   TICK. */
+static void
+set_tsc_rate (uint64_t hz, uint64_t tsc, int64_t tick) 
+{
+  enum intr_level old_level;
+  uint64_t now_ns, tick_ns;
+
+  ASSERT (hz > 0);
+
+  /* Keep as many fraction bits as fit in 32 bits of multiplier. */
+  for (tsc_shift = 32; tsc_shift > 0; tsc_shift--)
+    if ((1000000000ULL << tsc_shift) / hz <= UINT32_MAX)
+      break;
+  tsc_mult = (1000000000ULL << tsc_shift) / hz;
+
+  /* Carry on from the tick-based time, so that timer_ns() never
+     goes back. */
+  old_level = intr_disable ();
+  tsc_base = tsc;
+  tsc_base_ns = tick * NS_PER_TICK;
+  now_ns = tsc_base_ns + timer_tsc_to_ns (timer_tsc () - tsc_base);
+  tick_ns = ticks * NS_PER_TICK;
+  if (now_ns < tick_ns)
+    tsc_base_ns += tick_ns - now_ns;
+  tsc_hz = hz;
+  intr_set_level (old_level);
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
@@ -244,9 +777,12 @@ real_time_sleep (int64_t num, int32_t denom)
     }
   else 
     {
-      /* Otherwise, use a busy-wait loop for more accurate
-         sub-tick timing. */
-      real_time_delay (num, denom); 
+      /* Otherwise, use a one-shot countdown in tickless mode, or
+         a busy-wait loop, for more accurate sub-tick timing. */
+      if (tickless)
+        timer_hires_sleep (num * PIT_HZ / denom);
+      else
+        real_time_delay (num, denom); 
     }
 }
 
@@ -1,13 +1,19 @@
 #ifndef DEVICES_TIMER_H
 #define DEVICES_TIMER_H
 
+#include <list.h>
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
 #define TIMER_FREQ 100
 
 void timer_init (void);
+void timer_set_tickless (bool);
+void timer_set_profiling (bool);
+void timer_idle_exit (void);
+void timer_set_calibration (unsigned loops_per_tick, uint32_t cycles_per_tick);
 void timer_calibrate (void);
 
 int64_t timer_ticks (void);
@@ -26,4 +32,38 @@ void timer_ndelay (int64_t nanoseconds);
 
 void timer_print_stats (void);
 
+/* High-resolution clock. */
+uint64_t timer_ns (void);
+uint64_t timer_tsc_to_ns (uint64_t cycles);
+uint64_t timer_tsc_hz (void);
+
+/* Returns the CPU cycle counter, for timing short intervals
+   cheaply.  timer_tsc_to_ns() converts differences to time. */
+static inline uint64_t
+timer_tsc (void) 
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Kernel timer events.  The callback runs in the timer
+   interrupt handler on the first tick at or after the expiry
+   time, so it may not sleep; it typically unblocks a thread or
+   ups a semaphore. */
+typedef void timer_event_func (void *aux);
+
+struct timer_event
+  {
+    int64_t expires;            /* Tick at which to fire. */
+    timer_event_func *func;     /* Callback. */
+    void *aux;                  /* Callback argument. */
+    bool pending;               /* Armed and not yet fired? */
+    struct list_elem elem;      /* Timer wheel slot element. */
+  };
+
+void timer_event_init (struct timer_event *, timer_event_func *, void *aux);
+void timer_event_add (struct timer_event *, int64_t expires);
+bool timer_event_cancel (struct timer_event *);
+
 #endif /* devices/timer.h */
@@ -14,22 +14,33 @@
 #define COL_CNT 80
 #define ROW_CNT 25
 
+/* Number of rows that fit in the 32 kB of text mode video memory
+   at 0xb8000.  Only ROW_CNT of them are displayed at a time,
+   starting at row TOP, so that scrolling usually only has to
+   move the CRTC start address instead of copying the screen. */
+#define BUF_ROW_CNT (0x8000 / (COL_CNT * 2))
+
 /* Current cursor position.  (0,0) is in the upper left corner of
    the display. */
 static size_t cx, cy;
 
+/* Row in video memory shown at the top of the display. */
+static size_t top;
+
 /* Attribute value for gray text on a black background. */
 #define GRAY_ON_BLACK 0x07
 
 /* Framebuffer.  See [FREEVGA] under "VGA Text Mode Operation".
-   The character at (x,y) is fb[y][x][0].
-   The attribute at (x,y) is fb[y][x][1]. */
+   The character at video memory row Y, column X is fb[Y][x][0],
+   and its attribute is fb[Y][x][1].  Screen position (x,y) is
+   video memory row TOP + y. */
 static uint8_t (*fb)[COL_CNT][2];
 
 static void clear_row (size_t y);
 static void cls (void);
 static void newline (void);
 static void move_cursor (void);
+static void set_start (void);
 static void find_cursor (size_t *x, size_t *y);
 
 /* Initializes the VGA text display. */
@@ -41,6 +52,8 @@ init (void)
   if (!inited)
     {
       fb = ptov (0xb8000);
+      top = 0;
+      set_start ();
       find_cursor (&cx, &cy);
       inited = true; 
     }
@@ -89,8 +102,8 @@ vga_putc (int c)
       break;
       
     default:
-      fb[cy][cx][0] = c;
-      fb[cy][cx][1] = GRAY_ON_BLACK;
+      fb[top + cy][cx][0] = c;
+      fb[top + cy][cx][1] = GRAY_ON_BLACK;
       if (++cx >= COL_CNT)
         newline ();
       break;
@@ -108,6 +121,8 @@ cls (void)
 {
   size_t y;
 
+  top = 0;
+  set_start ();
   for (y = 0; y < ROW_CNT; y++)
     clear_row (y);
 
@@ -115,7 +130,7 @@ cls (void)
   move_cursor ();
 }
 
-/* Clears row Y to spaces. */
+/* Clears video memory row Y to spaces. */
 static void
 clear_row (size_t y) 
 {
@@ -130,7 +145,9 @@ clear_row (size_t y)
 
 /* Advances the cursor to the first column in the next line on
    the screen.  If the cursor is already on the last line on the
-   screen, scrolls the screen upward one line. */
+   screen, scrolls the screen upward one line, by moving the
+   display down a row in video memory or, once it reaches the end
+   of video memory, by copying the screen back to the start. */
 static void
 newline (void)
 {
@@ -139,8 +156,15 @@ newline (void)
   if (cy >= ROW_CNT)
     {
       cy = ROW_CNT - 1;
-      memmove (&fb[0], &fb[1], sizeof fb[0] * (ROW_CNT - 1));
-      clear_row (ROW_CNT - 1);
+      if (top + ROW_CNT < BUF_ROW_CNT)
+        top++;
+      else
+        {
+          memmove (&fb[0], &fb[top + 1], sizeof fb[0] * (ROW_CNT - 1));
+          top = 0;
+        }
+      clear_row (top + ROW_CNT - 1);
+      set_start ();
     }
 }
 
@@ -149,11 +173,22 @@ static void
 move_cursor (void) 
 {
   /* See [FREEVGA] under "Manipulating the Text-mode Cursor". */
-  uint16_t cp = cx + COL_CNT * cy;
+  uint16_t cp = cx + COL_CNT * (top + cy);
   outw (0x3d4, 0x0e | (cp & 0xff00));
   outw (0x3d4, 0x0f | (cp << 8));
 }
 
+/* Makes the display start at video memory row TOP. */
+static void
+set_start (void) 
+{
+  /* See [FREEVGA] under "CRTC Registers", Start Address High and
+     Start Address Low. */
+  uint16_t sa = COL_CNT * top;
+  outw (0x3d4, 0x0c | (sa & 0xff00));
+  outw (0x3d4, 0x0d | (sa << 8));
+}
+
 /* Reads the current hardware cursor position into (*X,*Y). */
 static void
 find_cursor (size_t *x, size_t *y) 
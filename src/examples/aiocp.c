@@ -0,0 +1,124 @@
+/* aiocp.c
+
+   Copies one file to another with asynchronous I/O, keeping up
+   to SLOTS chunks in flight at once: each slot reads a chunk of
+   the input, then writes it to the output, then moves on to the
+   next chunk nobody has read yet.
+
+   Usage: aiocp OLD NEW */
+
+#include <stdio.h>
+#include <syscall.h>
+
+/* Chunks in flight, and the size of each. */
+#define SLOTS 8
+#define CHUNK 4096
+
+static struct aio_ring ring;
+static char buffers[SLOTS][CHUNK];
+
+/* Queues a request to transfer LEN bytes at POS between FD and
+   slot SLOT's buffer.  The slot number comes back as the
+   completion's user_data. */
+static void
+queue (int op, int fd, int slot, unsigned len, unsigned pos)
+{
+  struct aio_sqe *sqe = &ring.sq[ring.sq_tail % AIO_RING_ENTRIES];
+
+  sqe->op = op;
+  sqe->fd = fd;
+  sqe->buf = buffers[slot];
+  sqe->len = len;
+  sqe->pos = pos;
+  sqe->user_data = slot;
+  ring.sq_tail++;
+}
+
+int
+main (int argc, char *argv[])
+{
+  unsigned size, next = 0, pos[SLOTS];
+  bool writing[SLOTS];
+  int in_fd, out_fd, busy = 0, slot;
+
+  if (argc != 3)
+    {
+      printf ("usage: aiocp OLD NEW\n");
+      return EXIT_FAILURE;
+    }
+
+  in_fd = open (argv[1]);
+  if (in_fd < 0)
+    {
+      printf ("%s: open failed\n", argv[1]);
+      return EXIT_FAILURE;
+    }
+  size = filesize (in_fd);
+  if (!create (argv[2], size))
+    {
+      printf ("%s: create failed\n", argv[2]);
+      return EXIT_FAILURE;
+    }
+  out_fd = open (argv[2]);
+  if (out_fd < 0)
+    {
+      printf ("%s: open failed\n", argv[2]);
+      return EXIT_FAILURE;
+    }
+  if (!aio_setup (&ring))
+    {
+      printf ("aiocp: aio_setup failed\n");
+      return EXIT_FAILURE;
+    }
+
+  /* Start a read in every slot there is a chunk for. */
+  for (slot = 0; slot < SLOTS && next < size; slot++, next += CHUNK)
+    {
+      pos[slot] = next;
+      writing[slot] = false;
+      queue (AIO_READ, in_fd, slot, CHUNK, next);
+      busy++;
+    }
+
+  /* Each completed read becomes a write of the same chunk, and
+     each completed write starts the next read. */
+  while (busy > 0)
+    {
+      if (aio_enter (1) < 0)
+        {
+          printf ("aiocp: aio_enter failed\n");
+          return EXIT_FAILURE;
+        }
+      while (ring.cq_head != ring.cq_tail)
+        {
+          struct aio_cqe *cqe = &ring.cq[ring.cq_head++ % AIO_RING_ENTRIES];
+          unsigned len = size - pos[cqe->user_data] < CHUNK
+                         ? size - pos[cqe->user_data] : CHUNK;
+
+          slot = cqe->user_data;
+          if (cqe->res != (int) len)
+            {
+              printf ("%s: %s failed at %u\n",
+                      writing[slot] ? argv[2] : argv[1],
+                      writing[slot] ? "write" : "read", pos[slot]);
+              return EXIT_FAILURE;
+            }
+          if (!writing[slot])
+            {
+              writing[slot] = true;
+              queue (AIO_WRITE, out_fd, slot, len, pos[slot]);
+            }
+          else if (next < size)
+            {
+              writing[slot] = false;
+              pos[slot] = next;
+              next += CHUNK;
+              queue (AIO_READ, in_fd, slot, CHUNK, pos[slot]);
+            }
+          else
+            busy--;
+        }
+    }
+
+  return EXIT_SUCCESS;
+}
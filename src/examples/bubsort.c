@@ -6,6 +6,7 @@
  
    Ideally, we could read the unsorted array off of the file
    system, and store the result back to the file system! */
+#include <malloc.h>
 #include <stdio.h>
 
 /* Size of array to sort. */
@@ -14,11 +15,17 @@
 int
 main (void)
 {
-  /* Array to sort.  Static to reduce stack usage. */
-  static int array[SORT_SIZE];
+  /* Array to sort.  On the heap to reduce stack usage. */
+  int *array = malloc (SORT_SIZE * sizeof *array);
 
   int i, j, tmp;
 
+  if (array == NULL)
+    {
+      printf ("sort: out of memory\n");
+      return -1;
+    }
+
   /* First initialize the array in descending order. */
   for (i = 0; i < SORT_SIZE; i++)
     array[i] = SORT_SIZE - i - 1;
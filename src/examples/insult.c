@@ -240,7 +240,7 @@ init_grammar (void)
 #include <string.h>
 #include <syscall.h>
 
-void expand (int num, char **grammar[], char *location[], int handle);
+void expand (int num, char **grammar[], char *location[], FILE *out);
 
 static void
 usage (int ret_code, const char *message, ...) PRINTF_FORMAT (2, 3);
@@ -273,6 +273,7 @@ main (int argc, char *argv[])
 {
   int sentence_cnt, new_seed, i, file_flag, sent_flag, seed_flag;
   int handle;
+  FILE *out;
   
   new_seed = 4951;
   sentence_cnt = 4;
@@ -328,24 +329,31 @@ main (int argc, char *argv[])
 
   init_grammar ();
 
+  out = file_flag ? fdopen (handle, "w") : stdout;
+  if (out == NULL)
+    {
+      printf ("could not open output stream\n");
+      return EXIT_FAILURE;
+    }
+
   random_init (new_seed);
-  hprintf (handle, "\n");
+  fputs ("\n", out);
 
   for (i = 0; i < sentence_cnt; i++)
     {
-      hprintf (handle, "\n");
-      expand (0, daGrammar, daGLoc, handle);
-      hprintf (handle, "\n\n");
+      fputs ("\n", out);
+      expand (0, daGrammar, daGLoc, out);
+      fputs ("\n\n", out);
     }
   
   if (file_flag)
-    close (handle);
+    fclose (out);
 
   return EXIT_SUCCESS;
 }
 
 void
-expand (int num, char **grammar[], char *location[], int handle)
+expand (int num, char **grammar[], char *location[], FILE *out)
 {
   char *word;
   int i, which, listStart, listEnd;
@@ -359,11 +367,11 @@ expand (int num, char **grammar[], char *location[], int handle)
       if (!isdigit (*word))
 	{
 	  if (!ispunct (*word))
-            hprintf (handle, " ");
-          hprintf (handle, "%s", word);
+            fputc (' ', out);
+          fputs (word, out);
 	}
       else
-	expand (atoi (word), grammar, location, handle);
+	expand (atoi (word), grammar, location, out);
     }
 
 }
@@ -12,6 +12,9 @@
 #include <stdio.h>
 #include <string.h>
 
+/* Directory entries read per getdents() call. */
+#define ENTRY_BATCH 32
+
 static bool
 list_dir (const char *dir, bool verbose) 
 {
@@ -24,39 +27,43 @@ list_dir (const char *dir, bool verbose)
 
   if (isdir (dir_fd))
     {
-      char name[READDIR_MAX_LEN];
+      struct dirent entries[ENTRY_BATCH];
+      int cnt, i;
 
       printf ("%s", dir);
       if (verbose)
         printf (" (inumber %d)", inumber (dir_fd));
       printf (":\n");
 
-      while (readdir (dir_fd, name)) 
-        {
-          printf ("%s", name); 
-          if (verbose) 
-            {
-              char full_name[128];
-              int entry_fd;
+      while ((cnt = getdents (dir_fd, entries, ENTRY_BATCH)) > 0)
+        for (i = 0; i < cnt; i++)
+          {
+            const char *name = entries[i].name;
+
+            printf ("%s", name); 
+            if (verbose) 
+              {
+                char full_name[128];
+                int entry_fd;
 
-              snprintf (full_name, sizeof full_name, "%s/%s", dir, name);
-              entry_fd = open (full_name);
+                snprintf (full_name, sizeof full_name, "%s/%s", dir, name);
+                entry_fd = open (full_name);
 
-              printf (": ");
-              if (entry_fd != -1)
-                {
-                  if (isdir (entry_fd))
-                    printf ("directory");
-                  else
-                    printf ("%d-byte file", filesize (entry_fd));
-                  printf (", inumber %d", inumber (entry_fd));
-                }
-              else
-                printf ("open failed");
-              close (entry_fd);
-            }
-          printf ("\n");
-        }
+                printf (": ");
+                if (entry_fd != -1)
+                  {
+                    if (isdir (entry_fd))
+                      printf ("directory");
+                    else
+                      printf ("%d-byte file", filesize (entry_fd));
+                    printf (", inumber %d", inumber (entry_fd));
+                  }
+                else
+                  printf ("open failed");
+                close (entry_fd);
+              }
+            printf ("\n");
+          }
     }
   else 
     printf ("%s: not a directory\n", dir);
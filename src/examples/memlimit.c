@@ -0,0 +1,41 @@
+/* memlimit.c
+
+   Runs a program that may keep at most PAGES pages of memory
+   resident.  Once it holds that many, its page faults evict its
+   own pages rather than those of other processes.  The program
+   inherits the limit, along with any processes it starts; 0
+   lifts it.
+
+   Usage: memlimit PAGES PROGRAM [ARG...] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+
+int
+main (int argc, char *argv[])
+{
+  int pages;
+  pid_t pid;
+
+  if (argc < 3)
+    {
+      printf ("usage: memlimit PAGES PROGRAM [ARG...]\n");
+      return EXIT_FAILURE;
+    }
+  pages = atoi (argv[1]);
+  if (pages < 0)
+    {
+      printf ("memlimit: bad page count %s\n", argv[1]);
+      return EXIT_FAILURE;
+    }
+  memlimit (pages);
+
+  pid = spawn ((const char **) &argv[2]);
+  if (pid == PID_ERROR)
+    {
+      printf ("memlimit: %s: spawn failed\n", argv[2]);
+      return EXIT_FAILURE;
+    }
+  return wait (pid);
+}
@@ -0,0 +1,73 @@
+/* mupcase.c
+
+   Converts a file to upper case in place through a mapping of
+   it, calling msync() to write the changes back while the file
+   stays mapped, then reads the file to check that they reached
+   it.
+
+   Usage: mupcase FILE */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <syscall.h>
+
+/* Where the file is mapped. */
+#define MAP_ADDR ((char *) 0x10000000)
+
+int
+main (int argc, char *argv[])
+{
+  char buf[512];
+  mapid_t map;
+  int fd, size, ofs;
+
+  if (argc != 2)
+    {
+      printf ("usage: mupcase FILE\n");
+      return EXIT_FAILURE;
+    }
+
+  fd = open (argv[1]);
+  if (fd < 0)
+    {
+      printf ("%s: open failed\n", argv[1]);
+      return EXIT_FAILURE;
+    }
+  size = filesize (fd);
+  map = mmap (fd, MAP_ADDR);
+  if (map == MAP_FAILED)
+    {
+      printf ("%s: mmap failed\n", argv[1]);
+      return EXIT_FAILURE;
+    }
+
+  for (ofs = 0; ofs < size; ofs++)
+    MAP_ADDR[ofs] = toupper ((unsigned char) MAP_ADDR[ofs]);
+  if (!msync (map))
+    {
+      printf ("%s: msync failed\n", argv[1]);
+      return EXIT_FAILURE;
+    }
+
+  /* The mapping is still there; compare it with the file. */
+  for (ofs = 0; ofs < size; ofs += sizeof buf)
+    {
+      int len = size - ofs < (int) sizeof buf ? size - ofs : (int) sizeof buf;
+      int i;
+
+      if (pread (fd, buf, len, ofs) != len)
+        {
+          printf ("%s: read failed at %d\n", argv[1], ofs);
+          return EXIT_FAILURE;
+        }
+      for (i = 0; i < len; i++)
+        if (buf[i] != MAP_ADDR[ofs + i])
+          {
+            printf ("%s: byte %d not written back\n", argv[1], ofs + i);
+            return EXIT_FAILURE;
+          }
+    }
+
+  munmap (map);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,39 @@
+/* pin.c
+
+   Runs a program restricted to a set of CPUs, so that it keeps
+   its caches warm on them.  MASK is a decimal affinity mask in
+   which bit N allows CPU N; the program inherits it, along with
+   any processes and threads it starts.
+
+   Usage: pin MASK PROGRAM [ARG...] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+
+int
+main (int argc, char *argv[])
+{
+  unsigned mask;
+  pid_t pid;
+
+  if (argc < 3)
+    {
+      printf ("usage: pin MASK PROGRAM [ARG...]\n");
+      return EXIT_FAILURE;
+    }
+  mask = atoi (argv[1]);
+  if (!sched_setaffinity (mask))
+    {
+      printf ("pin: no CPU that is up in mask %u\n", mask);
+      return EXIT_FAILURE;
+    }
+
+  pid = spawn ((const char **) &argv[2]);
+  if (pid == PID_ERROR)
+    {
+      printf ("pin: %s: spawn failed\n", argv[2]);
+      return EXIT_FAILURE;
+    }
+  return wait (pid);
+}
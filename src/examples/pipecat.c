@@ -0,0 +1,58 @@
+/* pipecat.c
+
+   Prints a file by way of a pipe: a child process reads the file
+   and writes it into the pipe, and the parent copies what comes
+   out of the pipe to the console until the child closes its end.
+
+   Usage: pipecat FILE */
+
+#include <stdio.h>
+#include <syscall.h>
+
+int
+main (int argc, char *argv[])
+{
+  char buffer[1024];
+  int fds[2], n;
+  pid_t pid;
+
+  if (argc != 2)
+    {
+      printf ("usage: pipecat FILE\n");
+      return EXIT_FAILURE;
+    }
+  if (!pipe (fds))
+    {
+      printf ("pipecat: pipe failed\n");
+      return EXIT_FAILURE;
+    }
+
+  pid = fork ();
+  if (pid == PID_ERROR)
+    {
+      printf ("pipecat: fork failed\n");
+      return EXIT_FAILURE;
+    }
+  if (pid == 0)
+    {
+      int fd = open (argv[1]);
+
+      close (fds[0]);
+      if (fd < 0)
+        {
+          printf ("%s: open failed\n", argv[1]);
+          return EXIT_FAILURE;
+        }
+      while ((n = read (fd, buffer, sizeof buffer)) > 0)
+        if (write (fds[1], buffer, n) != n)
+          return EXIT_FAILURE;
+      return EXIT_SUCCESS;
+    }
+
+  /* Until our own copy of the write end is closed, reads would
+     never see the end of the data. */
+  close (fds[1]);
+  while ((n = read (fds[0], buffer, sizeof buffer)) > 0)
+    write (STDOUT_FILENO, buffer, n);
+  return wait (pid);
+}
@@ -0,0 +1,102 @@
+/* psum.c
+
+   Sums the integers from 1 to N with THREADS threads of one
+   process, each adding its share to a total guarded by a lock
+   built on futexes.
+
+   Usage: psum N */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+
+/* Threads to start, and the stack each one runs on. */
+#define THREADS 4
+#define STACK_SIZE 4096
+
+static char stacks[THREADS][STACK_SIZE];
+
+/* A lock: 0 if free, 1 if held, 2 if held with waiters. */
+static int lock;
+static unsigned long long total;
+
+static void
+lock_acquire (void)
+{
+  int c = __sync_val_compare_and_swap (&lock, 0, 1);
+
+  if (c == 0)
+    return;
+  if (c != 2)
+    c = __sync_lock_test_and_set (&lock, 2);
+  while (c != 0)
+    {
+      futex_wait (&lock, 2);
+      c = __sync_lock_test_and_set (&lock, 2);
+    }
+}
+
+static void
+lock_release (void)
+{
+  if (__sync_fetch_and_sub (&lock, 1) != 1)
+    {
+      lock = 0;
+      futex_wake (&lock, 1);
+    }
+}
+
+/* The integers one thread adds up. */
+struct range
+  {
+    unsigned first, last;
+  };
+
+static void
+sum (void *range_)
+{
+  const struct range *range = range_;
+  unsigned i;
+
+  for (i = range->first; i <= range->last; i++)
+    {
+      lock_acquire ();
+      total += i;
+      lock_release ();
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+  struct range ranges[THREADS];
+  uthread_t tids[THREADS];
+  unsigned n, next = 1;
+  int i;
+
+  if (argc != 2)
+    {
+      printf ("usage: psum N\n");
+      return EXIT_FAILURE;
+    }
+  n = atoi (argv[1]);
+
+  for (i = 0; i < THREADS; i++)
+    {
+      ranges[i].first = next;
+      ranges[i].last = n * (i + 1) / THREADS;
+      next = ranges[i].last + 1;
+      tids[i] = uthread_create (sum, &ranges[i], stacks[i], STACK_SIZE);
+      if (tids[i] == UTHREAD_ERROR)
+        {
+          printf ("psum: uthread_create failed\n");
+          return EXIT_FAILURE;
+        }
+    }
+  for (i = 0; i < THREADS; i++)
+    uthread_join (tids[i]);
+
+  printf ("%llu (expected %llu)\n",
+          total, (unsigned long long) n * (n + 1) / 2);
+  return EXIT_SUCCESS;
+}
@@ -4,6 +4,7 @@
 #include <syscall.h>
 
 static void read_line (char line[], size_t);
+static char read_char (void);
 static bool backspace (char **pos, char line[]);
 
 int
@@ -54,8 +55,7 @@ read_line (char line[], size_t size)
   char *pos = line;
   for (;;)
     {
-      char c;
-      read (STDIN_FILENO, &c, 1);
+      char c = read_char ();
 
       switch (c) 
         {
@@ -85,6 +85,23 @@ read_line (char line[], size_t size)
     }
 }
 
+/* Returns the next character of input.  Reads as much input as
+   is available at once, and hands it out a character at a time
+   from there. */
+static char
+read_char (void) 
+{
+  static char buf[64];
+  static int ofs, cnt;
+
+  while (ofs >= cnt)
+    {
+      cnt = read (STDIN_FILENO, buf, sizeof buf);
+      ofs = 0;
+    }
+  return buf[ofs++];
+}
+
 /* If *POS is past the beginning of LINE, backs up one character
    position.  Returns true if successful, false if nothing was
    done. */
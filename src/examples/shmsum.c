@@ -0,0 +1,66 @@
+/* shmsum.c
+
+   Shares a table of numbers with a child process through a shared
+   memory object: the parent fills it in, the child adds it up
+   and leaves the total in the object for the parent to read, and
+   no byte of it is copied on the way.
+
+   Usage: shmsum [N] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+
+/* Where the object is mapped, and its layout there. */
+#define SHM_ADDR ((void *) 0x10000000)
+#define NUMBERS ((SHM_SIZE_MAX - sizeof (unsigned long long)) / sizeof (int))
+
+struct table
+  {
+    unsigned long long total;
+    int numbers[NUMBERS];
+  };
+
+int
+main (int argc, char *argv[])
+{
+  struct table *table = SHM_ADDR;
+  unsigned n = argc > 1 ? (unsigned) atoi (argv[1]) : NUMBERS;
+  unsigned long long expected = 0;
+  pid_t pid;
+  unsigned i;
+
+  if (n > NUMBERS)
+    n = NUMBERS;
+  if (shm_open ("shmsum", sizeof *table, SHM_ADDR) == MAP_FAILED)
+    {
+      printf ("shmsum: shm_open failed\n");
+      return EXIT_FAILURE;
+    }
+  /* The object lives on in this process and its child. */
+  shm_unlink ("shmsum");
+
+  for (i = 0; i < n; i++)
+    {
+      table->numbers[i] = i * 7 % 1000;
+      expected += table->numbers[i];
+    }
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      unsigned long long total = 0;
+      for (i = 0; i < n; i++)
+        total += table->numbers[i];
+      table->total = total;
+      return EXIT_SUCCESS;
+    }
+  if (pid == PID_ERROR || wait (pid) != EXIT_SUCCESS)
+    {
+      printf ("shmsum: child failed\n");
+      return EXIT_FAILURE;
+    }
+
+  printf ("%llu (expected %llu)\n", table->total, expected);
+  return table->total == expected ? EXIT_SUCCESS : EXIT_FAILURE;
+}
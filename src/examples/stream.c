@@ -0,0 +1,83 @@
+/* stream.c
+
+   Sums the bytes of a file in one pass, first telling the kernel
+   that it will be read in order and only once, so that it reads
+   further ahead and lets each part go as soon as it has been
+   read.  With -m, the file is mapped and summed through the
+   mapping, advised with madvise(); with -p it is mapped the same
+   way, but read in whole by mmap_flags() with MAP_POPULATE before
+   the sum starts.  Otherwise it is read with read(), advised with
+   fadvise().  Either way the file is advised MADV_DONTNEED
+   afterward.
+
+   Usage: stream [-m | -p] FILE */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+
+/* Where the file is mapped with -m. */
+#define MAP_ADDR ((unsigned char *) 0x10000000)
+
+int
+main (int argc, char *argv[])
+{
+  bool populate = argc == 3 && !strcmp (argv[1], "-p");
+  bool mapped = populate || (argc == 3 && !strcmp (argv[1], "-m"));
+  const char *name = argv[argc - 1];
+  unsigned sum = 0;
+  int fd, size;
+
+  if (argc != 2 && !mapped)
+    {
+      printf ("usage: stream [-m | -p] FILE\n");
+      return EXIT_FAILURE;
+    }
+
+  fd = open (name);
+  if (fd < 0)
+    {
+      printf ("%s: open failed\n", name);
+      return EXIT_FAILURE;
+    }
+  size = filesize (fd);
+
+  if (mapped)
+    {
+      mapid_t map = mmap_flags (fd, MAP_ADDR, populate ? MAP_POPULATE : 0);
+      int ofs;
+
+      if (map == MAP_FAILED)
+        {
+          printf ("%s: mmap failed\n", name);
+          return EXIT_FAILURE;
+        }
+      if (!madvise (MAP_ADDR, size, MADV_SEQUENTIAL))
+        {
+          printf ("%s: madvise failed\n", name);
+          return EXIT_FAILURE;
+        }
+      for (ofs = 0; ofs < size; ofs++)
+        sum += MAP_ADDR[ofs];
+      madvise (MAP_ADDR, size, MADV_DONTNEED);
+      munmap (map);
+    }
+  else
+    {
+      unsigned char buf[4096];
+      int n, i;
+
+      if (!fadvise (fd, 0, size, MADV_SEQUENTIAL))
+        {
+          printf ("%s: fadvise failed\n", name);
+          return EXIT_FAILURE;
+        }
+      while ((n = read (fd, buf, sizeof buf)) > 0)
+        for (i = 0; i < n; i++)
+          sum += buf[i];
+      fadvise (fd, 0, size, MADV_DONTNEED);
+    }
+
+  printf ("%s: %d bytes, sum %u\n", name, size, sum);
+  return EXIT_SUCCESS;
+}
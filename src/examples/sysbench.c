@@ -0,0 +1,151 @@
+/* sysbench.c
+
+   Times cheap system calls in a loop, to track the cost of
+   entering and leaving the kernel.  Prints the average time and
+   CPU cycles per loop iteration for each benchmark, beginning
+   with reads of the user info page, which enter no kernel at
+   all, for comparison.
+
+   Usage: sysbench [ITERATIONS] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+
+/* Default iterations per benchmark. */
+#define DEFAULT_ITERATIONS 1000
+
+/* Bytes moved by each small read or write. */
+#define SMALL_SIZE 64
+
+/* Scratch file, removed at the end. */
+#define SCRATCH_FILE "sysbench.tmp"
+
+/* Where mmap maps the scratch file. */
+#define MAP_ADDR ((void *) 0x10000000)
+
+static unsigned iterations;
+static struct clock_time start;
+
+/* Starts timing a benchmark. */
+static void
+begin (void)
+{
+  clock (&start);
+}
+
+/* Stops timing the benchmark NAME, which ran CNT iterations, and
+   prints the cost of one. */
+static void
+end (const char *name, unsigned cnt)
+{
+  struct clock_time now;
+
+  clock (&now);
+  printf ("%-12s %8llu ns %8llu cycles\n", name,
+          (now.ns - start.ns) / cnt, (now.cycles - start.cycles) / cnt);
+}
+
+int
+main (int argc, char *argv[]) 
+{
+  char buffer[SMALL_SIZE];
+  char cmd_line[64];
+  struct clock_time now;
+  mapid_t map;
+  unsigned i;
+  int fd;
+
+  /* Run as the child of the exec benchmark. */
+  if (argc == 2 && !strcmp (argv[1], "-child"))
+    return EXIT_SUCCESS;
+
+  iterations = argc > 1 ? atoi (argv[1]) : DEFAULT_ITERATIONS;
+  if (argc > 2 || iterations == 0) 
+    {
+      printf ("usage: sysbench [ITERATIONS]\n");
+      return EXIT_FAILURE;
+    }
+
+  /* Create the scratch file at full size, so writes do not also
+     time growing it. */
+  if (!create (SCRATCH_FILE, iterations * SMALL_SIZE)) 
+    {
+      printf ("%s: create failed\n", SCRATCH_FILE);
+      return EXIT_FAILURE;
+    }
+  fd = open (SCRATCH_FILE);
+  if (fd < 0) 
+    {
+      printf ("%s: open failed\n", SCRATCH_FILE);
+      return EXIT_FAILURE;
+    }
+  memset (buffer, 'x', sizeof buffer);
+
+  begin ();
+  for (i = 0; i < iterations; i++)
+    get_ticks ();
+  end ("get_ticks", iterations);
+
+  begin ();
+  for (i = 0; i < iterations; i++)
+    getpid ();
+  end ("getpid", iterations);
+
+  begin ();
+  for (i = 0; i < iterations; i++)
+    clock (&now);
+  end ("clock", iterations + 1);
+
+  begin ();
+  for (i = 0; i < iterations; i++)
+    tell (fd);
+  end ("tell", iterations);
+
+  begin ();
+  for (i = 0; i < iterations; i++)
+    filesize (fd);
+  end ("filesize", iterations);
+
+  seek (fd, 0);
+  begin ();
+  for (i = 0; i < iterations; i++)
+    write (fd, buffer, sizeof buffer);
+  end ("write", iterations);
+
+  seek (fd, 0);
+  begin ();
+  for (i = 0; i < iterations; i++)
+    read (fd, buffer, sizeof buffer);
+  end ("read", iterations);
+
+  begin ();
+  for (i = 0; i < iterations; i++)
+    close (open (SCRATCH_FILE));
+  end ("open+close", iterations);
+
+  /* Loading a process costs far more than a system call. */
+  snprintf (cmd_line, sizeof cmd_line, "%s -child", argv[0]);
+  begin ();
+  for (i = 0; i < iterations / 10 + 1; i++)
+    wait (exec (cmd_line));
+  end ("exec+wait", iterations / 10 + 1);
+
+  /* Mapping fails in kernels built without virtual memory. */
+  map = mmap (fd, MAP_ADDR);
+  if (map != MAP_FAILED) 
+    {
+      munmap (map);
+      begin ();
+      for (i = 0; i < iterations; i++)
+        munmap (mmap (fd, MAP_ADDR));
+      end ("mmap+munmap", iterations);
+    }
+  else
+    printf ("%-12s not supported\n", "mmap+munmap");
+
+  close (fd);
+  remove (SCRATCH_FILE);
+  return EXIT_SUCCESS;
+}
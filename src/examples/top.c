@@ -0,0 +1,130 @@
+/* top.c
+
+   Samples the kernel's threads, memory and buffer cache at a
+   fixed interval, to watch resource use during a load test.
+   Prints one block per sample: a summary line per subsystem and
+   a line per thread.  The cache hit ratio is over the interval
+   since the previous sample.
+
+   There is no way to sleep from user space, so top waits by
+   polling the clock; its own thread shows up busy.
+
+   Usage: top [SAMPLES [INTERVAL_MS]] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+
+/* Defaults for the command line arguments. */
+#define DEFAULT_SAMPLES 10
+#define DEFAULT_INTERVAL_MS 1000
+
+/* Names of the SYSINFO_* thread statuses. */
+static const char *status_names[] = {"running", "ready", "blocked", "dying"};
+
+/* Prints N / D as a percentage with one decimal, or "-" if D is
+   zero.  There is no floating point in user programs. */
+static void
+print_percent (unsigned long long n, unsigned long long d)
+{
+  unsigned long long tenths;
+
+  if (d == 0)
+    {
+      printf ("-");
+      return;
+    }
+  tenths = (n * 1000 + d / 2) / d;
+  printf ("%llu.%llu%%", tenths / 10, tenths % 10);
+}
+
+/* Prints sample INFO, taken after PREV unless PREV is null. */
+static void
+print_sample (const struct sysinfo *info, const struct sysinfo *prev)
+{
+  unsigned long long lookups = info->cache_lookups;
+  unsigned long long hits = info->cache_hits;
+  int i, cnt;
+
+  if (prev != NULL)
+    {
+      lookups -= prev->cache_lookups;
+      hits -= prev->cache_hits;
+    }
+
+  printf ("--- tick %llu, load average %d.%02d, %d threads\n",
+          info->ticks, info->load_avg / 100, info->load_avg % 100,
+          info->thread_cnt);
+  printf ("pages: kernel %u of %u free, user %u of %u free\n",
+          info->kernel_free, info->kernel_pages,
+          info->user_free, info->user_pages);
+  printf ("cache: %u sectors, %llu lookups, ", info->cache_sectors, lookups);
+  print_percent (hits, lookups);
+  printf (" hits\n");
+  if (info->frames > 0)
+    printf ("vm: %u of %u frames used, %u of %u swap slots used\n",
+            info->frames_used, info->frames,
+            info->swap_used, info->swap_slots);
+
+  printf ("%5s %-16s %-8s %4s %4s %10s\n",
+          "tid", "name", "status", "pri", "nice", "recent_cpu");
+  cnt = info->thread_cnt < SYSINFO_THREADS_MAX
+        ? info->thread_cnt : SYSINFO_THREADS_MAX;
+  for (i = 0; i < cnt; i++)
+    {
+      const struct sysinfo_thread *t = &info->threads[i];
+      int cpu = t->recent_cpu < 0 ? -t->recent_cpu : t->recent_cpu;
+
+      printf ("%5d %-16s %-8s %4d %4d %s%7d.%02d\n",
+              t->tid, t->name,
+              t->status >= 0 && t->status <= SYSINFO_DYING
+              ? status_names[t->status] : "?",
+              t->priority, t->nice, t->recent_cpu < 0 ? "-" : " ",
+              cpu / 100, cpu % 100);
+    }
+  if (info->thread_cnt > cnt)
+    printf ("(%d more threads not shown)\n", info->thread_cnt - cnt);
+}
+
+/* Waits until MS milliseconds after START. */
+static void
+wait_until (const struct clock_time *start, unsigned long long ms)
+{
+  struct clock_time now;
+
+  do
+    clock (&now);
+  while (now.ns - start->ns < ms * 1000000);
+}
+
+int
+main (int argc, char *argv[]) 
+{
+  static struct sysinfo samples[2];
+  struct clock_time start;
+  int sample_cnt = argc > 1 ? atoi (argv[1]) : DEFAULT_SAMPLES;
+  int interval = argc > 2 ? atoi (argv[2]) : DEFAULT_INTERVAL_MS;
+  int i;
+
+  if (argc > 3 || sample_cnt <= 0 || interval < 0)
+    {
+      printf ("usage: top [SAMPLES [INTERVAL_MS]]\n");
+      return EXIT_FAILURE;
+    }
+
+  clock (&start);
+  for (i = 0; i < sample_cnt; i++)
+    {
+      struct sysinfo *info = &samples[i % 2];
+
+      if (i > 0)
+        wait_until (&start, (unsigned long long) interval * i);
+      if (!sysinfo (info))
+        {
+          printf ("top: sysinfo failed\n");
+          return EXIT_FAILURE;
+        }
+      print_sample (info, i > 0 ? &samples[(i + 1) % 2] : NULL);
+    }
+  return EXIT_SUCCESS;
+}
@@ -1,129 +1,1748 @@
 #include "filesys/cache.h"
 #include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <debug.h>
+#include <hash.h>
+#include <round.h>
+#include "devices/timer.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "filesys/journal.h"
+#include "threads/ktrace.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "threads/workqueue.h"
 
-#define CACHE_SIZE 64
+/* Default boot-time and maximum cache sizes, in sectors. */
+#define CACHE_SIZE_DEFAULT 64
+#define CACHE_MAX_DEFAULT 1024
 
+/* Number of sector buffers carved out of one page. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* The cache only grows while the user pool has more than this
+   many free pages, and considers growing once every
+   CACHE_GROW_PERIOD evictions. */
+#define CACHE_GROW_RESERVE 256
+#define CACHE_GROW_PERIOD 32
+
+/* Most pages the cache takes past cache_max for an operation that
+   has dirtied more metadata than the cache holds: room for a
+   whole journal's worth of sectors. */
+#define CACHE_JOURNAL_EXTRA DIV_ROUND_UP (JOURNAL_SECTORS, SECTORS_PER_PAGE)
+
+/* Default write-behind interval, in timer ticks. */
+#define CACHE_FLUSH_DEFAULT TIMER_FREQ
+
+/* Most sectors one idle-time write-back writes. */
+#define CACHE_IDLE_FLUSH 8
+
+/* Capacity of the read-ahead request queue, in sectors. */
+#define PREFETCH_QUEUE_SIZE 32
+
+/* Default percentage of the cache kept for metadata. */
+#define CACHE_META_SHARE_DEFAULT 25
+
+/* Warm-up records, see cache_warm_format().  The sectors list
+   fills the rest of the CACHE_WARM_SECTORS sectors of the area;
+   CACHE_WARM_DATA is set in each recorded for CACHE_DATA. */
+#define CACHE_WARM_MAGIC 0x4d524157     /* "WARM". */
+#define CACHE_WARM_DATA 0x80000000u
+#define CACHE_WARM_MAX ((CACHE_WARM_SECTORS * BLOCK_SECTOR_SIZE - 3 * sizeof (unsigned)) \
+                        / sizeof (block_sector_t))
+
+/* Under CACHE_2Q, at most 1/A1IN_SHARE of the cache holds sectors
+   used once before they are evicted first, and the last
+   cache_cnt / A1OUT_SHARE sectors evicted from there are
+   remembered. */
+#define A1IN_SHARE 4
+#define A1OUT_SHARE 2
+
+/* A cached sector.
+
+   VALID, DIRTY, RECENT_USED, ACCESSED, the list and hash
+   elements and the READERS/WRITER claim are protected by
+   global_lock.  BUFFER is protected by the claim instead: any
+   number of readers, or a single writer, may touch it without
+   holding global_lock.  A writer claim is also held while the
+   entry is being loaded from or written back to disk, so that a
+   disk transfer on one entry never blocks hits on another.
+
+   DATA tells which enum cache_class the last request for the
+   sector was tagged with: file data if true, else metadata.
+
+   META marks an entry written as file system metadata since it
+   was last clean.  While journaling, a dirty metadata entry only
+   reaches its home sector through a journal commit, so it is
+   never evicted or written behind. */
 struct cache_entry
 {
     block_sector_t disk_sector;
-    uint8_t buffer[BLOCK_SECTOR_SIZE];
+    uint8_t *buffer;                    /* BLOCK_SECTOR_SIZE bytes in a chunk page. */
     bool valid;
     bool dirty;
-    int recent_used;
+    bool data;                          /* CACHE_DATA, see above. */
+    bool meta;                          /* Metadata, see above. */
+    unsigned version;                   /* Bumped by each metadata write. */
+    block_sector_t owner;               /* Inode of the last write, see cache_flush_owner(). */
+    int recent_used;                    /* Value of cache_clock at last use. */
+    bool accessed;                      /* Second-chance bit for CACHE_CLOCK. */
+    bool first_use;                     /* In the A1in queue of CACHE_2Q. */
+    unsigned hits;                      /* Hits since the sector was loaded. */
+    int readers;                        /* # of threads reading BUFFER. */
+    bool writer;                        /* True if one thread owns BUFFER. */
+    struct condition released;          /* Signaled when the claim drops. */
     struct list_elem elem;
+    struct hash_elem hash_elem;         /* Element in cache_index, if valid. */
+};
+
+/* The warm-up area on disk. */
+struct cache_warm
+{
+    unsigned magic;                     /* CACHE_WARM_MAGIC. */
+    unsigned cnt;                       /* Number of SECTORS recorded. */
+    unsigned checksum;                  /* hash_bytes() of them. */
+    block_sector_t sectors[CACHE_WARM_MAX];
+};
+
+/* One page worth of cache entries.  The cache is made of whole
+   chunks so that it can be grown and shrunk a page at a time. */
+struct cache_chunk
+{
+    uint8_t *page;                      /* Buffers of ENTRIES. */
+    bool user;                          /* Page came from the user pool
+                                           and may be given back. */
+    bool extra;                         /* Taken past cache_max for the
+                                           journal, see cache_trim(). */
+    struct list_elem elem;              /* Element in chunk_list. */
+    struct cache_entry entries[SECTORS_PER_PAGE];
 };
 
-static struct cache_entry cache[CACHE_SIZE];
 static struct lock global_lock;
 static struct list cache_list;
-static bool cache_recent_used_more (const struct list_elem *lhs, const struct list_elem *rhs, void *aux UNUSED);
+
+/* All chunks, protected by global_lock. */
+static struct list chunk_list;
+
+/* Boot-time and maximum number of cached sectors, set by
+   cache_set_size() and cache_set_max_size(), and the number
+   currently cached. */
+static size_t cache_min = CACHE_SIZE_DEFAULT;
+static size_t cache_max = CACHE_MAX_DEFAULT;
+static size_t cache_cnt;
+
+/* # of chunks taken past cache_max for the journal. */
+static size_t extra_cnt;
+
+/* # of evictions, to pace growth attempts. */
+static unsigned evict_cnt;
+
+/* Signaled whenever some entry becomes unclaimed, for threads
+   that found every entry busy while looking for a victim. */
+static struct condition entry_free;
+
+/* Replacement policy in use, set by cache_set_policy(). */
+static enum cache_policy policy = CACHE_LRU;
+
+/* Percentage of the cache that metadata may fill without file
+   data replacing any of it, set by cache_set_meta_share(), and
+   the number of valid entries that hold metadata. */
+static int meta_share = CACHE_META_SHARE_DEFAULT;
+static size_t meta_cnt;
+
+/* Next element of cache_list examined by the clock hand under
+   CACHE_CLOCK. */
+static struct list_elem *clock_hand;
+
+/* Under CACHE_2Q, cache_list holds the Am queue of entries used
+   more than once, most recently used first, followed by the A1in
+   queue of entries used once, newest first.  A1IN_HEAD is the
+   first element of A1in, or the list end if it is empty, and
+   A1IN_CNT its length.  A sector of file data starts out in
+   A1in and stays there however often it is hit, so one pass over
+   a large file only ever replaces A1in; it moves to Am if it is
+   missed again while its number is still in the ghost ring of
+   sectors recently evicted from A1in (the A1out queue), GHOST_MAX
+   long.  Metadata goes straight to Am. */
+static struct list_elem *a1in_head;
+static size_t a1in_cnt;
+static block_sector_t *ghosts;
+static size_t ghost_max, ghost_next, ghost_cnt;
+
+/* Marks a forgotten slot of the ghost ring. */
+#define GHOST_NONE ((block_sector_t) -1)
+
+/* Maps a disk sector to the valid cache_entry holding it. */
+static struct hash cache_index;
+
+/* Bumped on every access under CACHE_AGING, so recent_used orders
+   entries by age without touching every entry on each lookup. */
+static int cache_clock;
+
+/* Owner that cache_flush_dirty() takes to mean every entry. */
+#define ANY_OWNER ((block_sector_t) -1)
+
+/* True while the file system device has a journal, set by
+   cache_set_journaling(), and the number of dirty metadata
+   entries it has to commit. */
+static bool journaling;
+static size_t meta_dirty_cnt;
+
+/* Ticks between write-behind passes of the flusher thread, or 0
+   to disable write-behind.  Set by cache_set_flush_interval(). */
+static int64_t flush_interval = CACHE_FLUSH_DEFAULT;
+
+/* Set by cache_close() to make the flusher and warm-up threads
+   exit. */
+static bool flusher_stop;
+
+/* True if the file system device has a warm-up area. */
+static bool warm_enabled;
+
+/* Idle-time write-back.  While the CPU has nothing else to do,
+   the idle thread queues idle_flush, which writes back a few
+   dirty entries at the lowest priority, so that the flusher and
+   evictions find less to do.  IDLE_DIRTY is set as entries
+   become dirty and cleared when a pass finds few left. */
+static struct idle_work idle_hook;
+static struct workqueue idle_wq;
+static struct work idle_flush;
+static bool idle_dirty;
+
+/* Read-ahead requests queued by cache_prefetch() and consumed by
+   the cache_prefetcher thread, a ring buffer protected by
+   prefetch_lock. */
+static block_sector_t prefetch_queue[PREFETCH_QUEUE_SIZE];
+static size_t prefetch_head;            /* Next request to consume. */
+static size_t prefetch_cnt;             /* # of queued requests. */
+static struct lock prefetch_lock;
+static struct condition prefetch_ready;
+
+/* Statistics. */
+static unsigned long long lookup_cnt;   /* # of calls to cache_lookup(). */
+static unsigned long long hit_cnt;      /* # of lookups that found the sector. */
+static unsigned long long data_lookup_cnt; /* ...of them for file data. */
+static unsigned long long data_hit_cnt;    /* ...of them for file data. */
+static unsigned long long probe_cnt;    /* # of key comparisons in cache_index. */
+static unsigned long long flush_cnt;    /* # of sectors written behind. */
+static unsigned long long prefetch_req_cnt;  /* # of sectors queued for read-ahead. */
+static unsigned long long prefetch_drop_cnt; /* # of read-ahead requests dropped. */
+static unsigned long long warm_cnt;     /* # of sectors read in by warm-up. */
+static unsigned long long grow_cnt;     /* # of pages added to the cache. */
+static unsigned long long shrink_cnt;   /* # of pages given back. */
+
+static unsigned cache_hash (const struct hash_elem *e, void *aux UNUSED);
+static bool cache_less (const struct hash_elem *lhs, const struct hash_elem *rhs, void *aux UNUSED);
+static int cache_sector_compare (const void *lhs, const void *rhs);
+static void cache_add_chunk (struct cache_chunk *, void *page, bool user);
+static thread_func cache_flusher;
+static thread_func cache_prefetcher;
+static thread_func cache_warmer;
+static idle_work_func cache_idle;
+static work_func cache_idle_flush;
+static size_t cache_flush_dirty (block_sector_t owner, size_t max);
 
 void
 cache_init (void)
 {
     list_init (&cache_list);
-    lock_init (&global_lock);
-    for (size_t i = 0; i < CACHE_SIZE; i++)
+    lock_init_named (&global_lock, "cache global_lock");
+    cond_init (&entry_free);
+    if (!hash_init_sized (&cache_index, cache_hash, cache_less, NULL, cache_min))
+        PANIC ("cache index creation failed");
+    list_init (&chunk_list);
+    cache_clock = 0;
+    clock_hand = list_end (&cache_list);
+    a1in_head = list_end (&cache_list);
+    a1in_cnt = 0;
+    cache_cnt = 0;
+
+    /* The boot-time cache comes from the kernel pool and is never
+       given back; only growth competes with user frames. */
+    cache_min = ROUND_UP (cache_min, SECTORS_PER_PAGE);
+    if (cache_max < cache_min)
+        cache_max = cache_min;
+    while (cache_cnt < cache_min)
+    {
+        void *page = palloc_get_page (PAL_ZERO);
+        struct cache_chunk *chunk = malloc (sizeof *chunk);
+        if (page == NULL || chunk == NULL)
+            PANIC ("not enough memory for a %zu-sector cache", cache_min);
+        cache_add_chunk (chunk, page, false);
+    }
+    if (policy == CACHE_2Q)
+    {
+        ghost_max = cache_max / A1OUT_SHARE;
+        ghost_next = ghost_cnt = 0;
+        ghosts = malloc (ghost_max * sizeof *ghosts);
+        if (ghosts == NULL)
+            PANIC ("not enough memory for the cache's ghost queue");
+    }
+
+    lock_init (&prefetch_lock);
+    cond_init (&prefetch_ready);
+    prefetch_head = prefetch_cnt = 0;
+    if (thread_create ("cache-readahead", PRI_DEFAULT, cache_prefetcher, NULL) == TID_ERROR)
+        PANIC ("cache read-ahead thread creation failed");
+
+    flusher_stop = false;
+    if (flush_interval > 0
+        && thread_create ("cache-flush", PRI_DEFAULT, cache_flusher, NULL) == TID_ERROR)
+        PANIC ("cache flusher creation failed");
+
+    /* Idle-time write-back is write-behind too. */
+    if (flush_interval > 0)
+    {
+        workqueue_init (&idle_wq, "cache-idle", PRI_MIN);
+        work_init (&idle_flush, cache_idle_flush);
+        thread_add_idle_work (&idle_hook, cache_idle);
+    }
+}
+
+/* Selects the replacement policy named NAME, which is one of
+   "lru", "clock", "aging" or "2q".  Must be called before
+   cache_init().
+   Returns false if NAME is not a known policy. */
+bool
+cache_set_policy (const char *name)
+{
+    if (!strcmp (name, "lru"))
+        policy = CACHE_LRU;
+    else if (!strcmp (name, "clock"))
+        policy = CACHE_CLOCK;
+    else if (!strcmp (name, "aging"))
+        policy = CACHE_AGING;
+    else if (!strcmp (name, "2q"))
+        policy = CACHE_2Q;
+    else
+        return false;
+    return true;
+}
+
+/* Keeps PERCENT percent of the cache for metadata: while metadata
+   takes up no more than that, a miss on file data replaces other
+   file data if any can be replaced, however the policy ranks the
+   entries.  0 turns the reservation off.  Must be called before
+   cache_init().  Returns false if PERCENT is not from 0 to 100. */
+bool
+cache_set_meta_share (int percent)
+{
+    if (percent < 0 || percent > 100)
+        return false;
+    meta_share = percent;
+    return true;
+}
+
+/* Sets the write-behind interval to TICKS timer ticks.  0
+   disables the flusher thread, so dirty entries only reach disk
+   on eviction or at cache_close().  Must be called before
+   cache_init(). */
+void
+cache_set_flush_interval (int64_t ticks)
+{
+    ASSERT (ticks >= 0);
+    flush_interval = ticks;
+}
+
+/* Sets the boot-time cache size to SECTORS, rounded up to a whole
+   page.  Must be called before cache_init(). */
+void
+cache_set_size (size_t sectors)
+{
+    ASSERT (sectors > 0);
+    cache_min = sectors;
+}
+
+/* Lets the cache grow up to SECTORS while user memory is
+   plentiful.  Must be called before cache_init().  Returns false
+   if SECTORS is below the boot-time size set so far. */
+bool
+cache_set_max_size (size_t sectors)
+{
+    if (sectors < cache_min)
+        return false;
+    cache_max = sectors;
+    return true;
+}
+
+/* Returns true if some thread holds a claim on SLOT. */
+static inline bool
+cache_busy (const struct cache_entry *slot)
+{
+    return slot->writer || slot->readers > 0;
+}
+
+/* Returns true if SLOT holds metadata that must wait for a
+   journal commit before it is written to its home sector. */
+static inline bool
+cache_held_for_journal (const struct cache_entry *slot)
+{
+    return journaling && slot->valid && slot->dirty && slot->meta;
+}
+
+/* Returns true if SLOT may not be evicted or given back now. */
+static inline bool
+cache_pinned (const struct cache_entry *slot)
+{
+    return cache_busy (slot) || cache_held_for_journal (slot);
+}
+
+/* Marks SLOT clean once its contents are on disk.  Must be called
+   with global_lock held. */
+static void
+cache_clean (struct cache_entry *slot)
+{
+    if (slot->dirty && slot->meta)
+        meta_dirty_cnt--;
+    slot->dirty = 0;
+    slot->meta = 0;
+}
+
+/* Removes SLOT from cache_list, keeping the clock hand and the
+   start of the A1in queue on valid elements.  Must be called with
+   global_lock held. */
+static void
+cache_unlink (struct cache_entry *slot)
+{
+    if (clock_hand == &slot->elem)
+        clock_hand = list_next (clock_hand);
+    if (a1in_head == &slot->elem)
+        a1in_head = list_next (a1in_head);
+    if (slot->first_use)
+        a1in_cnt--;
+    slot->first_use = 0;
+    list_remove (&slot->elem);
+}
+
+/* Adds SLOT, which is on no list, to the A1in queue of CACHE_2Q
+   as its newest entry if NEWEST is true, else as its oldest, the
+   next to be evicted.  Must be called with global_lock held. */
+static void
+cache_a1in_insert (struct cache_entry *slot, bool newest)
+{
+    if (newest)
+    {
+        list_insert (a1in_head, &slot->elem);
+        a1in_head = &slot->elem;
+    }
+    else
+    {
+        list_push_back (&cache_list, &slot->elem);
+        if (a1in_head == list_end (&cache_list))
+            a1in_head = &slot->elem;
+    }
+    slot->first_use = 1;
+    a1in_cnt++;
+}
+
+/* Remembers that SECTOR was evicted from the A1in queue. */
+static void
+cache_ghost_add (block_sector_t sector)
+{
+    ghosts[ghost_next] = sector;
+    ghost_next = (ghost_next + 1) % ghost_max;
+    if (ghost_cnt < ghost_max)
+        ghost_cnt++;
+}
+
+/* Returns true if SECTOR is among the last cache_cnt / A1OUT_SHARE
+   sectors evicted from the A1in queue, forgetting it if so. */
+static bool
+cache_ghost_take (block_sector_t sector)
+{
+    size_t limit = cache_cnt / A1OUT_SHARE;
+    size_t i;
+
+    if (limit > ghost_cnt)
+        limit = ghost_cnt;
+    for (i = 1; i <= limit; i++)
+    {
+        block_sector_t *g = &ghosts[(ghost_next + ghost_max - i) % ghost_max];
+        if (*g == sector)
+        {
+            *g = GHOST_NONE;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Adds CHUNK, whose buffers live in PAGE, to the cache.  Its
+   entries start out invalid and are placed where the policy
+   looks for victims first.  Must be called with global_lock held
+   or before the cache is in use. */
+static void
+cache_add_chunk (struct cache_chunk *chunk, void *page, bool user)
+{
+    struct list_elem *first = NULL;
+
+    chunk->page = page;
+    chunk->user = user;
+    chunk->extra = false;
+    list_push_back (&chunk_list, &chunk->elem);
+    for (size_t i = 0; i < SECTORS_PER_PAGE; i++)
+    {
+        struct cache_entry *slot = &chunk->entries[i];
+        slot->buffer = chunk->page + i * BLOCK_SECTOR_SIZE;
+        slot->valid = 0;
+        slot->dirty = 0;
+        slot->data = 0;
+        slot->meta = 0;
+        slot->version = 0;
+        slot->owner = ANY_OWNER;
+        slot->recent_used = 0;
+        slot->accessed = 0;
+        slot->first_use = 0;
+        slot->hits = 0;
+        slot->readers = 0;
+        slot->writer = 0;
+        cond_init (&slot->released);
+        switch (policy)
+        {
+            case CACHE_CLOCK:
+                list_insert (clock_hand, &slot->elem);
+                if (first == NULL)
+                    first = &slot->elem;
+                break;
+            case CACHE_AGING:
+                list_push_front (&cache_list, &slot->elem);
+                break;
+            case CACHE_2Q:
+                cache_a1in_insert (slot, false);
+                break;
+            case CACHE_LRU:
+            default:
+                list_push_back (&cache_list, &slot->elem);
+                break;
+        }
+    }
+    if (first != NULL)
+        clock_hand = first;
+    cache_cnt += SECTORS_PER_PAGE;
+}
+
+/* Tries to add one page from the user pool to the cache, if it
+   is below cache_max and user memory is not under pressure.
+   Must be called with global_lock held. */
+static bool
+cache_grow (void)
+{
+    struct cache_chunk *chunk;
+    void *page;
+
+    if (cache_cnt + SECTORS_PER_PAGE > cache_max
+        || palloc_free_cnt (PAL_USER) <= CACHE_GROW_RESERVE)
+        return false;
+    page = palloc_get_page (PAL_USER);
+    if (page == NULL)
+        return false;
+    chunk = malloc (sizeof *chunk);
+    if (chunk == NULL)
+    {
+        palloc_free_page (page);
+        return false;
+    }
+    cache_add_chunk (chunk, page, true);
+    grow_cnt++;
+    return true;
+}
+
+/* Returns an unclaimed entry that could be replaced but for being
+   held for the journal, or a null pointer if there is none.  Must
+   be called with global_lock held. */
+static struct cache_entry *
+cache_journal_held (void)
+{
+    struct list_elem *e;
+
+    if (!journaling)
+        return NULL;
+    for (e = list_begin (&cache_list); e != list_end (&cache_list);
+         e = list_next (e))
+    {
+        struct cache_entry *slot = list_entry (e, struct cache_entry, elem);
+        if (!cache_busy (slot) && cache_held_for_journal (slot))
+            return slot;
+    }
+    return NULL;
+}
+
+/* Adds one page to the cache past cache_max, from the user pool
+   if it has a page to spare, else from the kernel pool, unless
+   it already holds CACHE_JOURNAL_EXTRA such pages.  Used
+   when a single operation has dirtied more metadata than the
+   cache holds: none of it can be evicted until the operation ends
+   and a journal commit writes it home, so without more entries
+   the operation would wait forever.  cache_trim() gives the
+   pages back.  Must be called with global_lock held. */
+static bool
+cache_grow_for_journal (void)
+{
+    struct cache_chunk *chunk;
+    bool user = true;
+    void *page;
+
+    if (extra_cnt >= CACHE_JOURNAL_EXTRA)
+        return false;
+    page = palloc_get_page (PAL_USER);
+    if (page == NULL)
+    {
+        user = false;
+        page = palloc_get_page (0);
+        if (page == NULL)
+            return false;
+    }
+    chunk = malloc (sizeof *chunk);
+    if (chunk == NULL)
+    {
+        palloc_free_page (page);
+        return false;
+    }
+    cache_add_chunk (chunk, page, user);
+    chunk->extra = true;
+    extra_cnt++;
+    grow_cnt++;
+    return true;
+}
+
+/* Returns true if some entry of CHUNK is claimed or held for the
+   journal. */
+static bool
+cache_chunk_busy (const struct cache_chunk *chunk)
+{
+    for (size_t i = 0; i < SECTORS_PER_PAGE; i++)
+        if (cache_pinned (&chunk->entries[i]))
+            return true;
+    return false;
+}
+
+/* Removes CHUNK, none of whose entries is claimed or held for the
+   journal, from the cache and gives its page back to palloc,
+   writing back its dirty entries first.  Must be called with
+   global_lock held, which it releases. */
+static void
+cache_remove_chunk (struct cache_chunk *chunk)
+{
+    size_t i;
+
+    /* Claim every entry so that nobody else touches the chunk
+       while its dirty entries are written back. */
+    for (i = 0; i < SECTORS_PER_PAGE; i++)
+        chunk->entries[i].writer = 1;
+    lock_release (&global_lock);
+    for (i = 0; i < SECTORS_PER_PAGE; i++)
+    {
+        struct cache_entry *slot = &chunk->entries[i];
+        if (slot->valid && slot->dirty)
+            block_write (fs_device, slot->disk_sector, slot->buffer);
+    }
+    lock_acquire (&global_lock);
+    for (i = 0; i < SECTORS_PER_PAGE; i++)
+    {
+        struct cache_entry *slot = &chunk->entries[i];
+        if (slot->valid)
+        {
+            /* Written back above, so it counts as clean now. */
+            cache_clean (slot);
+            hash_delete (&cache_index, &slot->hash_elem);
+            if (!slot->data)
+                meta_cnt--;
+        }
+        cache_unlink (slot);
+
+        /* Waiters look the sector up again when they wake up, so
+           none of them touches SLOT after this. */
+        cond_broadcast (&slot->released, &global_lock);
+    }
+    list_remove (&chunk->elem);
+    cache_cnt -= SECTORS_PER_PAGE;
+    if (chunk->extra)
+        extra_cnt--;
+    shrink_cnt++;
+    lock_release (&global_lock);
+
+    palloc_free_page (chunk->page);
+    free (chunk);
+}
+
+/* Gives one page that the cache took from the user pool back to
+   palloc, writing back its dirty entries first.  Called by the
+   frame allocator when user memory runs out.  Returns false if
+   no such page could be freed. */
+bool
+cache_shrink (void)
+{
+    struct list_elem *e;
+
+    lock_acquire (&global_lock);
+    for (e = list_begin (&chunk_list); e != list_end (&chunk_list);
+         e = list_next (e))
     {
-        cache[i].valid = 0;
-        cache[i].dirty = 0;
-        cache[i].recent_used = 0;
-        memset (cache[i].buffer, 0, BLOCK_SECTOR_SIZE);
-        list_push_back (&cache_list, &cache[i].elem);
+        struct cache_chunk *c = list_entry (e, struct cache_chunk, elem);
+        if (c->user && !cache_chunk_busy (c))
+        {
+            cache_remove_chunk (c);
+            return true;
+        }
     }
+    lock_release (&global_lock);
+    return false;
 }
 
+/* Gives back the pages cache_grow_for_journal() took past
+   cache_max, as far as their entries are not in use, so that the
+   cache returns to its usual size.  Called after each journal
+   commit, which is what releases them. */
+void
+cache_trim (void)
+{
+    for (;;)
+    {
+        struct list_elem *e;
+        struct cache_chunk *chunk = NULL;
+
+        lock_acquire (&global_lock);
+        for (e = list_begin (&chunk_list);
+             extra_cnt > 0 && e != list_end (&chunk_list); e = list_next (e))
+        {
+            struct cache_chunk *c = list_entry (e, struct cache_chunk, elem);
+            if (c->extra && !cache_chunk_busy (c))
+            {
+                chunk = c;
+                break;
+            }
+        }
+        if (chunk == NULL)
+        {
+            lock_release (&global_lock);
+            return;
+        }
+        cache_remove_chunk (chunk);
+    }
+}
+
+/* Returns the valid entry holding SECTOR, or a null pointer,
+   counting the lookup under class CLS.  Must be called with
+   global_lock held. */
 static struct cache_entry *
-cache_lookup (block_sector_t sector)
+cache_lookup (block_sector_t sector, enum cache_class cls)
+{
+    struct cache_entry key;
+    struct hash_elem *e;
+
+    lookup_cnt++;
+    if (cls == CACHE_DATA)
+        data_lookup_cnt++;
+    key.disk_sector = sector;
+    e = hash_find (&cache_index, &key.hash_elem);
+    if (e == NULL)
+        return NULL;
+    hit_cnt++;
+    if (cls == CACHE_DATA)
+        data_hit_cnt++;
+    return hash_entry (e, struct cache_entry, hash_elem);
+}
+
+/* Records an access to SLOT for the replacement policy. */
+static void
+cache_touch (struct cache_entry *slot)
+{
+    switch (policy)
+    {
+        case CACHE_LRU:
+            list_remove (&slot->elem);
+            list_push_front (&cache_list, &slot->elem);
+            break;
+        case CACHE_CLOCK:
+            slot->accessed = 1;
+            break;
+        case CACHE_AGING:
+            /* cache_list stays sorted from least to most recently
+               used: the new stamp is the largest, so the entry
+               belongs at the back. */
+            slot->recent_used = ++cache_clock;
+            list_remove (&slot->elem);
+            list_push_back (&cache_list, &slot->elem);
+            break;
+        case CACHE_2Q:
+            /* Hits in A1in are taken as part of the same use. */
+            if (!slot->first_use)
+            {
+                list_remove (&slot->elem);
+                list_push_front (&cache_list, &slot->elem);
+            }
+            break;
+    }
+}
+
+/* Tags SLOT, which is valid, with class CLS: a sector is taken
+   to hold what it was last requested as.  Must be called with
+   global_lock held. */
+static void
+cache_set_class (struct cache_entry *slot, enum cache_class cls)
+{
+    bool data = cls == CACHE_DATA;
+    if (slot->data != data)
+    {
+        if (data)
+            meta_cnt--;
+        else
+            meta_cnt++;
+        slot->data = data;
+    }
+}
+
+/* Places SLOT, just bound to a new sector of class CLS, for the
+   replacement policy.  Must be called with global_lock held. */
+static void
+cache_place (struct cache_entry *slot, enum cache_class cls)
 {
-    struct cache_entry *ret = NULL;
-    for (size_t i = 0; i < CACHE_SIZE; i++)
+    if (policy != CACHE_2Q)
     {
-        cache[i].recent_used ++;
-        if (!cache[i].valid) continue;
-        if (cache[i].disk_sector == sector)
-            ret = &(cache[i]);
+        cache_touch (slot);
+        return;
     }
-    return ret;
+    cache_unlink (slot);
+    if (cls == CACHE_DATA && !cache_ghost_take (slot->disk_sector))
+        cache_a1in_insert (slot, true);
+    else
+        list_push_front (&cache_list, &slot->elem);
 }
 
+/* Returns true if cache_pick() must pass over SLOT: it is pinned,
+   or PROTECT is true and it holds metadata. */
+static inline bool
+cache_skip (const struct cache_entry *slot, bool protect)
+{
+    return cache_pinned (slot) || (protect && slot->valid && !slot->data);
+}
+
+/* Picks the unclaimed entry to replace according to the policy,
+   passing over metadata held for the journal, and over all
+   metadata if PROTECT is true.  Returns a null pointer if every
+   entry is passed over. */
 static struct cache_entry *
-cache_evcit (void)
+cache_pick (bool protect)
 {
-    struct cache_entry *slot = list_entry (list_back (&cache_list), struct cache_entry, elem);
-    if (slot->dirty)
+    struct cache_entry *slot;
+    struct list_elem *e;
+
+    switch (policy)
     {
-        block_write (fs_device, slot->disk_sector, slot->buffer);
-        slot->dirty = 0;
+        case CACHE_CLOCK:
+            for (size_t i = 0; i < 2 * cache_cnt; i++)
+            {
+                if (clock_hand == list_end (&cache_list))
+                    clock_hand = list_begin (&cache_list);
+                slot = list_entry (clock_hand, struct cache_entry, elem);
+                clock_hand = list_next (clock_hand);
+                if (cache_skip (slot, protect))
+                    continue;
+                if (!slot->valid || !slot->accessed)
+                    return slot;
+                slot->accessed = 0;
+            }
+            return NULL;
+        case CACHE_AGING:
+            for (e = list_begin (&cache_list); e != list_end (&cache_list); e = list_next (e))
+            {
+                slot = list_entry (e, struct cache_entry, elem);
+                if (!cache_skip (slot, protect))
+                    return slot;
+            }
+            return NULL;
+        case CACHE_2Q:
+            /* The oldest entry of A1in, if it holds nothing or A1in
+               is over its share; else the least recently used entry
+               of Am; else any entry of A1in. */
+            for (e = list_rbegin (&cache_list); e != list_rend (&cache_list); e = list_prev (e))
+            {
+                slot = list_entry (e, struct cache_entry, elem);
+                if (!slot->first_use)
+                    break;
+                if (cache_skip (slot, protect))
+                    continue;
+                if (!slot->valid || a1in_cnt > cache_cnt / A1IN_SHARE)
+                    return slot;
+                break;
+            }
+            for (e = list_prev (a1in_head); e != list_rend (&cache_list); e = list_prev (e))
+            {
+                slot = list_entry (e, struct cache_entry, elem);
+                if (!cache_skip (slot, protect))
+                    return slot;
+            }
+            for (e = list_rbegin (&cache_list); e != list_rend (&cache_list); e = list_prev (e))
+            {
+                slot = list_entry (e, struct cache_entry, elem);
+                if (!slot->first_use)
+                    break;
+                if (!cache_skip (slot, protect))
+                    return slot;
+            }
+            return NULL;
+        case CACHE_LRU:
+        default:
+            for (e = list_rbegin (&cache_list); e != list_rend (&cache_list); e = list_prev (e))
+            {
+                slot = list_entry (e, struct cache_entry, elem);
+                if (!cache_skip (slot, protect))
+                    return slot;
+            }
+            return NULL;
     }
-    slot->valid = 0;
+}
+
+/* Picks the entry to replace for a sector of class CLS.  While
+   metadata fills no more than its share of the cache, file data
+   replaces metadata only if no other entry can be replaced. */
+static struct cache_entry *
+cache_victim (enum cache_class cls)
+{
+    bool protect = cls == CACHE_DATA && meta_cnt * 100 <= cache_cnt * meta_share;
+    struct cache_entry *slot = cache_pick (protect);
+
+    if (slot == NULL && protect)
+        slot = cache_pick (false);
     return slot;
 }
 
-void
-cache_read (block_sector_t sector, void *target)
+/* Drops a claim on SLOT.  Must be called with global_lock held. */
+static void
+cache_unclaim (struct cache_entry *slot, bool exclusive)
+{
+    if (exclusive)
+        slot->writer = 0;
+    else
+        slot->readers--;
+    if (!cache_busy (slot))
+    {
+        cond_broadcast (&slot->released, &global_lock);
+        cond_signal (&entry_free, &global_lock);
+    }
+}
+
+/* Finds or loads SECTOR and claims its entry, shared or
+   EXCLUSIVE.  If LOAD is false and the sector is not cached, the
+   entry is claimed without reading the sector from disk, because
+   the caller is about to overwrite all of it.  If ABSENT is true
+   and the sector is cached, nothing is claimed and a null
+   pointer is returned.  The entry is tagged with class CLS.
+   Returns with the claim held and global_lock released. */
+static struct cache_entry *
+cache_claim (block_sector_t sector, bool exclusive, bool load, bool absent,
+             enum cache_class cls)
 {
+    struct cache_entry *slot;
+
     lock_acquire (&global_lock);
-    struct cache_entry *slot = cache_lookup (sector);
-    if (slot == NULL)
+    for (;;)
     {
-        slot = cache_evcit ();
+        slot = cache_lookup (sector, cls);
+        if (slot != NULL)
+        {
+            if (absent)
+            {
+                lock_release (&global_lock);
+                return NULL;
+            }
+            if (slot->writer || (exclusive && slot->readers > 0))
+            {
+                /* The entry may be recycled while we sleep, so look
+                   the sector up again afterward. */
+                cond_wait (&slot->released, &global_lock);
+                continue;
+            }
+            break;
+        }
+
+        slot = cache_victim (cls);
+        if (slot == NULL)
+        {
+            slot = cache_journal_held ();
+            if (slot == NULL)
+            {
+                cond_wait (&entry_free, &global_lock);
+                continue;
+            }
+            if (cache_grow_for_journal ())
+                continue;
+
+            /* The cache may grow no further, so write SLOT home
+               ahead of its commit (see journal_commit()). */
+            ASSERT (slot->valid && slot->dirty);
+        }
+        else if (slot->valid && ++evict_cnt % CACHE_GROW_PERIOD == 0
+                 && cache_grow ())
+            continue;
+
+        if (slot->valid && slot->dirty)
+        {
+            /* Write the old contents back without holding
+               global_lock, then retry: another thread may have
+               brought SECTOR in meanwhile. */
+            slot->writer = 1;
+            lock_release (&global_lock);
+            block_write (fs_device, slot->disk_sector, slot->buffer);
+            lock_acquire (&global_lock);
+            cache_clean (slot);
+            cache_unclaim (slot, true);
+            continue;
+        }
+
+        /* Rebind the clean victim to SECTOR before dropping
+           global_lock, so that concurrent misses on SECTOR wait
+           for our read instead of issuing their own. */
+        if (slot->valid)
+        {
+            hash_delete (&cache_index, &slot->hash_elem);
+            if (slot->first_use)
+                cache_ghost_add (slot->disk_sector);
+            if (!slot->data)
+                meta_cnt--;
+        }
         slot->valid = 1;
+        slot->hits = 0;
+        slot->data = cls == CACHE_DATA;
+        if (!slot->data)
+            meta_cnt++;
         slot->dirty = 0;
+        slot->meta = 0;
         slot->disk_sector = sector;
-        block_read (fs_device, sector, slot->buffer);
+        hash_insert (&cache_index, &slot->hash_elem);
+        cache_place (slot, cls);
+        slot->writer = 1;
+        if (load)
+        {
+            lock_release (&global_lock);
+            block_read (fs_device, sector, slot->buffer);
+            lock_acquire (&global_lock);
+        }
+        if (!exclusive)
+        {
+            /* Downgrade to a shared claim and let in the readers
+               that queued up behind the load. */
+            slot->writer = 0;
+            slot->readers++;
+            cond_broadcast (&slot->released, &global_lock);
+        }
+        lock_release (&global_lock);
+        return slot;
     }
-    slot->recent_used = 0;
-    list_sort (&cache_list, cache_recent_used_more, NULL);
-    memcpy (target, slot->buffer, BLOCK_SECTOR_SIZE);
+    cache_set_class (slot, cls);
+    cache_touch (slot);
+    slot->hits++;
+
+    if (exclusive)
+        slot->writer = 1;
+    else
+        slot->readers++;
     lock_release (&global_lock);
+    return slot;
 }
 
+/* Drops the claim taken by cache_claim(), first marking SLOT
+   dirty if DIRTY is true, with metadata if META is true.  An
+   entry stays metadata until it is clean, so that a sector freed
+   from metadata and reused for data is not written home ahead of
+   the commit that frees it. */
+static void
+cache_release (struct cache_entry *slot, bool exclusive, bool dirty, bool meta)
+{
+    lock_acquire (&global_lock);
+    if (dirty)
+    {
+        if (meta && !(slot->dirty && slot->meta))
+            meta_dirty_cnt++;
+        if (meta)
+            slot->meta = 1;
+        if (slot->meta)
+            slot->version++;
+        slot->dirty = 1;
+        idle_dirty = true;
+    }
+    cache_unclaim (slot, exclusive);
+    lock_release (&global_lock);
+}
+
+/* Pins SECTOR in the cache for reading and returns a pointer to
+   its BLOCK_SECTOR_SIZE bytes, storing the entry in *HANDLE for
+   cache_unpin().  Other readers may share the entry meanwhile,
+   but writers wait until it is unpinned. */
+const void *
+cache_pin_read (block_sector_t sector, enum cache_class cls, struct cache_entry **handle)
+{
+    *handle = cache_claim (sector, false, true, false, cls);
+    return (*handle)->buffer;
+}
+
+/* Pins SECTOR in the cache for writing and returns a pointer to
+   its data, storing the entry in *HANDLE for cache_unpin(), which
+   marks it dirty.  If the caller will overwrite the whole sector,
+   LOAD may be false to skip reading a missing sector from disk.
+   No other thread can access the sector until it is unpinned.
+   Only metadata is written in place this way. */
+void *
+cache_pin_write (block_sector_t sector, block_sector_t owner, bool load,
+                 struct cache_entry **handle)
+{
+    *handle = cache_claim (sector, true, load, false, CACHE_META);
+    (*handle)->owner = owner;
+    return (*handle)->buffer;
+}
+
+/* Unpins HANDLE, obtained from cache_pin_read() or
+   cache_pin_write().  A write pin is the only claim on its entry,
+   so it can be told apart from a read pin by the writer flag. */
 void
-cache_write (block_sector_t sector, const void *source)
+cache_unpin (struct cache_entry *handle)
 {
+    bool exclusive = handle->writer;
+    cache_release (handle, exclusive, exclusive, false);
+}
+
+/* Unpins HANDLE, obtained from cache_pin_write(), marking the
+   sector as metadata to be journaled. */
+void
+cache_unpin_meta (struct cache_entry *handle)
+{
+    ASSERT (handle->writer);
+    cache_release (handle, true, true, true);
+}
+
+/* Copies SIZE bytes starting at byte OFS of SECTOR, of class CLS,
+   into TARGET. */
+void
+cache_read_at (block_sector_t sector, enum cache_class cls, void *target,
+               size_t ofs, size_t size)
+{
+    ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+    KTRACE (KTRACE_CACHE_READ, sector);
+    struct cache_entry *slot = cache_claim (sector, false, true, false, cls);
+    KTRACE (KTRACE_CACHE_READ_DONE, sector);
+    memcpy (target, slot->buffer + ofs, size);
+    cache_release (slot, false, false, false);
+}
+
+/* Copies SIZE bytes from SOURCE to byte OFS of SECTOR, of class
+   CLS, on behalf of the inode at OWNER, to be journaled if META
+   is true. */
+static void
+cache_write_common (block_sector_t sector, enum cache_class cls, block_sector_t owner,
+                    const void *source, size_t ofs, size_t size, bool meta)
+{
+    ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+    struct cache_entry *slot = cache_claim (sector, true, size < BLOCK_SECTOR_SIZE, false, cls);
+    memcpy (slot->buffer + ofs, source, size);
+    slot->owner = owner;
+    cache_release (slot, true, true, meta);
+}
+
+/* Copies SIZE bytes from SOURCE to byte OFS of SECTOR, of class
+   CLS, part of the file whose inode is at sector OWNER.  The rest
+   of the sector is read from disk first only if it is not cached
+   and the write does not cover the whole sector. */
+void
+cache_write_at (block_sector_t sector, enum cache_class cls, block_sector_t owner,
+                const void *source, size_t ofs, size_t size)
+{
+    cache_write_common (sector, cls, owner, source, ofs, size, false);
+}
+
+/* Like cache_write_at(), for a sector of file system metadata:
+   an inode, an index block, or a directory or free map sector. */
+void
+cache_write_meta_at (block_sector_t sector, block_sector_t owner, const void *source,
+                     size_t ofs, size_t size)
+{
+    cache_write_common (sector, CACHE_META, owner, source, ofs, size, true);
+}
+
+void
+cache_read (block_sector_t sector, enum cache_class cls, void *target)
+{
+    cache_read_at (sector, cls, target, 0, BLOCK_SECTOR_SIZE);
+}
+
+void
+cache_write (block_sector_t sector, enum cache_class cls, block_sector_t owner,
+             const void *source)
+{
+    cache_write_at (sector, cls, owner, source, 0, BLOCK_SECTOR_SIZE);
+}
+
+void
+cache_write_meta (block_sector_t sector, block_sector_t owner, const void *source)
+{
+    cache_write_meta_at (sector, owner, source, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes back up to MAX dirty entries last written for OWNER, or
+   for any owner if OWNER is ANY_OWNER, that are not exclusively
+   claimed or held for the journal, in ascending sector order so
+   that the disk head sweeps once.  Returns the number written.
+   All the writes are queued before waiting for any, so that the
+   block layer merges runs of consecutive sectors and the disk
+   stays busy, while other disks serve their own requests.
+   Entries are claimed shared during the write, so readers of the
+   same sector proceed while it is in flight. */
+static size_t
+cache_flush_dirty (block_sector_t owner, size_t max)
+{
+    struct cache_entry **dirty;
+    struct block_request *reqs;
+    struct list_elem *e;
+    size_t cnt = 0;
+
     lock_acquire (&global_lock);
-    struct cache_entry *slot = cache_lookup (sector);
-    if (slot == NULL)
+    dirty = malloc (cache_cnt * sizeof *dirty);
+    if (dirty == NULL)
     {
-        slot = cache_evcit ();
-        slot->valid = 1;
-        slot->dirty = 0;
-        slot->disk_sector = sector;
-        block_read (fs_device, sector, slot->buffer);
+        /* Try again on the next pass. */
+        lock_release (&global_lock);
+        return 0;
+    }
+    for (e = list_begin (&cache_list); e != list_end (&cache_list) && cnt < max;
+         e = list_next (e))
+    {
+        struct cache_entry *slot = list_entry (e, struct cache_entry, elem);
+        if (slot->valid && slot->dirty && !slot->writer && !cache_held_for_journal (slot)
+            && (owner == ANY_OWNER || slot->owner == owner))
+        {
+            slot->readers++;
+            dirty[cnt++] = slot;
+        }
     }
-    slot->recent_used = 0;
-    slot->dirty = 1;
-    list_sort (&cache_list, cache_recent_used_more, NULL);
-    memcpy (slot->buffer, source, BLOCK_SECTOR_SIZE);
     lock_release (&global_lock);
+
+    qsort (dirty, cnt, sizeof *dirty, cache_sector_compare);
+    /* A shared claim keeps writers out, so the sectors cannot be
+       redirtied until the writes complete.  Without room for the
+       requests, write one sector at a time. */
+    reqs = cnt > 1 ? malloc (cnt * sizeof *reqs) : NULL;
+    for (size_t i = 0; i < cnt; i++)
+    {
+        if (reqs == NULL)
+            block_write (fs_device, dirty[i]->disk_sector, dirty[i]->buffer);
+        else
+        {
+            block_request_init (&reqs[i], true, dirty[i]->disk_sector, dirty[i]->buffer, 1);
+            block_submit (fs_device, &reqs[i]);
+        }
+    }
+    if (reqs != NULL)
+        for (size_t i = 0; i < cnt; i++)
+            block_wait (&reqs[i]);
+    lock_acquire (&global_lock);
+    for (size_t i = 0; i < cnt; i++)
+    {
+        cache_clean (dirty[i]);
+        flush_cnt++;
+        cache_unclaim (dirty[i], false);
+    }
+    lock_release (&global_lock);
+    free (reqs);
+    free (dirty);
+    return cnt;
+}
+
+/* Writes back every dirty entry that is not held for the
+   journal. */
+void
+cache_flush (void)
+{
+    cache_flush_dirty (ANY_OWNER, SIZE_MAX);
+}
+
+/* Writes back the dirty entries last written for the file whose
+   inode is at sector OWNER, except metadata held for the
+   journal, and waits for them to reach the disk. */
+void
+cache_flush_owner (block_sector_t owner)
+{
+    ASSERT (owner != ANY_OWNER);
+    cache_flush_dirty (owner, SIZE_MAX);
+}
+
+/* Write-behind thread: every flush_interval ticks, brings the
+   free map file up to date and writes dirty entries back so that
+   evictions rarely have to.  With a journal, that is all done by
+   a journal commit. */
+static void
+cache_flusher (void *aux UNUSED)
+{
+    block_set_io_class (BLOCK_IO_WRITEBACK);
+    while (!flusher_stop)
+    {
+        timer_sleep (flush_interval);
+        if (flusher_stop)
+            break;
+        if (journaling)
+            journal_commit ();
+        else
+        {
+            free_map_sync ();
+            cache_flush_dirty (ANY_OWNER, SIZE_MAX);
+        }
+    }
+}
+
+/* Idle work: queues an idle-time write-back if entries have
+   become dirty since the last one found few.  The write-back
+   itself sleeps on the disk, which the idle thread must not, so
+   it runs on a worker. */
+static bool
+cache_idle (void)
+{
+    if (idle_dirty && !flusher_stop)
+    {
+        idle_dirty = false;
+        work_queue (&idle_wq, &idle_flush);
+    }
+    return false;
+}
+
+/* Writes back up to CACHE_IDLE_FLUSH dirty entries, then leaves
+   the next batch to the next idle moment. */
+static void
+cache_idle_flush (struct work *w UNUSED)
+{
+    if (!flusher_stop && cache_flush_dirty (ANY_OWNER, CACHE_IDLE_FLUSH) == CACHE_IDLE_FLUSH)
+        idle_dirty = true;
+}
+
+/* Turns journaling of metadata on or off.  While it is on, dirty
+   metadata entries are written home only by journal commits,
+   through cache_snapshot_meta() and cache_meta_written(). */
+void
+cache_set_journaling (bool enable)
+{
+    lock_acquire (&global_lock);
+    journaling = enable;
+    lock_release (&global_lock);
+}
+
+/* Returns true if MAX or more metadata entries are dirty, or
+   enough of them that evictions would start to find no victim. */
+bool
+cache_meta_crowded (size_t max)
+{
+    return meta_dirty_cnt >= max || meta_dirty_cnt >= cache_cnt / 4;
+}
+
+/* Copies up to MAX dirty metadata entries into SNAPS, each with
+   its contents in the next
+   BLOCK_SECTOR_SIZE bytes of BUFFERS.  The entries stay dirty
+   until cache_meta_written() says the copies are home.  Returns
+   the number copied. */
+size_t
+cache_snapshot_meta (struct cache_snapshot *snaps, void *buffers, size_t max)
+{
+    uint8_t *buf = buffers;
+    struct list_elem *e;
+    size_t cnt = 0;
+
+    lock_acquire (&global_lock);
+    for (e = list_begin (&cache_list); e != list_end (&cache_list) && cnt < max;
+         e = list_next (e))
+    {
+        struct cache_entry *slot = list_entry (e, struct cache_entry, elem);
+        if (slot->valid && slot->dirty && slot->meta && !slot->writer)
+        {
+            struct cache_snapshot *s = &snaps[cnt];
+            s->sector = slot->disk_sector;
+            s->slot = slot;
+            s->version = slot->version;
+            memcpy (buf + cnt * BLOCK_SECTOR_SIZE, slot->buffer, BLOCK_SECTOR_SIZE);
+            cnt++;
+        }
+    }
+    lock_release (&global_lock);
+    return cnt;
+}
+
+/* Marks clean the entries of the CNT snapshots in SNAPS that have
+   not been written again since, now that the copies are on disk
+   at their home sectors. */
+void
+cache_meta_written (const struct cache_snapshot *snaps, size_t cnt)
+{
+    size_t i;
+
+    lock_acquire (&global_lock);
+    for (i = 0; i < cnt; i++)
+    {
+        struct cache_entry *slot = snaps[i].slot;
+        if (slot->valid && slot->disk_sector == snaps[i].sector
+            && slot->version == snaps[i].version && !slot->writer)
+            cache_clean (slot);
+    }
+    cond_broadcast (&entry_free, &global_lock);
+    lock_release (&global_lock);
+}
+
+/* Makes SECTOR, if it is cached, the next entry the replacement
+   policy picks, as for data read once and not wanted again, so
+   that streaming through a file does not push out the entries
+   other readers keep using. */
+void
+cache_demote (block_sector_t sector)
+{
+    struct cache_entry key;
+    struct hash_elem *e;
+
+    lock_acquire (&global_lock);
+    key.disk_sector = sector;
+    e = hash_find (&cache_index, &key.hash_elem);
+    if (e != NULL)
+    {
+        struct cache_entry *slot = hash_entry (e, struct cache_entry, hash_elem);
+        switch (policy)
+        {
+            case CACHE_LRU:
+                list_remove (&slot->elem);
+                list_push_back (&cache_list, &slot->elem);
+                break;
+            case CACHE_CLOCK:
+                slot->accessed = 0;
+                break;
+            case CACHE_AGING:
+                slot->recent_used = 0;
+                list_remove (&slot->elem);
+                list_push_front (&cache_list, &slot->elem);
+                break;
+            case CACHE_2Q:
+                cache_unlink (slot);
+                cache_a1in_insert (slot, false);
+                break;
+        }
+    }
+    lock_release (&global_lock);
+}
+
+/* Asks the read-ahead thread to bring SECTOR, a sector of file
+   data, into the cache.  Never blocks on disk I/O: if the queue
+   is full the request is simply dropped. */
+void
+cache_prefetch (block_sector_t sector)
+{
+    lock_acquire (&prefetch_lock);
+    if (prefetch_cnt < PREFETCH_QUEUE_SIZE)
+    {
+        prefetch_queue[(prefetch_head + prefetch_cnt++) % PREFETCH_QUEUE_SIZE] = sector;
+        prefetch_req_cnt++;
+        cond_signal (&prefetch_ready, &prefetch_lock);
+    }
+    else
+        prefetch_drop_cnt++;
+    lock_release (&prefetch_lock);
+}
+
+/* Returns the most sectors to read with one command into BOUNCE,
+   which may be null: holding more than a few claims at once could
+   starve everyone else of entries in a small cache. */
+static size_t
+cache_run_max (const uint8_t *bounce)
+{
+    size_t max = bounce != NULL ? cache_cnt / 4 : 1;
+    if (max > SECTORS_PER_PAGE)
+        max = SECTORS_PER_PAGE;
+    if (max < 1)
+        max = 1;
+    return max;
+}
+
+/* Brings the LEN sectors from FIRST, of class CLS, into the cache,
+   where not cached already.  LEN is at most cache_run_max()
+   (BOUNCE).  Each run of them that is not cached is read with one
+   multi-sector command through BOUNCE. */
+static void
+cache_load_run (block_sector_t first, size_t len, enum cache_class cls, uint8_t *bounce)
+{
+    struct cache_entry *run[SECTORS_PER_PAGE];
+    size_t cnt, i;
+
+    for (i = 0; i < len; i += cnt + 1)
+    {
+        /* Claim the uncached sectors from FIRST + I up to the
+           next cached one, which is skipped. */
+        for (cnt = 0; i + cnt < len; cnt++)
+        {
+            run[cnt] = cache_claim (first + i + cnt, true, false, true, cls);
+            if (run[cnt] == NULL)
+                break;
+        }
+        if (cnt == 1)
+            block_read (fs_device, first + i, run[0]->buffer);
+        else if (cnt > 1)
+        {
+            block_read_multiple (fs_device, first + i, bounce, cnt);
+            for (size_t j = 0; j < cnt; j++)
+                memcpy (run[j]->buffer, bounce + j * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE);
+        }
+        for (size_t j = 0; j < cnt; j++)
+            cache_release (run[j], true, false, false);
+    }
+}
+
+/* Read-ahead thread: loads the sectors queued by
+   cache_prefetch() so that sequential readers find them cached.
+   Queued requests for consecutive sectors are taken together,
+   and the uncached ones among them are read with one
+   multi-sector command per run. */
+static void
+cache_prefetcher (void *aux UNUSED)
+{
+    /* Without a bounce buffer, read one sector at a time. */
+    uint8_t *bounce = malloc (SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE);
+
+    block_set_io_class (BLOCK_IO_READAHEAD);
+    for (;;)
+    {
+        size_t max = cache_run_max (bounce);
+        block_sector_t first;
+        size_t len;
+
+        lock_acquire (&prefetch_lock);
+        while (prefetch_cnt == 0)
+            cond_wait (&prefetch_ready, &prefetch_lock);
+        first = prefetch_queue[prefetch_head];
+        len = 0;
+        do
+        {
+            prefetch_head = (prefetch_head + 1) % PREFETCH_QUEUE_SIZE;
+            prefetch_cnt--;
+            len++;
+        }
+        while (len < max && prefetch_cnt > 0
+               && prefetch_queue[prefetch_head] == first + len);
+        lock_release (&prefetch_lock);
+
+        cache_load_run (first, len, CACHE_DATA, bounce);
+    }
+}
+
+/* Reserves the warm-up area on a file system being formatted and
+   records an empty list there.  Must come right after
+   journal_format().  A device too small for it goes without. */
+void
+cache_warm_format (void)
+{
+    struct cache_warm *warm = calloc (1, sizeof *warm);
+
+    if (warm == NULL)
+        PANIC ("can't allocate cache warm-up record");
+    if (free_map_allocate_at (CACHE_WARM_START, CACHE_WARM_SECTORS))
+    {
+        warm->magic = CACHE_WARM_MAGIC;
+        warm->checksum = hash_bytes (warm->sectors, 0);
+        block_write_multiple (fs_device, CACHE_WARM_START, warm, CACHE_WARM_SECTORS);
+        warm_enabled = true;
+    }
+    free (warm);
+}
+
+/* Looks for the warm-up area on the file system device and, if
+   it lists any sectors, starts a thread that reads them into the
+   cache in the background.  A device formatted without the area,
+   or whose record was not completely written, starts cold.  Must
+   be called once the file system is mounted. */
+void
+cache_warm_start (void)
+{
+    struct cache_warm *warm;
+
+    if (block_size (fs_device) < CACHE_WARM_START + CACHE_WARM_SECTORS)
+        return;
+    warm = malloc (sizeof *warm);
+    if (warm == NULL)
+        return;
+    block_read_multiple (fs_device, CACHE_WARM_START, warm, CACHE_WARM_SECTORS);
+    if (warm->magic != CACHE_WARM_MAGIC || warm->cnt > CACHE_WARM_MAX
+        || warm->checksum != hash_bytes (warm->sectors, warm->cnt * sizeof *warm->sectors))
+    {
+        free (warm);
+        return;
+    }
+    warm_enabled = true;
+    if (warm->cnt == 0
+        || thread_create ("cache-warm", PRI_DEFAULT, cache_warmer, warm) == TID_ERROR)
+        free (warm);
+}
+
+/* Orders recorded warm-up sectors by sector number. */
+static int
+cache_warm_compare (const void *lhs, const void *rhs)
+{
+    block_sector_t a = *(const block_sector_t *) lhs & ~CACHE_WARM_DATA;
+    block_sector_t b = *(const block_sector_t *) rhs & ~CACHE_WARM_DATA;
+
+    return a < b ? -1 : a > b;
+}
+
+/* Warm-up thread: reads the sectors of struct cache_warm WARM_
+   into the cache in ascending order, so that the disk head sweeps
+   once, with one multi-sector read for each run of adjacent
+   sectors of the same class, then exits. */
+static void
+cache_warmer (void *warm_)
+{
+    struct cache_warm *warm = warm_;
+    uint8_t *bounce = malloc (SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE);
+    block_sector_t size = block_size (fs_device);
+    size_t i, len;
+
+    block_set_io_class (BLOCK_IO_READAHEAD);
+    qsort (warm->sectors, warm->cnt, sizeof *warm->sectors, cache_warm_compare);
+    for (i = 0; i < warm->cnt && !flusher_stop; i += len)
+    {
+        size_t max = cache_run_max (bounce);
+        block_sector_t first = warm->sectors[i] & ~CACHE_WARM_DATA;
+        enum cache_class cls = warm->sectors[i] & CACHE_WARM_DATA ? CACHE_DATA : CACHE_META;
+
+        for (len = 1; len < max && i + len < warm->cnt
+             && warm->sectors[i + len] == warm->sectors[i] + len; len++)
+            continue;
+        if (first + len <= size)
+        {
+            cache_load_run (first, len, cls, bounce);
+            warm_cnt += len;
+        }
+    }
+    free (bounce);
+    free (warm);
+}
+
+/* Orders pointers to cache entries by descending hits. */
+static int
+cache_hits_compare (const void *lhs, const void *rhs)
+{
+    const struct cache_entry *a = *(struct cache_entry * const *) lhs;
+    const struct cache_entry *b = *(struct cache_entry * const *) rhs;
+
+    return a->hits > b->hits ? -1 : a->hits < b->hits;
+}
+
+/* Records the valid entries with the most hits, up to
+   CACHE_WARM_MAX of them, in the warm-up area.  Must be called
+   with global_lock held, once nothing else uses the cache. */
+static void
+cache_warm_save (void)
+{
+    struct cache_entry **hot;
+    struct cache_warm *warm;
+    struct list_elem *e;
+    size_t cnt = 0, i;
+
+    if (!warm_enabled)
+        return;
+    hot = malloc (cache_cnt * sizeof *hot);
+    warm = calloc (1, sizeof *warm);
+    if (hot != NULL && warm != NULL)
+    {
+        for (e = list_begin (&cache_list); e != list_end (&cache_list); e = list_next (e))
+        {
+            struct cache_entry *slot = list_entry (e, struct cache_entry, elem);
+            if (slot->valid)
+                hot[cnt++] = slot;
+        }
+        qsort (hot, cnt, sizeof *hot, cache_hits_compare);
+        if (cnt > CACHE_WARM_MAX)
+            cnt = CACHE_WARM_MAX;
+        for (i = 0; i < cnt; i++)
+            warm->sectors[i] = hot[i]->disk_sector | (hot[i]->data ? CACHE_WARM_DATA : 0);
+        warm->magic = CACHE_WARM_MAGIC;
+        warm->cnt = cnt;
+        warm->checksum = hash_bytes (warm->sectors, cnt * sizeof *warm->sectors);
+        block_write_multiple (fs_device, CACHE_WARM_START, warm, CACHE_WARM_SECTORS);
+    }
+    free (hot);
+    free (warm);
 }
 
 void
 cache_close (void)
 {
+    struct list_elem *e;
+
+    flusher_stop = true;
+    if (flush_interval > 0)
+        workqueue_flush (&idle_wq);
     lock_acquire (&global_lock);
-    for (size_t i = 0; i < CACHE_SIZE; i++)
+    for (e = list_begin (&cache_list); e != list_end (&cache_list); e = list_next (e))
     {
-        if (!cache[i].valid) continue;
-        if (cache[i].dirty)
-            block_write (fs_device, cache[i].disk_sector, cache[i].buffer);
+        struct cache_entry *slot = list_entry (e, struct cache_entry, elem);
+        if (!slot->valid) continue;
+        while (cache_busy (slot))
+            cond_wait (&slot->released, &global_lock);
+        if (slot->dirty)
+        {
+            block_write (fs_device, slot->disk_sector, slot->buffer);
+            cache_clean (slot);
+        }
     }
+    cache_warm_save ();
+    lock_release (&global_lock);
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+    static const char *policy_names[] = {"lru", "clock", "aging", "2q"};
+    unsigned long long tenths = lookup_cnt ? probe_cnt * 10 / lookup_cnt : 0;
+    printf ("Cache (%s): %zu sectors (%llu pages grown, %llu shrunk), %llu lookups, %llu hits, %llu probes (%llu.%llu per lookup), "
+            "%llu written behind, %llu read ahead (%llu dropped), %llu warmed up\n",
+            policy_names[policy], cache_cnt, grow_cnt, shrink_cnt, lookup_cnt, hit_cnt, probe_cnt, tenths / 10, tenths % 10,
+            flush_cnt, prefetch_req_cnt, prefetch_drop_cnt, warm_cnt);
+    printf ("Cache: metadata %zu sectors (%d%% kept), %llu hits, %llu misses; data %llu hits, %llu misses\n",
+            meta_cnt, meta_share,
+            hit_cnt - data_hit_cnt, (lookup_cnt - data_lookup_cnt) - (hit_cnt - data_hit_cnt),
+            data_hit_cnt, data_lookup_cnt - data_hit_cnt);
+}
+
+/* Stores the number of sectors cached, lookups made and lookups
+   that hit in *SECTORS, *LOOKUPS and *HITS. */
+void
+cache_get_stats (size_t *sectors, unsigned long long *lookups, unsigned long long *hits)
+{
+    lock_acquire (&global_lock);
+    *sectors = cache_cnt;
+    *lookups = lookup_cnt;
+    *hits = hit_cnt;
     lock_release (&global_lock);
 }
 
+static unsigned
+cache_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+    const struct cache_entry *entry = hash_entry (e, struct cache_entry, hash_elem);
+    return hash_int (entry->disk_sector);
+}
+
+/* Every key comparison made by hash_find() in cache_lookup() or
+   hash_insert() in cache_claim() is counted as one probe. */
 static bool
-cache_recent_used_more (const struct list_elem *lhs, const struct list_elem *rhs, void *aux UNUSED)
-{
-  struct cache_entry *a, *b;
-  
-  ASSERT (lhs != NULL && rhs != NULL);
-  
-  a = list_entry (lhs, struct cache_entry, elem);
-  b = list_entry (rhs, struct cache_entry, elem);
-  
-  return (a->recent_used > b->recent_used);
+cache_less (const struct hash_elem *lhs, const struct hash_elem *rhs, void *aux UNUSED)
+{
+    const struct cache_entry *a = hash_entry (lhs, struct cache_entry, hash_elem);
+    const struct cache_entry *b = hash_entry (rhs, struct cache_entry, hash_elem);
+
+    probe_cnt++;
+    return a->disk_sector < b->disk_sector;
+}
+
+/* Orders pointers to cache entries by ascending disk sector. */
+static int
+cache_sector_compare (const void *lhs, const void *rhs)
+{
+    const struct cache_entry *a = *(struct cache_entry * const *) lhs;
+    const struct cache_entry *b = *(struct cache_entry * const *) rhs;
+
+    return a->disk_sector < b->disk_sector ? -1 : a->disk_sector > b->disk_sector;
 }
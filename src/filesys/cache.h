@@ -1,11 +1,89 @@
 #ifndef FILESYS_CACHE_H
 #define FILESYS_CACHE_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "devices/block.h"
+#include "filesys/journal.h"
+
+/* First sector and length of the area on the file system device
+   where cache_close() records the sectors the cache used most,
+   for cache_warm_start() to read in again after the next mount.
+   Reserved when the file system is formatted, right after the
+   journal. */
+#define CACHE_WARM_START (JOURNAL_START + JOURNAL_SECTORS)
+#define CACHE_WARM_SECTORS 8
+
+/* Buffer cache replacement policies. */
+enum cache_policy
+  {
+    CACHE_LRU,                  /* Least recently used, move-to-front list. */
+    CACHE_CLOCK,                /* Second chance over the entry list. */
+    CACHE_AGING,                /* Access stamps, list resorted on each access. */
+    CACHE_2Q                    /* Scan-resistant: used-once FIFO, then LRU. */
+  };
+
+/* What a cached sector holds, as the file system tags each
+   request.  Metadata keeps a share of the cache that file data
+   cannot take from it; see cache_set_meta_share(). */
+enum cache_class
+  {
+    CACHE_META,                 /* Inode, index block, directory or free map. */
+    CACHE_DATA                  /* Data of a regular file. */
+  };
+
+bool cache_set_policy (const char *name);
+bool cache_set_meta_share (int percent);
+void cache_set_flush_interval (int64_t ticks);
+void cache_set_size (size_t sectors);
+bool cache_set_max_size (size_t sectors);
+bool cache_shrink (void);
+void cache_trim (void);
 
 void cache_init (void);
-void cache_read (block_sector_t sector, void *target);
-void cache_write (block_sector_t sector, const void *source);
+void cache_read (block_sector_t sector, enum cache_class, void *target);
+void cache_write (block_sector_t sector, enum cache_class, block_sector_t owner,
+                  const void *source);
+void cache_read_at (block_sector_t sector, enum cache_class, void *target,
+                    size_t ofs, size_t size);
+void cache_write_at (block_sector_t sector, enum cache_class, block_sector_t owner,
+                     const void *source, size_t ofs, size_t size);
+void cache_write_meta (block_sector_t sector, block_sector_t owner, const void *source);
+void cache_write_meta_at (block_sector_t sector, block_sector_t owner, const void *source,
+                          size_t ofs, size_t size);
+void cache_prefetch (block_sector_t sector);
+void cache_demote (block_sector_t sector);
+void cache_flush (void);
+void cache_flush_owner (block_sector_t owner);
 void cache_close (void);
+void cache_warm_format (void);
+void cache_warm_start (void);
+
+/* Pinned, copy-free access to a cached sector. */
+struct cache_entry;
+const void *cache_pin_read (block_sector_t sector, enum cache_class,
+                            struct cache_entry **handle);
+void *cache_pin_write (block_sector_t sector, block_sector_t owner, bool load,
+                       struct cache_entry **handle);
+void cache_unpin (struct cache_entry *handle);
+void cache_unpin_meta (struct cache_entry *handle);
+
+/* A copy of a dirty metadata entry taken for a journal commit. */
+struct cache_snapshot
+  {
+    block_sector_t sector;      /* Home sector. */
+    struct cache_entry *slot;   /* Entry the copy was taken from. */
+    unsigned version;           /* Entry's version when copied. */
+  };
+
+void cache_set_journaling (bool enable);
+bool cache_meta_crowded (size_t max);
+size_t cache_snapshot_meta (struct cache_snapshot *, void *buffers, size_t max);
+void cache_meta_written (const struct cache_snapshot *, size_t cnt);
+
+void cache_print_stats (void);
+void cache_get_stats (size_t *sectors, unsigned long long *lookups,
+                      unsigned long long *hits);
 
 #endif /* filesys/cache.h */
\ No newline at end of file
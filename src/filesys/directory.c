@@ -2,10 +2,16 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <syscall-nr.h>
+#include <hash.h>
 #include <list.h>
+#include <packed.h>
+#include <round.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/tmpfs.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir
@@ -14,29 +20,227 @@ struct dir
     off_t pos;                          /* Current position. */
   };
 
-/* A single directory entry. */
+/* Header at the start of a directory, before its first entry. */
+struct dir_header
+  {
+    block_sector_t parent;              /* Sector of parent's inode. */
+    uint32_t bucket_cnt;                /* Number of buckets, 0 if linear. */
+  };
+
+/* A directory entry, followed on disk by its NAME_LEN-byte name,
+   with no null terminator.
+
+   A directory is a sequence of BLOCK_SECTOR_SIZE-byte blocks.
+   Entries are packed one after another from the start of each
+   block, or from the end of the header in block 0, and none
+   crosses into the next block.  REC_LEN covers an entry's name
+   and any unused space up to the next entry; a free entry, whose
+   INODE_SECTOR is 0, is only such space.  Where REC_LEN is 0, as
+   in a zeroed block, the block's free tail starts and runs to the
+   block's end. */
 struct dir_entry
   {
-    block_sector_t inode_sector;        /* Sector number of header. */
-    char name[NAME_MAX + 1];            /* Null terminated file name. */
-    bool in_use;                        /* In use or free? */
+    block_sector_t inode_sector;        /* Sector of header, 0 if free. */
+    uint16_t rec_len;                   /* Bytes up to the next entry. */
+    uint8_t name_len;                   /* Length of the name. */
+  }
+PACKED;
+
+/* Bytes taken by an entry with a LEN-character name. */
+#define ENTRY_SIZE(LEN) (sizeof (struct dir_entry) + (LEN))
+
+/* A linear directory is rebuilt as a hashed one once an entry is
+   added past its first DIR_INDEX_BLOCKS blocks. */
+#define DIR_INDEX_BLOCKS 3
+
+/* A walk over the entries of part of a directory, reading it a
+   block at a time.  The free tail of each block is returned as a
+   free entry with TAIL set. */
+struct dir_cursor
+  {
+    const struct dir *dir;              /* Directory walked. */
+    off_t end;                          /* Walk stops at this block. */
+    off_t block_ofs;                    /* Offset of BLOCK in the directory. */
+    size_t size;                        /* Bytes of BLOCK read, 0 at end. */
+    size_t pos;                         /* Offset of E in BLOCK, or SIZE_MAX. */
+    size_t prev;                        /* Offset of the entry before, or SIZE_MAX. */
+    size_t next;                        /* Offset of the next entry in BLOCK. */
+    bool tail;                          /* Is E the free tail of BLOCK? */
+    struct dir_entry e;                 /* Current entry. */
+    char name[NAME_MAX + 1];            /* Its null terminated name. */
+    uint8_t block[BLOCK_SECTOR_SIZE];   /* Current block. */
+  };
+
+/* Where dir_add() puts a new entry. */
+struct dir_slot
+  {
+    off_t ofs;                          /* Offset of the new entry. */
+    uint16_t rec_len;                   /* Its REC_LEN. */
+    off_t split_ofs;                    /* Entry whose space it takes, or -1. */
+    uint16_t split_len;                 /* That entry's new REC_LEN. */
   };
 
-/* Creates a directory with space for ENTRY_CNT entries in the given SECTOR.
+/* Number of names remembered by the path-resolution cache. */
+#define DCACHE_SIZE 64
+
+/* Sector recorded for a name known not to exist. */
+#define DCACHE_NEGATIVE ((block_sector_t) -1)
+
+/* An entry in the path-resolution cache: NAME in the directory
+   whose inode is in sector PARENT resolves to the inode in
+   sector SECTOR, or to nothing if SECTOR is DCACHE_NEGATIVE. */
+struct dcache_entry
+  {
+    block_sector_t parent;
+    char name[NAME_MAX + 1];
+    block_sector_t sector;
+    struct hash_elem hash_elem;         /* Element in dcache_index. */
+    struct list_elem elem;              /* Element in dcache_lru. */
+  };
+
+/* Path-resolution cache, so that resolving the same path again
+   does not scan each directory along it.  dcache_index holds the
+   entries in use, dcache_lru all entries from most to least
+   recently used.  All protected by dcache_lock. */
+static struct dcache_entry dcache[DCACHE_SIZE];
+static struct hash dcache_index;
+static struct list dcache_lru;
+static struct lock dcache_lock;
+
+static unsigned
+dcache_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dcache_entry *d = hash_entry (e, struct dcache_entry, hash_elem);
+  return hash_string (d->name) ^ hash_int (d->parent);
+}
+
+static bool
+dcache_less (const struct hash_elem *lhs, const struct hash_elem *rhs, void *aux UNUSED)
+{
+  const struct dcache_entry *a = hash_entry (lhs, struct dcache_entry, hash_elem);
+  const struct dcache_entry *b = hash_entry (rhs, struct dcache_entry, hash_elem);
+  if (a->parent != b->parent)
+    return a->parent < b->parent;
+  return strcmp (a->name, b->name) < 0;
+}
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  if (!hash_init_sized (&dcache_index, dcache_hash, dcache_less, NULL,
+                        DCACHE_SIZE))
+    PANIC ("path cache creation failed");
+  list_init (&dcache_lru);
+  lock_init (&dcache_lock);
+  for (size_t i = 0; i < DCACHE_SIZE; i++)
+    {
+      dcache[i].sector = DCACHE_NEGATIVE;
+      dcache[i].name[0] = '\0';
+      list_push_back (&dcache_lru, &dcache[i].elem);
+    }
+}
+
+/* Returns the cache entry for NAME in PARENT, or a null pointer.
+   Must be called with dcache_lock held. */
+static struct dcache_entry *
+dcache_find (block_sector_t parent, const char *name)
+{
+  struct dcache_entry key;
+  struct hash_elem *e;
+
+  key.parent = parent;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dcache_index, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dcache_entry, hash_elem) : NULL;
+}
+
+/* Looks up NAME in the directory in sector PARENT in the cache.
+   On a hit, stores the inode sector, or DCACHE_NEGATIVE, into
+   *SECTOR and returns true. */
+static bool
+dcache_get (block_sector_t parent, const char *name, block_sector_t *sector)
+{
+  struct dcache_entry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return false;
+  lock_acquire (&dcache_lock);
+  d = dcache_find (parent, name);
+  if (d != NULL)
+    {
+      list_remove (&d->elem);
+      list_push_front (&dcache_lru, &d->elem);
+      *sector = d->sector;
+    }
+  lock_release (&dcache_lock);
+  return d != NULL;
+}
+
+/* Records that NAME in the directory in sector PARENT resolves to
+   SECTOR, which may be DCACHE_NEGATIVE, replacing the least
+   recently used entry if NAME is not cached yet. */
+static void
+dcache_put (block_sector_t parent, const char *name, block_sector_t sector)
+{
+  struct dcache_entry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+  lock_acquire (&dcache_lock);
+  d = dcache_find (parent, name);
+  if (d == NULL)
+    {
+      d = list_entry (list_back (&dcache_lru), struct dcache_entry, elem);
+      if (d->name[0] != '\0')
+        hash_delete (&dcache_index, &d->hash_elem);
+      d->parent = parent;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dcache_index, &d->hash_elem);
+    }
+  d->sector = sector;
+  list_remove (&d->elem);
+  list_push_front (&dcache_lru, &d->elem);
+  lock_release (&dcache_lock);
+}
+
+/* Forgets every name cached for the directory in sector PARENT,
+   whose sector is about to be freed or reused. */
+static void
+dcache_purge (block_sector_t parent)
+{
+  lock_acquire (&dcache_lock);
+  for (size_t i = 0; i < DCACHE_SIZE; i++)
+    if (dcache[i].name[0] != '\0' && dcache[i].parent == parent)
+      {
+        hash_delete (&dcache_index, &dcache[i].hash_elem);
+        dcache[i].name[0] = '\0';
+        list_remove (&dcache[i].elem);
+        list_push_back (&dcache_lru, &dcache[i].elem);
+      }
+  lock_release (&dcache_lock);
+}
+
+/* Creates a directory with space for ENTRY_CNT entries with the
+   longest names in the given SECTOR, whose ".." is the directory
+   in sector PARENT.
    Returns true if successful, false on failure. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector, block_sector_t parent, size_t entry_cnt)
 {
   bool success = true;
-  success = inode_create (sector, entry_cnt * sizeof (struct dir_entry), true);
+  success = inode_create (sector, sizeof (struct dir_header)
+                                  + entry_cnt * ENTRY_SIZE (NAME_MAX), true);
   if (!success) return false;
+  dcache_purge (sector);
 
-  // The first (offset 0) dir entry is for parent directory;
+  // The header records the parent directory; the rest is zeroed free space.
   struct dir *dir = dir_open (inode_open (sector));
   ASSERT (dir != NULL);
-  struct dir_entry e;
-  e.inode_sector = sector;
-  if (inode_write_at(dir->inode, &e, sizeof e, 0) != sizeof e) {
+  struct dir_header h;
+  h.parent = parent;
+  h.bucket_cnt = 0;
+  if (inode_write_at(dir->inode, &h, sizeof h, 0) != sizeof h) {
     success = false;
   }
   dir_close (dir);
@@ -53,7 +257,7 @@ dir_open (struct inode *inode)
   if (inode != NULL && dir != NULL)
     {
       dir->inode = inode;
-      dir->pos = sizeof (struct dir_entry); // 0-pos is for parent directory
+      dir->pos = sizeof (struct dir_header); // entries follow the header
       return dir;
     }
   else
@@ -150,56 +354,313 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
+/* Returns the byte offset of bucket BUCKET of a hashed directory.
+   The overflow area starts at bucket_ofs (BUCKET_CNT).
+
+   A hashed directory, one whose header has a nonzero BUCKET_CNT,
+   stores the header alone in block 0, then BUCKET_CNT buckets of
+   one block each, then an overflow area running to the end of the
+   file for entries whose bucket was full.  An entry lives in
+   bucket hash_string (name) % BUCKET_CNT or in the overflow area.
+   Linear directories are searched from end to end. */
+static inline off_t
+bucket_ofs (uint32_t bucket)
+{
+  return (1 + bucket) * BLOCK_SECTOR_SIZE;
+}
+
+/* Returns the number of buckets of DIR, or 0 if DIR is linear. */
+static uint32_t
+dir_bucket_cnt (const struct dir *dir)
+{
+  struct dir_header h;
+
+  if (inode_read_at (dir->inode, &h, sizeof h, 0) != sizeof h)
+    return 0;
+  return h.bucket_cnt;
+}
+
+/* Stores the header of the entry at POS in the SIZE bytes read of
+   BLOCK into *E.  Returns false if no entry starts there, which
+   is where the block's free tail starts. */
+static bool
+entry_at (const uint8_t *block, size_t size, size_t pos, struct dir_entry *e)
+{
+  if (pos + sizeof *e > size)
+    return false;
+  memcpy (e, block + pos, sizeof *e);
+  return (e->rec_len >= sizeof *e && pos + e->rec_len <= size
+          && (e->inode_sector == 0
+              || (e->name_len > 0 && e->name_len <= NAME_MAX
+                  && ENTRY_SIZE (e->name_len) <= e->rec_len)));
+}
+
+/* Reads C's current block. */
+static void
+cursor_load (struct dir_cursor *c)
+{
+  c->size = 0;
+  if (c->block_ofs < c->end)
+    c->size = inode_read_at (c->dir->inode, c->block, sizeof c->block,
+                             c->block_ofs);
+  c->pos = c->prev = SIZE_MAX;
+  c->next = c->block_ofs == 0 ? sizeof (struct dir_header) : 0;
+}
+
+/* Starts C on the entries of DIR in the blocks from the one
+   holding byte offset START up to END. */
+static void
+cursor_start (struct dir_cursor *c, const struct dir *dir, off_t start, off_t end)
+{
+  c->dir = dir;
+  c->end = end;
+  c->block_ofs = ROUND_DOWN (start, BLOCK_SECTOR_SIZE);
+  cursor_load (c);
+}
+
+/* Advances C to the next entry.  Returns false at the end. */
+static bool
+cursor_next (struct dir_cursor *c)
+{
+  while (c->size > 0)
+    {
+      if (c->next < BLOCK_SECTOR_SIZE)
+        {
+          c->prev = c->pos;
+          c->pos = c->next;
+          c->tail = !entry_at (c->block, c->size, c->pos, &c->e);
+          if (c->tail)
+            {
+              c->e.inode_sector = 0;
+              c->e.rec_len = BLOCK_SECTOR_SIZE - c->pos;
+              c->e.name_len = 0;
+            }
+          c->name[0] = '\0';
+          if (c->e.inode_sector != 0)
+            {
+              memcpy (c->name, c->block + c->pos + sizeof c->e, c->e.name_len);
+              c->name[c->e.name_len] = '\0';
+            }
+          c->next = c->pos + c->e.rec_len;
+          return true;
+        }
+      c->block_ofs += BLOCK_SECTOR_SIZE;
+      cursor_load (c);
+    }
+  return false;
+}
+
+/* Returns the byte offset of C's current entry. */
+static inline off_t
+cursor_ofs (const struct dir_cursor *c)
+{
+  return c->block_ofs + c->pos;
+}
+
+/* Searches the entries of DIR in the blocks from byte offset START
+   up to END for one named NAME, like lookup(). */
+static bool
+lookup_range (const struct dir *dir, const char *name, off_t start, off_t end,
+              struct dir_entry *ep, off_t *ofsp, off_t *prevp)
+{
+  struct dir_cursor c;
+
+  cursor_start (&c, dir, start, end);
+  while (cursor_next (&c))
+    if (c.e.inode_sector != 0 && !strcmp (name, c.name))
+      {
+        if (ep != NULL)
+          *ep = c.e;
+        if (ofsp != NULL)
+          *ofsp = cursor_ofs (&c);
+        if (prevp != NULL)
+          *prevp = c.prev != SIZE_MAX ? c.block_ofs + (off_t) c.prev : -1;
+        return true;
+      }
+  return false;
+}
+
+/* Finds room for an entry with a LEN-character name in the blocks
+   of DIR from byte offset START up to END, in a free entry, in the
+   unused space after an entry, or in a block's free tail.  Returns
+   false if there is none. */
+static bool
+free_slot (const struct dir *dir, off_t start, off_t end, size_t len,
+           struct dir_slot *slot)
+{
+  struct dir_cursor c;
+  size_t need = ENTRY_SIZE (len);
+
+  cursor_start (&c, dir, start, end);
+  while (cursor_next (&c))
+    {
+      size_t used = c.e.inode_sector != 0 ? ENTRY_SIZE (c.e.name_len) : 0;
+      if (c.e.rec_len - used >= need)
+        {
+          slot->ofs = cursor_ofs (&c) + used;
+          slot->rec_len = c.tail ? need : c.e.rec_len - used;
+          slot->split_ofs = used > 0 ? cursor_ofs (&c) : -1;
+          slot->split_len = used;
+          return true;
+        }
+    }
+  return false;
+}
+
 /* Searches DIR for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
-   if EP is non-null, and sets *OFSP to the byte offset of the
-   directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   if EP is non-null, sets *OFSP to the byte offset of the
+   directory entry if OFSP is non-null, and sets *PREVP to the
+   byte offset of the entry before it in its block, or -1 if it is
+   the first, if PREVP is non-null.
+   otherwise, returns false and ignores EP, OFSP and PREVP.
+   A hashed directory is searched only in NAME's bucket and the
+   overflow area. */
 static bool
 lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp)
+        struct dir_entry *ep, off_t *ofsp, off_t *prevp)
 {
-  struct dir_entry e;
-  size_t ofs;
+  off_t length;
+  uint32_t bucket_cnt, bucket;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = sizeof e; /* 0-pos is for parent directory */
-       inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e)
-    if (e.in_use && !strcmp (name, e.name))
+  length = inode_length (dir->inode);
+  bucket_cnt = dir_bucket_cnt (dir);
+  if (bucket_cnt == 0)
+    return lookup_range (dir, name, 0, length, ep, ofsp, prevp);
+
+  bucket = hash_string (name) % bucket_cnt;
+  return (lookup_range (dir, name, bucket_ofs (bucket), bucket_ofs (bucket + 1),
+                        ep, ofsp, prevp)
+          || lookup_range (dir, name, bucket_ofs (bucket_cnt), length,
+                           ep, ofsp, prevp));
+}
+
+/* An entry being moved by dir_rehash(). */
+struct rehash_entry
+  {
+    off_t ofs;                          /* New byte offset. */
+    block_sector_t inode_sector;        /* Sector of header. */
+    uint8_t name_len;                   /* Length of the name. */
+    char name[NAME_MAX + 1];            /* Null terminated name. */
+  };
+
+/* Rebuilds DIR as a hashed directory with BUCKET_CNT buckets,
+   moving every entry to its bucket.  Returns false, leaving DIR
+   as it was, if memory or disk space runs out. */
+static bool
+dir_rehash (struct dir *dir, uint32_t bucket_cnt)
+{
+  struct dir_cursor *c;
+  struct dir_header h;
+  struct rehash_entry *entries;
+  size_t *fill;
+  uint8_t *image = NULL;
+  size_t cnt = 0, i;
+  off_t length = inode_length (dir->inode), overflow, image_len, ofs;
+  bool success = false;
+
+  c = malloc (sizeof *c);
+  entries = malloc ((length / ENTRY_SIZE (1) + 1) * sizeof *entries);
+  fill = calloc (bucket_cnt, sizeof *fill);
+  if (c == NULL || entries == NULL || fill == NULL
+      || inode_read_at (dir->inode, &h, sizeof h, 0) != sizeof h)
+    goto done;
+
+  /* Place every entry first, to learn how big the file must be. */
+  overflow = bucket_ofs (bucket_cnt);
+  cursor_start (c, dir, 0, length);
+  while (cursor_next (c))
+    if (c->e.inode_sector != 0)
       {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
+        struct rehash_entry *r = &entries[cnt++];
+        uint32_t bucket = hash_string (c->name) % bucket_cnt;
+        size_t size = ENTRY_SIZE (c->e.name_len);
+
+        if (fill[bucket] + size <= BLOCK_SECTOR_SIZE)
+          {
+            r->ofs = bucket_ofs (bucket) + fill[bucket];
+            fill[bucket] += size;
+          }
+        else
+          {
+            if (overflow % BLOCK_SECTOR_SIZE + size > BLOCK_SECTOR_SIZE)
+              overflow = ROUND_UP (overflow, BLOCK_SECTOR_SIZE);
+            r->ofs = overflow;
+            overflow += size;
+          }
+        r->inode_sector = c->e.inode_sector;
+        r->name_len = c->e.name_len;
+        memcpy (r->name, c->name, sizeof r->name);
       }
-  return false;
+
+  /* Lay out the new directory in memory, with every byte not in
+     an entry zeroed to free space. */
+  image_len = overflow > length ? overflow : length;
+  image = calloc (image_len, 1);
+  if (image == NULL)
+    goto done;
+  h.bucket_cnt = bucket_cnt;
+  memcpy (image, &h, sizeof h);
+  for (i = 0; i < cnt; i++)
+    {
+      struct dir_entry e;
+      e.inode_sector = entries[i].inode_sector;
+      e.rec_len = ENTRY_SIZE (entries[i].name_len);
+      e.name_len = entries[i].name_len;
+      memcpy (image + entries[i].ofs, &e, sizeof e);
+      memcpy (image + entries[i].ofs + sizeof e, entries[i].name, e.name_len);
+    }
+
+  /* Grow the file before changing anything, so that none of the
+     writes below can fail. */
+  if (image_len > length)
+    {
+      if (inode_write_at (dir->inode, image + image_len - 1, 1, image_len - 1) != 1)
+        goto done;
+      length = image_len;
+    }
+
+  /* Write the buckets and overflow area a block at a time, and
+     the header last. */
+  for (ofs = BLOCK_SECTOR_SIZE; ofs < image_len; ofs += BLOCK_SECTOR_SIZE)
+    inode_write_at (dir->inode, image + ofs,
+                    image_len - ofs < BLOCK_SECTOR_SIZE ? image_len - ofs : BLOCK_SECTOR_SIZE,
+                    ofs);
+  inode_write_at (dir->inode, image,
+                  image_len < BLOCK_SECTOR_SIZE ? image_len : BLOCK_SECTOR_SIZE, 0);
+  success = true;
+
+ done:
+  free (c);
+  free (entries);
+  free (fill);
+  free (image);
+  return success;
 }
 
-/* Returns whether the DIR is empty. */
+/* Returns whether the DIR is empty.  The caller must hold DIR's
+   inode lock. */
 bool
 dir_is_empty (const struct dir *dir)
 {
-  struct dir_entry e;
-  off_t ofs;
+  struct dir_cursor c;
 
-  for (ofs = sizeof e; /* 0-pos is for parent directory */
-       inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e)
-  {
-    if (e.in_use)
+  cursor_start (&c, dir, 0, inode_length (dir->inode));
+  while (cursor_next (&c))
+    if (c.e.inode_sector != 0)
       return false;
-  }
   return true;
 }
 
 /* Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.  A name that
+   finds the directory a tmpfs is mounted on yields the tmpfs
+   root. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode)
@@ -214,16 +675,23 @@ dir_lookup (const struct dir *dir, const char *name,
     *inode = inode_reopen (dir->inode);
   }
   else if (strcmp (name, "..") == 0) {
-    // parent directory : the information is stored at the first (0-pos) entry.
-    inode_read_at (dir->inode, &e, sizeof e, 0);
-    *inode = inode_open (e.inode_sector);
+    // parent directory : the information is stored in the header.
+    struct dir_header h;
+    inode_read_at (dir->inode, &h, sizeof h, 0);
+    *inode = inode_open (h.parent);
   }
-  else if (lookup (dir, name, &e, NULL)) {
-    // normal lookup. lookuped entry is stored into e
-    *inode = inode_open (e.inode_sector);
+  else {
+    // normal lookup, answered from the path cache if possible
+    block_sector_t parent = inode_get_inumber (dir->inode);
+    block_sector_t sector;
+    if (!dcache_get (parent, name, &sector)) {
+      inode_lock (dir->inode);
+      sector = lookup (dir, name, &e, NULL, NULL) ? e.inode_sector : DCACHE_NEGATIVE;
+      dcache_put (parent, name, sector);
+      inode_unlock (dir->inode);
+    }
+    *inode = sector != DCACHE_NEGATIVE ? tmpfs_cross (inode_open (sector)) : NULL;
   }
-  else
-    *inode = NULL;
 
   return *inode != NULL;
 }
@@ -239,52 +707,93 @@ bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector, bool is_dir)
 {
   struct dir_entry e;
-  off_t ofs;
+  struct dir_slot slot;
+  uint8_t record[ENTRY_SIZE (NAME_MAX)];
+  size_t len = strlen (name);
+  off_t length, overflow;
+  uint32_t bucket_cnt;
+  bool found = false;
   bool success = false;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (*name == '\0' || strlen (name) > NAME_MAX)
+  if (len == 0 || len > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  /* Check that DIR is still there and NAME is not in use. */
+  inode_lock (dir->inode);
+  if (inode_is_removed (dir->inode) || lookup (dir, name, NULL, NULL, NULL))
     goto done;
 
   // update the child directory [inode_sector] has a parent directory [dir]
   if (is_dir)
   {
-    /* e is a parent-directory-entry here */
+    struct dir_header h;
     struct dir *child_dir = dir_open (inode_open (inode_sector));
     if (child_dir == NULL) goto done;
-    e.inode_sector = inode_get_inumber (dir_get_inode(dir));
-    if (inode_write_at (child_dir->inode, &e, sizeof e, 0) != sizeof e) {
+    h.parent = inode_get_inumber (dir_get_inode(dir));
+    h.bucket_cnt = 0;
+    if (inode_write_at (child_dir->inode, &h, sizeof h, 0) != sizeof h) {
       dir_close (child_dir);
       goto done;
     }
     dir_close (child_dir);
   }
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
+  /* Find room for the entry: in NAME's bucket if DIR is hashed
+     and the bucket has room, otherwise anywhere after the header
+     (or the buckets).  If there is none, it goes at the start of
+     a new block at the end of the file.
 
      inode_read_at() will only return a short read at end of file.
      Otherwise, we'd need to verify that we didn't get a short
      read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e)
-    if (!e.in_use)
-      break;
-
-  /* Write slot. */
-  e.in_use = true;
-  strlcpy (e.name, name, sizeof e.name);
+  length = inode_length (dir->inode);
+  bucket_cnt = dir_bucket_cnt (dir);
+  overflow = 0;
+  if (bucket_cnt > 0)
+    {
+      uint32_t bucket = hash_string (name) % bucket_cnt;
+      overflow = bucket_ofs (bucket_cnt);
+      found = free_slot (dir, bucket_ofs (bucket), bucket_ofs (bucket + 1),
+                         len, &slot);
+    }
+  if (!found && !free_slot (dir, overflow, length, len, &slot))
+    {
+      slot.ofs = ROUND_UP (length, BLOCK_SECTOR_SIZE);
+      slot.rec_len = ENTRY_SIZE (len);
+      slot.split_ofs = -1;
+    }
+
+  /* Write the entry, then shrink the entry whose unused space it
+     went into, if any, to make it visible. */
   e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  e.rec_len = slot.rec_len;
+  e.name_len = len;
+  memcpy (record, &e, sizeof e);
+  memcpy (record + sizeof e, name, len);
+  success = inode_write_at (dir->inode, record, ENTRY_SIZE (len), slot.ofs)
+            == (off_t) ENTRY_SIZE (len);
+  if (success && slot.split_ofs >= 0)
+    success = (inode_write_at (dir->inode, &slot.split_len, sizeof slot.split_len,
+                               slot.split_ofs + offsetof (struct dir_entry, rec_len))
+               == sizeof slot.split_len);
+  if (success)
+    dcache_put (inode_get_inumber (dir->inode), name, inode_sector);
+
+  /* Index a linear directory that has grown large, and double the
+     buckets of a hashed one whose overflow area fills up.  This
+     only speeds up later lookups, so failure is ignored. */
+  if (success && bucket_cnt == 0
+      && slot.ofs >= DIR_INDEX_BLOCKS * BLOCK_SECTOR_SIZE)
+    dir_rehash (dir, 2 * DIV_ROUND_UP (slot.ofs + 1, BLOCK_SECTOR_SIZE));
+  else if (success && bucket_cnt > 0 && slot.ofs >= overflow
+           && (size_t) (slot.ofs - overflow) >= bucket_cnt * BLOCK_SECTOR_SIZE / 4)
+    dir_rehash (dir, 2 * bucket_cnt);
 
  done:
+  inode_unlock (dir->inode);
   return success;
 }
 
@@ -296,14 +805,17 @@ dir_remove (struct dir *dir, const char *name)
 {
   struct dir_entry e;
   struct inode *inode = NULL;
+  bool locked = false;
   bool success = false;
-  off_t ofs;
+  off_t ofs, prev;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  /* Find directory entry.  A tmpfs mount point stays put. */
+  inode_lock (dir->inode);
+  if (!lookup (dir, name, &e, &ofs, &prev)
+      || tmpfs_is_mount_point (e.inode_sector))
     goto done;
 
   /* Open inode. */
@@ -311,24 +823,48 @@ dir_remove (struct dir *dir, const char *name)
   if (inode == NULL)
     goto done;
 
-  /* Prevent removing non-empty directory. */
+  /* Prevent removing non-empty directory.  Its lock is held until
+     it is marked removed, so nothing is added to it meanwhile;
+     locks are always taken parent before child. */
   if (inode_is_dir (inode)) {
-    struct dir *dir = dir_open (inode);
+    inode_lock (inode);
+    locked = true;
+    struct dir *dir = dir_open (inode_reopen (inode));
     bool is_empty = dir_is_empty (dir);
     dir_close (dir);
     if (!is_empty) goto done; // can't delete
   }
 
-  /* Erase directory entry. */
-  e.in_use = false;
-  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
-    goto done;
+  /* Erase directory entry, giving its space to the entry before
+     it in the block if there is one. */
+  if (prev >= 0)
+    {
+      struct dir_entry p;
+      if (inode_read_at (dir->inode, &p, sizeof p, prev) != sizeof p)
+        goto done;
+      p.rec_len += e.rec_len;
+      if (inode_write_at (dir->inode, &p, sizeof p, prev) != sizeof p)
+        goto done;
+    }
+  else
+    {
+      e.inode_sector = 0;
+      if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+        goto done;
+    }
 
-  /* Remove inode. */
+  /* Remove inode, and forget the names cached under it if it is
+     a directory, since its sector may be reused. */
+  dcache_put (inode_get_inumber (dir->inode), name, DCACHE_NEGATIVE);
+  if (inode_is_dir (inode))
+    dcache_purge (inode_get_inumber (inode));
   inode_remove (inode);
   success = true;
 
  done:
+  if (locked)
+    inode_unlock (inode);
+  inode_unlock (dir->inode);
   inode_close (inode);
   return success;
 }
@@ -339,18 +875,46 @@ dir_remove (struct dir *dir, const char *name)
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
-  struct dir_entry e;
+  struct dirent d;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e)
+  if (dir_readdir_batch (dir, &d, 1) == 0)
+    return false;
+  strlcpy (name, d.name, NAME_MAX + 1);
+  return true;
+}
+
+/* Reads up to CNT of the next directory entries in DIR into
+   ENTRIES, a block at a time, and returns the number read, 0 if
+   the directory contains no more entries.  DIR's position is left
+   just after the last entry returned.
+
+   Entries move when a directory is rehashed, so the position may
+   no longer be the start of an entry; the walk always starts from
+   the start of its block and skips the entries before it. */
+size_t
+dir_readdir_batch (struct dir *dir, struct dirent *entries, size_t cnt)
+{
+  struct dir_cursor c;
+  off_t length;
+  size_t found = 0;
+
+  inode_lock (dir->inode);
+  length = inode_length (dir->inode);
+  cursor_start (&c, dir, dir->pos, length);
+  while (found < cnt && cursor_next (&c))
     {
-      dir->pos += sizeof e;
-      if (e.in_use)
-        {
-          strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
-        }
+      off_t ofs = cursor_ofs (&c);
+      if (ofs < dir->pos || c.e.inode_sector == 0)
+        continue;
+      entries[found].inumber = c.e.inode_sector;
+      strlcpy (entries[found].name, c.name, sizeof entries[found].name);
+      found++;
+      dir->pos = ofs + c.e.rec_len;
     }
-  return false;
+  if (found < cnt && dir->pos < length)
+    dir->pos = length;
+  inode_unlock (dir->inode);
+  return found;
 }
 
 void
@@ -12,9 +12,13 @@
 #define NAME_MAX 14
 
 struct inode;
+struct dirent;
+
+void dir_init (void);
 
 /* Opening and closing directories. */
-bool dir_create (block_sector_t sector, size_t entry_cnt);
+bool dir_create (block_sector_t sector, block_sector_t parent,
+                 size_t entry_cnt);
 struct dir *dir_open (struct inode *);
 struct dir *dir_open_root (void);
 struct dir *dir_open_path (const char *);
@@ -28,6 +32,7 @@ bool dir_lookup (const struct dir *, const char *name, struct inode **);
 bool dir_add (struct dir *, const char *name, block_sector_t, bool is_dir);
 bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
+size_t dir_readdir_batch (struct dir *, struct dirent *, size_t cnt);
 void dir_parser (const char *path, char *directory, char *name);
 
 #endif /* filesys/directory.h */
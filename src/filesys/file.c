@@ -113,6 +113,36 @@ file_write_at (struct file *file, const void *buffer, off_t size,
   return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Like file_write_at(), for data written back from a page of an
+   mmap'd file; see inode_write_back_at(). */
+off_t
+file_write_back_at (struct file *file, const void *buffer, off_t size,
+                    off_t file_ofs)
+{
+  return inode_write_back_at (file->inode, buffer, size, file_ofs);
+}
+
+/* Copies SIZE bytes of SRC, starting at offset SRC_OFS, into DST
+   at offset DST_OFS, entirely inside the kernel.
+   Returns the number of bytes actually copied, which may be less
+   than SIZE if end of SRC is reached or an error occurs.
+   Neither file's current position is affected. */
+off_t
+file_copy_at (struct file *dst, off_t dst_ofs, struct file *src,
+              off_t src_ofs, off_t size)
+{
+  return inode_copy_at (dst->inode, dst_ofs, src->inode, src_ofs, size);
+}
+
+/* Takes ADVICE about how the LENGTH bytes of FILE at OFFSET will
+   be read; see inode_advise().  The advice is shared by every
+   opener of the file.  Returns false if ADVICE is not known. */
+bool
+file_advise (struct file *file, off_t offset, off_t length, int advice)
+{
+  return inode_advise (file->inode, offset, length, advice);
+}
+
 /* Prevents write operations on FILE's underlying inode
    until file_allow_write() is called or FILE is closed. */
 void
@@ -140,6 +170,24 @@ file_allow_write (struct file *file)
     }
 }
 
+/* Allocates disk space for the LENGTH bytes of FILE starting at
+   OFFSET, contiguous if possible, extending FILE to cover them.
+   Returns true if successful. */
+bool
+file_preallocate (struct file *file, off_t offset, off_t length)
+{
+  ASSERT (file != NULL);
+  return inode_preallocate (file->inode, offset, length);
+}
+
+/* Writes FILE's data to disk. */
+void
+file_sync (struct file *file)
+{
+  ASSERT (file != NULL);
+  inode_sync (file->inode);
+}
+
 /* Returns the size of FILE in bytes. */
 off_t
 file_length (struct file *file)
@@ -8,6 +8,8 @@
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
+#include "filesys/tmpfs.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
@@ -24,13 +26,19 @@ filesys_init (bool format)
     PANIC ("No file system device found, can't initialize file system.");
 
   inode_init ();
+  dir_init ();
   free_map_init ();
   cache_init ();
 
   if (format)
     do_format ();
+  journal_init ();
+  if (!format)
+    inode_adopt_format (FREE_MAP_SECTOR);
 
   free_map_open ();
+  cache_warm_start ();
+  tmpfs_init ();
 }
 
 /* Shuts down the file system module, writing any unwritten data
@@ -39,13 +47,28 @@ void
 filesys_done (void)
 {
   free_map_close ();
+  journal_close ();
   cache_close ();
 }
 
+/* Writes everything the file system has cached to disk, without
+   shutting it down. */
+void
+filesys_sync (void)
+{
+  if (journal_commit ())
+    return;
+  free_map_sync ();
+  cache_flush ();
+}
+
 /* Creates a file or directory (set by `is_dir`) of
    full path `path` with the given `initial_size`.
    The path to file consists of two parts: path directory and filename.
 
+   A file in a tmpfs directory is a tmpfs inode, which takes
+   nothing from the free map.
+
    Returns true if successful, false otherwise.
    Fails if a file named NAME already exists,
    or if internal memory allocation fails. */
@@ -58,15 +81,29 @@ filesys_create (const char *path, off_t initial_size, bool is_dir)
   char name[strlen(path)];
   dir_parser (path, directory, name);
   struct dir *dir = dir_open_path (directory);
+  bool in_memory = (dir != NULL
+                    && tmpfs_owns (inode_get_inumber (dir_get_inode (dir))));
 
+  journal_begin ();
   bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
+                  && (in_memory ? tmpfs_allocate (&inode_sector)
+                      : free_map_allocate (1, &inode_sector))
                   && inode_create (inode_sector, initial_size, is_dir)
                   && dir_add (dir, name, inode_sector, is_dir));
 
-  if (!success && inode_sector != 0)
+  if (!success && inode_sector != 0 && in_memory)
+    {
+      struct inode *inode = inode_open (inode_sector);
+      if (inode != NULL)
+        {
+          inode_remove (inode);
+          inode_close (inode);
+        }
+    }
+  else if (!success && inode_sector != 0)
     free_map_release (inode_sector, 1);
   dir_close (dir);
+  journal_end ();
 
   return success;
 }
@@ -119,8 +156,10 @@ filesys_remove (const char *path)
   dir_parser (path, directory, name);
   struct dir *dir = dir_open_path (directory);
 
+  journal_begin ();
   bool success = (dir != NULL && dir_remove (dir, name));
   dir_close (dir);
+  journal_end ();
 
   return success;
 }
@@ -145,8 +184,10 @@ static void
 do_format (void)
 {
   printf ("Formatting file system...");
+  journal_format ();
+  cache_warm_format ();
   free_map_create ();
-  if (!dir_create (ROOT_DIR_SECTOR, 16))
+  if (!dir_create (ROOT_DIR_SECTOR, ROOT_DIR_SECTOR, 16))
     PANIC ("root directory creation failed");
   free_map_close ();
   printf ("done.\n");
@@ -1,13 +1,158 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Sectors per block group in the free-space summary. */
+#define GROUP_SECTORS 1024
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
 
+/* Number of free sectors in each GROUP_SECTORS-sector block group,
+   so that searches skip full groups without scanning them. */
+static size_t *group_free;
+static size_t group_cnt;
+
+/* Where free_map_allocate() resumes searching. */
+static block_sector_t cursor;
+
+/* Free map bits held by one sector of the free map file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+/* One bit per sector of the free map file, set if that part of
+   the free map changed since free_map_sync() last wrote it. */
+static struct bitmap *dirty_map;
+
+/* One bit per sector of the free map file, set once that part of
+   the free map has been read in.  free_map_open() reads none of
+   it: each part is read the first time an allocation or release
+   needs it, so mounting takes the same time whatever the size of
+   the disk.  Until then a part's bits are all set, and its block
+   groups count as full, so that no search can take it for free
+   space. */
+static struct bitmap *loaded_map;
+
+/* Each sector of the free map file covers whole block groups. */
+#if BITS_PER_SECTOR % GROUP_SECTORS != 0
+#error BITS_PER_SECTOR must be a multiple of GROUP_SECTORS
+#endif
+
+/* Protects all of the above.  Taken last: it is acquired with
+   inode and cache locks held, never the other way around, except
+   that free_map_sync() writes the free map file's own inode,
+   which is never extended. */
+static struct lock free_map_lock;
+
+/* Recomputes group_free from the free map for block groups
+   FIRST up to but not including LAST. */
+static void
+free_map_summarize (size_t first, size_t last)
+{
+  size_t size = bitmap_size (free_map);
+
+  if (last > group_cnt)
+    last = group_cnt;
+  for (size_t g = first; g < last; g++)
+    {
+      size_t start = g * GROUP_SECTORS;
+      size_t cnt = size - start < GROUP_SECTORS ? size - start : GROUP_SECTORS;
+      group_free[g] = bitmap_count (free_map, start, cnt, false);
+    }
+}
+
+/* Reads part CHUNK of the free map, the bits held by sector CHUNK
+   of the free map file, and summarizes its block groups. */
+static void
+free_map_load (size_t chunk)
+{
+  size_t groups_per_chunk = BITS_PER_SECTOR / GROUP_SECTORS;
+
+  ASSERT (!bitmap_test (loaded_map, chunk));
+  if (!bitmap_read_range (free_map, free_map_file,
+                          chunk * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE))
+    PANIC ("can't read free map");
+  bitmap_mark (loaded_map, chunk);
+  free_map_summarize (chunk * groups_per_chunk, (chunk + 1) * groups_per_chunk);
+}
+
+/* Reads in any part of the free map covering the CNT sectors
+   starting at SECTOR that has not been read yet. */
+static void
+free_map_load_range (block_sector_t sector, size_t cnt)
+{
+  size_t chunk;
+
+  for (chunk = sector / BITS_PER_SECTOR;
+       chunk <= (sector + cnt - 1) / BITS_PER_SECTOR; chunk++)
+    if (!bitmap_test (loaded_map, chunk))
+      free_map_load (chunk);
+}
+
+/* Marks the CNT sectors starting at SECTOR as USED or free, all
+   of which must currently be in the opposite state, keeping
+   group_free up to date. */
+static void
+free_map_set (block_sector_t sector, size_t cnt, bool used)
+{
+  bitmap_set_multiple (free_map, sector, cnt, used);
+  bitmap_set_multiple (dirty_map, sector / BITS_PER_SECTOR,
+                       (sector + cnt - 1) / BITS_PER_SECTOR - sector / BITS_PER_SECTOR + 1,
+                       true);
+  while (cnt > 0)
+    {
+      size_t g = sector / GROUP_SECTORS;
+      size_t n = (g + 1) * GROUP_SECTORS - sector;
+      if (n > cnt)
+        n = cnt;
+      if (used)
+        group_free[g] -= n;
+      else
+        group_free[g] += n;
+      sector += n;
+      cnt -= n;
+    }
+}
+
+/* Returns the first sector of the first run of CNT free sectors
+   that starts in [START, END), or BITMAP_ERROR if there is none.
+   Full block groups are skipped without looking at the bitmap.
+
+   Parts of the free map not read in yet look full, so a run found
+   past one of them, or none at all, may not be the first; then
+   the earliest such part is read in and the search is made
+   again. */
+static size_t
+free_map_scan (size_t start, size_t end, size_t cnt)
+{
+  for (;;)
+    {
+      size_t pos = start;
+      size_t sector = BITMAP_ERROR;
+      size_t last, unloaded;
+
+      while (pos < end && group_free[pos / GROUP_SECTORS] == 0)
+        pos = (pos / GROUP_SECTORS + 1) * GROUP_SECTORS;
+      if (pos < end)
+        {
+          sector = bitmap_scan (free_map, pos, cnt, false);
+          if (sector >= end)
+            sector = BITMAP_ERROR;
+        }
+
+      last = (sector != BITMAP_ERROR ? sector : end - 1) / BITS_PER_SECTOR;
+      unloaded = bitmap_scan (loaded_map, start / BITS_PER_SECTOR, 1, false);
+      if (unloaded == BITMAP_ERROR || unloaded > last)
+        return sector;
+      free_map_load (unloaded);
+    }
+}
+
 /* Initializes the free map. */
 void
 free_map_init (void)
@@ -15,56 +160,146 @@ free_map_init (void)
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), GROUP_SECTORS);
+  group_free = malloc (group_cnt * sizeof *group_free);
+  dirty_map = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                           BLOCK_SECTOR_SIZE));
+  loaded_map = bitmap_create (bitmap_size (dirty_map));
+  if (group_free == NULL || dirty_map == NULL || loaded_map == NULL)
+    PANIC ("free map summary creation failed");
+  bitmap_set_all (loaded_map, true);
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  free_map_summarize (0, group_cnt);
+  cursor = 0;
+  lock_init (&free_map_lock);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+   the first into *SECTORP.  The search resumes where the previous
+   allocation ended, so the densely used start of a filling disk
+   is not rescanned every time.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  return free_map_allocate_near (cnt, cursor, sectorp);
+}
+
+/* Like free_map_allocate(), but takes the first run of CNT free
+   sectors at or after HINT, wrapping around to the start of the
+   disk if there is none, so that related data stays close. */
+bool
+free_map_allocate_near (size_t cnt, block_sector_t hint, block_sector_t *sectorp)
+{
+  size_t size = bitmap_size (free_map);
+  size_t sector;
+
+  if (hint >= size)
+    hint = 0;
+  lock_acquire (&free_map_lock);
+  sector = free_map_scan (hint, size, cnt);
+  if (sector == BITMAP_ERROR && hint != 0)
+    sector = free_map_scan (0, hint, cnt);
+  if (sector != BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false);
-      sector = BITMAP_ERROR;
+      free_map_set (sector, cnt, true);
+      cursor = sector + cnt;
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+  lock_release (&free_map_lock);
+  if (sector == BITMAP_ERROR)
+    return false;
+
+  *sectorp = sector;
+  return true;
+}
+
+/* Allocates the CNT sectors starting at SECTOR, if all of them
+   are free.  Returns true if successful, false if some sector was
+   in use. */
+bool
+free_map_allocate_at (block_sector_t sector, size_t cnt)
+{
+  bool success;
+
+  if (sector + cnt > bitmap_size (free_map))
+    return false;
+  lock_acquire (&free_map_lock);
+  free_map_load_range (sector, cnt);
+  success = bitmap_none (free_map, sector, cnt);
+  if (success)
+    free_map_set (sector, cnt, true);
+  lock_release (&free_map_lock);
+  return success;
 }
 
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
+  free_map_load_range (sector, cnt);
   ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  free_map_set (sector, cnt, false);
+  lock_release (&free_map_lock);
+}
+
+/* Writes the sectors of the free map file whose part of the free
+   map changed since the last call.  Allocation and release only
+   update the in-memory map; this is called at sync points, by
+   the buffer cache's write-behind thread and when the file system
+   is shut down. */
+void
+free_map_sync (void)
+{
+  size_t i;
+
+  lock_acquire (&free_map_lock);
+  if (free_map_file == NULL)
+    {
+      lock_release (&free_map_lock);
+      return;
+    }
+  for (i = 0; i < bitmap_size (dirty_map); i++)
+    if (bitmap_test (dirty_map, i))
+      {
+        /* Clear the bit first, so that a change made while the
+           sector is being written marks it dirty again. */
+        bitmap_reset (dirty_map, i);
+        if (!bitmap_write_range (free_map, free_map_file,
+                                 i * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE))
+          bitmap_mark (dirty_map, i);
+      }
+  lock_release (&free_map_lock);
 }
 
-/* Opens the free map file and reads it from disk. */
+/* Opens the free map file.  Its contents are read from disk a
+   part at a time, as they are needed. */
 void
 free_map_open (void)
 {
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_read (free_map, free_map_file))
-    PANIC ("can't read free map");
+  bitmap_set_all (free_map, true);
+  bitmap_set_all (loaded_map, false);
+  free_map_summarize (0, group_cnt);
+  bitmap_set_all (dirty_map, false);
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void)
 {
-  file_close (free_map_file);
+  struct file *file;
+
+  free_map_sync ();
+  lock_acquire (&free_map_lock);
+  file = free_map_file;
+  free_map_file = NULL;
+  lock_release (&free_map_lock);
+  file_close (file);
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -82,4 +317,5 @@ free_map_create (void)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (dirty_map, false);
 }
@@ -1,5 +1,6 @@
 #include "filesys/fsutil.h"
 #include <debug.h>
+#include <round.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -67,20 +68,126 @@ fsutil_rm (char **argv)
     PANIC ("%s: delete failed\n", file_name);
 }
 
+/* Sectors of the archive fsutil_extract() reads per request. */
+#define EXTRACT_SECTORS 64
+
+/* Reads an archive from a block device in order, EXTRACT_SECTORS
+   at a time, into two buffers in turn, for a ustar reader.  While one buffer is being
+   used, the next chunk is read into the other, so that reading the
+   archive overlaps writing the files in it. */
+struct archive_reader
+  {
+    struct block *block;                /* Device read. */
+    block_sector_t next;                /* Next sector to read ahead. */
+    uint8_t *buffers[2];                /* EXTRACT_SECTORS sectors each. */
+    struct block_request reqs[2];       /* Reads into BUFFERS. */
+    bool pending[2];                    /* REQS[i] submitted, not waited? */
+    int cur;                            /* Buffer in use. */
+    bool started;                       /* Buffer CUR handed out yet? */
+  };
+
+/* Starts a read of the next chunk of R's device into buffer I, if
+   the device has any left. */
+static void
+reader_fill (struct archive_reader *r, int i)
+{
+  block_sector_t left = block_size (r->block) - r->next;
+  block_sector_t cnt = left < EXTRACT_SECTORS ? left : EXTRACT_SECTORS;
+
+  block_request_init (&r->reqs[i], false, r->next, r->buffers[i], cnt);
+  r->pending[i] = cnt > 0;
+  if (cnt > 0)
+    block_submit (r->block, &r->reqs[i]);
+  r->next += cnt;
+}
+
+/* Initializes R to read BLOCK from SECTOR onward, and starts
+   reading the first two chunks. */
+static void
+reader_init (struct archive_reader *r, struct block *block,
+             block_sector_t sector)
+{
+  int i;
+
+  r->block = block;
+  r->next = sector;
+  for (i = 0; i < 2; i++)
+    {
+      r->buffers[i] = malloc (EXTRACT_SECTORS * BLOCK_SECTOR_SIZE);
+      if (r->buffers[i] == NULL)
+        PANIC ("couldn't allocate buffers");
+    }
+  reader_fill (r, 0);
+  reader_fill (r, 1);
+  r->cur = 0;
+  r->started = false;
+}
+
+/* Returns the next chunk of R's device, storing its length in
+   sectors into *CNT.  The data stays valid until the next call.
+   Panics at the end of the device. */
+static const void *
+reader_get (struct archive_reader *r, block_sector_t *cnt)
+{
+  struct block_request *req;
+
+  if (r->started)
+    {
+      /* Done with this buffer: read ahead into it, and move on to
+         the other one. */
+      reader_fill (r, r->cur);
+      r->cur = !r->cur;
+    }
+  r->started = true;
+
+  req = &r->reqs[r->cur];
+  if (!r->pending[r->cur])
+    PANIC ("archive runs past the end of the scratch device");
+  block_wait (req);
+  r->pending[r->cur] = false;
+  *cnt = req->cnt;
+  return r->buffers[r->cur];
+}
+
+/* Waits for R's reads ahead and frees its buffers. */
+static void
+reader_done (struct archive_reader *r)
+{
+  int i;
+
+  for (i = 0; i < 2; i++)
+    {
+      if (r->pending[i])
+        block_wait (&r->reqs[i]);
+      free (r->buffers[i]);
+    }
+}
+
 /* Extracts a ustar-format tar archive from the scratch block
-   device into the Pintos file system. */
+   device into the Pintos file system.
+
+   The archive is read EXTRACT_SECTORS sectors at a time and fed
+   to a ustar reader.  Each file is created at its full size from
+   its ustar header, so it is laid out contiguously if possible,
+   and then written straight from the data ranges the reader hands
+   out of its buffers. */
 void
 fsutil_extract (char **argv UNUSED)
 {
   static block_sector_t sector = 0;
 
+  struct archive_reader reader;
+  struct ustar_reader ustar;
   struct block *src;
-  void *header, *data;
+  struct file *dst = NULL;
+  const char *file_name = NULL;
+  int size = 0;
+  void *header;
+  bool done = false;
 
-  /* Allocate buffers. */
+  /* Allocate buffer. */
   header = malloc (BLOCK_SECTOR_SIZE);
-  data = malloc (BLOCK_SECTOR_SIZE);
-  if (header == NULL || data == NULL)
+  if (header == NULL)
     PANIC ("couldn't allocate buffers");
 
   /* Open source block device. */
@@ -91,29 +198,29 @@ fsutil_extract (char **argv UNUSED)
   printf ("Extracting ustar archive from scratch device "
           "into file system...\n");
 
-  for (;;)
+  reader_init (&reader, src, sector);
+  ustar_reader_init (&ustar);
+  while (!done)
     {
-      const char *file_name;
-      const char *error;
-      enum ustar_type type;
-      int size;
-
-      /* Read and parse ustar header. */
-      block_read (src, sector++, header);
-      error = ustar_parse_header (header, &file_name, &type, &size);
-      if (error != NULL)
-        PANIC ("bad ustar header in sector %"PRDSNu" (%s)", sector - 1, error);
-
-      if (type == USTAR_EOF)
+      struct ustar_chunk chunk;
+      const void *data;
+      block_sector_t cnt;
+
+      switch (ustar_reader_next (&ustar, &chunk))
         {
-          /* End of archive. */
+        case USTAR_ITEM_MORE:
+          data = reader_get (&reader, &cnt);
+          ustar_reader_feed (&ustar, data, cnt * BLOCK_SECTOR_SIZE);
           break;
-        }
-      else if (type == USTAR_DIRECTORY)
-        printf ("ignoring directory %s\n", file_name);
-      else if (type == USTAR_REGULAR)
-        {
-          struct file *dst;
+
+        case USTAR_ITEM_HEADER:
+          file_name = chunk.file_name;
+          size = chunk.size;
+          if (chunk.type == USTAR_DIRECTORY)
+            {
+              printf ("ignoring directory %s\n", file_name);
+              break;
+            }
 
           printf ("Putting '%s' into the file system...\n", file_name);
 
@@ -123,24 +230,36 @@ fsutil_extract (char **argv UNUSED)
           dst = filesys_open (file_name);
           if (dst == NULL)
             PANIC ("%s: open failed", file_name);
+          break;
 
-          /* Do copy. */
-          while (size > 0)
-            {
-              int chunk_size = (size > BLOCK_SECTOR_SIZE
-                                ? BLOCK_SECTOR_SIZE
-                                : size);
-              block_read (src, sector++, data);
-              if (file_write (dst, data, chunk_size) != chunk_size)
-                PANIC ("%s: write failed with %d bytes unwritten",
-                       file_name, size);
-              size -= chunk_size;
-            }
+        case USTAR_ITEM_DATA:
+          if (file_write (dst, chunk.data, chunk.length)
+              != (off_t) chunk.length)
+            PANIC ("%s: write failed with %d bytes unwritten",
+                   file_name, size);
+          size -= chunk.length;
+          break;
 
-          /* Finish up. */
+        case USTAR_ITEM_END:
+          done = true;
+          break;
+
+        case USTAR_ITEM_ERROR:
+          PANIC ("bad ustar header in sector %"PRDSNu" (%s)",
+                 sector + (block_sector_t) (chunk.header_ofs
+                                            / BLOCK_SECTOR_SIZE),
+                 chunk.error);
+        }
+
+      /* Finish up a file once all of its data is written. */
+      if (dst != NULL && size == 0)
+        {
           file_close (dst);
+          dst = NULL;
         }
     }
+  sector += ustar_reader_tell (&ustar) / BLOCK_SECTOR_SIZE;
+  reader_done (&reader);
 
   /* Erase the ustar header from the start of the block device,
      so that the extraction operation is idempotent.  We erase
@@ -151,10 +270,12 @@ fsutil_extract (char **argv UNUSED)
   block_write (src, 0, header);
   block_write (src, 1, header);
 
-  free (data);
   free (header);
 }
 
+/* Sectors fsutil_append() writes per request. */
+#define APPEND_SECTORS 64
+
 /* Copies file FILE_NAME from the file system to the scratch
    device, in ustar format.
 
@@ -162,24 +283,34 @@ fsutil_extract (char **argv UNUSED)
    beginning of the scratch device.  Later calls advance across
    the device.  This position is independent of that used for
    fsutil_extract(), so `extract' should precede all
-   `append's. */
+   `append's.
+
+   The file is copied APPEND_SECTORS sectors at a time through two
+   buffers in turn, so that each chunk is written to the device
+   while the next is read from the file. */
 void
 fsutil_append (char **argv)
 {
   static block_sector_t sector = 0;
 
   const char *file_name = argv[1];
-  void *buffer;
+  uint8_t *buffers[2];
+  struct block_request reqs[2];
+  bool pending[2] = { false, false };
   struct file *src;
   struct block *dst;
   off_t size;
+  int i;
 
   printf ("Appending '%s' to ustar archive on scratch device...\n", file_name);
 
-  /* Allocate buffer. */
-  buffer = malloc (BLOCK_SECTOR_SIZE);
-  if (buffer == NULL)
-    PANIC ("couldn't allocate buffer");
+  /* Allocate buffers. */
+  for (i = 0; i < 2; i++)
+    {
+      buffers[i] = malloc (APPEND_SECTORS * BLOCK_SECTOR_SIZE);
+      if (buffers[i] == NULL)
+        PANIC ("couldn't allocate buffer");
+    }
 
   /* Open source file. */
   src = filesys_open (file_name);
@@ -193,31 +324,46 @@ fsutil_append (char **argv)
     PANIC ("couldn't open scratch device");
 
   /* Write ustar header to first sector. */
-  if (!ustar_make_header (file_name, USTAR_REGULAR, size, buffer))
+  if (!ustar_make_header (file_name, USTAR_REGULAR, size,
+                          (char *) buffers[0]))
     PANIC ("%s: name too long for ustar format", file_name);
-  block_write (dst, sector++, buffer);
+  block_write (dst, sector++, buffers[0]);
 
   /* Do copy. */
-  while (size > 0)
+  for (i = 0; size > 0; i = !i)
     {
-      int chunk_size = size > BLOCK_SECTOR_SIZE ? BLOCK_SECTOR_SIZE : size;
-      if (sector >= block_size (dst))
+      int chunk_size = (size > APPEND_SECTORS * BLOCK_SECTOR_SIZE
+                        ? APPEND_SECTORS * BLOCK_SECTOR_SIZE
+                        : size);
+      block_sector_t cnt = DIV_ROUND_UP (chunk_size, BLOCK_SECTOR_SIZE);
+
+      if (cnt > block_size (dst) - sector)
         PANIC ("%s: out of space on scratch device", file_name);
-      if (file_read (src, buffer, chunk_size) != chunk_size)
+      if (pending[i])
+        block_wait (&reqs[i]);
+      if (file_read (src, buffers[i], chunk_size) != chunk_size)
         PANIC ("%s: read failed with %"PROTd" bytes unread", file_name, size);
-      memset (buffer + chunk_size, 0, BLOCK_SECTOR_SIZE - chunk_size);
-      block_write (dst, sector++, buffer);
+      memset (buffers[i] + chunk_size, 0, cnt * BLOCK_SECTOR_SIZE - chunk_size);
+      block_request_init (&reqs[i], true, sector, buffers[i], cnt);
+      block_submit (dst, &reqs[i]);
+      pending[i] = true;
+      sector += cnt;
       size -= chunk_size;
     }
+  for (i = 0; i < 2; i++)
+    if (pending[i])
+      block_wait (&reqs[i]);
 
   /* Write ustar end-of-archive marker, which is two consecutive
      sectors full of zeros.  Don't advance our position past
      them, though, in case we have more files to append. */
-  memset (buffer, 0, BLOCK_SECTOR_SIZE);
-  block_write (dst, sector, buffer);
-  block_write (dst, sector, buffer + 1);
+  if (block_size (dst) - sector < 2)
+    PANIC ("%s: out of space on scratch device", file_name);
+  memset (buffers[0], 0, 2 * BLOCK_SECTOR_SIZE);
+  block_write_multiple (dst, sector, buffers[0], 2);
 
   /* Finish up. */
   file_close (src);
-  free (buffer);
+  for (i = 0; i < 2; i++)
+    free (buffers[i]);
 }
@@ -1,34 +1,95 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
+#include <stddef.h>
 #include <string.h>
+#include <syscall-nr.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "filesys/cache.h"
+#include "filesys/journal.h"
+#include "filesys/tmpfs.h"
 #include "threads/malloc.h"
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/frame.h"
+#endif
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Identifies an inode whose data is described by extents. */
+#define INODE_EXTENT_MAGIC 0x494e4f45
+
 #define DIRECT_BLOCK_SIZE 122
 #define INDEX_SIZE 128
 #define FIRST_INDEX_LEVEL (122 + 128)
 #define SECOND_INDEX_LEVEL (122 + 128 + 128 * 128)
 #define THIRD_INDEX_LEVEL (122 + 128 + 128 * 128 + 128 * 128 * 128)
+#define EXTENT_CNT 62
+
+/* Most bytes of data an inode holds in its own sector. */
+#define INLINE_DATA_SIZE 500
+
+/* Number of closed inodes kept in memory for reopening. */
+#define CLOSED_INODES_MAX 16
+
+/* Longest run of sectors reserved at once while growing a file. */
+#define SECTOR_RUN_MAX 64
+
+/* Fewest sectors reserved ahead of an appending writer. */
+#define APPEND_RESERVE_MIN 8
+
+/* Read-ahead window bounds, in sectors. */
+#define READAHEAD_MIN 2
+#define READAHEAD_MAX 32
 
 static char zeros[BLOCK_SECTOR_SIZE];
 
+/* A run of LENGTH contiguous sectors starting at START. */
+struct extent
+  {
+    block_sector_t start;
+    uint32_t length;
+  };
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+   MAGIC selects how the data sectors are found: INODE_MAGIC
+   inodes use the direct blocks and index tree, INODE_EXTENT_MAGIC
+   inodes the first EXTENT_CNT entries of EXTENTS, in file order.
+
+   An inode no longer than INLINE_DATA_SIZE bytes is created with
+   IS_INLINE set and keeps its data in INLINE_DATA instead, at the
+   start of its own sector, so that it takes no data sector and a
+   read of it needs no second disk access.  When it grows past
+   that, the data moves out to a data sector in the layout that
+   MAGIC names. */
 struct inode_disk
   {
-    block_sector_t direct_blocks[DIRECT_BLOCK_SIZE];
-    block_sector_t first_index;
-    block_sector_t second_index;
-    block_sector_t third_index;
+    union
+      {
+        struct
+          {
+            block_sector_t direct_blocks[DIRECT_BLOCK_SIZE];
+            block_sector_t first_index;
+            block_sector_t second_index;
+            block_sector_t third_index;
+          };
+        struct
+          {
+            struct extent extents[EXTENT_CNT];
+            uint32_t extent_cnt;
+          };
+        uint8_t inline_data[INLINE_DATA_SIZE];
+      };
 
     bool is_dir;
+    bool is_inline;                     /* Data in INLINE_DATA? */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
   };
@@ -41,193 +102,730 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
-/* In-memory inode. */
+/* In-memory inode.  Only the fields of the on-disk inode needed
+   on every access are copied here; block pointers are read from
+   the on-disk inode in the buffer cache when needed. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem hash_elem;         /* Element in open_inodes. */
+    struct list_elem elem;              /* Element in closed_inodes, if closed. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
-    struct inode_disk data;             /* Inode content. */
+    off_t ra_next;                      /* Sector index a sequential read hits next. */
+    off_t ra_queued;                    /* Read-ahead queued up to this sector index. */
+    int ra_window;                      /* Read-ahead window in sectors, 0 if random. */
+    int ra_advice;                      /* MADV_NORMAL, MADV_SEQUENTIAL or
+                                           MADV_RANDOM; see inode_advise(). */
+    struct rwlock rw;                   /* Shared by I/O, exclusive to extend. */
+    struct lock lock;                   /* Serializes directory updates. */
+    struct lock extend_lock;            /* Serializes inode_extend() calls. */
+    struct lock xlate_lock;             /* Protects the XLATE_* members. */
+    block_sector_t *xlate_map;          /* Copy of the last leaf index block used. */
+    off_t xlate_base;                   /* Sector index mapped by xlate_map[0]. */
+    bool xlate_valid;                   /* False if xlate_map is stale or unset. */
+    off_t length;                       /* File size in bytes. */
+    bool is_dir;                        /* True if a directory. */
+    bool is_inline;                     /* Data in the inode's sector? */
+    unsigned magic;                     /* Layout, as in struct inode_disk. */
+    unsigned generation;                /* Changes whenever data is written. */
+    int page_cnt;                       /* Pages of it that mmap'd frames hold;
+                                           see inode_count_pages(). */
+
+    /* Sectors taken from the free map ahead of an appending
+       writer, so that a run of small appends allocates in one
+       contiguous batch instead of a sector per call.  Changed
+       only with RW held exclusively, and given back when the last
+       opener closes the inode. */
+    block_sector_t resv_next;           /* First reserved sector. */
+    size_t resv_left;                   /* Number of sectors reserved. */
+    size_t resv_window;                 /* Sectors to reserve next time. */
+
+    /* A tmpfs inode's data, or a null pointer for an inode on
+       disk.  A tmpfs inode has no sectors: it stays in
+       open_inodes, never in closed_inodes, from its creation
+       until it is removed and closed, and its data is read and
+       written through tmpfs_file_read() and tmpfs_file_write()
+       with RW held exclusively by writers. */
+    struct tmpfs_file *mem;
   };
 
-static block_sector_t index_to_sector (const struct inode_disk *inode_disk, off_t index);
-static bool inode_allocate (struct inode_disk *inode_disk, off_t length);
-static bool inode_allocate_index (block_sector_t *index, size_t sectors, off_t level);
-static void inode_deallocate (struct inode *inode, off_t length);
+static block_sector_t index_to_sector (struct inode *inode, off_t index);
+static bool inode_allocate (struct inode_disk *inode_disk, off_t start, off_t length,
+                            block_sector_t near, struct inode *appender,
+                            bool contiguous);
+static bool inode_allocate_extents (struct inode_disk *inode_disk, off_t length,
+                                    block_sector_t near);
+struct sector_run;
+static bool inode_allocate_index (block_sector_t *index, size_t first, size_t last,
+                                  off_t level, struct sector_run *run);
+static void inode_deallocate (const struct inode_disk *inode_disk, off_t length);
 static void inode_deallocate_index (block_sector_t index, size_t sectors, off_t level);
 
+/* Returns entry SLOT of the index block in SECTOR, reading just
+   those 4 bytes out of the buffer cache. */
 static block_sector_t
-index_to_sector (const struct inode_disk *inode_disk, off_t index)
+index_entry (block_sector_t sector, off_t slot)
 {
   block_sector_t ret;
-  if (index < DIRECT_BLOCK_SIZE)
-    return inode_disk->direct_blocks[index];
-  else if (index < FIRST_INDEX_LEVEL)
+  cache_read_at (sector, CACHE_META, &ret, slot * sizeof ret, sizeof ret);
+  return ret;
+}
+
+/* Layout given to new inodes: INODE_MAGIC or INODE_EXTENT_MAGIC. */
+static unsigned new_inode_magic = INODE_MAGIC;
+
+/* Last write generation handed out, to any inode. */
+static unsigned last_generation;
+
+/* Returns a write generation no inode has had before. */
+static unsigned
+next_generation (void)
+{
+  enum intr_level old_level = intr_disable ();
+  unsigned generation = ++last_generation;
+  intr_set_level (old_level);
+  return generation;
+}
+
+/* Returns the data sector holding sector index INDEX of an
+   extent-based INODE_DISK, or -1 if it has none. */
+static block_sector_t
+extent_to_sector (const struct inode_disk *inode_disk, off_t index)
+{
+  for (uint32_t i = 0; i < inode_disk->extent_cnt; i++)
   {
-    off_t index_first = (index - DIRECT_BLOCK_SIZE);
-    block_sector_t *sector = calloc (INDEX_SIZE, sizeof *sector);
-    cache_read (inode_disk->first_index, sector);
-    ret = *(sector + index_first);
-    free (sector);
-    return ret;
+    if (index < (off_t) inode_disk->extents[i].length)
+      return inode_disk->extents[i].start + index;
+    index -= inode_disk->extents[i].length;
+  }
+  return -1;
+}
+
+/* Returns the leaf index block, the one holding data sector
+   numbers, that maps sector index INDEX of INODE_DISK, and stores
+   in *BASE the sector index mapped by its first entry.  Returns 0
+   if INDEX lies in a hole with no leaf.  INDEX must lie past the
+   direct blocks. */
+static block_sector_t
+index_leaf (const struct inode_disk *inode_disk, off_t index, off_t *base)
+{
+  ASSERT (index >= DIRECT_BLOCK_SIZE && index < THIRD_INDEX_LEVEL);
+  if (index < FIRST_INDEX_LEVEL)
+  {
+    *base = DIRECT_BLOCK_SIZE;
+    return inode_disk->first_index;
   }
   else if (index < SECOND_INDEX_LEVEL)
   {
     off_t index_first = (index - FIRST_INDEX_LEVEL) / INDEX_SIZE;
-    off_t index_second = (index - FIRST_INDEX_LEVEL) % INDEX_SIZE;
-    block_sector_t *sector = calloc (INDEX_SIZE, sizeof *sector);
-    cache_read (inode_disk->second_index, sector);
-    cache_read (*(sector + index_first), sector);
-    ret = *(sector + index_second);
-    free (sector);
-    return ret;
-  }
-  else if (index < THIRD_INDEX_LEVEL)
-  {
-    off_t index_first = (index - SECOND_INDEX_LEVEL) / INDEX_SIZE;
-    off_t index_second = (index - SECOND_INDEX_LEVEL - index_first * INDEX_SIZE) / INDEX_SIZE;
-    off_t index_third = (index - SECOND_INDEX_LEVEL - index_first * INDEX_SIZE) % INDEX_SIZE;
-    block_sector_t *sector = calloc (INDEX_SIZE, sizeof *sector);
-    cache_read (inode_disk->third_index, sector);
-    cache_read (*(sector + index_first), sector);
-    cache_read (*(sector + index_second), sector);
-    ret = *(sector + index_third);
-    free (sector);
-    return ret;
-  }
-  else 
+    *base = FIRST_INDEX_LEVEL + index_first * INDEX_SIZE;
+    if (inode_disk->second_index == 0)
+      return 0;
+    return index_entry (inode_disk->second_index, index_first);
+  }
+  else
+  {
+    off_t index_first = (index - SECOND_INDEX_LEVEL) / (INDEX_SIZE * INDEX_SIZE);
+    off_t index_second = (index - SECOND_INDEX_LEVEL) / INDEX_SIZE % INDEX_SIZE;
+    block_sector_t sector;
+    *base = SECOND_INDEX_LEVEL + (index - SECOND_INDEX_LEVEL) / INDEX_SIZE * INDEX_SIZE;
+    if (inode_disk->third_index == 0)
+      return 0;
+    sector = index_entry (inode_disk->third_index, index_first);
+    return sector != 0 ? index_entry (sector, index_second) : 0;
+  }
+}
+
+/* Returns the data sector holding sector index INDEX of INODE.
+   The leaf index block used last is kept decoded in xlate_map, so
+   that walking a file only touches each index block once. */
+static block_sector_t
+index_to_sector (struct inode *inode, off_t index)
+{
+  const struct inode_disk *disk;
+  struct cache_entry *handle;
+  block_sector_t sector;
+
+  if (inode->is_inline)
+    /* Byte I of the data is byte I of the inode's sector. */
+    return index == 0 ? inode->sector : -1u;
+  else if (inode->magic == INODE_EXTENT_MAGIC)
+  {
+    disk = cache_pin_read (inode->sector, CACHE_META, &handle);
+    sector = extent_to_sector (disk, index);
+    cache_unpin (handle);
+    return sector;
+  }
+  else if (index < DIRECT_BLOCK_SIZE)
+    /* The direct blocks open the on-disk inode. */
+    return index_entry (inode->sector, index);
+  else if (index >= THIRD_INDEX_LEVEL)
     return -1;
+
+  lock_acquire (&inode->xlate_lock);
+  if (!inode->xlate_valid || index < inode->xlate_base
+      || index >= inode->xlate_base + INDEX_SIZE)
+  {
+    off_t base;
+    block_sector_t leaf;
+
+    disk = cache_pin_read (inode->sector, CACHE_META, &handle);
+    leaf = index_leaf (disk, index, &base);
+    cache_unpin (handle);
+    if (leaf == 0)
+    {
+      /* A hole. */
+      lock_release (&inode->xlate_lock);
+      return 0;
+    }
+    if (inode->xlate_map == NULL)
+      inode->xlate_map = malloc (BLOCK_SECTOR_SIZE);
+    if (inode->xlate_map == NULL)
+    {
+      /* Out of memory: translate without caching. */
+      lock_release (&inode->xlate_lock);
+      return index_entry (leaf, index - base);
+    }
+    cache_read (leaf, CACHE_META, inode->xlate_map);
+    inode->xlate_base = base;
+    inode->xlate_valid = true;
+  }
+  sector = inode->xlate_map[index - inode->xlate_base];
+  lock_release (&inode->xlate_lock);
+  return sector;
+}
+
+/* Returns true if INODE's contents are file system metadata: a
+   directory, the free map, or data kept inline in the inode's
+   own sector. */
+static inline bool
+inode_holds_meta (const struct inode *inode)
+{
+  return inode->is_dir || inode->is_inline || inode->sector == FREE_MAP_SECTOR;
+}
+
+/* Returns the cache class of INODE's data sectors. */
+static inline enum cache_class
+inode_class (const struct inode *inode)
+{
+  return inode_holds_meta (inode) ? CACHE_META : CACHE_DATA;
+}
+
+/* Returns the cache class of the data sectors of INODE_DISK, the
+   on-disk inode at SECTOR: directory and free map contents are
+   metadata. */
+static inline enum cache_class
+data_class (const struct inode_disk *inode_disk, block_sector_t sector)
+{
+  return inode_disk->is_dir || sector == FREE_MAP_SECTOR ? CACHE_META : CACHE_DATA;
 }
 
 /* Returns the block device sector that contains byte offset POS
    within INODE.
    Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   POS, or 0 if POS lies in a hole that has no sector yet. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos) 
 {
   ASSERT (inode != NULL);
-  if (pos < inode->data.length){
+  if (pos < inode->length){
     off_t index = pos / BLOCK_SECTOR_SIZE;
-    return index_to_sector (&inode->data, index);
+    return index_to_sector (inode, index);
   }
   else
     return -1;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Open inodes keyed by sector, so that opening a single inode
+   twice returns the same `struct inode'.  Also holds the inodes
+   in closed_inodes. */
+static struct hash open_inodes;
+
+/* Up to CLOSED_INODES_MAX inodes whose last opener closed them,
+   most recently closed first, so that reopening one does not read
+   it from disk again.  Their open_cnt is 0. */
+static struct list closed_inodes;
+static size_t closed_cnt;
+
+/* Protects open_inodes, closed_inodes and the open_cnt, removed
+   and deny_write_cnt members of every inode.  Never held across
+   disk I/O except when an inode is first read in. */
+static struct lock open_inodes_lock;
+
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, hash_elem)->sector);
+}
+
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, hash_elem)->sector
+          < hash_entry (b, struct inode, hash_elem)->sector);
+}
+
+/* Returns the in-memory inode for SECTOR, open or closed, or a
+   null pointer. */
+static struct inode *
+inode_find (block_sector_t sector)
+{
+  struct inode key;
+  struct hash_elem *e;
+
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct inode, hash_elem) : NULL;
+}
+
+/* Frees closed INODE. */
+static void
+inode_evict (struct inode *inode)
+{
+  ASSERT (inode->open_cnt == 0);
+  list_remove (&inode->elem);
+  closed_cnt--;
+  hash_delete (&open_inodes, &inode->hash_elem);
+  free (inode->xlate_map);
+  free (inode);
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+    PANIC ("open inode table creation failed");
+  list_init (&closed_inodes);
+  closed_cnt = 0;
+  lock_init (&open_inodes_lock);
+}
+
+/* Selects the on-disk layout of inodes created from now on:
+   "tree" for direct blocks plus an index tree, or "extent" for a
+   list of contiguous runs.  Returns false if NAME is unknown. */
+bool
+inode_set_format (const char *name)
+{
+  if (!strcmp (name, "tree"))
+    new_inode_magic = INODE_MAGIC;
+  else if (!strcmp (name, "extent"))
+    new_inode_magic = INODE_EXTENT_MAGIC;
+  else
+    return false;
+  return true;
+}
+
+/* Makes new inodes use the layout of the inode in SECTOR, so that
+   a file system keeps the format it was created with.  Inodes of
+   either layout can always be read. */
+void
+inode_adopt_format (block_sector_t sector)
+{
+  unsigned magic;
+
+  cache_read_at (sector, CACHE_META, &magic, offsetof (struct inode_disk, magic), sizeof magic);
+  if (magic == INODE_MAGIC || magic == INODE_EXTENT_MAGIC)
+    new_inode_magic = magic;
+}
+
+/* Sectors reserved from the free map as one contiguous run and
+   handed out in order while a tree inode grows, so that its
+   blocks end up next to each other and the free map is scanned
+   once per run rather than once per sector. */
+struct sector_run
+  {
+    block_sector_t next;                /* Next sector to hand out. */
+    size_t left;                        /* Sectors left in the run. */
+    size_t wanted;                      /* Sectors still expected to be taken. */
+    size_t max;                         /* Longest run to reserve at once. */
+    block_sector_t owner;               /* Inode the sectors are written for. */
+  };
+
+/* Stores the next sector of RUN into *SECTORP, first reserving a
+   new run near the previous one if RUN is used up.  Returns false
+   if the disk is full. */
+static bool
+sector_run_take (struct sector_run *run, block_sector_t *sectorp)
+{
+  if (run->left == 0)
+  {
+    size_t cnt = run->wanted < run->max ? run->wanted : run->max;
+    for (cnt = cnt > 0 ? cnt : 1; cnt > 0; cnt /= 2)
+      if (free_map_allocate_near (cnt, run->next, &run->next))
+        break;
+    if (cnt == 0)
+      return false;
+    run->left = cnt;
+  }
+  *sectorp = run->next++;
+  run->left--;
+  if (run->wanted > 0)
+    run->wanted--;
+  return true;
+}
+
+/* Gives the unused part of RUN back to the free map. */
+static void
+sector_run_finish (struct sector_run *run)
+{
+  if (run->left > 0)
+    free_map_release (run->next, run->left);
+  run->left = 0;
 }
 
-static bool 
-inode_allocate_index (block_sector_t *index, size_t sectors, off_t level)
+/* Number of data sectors mapped by an index block of LEVEL. */
+static size_t
+index_span (off_t level)
+{
+  size_t span = 1;
+  while (level-- > 0)
+    span *= INDEX_SIZE;
+  return span;
+}
+
+/* Allocates the data sectors with indexes FIRST up to but not
+   including LAST, counted from the start of the subtree under the
+   index block at *INDEX of LEVEL (a data sector at level 0),
+   taking them and any missing index blocks on the way from RUN.
+   Sectors already allocated are left alone, so that the rest of
+   the subtree stays a hole. */
+static bool
+inode_allocate_index (block_sector_t *index, size_t first, size_t last, off_t level,
+                      struct sector_run *run)
 {
   if (level == 0)
   {
     if (*index == 0)
     {
-      if (!free_map_allocate (1, index))
+      if (!sector_run_take (run, index))
         return false;
-      cache_write (*index, zeros);
+      cache_write (*index, CACHE_META, run->owner, zeros);
     }
     return true;
   }
   block_sector_t blocks[INDEX_SIZE];
+  size_t span = index_span (level - 1);
+  bool changed = false, success = true;
   if (*index == 0)
   {
-    free_map_allocate (1, index);
-    cache_write (*index, zeros);
+    if (!sector_run_take (run, index))
+      return false;
+    memset (blocks, 0, sizeof blocks);
+    changed = true;
   }
-  cache_read (*index, &blocks);
-  if (level == 1)
+  else
+    cache_read (*index, CACHE_META, &blocks);
+  for (size_t i = first / span; success && i < DIV_ROUND_UP (last, span); i++)
   {
-    for (size_t i = 0; i < sectors; i++)
+    size_t base = i * span;
+    block_sector_t old = blocks[i];
+    success = inode_allocate_index (&blocks[i], first > base ? first - base : 0,
+                                    last < base + span ? last - base : span,
+                                    level - 1, run);
+    changed |= blocks[i] != old;
+  }
+
+  /* Write back even after a failure, so that the sectors taken
+     stay recorded and are used again by the next attempt. */
+  if (changed)
+    cache_write_meta (*index, run->owner, &blocks);
+  return success;
+}
+
+/* Allocates N zeroed sectors right after the last extent of
+   INODE_DISK, or as a new extent, trying shorter runs if N
+   contiguous sectors are not free.  The first extent is placed
+   near sector NEAR, the inode's own sector.  Returns the number of sectors allocated, 0 on
+   failure. */
+static size_t
+inode_allocate_run (struct inode_disk *inode_disk, size_t n, block_sector_t near)
+{
+  struct extent *last = (inode_disk->extent_cnt > 0
+                         ? &inode_disk->extents[inode_disk->extent_cnt - 1]
+                         : NULL);
+  block_sector_t start = 0;
+  size_t cnt;
+
+  for (cnt = n; cnt > 0; cnt /= 2)
+    if (last != NULL && free_map_allocate_at (last->start + last->length, cnt))
     {
-      if (!inode_allocate_index (&blocks[i], 1, level - 1))
-        return false;
+      start = last->start + last->length;
+      last->length += cnt;
+      break;
     }
+  if (cnt == 0 && inode_disk->extent_cnt < EXTENT_CNT)
+    for (cnt = n; cnt > 0; cnt /= 2)
+      if (free_map_allocate_near (cnt, last != NULL ? last->start + last->length : near,
+                                  &start))
+      {
+        last = &inode_disk->extents[inode_disk->extent_cnt++];
+        last->start = start;
+        last->length = cnt;
+        break;
+      }
+
+  for (size_t i = 0; i < cnt; i++)
+    cache_write (start + i, data_class (inode_disk, near), near, zeros);
+  return cnt;
+}
+
+/* Extent counterpart of inode_allocate(). */
+static bool
+inode_allocate_extents (struct inode_disk *inode_disk, off_t length,
+                        block_sector_t near)
+{
+  size_t want = bytes_to_sectors (length);
+  size_t have = 0;
+
+  for (uint32_t i = 0; i < inode_disk->extent_cnt; i++)
+    have += inode_disk->extents[i].length;
+  while (have < want)
+  {
+    size_t cnt = inode_allocate_run (inode_disk, want - have, near);
+    if (cnt == 0)
+      return false;
+    have += cnt;
   }
-  else if (level == 2)
+  return true;
+}
+
+/* Allocates, under the index block at *INDEX of LEVEL that maps
+   the data sectors from BASE up to END, those of them in the
+   range FIRST up to LAST. */
+static bool
+inode_allocate_level (block_sector_t *index, size_t base, size_t end, off_t level,
+                      size_t first, size_t last, struct sector_run *run)
+{
+  if (first >= end || last <= base)
+    return true;
+  return inode_allocate_index (index, first > base ? first - base : 0,
+                               (last < end ? last : end) - base, level, run);
+}
+
+/* Allocates the data sectors with indexes FIRST up to but not
+   including LAST of a tree INODE_DISK, taking them from RUN. */
+static bool
+inode_allocate_tree (struct inode_disk *inode_disk, size_t first, size_t last,
+                     struct sector_run *run)
+{
+  if (last > THIRD_INDEX_LEVEL)
+    return false;
+  for (size_t i = first; i < last && i < DIRECT_BLOCK_SIZE; i++)
   {
-    size_t num = DIV_ROUND_UP (sectors, INDEX_SIZE);
-    for (size_t i = 0; i < num; i++)
+    if (inode_disk->direct_blocks[i] == 0)
     {
-      size_t subsize = sectors < INDEX_SIZE ? sectors : INDEX_SIZE;
-      if (!inode_allocate_index (&blocks[i], subsize, level - 1))
+      if (!sector_run_take (run, &inode_disk->direct_blocks[i]))
         return false;
-      sectors -= subsize;
+      cache_write (inode_disk->direct_blocks[i], data_class (inode_disk, run->owner),
+                   run->owner, zeros);
     }
   }
-  else if (level == 3)
+  return (inode_allocate_level (&inode_disk->first_index, DIRECT_BLOCK_SIZE,
+                                FIRST_INDEX_LEVEL, 1, first, last, run)
+          && inode_allocate_level (&inode_disk->second_index, FIRST_INDEX_LEVEL,
+                                   SECOND_INDEX_LEVEL, 2, first, last, run)
+          && inode_allocate_level (&inode_disk->third_index, SECOND_INDEX_LEVEL,
+                                   THIRD_INDEX_LEVEL, 3, first, last, run));
+}
+
+/* Returns the last data sector of the first SECTORS sectors of a
+   tree INODE_DISK, or 0 if SECTORS is 0 or that sector is a
+   hole. */
+static block_sector_t
+tree_last_sector (const struct inode_disk *inode_disk, size_t sectors)
+{
+  off_t index = sectors - 1, base;
+  block_sector_t leaf;
+
+  if (sectors == 0 || index >= THIRD_INDEX_LEVEL)
+    return 0;
+  else if (index < DIRECT_BLOCK_SIZE)
+    return inode_disk->direct_blocks[index];
+  leaf = index_leaf (inode_disk, index, &base);
+  return leaf != 0 ? index_entry (leaf, index - base) : 0;
+}
+
+/* Moves the inline data of INODE_DISK, the inode at sector NEAR,
+   out to a newly allocated data sector in the layout its magic
+   names.  On failure INODE_DISK stays inline, but any sectors
+   taken before the disk filled up stay allocated. */
+static bool
+inode_promote (struct inode_disk *inode_disk, block_sector_t near)
+{
+  off_t old_length = inode_disk->length;
+  uint8_t *data;
+  block_sector_t first;
+
+  inode_disk->is_inline = false;
+  if (old_length == 0)
+    return true;
+  data = malloc (INLINE_DATA_SIZE);
+  if (data == NULL)
   {
-    size_t num = DIV_ROUND_UP (sectors, INDEX_SIZE * INDEX_SIZE);
-    for (size_t i = 0; i < num; i++)
-    {
-      size_t subsize = sectors < INDEX_SIZE * INDEX_SIZE ? sectors : INDEX_SIZE * INDEX_SIZE;
-      if (!inode_allocate_index (&blocks[i], subsize, level - 1))
-        return false;
-      sectors -= subsize;
-    }
+    inode_disk->is_inline = true;
+    return false;
+  }
+  memcpy (data, inode_disk->inline_data, INLINE_DATA_SIZE);
+  memset (inode_disk->inline_data, 0, INLINE_DATA_SIZE);
+  if (!inode_allocate (inode_disk, 0, old_length, near, NULL, false))
+  {
+    memcpy (inode_disk->inline_data, data, INLINE_DATA_SIZE);
+    inode_disk->is_inline = true;
+    free (data);
+    return false;
   }
 
-  cache_write (*index, &blocks);
+  first = (inode_disk->magic == INODE_EXTENT_MAGIC
+           ? extent_to_sector (inode_disk, 0) : inode_disk->direct_blocks[0]);
+  cache_write_at (first, data_class (inode_disk, near), near, data, 0, old_length);
+  free (data);
   return true;
 }
 
+/* Makes INODE_DISK able to hold LENGTH bytes, with data sectors
+   for the bytes from START on.  A tree inode leaves the sectors
+   before START that it does not have yet as holes, which read as
+   zeros and are allocated only when written; an extent inode
+   allocates all of them.  The first data sector of an empty
+   inode is placed near sector NEAR, the inode's own sector, for
+   which the new sectors are written.
+
+   APPENDER, if nonnull, is the in-memory inode being appended to.
+   A tree inode then takes its sectors from APPENDER's reservation,
+   and reserves a window of sectors beyond LENGTH when it runs
+   out.  The window doubles with each batch, up to SECTOR_RUN_MAX.
+
+   If CONTIGUOUS is true, a tree inode first tries to reserve all
+   of its new sectors as one run, for a file whose size is known
+   ahead, instead of SECTOR_RUN_MAX sectors at a time.  Extent
+   inodes always try the longest run first. */
 static bool
-inode_allocate (struct inode_disk *inode_disk, off_t length)
+inode_allocate (struct inode_disk *inode_disk, off_t start, off_t length,
+                block_sector_t near, struct inode *appender, bool contiguous)
 {
-  ASSERT (length >= 0);
+  bool success;
 
-  size_t sectors = bytes_to_sectors(length);
-  size_t num;
+  ASSERT (start >= 0 && length >= start);
 
-  num = sectors < DIRECT_BLOCK_SIZE ? sectors : DIRECT_BLOCK_SIZE;
-  for (size_t i = 0; i < num; i++)
+  if (inode_disk->is_inline)
   {
-    if (inode_disk->direct_blocks[i] == 0)
+    if (length <= INLINE_DATA_SIZE)
+      return true;
+    if (!inode_promote (inode_disk, near))
+      return false;
+  }
+
+  if (inode_disk->magic == INODE_EXTENT_MAGIC)
+    success = inode_allocate_extents (inode_disk, length, near);
+  else
+  {
+    size_t first = start / BLOCK_SECTOR_SIZE;
+    size_t last = bytes_to_sectors (length);
+    size_t cnt = last > first ? last - first : 0;
+    struct sector_run run;
+
+    /* Reserve room for the data plus about one index block per
+       INDEX_SIZE data sectors, right after the sector before. */
+    run.next = first > 0 ? tree_last_sector (inode_disk, first) : 0;
+    if (run.next == 0)
+      run.next = near;
+    run.left = 0;
+    run.owner = near;
+    run.wanted = cnt + cnt / INDEX_SIZE + 1;
+    run.max = contiguous ? run.wanted : SECTOR_RUN_MAX;
+    if (appender != NULL)
     {
-      if (!free_map_allocate (1, &inode_disk->direct_blocks[i]))
-        return false;
-      cache_write (inode_disk->direct_blocks[i], zeros);
+      if (appender->resv_left > 0)
+      {
+        run.next = appender->resv_next;
+        run.left = appender->resv_left;
+      }
+      else
+      {
+        appender->resv_window = (appender->resv_window == 0 ? APPEND_RESERVE_MIN
+                                 : appender->resv_window * 2 > SECTOR_RUN_MAX
+                                 ? SECTOR_RUN_MAX : appender->resv_window * 2);
+        run.wanted += appender->resv_window;
+      }
+    }
+    success = inode_allocate_tree (inode_disk, first, last, &run);
+    if (appender != NULL)
+    {
+      appender->resv_next = run.next;
+      appender->resv_left = run.left;
     }
+    else
+      sector_run_finish (&run);
   }
-  sectors -= num;
-  if (sectors == 0) return true;
-
-  num = sectors < INDEX_SIZE ? sectors : INDEX_SIZE;
-  if (!inode_allocate_index (&inode_disk->first_index, num, 1))
-    return false;
-  sectors -= num;
-  if (sectors == 0) return true;
+  return success;
+}
 
-  num = sectors < INDEX_SIZE * INDEX_SIZE ? sectors : INDEX_SIZE * INDEX_SIZE;
-  if (!inode_allocate_index (&inode_disk->second_index, num, 2))
-    return false;
-  sectors -= num;
-  if (sectors == 0) return true;
+/* Returns a new in-memory inode for SECTOR, open once and not yet
+   in open_inodes, with its on-disk fields left for the caller to
+   fill in, or a null pointer if memory is short. */
+static struct inode *
+inode_alloc (block_sector_t sector)
+{
+  struct inode *inode = malloc (sizeof *inode);
+  if (inode == NULL)
+    return NULL;
+  inode->sector = sector;
+  inode->open_cnt = 1;
+  inode->deny_write_cnt = 0;
+  inode->removed = false;
+  inode->ra_next = 0;
+  inode->ra_queued = 0;
+  inode->ra_window = 0;
+  inode->ra_advice = MADV_NORMAL;
+  rwlock_init (&inode->rw);
+  lock_init (&inode->lock);
+  lock_init (&inode->extend_lock);
+  lock_init (&inode->xlate_lock);
+  inode->xlate_map = NULL;
+  inode->xlate_valid = false;
+  inode->generation = next_generation ();
+  inode->page_cnt = 0;
+  inode->resv_left = 0;
+  inode->resv_window = 0;
+  inode->mem = NULL;
+  return inode;
+}
 
-  num = sectors < INDEX_SIZE * INDEX_SIZE * INDEX_SIZE ? sectors : INDEX_SIZE;
-  if (!inode_allocate_index (&inode_disk->third_index, num, 3))
+/* Creates tmpfs inode INUMBER, holding LENGTH bytes of zeros, and
+   leaves it closed in open_inodes.  Returns false if memory is
+   short. */
+static bool
+inode_create_memory (block_sector_t inumber, off_t length, bool is_dir)
+{
+  struct inode *inode = inode_alloc (inumber);
+  if (inode == NULL)
     return false;
-  sectors -= num;
-  if (sectors == 0) return true;
-
-  return false;
+  inode->mem = tmpfs_file_create ();
+  if (inode->mem == NULL)
+    {
+      free (inode);
+      return false;
+    }
+  inode->open_cnt = 0;
+  inode->length = length;
+  inode->is_dir = is_dir;
+  inode->is_inline = false;
+  inode->magic = 0;
+
+  lock_acquire (&open_inodes_lock);
+  hash_insert (&open_inodes, &inode->hash_elem);
+  lock_release (&open_inodes_lock);
+  return true;
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  A large inode is laid out in one contiguous run if
+   there is one.  A tmpfs inode number gets an inode in memory
+   instead.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
@@ -242,15 +840,29 @@ inode_create (block_sector_t sector, off_t length, bool is_dir)
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
+  if (tmpfs_owns (sector))
+    return inode_create_memory (sector, length, is_dir);
+
+  /* Forget a stale copy of an inode that used to live here. */
+  lock_acquire (&open_inodes_lock);
+  struct inode *stale = inode_find (sector);
+  if (stale != NULL && stale->open_cnt == 0)
+    inode_evict (stale);
+  lock_release (&open_inodes_lock);
+
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
+      disk_inode->magic = new_inode_magic;
       disk_inode->is_dir = is_dir;
-      if (inode_allocate (disk_inode, disk_inode->length)) 
+      /* Sector 0 marks a hole, so the free map, whose inode is
+         there, never keeps its data inline. */
+      disk_inode->is_inline = length <= INLINE_DATA_SIZE && sector != FREE_MAP_SECTOR;
+      if (inode_allocate (disk_inode, 0, length, sector, NULL,
+                          length > SECTOR_RUN_MAX * BLOCK_SECTOR_SIZE)) 
         {
-          cache_write (sector, disk_inode);
+          disk_inode->length = length;
+          cache_write_meta (sector, sector, disk_inode);
           success = true; 
         } 
       free (disk_inode);
@@ -264,33 +876,56 @@ inode_create (block_sector_t sector, off_t length, bool is_dir)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  /* Check whether this inode is already open, or was closed
+     recently. */
+  lock_acquire (&open_inodes_lock);
+  inode = inode_find (sector);
+  if (inode != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
+      if (inode->open_cnt == 0)
         {
-          inode_reopen (inode);
-          return inode; 
+          if (inode->mem == NULL)
+            {
+              list_remove (&inode->elem);
+              closed_cnt--;
+            }
+          inode->ra_next = 0;
+          inode->ra_queued = 0;
+          inode->ra_window = 0;
+          inode->ra_advice = MADV_NORMAL;
         }
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+      return inode;
     }
 
-  /* Allocate memory. */
-  inode = malloc (sizeof *inode);
-  if (inode == NULL)
-    return NULL;
+  /* A tmpfs inode not in the table does not exist. */
+  if (tmpfs_owns (sector))
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
-  inode->sector = sector;
-  inode->open_cnt = 1;
-  inode->deny_write_cnt = 0;
-  inode->removed = false;
-  cache_read (inode->sector, &inode->data);
+  /* Allocate memory and initialize. */
+  inode = inode_alloc (sector);
+  if (inode == NULL)
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
+  hash_insert (&open_inodes, &inode->hash_elem);
+  /* Read the inode in before dropping the lock, so that a second
+     opener never sees it half set up. */
+  struct cache_entry *handle;
+  const struct inode_disk *disk = cache_pin_read (inode->sector, CACHE_META, &handle);
+  inode->length = disk->length;
+  inode->is_dir = disk->is_dir;
+  inode->is_inline = disk->is_inline;
+  inode->magic = disk->magic;
+  cache_unpin (handle);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -299,7 +934,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -310,16 +949,28 @@ inode_get_inumber (const struct inode *inode)
   return inode->sector;
 }
 
+/* Returns INODE's write generation.  It differs from any value
+   returned earlier for this or any other inode once INODE's data
+   has been written, so that a caller may keep what it derived
+   from the data for as long as the generation stays the same. */
+unsigned
+inode_get_generation (const struct inode *inode)
+{
+  return inode->generation;
+}
+
 static void
 inode_deallocate_index (block_sector_t index, size_t sectors, off_t level)
 {
+  if (index == 0)
+    return;
   if (level == 0)
   {
     free_map_release (index, 1);
     return;
   }
   block_sector_t blocks[INDEX_SIZE];
-  cache_read (index, &blocks);
+  cache_read (index, CACHE_META, &blocks);
   if (level == 1)
   {
     for (size_t i = 0; i < sectors; i++)
@@ -352,8 +1003,17 @@ inode_deallocate_index (block_sector_t index, size_t sectors, off_t level)
 }
 
 static void
-inode_deallocate (struct inode *inode, off_t length)
+inode_deallocate (const struct inode_disk *inode_disk, off_t length)
 {
+  if (inode_disk->is_inline)
+    return;
+  if (inode_disk->magic == INODE_EXTENT_MAGIC)
+  {
+    for (uint32_t i = 0; i < inode_disk->extent_cnt; i++)
+      free_map_release (inode_disk->extents[i].start, inode_disk->extents[i].length);
+    return;
+  }
+
   ASSERT (length >= 0 && length < THIRD_INDEX_LEVEL);
 
   size_t sectors = bytes_to_sectors (length);
@@ -361,7 +1021,8 @@ inode_deallocate (struct inode *inode, off_t length)
   {
     for (size_t i = 0; i < sectors; i++)
     {
-      free_map_release (inode->data.direct_blocks[i], 1);
+      if (inode_disk->direct_blocks[i] != 0)
+        free_map_release (inode_disk->direct_blocks[i], 1);
     }
     return;
   }
@@ -369,33 +1030,34 @@ inode_deallocate (struct inode *inode, off_t length)
   {
     for (size_t i = 0; i < DIRECT_BLOCK_SIZE; i++)
     {
-      free_map_release (inode->data.direct_blocks[i], 1);
+      if (inode_disk->direct_blocks[i] != 0)
+        free_map_release (inode_disk->direct_blocks[i], 1);
     }
   }
 
   if (sectors < FIRST_INDEX_LEVEL)
   {
-    inode_deallocate_index (inode->data.first_index, sectors - DIRECT_BLOCK_SIZE, 1);
+    inode_deallocate_index (inode_disk->first_index, sectors - DIRECT_BLOCK_SIZE, 1);
     return;
   }
   else
   {
-    inode_deallocate_index (inode->data.first_index, FIRST_INDEX_LEVEL - DIRECT_BLOCK_SIZE, 1);
+    inode_deallocate_index (inode_disk->first_index, FIRST_INDEX_LEVEL - DIRECT_BLOCK_SIZE, 1);
   }
 
   if (sectors < SECOND_INDEX_LEVEL)
   {
-    inode_deallocate_index (inode->data.second_index, sectors - FIRST_INDEX_LEVEL, 2);
+    inode_deallocate_index (inode_disk->second_index, sectors - FIRST_INDEX_LEVEL, 2);
     return;
   }
   else
   {
-    inode_deallocate_index (inode->data.second_index, SECOND_INDEX_LEVEL - FIRST_INDEX_LEVEL, 2);
+    inode_deallocate_index (inode_disk->second_index, SECOND_INDEX_LEVEL - FIRST_INDEX_LEVEL, 2);
   }
 
   if (sectors < THIRD_INDEX_LEVEL)
   {
-    inode_deallocate_index (inode->data.third_index, sectors - SECOND_INDEX_LEVEL, 3);
+    inode_deallocate_index (inode_disk->third_index, sectors - SECOND_INDEX_LEVEL, 3);
     return;
   }
   else
@@ -408,24 +1070,74 @@ inode_deallocate (struct inode *inode, off_t length)
 void
 inode_close (struct inode *inode) 
 {
+  block_sector_t resv_next = 0;
+  size_t resv_left = 0;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
   /* Release resources if this was the last opener. */
+  lock_acquire (&open_inodes_lock);
   if (--inode->open_cnt == 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
-      /* Deallocate blocks if removed. */
+      /* A tmpfs inode stays in the table until it is removed, and
+         then its memory is all there is to free. */
+      if (inode->mem != NULL)
+        {
+          if (inode->removed)
+            hash_delete (&open_inodes, &inode->hash_elem);
+          lock_release (&open_inodes_lock);
+          if (inode->removed)
+            {
+              tmpfs_file_destroy (inode->mem);
+              free (inode);
+            }
+          return;
+        }
+
+      /* Give back the sectors reserved for appending, once the
+         table lock is dropped. */
+      resv_next = inode->resv_next;
+      resv_left = inode->resv_left;
+      inode->resv_left = 0;
+      inode->resv_window = 0;
+
+      /* Deallocate blocks if removed.  Nobody can find the inode
+         once it is out of the table, so this needs no lock.  Its
+         own sector, and the reservation, are released only after
+         its blocks: once free, a concurrent create may put a new
+         inode there, whose blocks we would then free instead. */
       if (inode->removed) 
         {
+          hash_delete (&open_inodes, &inode->hash_elem);
+          lock_release (&open_inodes_lock);
+          journal_begin ();
+          struct cache_entry *handle;
+          inode_deallocate (cache_pin_read (inode->sector, CACHE_META, &handle),
+                            inode->length);
+          cache_unpin (handle);
+          if (resv_left > 0)
+            free_map_release (resv_next, resv_left);
           free_map_release (inode->sector, 1);
-          inode_deallocate (inode, inode->data.length); 
+          journal_end ();
+          free (inode->xlate_map);
+          free (inode); 
+          return;
         }
 
-      free (inode); 
+      /* Otherwise keep it around in case it is reopened soon. */
+      list_push_front (&closed_inodes, &inode->elem);
+      if (++closed_cnt > CLOSED_INODES_MAX)
+        inode_evict (list_entry (list_back (&closed_inodes), struct inode, elem));
+    }
+  lock_release (&open_inodes_lock);
+
+  if (resv_left > 0)
+    {
+      journal_begin ();
+      free_map_release (resv_next, resv_left);
+      journal_end ();
     }
 }
 
@@ -435,7 +1147,92 @@ void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
+  lock_acquire (&open_inodes_lock);
   inode->removed = true;
+  lock_release (&open_inodes_lock);
+}
+
+/* Updates INODE's read-ahead state for a read that covered bytes
+   START up to END, and queues the sectors in the read-ahead
+   window with the cache's read-ahead thread.  A read is
+   sequential if it starts in the sector where the previous one
+   ended or in the one after it; each sequential read doubles the
+   window up to READAHEAD_MAX, and any other read resets it.
+   Under MADV_SEQUENTIAL the window is always READAHEAD_MAX, and
+   under MADV_RANDOM nothing is read ahead. */
+static void
+inode_readahead (struct inode *inode, off_t start, off_t end)
+{
+  off_t first = start / BLOCK_SECTOR_SIZE;
+  off_t last, i;
+
+  if (inode->ra_advice == MADV_RANDOM)
+    return;
+  if (start != 0 && (first == inode->ra_next || first + 1 == inode->ra_next))
+    inode->ra_window = (inode->ra_window == 0 ? READAHEAD_MIN
+                        : inode->ra_window * 2 > READAHEAD_MAX ? READAHEAD_MAX
+                        : inode->ra_window * 2);
+  else
+    {
+      inode->ra_window = 0;
+      inode->ra_queued = 0;
+    }
+  if (inode->ra_advice == MADV_SEQUENTIAL)
+    inode->ra_window = READAHEAD_MAX;
+  inode->ra_next = DIV_ROUND_UP (end, BLOCK_SECTOR_SIZE);
+  if (inode->ra_window == 0)
+    return;
+
+  last = inode->ra_next + inode->ra_window;
+  if (last > (off_t) bytes_to_sectors (inode_length (inode)))
+    last = bytes_to_sectors (inode_length (inode));
+  i = inode->ra_queued > inode->ra_next ? inode->ra_queued : inode->ra_next;
+  for (; i < last; i++)
+    {
+      block_sector_t sector = index_to_sector (inode, i);
+      if (sector != 0)
+        cache_prefetch (sector);
+    }
+  if (i > inode->ra_queued)
+    inode->ra_queued = i;
+}
+
+/* Reads SIZE bytes from tmpfs INODE into BUFFER, starting at
+   OFFSET, as for inode_read_at(). */
+static off_t
+inode_read_memory (struct inode *inode, uint8_t *buffer, off_t size,
+                   off_t offset)
+{
+  off_t bytes_read = 0;
+
+  rwlock_acquire_read (&inode->rw);
+  if (offset >= inode->length)
+    size = 0;
+  else if (size > inode->length - offset)
+    size = inode->length - offset;
+  while (size > 0)
+    {
+      off_t chunk_size = 0;
+
+#ifdef VM
+      /* As in inode_read_at(), a mapped page is read from its
+         frame. */
+      if (inode->page_cnt > 0)
+        chunk_size = frame_file_read (inode, buffer + bytes_read, offset, size);
+#endif
+      if (chunk_size <= 0)
+        {
+          chunk_size = PGSIZE - offset % PGSIZE;
+          if (chunk_size > size)
+            chunk_size = size;
+          tmpfs_file_read (inode->mem, buffer + bytes_read, chunk_size, offset);
+        }
+      size -= chunk_size;
+      offset += chunk_size;
+      bytes_read += chunk_size;
+    }
+  rwlock_release_read (&inode->rw);
+  return bytes_read;
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
@@ -446,8 +1243,12 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  off_t start = offset;
+
+  if (inode->mem != NULL)
+    return inode_read_memory (inode, buffer, size, offset);
 
+  rwlock_acquire_read (&inode->rw);
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
@@ -464,59 +1265,292 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          cache_read (sector_idx, buffer + bytes_read);
-        }
-      else 
+#ifdef VM
+      /* A page that a process has mapped is read from its frame,
+         which holds the newest data, up to the end of the page. */
+      if (inode->page_cnt > 0)
         {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
+          off_t n = frame_file_read (inode, buffer + bytes_read, offset,
+                                     size < inode_left ? size : inode_left);
+          if (n > 0)
             {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
+              size -= n;
+              offset += n;
+              bytes_read += n;
+              continue;
             }
-          cache_read (sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
         }
+#endif
+
+      /* Copy straight out of the cached sector.  A hole reads as
+         zeros.  A file read sequentially is read once, so each
+         sector read to its end goes first when the cache needs
+         room. */
+      if (sector_idx != 0)
+        {
+          cache_read_at (sector_idx, inode_class (inode), buffer + bytes_read,
+                         sector_ofs, chunk_size);
+          if (inode->ra_advice == MADV_SEQUENTIAL
+              && sector_ofs + chunk_size == BLOCK_SECTOR_SIZE)
+            cache_demote (sector_idx);
+        }
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  if (bytes_read > 0)
+    inode_readahead (inode, start, offset);
+  rwlock_release_read (&inode->rw);
 
   return bytes_read;
 }
 
+/* Returns true if some sector of INODE holding the SIZE bytes
+   starting at OFFSET, up to its current length, is a hole. */
+static bool
+inode_has_hole (struct inode *inode, off_t offset, off_t size)
+{
+  off_t end = offset + size < inode_length (inode) ? offset + size : inode_length (inode);
+  off_t pos;
+
+  if (inode->is_inline || inode->magic == INODE_EXTENT_MAGIC)
+    return false;
+  for (pos = offset - offset % BLOCK_SECTOR_SIZE; pos < end; pos += BLOCK_SECTOR_SIZE)
+    if (byte_to_sector (inode, pos) == 0)
+      return true;
+  return false;
+}
+
+/* Writes SIZE bytes from BUFFER into tmpfs INODE, starting at
+   OFFSET, as for inode_write(), with INODE's lock held
+   exclusively throughout. */
+static off_t
+inode_write_memory (struct inode *inode, const uint8_t *buffer, off_t size,
+                    off_t offset, bool to_frames UNUSED)
+{
+  off_t bytes_written;
+
+  rwlock_acquire_write (&inode->rw);
+  bytes_written = tmpfs_file_write (inode->mem, buffer, size, offset);
+  if (bytes_written > 0 && offset + bytes_written > inode->length)
+    inode->length = offset + bytes_written;
+#ifdef VM
+  if (to_frames && inode->page_cnt > 0)
+    {
+      off_t done = 0;
+      while (done < bytes_written)
+        {
+          off_t chunk_size = PGSIZE - (offset + done) % PGSIZE;
+          if (chunk_size > bytes_written - done)
+            chunk_size = bytes_written - done;
+          frame_file_write (inode, buffer + done, offset + done, chunk_size);
+          done += chunk_size;
+        }
+    }
+#endif
+  if (bytes_written > 0)
+    inode->generation = next_generation ();
+  rwlock_release_write (&inode->rw);
+  return bytes_written;
+}
+
+/* Writes SIZE bytes from BUFFER into plain file INODE, starting
+   at OFFSET, as for inode_write(), for a write that extends
+   INODE and fills no hole.  Extending writes to INODE take turns
+   on its extend lock.  INODE's lock is held exclusively only to
+   allocate the new sectors and, at the end, to publish the new
+   length; the data is written in between with it shared, so
+   readers go on in parallel and see the old length, and nothing
+   past it, until the write is done. */
+static off_t
+inode_extend (struct inode *inode, const uint8_t *buffer, off_t size,
+              off_t offset, bool to_frames UNUSED)
+{
+  off_t bytes_written = 0;
+  off_t new_length;
+  bool exclusive;
+  bool success = true;
+
+  lock_acquire (&inode->extend_lock);
+  journal_begin ();
+
+  /* Allocate.  The on-disk length stays as it is until the data
+     is in place.  An extension that finished while this one
+     waited may have left a hole where this one writes, now
+     inside the published length; that is filled with readers
+     kept out throughout, as in inode_write(), since they would
+     otherwise see its new sectors before the data. */
+  rwlock_acquire_write (&inode->rw);
+  exclusive = inode_has_hole (inode, offset, size);
+  new_length = offset + size > inode->length ? offset + size : inode->length;
+  if (exclusive
+      || bytes_to_sectors (new_length) != bytes_to_sectors (inode->length))
+    {
+      struct cache_entry *handle;
+      struct inode_disk *disk = cache_pin_write (inode->sector, inode->sector,
+                                                 true, &handle);
+      success = inode_allocate (disk, offset, new_length, inode->sector,
+                                offset <= inode->length ? inode : NULL, false);
+      cache_unpin_meta (handle);
+      lock_acquire (&inode->xlate_lock);
+      inode->xlate_valid = false;
+      lock_release (&inode->xlate_lock);
+    }
+
+  /* Write the data, bounded by the new length rather than the
+     published one. */
+  if (success)
+    {
+      if (!exclusive)
+        {
+          rwlock_release_write (&inode->rw);
+          rwlock_acquire_read (&inode->rw);
+        }
+      while (size > 0)
+        {
+          block_sector_t sector_idx = index_to_sector (inode,
+                                                       offset / BLOCK_SECTOR_SIZE);
+          int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+          off_t inode_left = new_length - offset;
+          int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+          int min_left = inode_left < sector_left ? inode_left : sector_left;
+          int chunk_size = size < min_left ? size : min_left;
+          if (chunk_size <= 0)
+            break;
+
+          cache_write_at (sector_idx, CACHE_DATA, inode->sector,
+                          buffer + bytes_written, sector_ofs, chunk_size);
+#ifdef VM
+          if (to_frames && inode->page_cnt > 0)
+            frame_file_write (inode, buffer + bytes_written, offset, chunk_size);
+#endif
+
+          size -= chunk_size;
+          offset += chunk_size;
+          bytes_written += chunk_size;
+        }
+      if (!exclusive)
+        {
+          rwlock_release_read (&inode->rw);
+          rwlock_acquire_write (&inode->rw);
+        }
+
+      /* Publish the new length.  Another caller may have made
+         INODE longer still meanwhile, with inode_preallocate(). */
+      if (new_length > inode->length)
+        {
+          cache_write_meta_at (inode->sector, inode->sector, &new_length,
+                               offsetof (struct inode_disk, length),
+                               sizeof new_length);
+          inode->length = new_length;
+        }
+      if (bytes_written > 0)
+        inode->generation = next_generation ();
+    }
+  rwlock_release_write (&inode->rw);
+
+  journal_end ();
+  lock_release (&inode->extend_lock);
+  return bytes_written;
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
-off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
-                off_t offset) 
+   less than SIZE if an error occurs.  A write past end of file
+   extends the inode, and one into a hole allocates it.  A plain
+   file is extended by inode_extend(), alongside its readers.
+   Otherwise either holds INODE's lock exclusively, so that
+   readers never see the new length or sectors before the data,
+   while other writes share it with readers.
+
+   Directory and free map contents are metadata, journaled along
+   with the inodes and index blocks that an extension changes; a
+   write of plain file data within the file needs no transaction,
+   so writing back a mapped page never blocks on a commit.  Inline
+   data is journaled too, as part of the inode, but a write within
+   it changes a single sector and so needs no transaction
+   either.
+
+   If TO_FRAMES, the frames of mmap'd pages of INODE that the
+   write covers are updated too. */
+static off_t
+inode_write (struct inode *inode, const void *buffer_, off_t size,
+             off_t offset, bool to_frames UNUSED)
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  bool extend, hole, grow, meta, txn;
 
   if (inode->deny_write_cnt)
     return 0;
-
-  /* Extend the file when EOF extends. */
-  if (byte_to_sector (inode, offset + size - 1) == -1u)
+  if (inode->mem != NULL)
+    return inode_write_memory (inode, buffer, size, offset, to_frames);
+
+  /* Files never shrink and holes are only ever filled, so a write
+     that fits with no hole now keeps doing so after the lock is
+     taken. */
+  extend = offset + size > inode_length (inode);
+  hole = inode_has_hole (inode, offset, size);
+  grow = extend || hole;
+  meta = inode_holds_meta (inode);
+  if (extend && !hole && !meta)
+    return inode_extend (inode, buffer, size, offset, to_frames);
+  txn = grow || (meta && !inode->is_inline);
+  if (txn)
+    journal_begin ();
+  if (grow)
+    rwlock_acquire_write (&inode->rw);
+  else
+    rwlock_acquire_read (&inode->rw);
+
+  /* Allocate the sectors written, extending the file when EOF
+     extends.  Any sectors skipped between the old EOF and OFFSET
+     stay a hole.  Another writer may have extended the file
+     further meanwhile, so the length never drops below its
+     current value.
+
+     A small append that stays within the last sector, which is
+     already allocated, changes only the length: the sector map,
+     and so the translation cached in xlate_map, stay as they
+     are, and only the length field of the on-disk inode is
+     written. */
+  off_t new_length = offset + size > inode->length ? offset + size : inode->length;
+  if (grow && !hole
+      && bytes_to_sectors (new_length) == bytes_to_sectors (inode->length)
+      && (!inode->is_inline || new_length <= INLINE_DATA_SIZE))
   {
-    bool success = inode_allocate (&inode->data, offset + size);
-    if (!success) return 0;
-
-    inode->data.length = offset + size;
-    cache_write (inode->sector, &inode->data);
+    cache_write_meta_at (inode->sector, inode->sector, &new_length,
+                         offsetof (struct inode_disk, length), sizeof new_length);
+    inode->length = new_length;
+  }
+  else if (grow)
+  {
+    /* Grow the on-disk inode in place in the cache, which also
+       writes back just what changed. */
+    struct cache_entry *handle;
+    struct inode_disk *disk = cache_pin_write (inode->sector, inode->sector, true, &handle);
+    bool append = extend && offset <= inode->length;
+    bool success = inode_allocate (disk, offset, new_length, inode->sector,
+                                   append ? inode : NULL, false);
+    if (success)
+    {
+      disk->length = inode->length = new_length;
+      inode->is_inline = disk->is_inline;
+    }
+    cache_unpin_meta (handle);
+    lock_acquire (&inode->xlate_lock);
+    inode->xlate_valid = false;
+    lock_release (&inode->xlate_lock);
+    if (!success)
+      {
+        rwlock_release_write (&inode->rw);
+        journal_end ();
+        return 0;
+      }
   }
 
   while (size > 0) 
@@ -535,49 +1569,149 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          cache_write (sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            cache_read (sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          cache_write (sector_idx, bounce);
-        }
+      /* Copy straight into the cached sector, which is read in
+         first only if the chunk does not cover all of it. */
+      if (meta)
+        cache_write_meta_at (sector_idx, inode->sector, buffer + bytes_written,
+                             sector_ofs, chunk_size);
+      else
+        cache_write_at (sector_idx, CACHE_DATA, inode->sector, buffer + bytes_written,
+                        sector_ofs, chunk_size);
+#ifdef VM
+      if (to_frames && inode->page_cnt > 0)
+        frame_file_write (inode, buffer + bytes_written, offset, chunk_size);
+#endif
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+  /* Only now, so that nothing read while the write was under way
+     is kept under the new generation. */
+  if (bytes_written > 0)
+    inode->generation = next_generation ();
+  if (grow)
+    rwlock_release_write (&inode->rw);
+  else
+    rwlock_release_read (&inode->rw);
+  if (txn)
+    journal_end ();
 
   return bytes_written;
 }
 
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET,
+   as described for inode_write().  Returns the number of bytes
+   actually written. */
+off_t
+inode_write_at (struct inode *inode, const void *buffer, off_t size,
+                off_t offset)
+{
+  return inode_write (inode, buffer, size, offset, true);
+}
+
+/* Like inode_write_at(), for data written back from a page of an
+   mmap'd file.  The frames of INODE's mapped pages are left
+   alone: they hold that data, or newer if it was copied out of
+   one and the page has been written since. */
+off_t
+inode_write_back_at (struct inode *inode, const void *buffer, off_t size,
+                     off_t offset)
+{
+  return inode_write (inode, buffer, size, offset, false);
+}
+
+/* Copies SIZE bytes of SRC, starting at SRC_OFS, into DST at
+   DST_OFS, without a caller-supplied buffer.  Returns the number
+   of bytes copied, which may be less than SIZE at the end of SRC
+   or if writing DST fails.
+
+   Each source sector is pinned in the cache and written to DST
+   straight from there.  Pinning it while DST is written could
+   deadlock if DST is SRC, so a copy within one inode goes
+   through a sector-sized bounce buffer instead. */
+off_t
+inode_copy_at (struct inode *dst, off_t dst_ofs, struct inode *src,
+               off_t src_ofs, off_t size)
+{
+  uint8_t bounce[BLOCK_SECTOR_SIZE];
+  off_t bytes_copied = 0;
+
+  while (size > 0)
+    {
+      struct cache_entry *handle = NULL;
+      const uint8_t *data = bounce;
+      block_sector_t sector_idx;
+      int sector_ofs, chunk_size;
+      off_t written;
+
+      /* A tmpfs source has no sectors: copy through the bounce
+         buffer. */
+      if (src->mem != NULL)
+        {
+          chunk_size = inode_read_at (src, bounce,
+                                      size < BLOCK_SECTOR_SIZE ? size : BLOCK_SECTOR_SIZE,
+                                      src_ofs);
+          if (chunk_size <= 0)
+            break;
+          written = inode_write_at (dst, bounce, chunk_size, dst_ofs);
+          size -= written;
+          src_ofs += written;
+          dst_ofs += written;
+          bytes_copied += written;
+          if (written < chunk_size)
+            break;
+          continue;
+        }
+
+      /* Find the source sector, as inode_read_at() would. */
+      rwlock_acquire_read (&src->rw);
+      sector_idx = byte_to_sector (src, src_ofs);
+      sector_ofs = src_ofs % BLOCK_SECTOR_SIZE;
+      off_t inode_left = inode_length (src) - src_ofs;
+      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+      int min_left = inode_left < sector_left ? inode_left : sector_left;
+      chunk_size = size < min_left ? size : min_left;
+      if (chunk_size > 0)
+        {
+          if (sector_idx == 0)
+            data = (const uint8_t *) zeros;
+          else if (dst != src)
+            data = cache_pin_read (sector_idx, inode_class (src), &handle);
+          else
+            cache_read_at (sector_idx, inode_class (src), bounce, 0, BLOCK_SECTOR_SIZE);
+        }
+      rwlock_release_read (&src->rw);
+      if (chunk_size <= 0)
+        break;
+
+      /* Files never shrink, so the sector stays SRC's after its
+         lock is dropped. */
+      written = inode_write_at (dst, data + sector_ofs, chunk_size, dst_ofs);
+      if (handle != NULL)
+        cache_unpin (handle);
+
+      size -= written;
+      src_ofs += written;
+      dst_ofs += written;
+      bytes_copied += written;
+      if (written < chunk_size)
+        break;
+    }
+
+  return bytes_copied;
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
 inode_deny_write (struct inode *inode) 
 {
+  lock_acquire (&open_inodes_lock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  lock_release (&open_inodes_lock);
 }
 
 /* Re-enables writes to INODE.
@@ -586,22 +1720,158 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  lock_acquire (&open_inodes_lock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  lock_release (&open_inodes_lock);
+}
+
+/* Allocates the sectors for the LENGTH bytes of INODE starting at
+   OFFSET, trying to lay them out in one contiguous run, and makes
+   INODE at least OFFSET + LENGTH bytes long.  Sectors INODE
+   already has are kept.  Returns false if writes to INODE are
+   denied or the disk is too full. */
+bool
+inode_preallocate (struct inode *inode, off_t offset, off_t length)
+{
+  struct cache_entry *handle;
+  struct inode_disk *disk;
+  off_t end = offset + length;
+  bool success;
+
+  if (inode->deny_write_cnt || offset < 0 || length < 0 || end < offset)
+    return false;
+
+  /* A tmpfs inode gets its pages now. */
+  if (inode->mem != NULL)
+    {
+      rwlock_acquire_write (&inode->rw);
+      success = tmpfs_file_write (inode->mem, NULL, length, offset) == length;
+      if (success && end > inode->length)
+        inode->length = end;
+      rwlock_release_write (&inode->rw);
+      return success;
+    }
+
+  journal_begin ();
+  rwlock_acquire_write (&inode->rw);
+  disk = cache_pin_write (inode->sector, inode->sector, true, &handle);
+  success = inode_allocate (disk, offset, end, inode->sector, NULL, true);
+  if (success && end > inode->length)
+  {
+    disk->length = inode->length = end;
+    inode->is_inline = disk->is_inline;
+  }
+  cache_unpin_meta (handle);
+  lock_acquire (&inode->xlate_lock);
+  inode->xlate_valid = false;
+  lock_release (&inode->xlate_lock);
+  rwlock_release_write (&inode->rw);
+  journal_end ();
+  return success;
+}
+
+/* Writes INODE's data and metadata to disk, writing back only the
+   cached sectors last written for INODE.  With a journal, its
+   metadata is committed along with everything else written so
+   far, and so is the data that the commit orders ahead of it.
+   A tmpfs inode has nothing to write. */
+void
+inode_sync (struct inode *inode)
+{
+  if (inode->mem != NULL)
+    return;
+  if (journal_commit ())
+    return;
+  cache_flush_owner (inode->sector);
+  free_map_sync ();
+  cache_flush_owner (FREE_MAP_SECTOR);
+}
+
+/* Takes ADVICE, one of the MADV_* values in <syscall-nr.h>, about
+   how INODE will be read, for the LENGTH bytes at OFFSET, or to
+   the end of the file if LENGTH is 0:
+
+   MADV_NORMAL, MADV_SEQUENTIAL and MADV_RANDOM set how INODE is
+   read ahead, for the whole file, until it is next advised or the
+   last opener closes it; see inode_readahead().
+
+   MADV_WILLNEED queues the range's sectors for read-ahead, up to
+   READAHEAD_MAX of them.
+
+   MADV_DONTNEED writes INODE's dirty data back and makes the
+   range's cached sectors the first to be replaced.
+
+   Returns false if ADVICE is not known. */
+bool
+inode_advise (struct inode *inode, off_t offset, off_t length, int advice)
+{
+  off_t end, i, last;
+
+  switch (advice)
+    {
+    case MADV_NORMAL:
+    case MADV_SEQUENTIAL:
+    case MADV_RANDOM:
+      inode->ra_advice = advice;
+      inode->ra_window = 0;
+      inode->ra_queued = 0;
+      return true;
+    case MADV_WILLNEED:
+    case MADV_DONTNEED:
+      break;
+    default:
+      return false;
+    }
+
+  /* A tmpfs inode is all in memory already. */
+  if (inode->mem != NULL)
+    return true;
+  if (advice == MADV_DONTNEED)
+    cache_flush_owner (inode->sector);
+  rwlock_acquire_read (&inode->rw);
+  end = inode_length (inode);
+  if (length > 0 && offset + length > offset && offset + length < end)
+    end = offset + length;
+  last = DIV_ROUND_UP (end, BLOCK_SECTOR_SIZE);
+  if (advice == MADV_WILLNEED && last > offset / BLOCK_SECTOR_SIZE + READAHEAD_MAX)
+    last = offset / BLOCK_SECTOR_SIZE + READAHEAD_MAX;
+  for (i = offset / BLOCK_SECTOR_SIZE; i < last; i++)
+    {
+      block_sector_t sector = index_to_sector (inode, i);
+      if (sector == 0)
+        continue;
+      if (advice == MADV_WILLNEED)
+        cache_prefetch (sector);
+      else
+        cache_demote (sector);
+    }
+  rwlock_release_read (&inode->rw);
+  return true;
+}
+
+/* Adds DELTA to the number of INODE's pages that frames of mmap'd
+   files hold, which the frame table keeps up to date.  While it
+   is 0, reads and writes do not look for such frames at all. */
+void
+inode_count_pages (struct inode *inode, int delta)
+{
+  inode->page_cnt += delta;
+  ASSERT (inode->page_cnt >= 0);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
 off_t
 inode_length (const struct inode *inode)
 {
-  return inode->data.length;
+  return inode->length;
 }
 
 bool
 inode_is_dir (const struct inode *inode)
 {
-  return inode->data.is_dir;
+  return inode->is_dir;
 }
 
 bool
@@ -614,4 +1884,19 @@ int
 inode_get_open_cnt (const struct inode *inode)
 {
   return inode->open_cnt;
-}
\ No newline at end of file
+}
+
+/* Acquires INODE's lock, which directory code holds while it
+   looks up or changes the directory INODE holds. */
+void
+inode_lock (struct inode *inode)
+{
+  lock_acquire (&inode->lock);
+}
+
+/* Releases INODE's lock. */
+void
+inode_unlock (struct inode *inode)
+{
+  lock_release (&inode->lock);
+}
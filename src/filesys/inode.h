@@ -8,19 +8,32 @@
 struct bitmap;
 
 void inode_init (void);
+bool inode_set_format (const char *name);
+void inode_adopt_format (block_sector_t);
 bool inode_create (block_sector_t, off_t, bool);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
+unsigned inode_get_generation (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+off_t inode_write_back_at (struct inode *, const void *, off_t size,
+                           off_t offset);
+off_t inode_copy_at (struct inode *dst, off_t dst_ofs, struct inode *src,
+                     off_t src_ofs, off_t size);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
+bool inode_preallocate (struct inode *, off_t offset, off_t length);
+void inode_sync (struct inode *);
 off_t inode_length (const struct inode *);
+void inode_count_pages (struct inode *, int delta);
+bool inode_advise (struct inode *, off_t offset, off_t length, int advice);
 
 bool inode_is_dir (const struct inode *inode);
 bool inode_is_removed (const struct inode *inode);
+void inode_lock (struct inode *inode);
+void inode_unlock (struct inode *inode);
 
 #endif /* filesys/inode.h */
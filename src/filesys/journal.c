@@ -0,0 +1,413 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <hash.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "devices/shutdown.h"
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Write-ahead metadata journal.
+
+   Inode, index block, directory and free map sectors are written
+   through the buffer cache as metadata (cache_write_meta() and
+   friends).  While the journal is on, a dirty metadata sector
+   never goes to its home sector directly; instead a commit copies
+   every dirty metadata sector, logs the copies here, and only
+   then writes them home.  After a crash, journal_init() writes
+   the last committed copies home again, so the metadata on disk
+   is always the state at some commit: a file is never left
+   half-created or half-removed, and the free map always agrees
+   with the inodes.
+
+   A file system operation runs between journal_begin() and
+   journal_end().  A commit waits for the operations under way to
+   end and holds off new ones only while it takes its copies, so
+   all of the operations since the previous commit are committed
+   together, with one pass over the log.  File data is written
+   back ahead of the metadata that points to it, as in ext3's
+   ordered mode, so that a committed file never shows another
+   file's old blocks.
+
+   On disk, the journal is JOURNAL_SECTORS sectors starting at
+   JOURNAL_START: a header, then for the transaction being
+   committed a descriptor naming the home sectors, the copies,
+   and a commit record.  A transaction counts only if its commit
+   record matches the descriptor and the copies' checksum. */
+
+#define JOURNAL_MAGIC 0x4c4e524a        /* "JRNL". */
+
+/* Most sectors one transaction can log: the journal less the
+   header, descriptor and commit record. */
+#define JOURNAL_CAPACITY (JOURNAL_SECTORS - 3)
+
+/* First sector of the journal. */
+struct journal_header
+  {
+    unsigned magic;             /* JOURNAL_MAGIC. */
+    unsigned seq;               /* Sequence number of the next transaction. */
+    unsigned size;              /* JOURNAL_SECTORS. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 3 * sizeof (unsigned)];
+  };
+
+/* Sector after the header, followed by the CNT copies. */
+struct journal_descriptor
+  {
+    unsigned magic;             /* JOURNAL_MAGIC. */
+    unsigned seq;               /* Transaction's sequence number. */
+    unsigned cnt;               /* Number of copies. */
+    block_sector_t home[JOURNAL_CAPACITY]; /* Where each copy belongs. */
+  };
+
+/* Sector after the copies. */
+struct journal_commit
+  {
+    unsigned magic;             /* JOURNAL_MAGIC. */
+    unsigned seq;               /* Transaction's sequence number. */
+    unsigned cnt;               /* Number of copies. */
+    unsigned checksum;          /* hash_bytes() of descriptor and copies. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 4 * sizeof (unsigned)];
+  };
+
+/* Start of a file system operation that has to wait for a commit
+   when this many metadata sectors are dirty, so that each
+   transaction fits in the journal. */
+#define COMMIT_THRESHOLD (JOURNAL_CAPACITY / 2)
+
+static bool enabled;            /* Does the device have a journal? */
+static unsigned next_seq;       /* Sequence number of the next commit. */
+
+/* Protects active and committing. */
+static struct lock journal_lock;
+static int active;              /* Operations under way. */
+static bool committing;         /* Holding off new operations? */
+static struct condition quiesced;   /* Signaled when ACTIVE drops to 0. */
+static struct condition resumed;    /* Signaled when COMMITTING is cleared. */
+
+/* Serializes commits, and protects the buffers below. */
+static struct lock commit_lock;
+
+/* The descriptor followed by room for JOURNAL_CAPACITY copies,
+   the commit record, and the copies' cache snapshots. */
+static uint8_t *log_buf;
+static struct journal_commit *commit_rec;
+static struct cache_snapshot *snaps;
+
+/* Statistics. */
+static unsigned long long commit_cnt;   /* Transactions committed. */
+static unsigned long long logged_cnt;   /* Sectors logged. */
+static unsigned long long wait_cnt;     /* Operations held off by a commit. */
+static unsigned replay_cnt;             /* Sectors replayed at mount. */
+
+/* Commit that loses power, counting from 1, or 0 for none. */
+static unsigned crash_at;
+
+static bool valid_home (block_sector_t);
+static void write_header (void);
+
+/* Reserves the journal on a file system being formatted and
+   writes an empty header.  Must come before anything else is
+   allocated. */
+void
+journal_format (void)
+{
+  static const uint8_t zeros[BLOCK_SECTOR_SIZE];
+
+  if (!free_map_allocate_at (JOURNAL_START, JOURNAL_SECTORS))
+    PANIC ("can't reserve journal");
+  block_write (fs_device, JOURNAL_START + 1, zeros);
+  next_seq = 1;
+  write_header ();
+}
+
+/* Looks for a journal on the file system device, writes home any
+   transaction committed there but not yet known to be home, and
+   turns journaling on.  A device formatted without a journal is
+   used without one.  Must be called after cache_init() and before
+   anything is read through the cache. */
+void
+journal_init (void)
+{
+  struct journal_header *header;
+  struct journal_descriptor *desc;
+  size_t i;
+
+  lock_init (&journal_lock);
+  cond_init (&quiesced);
+  cond_init (&resumed);
+  lock_init (&commit_lock);
+
+  header = malloc (sizeof *header);
+  if (header == NULL)
+    PANIC ("can't allocate journal header");
+  block_read (fs_device, JOURNAL_START, header);
+  if (header->magic != JOURNAL_MAGIC || header->size != JOURNAL_SECTORS)
+    {
+      free (header);
+      return;
+    }
+  next_seq = header->seq;
+  free (header);
+
+  log_buf = malloc ((JOURNAL_CAPACITY + 1) * BLOCK_SECTOR_SIZE);
+  commit_rec = malloc (sizeof *commit_rec);
+  snaps = malloc (JOURNAL_CAPACITY * sizeof *snaps);
+  if (log_buf == NULL || commit_rec == NULL || snaps == NULL)
+    PANIC ("can't allocate journal buffers");
+
+  /* Replay the last transaction if its commit record made it to
+     disk.  Writing it home again is harmless if it already was. */
+  desc = (struct journal_descriptor *) log_buf;
+  block_read (fs_device, JOURNAL_START + 1, desc);
+  if (desc->magic == JOURNAL_MAGIC && desc->seq == next_seq
+      && desc->cnt <= JOURNAL_CAPACITY)
+    {
+      size_t cnt = desc->cnt;
+
+      block_read_multiple (fs_device, JOURNAL_START + 2,
+                           log_buf + BLOCK_SECTOR_SIZE, cnt);
+      block_read (fs_device, JOURNAL_START + 2 + cnt, commit_rec);
+      if (commit_rec->magic == JOURNAL_MAGIC && commit_rec->seq == next_seq
+          && commit_rec->cnt == cnt
+          && commit_rec->checksum == hash_bytes (log_buf,
+                                                 (cnt + 1) * BLOCK_SECTOR_SIZE))
+        {
+          for (i = 0; i < cnt; i++)
+            if (!valid_home (desc->home[i]))
+              PANIC ("journal names bad sector %"PRDSNu, desc->home[i]);
+          for (i = 0; i < cnt; i++)
+            block_write (fs_device, desc->home[i],
+                         log_buf + (i + 1) * BLOCK_SECTOR_SIZE);
+          replay_cnt = cnt;
+          printf ("journal: replayed %zu sectors\n", cnt);
+        }
+    }
+
+  /* Retire whatever is in the log. */
+  next_seq++;
+  write_header ();
+
+  enabled = true;
+  cache_set_journaling (true);
+}
+
+/* Commits everything and turns journaling off, so that
+   cache_close() may write the rest back directly. */
+void
+journal_close (void)
+{
+  if (!enabled)
+    return;
+  journal_commit ();
+  cache_set_journaling (false);
+  enabled = false;
+}
+
+/* Starts a file system operation, whose metadata writes go into
+   one transaction.  Calls nest: only the outermost pair counts.
+   The outermost call waits while a commit holds off operations,
+   and commits first if the journal would otherwise fill. */
+void
+journal_begin (void)
+{
+  struct thread *t = thread_current ();
+
+  if (!enabled)
+    return;
+  if (t->journal_depth > 0)
+    {
+      t->journal_depth++;
+      return;
+    }
+
+  /* journal_commit() must run outside any operation, so this
+     comes before the depth is raised. */
+  if (cache_meta_crowded (COMMIT_THRESHOLD))
+    journal_commit ();
+  t->journal_depth++;
+
+  lock_acquire (&journal_lock);
+  if (committing)
+    wait_cnt++;
+  while (committing)
+    cond_wait (&resumed, &journal_lock);
+  active++;
+  lock_release (&journal_lock);
+}
+
+/* Ends the file system operation started by the matching
+   journal_begin(). */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+
+  if (!enabled)
+    return;
+  ASSERT (t->journal_depth > 0);
+  if (--t->journal_depth > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  if (--active == 0)
+    cond_signal (&quiesced, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Compares the home sectors of the copies with indexes *A and *B,
+   for qsort(). */
+static int
+compare_home (const void *a_, const void *b_)
+{
+  const struct journal_descriptor *desc
+    = (const struct journal_descriptor *) log_buf;
+  block_sector_t a = desc->home[*(const size_t *) a_];
+  block_sector_t b = desc->home[*(const size_t *) b_];
+  return a < b ? -1 : a > b;
+}
+
+/* Commits the metadata written by every operation that has ended,
+   and writes it home.  Returns false, doing nothing, if the
+   device has no journal.  Must not be called inside an operation.
+
+   A transaction holds at most JOURNAL_CAPACITY sectors.  Only a
+   single operation that large leaves more dirty, because
+   journal_begin() commits first when metadata is crowded.  The
+   cache grows past its limit while that operation runs, by a
+   journal's worth of sectors at most, and gives the pages back
+   after the commit.  Past that, the cache writes the operation's
+   metadata home ahead of any commit, and the rest is committed
+   in several transactions, so such an operation is not atomic as
+   a whole. */
+bool
+journal_commit (void)
+{
+  struct journal_descriptor *desc = (struct journal_descriptor *) log_buf;
+  struct thread *t = thread_current ();
+  static size_t order[JOURNAL_CAPACITY];
+  size_t cnt, i;
+
+  if (!enabled)
+    return false;
+  ASSERT (t->journal_depth == 0);
+
+  lock_acquire (&commit_lock);
+  do
+    {
+      /* Hold off new operations and wait for those under way, so
+         that the copies are of a state between operations. */
+      lock_acquire (&journal_lock);
+      committing = true;
+      while (active > 0)
+        cond_wait (&quiesced, &journal_lock);
+      lock_release (&journal_lock);
+
+      /* Bring the free map file up to date.  It is written like
+         any other metadata, inside this commit. */
+      t->journal_depth++;
+      free_map_sync ();
+      t->journal_depth--;
+      cnt = cache_snapshot_meta (snaps, log_buf + BLOCK_SECTOR_SIZE,
+                                 JOURNAL_CAPACITY);
+
+      lock_acquire (&journal_lock);
+      committing = false;
+      cond_broadcast (&resumed, &journal_lock);
+      lock_release (&journal_lock);
+
+      /* Data first, then the log, then the commit record. */
+      cache_flush ();
+      if (cnt == 0)
+        break;
+      desc->magic = JOURNAL_MAGIC;
+      desc->seq = next_seq;
+      desc->cnt = cnt;
+      for (i = 0; i < cnt; i++)
+        desc->home[i] = snaps[i].sector;
+      memset (desc->home + cnt, 0,
+              (JOURNAL_CAPACITY - cnt) * sizeof *desc->home);
+      block_write_multiple (fs_device, JOURNAL_START + 1, log_buf, cnt + 1);
+
+      memset (commit_rec, 0, sizeof *commit_rec);
+      commit_rec->magic = JOURNAL_MAGIC;
+      commit_rec->seq = next_seq;
+      commit_rec->cnt = cnt;
+      commit_rec->checksum = hash_bytes (log_buf, (cnt + 1) * BLOCK_SECTOR_SIZE);
+      block_write (fs_device, JOURNAL_START + 2 + cnt, commit_rec);
+      if (commit_cnt + 1 == crash_at)
+        {
+          printf ("journal: losing power after commit record\n");
+          shutdown_crash ();
+        }
+
+      /* Committed.  Write the copies home in one sweep of the
+         disk, then retire the transaction. */
+      for (i = 0; i < cnt; i++)
+        order[i] = i;
+      qsort (order, cnt, sizeof *order, compare_home);
+      for (i = 0; i < cnt; i++)
+        block_write (fs_device, desc->home[order[i]],
+                     log_buf + (order[i] + 1) * BLOCK_SECTOR_SIZE);
+      next_seq++;
+      write_header ();
+      cache_meta_written (snaps, cnt);
+
+      commit_cnt++;
+      logged_cnt += cnt;
+    }
+  while (cnt == JOURNAL_CAPACITY);
+  cache_trim ();
+  lock_release (&commit_lock);
+  return true;
+}
+
+/* Makes the Nth commit since boot that logs anything lose power
+   just after writing its commit record, before any copy goes
+   home, so that the next mount has to replay it.  N of 0 turns
+   this off.  For testing recovery. */
+void
+journal_set_crash (unsigned n)
+{
+  crash_at = n;
+}
+
+/* Prints journal statistics. */
+void
+journal_print_stats (void)
+{
+  if (commit_cnt == 0 && replay_cnt == 0)
+    return;
+  printf ("Journal: %llu commits, %llu sectors logged, "
+          "%llu operations held off, %u sectors replayed\n",
+          commit_cnt, logged_cnt, wait_cnt, replay_cnt);
+}
+
+/* Returns true if SECTOR may be named in the journal: on the
+   device and outside the journal itself. */
+static bool
+valid_home (block_sector_t sector)
+{
+  return (sector < block_size (fs_device)
+          && (sector < JOURNAL_START
+              || sector >= JOURNAL_START + JOURNAL_SECTORS));
+}
+
+/* Writes the journal header with the current sequence number. */
+static void
+write_header (void)
+{
+  struct journal_header *header = calloc (1, sizeof *header);
+
+  if (header == NULL)
+    PANIC ("can't allocate journal header");
+  header->magic = JOURNAL_MAGIC;
+  header->seq = next_seq;
+  header->size = JOURNAL_SECTORS;
+  block_write (fs_device, JOURNAL_START, header);
+  free (header);
+}
@@ -0,0 +1,22 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+
+/* First sector and length of the journal on the file system
+   device, reserved when the file system is formatted. */
+#define JOURNAL_START 2
+#define JOURNAL_SECTORS 128
+
+void journal_format (void);
+void journal_init (void);
+void journal_close (void);
+
+void journal_begin (void);
+void journal_end (void);
+bool journal_commit (void);
+void journal_set_crash (unsigned n);
+
+void journal_print_stats (void);
+
+#endif /* filesys/journal.h */
@@ -0,0 +1,239 @@
+#include "filesys/tmpfs.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* A file system kept wholly in memory, for files that need not
+   outlive the machine.
+
+   A tmpfs inode is a `struct inode' like any other, but its data
+   is a struct tmpfs_file, pages from the kernel pool, instead of
+   sectors reached through the buffer cache, so that reading and
+   writing it cost only memory copies and it takes nothing from
+   the free map.  Its inode number comes from a counter starting
+   at TMPFS_INUMBER_BASE, and the inode stays in memory from
+   creation until it is removed and closed; see inode.c.
+   Directories keep their usual format, in tmpfs inodes.
+
+   The tmpfs root directory is mounted over a directory of the
+   disk file system, the mount point, at boot.  Looking up the
+   mount point's name yields the tmpfs root instead (see
+   tmpfs_cross()), so every path that goes through it, including
+   those dir_open_path() resolves, lands in the tmpfs, and ".."
+   in the tmpfs root leads back to the mount point's parent. */
+
+/* A tmpfs file's data, a page at a time.  Pages never written
+   are null and read as zeros. */
+struct tmpfs_file
+  {
+    uint8_t **pages;                    /* Pages of data. */
+    size_t page_cnt;                    /* Number of elements in PAGES. */
+  };
+
+/* Path to mount the tmpfs at, set by -tmpfs; null for none. */
+static const char *mount_path;
+
+/* Inode numbers of the mount point and of the tmpfs root, fixed
+   once mounted. */
+static block_sector_t mount_point;
+static block_sector_t root_inumber;
+static bool mounted;
+
+/* Next inode number to hand out, guarded by inumber_lock. */
+static block_sector_t next_inumber = TMPFS_INUMBER_BASE;
+static struct lock inumber_lock;
+
+/* Sets the path of the directory tmpfs_init() mounts the tmpfs
+   over. */
+void
+tmpfs_set_mount_point (const char *path)
+{
+  mount_path = path;
+}
+
+/* Mounts the tmpfs, if a mount point was set, creating the mount
+   point directory if it does not exist.  Must be called after
+   the disk file system is initialized. */
+void
+tmpfs_init (void)
+{
+  struct dir *dir;
+  struct inode *parent;
+
+  lock_init (&inumber_lock);
+  if (mount_path == NULL)
+    return;
+
+  dir = dir_open_path (mount_path);
+  if (dir == NULL && filesys_create (mount_path, 0, true))
+    dir = dir_open_path (mount_path);
+  if (dir == NULL)
+    PANIC ("tmpfs: cannot open mount point %s", mount_path);
+  if (!dir_lookup (dir, "..", &parent))
+    PANIC ("tmpfs: mount point %s has no parent", mount_path);
+
+  if (!tmpfs_allocate (&root_inumber)
+      || !dir_create (root_inumber, inode_get_inumber (parent), 16))
+    PANIC ("tmpfs: root directory creation failed");
+  mount_point = inode_get_inumber (dir_get_inode (dir));
+  mounted = true;
+  inode_close (parent);
+  dir_close (dir);
+  printf ("tmpfs: mounted on %s\n", mount_path);
+}
+
+/* Returns true if INUMBER is the number of a tmpfs inode. */
+bool
+tmpfs_owns (block_sector_t inumber)
+{
+  return inumber >= TMPFS_INUMBER_BASE;
+}
+
+/* Stores a new tmpfs inode number into *INUMBER.  Returns false
+   once they run out. */
+bool
+tmpfs_allocate (block_sector_t *inumber)
+{
+  bool success;
+
+  lock_acquire (&inumber_lock);
+  success = next_inumber != (block_sector_t) -1;
+  if (success)
+    *inumber = next_inumber++;
+  lock_release (&inumber_lock);
+  return success;
+}
+
+/* Returns true if INUMBER is the directory the tmpfs is mounted
+   on, which must not be removed. */
+bool
+tmpfs_is_mount_point (block_sector_t inumber)
+{
+  return mounted && inumber == mount_point;
+}
+
+/* Returns the inode a lookup that found INODE should yield: the
+   tmpfs root, in place of INODE, if INODE is the mount point, or
+   else INODE itself.  INODE may be null. */
+struct inode *
+tmpfs_cross (struct inode *inode)
+{
+  if (inode == NULL || !tmpfs_is_mount_point (inode_get_inumber (inode)))
+    return inode;
+  inode_close (inode);
+  return inode_open (root_inumber);
+}
+
+/* Returns a new, empty file, or a null pointer if memory is
+   short. */
+struct tmpfs_file *
+tmpfs_file_create (void)
+{
+  return calloc (1, sizeof (struct tmpfs_file));
+}
+
+/* Frees FILE and its pages. */
+void
+tmpfs_file_destroy (struct tmpfs_file *file)
+{
+  size_t i;
+
+  if (file == NULL)
+    return;
+  for (i = 0; i < file->page_cnt; i++)
+    palloc_free_page (file->pages[i]);
+  free (file->pages);
+  free (file);
+}
+
+/* Reads SIZE bytes of FILE at OFFSET into BUFFER.  The caller
+   keeps the read within the file's length. */
+void
+tmpfs_file_read (const struct tmpfs_file *file, void *buffer_, off_t size,
+                 off_t offset)
+{
+  uint8_t *buffer = buffer_;
+
+  while (size > 0)
+    {
+      size_t page = offset / PGSIZE;
+      int page_ofs = offset % PGSIZE;
+      int chunk_size = PGSIZE - page_ofs < size ? PGSIZE - page_ofs : size;
+
+      if (page < file->page_cnt && file->pages[page] != NULL)
+        memcpy (buffer, file->pages[page] + page_ofs, chunk_size);
+      else
+        memset (buffer, 0, chunk_size);
+      buffer += chunk_size;
+      offset += chunk_size;
+      size -= chunk_size;
+    }
+}
+
+/* Makes FILE's page array at least CNT elements long.  Returns
+   false if memory is short. */
+static bool
+grow_pages (struct tmpfs_file *file, size_t cnt)
+{
+  uint8_t **pages;
+
+  if (cnt <= file->page_cnt)
+    return true;
+  if (cnt < file->page_cnt * 2)
+    cnt = file->page_cnt * 2;
+  pages = realloc (file->pages, cnt * sizeof *pages);
+  if (pages == NULL)
+    return false;
+  memset (pages + file->page_cnt, 0,
+          (cnt - file->page_cnt) * sizeof *pages);
+  file->pages = pages;
+  file->page_cnt = cnt;
+  return true;
+}
+
+/* Writes SIZE bytes from BUFFER into FILE at OFFSET, allocating
+   the pages written.  Returns the number of bytes written, which
+   is less than SIZE if memory runs out.  If BUFFER is null, only
+   allocates the pages, leaving what they hold as it was.  The
+   caller serializes
+   writes to FILE with each other and with reads. */
+off_t
+tmpfs_file_write (struct tmpfs_file *file, const void *buffer_, off_t size,
+                  off_t offset)
+{
+  const uint8_t *buffer = buffer_;
+  off_t bytes_written = 0;
+
+  if (size > 0 && !grow_pages (file, DIV_ROUND_UP (offset + size, PGSIZE)))
+    return 0;
+  while (size > 0)
+    {
+      size_t page = offset / PGSIZE;
+      int page_ofs = offset % PGSIZE;
+      int chunk_size = PGSIZE - page_ofs < size ? PGSIZE - page_ofs : size;
+
+      if (file->pages[page] == NULL)
+        {
+          file->pages[page] = palloc_get_page (PAL_ZERO);
+          if (file->pages[page] == NULL)
+            break;
+        }
+      if (buffer != NULL)
+        {
+          memcpy (file->pages[page] + page_ofs, buffer, chunk_size);
+          buffer += chunk_size;
+        }
+      offset += chunk_size;
+      size -= chunk_size;
+      bytes_written += chunk_size;
+    }
+  return bytes_written;
+}
@@ -0,0 +1,31 @@
+#ifndef FILESYS_TMPFS_H
+#define FILESYS_TMPFS_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+#include "filesys/off_t.h"
+
+/* Inode numbers of tmpfs inodes start here, above any sector of
+   the file system device, so that the two never collide. */
+#define TMPFS_INUMBER_BASE 0x80000000u
+
+struct inode;
+struct tmpfs_file;
+
+/* Mounting. */
+void tmpfs_set_mount_point (const char *path);
+void tmpfs_init (void);
+bool tmpfs_owns (block_sector_t inumber);
+bool tmpfs_allocate (block_sector_t *inumber);
+bool tmpfs_is_mount_point (block_sector_t inumber);
+struct inode *tmpfs_cross (struct inode *);
+
+/* File contents. */
+struct tmpfs_file *tmpfs_file_create (void);
+void tmpfs_file_destroy (struct tmpfs_file *);
+void tmpfs_file_read (const struct tmpfs_file *, void *, off_t size,
+                      off_t offset);
+off_t tmpfs_file_write (struct tmpfs_file *, const void *, off_t size,
+                        off_t offset);
+
+#endif /* filesys/tmpfs.h */
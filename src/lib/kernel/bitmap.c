@@ -53,6 +53,28 @@ elem_cnt (size_t bit_cnt)
   return DIV_ROUND_UP (bit_cnt, ELEM_BITS);
 }
 
+/* Returns an elem_type with the bits for bitmap bits START
+   through END - 1 turned on, where both lie in the same element
+   (END may be the first bit of the next one). */
+static inline elem_type
+range_mask (size_t start, size_t end)
+{
+  elem_type high = (end % ELEM_BITS == 0 ? ~(elem_type) 0
+                    : ((elem_type) 1 << (end % ELEM_BITS)) - 1);
+  return high & (~(elem_type) 0 << (start % ELEM_BITS));
+}
+
+/* Returns the number of bits set in ELEM, by summing bits in
+   ever wider fields. */
+static inline size_t
+popcount (elem_type elem)
+{
+  elem = elem - ((elem >> 1) & (elem_type) 0x55555555);
+  elem = (elem & (elem_type) 0x33333333) + ((elem >> 2) & (elem_type) 0x33333333);
+  elem = (elem + (elem >> 4)) & (elem_type) 0x0f0f0f0f;
+  return (elem * (elem_type) 0x01010101) >> (ELEM_BITS - 8);
+}
+
 /* Returns the number of bytes required for BIT_CNT bits. */
 static inline size_t
 byte_cnt (size_t bit_cnt)
@@ -213,18 +235,31 @@ bitmap_set_all (struct bitmap *b, bool value)
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.  Each
+   element is updated atomically, as by bitmap_set(), but the
+   range as a whole is not. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
+  size_t end = start + cnt;
+
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  while (start < end)
+    {
+      size_t idx = elem_idx (start);
+      size_t stop = (idx + 1) * ELEM_BITS < end ? (idx + 1) * ELEM_BITS : end;
+      elem_type mask = range_mask (start, stop);
+
+      /* See bitmap_mark() and bitmap_reset(). */
+      if (value)
+        asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+      else
+        asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+      start = stop;
+    }
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -232,34 +267,63 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i, value_cnt;
+  size_t end = start + cnt;
+  size_t value_cnt;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
   value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
+  while (start < end)
+    {
+      size_t idx = elem_idx (start);
+      size_t stop = (idx + 1) * ELEM_BITS < end ? (idx + 1) * ELEM_BITS : end;
+      elem_type elem = value ? b->bits[idx] : ~b->bits[idx];
+
+      value_cnt += popcount (elem & range_mask (start, stop));
+      start = stop;
+    }
   return value_cnt;
 }
 
+/* Returns the index of the first bit in B at or after START and
+   before END that is set to VALUE, or END if there is none.
+   Skips whole elements that hold no such bit. */
+static size_t
+find_next (const struct bitmap *b, size_t start, size_t end, bool value)
+{
+  elem_type flip = value ? 0 : ~(elem_type) 0;
+  size_t idx, bit;
+  elem_type elem;
+
+  if (start >= end)
+    return end;
+
+  idx = elem_idx (start);
+  elem = (b->bits[idx] ^ flip) & (~(elem_type) 0 << (start % ELEM_BITS));
+  while (elem == 0)
+    {
+      if (++idx * ELEM_BITS >= end)
+        return end;
+      elem = b->bits[idx] ^ flip;
+    }
+
+  /* See [IA32-v2a] "BSF". */
+  bit = idx * ELEM_BITS + __builtin_ctzl (elem);
+  return bit < end ? bit : end;
+}
+
 /* Returns true if any bits in B between START and START + CNT,
    exclusive, are set to VALUE, and false otherwise. */
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return find_next (b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -298,13 +362,26 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
+  if (cnt == 0)
+    return start;
   if (cnt <= b->bit_cnt) 
     {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t i = start;
+
+      /* Jump from each run of VALUE bits to the next, stopping at
+         the first run at least CNT long. */
+      for (;;)
+        {
+          size_t run_end;
+
+          i = find_next (b, i, b->bit_cnt, value);
+          if (b->bit_cnt - i < cnt)
+            break;
+          run_end = find_next (b, i, i + cnt, !value);
+          if (run_end == i + cnt)
+            return i;
+          i = run_end;
+        }
     }
   return BITMAP_ERROR;
 }
@@ -358,6 +435,40 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Reads SIZE bytes of B's file image, starting at byte OFS, from
+   the same place in FILE.  The range is clipped to the end of the
+   image.  Returns true if successful, false otherwise. */
+bool
+bitmap_read_range (struct bitmap *b, struct file *file, size_t ofs, size_t size)
+{
+  size_t file_size = byte_cnt (b->bit_cnt);
+
+  if (ofs >= file_size)
+    return true;
+  if (size > file_size - ofs)
+    size = file_size - ofs;
+  if (file_read_at (file, (uint8_t *) b->bits + ofs, size, ofs) != (off_t) size)
+    return false;
+  if (ofs + size == file_size)
+    b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+  return true;
+}
+
+/* Writes SIZE bytes of B's file image, starting at byte OFS, to
+   the same place in FILE.  The range is clipped to the end of the
+   image.  Return true if successful, false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file, size_t ofs, size_t size)
+{
+  size_t file_size = byte_cnt (b->bit_cnt);
+
+  if (ofs >= file_size)
+    return true;
+  if (size > file_size - ofs)
+    size = file_size - ofs;
+  return file_write_at (file, (uint8_t *) b->bits + ofs, size, ofs) == (off_t) size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
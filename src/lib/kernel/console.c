@@ -7,7 +7,8 @@
 #include "threads/interrupt.h"
 #include "threads/synch.h"
 
-static void vprintf_helper (char, void *);
+static void vprintf_helper (const char *, size_t, void *);
+static void putbuf_have_lock (const char *, size_t);
 static void putchar_have_lock (uint8_t c);
 
 /* The console lock.
@@ -111,7 +112,7 @@ release_console (void)
 
 /* Returns true if the current thread has the console lock,
    false otherwise. */
-static bool
+static bool UNUSED
 console_locked_by_current_thread (void) 
 {
   return (intr_context ()
@@ -153,8 +154,7 @@ void
 putbuf (const char *buffer, size_t n) 
 {
   acquire_console ();
-  while (n-- > 0)
-    putchar_have_lock (*buffer++);
+  putbuf_have_lock (buffer, n);
   release_console ();
 }
 
@@ -171,11 +171,24 @@ putchar (int c)
 
 /* Helper function for vprintf(). */
 static void
-vprintf_helper (char c, void *char_cnt_) 
+vprintf_helper (const char *s, size_t n, void *char_cnt_) 
 {
   int *char_cnt = char_cnt_;
-  (*char_cnt)++;
-  putchar_have_lock (c);
+  *char_cnt += n;
+  putbuf_have_lock (s, n);
+}
+
+/* Writes the N characters in BUFFER to the vga display and
+   serial port.  The caller has already acquired the console lock
+   if appropriate. */
+static void
+putbuf_have_lock (const char *buffer, size_t n) 
+{
+  ASSERT (console_locked_by_current_thread ());
+  write_cnt += n;
+  serial_write ((const uint8_t *) buffer, n);
+  while (n-- > 0)
+    vga_putc (*buffer++);
 }
 
 /* Writes C to the vga display and serial port.
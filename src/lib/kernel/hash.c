@@ -12,9 +12,21 @@
 #define list_elem_to_hash_elem(LIST_ELEM)                       \
         list_entry(LIST_ELEM, struct hash_elem, list_elem)
 
+/* Element per bucket ratios. */
+#define MIN_ELEMS_PER_BUCKET  1 /* Elems/bucket < 1: reduce # of buckets. */
+#define BEST_ELEMS_PER_BUCKET 2 /* Ideal elems/bucket. */
+#define MAX_ELEMS_PER_BUCKET  4 /* Elems/bucket > 4: increase # of buckets. */
+
+/* Old buckets moved by each insertion or deletion while a rehash
+   is in progress. */
+#define REHASH_STEP 4
+
 static struct list *find_bucket (struct hash *, struct hash_elem *);
 static struct hash_elem *find_elem (struct hash *, struct list *,
                                     struct hash_elem *);
+static struct hash_elem *lookup (struct hash *, struct hash_elem *);
+static struct list *next_bucket (struct hash *, struct list *);
+static size_t ideal_bucket_cnt (const struct hash *);
 static void insert_elem (struct hash *, struct list *, struct hash_elem *);
 static void remove_elem (struct hash *, struct hash_elem *);
 static void rehash (struct hash *);
@@ -24,9 +36,25 @@ static void rehash (struct hash *);
 bool
 hash_init (struct hash *h,
            hash_hash_func *hash, hash_less_func *less, void *aux) 
+{
+  return hash_init_sized (h, hash, less, aux, 0);
+}
+
+/* Initializes hash table H like hash_init(), but with enough
+   buckets for about ELEM_CNT elements from the start.  The table
+   never shrinks below that size, so a table expected to hold
+   ELEM_CNT elements never rehashes on its way there. */
+bool
+hash_init_sized (struct hash *h, hash_hash_func *hash, hash_less_func *less,
+                 void *aux, size_t elem_cnt)
 {
   h->elem_cnt = 0;
   h->bucket_cnt = 4;
+  while (h->bucket_cnt * BEST_ELEMS_PER_BUCKET < elem_cnt)
+    h->bucket_cnt *= 2;
+  h->min_bucket_cnt = h->bucket_cnt;
+  h->old_buckets = NULL;
+  h->old_bucket_cnt = h->old_next = 0;
   h->buckets = malloc (sizeof *h->buckets * h->bucket_cnt);
   h->hash = hash;
   h->less = less;
@@ -53,22 +81,23 @@ hash_init (struct hash *h,
 void
 hash_clear (struct hash *h, hash_action_func *destructor) 
 {
+  struct list *bucket;
   size_t i;
 
-  for (i = 0; i < h->bucket_cnt; i++) 
-    {
-      struct list *bucket = &h->buckets[i];
-
-      if (destructor != NULL) 
-        while (!list_empty (bucket)) 
-          {
-            struct list_elem *list_elem = list_pop_front (bucket);
-            struct hash_elem *hash_elem = list_elem_to_hash_elem (list_elem);
-            destructor (hash_elem, h->aux);
-          }
+  if (destructor != NULL)
+    for (bucket = next_bucket (h, NULL); bucket != NULL;
+         bucket = next_bucket (h, bucket))
+      while (!list_empty (bucket)) 
+        {
+          struct list_elem *list_elem = list_pop_front (bucket);
+          struct hash_elem *hash_elem = list_elem_to_hash_elem (list_elem);
+          destructor (hash_elem, h->aux);
+        }
 
-      list_init (bucket); 
-    }    
+  for (i = 0; i < h->bucket_cnt; i++) 
+    list_init (&h->buckets[i]);
+  free (h->old_buckets);
+  h->old_buckets = NULL;
 
   h->elem_cnt = 0;
 }
@@ -89,6 +118,7 @@ hash_destroy (struct hash *h, hash_action_func *destructor)
   if (destructor != NULL)
     hash_clear (h, destructor);
   free (h->buckets);
+  free (h->old_buckets);
 }
 
 /* Inserts NEW into hash table H and returns a null pointer, if
@@ -98,11 +128,10 @@ hash_destroy (struct hash *h, hash_action_func *destructor)
 struct hash_elem *
 hash_insert (struct hash *h, struct hash_elem *new)
 {
-  struct list *bucket = find_bucket (h, new);
-  struct hash_elem *old = find_elem (h, bucket, new);
+  struct hash_elem *old = lookup (h, new);
 
   if (old == NULL) 
-    insert_elem (h, bucket, new);
+    insert_elem (h, find_bucket (h, new), new);
 
   rehash (h);
 
@@ -114,12 +143,11 @@ hash_insert (struct hash *h, struct hash_elem *new)
 struct hash_elem *
 hash_replace (struct hash *h, struct hash_elem *new) 
 {
-  struct list *bucket = find_bucket (h, new);
-  struct hash_elem *old = find_elem (h, bucket, new);
+  struct hash_elem *old = lookup (h, new);
 
   if (old != NULL)
     remove_elem (h, old);
-  insert_elem (h, bucket, new);
+  insert_elem (h, find_bucket (h, new), new);
 
   rehash (h);
 
@@ -131,7 +159,7 @@ hash_replace (struct hash *h, struct hash_elem *new)
 struct hash_elem *
 hash_find (struct hash *h, struct hash_elem *e) 
 {
-  return find_elem (h, find_bucket (h, e), e);
+  return lookup (h, e);
 }
 
 /* Finds, removes, and returns an element equal to E in hash
@@ -144,7 +172,7 @@ hash_find (struct hash *h, struct hash_elem *e)
 struct hash_elem *
 hash_delete (struct hash *h, struct hash_elem *e)
 {
-  struct hash_elem *found = find_elem (h, find_bucket (h, e), e);
+  struct hash_elem *found = lookup (h, e);
   if (found != NULL) 
     {
       remove_elem (h, found);
@@ -162,13 +190,13 @@ hash_delete (struct hash *h, struct hash_elem *e)
 void
 hash_apply (struct hash *h, hash_action_func *action) 
 {
-  size_t i;
+  struct list *bucket;
   
   ASSERT (action != NULL);
 
-  for (i = 0; i < h->bucket_cnt; i++) 
+  for (bucket = next_bucket (h, NULL); bucket != NULL;
+       bucket = next_bucket (h, bucket))
     {
-      struct list *bucket = &h->buckets[i];
       struct list_elem *elem, *next;
 
       for (elem = list_begin (bucket); elem != list_end (bucket); elem = next) 
@@ -203,7 +231,7 @@ hash_first (struct hash_iterator *i, struct hash *h)
   ASSERT (h != NULL);
 
   i->hash = h;
-  i->bucket = i->hash->buckets;
+  i->bucket = next_bucket (h, NULL);
   i->elem = list_elem_to_hash_elem (list_head (i->bucket));
 }
 
@@ -223,7 +251,8 @@ hash_next (struct hash_iterator *i)
   i->elem = list_elem_to_hash_elem (list_next (&i->elem->list_elem));
   while (i->elem == list_elem_to_hash_elem (list_end (i->bucket)))
     {
-      if (++i->bucket >= i->hash->buckets + i->hash->bucket_cnt)
+      i->bucket = next_bucket (i->hash, i->bucket);
+      if (i->bucket == NULL)
         {
           i->elem = NULL;
           break;
@@ -294,11 +323,29 @@ hash_string (const char *s_)
   return hash;
 }
 
-/* Returns a hash of integer I. */
+/* 2**32 divided by the golden ratio, for Fibonacci hashing. */
+#define FIB_32_MULT 2654435769u
+
+/* Returns a hash of integer I.
+
+   Fibonacci hashing: the product with FIB_32_MULT spreads I over
+   the high bits, and folding those down keeps the low bits that
+   find_bucket() uses from depending only on I's low bits.  Keys
+   that are multiples of a large power of 2, such as page
+   addresses, therefore still spread across buckets. */
 unsigned
 hash_int (int i) 
 {
-  return hash_bytes (&i, sizeof i);
+  unsigned hash = (unsigned) i * FIB_32_MULT;
+
+  return hash ^ (hash >> 16);
+}
+
+/* Returns a hash of pointer P, for tables keyed by address. */
+unsigned
+hash_ptr (const void *p)
+{
+  return hash_int ((int) (uintptr_t) p);
 }
 
 /* Returns the bucket in H that E belongs in. */
@@ -339,77 +386,121 @@ is_power_of_2 (size_t x)
   return x != 0 && turn_off_least_1bit (x) == 0;
 }
 
-/* Element per bucket ratios. */
-#define MIN_ELEMS_PER_BUCKET  1 /* Elems/bucket < 1: reduce # of buckets. */
-#define BEST_ELEMS_PER_BUCKET 2 /* Ideal elems/bucket. */
-#define MAX_ELEMS_PER_BUCKET  4 /* Elems/bucket > 4: increase # of buckets. */
 
-/* Changes the number of buckets in hash table H to match the
-   ideal.  This function can fail because of an out-of-memory
-   condition, but that'll just make hash accesses less efficient;
-   we can still continue. */
+/* Returns the number of buckets H should have for its current
+   number of elements: one for about every BEST_ELEMS_PER_BUCKET,
+   a power of 2, and at least H's minimum. */
+static size_t
+ideal_bucket_cnt (const struct hash *h)
+{
+  size_t bucket_cnt = h->elem_cnt / BEST_ELEMS_PER_BUCKET;
+
+  while (!is_power_of_2 (bucket_cnt) && bucket_cnt != 0)
+    bucket_cnt = turn_off_least_1bit (bucket_cnt);
+  return bucket_cnt > h->min_bucket_cnt ? bucket_cnt : h->min_bucket_cnt;
+}
+
+/* Moves H a step towards the ideal number of buckets.  If the
+   load is out of bounds and no rehash is in progress, allocates a
+   bucket array of the ideal size to start one; then moves the
+   elements of up to REHASH_STEP old buckets into it.  Allocation
+   can fail because of an out-of-memory condition, but that'll
+   just make hash accesses less efficient; we can still
+   continue. */
 static void
 rehash (struct hash *h) 
 {
-  size_t old_bucket_cnt, new_bucket_cnt;
-  struct list *new_buckets, *old_buckets;
   size_t i;
 
   ASSERT (h != NULL);
 
-  /* Save old bucket info for later use. */
-  old_buckets = h->buckets;
-  old_bucket_cnt = h->bucket_cnt;
-
-  /* Calculate the number of buckets to use now.
-     We want one bucket for about every BEST_ELEMS_PER_BUCKET.
-     We must have at least four buckets, and the number of
-     buckets must be a power of 2. */
-  new_bucket_cnt = h->elem_cnt / BEST_ELEMS_PER_BUCKET;
-  if (new_bucket_cnt < 4)
-    new_bucket_cnt = 4;
-  while (!is_power_of_2 (new_bucket_cnt))
-    new_bucket_cnt = turn_off_least_1bit (new_bucket_cnt);
-
-  /* Don't do anything if the bucket count wouldn't change. */
-  if (new_bucket_cnt == old_bucket_cnt)
-    return;
-
-  /* Allocate new buckets and initialize them as empty. */
-  new_buckets = malloc (sizeof *new_buckets * new_bucket_cnt);
-  if (new_buckets == NULL) 
+  if (h->old_buckets == NULL)
     {
-      /* Allocation failed.  This means that use of the hash table will
-         be less efficient.  However, it is still usable, so
-         there's no reason for it to be an error. */
-      return;
+      size_t new_bucket_cnt;
+      struct list *new_buckets;
+
+      /* Don't do anything while the load is within bounds. */
+      if (h->elem_cnt <= h->bucket_cnt * MAX_ELEMS_PER_BUCKET
+          && (h->elem_cnt >= h->bucket_cnt * MIN_ELEMS_PER_BUCKET
+              || h->bucket_cnt <= h->min_bucket_cnt))
+        return;
+      new_bucket_cnt = ideal_bucket_cnt (h);
+      if (new_bucket_cnt == h->bucket_cnt)
+        return;
+
+      /* Allocate new buckets and initialize them as empty. */
+      new_buckets = malloc (sizeof *new_buckets * new_bucket_cnt);
+      if (new_buckets == NULL) 
+        {
+          /* Allocation failed.  This means that use of the hash
+             table will be less efficient.  However, it is still
+             usable, so there's no reason for it to be an error. */
+          return;
+        }
+      for (i = 0; i < new_bucket_cnt; i++) 
+        list_init (&new_buckets[i]);
+
+      /* Install new bucket info. */
+      h->old_buckets = h->buckets;
+      h->old_bucket_cnt = h->bucket_cnt;
+      h->old_next = 0;
+      h->buckets = new_buckets;
+      h->bucket_cnt = new_bucket_cnt;
     }
-  for (i = 0; i < new_bucket_cnt; i++) 
-    list_init (&new_buckets[i]);
 
-  /* Install new bucket info. */
-  h->buckets = new_buckets;
-  h->bucket_cnt = new_bucket_cnt;
-
-  /* Move each old element into the appropriate new bucket. */
-  for (i = 0; i < old_bucket_cnt; i++) 
+  /* Move each element of the next few old buckets into the
+     appropriate new bucket. */
+  for (i = 0; i < REHASH_STEP && h->old_next < h->old_bucket_cnt; i++)
     {
-      struct list *old_bucket;
-      struct list_elem *elem, *next;
+      struct list *old_bucket = &h->old_buckets[h->old_next++];
 
-      old_bucket = &old_buckets[i];
-      for (elem = list_begin (old_bucket);
-           elem != list_end (old_bucket); elem = next) 
+      while (!list_empty (old_bucket))
         {
-          struct list *new_bucket
-            = find_bucket (h, list_elem_to_hash_elem (elem));
-          next = list_next (elem);
-          list_remove (elem);
-          list_push_front (new_bucket, elem);
+          struct list_elem *elem = list_pop_front (old_bucket);
+          list_push_front (find_bucket (h, list_elem_to_hash_elem (elem)),
+                           elem);
         }
     }
 
-  free (old_buckets);
+  if (h->old_next == h->old_bucket_cnt)
+    {
+      free (h->old_buckets);
+      h->old_buckets = NULL;
+    }
+}
+
+/* Finds and returns an element equal to E in H, looking in the
+   old buckets too while a rehash is in progress, or a null
+   pointer if there is none. */
+static struct hash_elem *
+lookup (struct hash *h, struct hash_elem *e)
+{
+  struct hash_elem *found = find_elem (h, find_bucket (h, e), e);
+
+  if (found == NULL && h->old_buckets != NULL)
+    {
+      size_t idx = h->hash (e, h->aux) & (h->old_bucket_cnt - 1);
+      if (idx >= h->old_next)
+        found = find_elem (h, &h->old_buckets[idx], e);
+    }
+  return found;
+}
+
+/* Returns the bucket of H that follows BUCKET, or the first one
+   if BUCKET is null, or a null pointer after the last one.  Old
+   buckets that may still hold elements come before the current
+   ones. */
+static struct list *
+next_bucket (struct hash *h, struct list *bucket)
+{
+  struct list *old_end = h->old_buckets + h->old_bucket_cnt;
+
+  if (bucket == NULL)
+    return (h->old_buckets != NULL ? h->old_buckets + h->old_next
+            : h->buckets);
+  if (h->old_buckets != NULL && bucket >= h->old_buckets && bucket < old_end)
+    return ++bucket < old_end ? bucket : h->buckets;
+  return ++bucket < h->buckets + h->bucket_cnt ? bucket : NULL;
 }
 
 /* Inserts E into BUCKET (in hash table H). */
@@ -18,7 +18,14 @@
    conversion from a struct hash_elem back to a structure object
    that contains it.  This is the same technique used in the
    linked list implementation.  Refer to lib/kernel/list.h for a
-   detailed explanation. */
+   detailed explanation.
+
+   The table grows and shrinks incrementally.  When the load
+   leaves its bounds, a bucket array of the new size is allocated
+   and the elements of the old one are moved over a few buckets
+   at a time by each later insertion or deletion, so that no
+   single operation pays for moving every element.  Until the
+   move is complete, lookups search both arrays. */
 
 #include <stdbool.h>
 #include <stddef.h>
@@ -61,6 +68,11 @@ struct hash
     size_t elem_cnt;            /* Number of elements in table. */
     size_t bucket_cnt;          /* Number of buckets, a power of 2. */
     struct list *buckets;       /* Array of `bucket_cnt' lists. */
+    struct list *old_buckets;   /* Array being moved into `buckets', or
+                                   null if no rehash is in progress. */
+    size_t old_bucket_cnt;      /* Number of buckets in `old_buckets'. */
+    size_t old_next;            /* Old buckets before this are empty. */
+    size_t min_bucket_cnt;      /* Never shrink below this many buckets. */
     hash_hash_func *hash;       /* Hash function. */
     hash_less_func *less;       /* Comparison function. */
     void *aux;                  /* Auxiliary data for `hash' and `less'. */
@@ -76,6 +88,8 @@ struct hash_iterator
 
 /* Basic life cycle. */
 bool hash_init (struct hash *, hash_hash_func *, hash_less_func *, void *aux);
+bool hash_init_sized (struct hash *, hash_hash_func *, hash_less_func *,
+                      void *aux, size_t elem_cnt);
 void hash_clear (struct hash *, hash_action_func *);
 void hash_destroy (struct hash *, hash_action_func *);
 
@@ -99,5 +113,6 @@ bool hash_empty (struct hash *);
 unsigned hash_bytes (const void *, size_t);
 unsigned hash_string (const char *);
 unsigned hash_int (int);
+unsigned hash_ptr (const void *);
 
 #endif /* lib/kernel/hash.h */
@@ -0,0 +1,200 @@
+/* Max-heap.
+
+   See heap.h for basic information. */
+
+#include "heap.h"
+#include "../debug.h"
+
+static struct heap_elem *meld (struct heap *, struct heap_elem *,
+                               struct heap_elem *);
+static struct heap_elem *merge_pairs (struct heap *, struct heap_elem *);
+static void detach (struct heap_elem *);
+
+/* Initializes H as an empty heap ordered by LESS, given
+   auxiliary data AUX. */
+void
+heap_init (struct heap *h, heap_less_func *less, void *aux) 
+{
+  ASSERT (h != NULL);
+  ASSERT (less != NULL);
+
+  h->root = NULL;
+  h->size = 0;
+  h->less = less;
+  h->aux = aux;
+}
+
+/* Inserts E into H. */
+void
+heap_push (struct heap *h, struct heap_elem *e) 
+{
+  ASSERT (h != NULL);
+  ASSERT (e != NULL);
+
+  e->child = e->next = e->prev = NULL;
+  h->root = meld (h, h->root, e);
+  h->size++;
+}
+
+/* Returns the greatest element in H, which must not be empty.
+   Among equal elements, which one is returned is unspecified. */
+struct heap_elem *
+heap_top (const struct heap *h) 
+{
+  ASSERT (!heap_empty (h));
+
+  return h->root;
+}
+
+/* Removes and returns the greatest element in H, which must not
+   be empty. */
+struct heap_elem *
+heap_pop (struct heap *h) 
+{
+  struct heap_elem *top;
+
+  ASSERT (!heap_empty (h));
+
+  top = h->root;
+  h->root = merge_pairs (h, top->child);
+  h->size--;
+  return top;
+}
+
+/* Removes E, which must be in H, from H. */
+void
+heap_remove (struct heap *h, struct heap_elem *e) 
+{
+  ASSERT (h != NULL);
+  ASSERT (e != NULL);
+
+  if (e == h->root)
+    heap_pop (h);
+  else
+    {
+      detach (e);
+      h->root = meld (h, h->root, merge_pairs (h, e->child));
+      h->size--;
+    }
+}
+
+/* Restores H's order after the key of E, which is in H, has
+   increased. */
+void
+heap_increase (struct heap *h, struct heap_elem *e) 
+{
+  ASSERT (h != NULL);
+  ASSERT (e != NULL);
+
+  if (e != h->root)
+    {
+      detach (e);
+      h->root = meld (h, h->root, e);
+    }
+}
+
+/* Restores H's order after the key of E, which is in H, has
+   changed in either direction. */
+void
+heap_update (struct heap *h, struct heap_elem *e) 
+{
+  heap_remove (h, e);
+  heap_push (h, e);
+}
+
+/* Returns the number of elements in H. */
+size_t
+heap_size (const struct heap *h) 
+{
+  ASSERT (h != NULL);
+
+  return h->size;
+}
+
+/* Returns true if H contains no elements, false otherwise. */
+bool
+heap_empty (const struct heap *h) 
+{
+  ASSERT (h != NULL);
+
+  return h->root == NULL;
+}
+
+/* Combines the trees rooted at A and B, either of which may be
+   null, and returns the root of the result.  A and B must have
+   no siblings. */
+static struct heap_elem *
+meld (struct heap *h, struct heap_elem *a, struct heap_elem *b) 
+{
+  if (a == NULL)
+    return b;
+  if (b == NULL)
+    return a;
+  if (h->less (a, b, h->aux))
+    {
+      struct heap_elem *t = a;
+      a = b;
+      b = t;
+    }
+
+  /* B becomes A's first child. */
+  b->prev = a;
+  b->next = a->child;
+  if (a->child != NULL)
+    a->child->prev = b;
+  a->child = b;
+  return a;
+}
+
+/* Combines the sibling list starting at FIRST into one tree and
+   returns its root, or a null pointer if FIRST is null.  Melds
+   siblings in pairs left to right, then melds the pairs right to
+   left, which is what gives the amortized O(log n) bound. */
+static struct heap_elem *
+merge_pairs (struct heap *h, struct heap_elem *first) 
+{
+  struct heap_elem *pairs = NULL;
+  struct heap_elem *root = NULL;
+
+  while (first != NULL)
+    {
+      struct heap_elem *a = first;
+      struct heap_elem *b = a->next;
+      struct heap_elem *m;
+
+      first = b != NULL ? b->next : NULL;
+      a->next = a->prev = NULL;
+      if (b != NULL)
+        b->next = b->prev = NULL;
+      m = meld (h, a, b);
+
+      /* Stack the pairs, linked through `next'. */
+      m->next = pairs;
+      pairs = m;
+    }
+
+  while (pairs != NULL)
+    {
+      struct heap_elem *m = pairs;
+      pairs = m->next;
+      m->next = NULL;
+      root = meld (h, root, m);
+    }
+  return root;
+}
+
+/* Cuts the subtree rooted at E, which is not a heap's root, out
+   of its parent's child list. */
+static void
+detach (struct heap_elem *e) 
+{
+  ASSERT (e->prev != NULL);
+
+  if (e->prev->child == e)
+    e->prev->child = e->next;
+  else
+    e->prev->next = e->next;
+  if (e->next != NULL)
+    e->next->prev = e->prev;
+  e->next = e->prev = NULL;
+}
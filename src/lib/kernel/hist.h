@@ -0,0 +1,18 @@
+#ifndef __LIB_KERNEL_HIST_H
+#define __LIB_KERNEL_HIST_H
+
+#include <stdint.h>
+
+/* Returns the bucket for VALUE in a histogram of BUCKETS
+   power-of-two buckets: floor(log2(VALUE)), or 0 for 0, capped
+   at the last bucket. */
+static inline int
+hist_bucket (uint64_t value, int buckets)
+{
+  uint32_t high = value >> 32, low = value;
+  int log2 = (high != 0 ? 63 - __builtin_clz (high)
+              : low != 0 ? 31 - __builtin_clz (low) : 0);
+  return log2 < buckets ? log2 : buckets - 1;
+}
+
+#endif /* lib/kernel/hist.h */
@@ -0,0 +1,297 @@
+/* Pointer map.
+
+   See ptrmap.h for basic information. */
+
+#include "ptrmap.h"
+#include <stdint.h>
+#include "hash.h"
+#include "../debug.h"
+#include "threads/malloc.h"
+
+/* Number of slots in a new map. */
+#define MIN_SLOT_CNT 16
+
+static size_t home (const struct ptrmap *, const void *key);
+static size_t distance (const struct ptrmap *, size_t idx);
+static size_t slot_cnt_for (size_t cnt);
+static bool resize (struct ptrmap *, size_t slot_cnt);
+static void place (struct ptrmap *, const void *key, void *value);
+static size_t locate (const struct ptrmap *, const void *key);
+
+/* Initializes map M as empty.  Returns false if out of memory. */
+bool
+ptrmap_init (struct ptrmap *m)
+{
+  return ptrmap_init_sized (m, 0);
+}
+
+/* Initializes map M as empty, with room for CNT pairs before it
+   first has to grow.  Returns false if out of memory. */
+bool
+ptrmap_init_sized (struct ptrmap *m, size_t cnt)
+{
+  m->cnt = 0;
+  m->slot_cnt = 0;
+  m->slots = NULL;
+  return resize (m, slot_cnt_for (cnt));
+}
+
+/* Makes room in M for CNT pairs in all, so that inserting up to
+   that many needs no memory.  Returns false if out of memory,
+   leaving M as it was. */
+bool
+ptrmap_reserve (struct ptrmap *m, size_t cnt)
+{
+  size_t slot_cnt = slot_cnt_for (cnt);
+  return slot_cnt <= m->slot_cnt || resize (m, slot_cnt);
+}
+
+/* Destroys map M.  If ACTION is non-null, it is called for each
+   pair in the map.  ACTION may free the memory the pair refers
+   to, but must not otherwise use M. */
+void
+ptrmap_destroy (struct ptrmap *m, ptrmap_action_func *action)
+{
+  size_t i;
+
+  if (action != NULL)
+    for (i = 0; i < m->slot_cnt; i++)
+      if (m->slots[i].key != NULL)
+        action (m->slots[i].key, m->slots[i].value);
+  free (m->slots);
+  m->slots = NULL;
+  m->slot_cnt = m->cnt = 0;
+}
+
+/* Maps KEY to VALUE in M.  KEY must not already be in M.
+   Returns false if out of memory, leaving M as it was. */
+bool
+ptrmap_insert (struct ptrmap *m, const void *key, void *value)
+{
+  ASSERT (key != NULL);
+  ASSERT (value != NULL);
+
+  /* Grow at three quarters full.  If that fails, carry on while
+     a slot stays empty to end every probe. */
+  if ((m->cnt + 1) * 4 > m->slot_cnt * 3
+      && !resize (m, m->slot_cnt * 2)
+      && m->cnt + 1 >= m->slot_cnt)
+    return false;
+
+  place (m, key, value);
+  m->cnt++;
+  return true;
+}
+
+/* Returns the value KEY maps to in M, or a null pointer if KEY is
+   not in M. */
+void *
+ptrmap_find (const struct ptrmap *m, const void *key)
+{
+  size_t idx = locate (m, key);
+  return idx != SIZE_MAX ? m->slots[idx].value : NULL;
+}
+
+/* Removes KEY from M and returns the value it mapped to, or a
+   null pointer if KEY was not in M.
+
+   The pairs after KEY's slot that are not in their home slots
+   are shifted back one slot each, so that no probe ever stops
+   short of its key. */
+void *
+ptrmap_delete (struct ptrmap *m, const void *key)
+{
+  size_t mask = m->slot_cnt - 1;
+  size_t idx = locate (m, key);
+  size_t next;
+  void *value;
+
+  if (idx == SIZE_MAX)
+    return NULL;
+  value = m->slots[idx].value;
+  for (next = (idx + 1) & mask;
+       m->slots[next].key != NULL && distance (m, next) > 0;
+       next = (next + 1) & mask)
+    {
+      m->slots[idx] = m->slots[next];
+      idx = next;
+    }
+  m->slots[idx].key = NULL;
+  m->slots[idx].value = NULL;
+  m->cnt--;
+  return value;
+}
+
+/* Initializes I for iterating map M.
+
+   Iteration idiom:
+
+      struct ptrmap_iterator i;
+
+      ptrmap_first (&i, m);
+      while (ptrmap_next (&i))
+        {
+          struct foo *f = ptrmap_cur (&i);
+          ...do something with f...
+        }
+
+   Modifying map M during iteration, using any of the functions
+   ptrmap_insert() or ptrmap_delete(), invalidates all
+   iterators. */
+void
+ptrmap_first (struct ptrmap_iterator *i, struct ptrmap *m)
+{
+  ASSERT (i != NULL);
+  ASSERT (m != NULL);
+
+  i->map = m;
+  i->idx = SIZE_MAX;
+}
+
+/* Advances I to the next pair in the map and returns its value.
+   Returns a null pointer if no pairs are left.  Pairs are
+   returned in no particular order. */
+void *
+ptrmap_next (struct ptrmap_iterator *i)
+{
+  const struct ptrmap *m = i->map;
+
+  while (++i->idx < m->slot_cnt)
+    if (m->slots[i->idx].key != NULL)
+      return m->slots[i->idx].value;
+  i->idx = m->slot_cnt;
+  return NULL;
+}
+
+/* Returns the value of the current pair in iteration, or a null
+   pointer at the end of the map.  Undefined behavior after
+   calling ptrmap_first() but before ptrmap_next(). */
+void *
+ptrmap_cur (struct ptrmap_iterator *i)
+{
+  return i->idx < i->map->slot_cnt ? i->map->slots[i->idx].value : NULL;
+}
+
+/* Returns the number of pairs in M. */
+size_t
+ptrmap_size (const struct ptrmap *m)
+{
+  return m->cnt;
+}
+
+/* Returns true if M contains no pairs, false otherwise. */
+bool
+ptrmap_empty (const struct ptrmap *m)
+{
+  return m->cnt == 0;
+}
+
+/* Returns KEY's home slot in M. */
+static size_t
+home (const struct ptrmap *m, const void *key)
+{
+  return hash_ptr (key) & (m->slot_cnt - 1);
+}
+
+/* Returns how far the pair in slot IDX of M is from its home
+   slot.  The slot must not be empty. */
+static size_t
+distance (const struct ptrmap *m, size_t idx)
+{
+  return (idx - home (m, m->slots[idx].key)) & (m->slot_cnt - 1);
+}
+
+/* Returns the number of slots that holds CNT pairs under the
+   maximum load. */
+static size_t
+slot_cnt_for (size_t cnt)
+{
+  size_t slot_cnt = MIN_SLOT_CNT;
+  while (cnt * 4 > slot_cnt * 3)
+    slot_cnt *= 2;
+  return slot_cnt;
+}
+
+/* Moves M's pairs into a new array of SLOT_CNT slots.  Returns
+   false if out of memory, leaving M as it was. */
+static bool
+resize (struct ptrmap *m, size_t slot_cnt)
+{
+  struct ptrmap_slot *old_slots = m->slots;
+  size_t old_slot_cnt = m->slot_cnt;
+  struct ptrmap_slot *slots;
+  size_t i;
+
+  ASSERT (slot_cnt >= MIN_SLOT_CNT && (slot_cnt & (slot_cnt - 1)) == 0);
+  slots = calloc (slot_cnt, sizeof *slots);
+  if (slots == NULL)
+    return false;
+
+  m->slots = slots;
+  m->slot_cnt = slot_cnt;
+  for (i = 0; i < old_slot_cnt; i++)
+    if (old_slots[i].key != NULL)
+      place (m, old_slots[i].key, old_slots[i].value);
+  free (old_slots);
+  return true;
+}
+
+/* Puts KEY and VALUE in M, which must have an empty slot.  Each
+   pair passed on the way that is nearer its home than the one
+   being placed is swapped out for it and placed further on. */
+static void
+place (struct ptrmap *m, const void *key, void *value)
+{
+  size_t mask = m->slot_cnt - 1;
+  size_t idx = home (m, key);
+  size_t dist = 0;
+
+  for (;;)
+    {
+      struct ptrmap_slot *s = &m->slots[idx];
+      size_t d;
+
+      if (s->key == NULL)
+        {
+          s->key = key;
+          s->value = value;
+          return;
+        }
+      ASSERT (s->key != key);
+      d = distance (m, idx);
+      if (d < dist)
+        {
+          const void *k = s->key;
+          void *v = s->value;
+          s->key = key;
+          s->value = value;
+          key = k;
+          value = v;
+          dist = d;
+        }
+      idx = (idx + 1) & mask;
+      dist++;
+    }
+}
+
+/* Returns the slot holding KEY in M, or SIZE_MAX if there is
+   none.  The probe stops at an empty slot or at a pair nearer
+   its home than KEY would be, since KEY would have displaced
+   it. */
+static size_t
+locate (const struct ptrmap *m, const void *key)
+{
+  size_t mask = m->slot_cnt - 1;
+  size_t idx = home (m, key);
+  size_t dist;
+
+  for (dist = 0; m->slots[idx].key != NULL; dist++)
+    {
+      if (m->slots[idx].key == key)
+        return idx;
+      if (distance (m, idx) < dist)
+        break;
+      idx = (idx + 1) & mask;
+    }
+  return SIZE_MAX;
+}
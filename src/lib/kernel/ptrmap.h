@@ -0,0 +1,72 @@
+#ifndef __LIB_KERNEL_PTRMAP_H
+#define __LIB_KERNEL_PTRMAP_H
+
+/* Pointer map.
+
+   An open-addressing hash table from non-null pointer keys to
+   non-null pointer values, for tables looked up far more often
+   than they change, such as the per-process page tables.
+
+   Unlike struct hash, the map does not chain elements: each
+   key/value pair lives in a flat array of slots probed linearly
+   from the key's home slot, so a lookup reads one or two cache
+   lines instead of following a list per bucket.  Probing is
+   Robin Hood: on insertion a key displaces any key closer to its
+   own home slot, keeping probe lengths short and even, and
+   deletion shifts the keys after a deleted one back instead of
+   leaving tombstones.
+
+   The slot array is allocated with malloc() and doubled when the
+   map is three quarters full, moving every pair at once.  Maps
+   that should not grow under a caller can be sized ahead with
+   ptrmap_init_sized() or ptrmap_reserve(). */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* A key/value pair.  KEY is null in an empty slot. */
+struct ptrmap_slot
+  {
+    const void *key;
+    void *value;
+  };
+
+/* Pointer map. */
+struct ptrmap
+  {
+    size_t cnt;                 /* Number of pairs in the map. */
+    size_t slot_cnt;            /* Number of slots, a power of 2. */
+    struct ptrmap_slot *slots;  /* Array of `slot_cnt' slots. */
+  };
+
+/* A pointer map iterator. */
+struct ptrmap_iterator
+  {
+    struct ptrmap *map;         /* The map. */
+    size_t idx;                 /* Current slot, or SIZE_MAX before first. */
+  };
+
+/* Performs some operation on the pair of KEY and VALUE. */
+typedef void ptrmap_action_func (const void *key, void *value);
+
+/* Basic life cycle. */
+bool ptrmap_init (struct ptrmap *);
+bool ptrmap_init_sized (struct ptrmap *, size_t cnt);
+bool ptrmap_reserve (struct ptrmap *, size_t cnt);
+void ptrmap_destroy (struct ptrmap *, ptrmap_action_func *);
+
+/* Search, insertion, deletion. */
+bool ptrmap_insert (struct ptrmap *, const void *key, void *value);
+void *ptrmap_find (const struct ptrmap *, const void *key);
+void *ptrmap_delete (struct ptrmap *, const void *key);
+
+/* Iteration. */
+void ptrmap_first (struct ptrmap_iterator *, struct ptrmap *);
+void *ptrmap_next (struct ptrmap_iterator *);
+void *ptrmap_cur (struct ptrmap_iterator *);
+
+/* Information. */
+size_t ptrmap_size (const struct ptrmap *);
+bool ptrmap_empty (const struct ptrmap *);
+
+#endif /* lib/kernel/ptrmap.h */
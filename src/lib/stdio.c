@@ -13,7 +13,7 @@ struct vsnprintf_aux
     int max_length;     /* Max length of output string. */
   };
 
-static void vsnprintf_helper (char, void *);
+static void vsnprintf_helper (const char *, size_t, void *);
 
 /* Like vprintf(), except that output is stored into BUFFER,
    which must have space for BUF_SIZE characters.  Writes at most
@@ -43,12 +43,18 @@ vsnprintf (char *buffer, size_t buf_size, const char *format, va_list args)
 
 /* Helper function for vsnprintf(). */
 static void
-vsnprintf_helper (char ch, void *aux_)
+vsnprintf_helper (const char *s, size_t n, void *aux_)
 {
   struct vsnprintf_aux *aux = aux_;
 
-  if (aux->length++ < aux->max_length)
-    *aux->p++ = ch;
+  if (aux->length < aux->max_length)
+    {
+      size_t room = aux->max_length - aux->length;
+      size_t copy = n < room ? n : room;
+      memcpy (aux->p, s, copy);
+      aux->p += copy;
+    }
+  aux->length += n;
 }
 
 /* Like printf(), except that output is stored into BUFFER,
@@ -146,16 +152,20 @@ static const char *parse_conversion (const char *format,
 static void format_integer (uintmax_t value, bool is_signed, bool negative, 
                             const struct integer_base *,
                             const struct printf_conversion *,
-                            void (*output) (char, void *), void *aux);
+                            printf_output_func *, void *aux);
 static void output_dup (char ch, size_t cnt,
-                        void (*output) (char, void *), void *aux);
+                        printf_output_func *, void *aux);
 static void format_string (const char *string, int length,
                            struct printf_conversion *,
-                           void (*output) (char, void *), void *aux);
+                           printf_output_func *, void *aux);
 
+/* Formats FORMAT with ARGS, passing the output to OUTPUT with
+   auxiliary data AUX.  OUTPUT receives whole runs of characters:
+   literal text between conversions in one call, and each
+   conversion in a few calls, for its padding, prefix and digits. */
 void
 __vprintf (const char *format, va_list args,
-           void (*output) (char, void *), void *aux)
+           printf_output_func *output, void *aux)
 {
   for (; *format != '\0'; format++)
     {
@@ -164,7 +174,10 @@ __vprintf (const char *format, va_list args,
       /* Literally copy non-conversions to output. */
       if (*format != '%') 
         {
-          output (*format, aux);
+          const char *run = format;
+          while (format[1] != '\0' && format[1] != '%')
+            format++;
+          output (run, format - run + 1, aux);
           continue;
         }
       format++;
@@ -172,7 +185,7 @@ __vprintf (const char *format, va_list args,
       /* %% => %. */
       if (*format == '%') 
         {
-          output ('%', aux);
+          output ("%", 1, aux);
           continue;
         }
 
@@ -470,9 +483,11 @@ static void
 format_integer (uintmax_t value, bool is_signed, bool negative, 
                 const struct integer_base *b,
                 const struct printf_conversion *c,
-                void (*output) (char, void *), void *aux)
+                printf_output_func *output, void *aux)
 {
   char buf[64], *cp;            /* Buffer and current position. */
+  char prefix[3];               /* Sign and `0x', in output order. */
+  int prefix_cnt;               /* # of characters in PREFIX. */
   int x;                        /* `x' character to use or 0 if none. */
   int sign;                     /* Sign character or 0 if none. */
   int precision;                /* Rendered precision. */
@@ -499,59 +514,76 @@ format_integer (uintmax_t value, bool is_signed, bool negative,
   x = (c->flags & POUND) && value ? b->x : 0;
 
   /* Accumulate digits into buffer.
-     This algorithm produces digits in reverse order, so later we
-     will output the buffer's content in reverse. */
-  cp = buf;
+     This algorithm produces digits from least to most
+     significant, so it fills the buffer from the end backward,
+     leaving the digits in output order. */
+  cp = buf + sizeof buf;
   digit_cnt = 0;
   while (value > 0) 
     {
       if ((c->flags & GROUP) && digit_cnt > 0 && digit_cnt % b->group == 0)
-        *cp++ = ',';
-      *cp++ = b->digits[value % b->base];
+        *--cp = ',';
+      *--cp = b->digits[value % b->base];
       value /= b->base;
       digit_cnt++;
     }
 
-  /* Append enough zeros to match precision.
+  /* Prepend enough zeros to match precision.
      If requested precision is 0, then a value of zero is
      rendered as a null string, otherwise as "0".
      If the # flag is used with base 8, the result must always
      begin with a zero. */
   precision = c->precision < 0 ? 1 : c->precision;
-  while (cp - buf < precision && cp < buf + sizeof buf - 1)
-    *cp++ = '0';
-  if ((c->flags & POUND) && b->base == 8 && (cp == buf || cp[-1] != '0'))
-    *cp++ = '0';
+  while (buf + sizeof buf - cp < precision && cp > buf + 1)
+    *--cp = '0';
+  if ((c->flags & POUND) && b->base == 8
+      && (cp == buf + sizeof buf || *cp != '0'))
+    *--cp = '0';
+
+  /* Gather the sign and `0x'. */
+  prefix_cnt = 0;
+  if (sign)
+    prefix[prefix_cnt++] = sign;
+  if (x) 
+    {
+      prefix[prefix_cnt++] = '0';
+      prefix[prefix_cnt++] = x;
+    }
 
   /* Calculate number of pad characters to fill field width. */
-  pad_cnt = c->width - (cp - buf) - (x ? 2 : 0) - (sign != 0);
+  pad_cnt = c->width - (buf + sizeof buf - cp) - prefix_cnt;
   if (pad_cnt < 0)
     pad_cnt = 0;
 
   /* Do output. */
   if ((c->flags & (MINUS | ZERO)) == 0)
     output_dup (' ', pad_cnt, output, aux);
-  if (sign)
-    output (sign, aux);
-  if (x) 
-    {
-      output ('0', aux);
-      output (x, aux); 
-    }
+  if (prefix_cnt > 0)
+    output (prefix, prefix_cnt, aux);
   if (c->flags & ZERO)
     output_dup ('0', pad_cnt, output, aux);
-  while (cp > buf)
-    output (*--cp, aux);
+  if (cp < buf + sizeof buf)
+    output (cp, buf + sizeof buf - cp, aux);
   if (c->flags & MINUS)
     output_dup (' ', pad_cnt, output, aux);
 }
 
-/* Writes CH to OUTPUT with auxiliary data AUX, CNT times. */
+/* Writes CH to OUTPUT with auxiliary data AUX, CNT times, in runs
+   of up to 16. */
 static void
-output_dup (char ch, size_t cnt, void (*output) (char, void *), void *aux) 
+output_dup (char ch, size_t cnt, printf_output_func *output, void *aux) 
 {
-  while (cnt-- > 0)
-    output (ch, aux);
+  static const char spaces[] = "                ";
+  static const char zeros[] = "0000000000000000";
+  const char *run = ch == ' ' ? spaces : zeros;
+
+  ASSERT (ch == ' ' || ch == '0');
+  while (cnt > 0)
+    {
+      size_t chunk = cnt < sizeof spaces - 1 ? cnt : sizeof spaces - 1;
+      output (run, chunk, aux);
+      cnt -= chunk;
+    }
 }
 
 /* Formats the LENGTH characters starting at STRING according to
@@ -560,13 +592,12 @@ output_dup (char ch, size_t cnt, void (*output) (char, void *), void *aux)
 static void
 format_string (const char *string, int length,
                struct printf_conversion *c,
-               void (*output) (char, void *), void *aux) 
+               printf_output_func *output, void *aux) 
 {
-  int i;
   if (c->width > length && (c->flags & MINUS) == 0)
     output_dup (' ', c->width - length, output, aux);
-  for (i = 0; i < length; i++)
-    output (string[i], aux);
+  if (length > 0)
+    output (string, length, aux);
   if (c->width > length && (c->flags & MINUS) != 0)
     output_dup (' ', c->width - length, output, aux);
 }
@@ -575,7 +606,7 @@ format_string (const char *string, int length,
    va_list. */
 void
 __printf (const char *format,
-          void (*output) (char, void *), void *aux, ...) 
+          printf_output_func *output, void *aux, ...) 
 {
   va_list args;
 
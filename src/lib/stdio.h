@@ -28,10 +28,14 @@ void hex_dump (uintptr_t ofs, const void *, size_t size, bool ascii);
 void print_human_readable_size (uint64_t sz);
 
 /* Internal functions. */
+
+/* Receives N characters starting at S from __vprintf(), along
+   with its auxiliary data AUX. */
+typedef void printf_output_func (const char *s, size_t n, void *aux);
+
 void __vprintf (const char *format, va_list args,
-                void (*output) (char, void *), void *aux);
-void __printf (const char *format,
-               void (*output) (char, void *), void *aux, ...);
+                printf_output_func *, void *aux);
+void __printf (const char *format, printf_output_func *, void *aux, ...);
 
 /* Try to be helpful. */
 #define sprintf dont_use_sprintf_use_snprintf
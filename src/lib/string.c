@@ -1,5 +1,21 @@
 #include <string.h>
 #include <debug.h>
+#include <stdint.h>
+
+/* The block functions below move 32-bit words with the x86
+   string instructions, finishing the last SIZE % 4 bytes one at
+   a time.  "rep movs" and "rep stos" tolerate misaligned
+   operands, so they need no alignment prologue.  The direction
+   flag is clear on entry, as the ABI requires and as the
+   interrupt stubs ensure.
+
+   SSE would be faster for large blocks, but the kernel is built
+   with -msoft-float and neither thread switches nor interrupts
+   save FPU or SSE state, so touching XMM registers here would
+   corrupt user programs' state. */
+
+/* A 32-bit word that may alias any other type. */
+typedef uint32_t __attribute__ ((may_alias)) word_t;
 
 /* Copies SIZE bytes from SRC to DST, which must not overlap.
    Returns DST. */
@@ -8,12 +24,17 @@ memcpy (void *dst_, const void *src_, size_t size)
 {
   unsigned char *dst = dst_;
   const unsigned char *src = src_;
+  size_t words = size / 4;
 
   ASSERT (dst != NULL || size == 0);
   ASSERT (src != NULL || size == 0);
 
-  while (size-- > 0)
-    *dst++ = *src++;
+  asm volatile ("rep movsl\n\t"
+                "movl %3, %%ecx\n\t"
+                "rep movsb"
+                : "+D" (dst), "+S" (src), "+c" (words)
+                : "rm" (size % 4)
+                : "memory");
 
   return dst_;
 }
@@ -58,6 +79,10 @@ memcmp (const void *a_, const void *b_, size_t size)
   ASSERT (a != NULL || size == 0);
   ASSERT (b != NULL || size == 0);
 
+  /* Skip equal words, then find the differing byte. */
+  for (; size >= 4; a += 4, b += 4, size -= 4)
+    if (*(const word_t *) a != *(const word_t *) b)
+      break;
   for (; size-- > 0; a++, b++)
     if (*a != *b)
       return *a > *b ? +1 : -1;
@@ -279,11 +304,17 @@ void *
 memset (void *dst_, int value, size_t size) 
 {
   unsigned char *dst = dst_;
+  uint32_t word = (unsigned char) value * 0x01010101u;
+  size_t words = size / 4;
 
   ASSERT (dst != NULL || size == 0);
-  
-  while (size-- > 0)
-    *dst++ = value;
+
+  asm volatile ("rep stosl\n\t"
+                "movl %2, %%ecx\n\t"
+                "rep stosb"
+                : "+D" (dst), "+c" (words)
+                : "rm" (size % 4), "a" (word)
+                : "memory");
 
   return dst_;
 }
@@ -28,7 +28,234 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_PREAD,                  /* Read from a file at a given position. */
+    SYS_PWRITE,                 /* Write to a file at a given position. */
+    SYS_READV,                  /* Read from a file into several buffers. */
+    SYS_WRITEV,                 /* Write to a file from several buffers. */
+    SYS_COPY_FILE_RANGE,        /* Copy data from one file to another. */
+    SYS_STATS,                  /* Report statistics for a system call. */
+    SYS_FORK,                   /* Duplicate the current process. */
+    SYS_VMSTATS,                /* Report the process's paging counters. */
+    SYS_SPAWN,                  /* Start a process from split arguments. */
+    SYS_STACK_PREFAULT,         /* Set the most stack pages one fault maps. */
+    SYS_SBRK,                   /* Move the end of the heap. */
+    SYS_FSYNC,                  /* Write a file's data to disk. */
+    SYS_SYNC,                   /* Write all file system data to disk. */
+    SYS_FALLOCATE,              /* Reserve disk space for a file. */
+    SYS_GETDENTS,               /* Reads many directory entries. */
+    SYS_CLOCK,                  /* Reads the system clock. */
+    SYS_SYSINFO,                /* Reports threads, memory and cache use. */
+    SYS_AIO_SETUP,              /* Registers an asynchronous I/O ring. */
+    SYS_AIO_ENTER,              /* Submits and reaps asynchronous I/O. */
+    SYS_UTHREAD_CREATE,         /* Starts a thread in this process. */
+    SYS_UTHREAD_EXIT,           /* Ends the calling thread. */
+    SYS_UTHREAD_JOIN,           /* Waits for a thread to end. */
+    SYS_FUTEX_WAIT,             /* Sleeps while an int holds a value. */
+    SYS_FUTEX_WAKE,             /* Wakes threads sleeping on an int. */
+    SYS_SHM_OPEN,               /* Maps a shared memory object. */
+    SYS_SHM_UNLINK,             /* Removes a shared memory object's name. */
+    SYS_PIPE,                   /* Creates a pipe. */
+    SYS_SCHED_SETAFFINITY,      /* Sets the CPUs a process may run on. */
+    SYS_SCHED_GETAFFINITY,      /* Reports the CPUs a process may run on. */
+    SYS_SCHED_RESERVE,          /* Reserves CPU time in every period. */
+    SYS_MSYNC,                  /* Writes a mapping's dirty pages back. */
+    SYS_MADVISE,                /* Advises how mapped memory will be used. */
+    SYS_FADVISE,                /* Advises how a file will be read. */
+    SYS_MEMLIMIT                /* Sets the most frames a process holds. */
+  };
+
+/* One buffer for SYS_READV and SYS_WRITEV. */
+struct iovec
+  {
+    void *iov_base;             /* Start of the buffer. */
+    unsigned iov_len;           /* Size of the buffer in bytes. */
+  };
+
+/* Most buffers SYS_READV and SYS_WRITEV accept in one call. */
+#define IOV_MAX 64
+
+/* Maximum characters in a file name in struct dirent. */
+#define DIRENT_NAME_MAX 14
+
+/* One directory entry, as returned by SYS_GETDENTS. */
+struct dirent
+  {
+    int inumber;                        /* Inode number of the file. */
+    char name[DIRENT_NAME_MAX + 1];     /* Null terminated file name. */
+  };
+
+/* Latency buckets in struct syscall_stats.  Bucket I counts calls
+   that took from 2**I up to 2**(I+1) CPU cycles; the last one
+   also counts anything slower. */
+#define SYSCALL_HIST_BUCKETS 40
+
+/* Statistics for one system call, as reported by SYS_STATS. */
+struct syscall_stats
+  {
+    unsigned long long calls;   /* Number of invocations. */
+    unsigned long long cycles;  /* Total CPU cycles spent. */
+    unsigned long long hist[SYSCALL_HIST_BUCKETS]; /* Latency histogram. */
+  };
+
+/* Paging counters for one process, as reported by SYS_VMSTATS. */
+struct vm_stats
+  {
+    unsigned minor_faults;      /* Faults served without I/O. */
+    unsigned major_faults;      /* Faults that read swap or a file. */
+    unsigned evictions;         /* Its pages evicted from frames. */
+    unsigned resident;          /* Its pages in frames now. */
+    unsigned swapped;           /* Its pages in swap now. */
+  };
+
+/* A reading of the system clock, as reported by SYS_CLOCK. */
+struct clock_time
+  {
+    unsigned long long ns;      /* Nanoseconds since boot. */
+    unsigned long long cycles;  /* CPU cycle counter. */
+  };
+
+/* Most threads struct sysinfo describes. */
+#define SYSINFO_THREADS_MAX 32
+
+/* Values of struct sysinfo_thread's status. */
+enum
+  {
+    SYSINFO_RUNNING,            /* Running. */
+    SYSINFO_READY,              /* Waiting for the CPU. */
+    SYSINFO_BLOCKED,            /* Waiting for an event. */
+    SYSINFO_DYING               /* About to be destroyed. */
+  };
+
+/* One thread, as reported by SYS_SYSINFO. */
+struct sysinfo_thread
+  {
+    int tid;                    /* Thread identifier. */
+    char name[16];              /* Null terminated thread name. */
+    int status;                 /* SYSINFO_RUNNING, etc. */
+    int priority;               /* Effective priority. */
+    int nice;                   /* Nice value. */
+    int recent_cpu;             /* 100 times recent_cpu, under -mlfqs. */
+  };
+
+/* System-wide state, as reported by SYS_SYSINFO.  Counts that
+   belong to a subsystem the kernel was built without are 0. */
+struct sysinfo
+  {
+    unsigned long long ticks;   /* Timer ticks since boot. */
+    int load_avg;               /* 100 times the load average. */
+
+    unsigned kernel_pages;      /* Pages in the kernel pool. */
+    unsigned kernel_free;       /* ...of which free. */
+    unsigned user_pages;        /* Pages in the user pool. */
+    unsigned user_free;         /* Pages free for user requests, including
+                                   kernel pages they may borrow. */
+
+    unsigned cache_sectors;     /* Sectors the buffer cache holds. */
+    unsigned long long cache_lookups; /* Buffer cache lookups. */
+    unsigned long long cache_hits;    /* ...that found the sector. */
+
+    unsigned frames;            /* Frames in the frame table. */
+    unsigned frames_used;       /* ...holding a user page. */
+    unsigned swap_slots;        /* Page-sized slots on the swap device. */
+    unsigned swap_used;         /* ...in use. */
+
+    int thread_cnt;             /* Number of threads, which may be more
+                                   than SYSINFO_THREADS_MAX. */
+    struct sysinfo_thread threads[SYSINFO_THREADS_MAX];
+  };
+
+/* Entries in each queue of struct aio_ring, which is also the
+   most requests a process may have outstanding.  A power of 2. */
+#define AIO_RING_ENTRIES 32
+
+/* Most bytes one asynchronous read or write transfers. */
+#define AIO_IO_MAX 65536
+
+/* Values of struct aio_sqe's op. */
+enum
+  {
+    AIO_READ,                   /* Read LEN bytes at POS into BUF. */
+    AIO_WRITE,                  /* Write LEN bytes from BUF at POS. */
+    AIO_FSYNC                   /* Write the file's data to disk. */
+  };
+
+/* An asynchronous I/O request. */
+struct aio_sqe
+  {
+    int op;                     /* AIO_READ, etc. */
+    int fd;                     /* File to read or write. */
+    void *buf;                  /* Buffer, which must stay put until
+                                   the request completes. */
+    unsigned len;               /* Size of BUF, at most AIO_IO_MAX. */
+    unsigned pos;               /* Position in the file. */
+    unsigned user_data;         /* Copied to the completion. */
+  };
+
+/* A completed asynchronous I/O request. */
+struct aio_cqe
+  {
+    unsigned user_data;         /* From the request. */
+    int res;                    /* Bytes transferred, 0 for a
+                                   successful AIO_FSYNC, or -1. */
+  };
+
+/* Submission and completion queues shared by a process and the
+   kernel, registered with SYS_AIO_SETUP.  The process adds a
+   request at sq[sq_tail % AIO_RING_ENTRIES] and advances sq_tail;
+   SYS_AIO_ENTER advances sq_head past the requests it takes.
+   SYS_AIO_ENTER adds completions at cq_tail, in the order they
+   finished, and advances it; the process advances cq_head past
+   the ones it has read.  The indexes count up and wrap. */
+struct aio_ring
+  {
+    unsigned sq_head, sq_tail;  /* Submission queue indexes. */
+    unsigned cq_head, cq_tail;  /* Completion queue indexes. */
+    struct aio_sqe sq[AIO_RING_ENTRIES];
+    struct aio_cqe cq[AIO_RING_ENTRIES];
+  };
+
+/* Affinity mask of SYS_SCHED_SETAFFINITY and
+   SYS_SCHED_GETAFFINITY: bit N allows CPU N. */
+#define CPU_MASK_ALL 0xffffffffu
+
+/* Flags of SYS_MMAP. */
+#define MAP_POPULATE 0x1        /* Read the whole file in now. */
+
+/* Advice for SYS_MADVISE and SYS_FADVISE. */
+enum
+  {
+    MADV_NORMAL,                /* No particular order; the default. */
+    MADV_SEQUENTIAL,            /* Read in order, each part once. */
+    MADV_RANDOM,                /* Read in no order: read nothing ahead. */
+    MADV_WILLNEED,              /* Wanted soon: start reading it in now. */
+    MADV_DONTNEED               /* Not wanted soon: let its memory go. */
+  };
+
+/* Maximum characters in the name of a shared memory object. */
+#define SHM_NAME_MAX 14
+
+/* Largest shared memory object SYS_SHM_OPEN creates, in bytes. */
+#define SHM_SIZE_MAX (1024 * 1024)
+
+/* Where every process finds struct user_info, read-only: the
+   page just below the usual start of an executable. */
+#define USER_INFO_PAGE 0x08047000
+
+/* What the kernel keeps current in the user info page.  SEQ is
+   odd while TICKS is being changed; a reader copies TICKS
+   between two reads of SEQ and retries until they agree and are
+   even.  PID and TID are those of the thread reading them. */
+struct user_info
+  {
+    unsigned seq;               /* Update sequence for ticks. */
+    unsigned long long ticks;   /* Timer ticks since boot. */
+    int pid;                    /* Process id, as exec() returns. */
+    int tid;                    /* Thread id, as uthread_create()
+                                   returns, or the process id in its
+                                   first thread. */
   };
 
 #endif /* lib/syscall-nr.h */
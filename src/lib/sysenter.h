@@ -0,0 +1,29 @@
+#ifndef __LIB_SYSENTER_H
+#define __LIB_SYSENTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* CPUID leaf 1 EDX bit for SYSENTER and SYSEXIT. */
+#define CPUID_SEP 0x800
+
+/* Returns true if the CPU has working SYSENTER and SYSEXIT
+   instructions.  The kernel sets them up exactly when this
+   returns true, so user programs make the same test to choose
+   how to enter the kernel.  Early Pentium Pros report SEP
+   without implementing it.  See [IA32-v2b] "SYSENTER". */
+static inline bool
+sysenter_supported (void)
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+  unsigned family, model, stepping;
+
+  asm ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  family = (eax >> 8) & 0xf;
+  model = (eax >> 4) & 0xf;
+  stepping = eax & 0xf;
+  return ((edx & CPUID_SEP) != 0
+          && !(family == 6 && model < 3 && stepping < 3));
+}
+
+#endif /* lib/sysenter.h */
@@ -8,7 +8,7 @@
 int
 vprintf (const char *format, va_list args) 
 {
-  return vhprintf (STDOUT_FILENO, format, args);
+  return vfprintf (stdout, format, args);
 }
 
 /* Like printf(), but writes output to the given HANDLE. */
@@ -25,23 +25,22 @@ hprintf (int handle, const char *format, ...)
   return retval;
 }
 
-/* Writes string S to the console, followed by a new-line
+/* Writes string S to stdout, followed by a new-line
    character. */
 int
 puts (const char *s) 
 {
-  write (STDOUT_FILENO, s, strlen (s));
+  fputs (s, stdout);
   putchar ('\n');
 
   return 0;
 }
 
-/* Writes C to the console. */
+/* Writes C to stdout. */
 int
 putchar (int c) 
 {
-  char c2 = c;
-  write (STDOUT_FILENO, &c2, 1);
+  fputc (c, stdout);
   return c;
 }
 
@@ -54,34 +53,46 @@ struct vhprintf_aux
     int handle;         /* Output file handle. */
   };
 
-static void add_char (char, void *);
+static void add_chars (const char *, size_t, void *);
 static void flush (struct vhprintf_aux *);
 
 /* Formats the printf() format specification FORMAT with
    arguments given in ARGS and writes the output to the given
-   HANDLE. */
+   HANDLE.  Output to the console first flushes stdout, so that
+   the two appear in order. */
 int
 vhprintf (int handle, const char *format, va_list args) 
 {
   struct vhprintf_aux aux;
+  if (handle == STDOUT_FILENO)
+    fflush (stdout);
   aux.p = aux.buf;
   aux.char_cnt = 0;
   aux.handle = handle;
-  __vprintf (format, args, add_char, &aux);
+  __vprintf (format, args, add_chars, &aux);
   flush (&aux);
   return aux.char_cnt;
 }
 
-/* Adds C to the buffer in AUX, flushing it if the buffer fills
-   up. */
+/* Adds the N characters in S to the buffer in AUX, flushing it
+   each time the buffer fills up. */
 static void
-add_char (char c, void *aux_) 
+add_chars (const char *s, size_t n, void *aux_) 
 {
   struct vhprintf_aux *aux = aux_;
-  *aux->p++ = c;
-  if (aux->p >= aux->buf + sizeof aux->buf)
-    flush (aux);
-  aux->char_cnt++;
+  aux->char_cnt += n;
+  while (n > 0)
+    {
+      size_t chunk = aux->buf + sizeof aux->buf - aux->p;
+      if (chunk > n)
+        chunk = n;
+      memcpy (aux->p, s, chunk);
+      aux->p += chunk;
+      s += chunk;
+      n -= chunk;
+      if (aux->p >= aux->buf + sizeof aux->buf)
+        flush (aux);
+    }
 }
 
 /* Flushes the buffer in AUX. */
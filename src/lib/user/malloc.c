@@ -0,0 +1,416 @@
+#include <malloc.h>
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
+#include <syscall.h>
+
+/* A simple malloc() for user programs, on the lines of the
+   kernel's in threads/malloc.c.
+
+   Requests smaller than half a page are rounded up to a power of
+   2 of at least 16 bytes and served from that size's free list.
+   When the list is empty, a page, called an "arena", is divided
+   into blocks of that size, which go on the list.  Bigger
+   requests get a run of whole pages of their own, with the page
+   count in the arena header.
+
+   Pages come from the heap, grown with sbrk() only as they are
+   needed, so a program touches the memory it uses rather than a
+   static array sized for the worst case.  Freed page runs, and
+   arenas once all their blocks are free, are kept in a list of
+   free runs, merged with their neighbours, and reused before the
+   heap is grown again.  A large enough free run at the top of the
+   heap is given back by moving the break down.
+
+   User programs have one thread each, so there is no locking. */
+
+/* Size of a page. */
+#define PAGE_SIZE 4096
+
+/* A free run at the top of the heap of more than this many pages
+   is given back to the kernel. */
+#define TRIM_PAGES 4
+
+/* Descriptor. */
+struct desc
+  {
+    size_t block_size;          /* Size of each element in bytes. */
+    size_t blocks_per_arena;    /* Number of blocks in an arena. */
+    struct block *free_list;    /* List of free blocks. */
+  };
+
+/* Magic number for detecting arena corruption. */
+#define ARENA_MAGIC 0x9a548eed
+
+/* Arena. */
+struct arena
+  {
+    unsigned magic;             /* Always set to ARENA_MAGIC. */
+    struct desc *desc;          /* Owning descriptor, null for big block. */
+    size_t free_cnt;            /* Free blocks; pages in big block. */
+  };
+
+/* Free block. */
+struct block
+  {
+    struct block *prev;         /* Previous free block, or null. */
+    struct block *next;         /* Next free block, or null. */
+  };
+
+/* Free run of pages, in the heap but not in use. */
+struct run
+  {
+    size_t page_cnt;            /* Number of pages. */
+    struct run *next;           /* Next run, at a higher address. */
+  };
+
+/* Our set of descriptors. */
+static struct desc descs[10];   /* Descriptors. */
+static size_t desc_cnt;         /* Number of descriptors. */
+
+/* Free runs, in order of address. */
+static struct run *free_runs;
+
+static void init (void);
+static struct arena *block_to_arena (struct block *);
+static struct block *arena_to_block (struct arena *, size_t idx);
+static void block_push (struct desc *, struct block *);
+static void block_remove (struct desc *, struct block *);
+static void *get_pages (size_t page_cnt);
+static void put_pages (void *, size_t page_cnt);
+static void trim (void);
+
+/* Obtains and returns a new block of at least SIZE bytes.
+   Returns a null pointer if memory is not available. */
+void *
+malloc (size_t size)
+{
+  struct desc *d;
+  struct arena *a;
+  struct block *b;
+
+  /* A null pointer satisfies a request for 0 bytes. */
+  if (size == 0)
+    return NULL;
+
+  if (desc_cnt == 0)
+    init ();
+
+  /* Find the smallest descriptor that satisfies a SIZE-byte
+     request. */
+  for (d = descs; d < descs + desc_cnt; d++)
+    if (d->block_size >= size)
+      break;
+  if (d == descs + desc_cnt)
+    {
+      /* SIZE is too big for any descriptor.
+         Allocate enough pages to hold SIZE plus an arena. */
+      size_t page_cnt;
+
+      if (size > SIZE_MAX - sizeof *a - PAGE_SIZE)
+        return NULL;
+      page_cnt = DIV_ROUND_UP (size + sizeof *a, PAGE_SIZE);
+      a = get_pages (page_cnt);
+      if (a == NULL)
+        return NULL;
+
+      /* Initialize the arena to indicate a big block of PAGE_CNT
+         pages, and return it. */
+      a->magic = ARENA_MAGIC;
+      a->desc = NULL;
+      a->free_cnt = page_cnt;
+      return a + 1;
+    }
+
+  /* If the free list is empty, create a new arena. */
+  if (d->free_list == NULL)
+    {
+      size_t i;
+
+      a = get_pages (1);
+      if (a == NULL)
+        return NULL;
+
+      a->magic = ARENA_MAGIC;
+      a->desc = d;
+      a->free_cnt = d->blocks_per_arena;
+      for (i = 0; i < d->blocks_per_arena; i++)
+        block_push (d, arena_to_block (a, i));
+    }
+
+  /* Get a block from the free list and return it. */
+  b = d->free_list;
+  block_remove (d, b);
+  block_to_arena (b)->free_cnt--;
+  return b;
+}
+
+/* Allocates and return A times B bytes initialized to zeroes.
+   Returns a null pointer if memory is not available. */
+void *
+calloc (size_t a, size_t b)
+{
+  void *p;
+  size_t size;
+
+  /* Calculate block size and make sure it fits in size_t. */
+  size = a * b;
+  if (size < a || size < b)
+    return NULL;
+
+  /* Allocate and zero memory.  Pages the heap grows by are zeroed
+     by the kernel, but reused ones are not. */
+  p = malloc (size);
+  if (p != NULL)
+    memset (p, 0, size);
+
+  return p;
+}
+
+/* Returns the number of bytes allocated for BLOCK. */
+static size_t
+allocated_size (void *block)
+{
+  struct arena *a = block_to_arena (block);
+  struct desc *d = a->desc;
+
+  return d != NULL ? d->block_size : PAGE_SIZE * a->free_cnt - sizeof *a;
+}
+
+/* Attempts to resize OLD_BLOCK to NEW_SIZE bytes, possibly
+   moving it in the process.
+   If successful, returns the new block; on failure, returns a
+   null pointer.
+   A call with null OLD_BLOCK is equivalent to malloc(NEW_SIZE).
+   A call with zero NEW_SIZE is equivalent to free(OLD_BLOCK). */
+void *
+realloc (void *old_block, size_t new_size)
+{
+  if (new_size == 0)
+    {
+      free (old_block);
+      return NULL;
+    }
+  else
+    {
+      void *new_block;
+      size_t old_size;
+
+      if (old_block == NULL)
+        return malloc (new_size);
+
+      /* A block that already fits stays where it is. */
+      old_size = allocated_size (old_block);
+      if (new_size <= old_size)
+        return old_block;
+
+      new_block = malloc (new_size);
+      if (new_block != NULL)
+        {
+          memcpy (new_block, old_block, old_size);
+          free (old_block);
+        }
+      return new_block;
+    }
+}
+
+/* Frees block P, which must have been previously allocated with
+   malloc(), calloc(), or realloc(). */
+void
+free (void *p)
+{
+  struct block *b = p;
+  struct arena *a;
+  struct desc *d;
+
+  if (p == NULL)
+    return;
+
+  a = block_to_arena (b);
+  d = a->desc;
+  if (d == NULL)
+    {
+      /* It's a big block.  Free its pages. */
+      a->magic = 0;
+      put_pages (a, a->free_cnt);
+      return;
+    }
+
+#ifndef NDEBUG
+  /* Clear the block to help detect use-after-free bugs. */
+  memset (b, 0xcc, d->block_size);
+#endif
+
+  block_push (d, b);
+
+  /* If the arena is now entirely unused, free it. */
+  if (++a->free_cnt >= d->blocks_per_arena)
+    {
+      size_t i;
+
+      ASSERT (a->free_cnt == d->blocks_per_arena);
+      for (i = 0; i < d->blocks_per_arena; i++)
+        block_remove (d, arena_to_block (a, i));
+      a->magic = 0;
+      put_pages (a, 1);
+    }
+}
+
+/* Initializes the malloc() descriptors. */
+static void
+init (void)
+{
+  size_t block_size;
+
+  for (block_size = 16; block_size < PAGE_SIZE / 2; block_size *= 2)
+    {
+      struct desc *d = &descs[desc_cnt++];
+      ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
+      d->block_size = block_size;
+      d->blocks_per_arena = (PAGE_SIZE - sizeof (struct arena)) / block_size;
+      d->free_list = NULL;
+    }
+}
+
+/* Returns the arena that block B is inside. */
+static struct arena *
+block_to_arena (struct block *b)
+{
+  struct arena *a = (struct arena *) ((uintptr_t) b & ~(PAGE_SIZE - 1));
+
+  /* Check that the arena is valid. */
+  ASSERT (a != NULL);
+  ASSERT (a->magic == ARENA_MAGIC);
+
+  /* Check that the block is properly aligned for the arena. */
+  ASSERT (a->desc == NULL
+          || ((uintptr_t) b - (uintptr_t) (a + 1)) % a->desc->block_size == 0);
+  ASSERT (a->desc != NULL || (struct arena *) b == a + 1);
+
+  return a;
+}
+
+/* Returns the (IDX - 1)'th block within arena A. */
+static struct block *
+arena_to_block (struct arena *a, size_t idx)
+{
+  ASSERT (a != NULL);
+  ASSERT (a->magic == ARENA_MAGIC);
+  ASSERT (idx < a->desc->blocks_per_arena);
+  return (struct block *) ((uint8_t *) a
+                           + sizeof *a
+                           + idx * a->desc->block_size);
+}
+
+/* Adds B to the front of D's free list. */
+static void
+block_push (struct desc *d, struct block *b)
+{
+  b->prev = NULL;
+  b->next = d->free_list;
+  if (b->next != NULL)
+    b->next->prev = b;
+  d->free_list = b;
+}
+
+/* Removes B from D's free list. */
+static void
+block_remove (struct desc *d, struct block *b)
+{
+  if (b->prev != NULL)
+    b->prev->next = b->next;
+  else
+    d->free_list = b->next;
+  if (b->next != NULL)
+    b->next->prev = b->prev;
+}
+
+/* Returns PAGE_CNT contiguous free pages, from the first free
+   run big enough or else by growing the heap, or a null pointer
+   if the heap cannot grow. */
+static void *
+get_pages (size_t page_cnt)
+{
+  struct run **rp;
+  uint8_t *brk, *p;
+  size_t pad;
+
+  for (rp = &free_runs; *rp != NULL; rp = &(*rp)->next)
+    {
+      struct run *r = *rp;
+      if (r->page_cnt == page_cnt)
+        {
+          *rp = r->next;
+          return r;
+        }
+      else if (r->page_cnt > page_cnt)
+        {
+          /* Take the end, so the run stays where it is. */
+          r->page_cnt -= page_cnt;
+          return (uint8_t *) r + r->page_cnt * PAGE_SIZE;
+        }
+    }
+
+  /* The heap starts page-aligned, but anyone may call sbrk(). */
+  brk = sbrk (0);
+  pad = ROUND_UP ((uintptr_t) brk, PAGE_SIZE) - (uintptr_t) brk;
+  if (page_cnt > (SIZE_MAX - pad) / PAGE_SIZE)
+    return NULL;
+  p = sbrk (pad + page_cnt * PAGE_SIZE);
+  return p != (void *) -1 ? p + pad : NULL;
+}
+
+/* Returns the PAGE_CNT pages at P to the free runs, merging them
+   with any free neighbours. */
+static void
+put_pages (void *p, size_t page_cnt)
+{
+  struct run *r = p, *prev = NULL, *next;
+
+  for (next = free_runs; next != NULL && next < r; next = next->next)
+    prev = next;
+
+  r->page_cnt = page_cnt;
+  r->next = next;
+  if (next != NULL
+      && (uint8_t *) r + r->page_cnt * PAGE_SIZE == (uint8_t *) next)
+    {
+      r->page_cnt += next->page_cnt;
+      r->next = next->next;
+    }
+  if (prev != NULL
+      && (uint8_t *) prev + prev->page_cnt * PAGE_SIZE == (uint8_t *) r)
+    {
+      prev->page_cnt += r->page_cnt;
+      prev->next = r->next;
+      r = prev;
+    }
+  else if (prev != NULL)
+    prev->next = r;
+  else
+    free_runs = r;
+
+  if (r->next == NULL)
+    trim ();
+}
+
+/* Gives the last free run back to the kernel, if it is at the top
+   of the heap and more than TRIM_PAGES long. */
+static void
+trim (void)
+{
+  struct run **rp, *r;
+
+  if (free_runs == NULL)
+    return;
+  for (rp = &free_runs; (*rp)->next != NULL; rp = &(*rp)->next)
+    continue;
+  r = *rp;
+  if (r->page_cnt > TRIM_PAGES
+      && (uint8_t *) r + r->page_cnt * PAGE_SIZE == (uint8_t *) sbrk (0))
+    {
+      *rp = NULL;
+      sbrk (-(intptr_t) (r->page_cnt * PAGE_SIZE));
+    }
+}
@@ -4,4 +4,54 @@
 int hprintf (int, const char *, ...) PRINTF_FORMAT (2, 3);
 int vhprintf (int, const char *, va_list) PRINTF_FORMAT (2, 0);
 
+/* Buffered streams.
+
+   A stream collects small reads or writes on a file handle into
+   one large read or write system call.  Output is written when
+   the buffer fills, when fflush() or fclose() is called, and at
+   exit(); a line-buffered stream also writes after each new-line
+   character.  stdout is line-buffered, so printf(), puts(), and
+   putchar() go through it.
+
+   stdin is unbuffered, because a console read does not return
+   until every byte asked for has been typed.  Reading from stdin
+   flushes stdout first, so prompts appear before input is
+   awaited. */
+
+typedef struct stream FILE;
+
+#define EOF (-1)                /* End of file or error. */
+#define BUFSIZ 512              /* Default buffer size. */
+#define FOPEN_MAX 8             /* Number of streams, including stdin, stdout. */
+
+/* Buffering modes, for setvbuf(). */
+#define _IOFBF 0                /* Fully buffered. */
+#define _IOLBF 1                /* Line buffered. */
+#define _IONBF 2                /* Unbuffered. */
+
+extern FILE *stdin;
+extern FILE *stdout;
+
+FILE *fdopen (int handle, const char *mode);
+int fclose (FILE *);
+int fflush (FILE *);
+int setvbuf (FILE *, char *buf, int mode, size_t size);
+int fileno (FILE *);
+int feof (FILE *);
+int ferror (FILE *);
+
+int fputc (int, FILE *);
+int fputs (const char *, FILE *);
+size_t fwrite (const void *, size_t size, size_t cnt, FILE *);
+int fprintf (FILE *, const char *, ...) PRINTF_FORMAT (2, 3);
+int vfprintf (FILE *, const char *, va_list) PRINTF_FORMAT (2, 0);
+
+int fgetc (FILE *);
+int getchar (void);
+char *fgets (char *, int size, FILE *);
+size_t fread (void *, size_t size, size_t cnt, FILE *);
+
+#define putc(C, STREAM) fputc (C, STREAM)
+#define getc(STREAM) fgetc (STREAM)
+
 #endif /* lib/user/stdio.h */
@@ -0,0 +1,413 @@
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+
+/* A buffered stream.  See lib/user/stdio.h. */
+struct stream
+  {
+    bool in_use;                /* Slot holds an open stream? */
+    bool reading;               /* Open for reading, not writing? */
+    bool eof;                   /* Read hit end of file? */
+    bool error;                 /* A read or write failed? */
+    int handle;                 /* File handle. */
+    int mode;                   /* _IOFBF, _IOLBF, or _IONBF. */
+    char *buf;                  /* Buffer. */
+    size_t size;                /* Size of buffer. */
+    size_t pos;                 /* Writing: bytes buffered.
+                                   Reading: offset of next byte. */
+    size_t len;                 /* Reading: bytes in buffer. */
+  };
+
+/* Default buffers, one per stream. */
+static char buffers[FOPEN_MAX][BUFSIZ];
+
+/* All streams.  The first two are stdin and stdout. */
+static struct stream streams[FOPEN_MAX] =
+  {
+    { true, true, false, false, STDIN_FILENO, _IONBF,
+      buffers[0], BUFSIZ, 0, 0 },
+    { true, false, false, false, STDOUT_FILENO, _IOLBF,
+      buffers[1], BUFSIZ, 0, 0 },
+  };
+
+FILE *stdin = &streams[0];
+FILE *stdout = &streams[1];
+
+/* Auxiliary data for vfprintf_helper(). */
+struct vfprintf_aux
+  {
+    FILE *s;            /* Output stream. */
+    int char_cnt;       /* Total characters written so far. */
+  };
+
+static void vfprintf_helper (const char *, size_t, void *);
+static int put_byte (FILE *, char);
+static bool refill (FILE *);
+
+/* Opens a stream on file HANDLE, for reading if MODE begins with
+   "r" or for writing if it begins with "w" or "a".  The stream
+   is fully buffered.  Returns a null pointer if MODE is invalid
+   or all FOPEN_MAX streams are open. */
+FILE *
+fdopen (int handle, const char *mode)
+{
+  struct stream *s;
+
+  if (mode[0] != 'r' && mode[0] != 'w' && mode[0] != 'a')
+    return NULL;
+
+  for (s = streams; s < streams + FOPEN_MAX; s++)
+    if (!s->in_use)
+      {
+        s->in_use = true;
+        s->reading = mode[0] == 'r';
+        s->eof = s->error = false;
+        s->handle = handle;
+        s->mode = _IOFBF;
+        s->buf = buffers[s - streams];
+        s->size = BUFSIZ;
+        s->pos = s->len = 0;
+        return s;
+      }
+  return NULL;
+}
+
+/* Flushes and closes stream S, and closes its file handle unless
+   it is the console's.  Returns 0 if successful, EOF if the
+   flush failed. */
+int
+fclose (FILE *s)
+{
+  int retval = fflush (s);
+
+  if (s->handle != STDIN_FILENO && s->handle != STDOUT_FILENO)
+    close (s->handle);
+  s->in_use = false;
+  return retval;
+}
+
+/* Writes out the output buffered in stream S, or in every open
+   stream if S is null.  For a stream open for reading, discards
+   buffered input and seeks its file back to the first byte not
+   yet read.  Returns 0 if successful, EOF on error. */
+int
+fflush (FILE *s)
+{
+  if (s == NULL)
+    {
+      int retval = 0;
+      for (s = streams; s < streams + FOPEN_MAX; s++)
+        if (s->in_use && fflush (s) != 0)
+          retval = EOF;
+      return retval;
+    }
+
+  if (s->reading)
+    {
+      if (s->pos < s->len)
+        seek (s->handle, tell (s->handle) - (s->len - s->pos));
+      s->pos = s->len = 0;
+      return 0;
+    }
+
+  if (s->pos > 0)
+    {
+      size_t cnt = s->pos;
+      s->pos = 0;
+      if (write (s->handle, s->buf, cnt) != (int) cnt)
+        {
+          s->error = true;
+          return EOF;
+        }
+    }
+  return 0;
+}
+
+/* Sets stream S to buffering MODE, using SIZE bytes at BUF as
+   its buffer if BUF is non-null.  Must be called before any
+   input or output on S.  Returns 0 if successful, nonzero if the
+   arguments are invalid. */
+int
+setvbuf (FILE *s, char *buf, int mode, size_t size)
+{
+  if ((mode != _IOFBF && mode != _IOLBF && mode != _IONBF)
+      || (buf != NULL && size == 0))
+    return EOF;
+
+  s->mode = mode;
+  if (buf != NULL)
+    {
+      s->buf = buf;
+      s->size = size;
+    }
+  return 0;
+}
+
+/* Returns the file handle of stream S. */
+int
+fileno (FILE *s)
+{
+  return s->handle;
+}
+
+/* Returns nonzero if a read from stream S has hit end of file. */
+int
+feof (FILE *s)
+{
+  return s->eof;
+}
+
+/* Returns nonzero if a read or write on stream S has failed. */
+int
+ferror (FILE *s)
+{
+  return s->error;
+}
+
+/* Writes C to stream S.  Returns C as an unsigned char, or EOF
+   on error. */
+int
+fputc (int c, FILE *s)
+{
+  return put_byte (s, c);
+}
+
+/* Writes string S to STREAM, without a new-line character.
+   Returns 0 if successful, EOF on error. */
+int
+fputs (const char *s, FILE *stream)
+{
+  size_t len = strlen (s);
+  return fwrite (s, 1, len, stream) == len ? 0 : EOF;
+}
+
+/* Writes CNT objects of SIZE bytes each from DATA to stream S.
+   Returns the number of objects written.
+
+   Data at least as large as the buffer is written straight from
+   DATA, after whatever is already buffered. */
+size_t
+fwrite (const void *data_, size_t size, size_t cnt, FILE *s)
+{
+  const char *data = data_;
+  size_t n = size * cnt;
+  size_t done = 0;
+
+  if (s->reading || n == 0)
+    return 0;
+
+  if (s->mode == _IONBF || n >= s->size)
+    {
+      int retval;
+
+      if (fflush (s) != 0)
+        return 0;
+      retval = write (s->handle, data, n);
+      if (retval != (int) n)
+        s->error = true;
+      done = retval > 0 ? retval : 0;
+    }
+  else
+    {
+      while (done < n)
+        {
+          size_t chunk = s->size - s->pos;
+          if (chunk > n - done)
+            chunk = n - done;
+          memcpy (s->buf + s->pos, data + done, chunk);
+          s->pos += chunk;
+          done += chunk;
+          if (s->pos >= s->size && fflush (s) != 0)
+            return 0;
+        }
+      if (s->mode == _IOLBF && memchr (data, '\n', n) != NULL
+          && fflush (s) != 0)
+        return 0;
+    }
+  return done / size;
+}
+
+/* The standard vfprintf() function, which is like fprintf() but
+   uses a va_list. */
+int
+vfprintf (FILE *s, const char *format, va_list args)
+{
+  struct vfprintf_aux aux;
+
+  /* Unbuffered output still goes out in one write per call. */
+  if (s->mode == _IONBF)
+    return fflush (s) == 0 ? vhprintf (s->handle, format, args) : EOF;
+
+  aux.s = s;
+  aux.char_cnt = 0;
+  __vprintf (format, args, vfprintf_helper, &aux);
+  return aux.char_cnt;
+}
+
+/* Formats the printf() format specification FORMAT and writes
+   the output to stream S. */
+int
+fprintf (FILE *s, const char *format, ...)
+{
+  va_list args;
+  int retval;
+
+  va_start (args, format);
+  retval = vfprintf (s, format, args);
+  va_end (args);
+
+  return retval;
+}
+
+/* Reads and returns the next byte from stream S as an unsigned
+   char, or EOF at end of file or on error. */
+int
+fgetc (FILE *s)
+{
+  if (!s->reading || (s->pos >= s->len && !refill (s)))
+    return EOF;
+  return (unsigned char) s->buf[s->pos++];
+}
+
+/* Reads and returns the next byte from stdin. */
+int
+getchar (void)
+{
+  return fgetc (stdin);
+}
+
+/* Reads a line of up to SIZE - 1 bytes from stream S into BUF,
+   including its new-line character if it fits, and
+   null-terminates it.  Returns BUF, or a null pointer if no
+   bytes could be read. */
+char *
+fgets (char *buf, int size, FILE *s)
+{
+  int i = 0;
+
+  if (size <= 0)
+    return NULL;
+  while (i < size - 1)
+    {
+      int c = fgetc (s);
+      if (c == EOF)
+        break;
+      buf[i++] = c;
+      if (c == '\n')
+        break;
+    }
+  if (i == 0 && size > 1)
+    return NULL;
+  buf[i] = '\0';
+  return buf;
+}
+
+/* Reads up to CNT objects of SIZE bytes each from stream S into
+   DATA.  Returns the number of whole objects read.
+
+   Buffered input is used first; a remainder at least as large
+   as the buffer is read straight into DATA. */
+size_t
+fread (void *data_, size_t size, size_t cnt, FILE *s)
+{
+  char *data = data_;
+  size_t n = size * cnt;
+  size_t done = 0;
+
+  if (!s->reading || n == 0)
+    return 0;
+
+  while (done < n)
+    {
+      size_t chunk;
+
+      if (s->pos >= s->len)
+        {
+          if (s->mode != _IONBF && n - done >= s->size)
+            {
+              int retval = read (s->handle, data + done, n - done);
+              if (retval <= 0)
+                {
+                  if (retval < 0)
+                    s->error = true;
+                  else
+                    s->eof = true;
+                  break;
+                }
+              done += retval;
+              continue;
+            }
+          if (!refill (s))
+            break;
+        }
+
+      chunk = s->len - s->pos;
+      if (chunk > n - done)
+        chunk = n - done;
+      memcpy (data + done, s->buf + s->pos, chunk);
+      s->pos += chunk;
+      done += chunk;
+    }
+  return done / size;
+}
+
+/* Writes the N characters in S to the stream in AUX. */
+static void
+vfprintf_helper (const char *s, size_t n, void *aux_)
+{
+  struct vfprintf_aux *aux = aux_;
+  fwrite (s, 1, n, aux->s);
+  aux->char_cnt += n;
+}
+
+/* Writes C to stream S, flushing the buffer if it fills or, in a
+   line-buffered stream, if C is a new-line.  Returns C as an
+   unsigned char, or EOF on error. */
+static int
+put_byte (FILE *s, char c)
+{
+  if (s->reading)
+    return EOF;
+
+  if (s->mode == _IONBF)
+    {
+      if (write (s->handle, &c, 1) != 1)
+        {
+          s->error = true;
+          return EOF;
+        }
+      return (unsigned char) c;
+    }
+
+  s->buf[s->pos++] = c;
+  if ((s->pos >= s->size || (c == '\n' && s->mode == _IOLBF))
+      && fflush (s) != 0)
+    return EOF;
+  return (unsigned char) c;
+}
+
+/* Refills the buffer of stream S, which must be empty.  An
+   unbuffered stream reads one byte at a time.  Reading the
+   console first flushes stdout.  Returns false at end of file or
+   on error. */
+static bool
+refill (FILE *s)
+{
+  int retval;
+
+  if (s->handle == STDIN_FILENO)
+    fflush (stdout);
+
+  retval = read (s->handle, s->buf, s->mode == _IONBF ? 1 : s->size);
+  if (retval <= 0)
+    {
+      if (retval < 0)
+        s->error = true;
+      else
+        s->eof = true;
+      return false;
+    }
+  s->pos = 0;
+  s->len = retval;
+  return true;
+}
@@ -1,31 +1,53 @@
 #include <syscall.h>
+#include <stdio.h>
+#include <sysenter.h>
 #include "../syscall-nr.h"
 
+/* Enter the kernel by SYSENTER instead of `int $0x30'?  Set by
+   syscall_init(). */
+static bool use_sysenter;
+
+/* Enters the kernel, once the system call number and arguments
+   are pushed, by SYSENTER if USE_SYSENTER is true and otherwise
+   by `int $0x30'.  SYSENTER spares the kernel the interrupt gate
+   and IRET; the kernel comes back to label 2 by SYSEXIT, with
+   the stack pointer from %ecx and the address from %edx, which
+   are clobbered either way.  The asm's operand FAST must be
+   USE_SYSENTER. */
+#define SYSCALL_TRAP                                            \
+        "cmpb $0, %[fast]; je 1f; "                             \
+        "movl %%esp, %%ecx; movl $2f, %%edx; sysenter; "        \
+        "1: int $0x30; 2: "
+
 /* Invokes syscall NUMBER, passing no arguments, and returns the
    return value as an `int'. */
 #define syscall0(NUMBER)                                        \
         ({                                                      \
           int retval;                                           \
           asm volatile                                          \
-            ("pushl %[number]; int $0x30; addl $4, %%esp"       \
+            ("pushl %[number]; " SYSCALL_TRAP                   \
+             "addl $4, %%esp"                                   \
                : "=a" (retval)                                  \
-               : [number] "i" (NUMBER)                          \
-               : "memory");                                     \
+               : [number] "i" (NUMBER),                         \
+                 [fast] "m" (use_sysenter)                      \
+               : "ecx", "edx", "cc", "memory");                 \
           retval;                                               \
         })
 
 /* Invokes syscall NUMBER, passing argument ARG0, and returns the
    return value as an `int'. */
-#define syscall1(NUMBER, ARG0)                                           \
-        ({                                                               \
-          int retval;                                                    \
-          asm volatile                                                   \
-            ("pushl %[arg0]; pushl %[number]; int $0x30; addl $8, %%esp" \
-               : "=a" (retval)                                           \
-               : [number] "i" (NUMBER),                                  \
-                 [arg0] "g" (ARG0)                                       \
-               : "memory");                                              \
-          retval;                                                        \
+#define syscall1(NUMBER, ARG0)                                  \
+        ({                                                      \
+          int retval;                                           \
+          asm volatile                                          \
+            ("pushl %[arg0]; pushl %[number]; " SYSCALL_TRAP    \
+             "addl $8, %%esp"                                   \
+               : "=a" (retval)                                  \
+               : [number] "i" (NUMBER),                         \
+                 [fast] "m" (use_sysenter),                     \
+                 [arg0] "g" (ARG0)                              \
+               : "ecx", "edx", "cc", "memory");                 \
+          retval;                                               \
         })
 
 /* Invokes syscall NUMBER, passing arguments ARG0 and ARG1, and
@@ -35,12 +57,14 @@
           int retval;                                           \
           asm volatile                                          \
             ("pushl %[arg1]; pushl %[arg0]; "                   \
-             "pushl %[number]; int $0x30; addl $12, %%esp"      \
+             "pushl %[number]; " SYSCALL_TRAP                   \
+             "addl $12, %%esp"                                  \
                : "=a" (retval)                                  \
                : [number] "i" (NUMBER),                         \
+                 [fast] "m" (use_sysenter),                     \
                  [arg0] "r" (ARG0),                             \
                  [arg1] "r" (ARG1)                              \
-               : "memory");                                     \
+               : "ecx", "edx", "cc", "memory");                 \
           retval;                                               \
         })
 
@@ -51,19 +75,51 @@
           int retval;                                           \
           asm volatile                                          \
             ("pushl %[arg2]; pushl %[arg1]; pushl %[arg0]; "    \
-             "pushl %[number]; int $0x30; addl $16, %%esp"      \
+             "pushl %[number]; " SYSCALL_TRAP                   \
+             "addl $16, %%esp"                                  \
                : "=a" (retval)                                  \
                : [number] "i" (NUMBER),                         \
+                 [fast] "m" (use_sysenter),                     \
                  [arg0] "r" (ARG0),                             \
                  [arg1] "r" (ARG1),                             \
                  [arg2] "r" (ARG2)                              \
-               : "memory");                                     \
+               : "ecx", "edx", "cc", "memory");                 \
           retval;                                               \
         })
 
+/* Invokes syscall NUMBER, passing arguments ARG0, ARG1, ARG2,
+   and ARG3, and returns the return value as an `int'. */
+#define syscall4(NUMBER, ARG0, ARG1, ARG2, ARG3)                \
+        ({                                                      \
+          int retval;                                           \
+          asm volatile                                          \
+            ("pushl %[arg3]; pushl %[arg2]; pushl %[arg1]; "    \
+             "pushl %[arg0]; "                                  \
+             "pushl %[number]; " SYSCALL_TRAP                   \
+             "addl $20, %%esp"                                  \
+               : "=a" (retval)                                  \
+               : [number] "i" (NUMBER),                         \
+                 [fast] "m" (use_sysenter),                     \
+                 [arg0] "r" (ARG0),                             \
+                 [arg1] "r" (ARG1),                             \
+                 [arg2] "r" (ARG2),                             \
+                 [arg3] "r" (ARG3)                              \
+               : "ecx", "edx", "cc", "memory");                 \
+          retval;                                               \
+        })
+
+/* Chooses how to enter the kernel.  Called by _start() before
+   any system call. */
+void
+syscall_init (void)
+{
+  use_sysenter = sysenter_supported ();
+}
+
 void
 halt (void) 
 {
+  fflush (NULL);
   syscall0 (SYS_HALT);
   NOT_REACHED ();
 }
@@ -71,6 +127,7 @@ halt (void)
 void
 exit (int status)
 {
+  fflush (NULL);
   syscall1 (SYS_EXIT, status);
   NOT_REACHED ();
 }
@@ -144,7 +201,13 @@ close (int fd)
 mapid_t
 mmap (int fd, void *addr)
 {
-  return syscall2 (SYS_MMAP, fd, addr);
+  return syscall3 (SYS_MMAP, fd, addr, 0);
+}
+
+mapid_t
+mmap_flags (int fd, void *addr, int flags)
+{
+  return syscall3 (SYS_MMAP, fd, addr, flags);
 }
 
 void
@@ -182,3 +245,262 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+int
+pread (int fd, void *buffer, unsigned size, unsigned position)
+{
+  return syscall4 (SYS_PREAD, fd, buffer, size, position);
+}
+
+int
+pwrite (int fd, const void *buffer, unsigned size, unsigned position)
+{
+  return syscall4 (SYS_PWRITE, fd, buffer, size, position);
+}
+
+int
+readv (int fd, const struct iovec *iov, int iovcnt)
+{
+  return syscall3 (SYS_READV, fd, iov, iovcnt);
+}
+
+int
+writev (int fd, const struct iovec *iov, int iovcnt)
+{
+  return syscall3 (SYS_WRITEV, fd, iov, iovcnt);
+}
+
+int
+copy_file_range (int fd_in, int fd_out, unsigned size)
+{
+  return syscall3 (SYS_COPY_FILE_RANGE, fd_in, fd_out, size);
+}
+
+bool
+stats (int syscall, struct syscall_stats *stats)
+{
+  return syscall2 (SYS_STATS, syscall, stats);
+}
+
+pid_t
+fork (void)
+{
+  return (pid_t) syscall0 (SYS_FORK);
+}
+
+bool
+vmstats (struct vm_stats *stats)
+{
+  return syscall1 (SYS_VMSTATS, stats);
+}
+
+pid_t
+spawn (const char *argv[])
+{
+  return (pid_t) syscall1 (SYS_SPAWN, argv);
+}
+
+int
+stack_prefault (int pages)
+{
+  return syscall1 (SYS_STACK_PREFAULT, pages);
+}
+
+int
+memlimit (int pages)
+{
+  return syscall1 (SYS_MEMLIMIT, pages);
+}
+
+void *
+sbrk (intptr_t increment)
+{
+  return (void *) syscall1 (SYS_SBRK, increment);
+}
+
+bool
+fsync (int fd)
+{
+  return syscall1 (SYS_FSYNC, fd);
+}
+
+void
+sync (void)
+{
+  syscall0 (SYS_SYNC);
+}
+
+bool
+fallocate (int fd, unsigned offset, unsigned length)
+{
+  return syscall3 (SYS_FALLOCATE, fd, offset, length);
+}
+
+int
+getdents (int fd, struct dirent *entries, unsigned cnt)
+{
+  return syscall3 (SYS_GETDENTS, fd, entries, cnt);
+}
+
+bool
+clock (struct clock_time *now)
+{
+  return syscall1 (SYS_CLOCK, now);
+}
+
+bool
+sysinfo (struct sysinfo *info)
+{
+  return syscall1 (SYS_SYSINFO, info);
+}
+
+bool
+aio_setup (struct aio_ring *ring)
+{
+  return syscall1 (SYS_AIO_SETUP, ring);
+}
+
+int
+aio_enter (unsigned min_complete)
+{
+  return syscall1 (SYS_AIO_ENTER, min_complete);
+}
+
+/* Where each thread started by uthread_create() begins. */
+static void
+uthread_start (void (*func) (void *), void *aux)
+{
+  func (aux);
+  uthread_exit ();
+}
+
+/* Starts a thread in this process that runs FUNC (AUX) on the
+   SIZE bytes at STACK, which must stay allocated until it exits.
+   The thread exits when FUNC returns. */
+uthread_t
+uthread_create (void (*func) (void *), void *aux, void *stack, unsigned size)
+{
+  /* Lay out a call to uthread_start (FUNC, AUX) from a null
+     return address, with its arguments 16-byte aligned. */
+  uintptr_t top = ((uintptr_t) stack + size) & ~(uintptr_t) 15;
+  uint32_t *sp = (uint32_t *) (top - 8);
+
+  *--sp = (uint32_t) aux;
+  *--sp = (uint32_t) func;
+  *--sp = 0;
+  return syscall2 (SYS_UTHREAD_CREATE, uthread_start, sp);
+}
+
+void
+uthread_exit (void)
+{
+  syscall0 (SYS_UTHREAD_EXIT);
+  NOT_REACHED ();
+}
+
+int
+uthread_join (uthread_t tid)
+{
+  return syscall1 (SYS_UTHREAD_JOIN, tid);
+}
+
+bool
+futex_wait (int *uaddr, int val)
+{
+  return syscall2 (SYS_FUTEX_WAIT, uaddr, val);
+}
+
+int
+futex_wake (int *uaddr, int cnt)
+{
+  return syscall2 (SYS_FUTEX_WAKE, uaddr, cnt);
+}
+
+mapid_t
+shm_open (const char *name, unsigned size, void *addr)
+{
+  return syscall3 (SYS_SHM_OPEN, name, size, addr);
+}
+
+bool
+shm_unlink (const char *name)
+{
+  return syscall1 (SYS_SHM_UNLINK, name);
+}
+
+bool
+pipe (int fds[2])
+{
+  return syscall1 (SYS_PIPE, fds);
+}
+
+bool
+sched_setaffinity (unsigned mask)
+{
+  return syscall1 (SYS_SCHED_SETAFFINITY, mask);
+}
+
+unsigned
+sched_getaffinity (void)
+{
+  return syscall0 (SYS_SCHED_GETAFFINITY);
+}
+
+bool
+sched_reserve (int runtime, int period)
+{
+  return syscall2 (SYS_SCHED_RESERVE, runtime, period);
+}
+
+bool
+msync (mapid_t mapid)
+{
+  return syscall1 (SYS_MSYNC, mapid);
+}
+
+bool
+madvise (void *addr, unsigned length, int advice)
+{
+  return syscall3 (SYS_MADVISE, addr, length, advice);
+}
+
+bool
+fadvise (int fd, unsigned offset, unsigned length, int advice)
+{
+  return syscall4 (SYS_FADVISE, fd, offset, length, advice);
+}
+
+/* The kernel's page of struct user_info. */
+#define USER_INFO ((const volatile struct user_info *) USER_INFO_PAGE)
+
+/* Returns the number of timer ticks since the OS booted. */
+unsigned long long
+get_ticks (void)
+{
+  unsigned seq;
+  unsigned long long ticks;
+
+  do
+    {
+      seq = USER_INFO->seq;
+      asm volatile ("" : : : "memory");
+      ticks = USER_INFO->ticks;
+      asm volatile ("" : : : "memory");
+    }
+  while ((seq & 1) != 0 || seq != USER_INFO->seq);
+  return ticks;
+}
+
+/* Returns the calling process's id. */
+pid_t
+getpid (void)
+{
+  return USER_INFO->pid;
+}
+
+/* Returns the calling thread's id. */
+uthread_t
+gettid (void)
+{
+  return USER_INFO->tid;
+}
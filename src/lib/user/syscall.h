@@ -2,7 +2,9 @@
 #define __LIB_USER_SYSCALL_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <debug.h>
+#include "../syscall-nr.h"
 
 /* Process identifier. */
 typedef int pid_t;
@@ -12,6 +14,10 @@ typedef int pid_t;
 typedef int mapid_t;
 #define MAP_FAILED ((mapid_t) -1)
 
+/* Thread identifier. */
+typedef int uthread_t;
+#define UTHREAD_ERROR ((uthread_t) -1)
+
 /* Maximum characters in a filename written by readdir(). */
 #define READDIR_MAX_LEN 14
 
@@ -19,6 +25,9 @@ typedef int mapid_t;
 #define EXIT_SUCCESS 0          /* Successful execution. */
 #define EXIT_FAILURE 1          /* Unsuccessful execution. */
 
+/* Sets up the system call entry.  Called by _start(). */
+void syscall_init (void);
+
 /* Projects 2 and later. */
 void halt (void) NO_RETURN;
 void exit (int status) NO_RETURN;
@@ -36,6 +45,7 @@ void close (int fd);
 
 /* Project 3 and optionally project 4. */
 mapid_t mmap (int fd, void *addr);
+mapid_t mmap_flags (int fd, void *addr, int flags);
 void munmap (mapid_t);
 
 /* Project 4 only. */
@@ -45,4 +55,46 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+int pread (int fd, void *buffer, unsigned length, unsigned position);
+int pwrite (int fd, const void *buffer, unsigned length, unsigned position);
+int readv (int fd, const struct iovec *iov, int iovcnt);
+int writev (int fd, const struct iovec *iov, int iovcnt);
+int copy_file_range (int fd_in, int fd_out, unsigned length);
+bool stats (int syscall, struct syscall_stats *);
+pid_t fork (void);
+bool vmstats (struct vm_stats *);
+pid_t spawn (const char *argv[]);
+int stack_prefault (int pages);
+int memlimit (int pages);
+void *sbrk (intptr_t increment);
+bool fsync (int fd);
+void sync (void);
+bool fallocate (int fd, unsigned offset, unsigned length);
+int getdents (int fd, struct dirent *entries, unsigned cnt);
+bool clock (struct clock_time *);
+bool sysinfo (struct sysinfo *);
+bool aio_setup (struct aio_ring *);
+int aio_enter (unsigned min_complete);
+uthread_t uthread_create (void (*func) (void *), void *aux,
+                          void *stack, unsigned size);
+void uthread_exit (void) NO_RETURN;
+int uthread_join (uthread_t);
+bool futex_wait (int *uaddr, int val);
+int futex_wake (int *uaddr, int cnt);
+mapid_t shm_open (const char *name, unsigned size, void *addr);
+bool shm_unlink (const char *name);
+bool pipe (int fds[2]);
+bool sched_setaffinity (unsigned mask);
+unsigned sched_getaffinity (void);
+bool sched_reserve (int runtime, int period);
+bool msync (mapid_t);
+bool madvise (void *addr, unsigned length, int advice);
+bool fadvise (int fd, unsigned offset, unsigned length, int advice);
+
+/* Read from the user info page, without a system call. */
+unsigned long long get_ticks (void);
+pid_t getpid (void);
+uthread_t gettid (void);
+
 #endif /* lib/user/syscall.h */
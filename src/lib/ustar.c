@@ -226,3 +226,127 @@ ustar_parse_header (const char header[USTAR_HEADER_SIZE],
   return NULL;
 }
 
+
+/* Initializes R to read an archive from its start.  Nothing can
+   be read until a buffer is fed with ustar_reader_feed(). */
+void
+ustar_reader_init (struct ustar_reader *r)
+{
+  r->buf = NULL;
+  r->buf_left = 0;
+  r->ofs = 0;
+  r->header_ofs = 0;
+  r->data_left = 0;
+  r->pad_left = 0;
+  r->done = false;
+}
+
+/* Gives R the next SIZE bytes of the archive, at BUF.  R must
+   have used up the previous buffer, that is, ustar_reader_next()
+   must have returned USTAR_ITEM_MORE.  BUF must stay valid until
+   then again, as the data ranges returned point into it. */
+void
+ustar_reader_feed (struct ustar_reader *r, const void *buf, size_t size)
+{
+  ASSERT (r->buf_left == 0);
+
+  r->buf = buf;
+  r->buf_left = size;
+}
+
+/* Advances R past CNT bytes of its buffer. */
+static void
+reader_consume (struct ustar_reader *r, size_t cnt)
+{
+  r->buf += cnt;
+  r->buf_left -= cnt;
+  r->ofs += cnt;
+}
+
+/* Returns the next item in the archive R is reading, filling in
+   the members of *CHUNK that the item uses:
+
+   - USTAR_ITEM_HEADER for each member, with its name, type and
+     size.  The name stays valid until the next header.
+
+   - USTAR_ITEM_DATA for each range of the current member's data,
+     which together make up its size.  A range never spans two
+     buffers.
+
+   - USTAR_ITEM_MORE when R needs another buffer to go on.
+
+   - USTAR_ITEM_END at the end-of-archive marker, and on every
+     call after it.
+
+   - USTAR_ITEM_ERROR for a corrupt header, with a message and the
+     header's offset.  R cannot go on from there. */
+enum ustar_item
+ustar_reader_next (struct ustar_reader *r, struct ustar_chunk *chunk)
+{
+  for (;;)
+    {
+      size_t cnt;
+
+      if (r->done)
+        return USTAR_ITEM_END;
+
+      if (r->data_left > 0 && r->buf_left > 0)
+        {
+          /* Hand out as much of the data as the buffer holds. */
+          cnt = r->data_left < r->buf_left ? r->data_left : r->buf_left;
+          chunk->data = r->buf;
+          chunk->length = cnt;
+          r->data_left -= cnt;
+          reader_consume (r, cnt);
+          return USTAR_ITEM_DATA;
+        }
+      else if (r->data_left > 0 || r->buf_left == 0)
+        return USTAR_ITEM_MORE;
+
+      if (r->pad_left > 0)
+        {
+          /* Skip padding up to the next header. */
+          cnt = r->pad_left < r->buf_left ? r->pad_left : r->buf_left;
+          r->pad_left -= cnt;
+          reader_consume (r, cnt);
+          continue;
+        }
+
+      /* Gather the next header. */
+      cnt = USTAR_HEADER_SIZE - r->header_ofs;
+      if (cnt > r->buf_left)
+        cnt = r->buf_left;
+      memcpy (r->header + r->header_ofs, r->buf, cnt);
+      r->header_ofs += cnt;
+      reader_consume (r, cnt);
+      if (r->header_ofs == USTAR_HEADER_SIZE)
+        {
+          r->header_ofs = 0;
+          chunk->error = ustar_parse_header (r->header, &chunk->file_name,
+                                             &chunk->type, &chunk->size);
+          if (chunk->error != NULL)
+            {
+              chunk->header_ofs = r->ofs - USTAR_HEADER_SIZE;
+              return USTAR_ITEM_ERROR;
+            }
+          if (chunk->type == USTAR_EOF)
+            {
+              r->done = true;
+              return USTAR_ITEM_END;
+            }
+          r->data_left = chunk->size;
+          r->pad_left = ((USTAR_HEADER_SIZE - chunk->size % USTAR_HEADER_SIZE)
+                         % USTAR_HEADER_SIZE);
+          return USTAR_ITEM_HEADER;
+        }
+    }
+}
+
+/* Returns the archive offset of the byte after the last one R
+   has read.  At the end of the archive, this is just past the
+   first block of the end-of-archive marker. */
+uint64_t
+ustar_reader_tell (const struct ustar_reader *r)
+{
+  return r->ofs;
+}
@@ -6,6 +6,8 @@
    "ustar" format specification. */
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 /* Type of a file entry in an archive.
    The values here are the bytes that appear in the file format.
@@ -26,4 +28,52 @@ const char *ustar_parse_header (const char header[USTAR_HEADER_SIZE],
                                 const char **file_name,
                                 enum ustar_type *, int *size);
 
+/* What ustar_reader_next() found. */
+enum ustar_item
+  {
+    USTAR_ITEM_MORE,            /* Buffer used up: feed another. */
+    USTAR_ITEM_HEADER,          /* Header of the next member. */
+    USTAR_ITEM_DATA,            /* Range of the current member's data. */
+    USTAR_ITEM_END,             /* End-of-archive marker. */
+    USTAR_ITEM_ERROR            /* Corrupt header. */
+  };
+
+/* A header or data range returned by ustar_reader_next(). */
+struct ustar_chunk
+  {
+    /* USTAR_ITEM_HEADER. */
+    const char *file_name;      /* Points into the reader. */
+    enum ustar_type type;       /* USTAR_REGULAR or USTAR_DIRECTORY. */
+    int size;                   /* Data bytes that follow. */
+
+    /* USTAR_ITEM_DATA. */
+    const void *data;           /* Points into the buffer fed. */
+    size_t length;              /* Bytes at DATA, at least 1. */
+
+    /* USTAR_ITEM_ERROR. */
+    const char *error;          /* Human-readable message. */
+    uint64_t header_ofs;        /* Archive offset of the bad header. */
+  };
+
+/* Reads a ustar archive fed to it in buffers of any size, in
+   order.  Data ranges are handed out in place, without copying;
+   only a header is copied, so that it may span two buffers. */
+struct ustar_reader
+  {
+    const uint8_t *buf;         /* Unread part of the buffer fed. */
+    size_t buf_left;            /* Bytes at BUF. */
+    uint64_t ofs;               /* Archive offset of BUF. */
+    char header[USTAR_HEADER_SIZE]; /* Header being read. */
+    size_t header_ofs;          /* Bytes of HEADER read. */
+    size_t data_left;           /* Current member's data bytes left. */
+    size_t pad_left;            /* Padding bytes left after the data. */
+    bool done;                  /* End of archive seen? */
+  };
+
+void ustar_reader_init (struct ustar_reader *);
+void ustar_reader_feed (struct ustar_reader *, const void *, size_t);
+enum ustar_item ustar_reader_next (struct ustar_reader *,
+                                   struct ustar_chunk *);
+uint64_t ustar_reader_tell (const struct ustar_reader *);
+
 #endif /* lib/ustar.h */
@@ -0,0 +1,31 @@
+/* Times CHILD_CNT processes each writing and reading back a file
+   of its own at the same time, against one process doing the
+   same amount of I/O alone. */
+
+#include <syscall.h>
+#include "tests/filesys/bench/bench.h"
+#include "tests/filesys/bench/contend.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Runs CNT child-contend processes at once and waits for them,
+   reporting them as PHASE. */
+static void
+run_children (const char *phase, int cnt)
+{
+  pid_t children[CHILD_CNT];
+  unsigned long long start = rdtsc ();
+
+  exec_children ("child-contend", children, cnt);
+  wait_children (children, cnt);
+  bench_report (phase, cnt, 2ULL * cnt * FILE_SIZE, rdtsc () - start);
+}
+
+void
+test_main (void)
+{
+  quiet = true;
+  run_children ("alone", 1);
+  run_children ("contend", CHILD_CNT);
+  quiet = false;
+}
@@ -0,0 +1,53 @@
+/* Times creating, looking up and removing many empty files in
+   one directory. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/filesys/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 200
+
+/* Does OP on each of the files, reporting it as PHASE. */
+static void
+each_file (const char *phase, bool (*op) (const char *))
+{
+  unsigned long long start = rdtsc ();
+  char name[32];
+  int i;
+
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "dir/file%d", i);
+      if (!op (name))
+        fail ("%s \"%s\"", phase, name);
+    }
+  bench_report (phase, FILE_CNT, 0, rdtsc () - start);
+}
+
+static bool
+create_empty (const char *name)
+{
+  return create (name, 0);
+}
+
+static bool
+open_close (const char *name)
+{
+  int fd = open (name);
+  close (fd);
+  return fd > 1;
+}
+
+void
+test_main (void)
+{
+  CHECK (mkdir ("dir"), "mkdir \"dir\"");
+  quiet = true;
+  each_file ("create", create_empty);
+  each_file ("open", open_close);
+  each_file ("remove", remove);
+  quiet = false;
+  CHECK (remove ("dir"), "remove \"dir\"");
+}
@@ -0,0 +1,51 @@
+/* Times reads and writes of 512 bytes and of 4 kB at random
+   aligned offsets in a 256 kB file. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/filesys/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE (256 * 1024)
+#define OP_CNT 256
+
+static char buf[4096];
+
+/* Does OP_CNT reads or writes of SIZE bytes at random multiples
+   of SIZE in FD, reporting them as PHASE. */
+static void
+random_ops (int fd, const char *phase, size_t size, bool writing)
+{
+  unsigned long long start = rdtsc ();
+  int i;
+
+  for (i = 0; i < OP_CNT; i++)
+    {
+      size_t ofs = random_ulong () % (FILE_SIZE / size) * size;
+      seek (fd, ofs);
+      if ((writing ? write (fd, buf, size) : read (fd, buf, size))
+          != (int) size)
+        fail ("%s \"bench\" at %zu", phase, ofs);
+    }
+  bench_report (phase, OP_CNT, (unsigned long long) OP_CNT * size,
+                rdtsc () - start);
+}
+
+void
+test_main (void)
+{
+  int fd;
+
+  random_init (0);
+  CHECK (create ("bench", FILE_SIZE), "create \"bench\"");
+  CHECK ((fd = open ("bench")) > 1, "open \"bench\"");
+  quiet = true;
+  random_ops (fd, "read-512", 512, false);
+  random_ops (fd, "read-4k", 4096, false);
+  random_ops (fd, "write-512", 512, true);
+  random_ops (fd, "write-4k", 4096, true);
+  quiet = false;
+  close (fd);
+  CHECK (remove ("bench"), "remove \"bench\"");
+}
@@ -0,0 +1,6 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::filesys::bench::bench;
+check_bench ('bench-random', 'read-512', 'read-4k', 'write-512', 'write-4k');
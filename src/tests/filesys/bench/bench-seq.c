@@ -0,0 +1,45 @@
+/* Times writing a file sequentially, reading it back, and
+   rewriting it in place, in 4 kB chunks. */
+
+#include <syscall.h>
+#include "tests/filesys/bench/bench.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE (512 * 1024)
+#define CHUNK_SIZE 4096
+
+static char buf[CHUNK_SIZE];
+
+/* Reads or writes all of FD from the start, reporting it as
+   PHASE. */
+static void
+pass_over (int fd, const char *phase, bool writing)
+{
+  unsigned long long start;
+  size_t ofs;
+
+  seek (fd, 0);
+  start = rdtsc ();
+  for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK_SIZE)
+    if ((writing ? write (fd, buf, CHUNK_SIZE)
+         : read (fd, buf, CHUNK_SIZE)) != CHUNK_SIZE)
+      fail ("%s \"bench\" at %zu", phase, ofs);
+  bench_report (phase, FILE_SIZE / CHUNK_SIZE, FILE_SIZE, rdtsc () - start);
+}
+
+void
+test_main (void)
+{
+  int fd;
+
+  CHECK (create ("bench", 0), "create \"bench\"");
+  CHECK ((fd = open ("bench")) > 1, "open \"bench\"");
+  quiet = true;
+  pass_over (fd, "write", true);
+  pass_over (fd, "read", false);
+  pass_over (fd, "rewrite", true);
+  quiet = false;
+  close (fd);
+  CHECK (remove ("bench"), "remove \"bench\"");
+}
@@ -0,0 +1,11 @@
+#include "tests/filesys/bench/bench.h"
+#include "tests/lib.h"
+
+/* Reports that PHASE did OPS operations moving BYTES bytes in
+   CYCLES CPU cycles, in the form bench.pm parses. */
+void
+bench_report (const char *phase, unsigned long ops,
+              unsigned long long bytes, unsigned long long cycles)
+{
+  msg ("%s: %lu ops, %llu bytes, %llu cycles", phase, ops, bytes, cycles);
+}
@@ -0,0 +1,16 @@
+#ifndef TESTS_FILESYS_BENCH_BENCH_H
+#define TESTS_FILESYS_BENCH_BENCH_H
+
+/* Reads the CPU's time-stamp counter. */
+static inline unsigned long long
+rdtsc (void)
+{
+  unsigned long long t;
+  asm volatile ("rdtsc" : "=A" (t));
+  return t;
+}
+
+void bench_report (const char *phase, unsigned long ops,
+                   unsigned long long bytes, unsigned long long cycles);
+
+#endif /* tests/filesys/bench/bench.h */
@@ -0,0 +1,45 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+# Checks that the benchmark reported exactly PHASES, in order,
+# and writes a summary of each phase's rate, followed by the
+# run's timer ticks and block device counts from the kernel's
+# shutdown statistics, to $test.summary.  The result itself must
+# be a bare PASS, so the summary cannot go there.  Cycle counts
+# vary from run to run, so nothing about the numbers themselves
+# is checked.
+sub check_bench {
+    my ($name, @phases) = @_;
+    our ($test);
+    my (@output) = read_text_file ("$test.output");
+
+    common_checks ("run", @output);
+    my (@core) = get_core_output ("run", @output);
+
+    my (@summary, @seen);
+    for (@core) {
+	my ($phase, $ops, $bytes, $cycles)
+	  = /^\($name\) ([\w-]+): (\d+) ops, (\d+) bytes, (\d+) cycles$/
+	  or next;
+	push (@seen, $phase);
+	my ($mcycles) = $cycles / 1e6 || 1e-6;
+	my ($line) = sprintf ("%s: %d ops, %.1f ops/Mcycle", $phase, $ops,
+			      $ops / $mcycles);
+	$line .= sprintf (", %.1f kB/Mcycle", $bytes / 1024 / $mcycles)
+	  if $bytes > 0;
+	push (@summary, $line);
+    }
+    fail "missing or malformed benchmark lines\n"
+      if join (', ', @seen) ne join (', ', @phases);
+
+    push (@summary, grep (/^Timer: \d+ ticks$/, @output));
+    push (@summary, grep (/^\S+ \([^)]+\): \d+ reads, \d+ writes$/, @output));
+    open (SUMMARY, '>', "$test.summary") or die "$test.summary: create: $!\n";
+    print SUMMARY "$_\n" foreach @summary;
+    close (SUMMARY);
+    pass;
+}
+
+1;
@@ -0,0 +1,42 @@
+/* Child process for bench-contend.
+   Writes a file of its own, reads it back and removes it, while
+   other processes do the same. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "tests/filesys/bench/contend.h"
+#include "tests/lib.h"
+
+const char *test_name = "child-contend";
+
+static char buf[CHUNK_SIZE];
+
+int
+main (int argc, char *argv[])
+{
+  char name[16];
+  size_t ofs;
+  int child_idx;
+  int fd;
+
+  quiet = true;
+
+  CHECK (argc == 2, "argc must be 2, actually %d", argc);
+  child_idx = atoi (argv[1]);
+  snprintf (name, sizeof name, "file%d", child_idx);
+
+  CHECK (create (name, 0), "create \"%s\"", name);
+  CHECK ((fd = open (name)) > 1, "open \"%s\"", name);
+  for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK_SIZE)
+    if (write (fd, buf, CHUNK_SIZE) != CHUNK_SIZE)
+      fail ("write \"%s\" at %zu", name, ofs);
+  seek (fd, 0);
+  for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK_SIZE)
+    if (read (fd, buf, CHUNK_SIZE) != CHUNK_SIZE)
+      fail ("read \"%s\" at %zu", name, ofs);
+  close (fd);
+  CHECK (remove (name), "remove \"%s\"", name);
+
+  return child_idx;
+}
@@ -0,0 +1,8 @@
+#ifndef TESTS_FILESYS_BENCH_CONTEND_H
+#define TESTS_FILESYS_BENCH_CONTEND_H
+
+#define CHILD_CNT 4
+#define FILE_SIZE (64 * 1024)
+#define CHUNK_SIZE 4096
+
+#endif /* tests/filesys/bench/contend.h */
@@ -0,0 +1,7 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($aio) = join ('', map ($_ x 4096, 'a'...'d'));
+check_archive ({"aio" => [$aio]});
+pass;
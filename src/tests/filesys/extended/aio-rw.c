@@ -0,0 +1,97 @@
+/* Writes a file with asynchronous writes submitted all at once,
+   syncs it, and reads it back with asynchronous reads submitted
+   in reverse order.  Each completion must carry its request's
+   user_data and the bytes transferred, and a request for a bad
+   file descriptor must complete with -1. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHUNK_SIZE 4096
+#define CHUNK_CNT 4
+
+static struct aio_ring ring;
+static char out[CHUNK_CNT][CHUNK_SIZE];
+static char in[CHUNK_CNT][CHUNK_SIZE];
+
+/* Queues a request, to be submitted by the next aio_enter(). */
+static void
+queue (int op, int fd, void *buf, unsigned pos, unsigned user_data)
+{
+  struct aio_sqe *sqe = &ring.sq[ring.sq_tail % AIO_RING_ENTRIES];
+
+  sqe->op = op;
+  sqe->fd = fd;
+  sqe->buf = buf;
+  sqe->len = buf != NULL ? CHUNK_SIZE : 0;
+  sqe->pos = pos;
+  sqe->user_data = user_data;
+  ring.sq_tail++;
+}
+
+/* Submits the queued requests and waits for CNT completions,
+   storing the result of each into RES[] by its user_data. */
+static void
+reap (int cnt, int res[])
+{
+  int done = 0;
+
+  while (done < cnt)
+    {
+      if (aio_enter (cnt - done) < 0)
+        fail ("aio_enter failed");
+      while (ring.cq_head != ring.cq_tail)
+        {
+          struct aio_cqe *cqe = &ring.cq[ring.cq_head++ % AIO_RING_ENTRIES];
+          if (cqe->user_data >= CHUNK_CNT)
+            fail ("completion with bad user_data %u", cqe->user_data);
+          res[cqe->user_data] = cqe->res;
+          done++;
+        }
+    }
+}
+
+void
+test_main (void)
+{
+  int res[CHUNK_CNT];
+  int fd, i;
+
+  for (i = 0; i < CHUNK_CNT; i++)
+    memset (out[i], 'a' + i, CHUNK_SIZE);
+  CHECK (create ("aio", 0), "create \"aio\"");
+  CHECK ((fd = open ("aio")) > 1, "open \"aio\"");
+  CHECK (aio_setup (&ring), "aio_setup");
+
+  for (i = 0; i < CHUNK_CNT; i++)
+    queue (AIO_WRITE, fd, out[i], i * CHUNK_SIZE, i);
+  reap (CHUNK_CNT, res);
+  for (i = 0; i < CHUNK_CNT; i++)
+    if (res[i] != CHUNK_SIZE)
+      fail ("write of chunk %d returned %d", i, res[i]);
+  msg ("write %d chunks", CHUNK_CNT);
+
+  queue (AIO_FSYNC, fd, NULL, 0, 0);
+  reap (1, res);
+  CHECK (res[0] == 0, "fsync");
+
+  queue (AIO_READ, 1000, in[0], 0, 0);
+  reap (1, res);
+  CHECK (res[0] == -1, "read from a bad fd (must fail)");
+
+  for (i = CHUNK_CNT - 1; i >= 0; i--)
+    queue (AIO_READ, fd, in[i], i * CHUNK_SIZE, i);
+  reap (CHUNK_CNT, res);
+  for (i = 0; i < CHUNK_CNT; i++)
+    {
+      if (res[i] != CHUNK_SIZE)
+        fail ("read of chunk %d returned %d", i, res[i]);
+      compare_bytes (in[i], out[i], CHUNK_SIZE, i * CHUNK_SIZE, "aio");
+    }
+  msg ("read %d chunks back", CHUNK_CNT);
+
+  close (fd);
+  check_file ("aio", out, sizeof out);
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(aio-rw) begin
+(aio-rw) create "aio"
+(aio-rw) open "aio"
+(aio-rw) aio_setup
+(aio-rw) write 4 chunks
+(aio-rw) fsync
+(aio-rw) read from a bad fd (must fail)
+(aio-rw) read 4 chunks back
+(aio-rw) open "aio" for verification
+(aio-rw) verified contents of "aio"
+(aio-rw) close "aio"
+(aio-rw) end
+EOF
+pass;
@@ -0,0 +1,8 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($a) = 'a' x 1234;
+my ($b) = 'b' x 1234;
+check_archive ({"a" => [$a], "b" => [$b]});
+pass;
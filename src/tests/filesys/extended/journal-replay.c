@@ -0,0 +1,41 @@
+/* Writes two files, syncing each, and loses power just after the
+   second sync's commit record reaches the journal, before the
+   metadata goes home (the -journal-crash=2 kernel option).  The
+   persistence check then finds both files, so the mount must
+   have replayed the journal. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 1234
+
+static char a[FILE_SIZE];
+static char b[FILE_SIZE];
+
+/* Creates NAME holding the FILE_SIZE bytes in BUF and syncs it,
+   announcing the sync first in case it never returns. */
+static void
+write_file (const char *name, const char *buf, const char *sync_msg)
+{
+  int fd;
+
+  CHECK (create (name, 0), "create \"%s\"", name);
+  CHECK ((fd = open (name)) > 1, "open \"%s\"", name);
+  CHECK (write (fd, buf, FILE_SIZE) == FILE_SIZE, "write \"%s\"", name);
+  msg (sync_msg, name);
+  if (!fsync (fd))
+    fail ("fsync \"%s\" failed", name);
+  close (fd);
+}
+
+void
+test_main (void)
+{
+  memset (a, 'a', sizeof a);
+  memset (b, 'b', sizeof b);
+  write_file ("a", a, "fsync \"%s\"");
+  write_file ("b", b, "fsync \"%s\", losing power");
+  fail ("still running after the commit that should lose power");
+}
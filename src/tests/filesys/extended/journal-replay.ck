@@ -0,0 +1,26 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+our ($test);
+
+# The run loses power inside the second fsync, so the process
+# never finishes and only its output up to then can be checked.
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+my (@actual) = grep (/^\(journal-replay\) / || /^journal: /, @output);
+my (@expected) = split ("\n", <<'EOF');
+(journal-replay) begin
+(journal-replay) create "a"
+(journal-replay) open "a"
+(journal-replay) write "a"
+(journal-replay) fsync "a"
+(journal-replay) create "b"
+(journal-replay) open "b"
+(journal-replay) write "b"
+(journal-replay) fsync "b", losing power
+journal: losing power after commit record
+EOF
+fail join ("\n", "Run produced unexpected output:", @actual, "")
+  if join ("\n", @actual) ne join ("\n", @expected);
+pass;
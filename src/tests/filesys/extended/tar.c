@@ -3,10 +3,15 @@
    Creates a tar archive. */
 
 #include <ustar.h>
+#include <round.h>
 #include <syscall.h>
 #include <stdio.h>
 #include <string.h>
 
+/* Bytes of an ordinary file's header and data written at a time.
+   A multiple of the ustar block size. */
+#define CHUNK_SIZE (64 * USTAR_HEADER_SIZE)
+
 static void usage (void);
 static bool make_tar_archive (const char *archive_name,
                               char *files[], size_t file_cnt);
@@ -120,38 +125,52 @@ archive_file (char file_name[], size_t file_name_size,
     }
 }
 
+/* Writes FILE_NAME's header and data to ARCHIVE_FD, CHUNK_SIZE
+   bytes at a time, with the header in the same write as the
+   first chunk of data. */
 static bool
 archive_ordinary_file (const char *file_name, int file_fd,
                        int archive_fd, bool *write_error)
 {
+  static char buf[CHUNK_SIZE];
   bool read_error = false;
   bool success = true;
   int file_size = filesize (file_fd);
+  int used;
 
-  if (!write_header (file_name, USTAR_REGULAR, file_size,
-                     archive_fd, write_error))
+  if (!ustar_make_header (file_name, USTAR_REGULAR, file_size, buf))
     return false;
+  used = USTAR_HEADER_SIZE;
 
-  while (file_size > 0) 
+  do
     {
-      static char buf[512];
-      int chunk_size = file_size > 512 ? 512 : file_size;
-      int read_retval = read (file_fd, buf, chunk_size);
-      int bytes_read = read_retval > 0 ? read_retval : 0;
+      int chunk_size = (file_size < CHUNK_SIZE - used
+                        ? file_size : CHUNK_SIZE - used);
 
-      if (bytes_read != chunk_size && !read_error) 
+      if (chunk_size > 0)
         {
-          printf ("%s: read error\n", file_name);
-          read_error = true;
-          success = false;
+          int read_retval = read (file_fd, buf + used, chunk_size);
+          int bytes_read = read_retval > 0 ? read_retval : 0;
+
+          if (bytes_read != chunk_size && !read_error) 
+            {
+              printf ("%s: read error\n", file_name);
+              read_error = true;
+              success = false;
+            }
+
+          /* Pad the last block of the file with zeros. */
+          memset (buf + used + bytes_read, 0,
+                  ROUND_UP (chunk_size, USTAR_HEADER_SIZE) - bytes_read);
+          used += ROUND_UP (chunk_size, USTAR_HEADER_SIZE);
+          file_size -= chunk_size;
         }
 
-      memset (buf + bytes_read, 0, 512 - bytes_read);
-      if (!do_write (archive_fd, buf, 512, write_error))
-        success = false;
-
-      file_size -= chunk_size;
+      if (!do_write (archive_fd, buf, used, write_error))
+        return false;
+      used = 0;
     }
+  while (file_size > 0);
 
   return success;
 }
@@ -0,0 +1,7 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+my ($disk) = join ('', map (chr (ord ('a') + $_ % 26), 0...5999));
+check_archive ({"disk" => [$disk], "tmp" => {}});
+pass;
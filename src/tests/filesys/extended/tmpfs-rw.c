@@ -0,0 +1,62 @@
+/* Runs with an in-memory file system mounted on /tmp.  Writes and
+   reads back a file there and one on disk, and walks in and out
+   of the mount.  tmpfs-rw-persistence checks that after a reboot
+   the disk file is there and /tmp is empty. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 6000
+
+/* Inode numbers of tmpfs files start here. */
+#define TMPFS_INUMBER_BASE 0x80000000u
+
+static char buf[FILE_SIZE];
+
+/* Creates FILE_NAME with the contents of buf and returns its
+   inode number. */
+static unsigned
+write_file (const char *file_name)
+{
+  unsigned ino;
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, FILE_SIZE) == FILE_SIZE, "write \"%s\"", file_name);
+  ino = inumber (fd);
+  close (fd);
+  check_file (file_name, buf, FILE_SIZE);
+  return ino;
+}
+
+void
+test_main (void)
+{
+  size_t i;
+  int fd;
+
+  for (i = 0; i < FILE_SIZE; i++)
+    buf[i] = 'a' + i % 26;
+
+  CHECK (write_file ("/tmp/a") >= TMPFS_INUMBER_BASE,
+         "\"/tmp/a\" is in the tmpfs");
+  CHECK (write_file ("disk") < TMPFS_INUMBER_BASE, "\"disk\" is on disk");
+
+  CHECK (mkdir ("/tmp/d"), "mkdir \"/tmp/d\"");
+  CHECK (chdir ("/tmp/d"), "chdir \"/tmp/d\"");
+  CHECK (create ("b", 512), "create \"b\"");
+  CHECK ((fd = open ("../a")) > 1, "open \"../a\"");
+  check_file_handle (fd, "../a", buf, FILE_SIZE);
+  close (fd);
+
+  CHECK (chdir ("../.."), "chdir \"../..\"");
+  CHECK ((fd = open ("disk")) > 1, "open \"disk\" from the root");
+  close (fd);
+
+  CHECK (!remove ("/tmp"), "remove \"/tmp\" (must fail)");
+  CHECK (remove ("/tmp/a"), "remove \"/tmp/a\"");
+  CHECK (open ("/tmp/a") == -1, "open \"/tmp/a\" (must fail)");
+}
@@ -0,0 +1,33 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(tmpfs-rw) begin
+(tmpfs-rw) create "/tmp/a"
+(tmpfs-rw) open "/tmp/a"
+(tmpfs-rw) write "/tmp/a"
+(tmpfs-rw) open "/tmp/a" for verification
+(tmpfs-rw) verified contents of "/tmp/a"
+(tmpfs-rw) close "/tmp/a"
+(tmpfs-rw) "/tmp/a" is in the tmpfs
+(tmpfs-rw) create "disk"
+(tmpfs-rw) open "disk"
+(tmpfs-rw) write "disk"
+(tmpfs-rw) open "disk" for verification
+(tmpfs-rw) verified contents of "disk"
+(tmpfs-rw) close "disk"
+(tmpfs-rw) "disk" is on disk
+(tmpfs-rw) mkdir "/tmp/d"
+(tmpfs-rw) chdir "/tmp/d"
+(tmpfs-rw) create "b"
+(tmpfs-rw) open "../a"
+(tmpfs-rw) verified contents of "../a"
+(tmpfs-rw) chdir "../.."
+(tmpfs-rw) open "disk" from the root
+(tmpfs-rw) remove "/tmp" (must fail)
+(tmpfs-rw) remove "/tmp/a"
+(tmpfs-rw) open "/tmp/a" (must fail)
+(tmpfs-rw) end
+EOF
+pass;
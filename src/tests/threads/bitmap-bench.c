@@ -0,0 +1,108 @@
+/* Compares the word-at-a-time bitmap_count() and bitmap_scan()
+   against bit-at-a-time loops over bitmap_test(), on a bitmap
+   the size of the free map of an 8 MB disk, mostly allocated
+   with scattered free runs.  Checks that both give the same
+   answers.
+
+   The cycle counts vary between runs and machines, so they are
+   reported but not checked. */
+
+#include <bitmap.h>
+#include <random.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "tests/threads/tests.h"
+
+/* One bit per 512-byte sector of an 8 MB disk. */
+#define BIT_CNT (8 * 1024 * 1024 / 512)
+
+/* Returns the CPU's time-stamp counter. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint32_t lo, hi;
+  asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+}
+
+static size_t
+bit_count (const struct bitmap *b, bool value)
+{
+  size_t i, cnt = 0;
+
+  for (i = 0; i < bitmap_size (b); i++)
+    if (bitmap_test (b, i) == value)
+      cnt++;
+  return cnt;
+}
+
+static size_t
+bit_scan (const struct bitmap *b, size_t cnt, bool value)
+{
+  size_t i, run = 0;
+
+  for (i = 0; i < bitmap_size (b); i++)
+    if (bitmap_test (b, i) != value)
+      run = 0;
+    else if (++run == cnt)
+      return i + 1 - cnt;
+  return BITMAP_ERROR;
+}
+
+static void
+bench_scan (const struct bitmap *b, size_t cnt)
+{
+  uint64_t start, bitwise, wordwise;
+  size_t r1, r2;
+
+  start = rdtsc ();
+  r1 = bit_scan (b, cnt, false);
+  bitwise = rdtsc () - start;
+  start = rdtsc ();
+  r2 = bitmap_scan (b, 0, cnt, false);
+  wordwise = rdtsc () - start;
+  if (r1 != r2)
+    fail ("bitmap_scan for %zu free bits found %zu, expected %zu",
+          cnt, r2, r1);
+  msg ("scan %zu: %d cycles bitwise, %d cycles wordwise.", cnt,
+       (int) bitwise, (int) wordwise);
+}
+
+void
+test_bitmap_bench (void) 
+{
+  struct bitmap *b = bitmap_create (BIT_CNT);
+  uint64_t start, bitwise, wordwise;
+  size_t i, r1, r2;
+
+  if (b == NULL)
+    fail ("bitmap_create failed");
+
+  /* Allocate everything, then free short runs at random places,
+     and one long run near the end. */
+  random_init (0);
+  bitmap_set_all (b, true);
+  for (i = 0; i < 200; i++)
+    {
+      size_t ofs = random_ulong () % (BIT_CNT - 16);
+      bitmap_set_multiple (b, ofs, 1 + random_ulong () % 12, false);
+    }
+  bitmap_set_multiple (b, BIT_CNT - 200, 100, false);
+
+  start = rdtsc ();
+  r1 = bit_count (b, false);
+  bitwise = rdtsc () - start;
+  start = rdtsc ();
+  r2 = bitmap_count (b, 0, BIT_CNT, false);
+  wordwise = rdtsc () - start;
+  if (r1 != r2)
+    fail ("bitmap_count found %zu free bits, expected %zu", r2, r1);
+  msg ("count: %d cycles bitwise, %d cycles wordwise.",
+       (int) bitwise, (int) wordwise);
+
+  bench_scan (b, 1);
+  bench_scan (b, 8);
+  bench_scan (b, 64);
+
+  bitmap_destroy (b);
+}
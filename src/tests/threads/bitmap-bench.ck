@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+
+# Cycle counts vary, so check only the shape of the report.
+my (@lines) = map (/^\(bitmap-bench\) (count|scan \d+): \d+ cycles bitwise, \d+ cycles wordwise\.$/, @output);
+fail "missing or malformed benchmark lines\n"
+  if join (', ', @lines) ne "count, scan 1, scan 8, scan 64";
+pass;
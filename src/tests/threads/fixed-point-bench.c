@@ -0,0 +1,206 @@
+/* Compares the 17.14 fixed-point arithmetic in
+   threads/fixed_point.h, which the MLFQS scheduler does in the
+   timer interrupt, against the 64-bit 16.16 arithmetic it
+   replaced, whose divisions went through __divdi3().  Each is
+   timed with interrupts off, as in the interrupt handler, over
+   the multiplies, the divides, and whole simulated seconds of
+   load_avg and recent_cpu updates, and the two are checked to
+   give the same load_avg and recent_cpu to the hundredth
+   reported by thread_get_load_avg() and
+   thread_get_recent_cpu(), give or take rounding.
+
+   The cycle counts vary between runs and machines, so they are
+   reported but not checked. */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "tests/threads/tests.h"
+#include "threads/fixed_point.h"
+#include "threads/interrupt.h"
+
+/* Operations or seconds each measurement covers. */
+#define ROUNDS 256
+
+/* The replaced arithmetic: 64-bit numbers with 16 fraction
+   bits. */
+typedef int64_t wide_t;
+#define WIDE_SHIFT 16
+#define WIDE_FROM_INT(n) ((wide_t) (n) << WIDE_SHIFT)
+#define WIDE_MULT(a, b) ((wide_t) (a) * (b) >> WIDE_SHIFT)
+#define WIDE_DIV(a, b) (((wide_t) (a) << WIDE_SHIFT) / (b))
+
+/* Returns the CPU's time-stamp counter. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint32_t lo, hi;
+  asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+}
+
+/* Simulated scheduler state after a second. */
+struct second
+  {
+    int load_avg;               /* 100 times load_avg, rounded. */
+    int recent_cpu;             /* 100 times recent_cpu, rounded. */
+  };
+
+/* Number of ready threads in simulated second I. */
+static int
+ready_threads (int i)
+{
+  return (i * 7) % 16;
+}
+
+/* Returns WIDE times 100, rounded to nearest. */
+static int
+wide_hundredths (wide_t wide)
+{
+  wide *= 100;
+  return (wide >= 0 ? wide + (1 << (WIDE_SHIFT - 1))
+          : wide - (1 << (WIDE_SHIFT - 1))) >> WIDE_SHIFT;
+}
+
+/* Runs ROUNDS seconds of load_avg and recent_cpu updates for a
+   thread of the given NICE, in 64-bit arithmetic, into SECONDS.
+   Returns the cycles taken. */
+static uint64_t
+wide_seconds (int nice, struct second seconds[])
+{
+  wide_t load_avg = 0, recent_cpu = 0;
+  uint64_t start, cycles = 0;
+  int i;
+
+  for (i = 0; i < ROUNDS; i++)
+    {
+      wide_t coefficient;
+
+      start = rdtsc ();
+      load_avg = (WIDE_MULT (WIDE_FROM_INT (59) / 60, load_avg)
+                  + WIDE_FROM_INT (1) / 60 * ready_threads (i));
+      coefficient = WIDE_DIV (load_avg * 2, load_avg * 2 + WIDE_FROM_INT (1));
+      recent_cpu = WIDE_MULT (coefficient, recent_cpu) + WIDE_FROM_INT (nice);
+      cycles += rdtsc () - start;
+
+      seconds[i].load_avg = wide_hundredths (load_avg);
+      seconds[i].recent_cpu = wide_hundredths (recent_cpu);
+    }
+  return cycles;
+}
+
+/* Same as wide_seconds(), in the arithmetic of
+   threads/fixed_point.h. */
+static uint64_t
+fixed_seconds (int nice, struct second seconds[])
+{
+  fixed_t load_avg = 0, recent_cpu = 0;
+  uint64_t start, cycles = 0;
+  int i;
+
+  for (i = 0; i < ROUNDS; i++)
+    {
+      fixed_t coefficient;
+
+      start = rdtsc ();
+      load_avg = (MULT (DIV_INT (CONVERT_TO_FP (59), 60), load_avg)
+                  + MULT_INT (DIV_INT (CONVERT_TO_FP (1), 60),
+                              ready_threads (i)));
+      coefficient = DIV (MULT_INT (load_avg, 2),
+                         ADD_INT (MULT_INT (load_avg, 2), 1));
+      recent_cpu = ADD_INT (MULT (coefficient, recent_cpu), nice);
+      cycles += rdtsc () - start;
+
+      seconds[i].load_avg = CONVERT_TO_INT_ROUND (MULT_INT (load_avg, 100));
+      seconds[i].recent_cpu = CONVERT_TO_INT_ROUND (MULT_INT (recent_cpu, 100));
+    }
+  return cycles;
+}
+
+/* Returns true if A and B are within TOLERANCE of each other, or
+   of TOLERANCE percent of the larger in magnitude, whichever is
+   more. */
+static bool
+close_enough (int a, int b, int tolerance)
+{
+  int diff = a > b ? a - b : b - a;
+  int big = a < 0 ? -a : a;
+  if (big < (b < 0 ? -b : b))
+    big = b < 0 ? -b : b;
+  return diff <= tolerance || diff * 100 <= big * tolerance;
+}
+
+static void
+report (const char *name, uint64_t wide, uint64_t fixed)
+{
+  msg ("%s: %d cycles 64-bit, %d cycles 32-bit.", name,
+       (int) (wide / ROUNDS), (int) (fixed / ROUNDS));
+}
+
+void
+test_fixed_point_bench (void)
+{
+  static struct second wide[ROUNDS], fixed[ROUNDS];
+  /* Operands as they come up: load_avg, recent_cpu, and
+     coefficients, in each format. */
+  static wide_t wa[ROUNDS], wb[ROUNDS];
+  static fixed_t fa[ROUNDS], fb[ROUNDS];
+  volatile wide_t wide_sink;
+  volatile fixed_t fixed_sink;
+  enum intr_level old_level;
+  uint64_t start, cycles[3][2];
+  int i, nice, bad = -1;
+
+  for (i = 0; i < ROUNDS; i++)
+    {
+      int real = i % 64 + 1, frac = i * 37 % 100;
+      wa[i] = WIDE_FROM_INT (real) + WIDE_FROM_INT (frac) / 100;
+      wb[i] = WIDE_FROM_INT (1) - WIDE_FROM_INT (i % 16) / 64;
+      fa[i] = CONVERT_TO_FP (real) + CONVERT_TO_FP (frac) / 100;
+      fb[i] = CONVERT_TO_FP (1) - CONVERT_TO_FP (i % 16) / 64;
+    }
+
+  old_level = intr_disable ();
+
+  start = rdtsc ();
+  for (i = 0; i < ROUNDS; i++)
+    wide_sink = WIDE_MULT (wa[i], wb[i]);
+  cycles[0][0] = rdtsc () - start;
+  start = rdtsc ();
+  for (i = 0; i < ROUNDS; i++)
+    fixed_sink = MULT (fa[i], fb[i]);
+  cycles[0][1] = rdtsc () - start;
+
+  start = rdtsc ();
+  for (i = 0; i < ROUNDS; i++)
+    wide_sink = WIDE_DIV (wb[i], wa[i]);
+  cycles[1][0] = rdtsc () - start;
+  start = rdtsc ();
+  for (i = 0; i < ROUNDS; i++)
+    fixed_sink = DIV (fb[i], fa[i]);
+  cycles[1][1] = rdtsc () - start;
+
+  cycles[2][0] = cycles[2][1] = 0;
+  for (nice = -20; bad < 0 && nice <= 20; nice += 10)
+    {
+      cycles[2][0] += wide_seconds (nice, wide);
+      cycles[2][1] += fixed_seconds (nice, fixed);
+      for (i = 0; bad < 0 && i < ROUNDS; i++)
+        if (!close_enough (wide[i].load_avg, fixed[i].load_avg, 1)
+            || !close_enough (wide[i].recent_cpu, fixed[i].recent_cpu, 1))
+          bad = i;
+    }
+
+  intr_set_level (old_level);
+  (void) wide_sink;
+  (void) fixed_sink;
+
+  if (bad >= 0)
+    fail ("nice %d, second %d: load_avg %d and recent_cpu %d in "
+          "64-bit, but %d and %d in 32-bit", nice - 10, bad,
+          wide[bad].load_avg, wide[bad].recent_cpu,
+          fixed[bad].load_avg, fixed[bad].recent_cpu);
+  report ("multiply", cycles[0][0], cycles[0][1]);
+  report ("divide", cycles[1][0], cycles[1][1]);
+  report ("scheduler second", cycles[2][0] / 5, cycles[2][1] / 5);
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+
+# Cycle counts vary, so check only the shape of the report.
+my (@counts) = map (/^\(priority-sema-bench\) (\d+) waiters: \d+ cycles per wake\.$/, @output);
+fail "missing or malformed benchmark lines\n"
+  if join (' ', @counts) ne "4 16 64 256";
+pass;
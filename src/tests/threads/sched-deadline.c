@@ -0,0 +1,87 @@
+/* Checks the deadline class.  A thread that reserves part of
+   every period gets it, at the lowest priority, while a thread
+   of high priority spins; and admission control refuses
+   reservations out of range or larger than the CPU has left. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* The deadline thread's reservation, and how many periods it
+   checks that it runs in. */
+#define RUNTIME 3
+#define PERIOD 10
+#define PERIODS 10
+
+static thread_func deadline_thread, spinner_thread;
+static struct semaphore start, done, spun;
+static volatile bool stop;
+static int periods_run;
+
+static void
+reserve (int runtime, int period)
+{
+  msg ("%s %d of every %d ticks.",
+       thread_set_reservation (runtime, period) ? "reserved" : "refused",
+       runtime, period);
+}
+
+void
+test_sched_deadline (void) 
+{
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  reserve (5, 10);
+  reserve (10, 10);
+  reserve (11, 10);
+  reserve (0, 0);
+
+  sema_init (&start, 0);
+  sema_init (&done, 0);
+  sema_init (&spun, 0);
+  thread_create ("deadline", PRI_DEFAULT + 1, deadline_thread, NULL);
+  reserve (7, 10);
+  thread_set_priority (PRI_MAX);
+  thread_create ("spinner", PRI_MAX - 1, spinner_thread, NULL);
+  sema_up (&start);
+  sema_down (&done);
+  stop = true;
+  sema_down (&spun);
+  thread_set_priority (PRI_DEFAULT);
+
+  msg ("deadline thread ran in %d of %d periods.", periods_run, PERIODS);
+}
+
+static void
+deadline_thread (void *aux UNUSED) 
+{
+  bool ran[PERIODS] = { false };
+  int64_t begin, now;
+  int i;
+
+  reserve (RUNTIME, PERIOD);
+  thread_set_priority (PRI_MIN);
+  sema_down (&start);
+
+  /* The spinner outranks us, so only the reservation lets us
+     see each stretch of PERIOD ticks. */
+  begin = timer_ticks ();
+  while ((now = timer_ticks ()) < begin + PERIODS * PERIOD)
+    ran[(now - begin) / PERIOD] = true;
+  for (i = 0; i < PERIODS; i++)
+    periods_run += ran[i];
+  sema_up (&done);
+}
+
+static void
+spinner_thread (void *aux UNUSED) 
+{
+  while (!stop)
+    barrier ();
+  sema_up (&spun);
+}
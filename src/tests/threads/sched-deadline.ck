@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(sched-deadline) begin
+(sched-deadline) reserved 5 of every 10 ticks.
+(sched-deadline) refused 10 of every 10 ticks.
+(sched-deadline) refused 11 of every 10 ticks.
+(sched-deadline) reserved 0 of every 0 ticks.
+(sched-deadline) reserved 3 of every 10 ticks.
+(sched-deadline) refused 7 of every 10 ticks.
+(sched-deadline) deadline thread ran in 10 of 10 periods.
+(sched-deadline) end
+EOF
+pass;
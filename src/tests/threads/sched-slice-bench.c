@@ -0,0 +1,103 @@
+/* Measures the trade-off the time slice makes between throughput
+   and latency.  Several CPU-bound threads at one low priority
+   spin side by side for a while, counting loop iterations and
+   noting the longest time each went without the CPU.  A longer
+   slice switches less often, so more iterations get done, but
+   each thread waits longer for its turn; the mixed setting gives
+   long slices to the low priority the spinners use while keeping
+   high priorities on short ones.
+
+   The counts vary between runs and machines, so they are
+   reported but not checked; the test checks that every spinner
+   ran. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Spinning threads, and their priority. */
+#define SPINNERS 4
+#define SPIN_PRI (PRI_MIN + 1)
+
+/* Ticks the spinners run per measurement. */
+#define MEASURE_TICKS 200
+
+static thread_func spinner_thread;
+static struct semaphore done;
+static volatile bool stop;
+
+/* The spinners' results. */
+static unsigned loops[SPINNERS];
+static int64_t max_wait[SPINNERS];
+
+static void
+bench (int high, int low)
+{
+  unsigned total = 0;
+  int64_t wait = 0;
+  int i;
+
+  if (!thread_set_time_slice (high, low))
+    fail ("time slice %d,%d rejected", high, low);
+
+  /* The spinners start once this thread sleeps. */
+  sema_init (&done, 0);
+  stop = false;
+  thread_set_priority (PRI_MAX);
+  for (i = 0; i < SPINNERS; i++)
+    thread_create ("spinner", SPIN_PRI, spinner_thread,
+                   (void *) (intptr_t) i);
+  timer_sleep (MEASURE_TICKS);
+  stop = true;
+  for (i = 0; i < SPINNERS; i++)
+    sema_down (&done);
+  thread_set_priority (PRI_DEFAULT);
+
+  for (i = 0; i < SPINNERS; i++)
+    {
+      if (loops[i] == 0)
+        fail ("spinner %d never ran", i);
+      total += loops[i];
+      if (max_wait[i] > wait)
+        wait = max_wait[i];
+    }
+  msg ("slice %d,%d: %u-tick slices, %u loops per tick, %d ticks max wait.",
+       high, low, thread_time_slice (SPIN_PRI), total / MEASURE_TICKS,
+       (int) wait);
+}
+
+void
+test_sched_slice_bench (void) 
+{
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  bench (1, 1);
+  bench (4, 4);
+  bench (16, 16);
+  bench (2, 16);
+  thread_set_time_slice (4, 4);
+}
+
+static void
+spinner_thread (void *i_) 
+{
+  int i = (intptr_t) i_;
+  int64_t last = timer_ticks ();
+
+  loops[i] = 0;
+  max_wait[i] = 0;
+  while (!stop)
+    {
+      int64_t now = timer_ticks ();
+      if (now - last > max_wait[i])
+        max_wait[i] = now - last;
+      last = now;
+      loops[i]++;
+    }
+  sema_up (&done);
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+
+# Counts vary, so check only the shape of the report.
+my (@slices) = map (/^\(sched-slice-bench\) slice (\d+,\d+): \d+-tick slices, \d+ loops per tick, \d+ ticks max wait\.$/, @output);
+fail "missing or malformed benchmark lines\n"
+  if join (' ', @slices) ne "1,1 4,4 16,16 2,16";
+pass;
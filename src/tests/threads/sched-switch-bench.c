@@ -0,0 +1,148 @@
+/* Measures the cost of a context switch as the number of other
+   threads grows.  Two threads ping-pong over a pair of
+   semaphores, switching twice per round, while N other threads
+   are either blocked on a semaphore or ready to run at a lower
+   priority.  A scheduler whose switch path scans all threads or
+   the ready list slows down as N grows; one that picks the next
+   thread in constant time stays flat.
+
+   The cycle counts include the semaphore operations and vary
+   between runs and machines, so they are reported but not
+   checked; the test checks that every round completes. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Ping-pong rounds timed per measurement. */
+#define ROUNDS 5000
+
+static thread_func pong_thread, parked_thread, ready_thread;
+static struct semaphore ping, pong, park, parked, done;
+static int exited;
+
+/* Times ROUNDS round trips between this thread and a partner,
+   and returns the average cycles per switch. */
+static int
+ping_pong (void)
+{
+  uint64_t start, cycles;
+  int i;
+
+  sema_init (&ping, 0);
+  sema_init (&pong, 0);
+  sema_init (&done, 0);
+
+  /* Run at the partner's priority, above the threads being
+     counted, so neither of us is preempted by them. */
+  thread_set_priority (PRI_DEFAULT + 1);
+  thread_create ("pong", PRI_DEFAULT + 1, pong_thread, NULL);
+
+  start = timer_tsc ();
+  for (i = 0; i < ROUNDS; i++)
+    {
+      sema_up (&ping);
+      sema_down (&pong);
+    }
+  cycles = timer_tsc () - start;
+
+  sema_down (&done);
+  thread_set_priority (PRI_DEFAULT);
+  return cycles / (2 * ROUNDS);
+}
+
+/* Measures switches with THREAD_CNT other threads blocked. */
+static void
+bench_blocked (int thread_cnt)
+{
+  int cycles;
+  int i;
+
+  sema_init (&park, 0);
+  sema_init (&parked, 0);
+  exited = 0;
+  for (i = 0; i < thread_cnt; i++)
+    thread_create ("parked", PRI_DEFAULT + 1, parked_thread, NULL);
+  for (i = 0; i < thread_cnt; i++)
+    sema_down (&parked);
+
+  cycles = ping_pong ();
+
+  for (i = 0; i < thread_cnt; i++)
+    sema_up (&park);
+  thread_set_priority (PRI_MIN);
+  thread_set_priority (PRI_DEFAULT);
+
+  if (exited != thread_cnt)
+    fail ("%d of %d blocked threads exited", exited, thread_cnt);
+  msg ("%d blocked: %d cycles per switch.", thread_cnt, cycles);
+}
+
+/* Measures switches with THREAD_CNT other threads ready. */
+static void
+bench_ready (int thread_cnt)
+{
+  int cycles;
+  int i;
+
+  /* The ready threads are created at our priority, so they wait
+     in the ready list until we drop below them. */
+  exited = 0;
+  for (i = 0; i < thread_cnt; i++)
+    thread_create ("ready", PRI_DEFAULT, ready_thread, NULL);
+
+  cycles = ping_pong ();
+
+  thread_set_priority (PRI_MIN);
+  thread_set_priority (PRI_DEFAULT);
+
+  if (exited != thread_cnt)
+    fail ("%d of %d ready threads exited", exited, thread_cnt);
+  msg ("%d ready: %d cycles per switch.", thread_cnt, cycles);
+}
+
+void
+test_sched_switch_bench (void) 
+{
+  static const int counts[] = {0, 16, 64, 256};
+  size_t i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  for (i = 0; i < sizeof counts / sizeof *counts; i++)
+    bench_blocked (counts[i]);
+  for (i = 0; i < sizeof counts / sizeof *counts; i++)
+    bench_ready (counts[i]);
+}
+
+static void
+pong_thread (void *aux UNUSED) 
+{
+  int i;
+
+  for (i = 0; i < ROUNDS; i++)
+    {
+      sema_down (&ping);
+      sema_up (&pong);
+    }
+  sema_up (&done);
+}
+
+static void
+parked_thread (void *aux UNUSED) 
+{
+  sema_up (&parked);
+  sema_down (&park);
+  exited++;
+}
+
+static void
+ready_thread (void *aux UNUSED) 
+{
+  exited++;
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+
+# Cycle counts vary, so check only the shape of the report.
+my (@lines) = map (/^\(sched-switch-bench\) (\d+ \w+): \d+ cycles per switch\.$/, @output);
+fail "missing or malformed benchmark lines\n"
+  if join (', ', @lines) ne join (', ', (map ("$_ blocked", 0, 16, 64, 256),
+                                         map ("$_ ready", 0, 16, 64, 256)));
+pass;
@@ -0,0 +1,93 @@
+/* Measures the time the timer interrupt takes from a running
+   thread, as the number of sleeping threads grows.  The main
+   thread spins reading the cycle counter at top priority; any
+   gap between two reads much longer than one loop iteration is
+   time taken by an interrupt, which here is almost always the
+   timer tick.  The sleepers' wake-ups are all due after the
+   measurement, so a timer that looks at every sleeper on each
+   tick slows down as their number grows, while one that looks
+   only at the events due now stays flat.
+
+   The cycle counts vary between runs and machines, so they are
+   reported but not checked; the test checks that every sleeper
+   woke up. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Ticks spun through per measurement. */
+#define MEASURE_TICKS 50
+
+/* Shortest gap between two reads of the cycle counter taken to
+   be an interrupt. */
+#define GAP_CYCLES 1000
+
+static thread_func sleeper_thread;
+static struct semaphore woken;
+static int64_t wake_base;
+
+static void
+bench (int sleeper_cnt)
+{
+  uint64_t last, stolen;
+  int64_t start, end;
+  int i;
+
+  /* The sleepers run at once and go to sleep, spread over a few
+     ticks after the measurement ends, leaving some ticks to
+     create them all. */
+  sema_init (&woken, 0);
+  wake_base = timer_ticks () + MEASURE_TICKS + 10;
+  for (i = 0; i < sleeper_cnt; i++)
+    thread_create ("sleeper", PRI_DEFAULT + 1, sleeper_thread,
+                   (void *) (intptr_t) i);
+
+  /* Spin from one tick boundary to another. */
+  thread_set_priority (PRI_MAX);
+  start = timer_ticks ();
+  while (timer_ticks () == start)
+    barrier ();
+  start = timer_ticks ();
+  end = start + MEASURE_TICKS;
+  stolen = 0;
+  last = timer_tsc ();
+  while (timer_ticks () < end)
+    {
+      uint64_t now = timer_tsc ();
+      if (now - last >= GAP_CYCLES)
+        stolen += now - last;
+      last = now;
+    }
+  thread_set_priority (PRI_DEFAULT);
+
+  for (i = 0; i < sleeper_cnt; i++)
+    sema_down (&woken);
+  msg ("%d sleepers: %d cycles per tick.", sleeper_cnt,
+       (int) (stolen / MEASURE_TICKS));
+}
+
+void
+test_sched_tick_bench (void) 
+{
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  bench (0);
+  bench (16);
+  bench (64);
+  bench (256);
+}
+
+static void
+sleeper_thread (void *i_) 
+{
+  int i = (intptr_t) i_;
+
+  timer_sleep (wake_base + i % 8 - timer_ticks ());
+  sema_up (&woken);
+}
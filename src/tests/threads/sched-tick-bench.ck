@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+
+# Cycle counts vary, so check only the shape of the report.
+my (@counts) = map (/^\(sched-tick-bench\) (\d+) sleepers: \d+ cycles per tick\.$/, @output);
+fail "missing or malformed benchmark lines\n"
+  if join (' ', @counts) ne "0 16 64 256";
+pass;
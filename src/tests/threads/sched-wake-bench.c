@@ -0,0 +1,100 @@
+/* Measures how late threads wake up from timer_sleep() as the
+   number sleeping until the same tick grows.  Every sleeper asks
+   to wake at one tick boundary and, once running, notes how long
+   after that boundary it got the CPU.  The first to run shows the
+   latency of the tick and the switch to it; the last shows how
+   long the whole batch took to wake and be scheduled.
+
+   The latencies vary between runs and machines, so they are
+   reported but not checked; the test checks that every sleeper
+   woke up, and on or after its tick. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+/* Wake-ups measured per sleeper. */
+#define ROUNDS 5
+
+/* Ticks between rounds' wake-up times. */
+#define ROUND_TICKS 4
+
+#define NS_PER_TICK (1000000000 / TIMER_FREQ)
+
+static thread_func sleeper_thread;
+static struct semaphore done;
+static int64_t wake_base;
+static uint64_t total_ns, max_ns;
+static int early;
+
+static void
+bench (int sleeper_cnt)
+{
+  int i;
+
+  /* The sleepers run at once and go to sleep, leaving some ticks
+     to create them all before the first wake-up. */
+  sema_init (&done, 0);
+  total_ns = max_ns = 0;
+  early = 0;
+  wake_base = timer_ticks () + 10;
+  for (i = 0; i < sleeper_cnt; i++)
+    thread_create ("sleeper", PRI_DEFAULT + 1, sleeper_thread, NULL);
+  for (i = 0; i < sleeper_cnt; i++)
+    sema_down (&done);
+
+  if (early > 0)
+    fail ("%d of %d wake-ups came early", early, sleeper_cnt * ROUNDS);
+  msg ("%d sleepers: %d us mean, %d us max wake latency.", sleeper_cnt,
+       (int) (total_ns / (sleeper_cnt * ROUNDS) / 1000),
+       (int) (max_ns / 1000));
+}
+
+void
+test_sched_wake_bench (void) 
+{
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  bench (1);
+  bench (16);
+  bench (64);
+  bench (256);
+}
+
+static void
+sleeper_thread (void *aux UNUSED) 
+{
+  int round;
+
+  for (round = 0; round < ROUNDS; round++)
+    {
+      int64_t wake = wake_base + round * ROUND_TICKS;
+      uint64_t due = (uint64_t) wake * NS_PER_TICK;
+      enum intr_level old_level;
+      uint64_t now;
+
+      timer_sleep (wake - timer_ticks ());
+
+      /* The nanosecond clock runs off the cycle counter, which
+         may drift a little from the tick count, so a reading
+         just before the due time counts as on time. */
+      old_level = intr_disable ();
+      now = timer_ns ();
+      if (timer_ticks () < wake)
+        early++;
+      else if (now > due)
+        {
+          total_ns += now - due;
+          if (now - due > max_ns)
+            max_ns = now - due;
+        }
+      intr_set_level (old_level);
+    }
+  sema_up (&done);
+}
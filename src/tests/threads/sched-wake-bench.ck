@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+
+# Latencies vary, so check only the shape of the report.
+my (@counts) = map (/^\(sched-wake-bench\) (\d+) sleepers: \d+ us mean, \d+ us max wake latency\.$/, @output);
+fail "missing or malformed benchmark lines\n"
+  if join (' ', @counts) ne "1 16 64 256";
+pass;
@@ -0,0 +1,127 @@
+/* Compares the word-wide memcpy(), memset() and memcmp() in
+   lib/string.c against plain byte-at-a-time loops, at the sizes
+   of a disk sector and of a page, and checks that both produce
+   the same results.
+
+   The cycle counts vary between runs and machines, so they are
+   reported but not checked. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Times each measurement repeats. */
+#define ROUNDS 64
+
+/* Returns the CPU's time-stamp counter. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint32_t lo, hi;
+  asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+}
+
+static void
+byte_memcpy (void *dst_, const void *src_, size_t size)
+{
+  unsigned char *dst = dst_;
+  const unsigned char *src = src_;
+
+  while (size-- > 0)
+    *dst++ = *src++;
+}
+
+static void
+byte_memset (void *dst_, int value, size_t size)
+{
+  unsigned char *dst = dst_;
+
+  while (size-- > 0)
+    *dst++ = value;
+}
+
+static int
+byte_memcmp (const void *a_, const void *b_, size_t size)
+{
+  const unsigned char *a = a_;
+  const unsigned char *b = b_;
+
+  for (; size-- > 0; a++, b++)
+    if (*a != *b)
+      return *a > *b ? +1 : -1;
+  return 0;
+}
+
+static void
+report (const char *name, size_t size, uint64_t bytewise, uint64_t library)
+{
+  msg ("%s %zu bytes: %d cycles bytewise, %d cycles library.", name, size,
+       (int) (bytewise / ROUNDS), (int) (library / ROUNDS));
+}
+
+static void
+bench (uint8_t *a, uint8_t *b, size_t size)
+{
+  uint64_t start, bytewise, library;
+  int i, r1 = 0, r2 = 0;
+
+  start = rdtsc ();
+  for (i = 0; i < ROUNDS; i++)
+    byte_memcpy (b, a, size);
+  bytewise = rdtsc () - start;
+  start = rdtsc ();
+  for (i = 0; i < ROUNDS; i++)
+    memcpy (b, a, size);
+  library = rdtsc () - start;
+  if (byte_memcmp (a, b, size) != 0)
+    fail ("memcpy of %zu bytes produced a different copy", size);
+  report ("memcpy", size, bytewise, library);
+
+  start = rdtsc ();
+  for (i = 0; i < ROUNDS; i++)
+    r1 = byte_memcmp (a, b, size);
+  bytewise = rdtsc () - start;
+  start = rdtsc ();
+  for (i = 0; i < ROUNDS; i++)
+    r2 = memcmp (a, b, size);
+  library = rdtsc () - start;
+  if (r1 != 0 || r2 != 0)
+    fail ("memcmp of %zu equal bytes returned %d", size, r2);
+  b[size - 1] ^= 1;
+  if (memcmp (a, b, size) != byte_memcmp (a, b, size))
+    fail ("memcmp of %zu bytes disagrees on the last byte", size);
+  report ("memcmp", size, bytewise, library);
+
+  start = rdtsc ();
+  for (i = 0; i < ROUNDS; i++)
+    byte_memset (a, 0x5a, size);
+  bytewise = rdtsc () - start;
+  start = rdtsc ();
+  for (i = 0; i < ROUNDS; i++)
+    memset (b, 0x5a, size);
+  library = rdtsc () - start;
+  if (byte_memcmp (a, b, size) != 0)
+    fail ("memset of %zu bytes produced different contents", size);
+  report ("memset", size, bytewise, library);
+}
+
+void
+test_string_bench (void) 
+{
+  uint8_t *a = palloc_get_page (PAL_ASSERT);
+  uint8_t *b = palloc_get_page (PAL_ASSERT);
+  size_t i;
+
+  for (i = 0; i < PGSIZE; i++)
+    a[i] = i * 7 + 3;
+
+  bench (a, b, 512);
+  bench (a, b, PGSIZE);
+
+  palloc_free_page (a);
+  palloc_free_page (b);
+}
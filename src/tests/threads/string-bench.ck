@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+
+# Cycle counts vary, so check only the shape of the report.
+my (@lines) = map (/^\(string-bench\) (\w+ \d+) bytes: \d+ cycles bytewise, \d+ cycles library\.$/, @output);
+fail "missing or malformed benchmark lines\n"
+  if join (', ', @lines) ne "memcpy 512, memcmp 512, memset 512, "
+                           . "memcpy 4096, memcmp 4096, memset 4096";
+pass;
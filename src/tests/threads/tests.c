@@ -29,6 +29,15 @@ static const struct test tests[] =
     {"priority-preempt", test_priority_preempt},
     {"priority-sema", test_priority_sema},
     {"priority-condvar", test_priority_condvar},
+    {"priority-sema-bench", test_priority_sema_bench},
+    {"string-bench", test_string_bench},
+    {"bitmap-bench", test_bitmap_bench},
+    {"fixed-point-bench", test_fixed_point_bench},
+    {"sched-switch-bench", test_sched_switch_bench},
+    {"sched-tick-bench", test_sched_tick_bench},
+    {"sched-wake-bench", test_sched_wake_bench},
+    {"sched-slice-bench", test_sched_slice_bench},
+    {"sched-deadline", test_sched_deadline},
     {"mlfqs-load-1", test_mlfqs_load_1},
     {"mlfqs-load-60", test_mlfqs_load_60},
     {"mlfqs-load-avg", test_mlfqs_load_avg},
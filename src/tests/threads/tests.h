@@ -23,6 +23,15 @@ extern test_func test_priority_fifo;
 extern test_func test_priority_preempt;
 extern test_func test_priority_sema;
 extern test_func test_priority_condvar;
+extern test_func test_priority_sema_bench;
+extern test_func test_string_bench;
+extern test_func test_bitmap_bench;
+extern test_func test_fixed_point_bench;
+extern test_func test_sched_switch_bench;
+extern test_func test_sched_tick_bench;
+extern test_func test_sched_wake_bench;
+extern test_func test_sched_slice_bench;
+extern test_func test_sched_deadline;
 extern test_func test_mlfqs_load_1;
 extern test_func test_mlfqs_load_60;
 extern test_func test_mlfqs_load_avg;
@@ -0,0 +1,79 @@
+/* Has several threads add to a counter under a lock built on
+   futex_wait() and futex_wake().  Each increment is a slow read,
+   delay and write, so the threads are preempted holding the lock
+   and contend for it.  No increment may be lost. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define THREAD_CNT 4
+#define ITERATIONS 2000
+#define STACK_SIZE 4096
+
+static char stacks[THREAD_CNT][STACK_SIZE];
+
+/* The lock: 0 if free, 1 if held, 2 if held with waiters. */
+static int lock;
+static volatile int counter;
+
+static void
+mutex_lock (void)
+{
+  int c = __sync_val_compare_and_swap (&lock, 0, 1);
+
+  if (c == 0)
+    return;
+  if (c != 2)
+    c = __sync_lock_test_and_set (&lock, 2);
+  while (c != 0)
+    {
+      futex_wait (&lock, 2);
+      c = __sync_lock_test_and_set (&lock, 2);
+    }
+}
+
+static void
+mutex_unlock (void)
+{
+  if (__sync_fetch_and_sub (&lock, 1) != 1)
+    {
+      lock = 0;
+      futex_wake (&lock, 1);
+    }
+}
+
+static void
+add (void *aux UNUSED)
+{
+  int i;
+
+  for (i = 0; i < ITERATIONS; i++)
+    {
+      volatile int delay;
+      int value;
+
+      mutex_lock ();
+      value = counter;
+      for (delay = 0; delay < 100; delay++)
+        continue;
+      counter = value + 1;
+      mutex_unlock ();
+    }
+}
+
+void
+test_main (void)
+{
+  uthread_t tids[THREAD_CNT];
+  int i;
+
+  for (i = 0; i < THREAD_CNT; i++)
+    CHECK ((tids[i] = uthread_create (add, NULL, stacks[i], STACK_SIZE))
+           != UTHREAD_ERROR, "create thread %d", i);
+  for (i = 0; i < THREAD_CNT; i++)
+    CHECK (uthread_join (tids[i]) == 0, "join thread %d", i);
+  if (counter != THREAD_CNT * ITERATIONS)
+    fail ("counter is %d, not %d", counter, THREAD_CNT * ITERATIONS);
+  msg ("counter is %d", counter);
+}
@@ -0,0 +1,60 @@
+/* Has several threads each wait on a futex of its own, the words
+   of one array, and wakes them one at a time in reverse order.  A
+   wake must reach only the waiters of its own address, however
+   the addresses share wait queues in the kernel. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define THREAD_CNT 8
+#define STACK_SIZE 4096
+
+static char stacks[THREAD_CNT][STACK_SIZE];
+static int words[THREAD_CNT];
+static int wakes[THREAD_CNT];
+static volatile int ready;
+static int unused;
+
+static void
+waiter (void *i_)
+{
+  int i = *(int *) i_;
+
+  __sync_fetch_and_add (&ready, 1);
+  while (words[i] == 0)
+    if (futex_wait (&words[i], 0))
+      wakes[i]++;
+}
+
+void
+test_main (void)
+{
+  uthread_t tids[THREAD_CNT];
+  int ids[THREAD_CNT];
+  int i;
+
+  CHECK (!futex_wait (&words[0], 1), "futex_wait on a changed value");
+  CHECK (futex_wake (&unused, THREAD_CNT) == 0, "futex_wake with no waiters");
+
+  for (i = 0; i < THREAD_CNT; i++)
+    {
+      ids[i] = i;
+      CHECK ((tids[i] = uthread_create (waiter, &ids[i], stacks[i],
+                                        STACK_SIZE)) != UTHREAD_ERROR,
+             "create thread %d", i);
+    }
+  while (ready < THREAD_CNT)
+    continue;
+
+  for (i = THREAD_CNT - 1; i >= 0; i--)
+    {
+      words[i] = 1;
+      futex_wake (&words[i], THREAD_CNT);
+      CHECK (uthread_join (tids[i]) == 0, "wake and join thread %d", i);
+    }
+  for (i = 0; i < THREAD_CNT; i++)
+    if (wakes[i] > 1)
+      fail ("thread %d was woken %d times", i, wakes[i]);
+  msg ("each thread was woken only for its own futex");
+}
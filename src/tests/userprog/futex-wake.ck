@@ -0,0 +1,29 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(futex-wake) begin
+(futex-wake) futex_wait on a changed value
+(futex-wake) futex_wake with no waiters
+(futex-wake) create thread 0
+(futex-wake) create thread 1
+(futex-wake) create thread 2
+(futex-wake) create thread 3
+(futex-wake) create thread 4
+(futex-wake) create thread 5
+(futex-wake) create thread 6
+(futex-wake) create thread 7
+(futex-wake) wake and join thread 7
+(futex-wake) wake and join thread 6
+(futex-wake) wake and join thread 5
+(futex-wake) wake and join thread 4
+(futex-wake) wake and join thread 3
+(futex-wake) wake and join thread 2
+(futex-wake) wake and join thread 1
+(futex-wake) wake and join thread 0
+(futex-wake) each thread was woken only for its own futex
+(futex-wake) end
+futex-wake: exit(0)
+EOF
+pass;
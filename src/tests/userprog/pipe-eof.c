@@ -0,0 +1,24 @@
+/* Writes into a pipe and closes its write end.  The reader must
+   get the data back, then 0 for the end of the data, without
+   blocking. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  static const char data[] = "Hello, pipe!";
+  char buf[sizeof data];
+  int fds[2];
+
+  CHECK (pipe (fds), "pipe");
+  CHECK (write (fds[1], data, sizeof data) == sizeof data, "write");
+  close (fds[1]);
+  CHECK (read (fds[0], buf, sizeof buf) == sizeof data, "read");
+  compare_bytes (buf, data, sizeof data, 0, "pipe");
+  CHECK (read (fds[0], buf, sizeof buf) == 0, "read at end of data");
+  CHECK (read (fds[0], buf, sizeof buf) == 0, "read at end of data again");
+}
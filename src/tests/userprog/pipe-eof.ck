@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(pipe-eof) begin
+(pipe-eof) pipe
+(pipe-eof) write
+(pipe-eof) read
+(pipe-eof) read at end of data
+(pipe-eof) read at end of data again
+(pipe-eof) end
+pipe-eof: exit(0)
+EOF
+pass;
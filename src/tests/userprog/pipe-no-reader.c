@@ -0,0 +1,20 @@
+/* Closes a pipe's read end, then writes to its write end.  With
+   no reader left, the write must fail at once rather than block
+   or kill the process. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  char byte = 'x';
+  int fds[2];
+
+  CHECK (pipe (fds), "pipe");
+  CHECK (write (fds[0], &byte, 1) == -1, "write to the read end (must fail)");
+  close (fds[0]);
+  CHECK (write (fds[1], &byte, 1) == -1, "write with no reader (must fail)");
+  close (fds[1]);
+}
@@ -0,0 +1,41 @@
+/* Calls exit() from a thread other than the process's first,
+   while another thread spins in user mode and the first waits on
+   a futex that nobody wakes.  The whole process must exit, with
+   the status that thread passed. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define STACK_SIZE 4096
+
+static char stacks[2][STACK_SIZE];
+static volatile unsigned spins;
+static int never;
+
+static void
+spin (void *aux UNUSED)
+{
+  for (;;)
+    spins++;
+}
+
+static void
+quit (void *aux UNUSED)
+{
+  while (spins == 0)
+    continue;
+  msg ("thread: exit(57)");
+  exit (57);
+}
+
+void
+test_main (void)
+{
+  CHECK (uthread_create (spin, NULL, stacks[0], STACK_SIZE) != UTHREAD_ERROR,
+         "create spinning thread");
+  CHECK (uthread_create (quit, NULL, stacks[1], STACK_SIZE) != UTHREAD_ERROR,
+         "create exiting thread");
+  for (;;)
+    futex_wait (&never, 0);
+}
@@ -0,0 +1,47 @@
+/* Starts several threads in one process, each of which leaves a
+   result in memory they all share, and joins them.  Joining a
+   thread a second time must fail. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define THREAD_CNT 4
+#define STACK_SIZE 4096
+
+static char stacks[THREAD_CNT][STACK_SIZE];
+static int results[THREAD_CNT];
+
+static void
+square (void *i_)
+{
+  int *i = i_;
+
+  results[*i] = *i * *i + 1;
+}
+
+void
+test_main (void)
+{
+  int ids[THREAD_CNT];
+  uthread_t tids[THREAD_CNT];
+  int i;
+
+  for (i = 0; i < THREAD_CNT; i++)
+    {
+      ids[i] = i;
+      CHECK ((tids[i] = uthread_create (square, &ids[i], stacks[i],
+                                        STACK_SIZE)) != UTHREAD_ERROR,
+             "create thread %d", i);
+    }
+  for (i = 0; i < THREAD_CNT; i++)
+    CHECK (uthread_join (tids[i]) == 0, "join thread %d", i);
+
+  for (i = 0; i < THREAD_CNT; i++)
+    if (results[i] != i * i + 1)
+      fail ("thread %d left %d, not %d", i, results[i], i * i + 1);
+  msg ("results are in");
+
+  CHECK (uthread_join (tids[0]) == -1, "join thread 0 again (must fail)");
+  CHECK (uthread_join (gettid ()) == -1, "join self (must fail)");
+}
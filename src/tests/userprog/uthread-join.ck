@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(uthread-join) begin
+(uthread-join) create thread 0
+(uthread-join) create thread 1
+(uthread-join) create thread 2
+(uthread-join) create thread 3
+(uthread-join) join thread 0
+(uthread-join) join thread 1
+(uthread-join) join thread 2
+(uthread-join) join thread 3
+(uthread-join) results are in
+(uthread-join) join thread 0 again (must fail)
+(uthread-join) join self (must fail)
+(uthread-join) end
+uthread-join: exit(0)
+EOF
+pass;
@@ -0,0 +1,89 @@
+/* Reads a file with asynchronous reads into pages that came back
+   from swap, and so are clean and still have their swap slots,
+   then pushes those pages out again.  The reads fill the pages
+   through the kernel, not through the process's own mappings, but
+   eviction must still write the read data out rather than drop
+   it for the stale copy in swap. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (2 * 1024 * 1024)
+#define CHUNK_SIZE 4096
+#define CHUNK_CNT 4
+
+static struct aio_ring ring;
+static char chunk[CHUNK_SIZE];
+static char buf[SIZE];
+
+/* Touches every page of buf after the first CHUNK_CNT, so that
+   those are evicted. */
+static void
+sweep (void)
+{
+  size_t i;
+
+  for (i = CHUNK_CNT * CHUNK_SIZE; i < SIZE; i += 4096)
+    buf[i]++;
+}
+
+void
+test_main (void)
+{
+  struct vm_stats stats;
+  int fd, i;
+
+  CHECK (create ("aio", CHUNK_CNT * CHUNK_SIZE), "create \"aio\"");
+  CHECK ((fd = open ("aio")) > 1, "open \"aio\"");
+  for (i = 0; i < CHUNK_CNT; i++)
+    {
+      memset (chunk, 'a' + i, CHUNK_SIZE);
+      if (write (fd, chunk, CHUNK_SIZE) != CHUNK_SIZE)
+        fail ("write chunk %d", i);
+    }
+  CHECK (aio_setup (&ring), "aio_setup");
+
+  /* Fill the buffer, so that its first pages go to swap. */
+  memset (buf, 0x5a, SIZE);
+  msg ("fill buffer");
+
+  /* Read the file into those pages, one request each. */
+  for (i = 0; i < CHUNK_CNT; i++)
+    {
+      struct aio_sqe *sqe = &ring.sq[ring.sq_tail++ % AIO_RING_ENTRIES];
+
+      sqe->op = AIO_READ;
+      sqe->fd = fd;
+      sqe->buf = buf + i * CHUNK_SIZE;
+      sqe->len = CHUNK_SIZE;
+      sqe->pos = i * CHUNK_SIZE;
+      sqe->user_data = i;
+    }
+  for (i = 0; i < CHUNK_CNT; )
+    {
+      if (aio_enter (CHUNK_CNT - i) < 0)
+        fail ("aio_enter failed");
+      for (; ring.cq_head != ring.cq_tail; i++)
+        {
+          struct aio_cqe *cqe = &ring.cq[ring.cq_head++ % AIO_RING_ENTRIES];
+          if (cqe->res != CHUNK_SIZE)
+            fail ("read %u returned %d", cqe->user_data, cqe->res);
+        }
+    }
+  msg ("read %d chunks", CHUNK_CNT);
+
+  /* Push the pages read into out again, then bring them back. */
+  sweep ();
+  sweep ();
+  CHECK (vmstats (&stats) && stats.evictions > 0, "evict");
+  for (i = 0; i < CHUNK_CNT; i++)
+    {
+      memset (chunk, 'a' + i, CHUNK_SIZE);
+      compare_bytes (buf + i * CHUNK_SIZE, chunk, CHUNK_SIZE,
+                     i * CHUNK_SIZE, "aio");
+    }
+  msg ("read data survived eviction");
+  close (fd);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(aio-evict) begin
+(aio-evict) create "aio"
+(aio-evict) open "aio"
+(aio-evict) aio_setup
+(aio-evict) fill buffer
+(aio-evict) read 4 chunks
+(aio-evict) evict
+(aio-evict) read data survived eviction
+(aio-evict) end
+aio-evict: exit(0)
+EOF
+pass;
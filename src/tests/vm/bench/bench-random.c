@@ -0,0 +1,7 @@
+/* Sweeps the working set of a child process from well under to
+   about twice the usual user memory, reading its pages in a
+   random order, which shows how well the replacement policy
+   keeps the pages that are used again. */
+
+#define ORDER "random"
+#include "tests/vm/bench/sweep.inc"
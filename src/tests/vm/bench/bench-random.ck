@@ -0,0 +1,6 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::vm::bench::bench;
+check_vm_bench ('random', 32, 64, 128, 256, 512, 768);
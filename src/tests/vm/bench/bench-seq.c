@@ -0,0 +1,6 @@
+/* Sweeps the working set of a child process from well under to
+   about twice the usual user memory, reading its pages in
+   order. */
+
+#define ORDER "seq"
+#include "tests/vm/bench/sweep.inc"
@@ -0,0 +1,14 @@
+#ifndef TESTS_VM_BENCH_BENCH_H
+#define TESTS_VM_BENCH_BENCH_H
+
+/* Working-set sizes swept by bench-seq and bench-random, in
+   pages, smallest first. */
+#define WS_SIZES 32, 64, 128, 256, 512, 768
+#define WS_MAX_PAGES 768
+
+/* Passes over the working set after the first touch. */
+#define WS_PASSES 3
+
+#define PAGE_SIZE 4096
+
+#endif /* tests/vm/bench/bench.h */
@@ -0,0 +1,53 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+# Checks that child-ws reported a first touch and a pass in
+# ORDER for each working-set size, and writes a summary to
+# $test.summary: for each size, its share of the user pool
+# reported at boot, faults, evictions and swap traffic per
+# million cycles, followed by the run's timer ticks and block
+# device counts.  Cycle counts vary from run to run, so nothing
+# about the numbers themselves is checked.
+sub check_vm_bench {
+    my ($order, @sizes) = @_;
+    our ($test);
+    my (@output) = read_text_file ("$test.output");
+
+    common_checks ("run", @output);
+    my (@core) = get_core_output ("run", @output);
+
+    my ($user_pages) = map (/^(\d+) pages available in user pool\.$/, @output);
+    my (@summary, @seen);
+    for (@core) {
+	next if !/^\(child-ws\) (.*)$/;
+	my (%f) = map (split (/=/, $_, 2), split (' ', $1));
+	fail "malformed benchmark line: $_\n"
+	  if grep (!defined $f{$_},
+		   qw (pages phase minor major evictions swapped cycles));
+	push (@seen, "$f{pages} $f{phase}");
+	my ($mcycles) = $f{cycles} / 1e6 || 1e-6;
+	my ($faults) = $f{minor} + $f{major};
+	my ($line) = sprintf ("pages=%d", $f{pages});
+	$line .= sprintf (" user-pool=%.2f", $f{pages} / $user_pages)
+	  if $user_pages;
+	$line .= sprintf (" phase=%s faults/Mcycle=%.1f evictions/Mcycle=%.1f"
+			  . " swap-kB/Mcycle=%.1f",
+			  $f{phase}, $faults / $mcycles, $f{evictions} / $mcycles,
+			  ($f{major} + $f{evictions}) * 4 / $mcycles);
+	push (@summary, $line);
+    }
+    my (@expected) = map (("$_ touch", "$_ $order"), @sizes);
+    fail "missing benchmark lines\n"
+      if join (', ', @seen) ne join (', ', @expected);
+
+    push (@summary, grep (/^Timer: \d+ ticks$/, @output));
+    push (@summary, grep (/^\S+ \([^)]+\): \d+ reads, \d+ writes$/, @output));
+    open (SUMMARY, '>', "$test.summary") or die "$test.summary: create: $!\n";
+    print SUMMARY "$_\n" foreach @summary;
+    close (SUMMARY);
+    pass;
+}
+
+1;
@@ -0,0 +1,79 @@
+/* Child process for bench-seq and bench-random.
+   Touches each page of a working set of argv[1] pages, writing
+   it, and then reads one byte of each page WS_PASSES times over,
+   in order or, if argv[2] is "random", in a random order.
+   Reports the paging counters and CPU cycles of the first touch
+   and of the passes after it, so that a working set larger than
+   user memory shows its evictions and swap traffic. */
+
+#include <random.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/bench/bench.h"
+#include "tests/lib.h"
+
+const char *test_name = "child-ws";
+
+static char pages[WS_MAX_PAGES * PAGE_SIZE];
+
+static inline unsigned long long
+rdtsc (void)
+{
+  unsigned long long t;
+  asm volatile ("rdtsc" : "=A" (t));
+  return t;
+}
+
+/* Reports PHASE over PAGE_CNT pages, from the counters in BEFORE
+   to now, taking CYCLES cycles, as one line of key=value pairs. */
+static void
+report (const char *phase, int page_cnt, const struct vm_stats *before,
+        unsigned long long cycles)
+{
+  struct vm_stats after;
+
+  CHECK (vmstats (&after), "vmstats");
+  msg ("pages=%d phase=%s minor=%u major=%u evictions=%u swapped=%u "
+       "cycles=%llu",
+       page_cnt, phase, after.minor_faults - before->minor_faults,
+       after.major_faults - before->major_faults,
+       after.evictions - before->evictions, after.swapped, cycles);
+}
+
+int
+main (int argc, char *argv[])
+{
+  struct vm_stats before;
+  unsigned long long start;
+  volatile unsigned sum = 0;
+  bool random_order;
+  int page_cnt, pass, i;
+
+  quiet = true;
+  CHECK (argc == 3, "argc must be 3, actually %d", argc);
+  page_cnt = atoi (argv[1]);
+  random_order = !strcmp (argv[2], "random");
+  CHECK (page_cnt > 0 && page_cnt <= WS_MAX_PAGES, "bad page count %d",
+         page_cnt);
+  random_init (page_cnt);
+  quiet = false;
+
+  CHECK (vmstats (&before), "vmstats");
+  start = rdtsc ();
+  for (i = 0; i < page_cnt; i++)
+    pages[i * PAGE_SIZE] = i;
+  report ("touch", page_cnt, &before, rdtsc () - start);
+
+  CHECK (vmstats (&before), "vmstats");
+  start = rdtsc ();
+  for (pass = 0; pass < WS_PASSES; pass++)
+    for (i = 0; i < page_cnt; i++)
+      {
+        int page = random_order ? (int) (random_ulong () % page_cnt) : i;
+        sum += pages[page * PAGE_SIZE];
+      }
+  report (random_order ? "random" : "seq", page_cnt, &before, rdtsc () - start);
+
+  return 0;
+}
@@ -0,0 +1,31 @@
+/* Child process of shm-share.
+   Maps the shared memory object whole, at an address other than
+   the parent's, checks the data the parent wrote there, and
+   writes a reply.  Asking for more than the object holds must
+   fail. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/shm.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((char *) 0x30000000)
+#define ELSEWHERE ((char *) 0x40000000)
+
+void
+test_main (void)
+{
+  size_t i;
+
+  CHECK (shm_open (SHM_NAME, 2 * SHM_SIZE, ELSEWHERE) == MAP_FAILED,
+         "shm_open \"%s\" larger than it is (must fail)", SHM_NAME);
+  CHECK (shm_open (SHM_NAME, 0, ACTUAL) != MAP_FAILED,
+         "shm_open \"%s\"", SHM_NAME);
+  for (i = 0; i < SHM_SIZE; i++)
+    if (ACTUAL[i] != shm_pattern (i))
+      fail ("byte %zu is 0x%02x, not 0x%02x",
+            i, ACTUAL[i] & 0xff, shm_pattern (i) & 0xff);
+  msg ("parent's data is there");
+  strlcpy (ACTUAL + SHM_REPLY_OFS, SHM_REPLY, SHM_SIZE - SHM_REPLY_OFS);
+}
@@ -0,0 +1,52 @@
+/* Forks a child process, then has each of the two write its copy
+   of the same buffer.  Each write faults in a private copy of the
+   page, so neither process may see the other's data. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (64 * 1024)
+
+static char buf[SIZE];
+
+/* Fails unless the SIZE bytes at BYTES are all VALUE. */
+static void
+check_bytes (const char *bytes, size_t size, char value, const char *who)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    if (bytes[i] != value)
+      fail ("%s: byte %zu is 0x%02x, not 0x%02x",
+            who, i, bytes[i] & 0xff, value & 0xff);
+}
+
+void
+test_main (void)
+{
+  pid_t pid;
+  int status;
+
+  msg ("initialize");
+  memset (buf, 0x5a, sizeof buf);
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      /* The parent writes its second half meanwhile. */
+      check_bytes (buf, SIZE, 0x5a, "child before writing");
+      memset (buf, 0xa5, SIZE);
+      check_bytes (buf, SIZE, 0xa5, "child after writing");
+      msg ("child: wrote its copy");
+      exit (81);
+    }
+  memset (buf + SIZE / 2, 0x3c, SIZE / 2);
+  status = wait (pid);
+  CHECK (pid != PID_ERROR && status == 81, "wait for child");
+
+  check_bytes (buf, SIZE / 2, 0x5a, "parent");
+  check_bytes (buf + SIZE / 2, SIZE / 2, 0x3c, "parent");
+  msg ("parent's copy is intact");
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(fork-cow) begin
+(fork-cow) initialize
+(fork-cow) child: wrote its copy
+fork-cow: exit(81)
+(fork-cow) wait for child
+(fork-cow) parent's copy is intact
+(fork-cow) end
+fork-cow: exit(0)
+EOF
+pass;
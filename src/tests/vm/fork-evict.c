@@ -0,0 +1,60 @@
+/* Forks a child process while 2 MB of the parent's memory is
+   shared with it, too much for both copies to stay in memory.
+   The child encrypts its copy and decrypts it again, so that its
+   pages are copied, evicted and read back in, and the parent's
+   pages, sharing swap slots with the child's until then, must
+   come through unchanged. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/arc4.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (2 * 1024 * 1024)
+
+static char buf[SIZE];
+
+/* Fails unless every byte of buf is 0x5a. */
+static void
+check_buf (const char *who)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != 0x5a)
+      fail ("%s: byte %zu is 0x%02x, not 0x5a", who, i, buf[i] & 0xff);
+}
+
+void
+test_main (void)
+{
+  struct vm_stats stats;
+  struct arc4 arc4;
+  pid_t pid;
+  int status;
+
+  msg ("initialize");
+  memset (buf, 0x5a, sizeof buf);
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      arc4_init (&arc4, "foobar", 6);
+      arc4_crypt (&arc4, buf, SIZE);
+      arc4_init (&arc4, "foobar", 6);
+      arc4_crypt (&arc4, buf, SIZE);
+      check_buf ("child");
+      if (!vmstats (&stats))
+        fail ("child: vmstats failed");
+      if (stats.evictions == 0)
+        fail ("child: none of its pages were evicted");
+      msg ("child: its copy came back after eviction");
+      exit (81);
+    }
+  status = wait (pid);
+  CHECK (pid != PID_ERROR && status == 81, "wait for child");
+
+  check_buf ("parent");
+  msg ("parent's copy is intact");
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(fork-evict) begin
+(fork-evict) initialize
+(fork-evict) child: its copy came back after eviction
+fork-evict: exit(81)
+(fork-evict) wait for child
+(fork-evict) parent's copy is intact
+(fork-evict) end
+fork-evict: exit(0)
+EOF
+pass;
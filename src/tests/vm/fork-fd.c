@@ -0,0 +1,39 @@
+/* Forks a child process with a file open partway through.  The
+   child's descriptor must start at the parent's position, and
+   reading and closing it must leave the parent's alone. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SKIP 10
+
+void
+test_main (void)
+{
+  size_t rest = sizeof sample - 1 - SKIP;
+  char buf[sizeof sample];
+  pid_t pid;
+  int fd, status;
+
+  CHECK ((fd = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK (read (fd, buf, SKIP) == SKIP, "read %d bytes", SKIP);
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      CHECK (tell (fd) == SKIP, "child: tell() = %d", SKIP);
+      CHECK (read (fd, buf, rest) == (int) rest, "child: read the rest");
+      compare_bytes (buf, sample + SKIP, rest, SKIP, "sample.txt");
+      close (fd);
+      exit (81);
+    }
+  status = wait (pid);
+  CHECK (pid != PID_ERROR && status == 81, "wait for child");
+
+  CHECK (tell (fd) == SKIP, "tell() = %d", SKIP);
+  CHECK (read (fd, buf, rest) == (int) rest, "read the rest");
+  compare_bytes (buf, sample + SKIP, rest, SKIP, "sample.txt");
+}
@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(fork-fd) begin
+(fork-fd) open "sample.txt"
+(fork-fd) read 10 bytes
+(fork-fd) child: tell() = 10
+(fork-fd) child: read the rest
+fork-fd: exit(81)
+(fork-fd) wait for child
+(fork-fd) tell() = 10
+(fork-fd) read the rest
+(fork-fd) end
+fork-fd: exit(0)
+EOF
+pass;
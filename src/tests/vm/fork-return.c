@@ -0,0 +1,26 @@
+/* Forks a child process.  fork() must return 0 in the child and
+   the child's pid in the parent, so that the parent can wait for
+   the child by that pid and get the child's exit status. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  pid_t pid;
+  int status;
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      msg ("child: fork() = 0");
+      exit (81);
+    }
+  status = wait (pid);
+  CHECK (pid != PID_ERROR && status == 81,
+         "wait for the child by the pid fork() returned");
+  status = wait (pid);
+  CHECK (status == -1, "wait for it again");
+}
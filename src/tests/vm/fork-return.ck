@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(fork-return) begin
+(fork-return) child: fork() = 0
+fork-return: exit(81)
+(fork-return) wait for the child by the pid fork() returned
+(fork-return) wait for it again
+(fork-return) end
+fork-return: exit(0)
+EOF
+pass;
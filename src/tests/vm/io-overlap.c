@@ -0,0 +1,94 @@
+/* Times writing and reading back a file, running 4 child-linear
+   processes that page to swap, and both at once.  With the
+   file system and swap on different disks, doing both should
+   take less than the two apart, because each disk's requests
+   are served while the other's are in flight. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHILD_CNT 4
+#define FILE_SIZE (256 * 1024)
+#define CHUNK_SIZE 4096
+
+static char buf[CHUNK_SIZE];
+
+static inline unsigned long long
+rdtsc (void)
+{
+  unsigned long long t;
+  asm volatile ("rdtsc" : "=A" (t));
+  return t;
+}
+
+/* Writes FILE_SIZE bytes to a new file, reads them back and
+   removes the file. */
+static void
+file_io (void)
+{
+  size_t ofs;
+  int fd;
+
+  CHECK (create ("bench", 0), "create \"bench\"");
+  CHECK ((fd = open ("bench")) > 1, "open \"bench\"");
+  for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK_SIZE)
+    if (write (fd, buf, CHUNK_SIZE) != CHUNK_SIZE)
+      fail ("write \"bench\" at %zu", ofs);
+  seek (fd, 0);
+  for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK_SIZE)
+    if (read (fd, buf, CHUNK_SIZE) != CHUNK_SIZE)
+      fail ("read \"bench\" at %zu", ofs);
+  close (fd);
+  CHECK (remove ("bench"), "remove \"bench\"");
+}
+
+/* Starts CHILD_CNT child-linear processes in CHILDREN. */
+static void
+start_linear (pid_t children[])
+{
+  int i;
+
+  for (i = 0; i < CHILD_CNT; i++)
+    CHECK ((children[i] = exec ("child-linear")) != -1,
+           "exec \"child-linear\"");
+}
+
+/* Waits for the child-linear processes in CHILDREN. */
+static void
+wait_linear (pid_t children[])
+{
+  int i;
+
+  for (i = 0; i < CHILD_CNT; i++)
+    CHECK (wait (children[i]) == 0x42, "wait for child %d", i);
+}
+
+void
+test_main (void)
+{
+  pid_t children[CHILD_CNT];
+  unsigned long long start, file, swap, both;
+
+  quiet = true;
+
+  start = rdtsc ();
+  file_io ();
+  file = rdtsc () - start;
+
+  start = rdtsc ();
+  start_linear (children);
+  wait_linear (children);
+  swap = rdtsc () - start;
+
+  start = rdtsc ();
+  start_linear (children);
+  file_io ();
+  wait_linear (children);
+  both = rdtsc () - start;
+
+  quiet = false;
+  msg ("file: %llu cycles", file);
+  msg ("swap: %llu cycles", swap);
+  msg ("both: %llu cycles", both);
+}
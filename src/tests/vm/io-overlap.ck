@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+
+# Cycle counts vary, so check only the shape of the report.
+my (@lines) = map (/^\(io-overlap\) (\w+): \d+ cycles$/, @output);
+fail "missing or malformed benchmark lines\n"
+  if join (', ', @lines) ne "file, swap, both";
+pass;
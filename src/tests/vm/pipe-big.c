@@ -0,0 +1,53 @@
+/* Writes more than a pipe can buffer in one call, to a forked
+   child that reads it in small pieces.  The write must wait for
+   room as the child drains the pipe and then return the whole
+   size, and the child must read every byte in order. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* A pipe buffers one page. */
+#define SIZE (3 * 4096 + 100)
+#define CHUNK 500
+
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  int fds[2];
+  int status;
+  pid_t pid;
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    buf[i] = i % 251;
+  CHECK (pipe (fds), "pipe");
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      char chunk[CHUNK];
+      size_t ofs = 0;
+      int n;
+
+      close (fds[1]);
+      while ((n = read (fds[0], chunk, sizeof chunk)) > 0)
+        {
+          if (ofs + n > SIZE)
+            fail ("child: read more than %d bytes", SIZE);
+          compare_bytes (chunk, buf + ofs, n, ofs, "pipe");
+          ofs += n;
+        }
+      if (ofs != SIZE)
+        fail ("child: read %zu bytes, not %d", ofs, SIZE);
+      msg ("child: read %zu bytes", ofs);
+      exit (81);
+    }
+  close (fds[0]);
+  CHECK (write (fds[1], buf, SIZE) == SIZE, "write %d bytes", SIZE);
+  close (fds[1]);
+  status = wait (pid);
+  CHECK (pid != PID_ERROR && status == 81, "wait for child");
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(pipe-big) begin
+(pipe-big) pipe
+(pipe-big) write 12388 bytes
+(pipe-big) child: read 12388 bytes
+pipe-big: exit(81)
+(pipe-big) wait for child
+(pipe-big) end
+pipe-big: exit(0)
+EOF
+pass;
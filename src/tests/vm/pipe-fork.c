@@ -0,0 +1,56 @@
+/* Passes a counter back and forth between a parent and a forked
+   child over two pipes, so that each read blocks until the other
+   process writes.  Once the parent closes its write end, the
+   child's read must return 0, and the child exits. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ROUNDS 100
+
+void
+test_main (void)
+{
+  int down[2], up[2];
+  int i, value, status;
+  pid_t pid;
+
+  CHECK (pipe (down), "pipe down");
+  CHECK (pipe (up), "pipe up");
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      int rounds = 0;
+
+      close (down[1]);
+      close (up[0]);
+      while (read (down[0], &value, sizeof value) == sizeof value)
+        {
+          value++;
+          if (write (up[1], &value, sizeof value) != sizeof value)
+            fail ("child: write failed");
+          rounds++;
+        }
+      msg ("child: end of data after %d rounds", rounds);
+      exit (81);
+    }
+  close (down[0]);
+  close (up[1]);
+
+  for (i = 0; i < ROUNDS; i++)
+    {
+      value = 2 * i;
+      if (write (down[1], &value, sizeof value) != sizeof value)
+        fail ("write in round %d failed", i);
+      if (read (up[0], &value, sizeof value) != sizeof value)
+        fail ("read in round %d failed", i);
+      if (value != 2 * i + 1)
+        fail ("round %d: got %d back, not %d", i, value, 2 * i + 1);
+    }
+  close (down[1]);
+  status = wait (pid);
+  CHECK (pid != PID_ERROR && status == 81, "wait for child");
+  CHECK (read (up[0], &value, sizeof value) == 0, "read at end of data");
+}
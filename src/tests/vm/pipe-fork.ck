@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(pipe-fork) begin
+(pipe-fork) pipe down
+(pipe-fork) pipe up
+(pipe-fork) child: end of data after 100 rounds
+pipe-fork: exit(81)
+(pipe-fork) wait for child
+(pipe-fork) read at end of data
+(pipe-fork) end
+pipe-fork: exit(0)
+EOF
+pass;
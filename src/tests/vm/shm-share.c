@@ -0,0 +1,41 @@
+/* Creates a shared memory object, fills it in and runs
+   child-shm, which maps the object by name at another address,
+   checks what the parent wrote and writes a reply.  The reply
+   must show up in the parent's mapping.  Once the name is
+   unlinked, opening it again must give a new, zeroed object. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/shm.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((char *) 0x10000000)
+#define FRESH ((char *) 0x20000000)
+
+void
+test_main (void)
+{
+  pid_t child;
+  size_t i;
+
+  CHECK (shm_open (SHM_NAME, SHM_SIZE, ACTUAL) != MAP_FAILED,
+         "shm_open \"%s\"", SHM_NAME);
+  for (i = 0; i < SHM_SIZE; i++)
+    ACTUAL[i] = shm_pattern (i);
+
+  CHECK ((child = exec ("child-shm")) != -1, "exec \"child-shm\"");
+  CHECK (wait (child) == 0, "wait for child (should return 0)");
+  CHECK (!strcmp (ACTUAL + SHM_REPLY_OFS, SHM_REPLY),
+         "child's reply is in the parent's mapping");
+
+  CHECK (shm_unlink (SHM_NAME), "shm_unlink \"%s\"", SHM_NAME);
+  CHECK (!shm_unlink (SHM_NAME), "shm_unlink \"%s\" again (must fail)",
+         SHM_NAME);
+  CHECK (shm_open (SHM_NAME, 4096, FRESH) != MAP_FAILED,
+         "shm_open \"%s\" after unlink", SHM_NAME);
+  for (i = 0; i < 4096; i++)
+    if (FRESH[i] != 0)
+      fail ("byte %zu of the new object is 0x%02x, not 0", i, FRESH[i] & 0xff);
+  CHECK (ACTUAL[0] == shm_pattern (0), "old mapping still has its data");
+}
@@ -0,0 +1,24 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(shm-share) begin
+(shm-share) shm_open "shm-share"
+(shm-share) exec "child-shm"
+(child-shm) begin
+(child-shm) shm_open "shm-share" larger than it is (must fail)
+(child-shm) shm_open "shm-share"
+(child-shm) parent's data is there
+(child-shm) end
+child-shm: exit(0)
+(shm-share) wait for child (should return 0)
+(shm-share) child's reply is in the parent's mapping
+(shm-share) shm_unlink "shm-share"
+(shm-share) shm_unlink "shm-share" again (must fail)
+(shm-share) shm_open "shm-share" after unlink
+(shm-share) old mapping still has its data
+(shm-share) end
+shm-share: exit(0)
+EOF
+pass;
@@ -0,0 +1,21 @@
+#ifndef TESTS_VM_SHM_H
+#define TESTS_VM_SHM_H
+
+#include <stddef.h>
+
+/* The object shm-share and child-shm share, and its size. */
+#define SHM_NAME "shm-share"
+#define SHM_SIZE (3 * 4096)
+
+/* Where in the object child-shm leaves its reply. */
+#define SHM_REPLY_OFS (2 * 4096 + 100)
+#define SHM_REPLY "reply from child-shm"
+
+/* Byte I of what shm-share writes to the object. */
+static inline char
+shm_pattern (size_t i)
+{
+  return i % 251 + 1;
+}
+
+#endif /* tests/vm/shm.h */
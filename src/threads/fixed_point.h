@@ -1,31 +1,75 @@
 #ifndef THREADS_FIXED_POINT_H
 #define THREADS_FIXED_POINT_H
 
-typedef int64_t fixed_t;
+#include <debug.h>
+#include <stdint.h>
 
-#define FP_SHIFT_AMOUNT 16
+/* 17.14 fixed-point numbers for the MLFQS scheduler.
 
-#define CONVERT_TO_FP(n) ((fixed_t)(n << FP_SHIFT_AMOUNT))
+   A fixed_t is a real number times 2**14 held in 32 bits: a sign,
+   17 bits of integer part and 14 of fraction, plenty for
+   load_avg, recent_cpu, and the decay coefficient between them.
 
-#define CONVERT_TO_INT(n) (n >> FP_SHIFT_AMOUNT)
+   The scheduler does this arithmetic in the timer interrupt, so
+   nothing here divides a 64-bit number by another, which i386
+   can only do in software with __divdi3() from lib/arithmetic.c.
+   A product is widened to 64 bits by a single IMUL and shifted
+   back; a quotient comes from a single IDIV of the widened
+   dividend by the 32-bit divisor.  Both assert that the result
+   fits in a fixed_t. */
 
-#define CONVERT_TO_INT_ROUND(n) (n >= 0 ? ((n + (1 << (FP_SHIFT_AMOUNT - 1))) >> FP_SHIFT_AMOUNT) \
-        : ((n - (1 << (FP_SHIFT_AMOUNT - 1))) >> FP_SHIFT_AMOUNT))
+typedef int32_t fixed_t;
 
-#define ADD(a, b) (a + b)
+#define FP_SHIFT_AMOUNT 14
 
-#define ADD_INT(a, b) (a + (b << FP_SHIFT_AMOUNT))
+#define CONVERT_TO_FP(n) ((fixed_t) (n) << FP_SHIFT_AMOUNT)
 
-#define SUB(a, b) (a - b)
+#define CONVERT_TO_INT(n) ((n) >> FP_SHIFT_AMOUNT)
 
-#define SUB_INT(a, b) (a - (b << FP_SHIFT_AMOUNT))
+#define CONVERT_TO_INT_ROUND(n) ((n) >= 0                                   \
+        ? ((n) + (1 << (FP_SHIFT_AMOUNT - 1))) >> FP_SHIFT_AMOUNT          \
+        : ((n) - (1 << (FP_SHIFT_AMOUNT - 1))) >> FP_SHIFT_AMOUNT)
 
-#define MULT_INT(a, b) (a * b)
+#define ADD(a, b) ((a) + (b))
 
-#define DIV_INT(a, b) (a / b)
+#define ADD_INT(a, b) ((a) + ((b) << FP_SHIFT_AMOUNT))
 
-#define MULT(a, b) ((fixed_t)(((int64_t) a) * b >> FP_SHIFT_AMOUNT))
+#define SUB(a, b) ((a) - (b))
 
-#define DIV(a, b) ((fixed_t)((((int64_t) a) << FP_SHIFT_AMOUNT) / b))
+#define SUB_INT(a, b) ((a) - ((b) << FP_SHIFT_AMOUNT))
 
-#endif /* threads/fixed_point.h */
\ No newline at end of file
+#define MULT_INT(a, b) ((a) * (b))
+
+#define DIV_INT(a, b) ((a) / (b))
+
+#define MULT(a, b) fp_mult (a, b)
+
+#define DIV(a, b) fp_div (a, b)
+
+/* Returns A * B. */
+static inline fixed_t
+fp_mult (fixed_t a, fixed_t b)
+{
+  int64_t product = (int64_t) a * b >> FP_SHIFT_AMOUNT;
+
+  ASSERT (product >= INT32_MIN && product <= INT32_MAX);
+  return product;
+}
+
+/* Returns A / B, rounded toward zero. */
+static inline fixed_t
+fp_div (fixed_t a, fixed_t b)
+{
+  int64_t dividend = (int64_t) a << FP_SHIFT_AMOUNT;
+  int32_t quotient, remainder;
+
+  ASSERT (b != 0);
+  ASSERT ((dividend < 0 ? -dividend : dividend)
+          < (b < 0 ? -(int64_t) b : (int64_t) b) << 31);
+  asm ("idivl %3"
+       : "=a" (quotient), "=d" (remainder)
+       : "A" (dividend), "rm" (b));
+  return quotient;
+}
+
+#endif /* threads/fixed_point.h */
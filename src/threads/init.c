@@ -17,25 +17,41 @@
 #include "devices/rtc.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
+#include "threads/ktrace.h"
 #include "threads/loader.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
 #include "threads/thread.h"
+#include "threads/workqueue.h"
 #ifdef USERPROG
 #include "userprog/process.h"
+#include "userprog/aio.h"
+#include "userprog/futex.h"
 #include "userprog/exception.h"
 #include "userprog/gdt.h"
 #include "userprog/syscall.h"
 #include "userprog/tss.h"
+#include "userprog/uinfo.h"
 #else
 #include "tests/threads/tests.h"
 #endif
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/inode.h"
+#include "filesys/cache.h"
+#include "filesys/journal.h"
+#include "filesys/tmpfs.h"
+#endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/shm.h"
+#include "vm/zswap.h"
 #endif
 
 /* Page directory with kernel mappings only. */
@@ -57,12 +73,17 @@ static const char *swap_bdev_name;
 /* -ul: Maximum number of pages to put into palloc's user pool. */
 static size_t user_page_limit = SIZE_MAX;
 
+/* -kl, -kh: Kernel pool free pages below which it stops lending
+   to user requests, and above which it starts again. */
+static size_t lend_low = SIZE_MAX, lend_high = SIZE_MAX;
+
 static void bss_init (void);
 static void paging_init (void);
 
 static char **read_command_line (void);
 static char **parse_options (char **argv);
 static void run_actions (char **argv);
+static void print_lock_stats (char **argv);
 static void usage (void);
 
 static void readline (void);
@@ -98,7 +119,9 @@ pintos_init (void)
 
   /* Initialize memory system. */
   palloc_init (user_page_limit);
+  palloc_set_watermarks (lend_low, lend_high);
   malloc_init ();
+  ktrace_init ();
   paging_init ();
 
   /* Segmentation. */
@@ -115,16 +138,24 @@ pintos_init (void)
 #ifdef USERPROG
   exception_init ();
   syscall_init ();
+  futex_init ();
+  uinfo_init ();
+  process_init ();
 #endif
 
   /* Start thread scheduler and enable interrupts. */
   thread_start ();
   serial_init_queue ();
   timer_calibrate ();
+  workqueue_start ();
+#ifdef USERPROG
+  aio_init ();
+#endif
 
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init ();
+  ramdisk_init ();
   locate_block_devices ();
   filesys_init (format_filesys);
 #endif
@@ -133,6 +164,7 @@ pintos_init (void)
   page_init();
   frame_init();
   swap_init();
+  shm_init();
 #endif
 
   printf ("Boot complete.\n");
@@ -167,16 +199,55 @@ bss_init (void)
   memset (&_start_bss, 0, &_end_bss - &_start_bss);
 }
 
+/* CPUID leaf 1 feature bits in EDX and CR4 bits for 4 MB pages
+   and global pages.  See [IA32-v2a] "CPUID" and [IA32-v3a] 2.5
+   "Control Registers". */
+#define CPUID_PSE 0x8
+#define CPUID_PGE 0x2000
+#define CR4_PSE 0x10
+#define CR4_PGE 0x80
+
+/* Returns true if the CPU has FEATURE, a CPUID_* bit. */
+static bool
+cpu_has (uint32_t feature)
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+
+  asm ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  return (edx & feature) != 0;
+}
+
 /* Populates the base page directory and page table with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
-   directory it creates. */
+   directory it creates.
+
+   Where the CPU allows, each 4 MB of RAM that is present in full
+   and holds no kernel text is mapped by a single large-page PDE
+   rather than by a page table.  That saves a kernel page per
+   4 MB and a TLB entry per kernel access to it.  The kernel text
+   keeps 4 kB pages so that it can stay read-only.
+
+   Where the CPU allows, kernel mappings are also global, so that
+   they stay in the TLB when switching to another process's page
+   directory, which shares them.  Under STACK_GUARD, large pages
+   are not used, so that each thread's guard page can be unmapped;
+   that is the only change to kernel mappings after this, and it
+   flushes the global entry with invlpg. */
 static void
 paging_init (void)
 {
   uint32_t *pd, *pt;
   size_t page;
   extern char _start, _end_kernel_text;
+#ifdef STACK_GUARD
+  /* Guard pages are unmapped one at a time. */
+  bool pse = false;
+#else
+  bool pse = cpu_has (CPUID_PSE);
+#endif
+  bool pge = cpu_has (CPUID_PGE);
+  uint32_t global = pge ? PTE_G : 0;
 
   pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
   pt = NULL;
@@ -188,20 +259,36 @@ paging_init (void)
       size_t pte_idx = pt_no (vaddr);
       bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
 
+      if (pse && pte_idx == 0 && page + PTSPAN / PGSIZE <= init_ram_pages
+          && !(vaddr < &_end_kernel_text && &_start < vaddr + PTSPAN))
+        {
+          pd[pde_idx] = pde_create_large (vaddr, true) | global;
+          page += PTSPAN / PGSIZE - 1;
+          continue;
+        }
+
       if (pd[pde_idx] == 0)
         {
           pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
           pd[pde_idx] = pde_create (pt);
         }
 
-      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text);
+      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text) | global;
     }
 
   /* Store the physical address of the page directory into CR3
      aka PDBR (page directory base register).  This activates our
      new page tables immediately.  See [IA32-v2a] "MOV--Move
      to/from Control Registers" and [IA32-v3a] 3.7.5 "Base Address
-     of the Page Directory". */
+     of the Page Directory".  Large and global pages must be
+     enabled first. */
+  if (pse || pge)
+    {
+      uint32_t cr4;
+      asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+      cr4 |= (pse ? CR4_PSE : 0) | (pge ? CR4_PGE : 0);
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4));
+    }
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)));
 }
 
@@ -259,23 +346,133 @@ parse_options (char **argv)
         shutdown_configure (SHUTDOWN_REBOOT);
 #ifdef FILESYS
       else if (!strcmp (name, "-f"))
-        format_filesys = true;
+        {
+          format_filesys = true;
+          if (value != NULL && !inode_set_format (value))
+            PANIC ("unknown inode layout `%s' (use -h for help)", value);
+        }
       else if (!strcmp (name, "-filesys"))
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-tmpfs"))
+        tmpfs_set_mount_point (value != NULL ? value : "/tmp");
+      else if (!strcmp (name, "-ramdisk"))
+        {
+          if (value == NULL || atoi (value) <= 0)
+            PANIC ("bad ramdisk size `%s' (use -h for help)", value);
+          ramdisk_set_size (atoi (value));
+        }
+      else if (!strcmp (name, "-cache-policy"))
+        {
+          if (value == NULL || !cache_set_policy (value))
+            PANIC ("unknown cache policy `%s' (use -h for help)", value);
+        }
+      else if (!strcmp (name, "-cache-meta"))
+        {
+          if (value == NULL || !cache_set_meta_share (atoi (value)))
+            PANIC ("bad cache metadata share `%s' (use -h for help)", value);
+        }
+      else if (!strcmp (name, "-cache-flush"))
+        {
+          if (value == NULL || atoi (value) < 0)
+            PANIC ("bad cache flush interval `%s' (use -h for help)", value);
+          cache_set_flush_interval (atoi (value));
+        }
+      else if (!strcmp (name, "-cache-size"))
+        {
+          if (value == NULL || atoi (value) <= 0)
+            PANIC ("bad cache size `%s' (use -h for help)", value);
+          cache_set_size (atoi (value));
+        }
+      else if (!strcmp (name, "-cache-max"))
+        {
+          if (value == NULL || atoi (value) < 0
+              || !cache_set_max_size (atoi (value)))
+            PANIC ("bad cache maximum size `%s' (use -h for help)", value);
+        }
+      else if (!strcmp (name, "-journal-crash"))
+        {
+          if (value == NULL || atoi (value) <= 0)
+            PANIC ("bad journal crash commit `%s' (use -h for help)", value);
+          journal_set_crash (atoi (value));
+        }
+      else if (!strcmp (name, "-blktrace"))
+        {
+          if (!block_set_trace (value))
+            PANIC ("unknown trace destination `%s' (use -h for help)", value);
+        }
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
+      else if (!strcmp (name, "-zswap"))
+        {
+          if (value == NULL || atoi (value) < 0)
+            PANIC ("bad zswap size `%s' (use -h for help)", value);
+          zswap_set_limit (atoi (value));
+        }
+      else if (!strcmp (name, "-vmstat"))
+        page_set_exit_report (true);
+      else if (!strcmp (name, "-vm-policy"))
+        {
+          if (value == NULL || !frame_set_policy (value))
+            PANIC ("unknown page replacement policy `%s' (use -h for help)", value);
+        }
 #endif
 #endif
       else if (!strcmp (name, "-rs"))
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-slice"))
+        {
+          char *low = value != NULL ? strchr (value, ',') : NULL;
+          if (value == NULL
+              || !thread_set_time_slice (atoi (value),
+                                         atoi (low != NULL ? low + 1 : value)))
+            PANIC ("bad time slice `%s' (use -h for help)", value);
+        }
+      else if (!strcmp (name, "-tickless"))
+        timer_set_tickless (true);
+      else if (!strcmp (name, "-timer-cal"))
+        {
+          char *cycles = value != NULL ? strchr (value, ',') : NULL;
+          if (cycles == NULL || atoi (value) <= 0 || atoi (cycles + 1) <= 0)
+            PANIC ("bad timer calibration `%s' (use -h for help)", value);
+          timer_set_calibration (atoi (value), atoi (cycles + 1));
+        }
+      else if (!strcmp (name, "-prof"))
+        timer_set_profiling (true);
+      else if (!strcmp (name, "-lockprof"))
+        lock_set_profiling (true);
+      else if (!strcmp (name, "-mallocprof"))
+        malloc_set_profiling (true);
+      else if (!strcmp (name, "-intrprof"))
+        intr_set_profiling (true);
+      else if (!strcmp (name, "-ktrace"))
+        {
+          if (!ktrace_set_dest (value))
+            PANIC ("unknown trace destination `%s' (use -h for help)", value);
+        }
+      else if (!strcmp (name, "-line-input"))
+        input_set_line_mode (true);
+      else if (!strcmp (name, "-serial-buf"))
+        {
+          if (value == NULL || atoi (value) <= 0
+              || !serial_set_buffer_size (atoi (value)))
+            PANIC ("bad serial buffer size `%s' (use -h for help)", value);
+        }
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+      else if (!strcmp (name, "-kl"))
+        lend_low = atoi (value);
+      else if (!strcmp (name, "-kh"))
+        lend_high = atoi (value);
+#ifndef VM
+      else if (!strcmp (name, "-demand-load"))
+        process_set_demand_load (true);
+#endif
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -294,6 +491,20 @@ parse_options (char **argv)
   return argv;
 }
 
+/* Prints the named locks' contention counters. */
+static void
+print_lock_stats (char **argv UNUSED)
+{
+  lock_print_stats ();
+}
+
+/* Prints the kernel heap's usage, under -mallocprof. */
+static void
+print_malloc_stats (char **argv UNUSED)
+{
+  malloc_print_stats ();
+}
+
 /* Runs the task specified in ARGV[1]. */
 static void
 run_task (char **argv)
@@ -326,6 +537,11 @@ run_actions (char **argv)
   static const struct action actions[] = 
     {
       {"run", 2, run_task},
+      {"lock-stats", 1, print_lock_stats},
+      {"malloc-stats", 1, print_malloc_stats},
+#ifdef USERPROG
+      {"syscall-stats", 1, syscall_print_histograms},
+#endif
 #ifdef FILESYS
       {"ls", 1, fsutil_ls},
       {"cat", 2, fsutil_cat},
@@ -371,9 +587,12 @@ usage (void)
           "\nAvailable actions:\n"
 #ifdef USERPROG
           "  run 'PROG [ARG...]' Run PROG and wait for it to complete.\n"
+          "  syscall-stats      Print system call latency histograms.\n"
 #else
           "  run TEST           Run TEST.\n"
 #endif
+          "  lock-stats         Print lock contention counters.\n"
+          "  malloc-stats       Print kernel heap usage (needs -mallocprof).\n"
 #ifdef FILESYS
           "  ls                 List files in the root directory.\n"
           "  cat FILE           Print FILE to the console.\n"
@@ -387,17 +606,51 @@ usage (void)
           "  -q                 Power off VM after actions or on panic.\n"
           "  -r                 Reboot after actions.\n"
 #ifdef FILESYS
-          "  -f                 Format file system device during startup.\n"
+          "  -f[=LAYOUT]        Format file system device during startup, with\n"
+          "                     LAYOUT (tree, extent) for file data.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -tmpfs[=PATH]      Mount an in-memory file system on PATH (/tmp).\n"
+          "  -ramdisk=KB        Create a KB-kilobyte block device ram0 in memory.\n"
+          "  -cache-policy=POL  Use POL (lru, clock, aging, 2q) for the buffer cache.\n"
+          "  -cache-meta=PCT    Keep PCT%% of the buffer cache for metadata (25).\n"
+          "  -cache-flush=TICKS Write dirty cache blocks back every TICKS (0=off).\n"
+          "  -cache-size=N      Start the buffer cache at N sectors.\n"
+          "  -cache-max=N       Let the buffer cache grow to N sectors, at least\n"
+          "                     the -cache-size given before it.\n"
+          "  -journal-crash=N   Lose power just after the Nth journal commit.\n"
+          "  -blktrace[=DEST]   Trace block requests; at shutdown print the\n"
+          "                     trace (DEST=console) or write it to scratch.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
+          "  -zswap=PAGES       Keep up to PAGES pages of compressed swap in RAM.\n"
+          "  -vmstat            Print each process's paging counters at exit.\n"
+          "  -vm-policy=POL     Use POL (clock, wsclock) for page replacement.\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -slice=HIGH[,LOW]  Give PRI_MAX threads HIGH ticks per time slice and\n"
+          "                     PRI_MIN ones LOW, scaling in between (default 4).\n"
+          "  -tickless          Program the timer one-shot; skip ticks when idle.\n"
+          "  -timer-cal=LOOPS,CYCLES  Skip timer calibration, using the loops\n"
+          "                     and cycles per tick printed by an earlier boot.\n"
+          "  -prof              Sample the interrupted kernel code each tick.\n"
+          "  -lockprof          Time waits and holds of named locks.\n"
+          "  -mallocprof        Count live kernel heap blocks by size and caller.\n"
+          "  -intrprof          Time code that runs with interrupts off.\n"
+          "  -ktrace[=DEST]     Trace kernel events; at shutdown print the\n"
+          "                     trace (DEST=console) or write it to scratch.\n"
+          "  -serial-buf=BYTES  Queue up to BYTES (256 to 65536) of serial output.\n"
+          "  -line-input        Return console reads at the end of each line.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+          "  -kl=COUNT          Stop lending kernel pages to user memory\n"
+          "                     when COUNT or fewer are free.\n"
+          "  -kh=COUNT          Resume lending once over COUNT are free.\n"
+#ifndef VM
+          "  -demand-load       Read executable pages in as they are touched.\n"
+#endif
 #endif
           );
   shutdown_power_off ();
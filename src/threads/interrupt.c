@@ -9,6 +9,10 @@
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "devices/timer.h"
+#ifdef USERPROG
+#include "userprog/gdt.h"
+#include "userprog/process.h"
+#endif
 
 /* Programmable Interrupt Controller (PIC) registers.
    A PC has two PICs, called the master and slave PICs, with the
@@ -37,6 +41,39 @@ static const char *intr_names[INTR_CNT];
    unexpected interrupt is one that has no registered handler. */
 static unsigned int unexpected_cnt[INTR_CNT];
 
+/* Number of interrupts and CPU cycles spent in the handler for
+   each vector, for intr_print_stats().  The cycles of a handler
+   that sleeps, such as a system call, include the time asleep. */
+static unsigned long long intr_cnt[INTR_CNT];
+static unsigned long long intr_cycles[INTR_CNT];
+
+/* Critical section profiling, turned on by -intrprof.  Each time
+   intr_disable() or intr_set_level() turns interrupts off, the
+   cycles until intr_enable() or intr_set_level() turns them back
+   on are charged to the code that turned them off. */
+static bool intr_profiling;
+
+/* A code address that turns interrupts off. */
+struct off_site
+  {
+    void *pc;                   /* Caller of intr_disable(), or null. */
+    unsigned long long cnt;     /* Number of times. */
+    unsigned long long cycles;  /* Cycles with interrupts off in all. */
+    uint64_t max_cycles;        /* Longest single time. */
+  };
+
+/* Call sites, hashed by address.  Sites that do not fit are
+   counted in the last entry, whose PC stays null. */
+#define OFF_SITE_CNT 128
+static struct off_site off_sites[OFF_SITE_CNT + 1];
+
+static void *off_pc;            /* Site that turned interrupts off. */
+static uint64_t off_tsc;        /* When. */
+
+static enum intr_level disable (void *pc);
+static enum intr_level enable (void);
+static struct off_site *find_off_site (void *pc);
+
 /* External interrupts are those generated by devices outside the
    CPU, such as the timer.  External interrupts run with
    interrupts turned off, so they never nest, nor are they ever
@@ -54,6 +91,7 @@ static void pic_end_of_interrupt (int irq);
 /* Interrupt Descriptor Table helpers. */
 static uint64_t make_intr_gate (void (*) (void), int dpl);
 static uint64_t make_trap_gate (void (*) (void), int dpl);
+static uint64_t make_task_gate (uint16_t tss_sel);
 static inline uint64_t make_idtr_operand (uint16_t limit, void *base);
 
 /* Interrupt handlers. */
@@ -80,16 +118,49 @@ intr_get_level (void)
 enum intr_level
 intr_set_level (enum intr_level level) 
 {
-  return level == INTR_ON ? intr_enable () : intr_disable ();
+  return level == INTR_ON ? enable () : disable (__builtin_return_address (0));
 }
 
 /* Enables interrupts and returns the previous interrupt status. */
 enum intr_level
 intr_enable (void) 
+{
+  return enable ();
+}
+
+/* Disables interrupts and returns the previous interrupt status. */
+enum intr_level
+intr_disable (void) 
+{
+  return disable (__builtin_return_address (0));
+}
+
+/* Turns critical section profiling on or off. */
+void
+intr_set_profiling (bool enable)
+{
+  intr_profiling = enable;
+}
+
+/* Enables interrupts and returns the previous interrupt status. */
+static enum intr_level
+enable (void) 
 {
   enum intr_level old_level = intr_get_level ();
   ASSERT (!intr_context ());
 
+  if (off_pc != NULL)
+    {
+      struct off_site *s = find_off_site (off_pc);
+      uint64_t cycles = timer_tsc () - off_tsc;
+
+      s->cnt++;
+      s->cycles += cycles;
+      if (cycles > s->max_cycles)
+        s->max_cycles = cycles;
+      off_pc = NULL;
+    }
+
   /* Enable interrupts by setting the interrupt flag.
 
      See [IA32-v2b] "STI" and [IA32-v3a] 5.8.1 "Masking Maskable
@@ -99,9 +170,10 @@ intr_enable (void)
   return old_level;
 }
 
-/* Disables interrupts and returns the previous interrupt status. */
-enum intr_level
-intr_disable (void) 
+/* Disables interrupts and returns the previous interrupt status.
+   PC is the code doing so, for profiling. */
+static enum intr_level
+disable (void *pc) 
 {
   enum intr_level old_level = intr_get_level ();
 
@@ -110,6 +182,12 @@ intr_disable (void)
      Hardware Interrupts". */
   asm volatile ("cli" : : : "memory");
 
+  if (intr_profiling && old_level == INTR_ON)
+    {
+      off_pc = pc;
+      off_tsc = timer_tsc ();
+    }
+
   return old_level;
 }
 
@@ -206,6 +284,20 @@ intr_register_int (uint8_t vec_no, int dpl, enum intr_level level,
   register_handler (vec_no, dpl, level, handler, name);
 }
 
+/* Registers internal interrupt VEC_NO to switch to the task whose
+   TSS is selected by TSS_SEL, named NAME for debugging purposes.
+   The task runs on its own stack, so that it can handle a fault
+   that leaves the current stack unusable.  It must never return,
+   because nothing switches back, and it is not counted in the
+   interrupt statistics. */
+void
+intr_register_task (uint8_t vec_no, uint16_t tss_sel, const char *name)
+{
+  ASSERT (vec_no < 0x20);
+  idt[vec_no] = make_task_gate (tss_sel);
+  intr_names[vec_no] = name;
+}
+
 /* Returns true during processing of an external interrupt
    and false at all other times. */
 bool
@@ -327,6 +419,19 @@ make_trap_gate (void (*function) (void), int dpl)
   return make_gate (function, dpl, 15);
 }
 
+/* Creates a task gate that switches to the task whose TSS is
+   selected by TSS_SEL.  See [IA32-v3a] 6.3.2 "Task-Gate
+   Descriptor". */
+static uint64_t
+make_task_gate (uint16_t tss_sel)
+{
+  uint32_t e0 = (uint32_t) tss_sel << 16;  /* TSS segment selector. */
+  uint32_t e1 = ((1 << 15)                 /* Present. */
+                 | (0 << 13)               /* Descriptor privilege. */
+                 | (5 << 8));              /* Gate type: task gate. */
+  return e0 | ((uint64_t) e1 << 32);
+}
+
 /* Returns a descriptor that yields the given LIMIT and BASE when
    used as an operand for the LIDT instruction. */
 static inline uint64_t
@@ -361,10 +466,22 @@ intr_handler (struct intr_frame *frame)
       yield_on_return = false;
     }
 
+  /* Interrupts were on in the interrupted code, so any critical
+     section being timed was ended by some means other than
+     intr_enable(), such as the idle thread's "sti; hlt" or a
+     return to user mode.  Its end time is unknown, so drop it. */
+  if ((frame->eflags & FLAG_IF) != 0)
+    off_pc = NULL;
+
   /* Invoke the interrupt's handler. */
   handler = intr_handlers[frame->vec_no];
   if (handler != NULL)
-    handler (frame);
+    {
+      uint64_t start = timer_tsc ();
+      intr_cnt[frame->vec_no]++;
+      handler (frame);
+      intr_cycles[frame->vec_no] += timer_tsc () - start;
+    }
   else if (frame->vec_no == 0x27 || frame->vec_no == 0x2f)
     {
       /* There is no handler, but this interrupt can trigger
@@ -386,6 +503,13 @@ intr_handler (struct intr_frame *frame)
       if (yield_on_return) 
         thread_yield (); 
     }
+
+#ifdef USERPROG
+  /* The threads of an exiting process exit on their way back to
+     user mode, from whatever brought them into the kernel. */
+  if (frame->cs == SEL_UCSEG)
+    process_check_exit ();
+#endif
 }
 
 /* Handles an unexpected interrupt with interrupt frame F.  An
@@ -406,6 +530,67 @@ unexpected_interrupt (const struct intr_frame *f)
     f->vec_no, intr_names[f->vec_no]);
 }
 
+/* Prints the number of interrupts and handler cycles for each
+   vector that has occurred and, while profiling, the call sites
+   that kept interrupts off longest in all. */
+void
+intr_print_stats (void) 
+{
+  enum { TOP_SITES = 16 };
+  bool printed[OFF_SITE_CNT + 1] = { false };
+  int i, n;
+
+  for (i = 0; i < INTR_CNT; i++)
+    if (intr_cnt[i] > 0)
+      printf ("Interrupt %#04x (%s): %llu calls, %llu cycles\n",
+              i, intr_names[i], intr_cnt[i], intr_cycles[i]);
+
+  if (!intr_profiling)
+    return;
+  for (n = 0; n < TOP_SITES; n++)
+    {
+      struct off_site *s;
+      int best = -1;
+
+      for (i = 0; i <= OFF_SITE_CNT; i++)
+        if (!printed[i] && off_sites[i].cnt > 0
+            && (best < 0 || off_sites[i].cycles > off_sites[best].cycles))
+          best = i;
+      if (best < 0)
+        break;
+      printed[best] = true;
+      s = &off_sites[best];
+      if (s->pc != NULL)
+        printf ("Interrupts off at %p: ", s->pc);
+      else
+        printf ("Interrupts off at other sites: ");
+      printf ("%llu times, %llu cycles, %"PRIu64" cycles longest\n",
+              s->cnt, s->cycles, s->max_cycles);
+    }
+}
+
+/* Returns the profiling entry for call site PC, adding it if
+   there is room, or the overflow entry if there is not. */
+static struct off_site *
+find_off_site (void *pc) 
+{
+  unsigned idx = ((uintptr_t) pc >> 2) % OFF_SITE_CNT;
+  int i;
+
+  for (i = 0; i < OFF_SITE_CNT; i++)
+    {
+      struct off_site *s = &off_sites[(idx + i) % OFF_SITE_CNT];
+      if (s->pc == pc)
+        return s;
+      else if (s->pc == NULL)
+        {
+          s->pc = pc;
+          return s;
+        }
+    }
+  return &off_sites[OFF_SITE_CNT];
+}
+
 /* Dumps interrupt frame F to the console, for debugging. */
 void
 intr_dump_frame (const struct intr_frame *f) 
@@ -61,9 +61,12 @@ void intr_init (void);
 void intr_register_ext (uint8_t vec, intr_handler_func *, const char *name);
 void intr_register_int (uint8_t vec, int dpl, enum intr_level,
                         intr_handler_func *, const char *name);
+void intr_register_task (uint8_t vec, uint16_t tss_sel, const char *name);
 bool intr_context (void);
 void intr_yield_on_return (void);
 
+void intr_set_profiling (bool);
+void intr_print_stats (void);
 void intr_dump_frame (const struct intr_frame *);
 const char *intr_name (uint8_t vec);
 
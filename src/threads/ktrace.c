@@ -0,0 +1,185 @@
+#include "threads/ktrace.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Pages of records kept by -ktrace. */
+#define KTRACE_PAGES 32
+
+/* Records that fit in the ring and in one sector. */
+#define KTRACE_CNT (KTRACE_PAGES * PGSIZE / sizeof (struct ktrace_record))
+#define KTRACE_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (struct ktrace_record))
+
+/* Where -ktrace sends the trace at shutdown. */
+enum ktrace_dest
+  {
+    KTRACE_OFF,                 /* Not tracing. */
+    KTRACE_CONSOLE,             /* Printed, one line per record. */
+    KTRACE_SCRATCH              /* Written to the scratch device. */
+  };
+
+/* Names of events, for the console. */
+static const char *event_names[KTRACE_EVENT_CNT] =
+  {
+    "schedule", "syscall", "syscall-done", "page-fault",
+    "page-fault-done", "frame-get", "frame-get-done", "cache-read",
+    "cache-read-done", "block-submit", "block-done",
+  };
+
+/* True while records are being made.  Read without
+   synchronization by KTRACE(), so it only changes with
+   interrupts off. */
+bool ktrace_enabled;
+
+/* Ring of the last KTRACE_CNT records, allocated by
+   ktrace_init().  Protected by disabling interrupts. */
+static enum ktrace_dest dest;
+static struct ktrace_record *ring;
+static uint32_t seq;                    /* Records made so far. */
+
+/* Turns on tracing, for the trace to be sent to DEST at
+   shutdown: "console", the default if DEST is null, or
+   "scratch".  Returns false if DEST is unknown.  Takes effect at
+   ktrace_init(). */
+bool
+ktrace_set_dest (const char *dest_)
+{
+  if (dest_ == NULL || !strcmp (dest_, "console"))
+    dest = KTRACE_CONSOLE;
+  else if (!strcmp (dest_, "scratch"))
+    dest = KTRACE_SCRATCH;
+  else
+    return false;
+  return true;
+}
+
+/* Allocates the ring and starts tracing, if ktrace_set_dest()
+   asked for it.  The page allocator must be initialized. */
+void
+ktrace_init (void)
+{
+  if (dest == KTRACE_OFF)
+    return;
+  ring = palloc_get_multiple (0, KTRACE_PAGES);
+  if (ring == NULL)
+    {
+      printf ("ktrace: not enough memory, tracing off\n");
+      return;
+    }
+  ktrace_enabled = true;
+}
+
+/* Appends EVENT with ARGS to the ring, overwriting the oldest
+   record if it is full.  Use KTRACE() instead of calling this
+   directly.  May be called from an interrupt handler, and from
+   schedule() while no thread is running, so the thread is found
+   from the stack as running_thread() does, without
+   thread_current()'s checks. */
+void
+ktrace_add (enum ktrace_event event, const uint32_t args[4])
+{
+  struct thread *t = pg_round_down (&event);
+  enum intr_level old_level = intr_disable ();
+
+  if (ring != NULL)
+    {
+      struct ktrace_record *r = &ring[seq++ % KTRACE_CNT];
+      r->tsc = timer_tsc ();
+      r->tid = t->tid;
+      r->event = event;
+      memcpy (r->args, args, sizeof r->args);
+    }
+  intr_set_level (old_level);
+}
+
+/* Sends the records in the ring, oldest first, where
+   ktrace_set_dest() said, and stops tracing.
+
+   On the console, each record is a line
+   "ktrace: CYCLES TID EVENT ARG0 ARG1 ARG2 ARG3", with the
+   arguments in hex.  On the scratch device, sector 0 holds a
+   struct ktrace_header and the records follow, KTRACE_PER_SECTOR
+   to a sector.  -blktrace=scratch writes to the same place, so
+   only one of them may use it at a time. */
+void
+ktrace_dump (void)
+{
+  struct ktrace_record *records;
+  uint32_t cnt, first, i;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  records = ring;
+  ring = NULL;
+  ktrace_enabled = false;
+  intr_set_level (old_level);
+  if (records == NULL)
+    return;
+
+  cnt = seq < KTRACE_CNT ? seq : KTRACE_CNT;
+  first = seq - cnt;
+  if (dest == KTRACE_CONSOLE)
+    {
+      printf ("ktrace: %"PRIu32" records, %"PRIu32" dropped, "
+              "%"PRIu64" cycles/s\n", cnt, first, timer_tsc_hz ());
+      for (i = first; i != seq; i++)
+        {
+          struct ktrace_record *r = &records[i % KTRACE_CNT];
+          printf ("ktrace: %"PRIu64" %"PRId32" %s"
+                  " %"PRIx32" %"PRIx32" %"PRIx32" %"PRIx32"\n",
+                  r->tsc, r->tid,
+                  r->event < KTRACE_EVENT_CNT ? event_names[r->event] : "?",
+                  r->args[0], r->args[1], r->args[2], r->args[3]);
+        }
+    }
+  else
+    {
+      struct block *scratch = block_get_role (BLOCK_SCRATCH);
+      uint8_t sector[BLOCK_SECTOR_SIZE];
+      struct ktrace_header header;
+      block_sector_t sec_no = 0;
+
+      if (scratch == NULL)
+        {
+          printf ("ktrace: no scratch device\n");
+          goto done;
+        }
+      if (block_size (scratch) < 1 + DIV_ROUND_UP (cnt, KTRACE_PER_SECTOR))
+        {
+          cnt = (block_size (scratch) - 1) * KTRACE_PER_SECTOR;
+          first = seq - cnt;
+        }
+
+      memset (&header, 0, sizeof header);
+      memcpy (header.magic, "KTRACE\0\0", sizeof header.magic);
+      header.cnt = cnt;
+      header.record_size = sizeof (struct ktrace_record);
+      header.dropped = first;
+      header.tsc_hz = timer_tsc_hz ();
+      memset (sector, 0, sizeof sector);
+      memcpy (sector, &header, sizeof header);
+      block_write (scratch, sec_no++, sector);
+      for (i = 0; i < cnt; i++)
+        {
+          memcpy (sector + i % KTRACE_PER_SECTOR * sizeof *records,
+                  &records[(first + i) % KTRACE_CNT], sizeof *records);
+          if ((i + 1) % KTRACE_PER_SECTOR == 0 || i + 1 == cnt)
+            {
+              block_write (scratch, sec_no++, sector);
+              memset (sector, 0, sizeof sector);
+            }
+        }
+      printf ("ktrace: %"PRIu32" records written to %s\n",
+              cnt, block_name (scratch));
+    }
+ done:
+  palloc_free_multiple (records, KTRACE_PAGES);
+}
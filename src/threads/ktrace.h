@@ -0,0 +1,78 @@
+#ifndef THREADS_KTRACE_H
+#define THREADS_KTRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Kernel event tracing.
+
+   With -ktrace, each KTRACE() call site appends a fixed-size
+   record, stamped with the CPU cycle counter and the running
+   thread, to a ring in kernel memory that keeps the most recent
+   KTRACE_CNT events.  At shutdown the ring is printed or written
+   to the scratch device, where utils/pintos-ktrace decodes it
+   into a timeline.  With tracing off, a call site costs one test
+   of ktrace_enabled.
+
+   Events that span time come in pairs, so that the decoder can
+   tell how long the thread or the request took. */
+
+/* Traced events.  The decoder in utils/pintos-ktrace knows them
+   by number, so add new ones at the end. */
+enum ktrace_event
+  {
+    KTRACE_SCHEDULE,            /* Switch: next tid, old status. */
+    KTRACE_SYSCALL,             /* System call entry: number. */
+    KTRACE_SYSCALL_DONE,        /* System call exit: number, result. */
+    KTRACE_PAGE_FAULT,          /* Fault: address, write, user. */
+    KTRACE_PAGE_FAULT_DONE,     /* Fault handled: address, success. */
+    KTRACE_FRAME_GET,           /* Frame wanted: user page. */
+    KTRACE_FRAME_GET_DONE,      /* Frame found: user page, frame. */
+    KTRACE_CACHE_READ,          /* Cache read: sector. */
+    KTRACE_CACHE_READ_DONE,     /* Sector in cache: sector. */
+    KTRACE_BLOCK_SUBMIT,        /* Request queued: sector, count,
+                                   write, request. */
+    KTRACE_BLOCK_DONE,          /* Request finished: request. */
+    KTRACE_EVENT_CNT
+  };
+
+/* One event, as recorded.  Sixteen fill a sector when the trace
+   is written to the scratch device. */
+struct ktrace_record
+  {
+    uint64_t tsc;               /* CPU cycle counter. */
+    int32_t tid;                /* Running thread. */
+    uint32_t event;             /* enum ktrace_event. */
+    uint32_t args[4];           /* Event arguments, zero if unused. */
+  };
+
+/* Sector 0 of the scratch device, when the trace is written
+   there; the records follow from sector 1. */
+struct ktrace_header
+  {
+    char magic[8];              /* "KTRACE\0\0". */
+    uint32_t cnt;               /* Number of records written. */
+    uint32_t record_size;       /* sizeof (struct ktrace_record). */
+    uint32_t dropped;           /* Older records overwritten. */
+    uint32_t unused;
+    uint64_t tsc_hz;            /* Cycle counter rate, 0 if unknown. */
+  };
+
+extern bool ktrace_enabled;
+
+/* Records EVENT with up to four arguments, each converted to
+   uint32_t, if tracing is on. */
+#define KTRACE(EVENT, ...)                                      \
+        do                                                      \
+          {                                                     \
+            if (ktrace_enabled)                                 \
+              ktrace_add (EVENT, (uint32_t[4]) {__VA_ARGS__});  \
+          }                                                     \
+        while (0)
+
+bool ktrace_set_dest (const char *dest);
+void ktrace_init (void);
+void ktrace_add (enum ktrace_event, const uint32_t args[4]);
+void ktrace_dump (void);
+
+#endif /* threads/ktrace.h */
@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -32,15 +33,51 @@
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   the beginning of the allocated block's arena header.
+
+   In front of each descriptor's free list sits a magazine, a
+   small stack of free blocks that malloc() and free() use
+   without taking the descriptor lock or touching arena headers.
+   Only a miss or overflow moves a batch of blocks between the
+   magazine and the free list under the lock.  Blocks in a
+   magazine count as in use as far as their arenas are
+   concerned.  The magazine is per-CPU state protected by
+   disabling interrupts; with only the boot CPU running there is
+   one per descriptor.
+
+   With -mallocprof, every arena also records, right after its
+   header, which call site allocated each of its blocks, so that
+   malloc_print_stats() can report the live blocks and their peak
+   per descriptor and per caller, and how full each arena is.
+   This takes one byte per block out of every arena. */
+
+/* Maximum number of blocks in a magazine. */
+#define MAG_SIZE 16
+
+/* Magazine of free blocks. */
+struct magazine
+  {
+    size_t cnt;                 /* Number of blocks in slots. */
+    size_t capacity;            /* Usable slots, at most MAG_SIZE. */
+    struct block *slots[MAG_SIZE];
+  };
 
 /* Descriptor. */
 struct desc
   {
     size_t block_size;          /* Size of each element in bytes. */
     size_t blocks_per_arena;    /* Number of blocks in an arena. */
+    size_t block_ofs;           /* Offset of block 0 in its arena. */
     struct list free_list;      /* List of free blocks. */
     struct lock lock;           /* Lock. */
+    char name[16];              /* Lock name for lock_print_stats(). */
+    struct magazine mag;        /* Blocks cached in front of free_list. */
+
+    /* Under -mallocprof only. */
+    size_t live;                /* Blocks malloc() has handed out. */
+    size_t peak;                /* Largest value of LIVE. */
+    struct list arenas;         /* Arenas, by arena_prof's elem.
+                                   Protected by LOCK. */
   };
 
 /* Magic number for detecting arena corruption. */
@@ -60,27 +97,94 @@ struct block
     struct list_elem free_elem; /* Free list element. */
   };
 
+/* Follows the header of every arena under -mallocprof. */
+struct arena_prof
+  {
+    struct list_elem elem;      /* Element in desc's arenas list. */
+    uint8_t sites[];            /* Site of each block, as an index
+                                   into SITES; only sites[0] for a
+                                   big block. */
+  };
+
+/* A place malloc() is called from, under -mallocprof. */
+struct malloc_site
+  {
+    void *caller;               /* Return address of the call. */
+    size_t live;                /* Blocks allocated here still live. */
+    size_t live_bytes;          /* Bytes of those blocks. */
+    size_t peak_bytes;          /* Largest value of LIVE_BYTES. */
+    unsigned long long calls;   /* Number of allocations. */
+  };
+
+/* Call sites, a hash table by caller.  Entry 0 collects calls
+   from every site that finds the table full. */
+#define SITE_CNT 128
+static struct malloc_site sites[SITE_CNT];
+
+/* True under -mallocprof. */
+static bool malloc_profiling;
+
+/* Offset of a big block in its arena. */
+static size_t big_ofs = sizeof (struct arena);
+
 /* Our set of descriptors. */
 static struct desc descs[10];   /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static size_t desc_get_blocks (struct desc *, struct block **, size_t cnt);
+static void desc_put_blocks (struct desc *, struct block **, size_t cnt);
+static void *malloc_from (size_t, void *caller);
+static void *note_alloc (struct desc *, void *, size_t size, void *caller);
+static void note_free (struct desc *, void *);
+
+/* Turns on per-descriptor and per-caller accounting if ENABLE
+   is true.  Must be called before malloc_init(). */
+void
+malloc_set_profiling (bool enable)
+{
+  ASSERT (desc_cnt == 0);
+  malloc_profiling = enable;
+}
 
 /* Initializes the malloc() descriptors. */
 void
 malloc_init (void) 
 {
+  const size_t prof_size = sizeof (struct arena) + sizeof (struct arena_prof);
   size_t block_size;
 
+  if (malloc_profiling)
+    big_ofs = ROUND_UP (prof_size + 1, sizeof (void *));
+
   for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2)
     {
       struct desc *d = &descs[desc_cnt++];
       ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
       d->block_size = block_size;
       d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
+      d->block_ofs = sizeof (struct arena);
+      if (malloc_profiling)
+        {
+          /* Make room for a site byte per block. */
+          d->blocks_per_arena = (PGSIZE - prof_size) / (block_size + 1);
+          d->block_ofs = ROUND_UP (prof_size + d->blocks_per_arena,
+                                   sizeof (void *));
+          while (d->block_ofs + d->blocks_per_arena * block_size > PGSIZE)
+            d->blocks_per_arena--;
+        }
+      d->live = d->peak = 0;
+      list_init (&d->arenas);
       list_init (&d->free_list);
-      lock_init (&d->lock);
+      snprintf (d->name, sizeof d->name, "malloc %zu", block_size);
+      lock_init_named (&d->lock, d->name);
+
+      /* Keep at most half the blocks of an arena per batch so
+         that the largest classes don't pin many pages. */
+      d->mag.cnt = 0;
+      d->mag.capacity = d->blocks_per_arena < MAG_SIZE
+                        ? d->blocks_per_arena : MAG_SIZE;
     }
 }
 
@@ -88,10 +192,19 @@ malloc_init (void)
    Returns a null pointer if memory is not available. */
 void *
 malloc (size_t size) 
+{
+  return malloc_from (size, __builtin_return_address (0));
+}
+
+/* Does the work of malloc() for a call from CALLER. */
+static void *
+malloc_from (size_t size, void *caller)
 {
   struct desc *d;
-  struct block *b;
+  struct block *batch[MAG_SIZE];
   struct arena *a;
+  enum intr_level old_level;
+  size_t cnt, i;
 
   /* A null pointer satisfies a request for 0 bytes. */
   if (size == 0)
@@ -106,7 +219,7 @@ malloc (size_t size)
     {
       /* SIZE is too big for any descriptor.
          Allocate enough pages to hold SIZE plus an arena. */
-      size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
+      size_t page_cnt = DIV_ROUND_UP (size + big_ofs, PGSIZE);
       a = palloc_get_multiple (0, page_cnt);
       if (a == NULL)
         return NULL;
@@ -116,41 +229,35 @@ malloc (size_t size)
       a->magic = ARENA_MAGIC;
       a->desc = NULL;
       a->free_cnt = page_cnt;
-      return a + 1;
+      return note_alloc (NULL, (uint8_t *) a + big_ofs,
+                         page_cnt * PGSIZE - big_ofs, caller);
     }
 
-  lock_acquire (&d->lock);
-
-  /* If the free list is empty, create a new arena. */
-  if (list_empty (&d->free_list))
+  /* Fast path: take a block from the magazine. */
+  old_level = intr_disable ();
+  if (d->mag.cnt > 0)
     {
-      size_t i;
-
-      /* Allocate a page. */
-      a = palloc_get_page (0);
-      if (a == NULL) 
-        {
-          lock_release (&d->lock);
-          return NULL; 
-        }
-
-      /* Initialize arena and add its blocks to the free list. */
-      a->magic = ARENA_MAGIC;
-      a->desc = d;
-      a->free_cnt = d->blocks_per_arena;
-      for (i = 0; i < d->blocks_per_arena; i++) 
-        {
-          struct block *b = arena_to_block (a, i);
-          list_push_back (&d->free_list, &b->free_elem);
-        }
+      struct block *b = d->mag.slots[--d->mag.cnt];
+      intr_set_level (old_level);
+      return note_alloc (d, b, d->block_size, caller);
     }
+  intr_set_level (old_level);
 
-  /* Get a block from free list and return it. */
-  b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
-  a = block_to_arena (b);
-  a->free_cnt--;
-  lock_release (&d->lock);
-  return b;
+  /* Refill from the free list: one block to return, the rest of
+     the batch for the magazine. */
+  cnt = desc_get_blocks (d, batch, (d->mag.capacity + 1) / 2 + 1);
+  if (cnt == 0)
+    return NULL;
+
+  /* Other threads may have refilled the magazine while we held
+     the lock; anything that doesn't fit goes back. */
+  old_level = intr_disable ();
+  for (i = 1; i < cnt && d->mag.cnt < d->mag.capacity; i++)
+    d->mag.slots[d->mag.cnt++] = batch[i];
+  intr_set_level (old_level);
+  if (i < cnt)
+    desc_put_blocks (d, batch + i, cnt - i);
+  return note_alloc (d, batch[0], d->block_size, caller);
 }
 
 /* Allocates and return A times B bytes initialized to zeroes.
@@ -167,7 +274,7 @@ calloc (size_t a, size_t b)
     return NULL;
 
   /* Allocate and zero memory. */
-  p = malloc (size);
+  p = malloc_from (size, __builtin_return_address (0));
   if (p != NULL)
     memset (p, 0, size);
 
@@ -201,7 +308,7 @@ realloc (void *old_block, size_t new_size)
     }
   else 
     {
-      void *new_block = malloc (new_size);
+      void *new_block = malloc_from (new_size, __builtin_return_address (0));
       if (old_block != NULL && new_block != NULL)
         {
           size_t old_size = block_size (old_block);
@@ -227,42 +334,131 @@ free (void *p)
       if (d != NULL) 
         {
           /* It's a normal block.  We handle it here. */
+          struct block *batch[MAG_SIZE + 1];
+          enum intr_level old_level;
+          size_t cnt = 0;
+
+          note_free (d, b);
 
 #ifndef NDEBUG
           /* Clear the block to help detect use-after-free bugs. */
           memset (b, 0xcc, d->block_size);
 #endif
-  
-          lock_acquire (&d->lock);
 
-          /* Add block to free list. */
-          list_push_front (&d->free_list, &b->free_elem);
-
-          /* If the arena is now entirely unused, free it. */
-          if (++a->free_cnt >= d->blocks_per_arena) 
+          /* Fast path: push the block onto the magazine.  If it
+             is full, take half of it back to the free list along
+             with this block. */
+          old_level = intr_disable ();
+          if (d->mag.cnt < d->mag.capacity)
+            d->mag.slots[d->mag.cnt++] = b;
+          else
             {
-              size_t i;
-
-              ASSERT (a->free_cnt == d->blocks_per_arena);
-              for (i = 0; i < d->blocks_per_arena; i++) 
-                {
-                  struct block *b = arena_to_block (a, i);
-                  list_remove (&b->free_elem);
-                }
-              palloc_free_page (a);
+              while (d->mag.cnt > d->mag.capacity / 2)
+                batch[cnt++] = d->mag.slots[--d->mag.cnt];
+              batch[cnt++] = b;
             }
+          intr_set_level (old_level);
 
-          lock_release (&d->lock);
+          if (cnt > 0)
+            desc_put_blocks (d, batch, cnt);
         }
       else
         {
           /* It's a big block.  Free its pages. */
+          note_free (NULL, b);
           palloc_free_multiple (a, a->free_cnt);
           return;
         }
     }
 }
 
+/* Takes up to CNT blocks from D's free list, creating an arena
+   if the list is empty, and stores them in BLOCKS.  Returns the
+   number of blocks obtained, which is 0 only if no page is
+   available. */
+static size_t
+desc_get_blocks (struct desc *d, struct block **blocks, size_t cnt)
+{
+  size_t got;
+
+  lock_acquire (&d->lock);
+
+  /* If the free list is empty, create a new arena. */
+  if (list_empty (&d->free_list))
+    {
+      struct arena *a;
+      size_t i;
+
+      /* Allocate a page. */
+      a = palloc_get_page (0);
+      if (a == NULL) 
+        {
+          lock_release (&d->lock);
+          return 0; 
+        }
+
+      /* Initialize arena and add its blocks to the free list. */
+      a->magic = ARENA_MAGIC;
+      a->desc = d;
+      a->free_cnt = d->blocks_per_arena;
+      if (malloc_profiling)
+        list_push_back (&d->arenas, &((struct arena_prof *) (a + 1))->elem);
+      for (i = 0; i < d->blocks_per_arena; i++) 
+        {
+          struct block *b = arena_to_block (a, i);
+          list_push_back (&d->free_list, &b->free_elem);
+        }
+    }
+
+  /* Get blocks from the free list. */
+  for (got = 0; got < cnt && !list_empty (&d->free_list); got++)
+    {
+      struct block *b = list_entry (list_pop_front (&d->free_list),
+                                    struct block, free_elem);
+      block_to_arena (b)->free_cnt--;
+      blocks[got] = b;
+    }
+
+  lock_release (&d->lock);
+  return got;
+}
+
+/* Returns the CNT blocks in BLOCKS to D's free list, giving
+   arenas that become entirely unused back to the page
+   allocator. */
+static void
+desc_put_blocks (struct desc *d, struct block **blocks, size_t cnt)
+{
+  size_t i;
+
+  lock_acquire (&d->lock);
+  for (i = 0; i < cnt; i++)
+    {
+      struct block *b = blocks[i];
+      struct arena *a = block_to_arena (b);
+
+      /* Add block to free list. */
+      list_push_front (&d->free_list, &b->free_elem);
+
+      /* If the arena is now entirely unused, free it. */
+      if (++a->free_cnt >= d->blocks_per_arena) 
+        {
+          size_t j;
+
+          ASSERT (a->free_cnt == d->blocks_per_arena);
+          for (j = 0; j < d->blocks_per_arena; j++) 
+            {
+              struct block *b = arena_to_block (a, j);
+              list_remove (&b->free_elem);
+            }
+          if (malloc_profiling)
+            list_remove (&((struct arena_prof *) (a + 1))->elem);
+          palloc_free_page (a);
+        }
+    }
+  lock_release (&d->lock);
+}
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b)
@@ -275,8 +471,8 @@ block_to_arena (struct block *b)
 
   /* Check that the block is properly aligned for the arena. */
   ASSERT (a->desc == NULL
-          || (pg_ofs (b) - sizeof *a) % a->desc->block_size == 0);
-  ASSERT (a->desc != NULL || pg_ofs (b) == sizeof *a);
+          || (pg_ofs (b) - a->desc->block_ofs) % a->desc->block_size == 0);
+  ASSERT (a->desc != NULL || pg_ofs (b) == big_ofs);
 
   return a;
 }
@@ -289,6 +485,151 @@ arena_to_block (struct arena *a, size_t idx)
   ASSERT (a->magic == ARENA_MAGIC);
   ASSERT (idx < a->desc->blocks_per_arena);
   return (struct block *) ((uint8_t *) a
-                           + sizeof *a
+                           + a->desc->block_ofs
                            + idx * a->desc->block_size);
 }
+
+/* Returns the site byte of block B, allocated from D, or of the
+   big block B if D is null. */
+static uint8_t *
+block_site (struct desc *d, void *b)
+{
+  struct arena_prof *prof = (struct arena_prof *) (block_to_arena (b) + 1);
+  return &prof->sites[d != NULL ? (pg_ofs (b) - d->block_ofs) / d->block_size : 0];
+}
+
+/* Returns the index in SITES for CALLER, adding it if it is new
+   and there is room.  Interrupts must be off. */
+static uint8_t
+site_lookup (void *caller)
+{
+  size_t i = (uintptr_t) caller % (SITE_CNT - 1) + 1;
+  size_t probes;
+
+  for (probes = 1; probes < SITE_CNT; probes++)
+    {
+      if (sites[i].caller == caller)
+        return i;
+      if (sites[i].caller == NULL)
+        {
+          sites[i].caller = caller;
+          return i;
+        }
+      i = i % (SITE_CNT - 1) + 1;
+    }
+  return 0;
+}
+
+/* Records that CALLER obtained the SIZE-byte block B from D, or
+   the big block B if D is null, under -mallocprof.  Returns B. */
+static void *
+note_alloc (struct desc *d, void *b, size_t size, void *caller)
+{
+  enum intr_level old_level;
+  struct malloc_site *s;
+  uint8_t idx;
+
+  if (!malloc_profiling)
+    return b;
+
+  old_level = intr_disable ();
+  idx = site_lookup (caller);
+  *block_site (d, b) = idx;
+  s = &sites[idx];
+  s->calls++;
+  s->live++;
+  s->live_bytes += size;
+  if (s->live_bytes > s->peak_bytes)
+    s->peak_bytes = s->live_bytes;
+  if (d != NULL && ++d->live > d->peak)
+    d->peak = d->live;
+  intr_set_level (old_level);
+  return b;
+}
+
+/* Records that block B, from D, or the big block B if D is null,
+   is being freed, under -mallocprof. */
+static void
+note_free (struct desc *d, void *b)
+{
+  enum intr_level old_level;
+  struct malloc_site *s;
+
+  if (!malloc_profiling)
+    return;
+
+  old_level = intr_disable ();
+  s = &sites[*block_site (d, b)];
+  s->live--;
+  s->live_bytes -= block_size (b);
+  if (d != NULL)
+    d->live--;
+  intr_set_level (old_level);
+}
+
+/* Prints, under -mallocprof, the live and peak blocks of each
+   descriptor with how full its arenas are, then every call site
+   with blocks still live, most bytes first.  A site's address
+   can be turned into a function name with the backtrace
+   utility. */
+void
+malloc_print_stats (void)
+{
+  uint8_t order[SITE_CNT];
+  size_t order_cnt = 0;
+  struct desc *d;
+  size_t i;
+
+  if (!malloc_profiling)
+    return;
+
+  for (d = descs; d < descs + desc_cnt; d++)
+    {
+      /* Arenas by quarter of blocks in use, counting those in
+         magazines. */
+      size_t quarters[4] = {0, 0, 0, 0};
+      size_t arena_cnt = 0;
+      struct list_elem *e;
+
+      lock_acquire (&d->lock);
+      for (e = list_begin (&d->arenas); e != list_end (&d->arenas);
+           e = list_next (e))
+        {
+          struct arena *a = (struct arena *) list_entry (e, struct arena_prof,
+                                                         elem) - 1;
+          size_t used = d->blocks_per_arena - a->free_cnt;
+          quarters[used * 4 / (d->blocks_per_arena + 1)]++;
+          arena_cnt++;
+        }
+      lock_release (&d->lock);
+
+      if (d->peak > 0)
+        printf ("Malloc %zu: %zu live, %zu peak, %zu arenas, "
+                "%zu/%zu/%zu/%zu of them under 1/4, 1/2, 3/4 and over 3/4 used\n",
+                d->block_size, d->live, d->peak, arena_cnt,
+                quarters[0], quarters[1], quarters[2], quarters[3]);
+    }
+
+  /* Sort the live sites by bytes, most first. */
+  for (i = 0; i < SITE_CNT; i++)
+    if (sites[i].live > 0)
+      {
+        size_t j = order_cnt++;
+        while (j > 0 && sites[order[j - 1]].live_bytes < sites[i].live_bytes)
+          {
+            order[j] = order[j - 1];
+            j--;
+          }
+        order[j] = i;
+      }
+  for (i = 0; i < order_cnt; i++)
+    {
+      struct malloc_site *s = &sites[order[i]];
+      if (order[i] == 0)
+        printf ("Malloc other sites: ");
+      else
+        printf ("Malloc site %p: ", s->caller);
+      printf ("%zu live, %zu bytes, %zu peak bytes, %llu calls\n",
+              s->live, s->live_bytes, s->peak_bytes, s->calls);
+    }
+}
@@ -2,13 +2,15 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
-#include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -23,22 +25,104 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Within a pool, free pages are managed by a binary buddy
+   allocator.  Free memory is kept as blocks of 2**K pages,
+   aligned to 2**K pages from the pool base, on one free list per
+   order K.  An allocation of N pages splits the smallest block
+   that fits and gives back the pages beyond N; a free breaks its
+   range into aligned blocks and merges each with its buddy for
+   as long as the buddy is free too.  Both take O(log n) steps.
+   The list element of a free block lives in its first page.
+
+   Single pages, by far the most common request, go through a
+   small LIFO stack of free pages per pool ahead of the buddy
+   lists.  The stack is refilled and drained in batches, so most
+   single-page allocations and frees are O(1) and reuse the page
+   most recently freed, which is likely still in the CPU cache.
+   Pages on the stack are free as far as used_map and
+   palloc_free_cnt() are concerned.
+
+   The idle thread also keeps a reserve of pages it has already
+   filled with zeros, through prezero_idle(), so that PAL_ZERO
+   requests for a single page need no memset on the caller's
+   path.  Any request may take a reserved page as a last resort.
+
+   Pool state is guarded by disabling interrupts, not a sleeping
+   lock, because the scheduler frees dying threads' pages with
+   interrupts off in thread_schedule_tail(), where waiting for a
+   lock is impossible.  Every critical section is
+   O(log n) list operations. */
+
+/* Largest block order.  2**20 pages cover 4 GB, more than any
+   pool. */
+#define MAX_ORDER 20
+
+/* Capacity of a pool's free-page stack, and how many pages a
+   refill or drain moves at once. */
+#define PAGE_CACHE_SIZE 32
+#define PAGE_CACHE_BATCH (PAGE_CACHE_SIZE / 2)
+
+/* Number of pre-zeroed pages a pool keeps in reserve. */
+#define ZERO_POOL_SIZE 32
+
+/* order_map value of a page that doesn't start a free block. */
+#define ORDER_NONE UINT8_MAX
 
 /* A memory pool. */
 struct pool
   {
-    struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
     uint8_t *base;                      /* Base of pool. */
+    size_t page_cnt;                    /* Number of pages in pool. */
+    size_t free_pages;                  /* Number of free pages. */
+    uint8_t *order_map;                 /* Per page: order of the free block
+                                           it starts, or ORDER_NONE. */
+    struct list free_lists[MAX_ORDER + 1]; /* Free blocks by order. */
+    size_t block_cnt[MAX_ORDER + 1];    /* Length of each free list. */
+    unsigned failed_cnt;                /* Allocations that failed. */
+    size_t cache[PAGE_CACHE_SIZE];      /* Free single pages, by index. */
+    size_t cache_cnt;                   /* Number of pages in cache. */
+    unsigned cache_hits;                /* Single pages served by cache. */
+    size_t zeroed[ZERO_POOL_SIZE];      /* Pre-zeroed free pages, by index. */
+    size_t zeroed_cnt;                  /* Number of pages in zeroed. */
+    unsigned zeroed_hits;               /* PAL_ZERO requests served by it. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
+/* Lending.  When the user pool runs dry, PAL_USER requests,
+   including user frames and buffer cache growth, borrow free
+   kernel pages for as long as the kernel pool keeps more than
+   lend_low pages free.  After that lending waits until more than
+   lend_high are free again.  A lent page goes back to the kernel
+   pool when it is freed.  Both watermarks are set from -kl and
+   -kh by palloc_set_watermarks(); lent pages are covered by
+   palloc_user_cnt() and palloc_user_index() so that frame tables
+   can track them.  Guarded by the kernel pool's lock. */
+static size_t lend_low, lend_high;
+static bool lending = true;
+static size_t lent_cnt;         /* Pages ever lent to user requests. */
+
+/* Fills the pre-zeroed reserves in idle time. */
+static struct idle_work prezero_work;
+
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static size_t buddy_alloc (struct pool *, size_t page_cnt);
+static void buddy_free (struct pool *, size_t page_idx, size_t page_cnt);
+static size_t cache_pop (struct pool *);
+static bool prezero_pool (struct pool *);
+static idle_work_func prezero_idle;
+static size_t pool_alloc (struct pool *, enum palloc_flags, size_t page_cnt,
+                          size_t reserve, bool *zeroed);
+static bool may_lend (struct pool *, size_t page_cnt, size_t reserve);
+static size_t pool_free_cnt (const struct pool *);
+static void cache_push (struct pool *, size_t page_idx);
+static void print_pool_stats (const struct pool *, const char *name);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -59,6 +143,28 @@ palloc_init (size_t user_page_limit)
   init_pool (&kernel_pool, free_start, kernel_pages, "kernel pool");
   init_pool (&user_pool, free_start + kernel_pages * PGSIZE,
              user_pages, "user pool");
+
+  /* By default lend down to a quarter of the kernel pool. */
+  lend_low = kernel_pool.page_cnt / 4 + 1;
+  lend_high = kernel_pool.page_cnt / 2 + 1;
+
+  thread_add_idle_work (&prezero_work, prezero_idle);
+}
+
+/* Sets the kernel pool's lending watermarks to LOW and HIGH free
+   pages.  SIZE_MAX leaves a watermark at its default.  Must be
+   called after palloc_init(). */
+void
+palloc_set_watermarks (size_t low, size_t high)
+{
+  if (low != SIZE_MAX)
+    lend_low = low;
+  if (high != SIZE_MAX)
+    lend_high = high;
+  if (lend_low == 0)
+    lend_low = 1;
+  if (lend_high < lend_low)
+    lend_high = lend_low;
 }
 
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
@@ -71,15 +177,21 @@ void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+  bool zeroed = false;
   void *pages;
   size_t page_idx;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
+  page_idx = pool_alloc (pool, flags, page_cnt, 0, &zeroed);
+  if (page_idx == BITMAP_ERROR && pool == &user_pool)
+    {
+      /* Borrow from the kernel pool, keeping its low watermark
+         free. */
+      pool = &kernel_pool;
+      page_idx = pool_alloc (pool, flags, page_cnt, lend_low, &zeroed);
+    }
 
   if (page_idx != BITMAP_ERROR)
     pages = pool->base + PGSIZE * page_idx;
@@ -88,7 +200,7 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 
   if (pages != NULL) 
     {
-      if (flags & PAL_ZERO)
+      if ((flags & PAL_ZERO) && !zeroed)
         memset (pages, 0, PGSIZE * page_cnt);
     }
   else 
@@ -118,6 +230,7 @@ void
 palloc_free_multiple (void *pages, size_t page_cnt) 
 {
   struct pool *pool;
+  enum intr_level old_level;
   size_t page_idx;
 
   ASSERT (pg_ofs (pages) == 0);
@@ -137,8 +250,14 @@ palloc_free_multiple (void *pages, size_t page_cnt)
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
+  old_level = intr_disable ();
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  if (page_cnt == 1)
+    cache_push (pool, page_idx);
+  else
+    buddy_free (pool, page_idx, page_cnt);
+  intr_set_level (old_level);
 }
 
 /* Frees the page at PAGE. */
@@ -148,15 +267,79 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Returns the number of free pages in POOL. */
+static size_t
+pool_free_cnt (const struct pool *pool)
+{
+  return pool->free_pages + pool->cache_cnt + pool->zeroed_cnt;
+}
+
+/* Returns the number of free pages in the kernel pool, or if
+   PAL_USER is set in FLAGS, the number available to user
+   requests: the user pool's plus what the kernel pool would lend
+   right now. */
+size_t
+palloc_free_cnt (enum palloc_flags flags)
+{
+  size_t kernel_free = pool_free_cnt (&kernel_pool);
+
+  if (!(flags & PAL_USER))
+    return kernel_free;
+  return (pool_free_cnt (&user_pool)
+          + (lending && kernel_free > lend_low ? kernel_free - lend_low : 0));
+}
+
+/* Returns the number of pages in the kernel pool, or if PAL_USER
+   is set in FLAGS, in the user pool. */
+size_t
+palloc_page_cnt (enum palloc_flags flags)
+{
+  return flags & PAL_USER ? user_pool.page_cnt : kernel_pool.page_cnt;
+}
+
+/* Prints free memory and fragmentation of both pools. */
+void
+palloc_print_stats (void)
+{
+  print_pool_stats (&kernel_pool, "kernel");
+  print_pool_stats (&user_pool, "user");
+  printf ("Palloc: %zu kernel pages lent to user requests, "
+          "watermarks %zu/%zu\n", lent_cnt, lend_low, lend_high);
+}
+
+/* Returns the number of pages that can back user requests, free
+   or not: the user pool's plus the kernel pool's, since the
+   latter may be lent. */
+size_t
+palloc_user_cnt (void)
+{
+  return kernel_pool.page_cnt + user_pool.page_cnt;
+}
+
+/* Returns the index of PAGE among the palloc_user_cnt() pages
+   that can back user requests, or SIZE_MAX if PAGE belongs to
+   neither pool. */
+size_t
+palloc_user_index (const void *page)
+{
+  if (page_from_pool (&kernel_pool, (void *) page))
+    return pg_no (page) - pg_no (kernel_pool.base);
+  if (page_from_pool (&user_pool, (void *) page))
+    return kernel_pool.page_cnt + pg_no (page) - pg_no (user_pool.base);
+  return SIZE_MAX;
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
+  /* We'll put the pool's used_map and order_map at its base.
+     Calculate the space needed for them and subtract it from the
+     pool's size. */
+  size_t bm_size = bitmap_buf_size (page_cnt);
+  size_t bm_pages = DIV_ROUND_UP (bm_size + page_cnt, PGSIZE);
+  size_t i;
   if (bm_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
   page_cnt -= bm_pages;
@@ -164,9 +347,24 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
   printf ("%zu pages available in %s.\n", page_cnt, name);
 
   /* Initialize the pool. */
-  lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
+  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_size);
+  p->order_map = (uint8_t *) base + bm_size;
+  memset (p->order_map, ORDER_NONE, page_cnt);
   p->base = base + bm_pages * PGSIZE;
+  p->page_cnt = page_cnt;
+  p->free_pages = 0;
+  p->failed_cnt = 0;
+  p->cache_cnt = 0;
+  p->cache_hits = 0;
+  p->zeroed_cnt = 0;
+  p->zeroed_hits = 0;
+  for (i = 0; i <= MAX_ORDER; i++)
+    {
+      list_init (&p->free_lists[i]);
+      p->block_cnt[i] = 0;
+    }
+
+  buddy_free (p, 0, page_cnt);
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -180,3 +378,303 @@ page_from_pool (const struct pool *pool, void *page)
 
   return page_no >= start_page && page_no < end_page;
 }
+
+/* Allocates PAGE_CNT contiguous pages from POOL, as for
+   palloc_get_multiple(), and returns the index of the first or
+   BITMAP_ERROR.  Sets *ZEROED to true if the page came from the
+   pre-zeroed reserve.  If RESERVE is nonzero the pages are being
+   lent to the user pool, and the allocation fails rather than
+   bring POOL's free pages below RESERVE. */
+static size_t
+pool_alloc (struct pool *pool, enum palloc_flags flags, size_t page_cnt,
+            size_t reserve, bool *zeroed)
+{
+  enum intr_level old_level;
+  size_t page_idx;
+
+  old_level = intr_disable ();
+  if (reserve > 0 && !may_lend (pool, page_cnt, reserve))
+    page_idx = BITMAP_ERROR;
+  else if (page_cnt == 1)
+    {
+      if ((flags & PAL_ZERO) && pool->zeroed_cnt > 0)
+        {
+          page_idx = pool->zeroed[--pool->zeroed_cnt];
+          pool->zeroed_hits++;
+          *zeroed = true;
+        }
+      else
+        {
+          page_idx = cache_pop (pool);
+          if (page_idx == BITMAP_ERROR && pool->zeroed_cnt > 0)
+            page_idx = pool->zeroed[--pool->zeroed_cnt];
+        }
+    }
+  else
+    {
+      page_idx = buddy_alloc (pool, page_cnt);
+
+      /* Pages parked on the stack may be what keeps a large
+         enough block from forming. */
+      if (page_idx == BITMAP_ERROR
+          && pool->cache_cnt + pool->zeroed_cnt > 0)
+        {
+          while (pool->cache_cnt > 0)
+            buddy_free (pool, pool->cache[--pool->cache_cnt], 1);
+          while (pool->zeroed_cnt > 0)
+            buddy_free (pool, pool->zeroed[--pool->zeroed_cnt], 1);
+          page_idx = buddy_alloc (pool, page_cnt);
+        }
+    }
+  if (page_idx != BITMAP_ERROR)
+    {
+      bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+      if (reserve > 0)
+        lent_cnt += page_cnt;
+    }
+  else if (reserve == 0)
+    pool->failed_cnt++;
+  intr_set_level (old_level);
+
+  return page_idx;
+}
+
+/* Returns true if PAGE_CNT pages of POOL may be lent out without
+   its free pages dropping below RESERVE.  Once lending hits that
+   low watermark it stops until the pool's free pages are back
+   above lend_high.  POOL's lock must be held. */
+static bool
+may_lend (struct pool *pool, size_t page_cnt, size_t reserve)
+{
+  size_t free = pool_free_cnt (pool);
+
+  if (!lending && free > lend_high)
+    lending = true;
+  if (lending && free < reserve + page_cnt)
+    lending = false;
+  return lending;
+}
+
+/* Returns the kernel virtual address of page PAGE_IDX of POOL. */
+static inline struct list_elem *
+block_elem (const struct pool *pool, size_t page_idx)
+{
+  return (struct list_elem *) (pool->base + PGSIZE * page_idx);
+}
+
+/* Returns the index of the page that starts the free block whose
+   list element is E. */
+static inline size_t
+elem_to_idx (const struct pool *pool, struct list_elem *e)
+{
+  return ((uint8_t *) e - pool->base) / PGSIZE;
+}
+
+/* Puts the free block of 2**ORDER pages at PAGE_IDX on its free
+   list. */
+static void
+block_insert (struct pool *pool, size_t page_idx, unsigned order)
+{
+  pool->order_map[page_idx] = order;
+  list_push_front (&pool->free_lists[order], block_elem (pool, page_idx));
+  pool->block_cnt[order]++;
+}
+
+/* Takes the free block of 2**ORDER pages at PAGE_IDX off its free
+   list. */
+static void
+block_remove (struct pool *pool, size_t page_idx, unsigned order)
+{
+  ASSERT (pool->order_map[page_idx] == order);
+  pool->order_map[page_idx] = ORDER_NONE;
+  list_remove (block_elem (pool, page_idx));
+  pool->block_cnt[order]--;
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL's free lists and
+   returns the index of the first, or BITMAP_ERROR if no free
+   block is large enough.  POOL's lock must be held. */
+static size_t
+buddy_alloc (struct pool *pool, size_t page_cnt)
+{
+  unsigned order, k;
+  size_t page_idx;
+
+  for (order = 0; order <= MAX_ORDER && ((size_t) 1 << order) < page_cnt;
+       order++)
+    continue;
+  for (k = order; k <= MAX_ORDER; k++)
+    if (!list_empty (&pool->free_lists[k]))
+      break;
+  if (k > MAX_ORDER)
+    return BITMAP_ERROR;
+
+  page_idx = elem_to_idx (pool, list_front (&pool->free_lists[k]));
+  block_remove (pool, page_idx, k);
+  pool->free_pages -= (size_t) 1 << k;
+
+  /* Give back what we don't need: the upper halves split off on
+     the way down to ORDER, then the tail beyond PAGE_CNT. */
+  while (k > order)
+    {
+      k--;
+      block_insert (pool, page_idx + ((size_t) 1 << k), k);
+      pool->free_pages += (size_t) 1 << k;
+    }
+  if (page_cnt < ((size_t) 1 << order))
+    buddy_free (pool, page_idx + page_cnt, ((size_t) 1 << order) - page_cnt);
+
+  return page_idx;
+}
+
+/* Returns the PAGE_CNT pages starting at PAGE_IDX to POOL's free
+   lists, merging them with free buddies.  POOL's lock must be
+   held, except during initialization. */
+static void
+buddy_free (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  size_t end = page_idx + page_cnt;
+
+  ASSERT (end <= pool->page_cnt);
+  pool->free_pages += page_cnt;
+
+  while (page_idx < end)
+    {
+      /* Largest aligned block that starts at PAGE_IDX and fits. */
+      unsigned order = 0;
+      size_t idx;
+
+      while (order < MAX_ORDER
+             && page_idx % ((size_t) 1 << (order + 1)) == 0
+             && page_idx + ((size_t) 1 << (order + 1)) <= end)
+        order++;
+
+      idx = page_idx;
+      page_idx += (size_t) 1 << order;
+
+      /* Merge with the buddy while it is a free block of the same
+         order. */
+      while (order < MAX_ORDER)
+        {
+          size_t buddy = idx ^ ((size_t) 1 << order);
+          if (buddy + ((size_t) 1 << order) > pool->page_cnt
+              || pool->order_map[buddy] != order)
+            break;
+          block_remove (pool, buddy, order);
+          if (buddy < idx)
+            idx = buddy;
+          order++;
+        }
+      block_insert (pool, idx, order);
+    }
+}
+
+/* Returns the index of a free page from POOL's free-page stack,
+   refilling the stack from the buddy lists first if it is empty,
+   or BITMAP_ERROR if the pool has no free page.  POOL's lock must
+   be held. */
+static size_t
+cache_pop (struct pool *pool)
+{
+  if (pool->cache_cnt > 0)
+    pool->cache_hits++;
+  else
+    while (pool->cache_cnt < PAGE_CACHE_BATCH)
+      {
+        size_t page_idx = buddy_alloc (pool, 1);
+        if (page_idx == BITMAP_ERROR)
+          break;
+        pool->cache[pool->cache_cnt++] = page_idx;
+      }
+
+  return pool->cache_cnt > 0 ? pool->cache[--pool->cache_cnt] : BITMAP_ERROR;
+}
+
+/* Pushes free page PAGE_IDX onto POOL's free-page stack, first
+   returning a batch of the stack's oldest pages to the buddy lists
+   if it is full.  POOL's lock must be held. */
+static void
+cache_push (struct pool *pool, size_t page_idx)
+{
+  if (pool->cache_cnt == PAGE_CACHE_SIZE)
+    {
+      size_t i;
+
+      for (i = 0; i < PAGE_CACHE_BATCH; i++)
+        buddy_free (pool, pool->cache[i], 1);
+      memmove (pool->cache, pool->cache + PAGE_CACHE_BATCH,
+               sizeof *pool->cache * (PAGE_CACHE_SIZE - PAGE_CACHE_BATCH));
+      pool->cache_cnt -= PAGE_CACHE_BATCH;
+    }
+  pool->cache[pool->cache_cnt++] = page_idx;
+}
+
+/* Zeroes one free page into the reserve of the user pool, or if
+   that is full, of the kernel pool.  Returns false if both
+   reserves are full or there was no page to spare.  Run by the
+   idle thread with interrupts on; the memset runs with them on, so
+   a thread that becomes ready preempts it as usual. */
+static bool
+prezero_idle (void)
+{
+  return prezero_pool (&user_pool) || prezero_pool (&kernel_pool);
+}
+
+/* Moves one page from POOL's buddy lists into its pre-zeroed
+   reserve, zeroing it with interrupts on.  Returns true if it did.
+   Pages already on the free-page stack are left alone, since they
+   are the cache-warm ones. */
+static bool
+prezero_pool (struct pool *pool)
+{
+  enum intr_level old_level;
+  size_t page_idx = BITMAP_ERROR;
+
+  ASSERT (intr_get_level () == INTR_ON);
+
+  old_level = intr_disable ();
+  if (pool->zeroed_cnt < ZERO_POOL_SIZE)
+    page_idx = buddy_alloc (pool, 1);
+  intr_set_level (old_level);
+  if (page_idx == BITMAP_ERROR)
+    return false;
+
+  memset (pool->base + PGSIZE * page_idx, 0, PGSIZE);
+
+  /* ZEROED can't have filled up meanwhile: only the idle thread
+     adds to it. */
+  old_level = intr_disable ();
+  ASSERT (pool->zeroed_cnt < ZERO_POOL_SIZE);
+  pool->zeroed[pool->zeroed_cnt++] = page_idx;
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Prints free memory, the size of the largest free block, and the
+   free block count per order for POOL, named NAME. */
+static void
+print_pool_stats (const struct pool *pool, const char *name)
+{
+  size_t largest = 0;
+  int k;
+
+  for (k = MAX_ORDER; k >= 0; k--)
+    if (pool->block_cnt[k] > 0)
+      {
+        largest = (size_t) 1 << k;
+        break;
+      }
+
+  printf ("Palloc %s: %zu of %zu pages free, largest free block %zu pages "
+          "(%zu%% fragmented), %u failed allocations, %u page cache hits, "
+          "%u pre-zeroed hits\n",
+          name, pool->free_pages + pool->cache_cnt + pool->zeroed_cnt,
+          pool->page_cnt, largest,
+          pool->free_pages > 0 ? 100 - largest * 100 / pool->free_pages : 0,
+          pool->failed_cnt, pool->cache_hits, pool->zeroed_hits);
+  printf ("Palloc %s: free blocks by order:", name);
+  for (k = 0; k <= MAX_ORDER; k++)
+    if (pool->block_cnt[k] > 0)
+      printf (" %d:%zu", k, pool->block_cnt[k]);
+  printf ("\n");
+}
@@ -1,6 +1,7 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
 /* How to allocate pages. */
@@ -12,9 +13,15 @@ enum palloc_flags
   };
 
 void palloc_init (size_t user_page_limit);
+void palloc_set_watermarks (size_t low, size_t high);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+size_t palloc_free_cnt (enum palloc_flags);
+size_t palloc_page_cnt (enum palloc_flags);
+void palloc_print_stats (void);
+size_t palloc_user_cnt (void);
+size_t palloc_user_index (const void *);
 
 #endif /* threads/palloc.h */
@@ -0,0 +1,202 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* Slab header, at the start of each slab's page.  The objects
+   follow, starting at the owning cache's obj_ofs. */
+struct slab
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct slab_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* Element in cache's partial list. */
+    uint16_t free_cnt;          /* Number of free objects. */
+    uint16_t free[];            /* Indexes of free objects, as a stack. */
+  };
+
+/* All caches, for slab_print_stats(). */
+static struct list all_caches = LIST_INITIALIZER (all_caches);
+
+static struct slab *slab_create (struct slab_cache *);
+static void *slab_object (struct slab_cache *, struct slab *, size_t idx);
+
+/* Initializes cache C for objects of SIZE bytes, named NAME.  If
+   CTOR is nonnull, it is called on each object when its slab is
+   created.  Allocates no memory until the first slab_alloc(). */
+void
+slab_cache_init (struct slab_cache *c, const char *name, size_t size,
+                 void (*ctor) (void *))
+{
+  enum intr_level old_level;
+  size_t n;
+
+  ASSERT (c != NULL);
+  ASSERT (size > 0);
+
+  size = ROUND_UP (size, sizeof (void *));
+  n = (PGSIZE - sizeof (struct slab)) / (size + sizeof (uint16_t));
+  while (n > 0
+         && ROUND_UP (sizeof (struct slab) + n * sizeof (uint16_t),
+                      sizeof (void *)) + n * size > PGSIZE)
+    n--;
+  ASSERT (n > 0 && n <= UINT16_MAX);
+
+  c->name = name;
+  c->obj_size = size;
+  c->objs_per_slab = n;
+  c->obj_ofs = ROUND_UP (sizeof (struct slab) + n * sizeof (uint16_t),
+                         sizeof (void *));
+  c->ctor = ctor;
+  lock_init (&c->lock);
+  list_init (&c->partial);
+  c->spare = NULL;
+  c->slab_cnt = c->in_use = c->peak = 0;
+  c->alloc_cnt = 0;
+
+  old_level = intr_disable ();
+  list_push_back (&all_caches, &c->elem);
+  intr_set_level (old_level);
+}
+
+/* Obtains and returns an object from cache C.  Returns a null
+   pointer if memory is not available. */
+void *
+slab_alloc (struct slab_cache *c)
+{
+  struct slab *s;
+  void *obj;
+
+  lock_acquire (&c->lock);
+
+  if (!list_empty (&c->partial))
+    s = list_entry (list_front (&c->partial), struct slab, elem);
+  else
+    {
+      if (c->spare != NULL)
+        {
+          s = c->spare;
+          c->spare = NULL;
+        }
+      else
+        {
+          s = slab_create (c);
+          if (s == NULL)
+            {
+              lock_release (&c->lock);
+              return NULL;
+            }
+        }
+      list_push_front (&c->partial, &s->elem);
+    }
+
+  obj = slab_object (c, s, s->free[--s->free_cnt]);
+  if (s->free_cnt == 0)
+    list_remove (&s->elem);
+
+  c->alloc_cnt++;
+  if (++c->in_use > c->peak)
+    c->peak = c->in_use;
+  lock_release (&c->lock);
+  return obj;
+}
+
+/* Returns OBJ, which must have been obtained from cache C with
+   slab_alloc(), to C.  A null OBJ is ignored. */
+void
+slab_free (struct slab_cache *c, void *obj)
+{
+  struct slab *s;
+  size_t ofs;
+
+  if (obj == NULL)
+    return;
+
+  s = pg_round_down (obj);
+  ofs = pg_ofs (obj);
+  ASSERT (s->magic == SLAB_MAGIC);
+  ASSERT (s->cache == c);
+  ASSERT (ofs >= c->obj_ofs && (ofs - c->obj_ofs) % c->obj_size == 0);
+
+  lock_acquire (&c->lock);
+
+  ASSERT (s->free_cnt < c->objs_per_slab);
+  s->free[s->free_cnt++] = (ofs - c->obj_ofs) / c->obj_size;
+  if (s->free_cnt == 1)
+    list_push_front (&c->partial, &s->elem);
+
+  /* Keep one empty slab around so that a cache hovering at a
+     slab boundary doesn't go back to the page allocator on every
+     call; give any other back. */
+  if (s->free_cnt == c->objs_per_slab)
+    {
+      list_remove (&s->elem);
+      if (c->spare == NULL)
+        c->spare = s;
+      else
+        {
+          s->magic = 0;
+          palloc_free_page (s);
+          c->slab_cnt--;
+        }
+    }
+
+  c->in_use--;
+  lock_release (&c->lock);
+}
+
+/* Prints usage statistics for every cache that has been used. */
+void
+slab_print_stats (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&all_caches); e != list_end (&all_caches);
+       e = list_next (e))
+    {
+      struct slab_cache *c = list_entry (e, struct slab_cache, elem);
+      if (c->alloc_cnt > 0)
+        printf ("Slab %s: %zu in use, %zu peak, %zu slabs, %llu allocs\n",
+                c->name, c->in_use, c->peak, c->slab_cnt, c->alloc_cnt);
+    }
+}
+
+/* Allocates a page for a new slab of cache C, with every object
+   free and constructed.  C's lock must be held.  Returns a null
+   pointer if no page is available. */
+static struct slab *
+slab_create (struct slab_cache *c)
+{
+  struct slab *s = palloc_get_page (0);
+  size_t i;
+
+  if (s == NULL)
+    return NULL;
+
+  s->magic = SLAB_MAGIC;
+  s->cache = c;
+  s->free_cnt = c->objs_per_slab;
+  for (i = 0; i < c->objs_per_slab; i++)
+    {
+      /* Hand out low addresses first. */
+      s->free[i] = c->objs_per_slab - 1 - i;
+      if (c->ctor != NULL)
+        c->ctor (slab_object (c, s, i));
+    }
+  c->slab_cnt++;
+  return s;
+}
+
+/* Returns object IDX in slab S of cache C. */
+static void *
+slab_object (struct slab_cache *c, struct slab *s, size_t idx)
+{
+  ASSERT (idx < c->objs_per_slab);
+  return (uint8_t *) s + c->obj_ofs + idx * c->obj_size;
+}
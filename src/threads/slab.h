@@ -0,0 +1,44 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <list.h>
+#include <stddef.h>
+#include "threads/synch.h"
+
+/* Slab cache.
+
+   Hands out fixed-size objects of a single type from whole pages
+   obtained with palloc_get_page().  Each page ("slab") starts
+   with a header holding a stack of the indexes of its free
+   objects, so allocation and freeing are O(1) and objects of a
+   type sit together in memory.
+
+   If a constructor is given, it runs once on each object when
+   its slab is created, not on every allocation, so an object
+   must be back in its constructed state when it is freed. */
+struct slab_cache
+  {
+    const char *name;           /* Name, for slab_print_stats(). */
+    size_t obj_size;            /* Size of each object in bytes. */
+    size_t objs_per_slab;       /* Number of objects in a slab. */
+    size_t obj_ofs;             /* Offset of first object in a slab. */
+    void (*ctor) (void *);      /* Constructor, or a null pointer. */
+    struct lock lock;           /* Protects the members below. */
+    struct list partial;        /* Slabs with both free and used objects. */
+    struct slab *spare;         /* An entirely free slab, or a null pointer. */
+
+    /* Statistics. */
+    size_t slab_cnt;            /* Pages currently held. */
+    size_t in_use;              /* Objects currently allocated. */
+    size_t peak;                /* Largest value of in_use. */
+    unsigned long long alloc_cnt; /* Number of slab_alloc() calls. */
+    struct list_elem elem;      /* Element in list of all caches. */
+  };
+
+void slab_cache_init (struct slab_cache *, const char *name, size_t size,
+                      void (*ctor) (void *));
+void *slab_alloc (struct slab_cache *);
+void slab_free (struct slab_cache *, void *);
+void slab_print_stats (void);
+
+#endif /* threads/slab.h */
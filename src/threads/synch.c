@@ -24,13 +24,90 @@
 */
 
 #include "threads/synch.h"
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "devices/timer.h"
 
-static bool cond_sema_priority_more (const struct list_elem *lhs, const struct list_elem *rhs, void *aux UNUSED);
-static bool thread_priority_more (const struct list_elem *lhs, const struct list_elem *rhs, void *aux UNUSED);
+static bool wait_less (const struct heap_elem *a, const struct heap_elem *b, void *aux UNUSED);
+static void sema_wake (struct semaphore *sema);
+static void lock_release_no_yield (struct lock *lock);
+static void yield_if_preempted (void);
+
+/* Arrival counter for wait queues. */
+static unsigned wait_seq;
+
+/* Locks initialized with lock_init_named(), for lock_print_stats(). */
+static struct list named_locks = LIST_INITIALIZER (named_locks);
+
+/* If true, locks also time waits and holds.  Set by -lockprof. */
+static bool lock_profiling;
+
+/* Initializes WQ as an empty wait queue. */
+void
+wait_queue_init (struct wait_queue *wq)
+{
+  heap_init (&wq->threads, wait_less, NULL);
+}
+
+/* Adds T, which is about to block, to WQ. */
+void
+wait_queue_push (struct wait_queue *wq, struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->wait_queue == NULL);
+
+  t->wait_seq = wait_seq++;
+  t->wait_queue = wq;
+  heap_push (&wq->threads, &t->waitelem);
+}
+
+/* Removes and returns the highest-priority thread in WQ, which
+   must not be empty.  The caller unblocks it. */
+struct thread *
+wait_queue_pop (struct wait_queue *wq)
+{
+  struct thread *t;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  t = heap_entry (heap_pop (&wq->threads), struct thread, waitelem);
+  t->wait_queue = NULL;
+  return t;
+}
+
+/* Re-positions T in WQ after its priority changed.  RAISED says
+   whether it went up, which is the cheaper case. */
+void
+wait_queue_update (struct wait_queue *wq, struct thread *t, bool raised)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->wait_queue == wq);
+
+  if (raised)
+    heap_increase (&wq->threads, &t->waitelem);
+  else
+    heap_update (&wq->threads, &t->waitelem);
+}
+
+/* Returns true if no thread waits in WQ. */
+bool
+wait_queue_empty (const struct wait_queue *wq)
+{
+  return heap_empty (&wq->threads);
+}
+
+/* Returns the priority of the first thread in WQ, or PRI_MIN - 1
+   if it is empty. */
+int
+wait_queue_max_priority (const struct wait_queue *wq)
+{
+  if (heap_empty (&wq->threads))
+    return PRI_MIN - 1;
+  return heap_entry (heap_top (&wq->threads), struct thread, waitelem)->priority;
+}
 
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
@@ -45,7 +122,7 @@ sema_init (struct semaphore *sema, unsigned value)
   ASSERT (sema != NULL);
 
   sema->value = value;
-  list_init (&sema->waiters);
+  wait_queue_init (&sema->waiters);
 }
 
 /* Down or "P" operation on a semaphore.  Waits for SEMA's value
@@ -65,7 +142,7 @@ sema_down (struct semaphore *sema)
   old_level = intr_disable ();
   while (sema->value == 0) 
     {
-      list_insert_ordered (&sema->waiters, &thread_current ()->elem, thread_priority_more, NULL);
+      wait_queue_push (&sema->waiters, thread_current ());
       thread_block ();
     }
   sema->value--;
@@ -108,15 +185,42 @@ sema_up (struct semaphore *sema)
   ASSERT (sema != NULL);
 
   old_level = intr_disable ();
-  if (!list_empty (&sema->waiters))
-  {
-    list_sort (&sema->waiters, thread_priority_more, NULL);
-    thread_unblock (list_entry (list_pop_front (&sema->waiters), struct thread, elem));
-  }
+  if (!intr_context () && !wait_queue_empty (&sema->waiters))
+    {
+      /* Hand the CPU straight to the waiter if it outranks us. */
+      struct thread *t = wait_queue_pop (&sema->waiters);
+      sema->value++;
+      thread_unblock_switch (t);
+    }
+  else
+    {
+      sema_wake (sema);
+      yield_if_preempted ();
+    }
+  intr_set_level (old_level);
+}
+
+/* Increments SEMA's value and unblocks its first waiter, if any,
+   without yielding.  Interrupts must be off. */
+static void
+sema_wake (struct semaphore *sema)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
 
+  if (!wait_queue_empty (&sema->waiters))
+    thread_unblock (wait_queue_pop (&sema->waiters));
   sema->value++;
-  thread_cond_yield ();
-  intr_set_level (old_level);
+}
+
+/* Yields if a thread of higher priority than ours is ready, or
+   arranges to on return from an interrupt handler. */
+static void
+yield_if_preempted (void)
+{
+  if (intr_context ())
+    intr_yield_on_return ();
+  else
+    thread_cond_yield ();
 }
 
 static void sema_test_helper (void *sema_);
@@ -177,6 +281,60 @@ lock_init (struct lock *lock)
 
   lock->holder = NULL;
   sema_init (&lock->semaphore, 1);
+  lock->name = NULL;
+  lock->acquire_cnt = 0;
+  lock->contend_cnt = 0;
+  lock->wait_cycles = 0;
+  lock->acquired_tsc = 0;
+  lock->max_hold_cycles = 0;
+}
+
+/* Turns timing of lock waits and holds on or off.  The counts of
+   acquisitions and contended acquisitions are always kept. */
+void
+lock_set_profiling (bool enable)
+{
+  lock_profiling = enable;
+}
+
+/* Initializes LOCK like lock_init(), and reports its contention
+   counters under NAME in lock_print_stats().  Meant for
+   long-lived global locks: LOCK must never be destroyed. */
+void
+lock_init_named (struct lock *lock, const char *name)
+{
+  enum intr_level old_level;
+
+  ASSERT (name != NULL);
+
+  lock_init (lock);
+  lock->name = name;
+  old_level = intr_disable ();
+  list_push_back (&named_locks, &lock->stat_elem);
+  intr_set_level (old_level);
+}
+
+/* Prints the contention counters of every named lock that has
+   ever been contended, or of every named lock while profiling. */
+void
+lock_print_stats (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&named_locks); e != list_end (&named_locks);
+       e = list_next (e))
+    {
+      struct lock *lock = list_entry (e, struct lock, stat_elem);
+      if (lock_profiling)
+        printf ("Lock %s: %u acquires, %u contended, %"PRIu64" ns waiting, "
+                "%"PRIu64" ns longest hold\n",
+                lock->name, lock->acquire_cnt, lock->contend_cnt,
+                timer_tsc_to_ns (lock->wait_cycles),
+                timer_tsc_to_ns (lock->max_hold_cycles));
+      else if (lock->contend_cnt > 0)
+        printf ("Lock %s: %u acquires, %u contended\n",
+                lock->name, lock->acquire_cnt, lock->contend_cnt);
+    }
 }
 
 /* Acquires LOCK, sleeping until it becomes available if
@@ -194,30 +352,35 @@ lock_acquire (struct lock *lock)
   ASSERT (!lock_held_by_current_thread (lock));
 
   struct thread *t = thread_current();
-  struct lock *l;
 
-  if (lock->holder != NULL && !thread_mlfqs)
+  /* Like sema_down(), but while we wait our priority is donated
+     to the holder through the lock's waiter heap. */
+  enum intr_level old_level = intr_disable();
+  lock->acquire_cnt++;
+  bool contended = lock->semaphore.value == 0;
+  uint64_t start = lock_profiling ? timer_tsc () : 0;
+  if (contended)
+    lock->contend_cnt++;
+  while (lock->semaphore.value == 0)
   {
-    t->lock_waiting = lock;
-    l = lock;
-    while (l && t->priority > l->max_priority)
+    wait_queue_push (&lock->semaphore.waiters, t);
+    if (!thread_mlfqs)
     {
-      l->max_priority = t->priority;
-      thread_donate_priority (l->holder);
-      l = l->holder->lock_waiting;
+      t->lock_waiting = lock;
+      thread_lock_waiters_changed (lock);
     }
+    thread_block ();
   }
-
-  sema_down (&lock->semaphore);
-  enum intr_level old_level = intr_disable();
-  t = thread_current();
-  if (!thread_mlfqs)
+  if (lock_profiling)
   {
-    t->lock_waiting = NULL;
-    lock->max_priority = t->priority;
-    thread_hold_the_lock (lock);
+    lock->acquired_tsc = timer_tsc ();
+    lock->wait_cycles += lock->acquired_tsc - start;
   }
+  lock->semaphore.value--;
+  t->lock_waiting = NULL;
   lock->holder = t;
+  if (!thread_mlfqs)
+    thread_hold_the_lock (lock);
   intr_set_level (old_level);
 }
 
@@ -236,7 +399,16 @@ lock_try_acquire (struct lock *lock)
 
   success = sema_try_down (&lock->semaphore);
   if (success)
+  {
+    lock->acquire_cnt++;
+    if (lock_profiling)
+      lock->acquired_tsc = timer_tsc ();
     lock->holder = thread_current ();
+    if (!thread_mlfqs)
+      thread_hold_the_lock (lock);
+  }
+  else
+    lock->contend_cnt++;
   return success;
 }
 
@@ -250,11 +422,28 @@ lock_release (struct lock *lock)
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
+  enum intr_level old_level = intr_disable ();
+  if (lock_profiling)
+  {
+    uint64_t held = timer_tsc () - lock->acquired_tsc;
+    if (held > lock->max_hold_cycles)
+      lock->max_hold_cycles = held;
+  }
+  lock_release_no_yield (lock);
+  yield_if_preempted ();
+  intr_set_level (old_level);
+}
+
+/* Releases LOCK and wakes its first waiter without yielding.
+   Interrupts must be off. */
+static void
+lock_release_no_yield (struct lock *lock)
+{
   if (!thread_mlfqs)
     thread_remove_lock (lock);
 
   lock->holder = NULL;
-  sema_up (&lock->semaphore);
+  sema_wake (&lock->semaphore);
 }
 
 /* Returns true if the current thread holds LOCK, false
@@ -268,13 +457,6 @@ lock_held_by_current_thread (const struct lock *lock)
   return lock->holder == thread_current ();
 }
 
-/* One semaphore in a list. */
-struct semaphore_elem 
-  {
-    struct list_elem elem;              /* List element. */
-    struct semaphore semaphore;         /* This semaphore. */
-  };
-
 /* Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
    code to receive the signal and act upon it. */
@@ -283,7 +465,7 @@ cond_init (struct condition *cond)
 {
   ASSERT (cond != NULL);
 
-  list_init (&cond->waiters);
+  wait_queue_init (&cond->waiters);
 }
 
 /* Atomically releases LOCK and waits for COND to be signaled by
@@ -306,17 +488,18 @@ cond_init (struct condition *cond)
 void
 cond_wait (struct condition *cond, struct lock *lock) 
 {
-  struct semaphore_elem waiter;
-
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (lock_held_by_current_thread (lock));
   
-  sema_init (&waiter.semaphore, 0);
-  list_push_back (&cond->waiters, &waiter.elem);
-  lock_release (lock);
-  sema_down (&waiter.semaphore);
+  /* Queue up before releasing LOCK, with interrupts off until we
+     block, so that a signal cannot slip in between. */
+  enum intr_level old_level = intr_disable ();
+  wait_queue_push (&cond->waiters, thread_current ());
+  lock_release_no_yield (lock);
+  thread_block ();
+  intr_set_level (old_level);
   lock_acquire (lock);
 }
 
@@ -334,12 +517,13 @@ cond_signal (struct condition *cond, struct lock *lock UNUSED)
   ASSERT (!intr_context ());
   ASSERT (lock_held_by_current_thread (lock));
 
-  if (!list_empty (&cond->waiters))
+  enum intr_level old_level = intr_disable ();
+  if (!wait_queue_empty (&cond->waiters))
   {
-    list_sort (&cond->waiters, cond_sema_priority_more, NULL);
-    sema_up (&list_entry (list_pop_front (&cond->waiters), struct semaphore_elem, elem)->semaphore);
+    thread_unblock (wait_queue_pop (&cond->waiters));
+    thread_cond_yield ();
   }
-    
+  intr_set_level (old_level);
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
@@ -353,31 +537,141 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
 
-  while (!list_empty (&cond->waiters))
+  while (!wait_queue_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
 
-static bool
-cond_sema_priority_more (const struct list_elem *lhs, const struct list_elem *rhs, void *aux UNUSED)
+/* Initializes RW as an unheld reader-writer lock.  Any number of
+   readers may hold it at once, or a single writer.  A waiting
+   writer keeps new readers out, so writers cannot starve, and
+   waiters of each kind are woken highest priority first.  A
+   reader may upgrade to writing and a writer may downgrade to
+   reading without letting anyone else in between.  Unlike a
+   lock, it is not recursive in either mode. */
+void
+rwlock_init (struct rwlock *rw)
 {
-  struct semaphore_elem *a, *b;
-  ASSERT (lhs != NULL && rhs != NULL);
+  ASSERT (rw != NULL);
+
+  lock_init (&rw->lock);
+  cond_init (&rw->readers_ok);
+  cond_init (&rw->writers_ok);
+  cond_init (&rw->upgrade_ok);
+  rw->readers = 0;
+  rw->waiting_writers = 0;
+  rw->writer = false;
+  rw->upgrading = false;
+}
 
-  a = list_entry (lhs, struct semaphore_elem, elem);
-  b = list_entry (rhs, struct semaphore_elem, elem);
-  
-  return list_entry (list_front (&a->semaphore.waiters), struct thread, elem)->priority > list_entry (list_front (&b->semaphore.waiters), struct thread, elem)->priority;
+/* Acquires RW for reading, sleeping until no writer holds it or
+   waits for it. */
+void
+rwlock_acquire_read (struct rwlock *rw)
+{
+  ASSERT (!intr_context ());
+
+  lock_acquire (&rw->lock);
+  while (rw->writer || rw->waiting_writers > 0 || rw->upgrading)
+    cond_wait (&rw->readers_ok, &rw->lock);
+  rw->readers++;
+  lock_release (&rw->lock);
 }
 
+/* Releases RW, which the current thread holds for reading. */
+void
+rwlock_release_read (struct rwlock *rw)
+{
+  lock_acquire (&rw->lock);
+  ASSERT (rw->readers > 0);
+  if (--rw->readers == 0)
+    cond_signal (&rw->writers_ok, &rw->lock);
+  else if (rw->readers == 1 && rw->upgrading)
+    cond_signal (&rw->upgrade_ok, &rw->lock);
+  lock_release (&rw->lock);
+}
+
+/* Acquires RW for writing, sleeping until nobody else holds it. */
+void
+rwlock_acquire_write (struct rwlock *rw)
+{
+  ASSERT (!intr_context ());
+
+  lock_acquire (&rw->lock);
+  rw->waiting_writers++;
+  while (rw->writer || rw->readers > 0)
+    cond_wait (&rw->writers_ok, &rw->lock);
+  rw->waiting_writers--;
+  rw->writer = true;
+  lock_release (&rw->lock);
+}
+
+/* Releases RW, which the current thread holds for writing. */
+void
+rwlock_release_write (struct rwlock *rw)
+{
+  lock_acquire (&rw->lock);
+  ASSERT (rw->writer);
+  rw->writer = false;
+  if (rw->waiting_writers > 0)
+    cond_signal (&rw->writers_ok, &rw->lock);
+  else
+    cond_broadcast (&rw->readers_ok, &rw->lock);
+  lock_release (&rw->lock);
+}
+
+/* Converts the current thread's read hold on RW into a write
+   hold, waiting for the other readers to leave.  The upgrade
+   goes ahead of waiting writers.  Only one reader can be
+   upgrading at a time, since two would wait for each other: if
+   another already is, returns false and the caller keeps its
+   read hold, and should release it before acquiring for writing.
+   Returns true on success. */
+bool
+rwlock_upgrade (struct rwlock *rw)
+{
+  ASSERT (!intr_context ());
+
+  lock_acquire (&rw->lock);
+  ASSERT (rw->readers > 0);
+  if (rw->upgrading)
+    {
+      lock_release (&rw->lock);
+      return false;
+    }
+  rw->upgrading = true;
+  while (rw->readers > 1)
+    cond_wait (&rw->upgrade_ok, &rw->lock);
+  rw->upgrading = false;
+  rw->readers = 0;
+  rw->writer = true;
+  lock_release (&rw->lock);
+  return true;
+}
+
+/* Converts the current thread's write hold on RW into a read
+   hold, letting in other readers unless a writer is waiting. */
+void
+rwlock_downgrade (struct rwlock *rw)
+{
+  lock_acquire (&rw->lock);
+  ASSERT (rw->writer);
+  rw->writer = false;
+  rw->readers = 1;
+  if (rw->waiting_writers == 0)
+    cond_broadcast (&rw->readers_ok, &rw->lock);
+  lock_release (&rw->lock);
+}
+
+/* Orders threads in a wait queue by priority, earlier arrivals
+   first among equals. */
 static bool
-thread_priority_more (const struct list_elem *lhs, const struct list_elem *rhs, void *aux UNUSED)
+wait_less (const struct heap_elem *a_, const struct heap_elem *b_,
+           void *aux UNUSED)
 {
-  struct thread *a, *b;
-  
-  ASSERT (lhs != NULL && rhs != NULL);
-  
-  a = list_entry (lhs, struct thread, elem);
-  b = list_entry (rhs, struct thread, elem);
-  
-  return (a->priority > b->priority);
-}
\ No newline at end of file
+  const struct thread *a = heap_entry (a_, struct thread, waitelem);
+  const struct thread *b = heap_entry (b_, struct thread, waitelem);
+
+  if (a->priority != b->priority)
+    return a->priority < b->priority;
+  return (int) (a->wait_seq - b->wait_seq) > 0;
+}
@@ -1,14 +1,36 @@
 #ifndef THREADS_SYNCH_H
 #define THREADS_SYNCH_H
 
+#include <heap.h>
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+struct thread;
+
+/* Queue of blocked threads, highest priority first and in
+   arrival order among equals.  Shared by semaphores, locks
+   (through their semaphore) and condition variables.  A thread
+   is on at most one queue, recorded in its `wait_queue' member,
+   so priority donation can re-position it in O(log n).
+   Interrupts must be off to use one. */
+struct wait_queue
+  {
+    struct heap threads;        /* Waiting threads by priority. */
+  };
+
+void wait_queue_init (struct wait_queue *);
+void wait_queue_push (struct wait_queue *, struct thread *);
+struct thread *wait_queue_pop (struct wait_queue *);
+void wait_queue_update (struct wait_queue *, struct thread *, bool raised);
+bool wait_queue_empty (const struct wait_queue *);
+int wait_queue_max_priority (const struct wait_queue *);
 
 /* A counting semaphore. */
 struct semaphore 
   {
     unsigned value;             /* Current value. */
-    struct list waiters;        /* List of waiting threads. */
+    struct wait_queue waiters;  /* Waiting threads. */
   };
 
 void sema_init (struct semaphore *, unsigned value);
@@ -22,11 +44,22 @@ struct lock
   {
     struct thread *holder;      /* Thread holding lock (for debugging). */
     struct semaphore semaphore; /* Binary semaphore controlling access. */
-    struct list_elem elem;      /* List element for priority donation. */
-    int max_priority;           /* The max priority thread acquiring the lock. */
+    struct heap_elem elem;      /* Heap element in holder's `locks'. */
+
+    /* Contention statistics. */
+    const char *name;           /* Name for lock_print_stats(), or null. */
+    struct list_elem stat_elem; /* Element in the named locks list. */
+    unsigned acquire_cnt;       /* Times acquired. */
+    unsigned contend_cnt;       /* Times found held by another thread. */
+    uint64_t wait_cycles;       /* CPU cycles spent waiting, if profiling. */
+    uint64_t acquired_tsc;      /* Cycle counter when last acquired. */
+    uint64_t max_hold_cycles;   /* Longest hold in cycles, if profiling. */
   };
 
 void lock_init (struct lock *);
+void lock_init_named (struct lock *, const char *name);
+void lock_print_stats (void);
+void lock_set_profiling (bool);
 void lock_acquire (struct lock *);
 bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
@@ -35,7 +68,7 @@ bool lock_held_by_current_thread (const struct lock *);
 /* Condition variable. */
 struct condition 
   {
-    struct list waiters;        /* List of waiting threads. */
+    struct wait_queue waiters;  /* Waiting threads. */
   };
 
 void cond_init (struct condition *);
@@ -43,6 +76,27 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Reader-writer lock. */
+struct rwlock
+  {
+    struct lock lock;           /* Protects the members below. */
+    struct condition readers_ok; /* Signaled when readers may enter. */
+    struct condition writers_ok; /* Signaled when a writer may enter. */
+    struct condition upgrade_ok; /* Signaled when the upgrader is alone. */
+    int readers;                /* Number of threads reading. */
+    int waiting_writers;        /* Number of threads waiting to write. */
+    bool writer;                /* True if a thread is writing. */
+    bool upgrading;             /* True if a reader waits to upgrade. */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+bool rwlock_upgrade (struct rwlock *);
+void rwlock_downgrade (struct rwlock *);
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
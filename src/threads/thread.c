@@ -4,18 +4,26 @@
 #include <random.h>
 #include <stdio.h>
 #include <string.h>
+#include <syscall-nr.h>
 #include "threads/flags.h"
 #include "threads/interrupt.h"
+#include "threads/init.h"
 #include "threads/intr-stubs.h"
+#include "threads/ktrace.h"
 #include "threads/palloc.h"
+#include "threads/pte.h"
 #include "threads/malloc.h"
 #include "threads/switch.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 #include "threads/fixed_point.h"
+#include "devices/timer.h"
 #ifdef USERPROG
+#include <bitmap.h>
+#include "userprog/pipe.h"
 #include "userprog/process.h"
 #include "userprog/syscall.h"
+#include "filesys/file.h"
 #endif
 #ifdef VM
 #include "vm/page.h"
@@ -29,27 +37,103 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* Per-CPU scheduler state.
+
+   Everything the scheduler keeps per processor lives here: the
+   run queue, the idle thread and tick statistics.  Only the boot
+   CPU is brought up, so there is one, returned by this_cpu().
+
+   The run queue holds processes in THREAD_READY state, that is,
+   processes that are ready to run but not actually running.
+   There is one FIFO queue per priority level; bit P of ready_mask
+   is set iff ready_queues[P] is non-empty, so the highest ready
+   priority is found with a single bit scan.  Protected by
+   disabling interrupts.
+
+   Threads in the deadline class (see thread_set_reservation())
+   wait in rt_queue instead, in no order, and are chosen ahead of
+   every priority: the one with budget left whose deadline is
+   earliest goes first.  They are few, so a scan finds it.
+
+   A thread joins the run queue of a CPU in its cpu_mask; with a
+   single CPU up, and every mask required to include it, that is
+   always the boot CPU's.  A load balancer that moves threads
+   between CPUs must keep to the same rule. */
+struct cpu
+  {
+    struct list ready_queues[PRI_MAX + 1];
+    uint32_t ready_mask[(PRI_MAX + 32) / 32];
+    size_t ready_cnt;                   /* Threads in ready_queues and rt_queue. */
+    struct list rt_queue;               /* Ready deadline threads. */
+    struct list rt_threads;             /* All deadline threads, by rtelem. */
+    unsigned rt_util;                   /* Thousandths of the CPU they reserve. */
+    struct thread *idle_thread;         /* This CPU's idle thread. */
+    long long idle_ticks;               /* # of timer ticks spent idle. */
+    long long kernel_ticks;             /* # of timer ticks in kernel threads. */
+    long long user_ticks;               /* # of timer ticks in user programs. */
+  };
+
+static struct cpu boot_cpu;
 
-/* List of processes in THREAD_BLOCK state. */
-static struct list sleep_list;
+/* CPUs that are up, as an affinity mask. */
+#define CPUS_ONLINE 1u
+
+/* Deadline class limits.  Reservations may take at most
+   RT_UTIL_MAX thousandths of a CPU, leaving the rest for other
+   threads, and periods may be at most RT_PERIOD_MAX ticks. */
+#define RT_UTIL_MAX 900
+#define RT_PERIOD_MAX (60 * TIMER_FREQ)
+
+/* Returns the CPU we are running on. */
+static inline struct cpu *
+this_cpu (void)
+{
+  return &boot_cpu;
+}
+
+/* Returns true if T is the current CPU's idle thread. */
+static inline bool
+is_idle_thread (const struct thread *t)
+{
+  return t == this_cpu ()->idle_thread;
+}
 
 
-/* List of file in this thread */
-static struct list file_list;
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
 static struct list all_list;
 
-/* List of all children. */
-static struct list child_list;
-
-
-/* Idle thread. */
-static struct thread *idle_thread;
+/* Work the idle thread does while nothing else is ready, as
+   struct idle_work.  Added to with interrupts off. */
+static struct list idle_work_list;
+
+/* Every thread's child_info, keyed by tid. */
+static struct hash child_table;
+static struct lock child_table_lock;
+
+/* Declared in thread.h. */
+struct slab_cache child_info_cache;
+struct slab_cache file_info_cache;
+struct slab_cache mmap_handler_cache;
+
+
+/* Pages of dead threads, kept for thread_create() to reuse so
+   that a short-lived thread costs neither a trip through the page
+   allocator nor zeroing a page: init_thread() clears just the
+   struct thread, and the stack needs no clearing.  Linked through
+   their first word.  Accessed with interrupts off, since dying
+   threads are added from thread_schedule_tail(). */
+#define THREAD_POOL_MAX 16
+static void *thread_pool;
+static size_t thread_pool_cnt;
+
+#ifdef STACK_GUARD
+/* Each thread's page comes with the page below it, which is left
+   unmapped so that running off the bottom of the stack faults at
+   once.  Pooled pages keep their guards. */
+static void set_guard (struct thread *, bool mapped);
+#endif
 
 /* Initial thread, the thread running init.c:main(). */
 static struct thread *initial_thread;
@@ -66,14 +150,24 @@ struct kernel_thread_frame
   };
 
 /* Statistics. */
-static long long idle_ticks;    /* # of timer ticks spent idle. */
-static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
-static long long user_ticks;    /* # of timer ticks in user programs. */
-static int load_avg;            /* # of load_avg in all threads. */
+static fixed_t load_avg;        /* # of load_avg in all threads. */
+
+/* Lazy recent_cpu decay for the MLFQS scheduler.  Instead of
+   decaying every thread once per second, the timer only records
+   that second's decay coefficient; a thread's recent_cpu is
+   brought up to date when it is queued, dequeued or runs.
+   Seconds older than the history are replayed as a power of the
+   oldest coefficient still recorded. */
+#define DECAY_HISTORY 64
+static int decay_epoch;         /* # of seconds of decay so far. */
+static fixed_t decay_history[DECAY_HISTORY];
 
 /* Scheduling. */
-#define TIME_SLICE 4            /* # of timer ticks to give each thread. */
+#define TIME_SLICE 4            /* Default # of timer ticks per slice. */
+#define TIME_SLICE_MAX 1000     /* Longest slice allowed, in ticks. */
 static unsigned thread_ticks;   /* # of timer ticks since last yield. */
+static unsigned slice_high = TIME_SLICE; /* Ticks per slice at PRI_MAX. */
+static unsigned slice_low = TIME_SLICE;  /* Ticks per slice at PRI_MIN. */
 
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
@@ -83,19 +177,41 @@ bool thread_mlfqs;
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
+static bool run_idle_work (void);
 static struct thread *running_thread (void);
 static struct thread *next_thread_to_run (void);
 static void init_thread (struct thread *, const char *name, int priority);
 static bool is_thread (struct thread *) UNUSED;
 static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
+static void switch_to (struct thread *next);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
+static tid_t create_thread (const char *name, int priority,
+                            thread_func *, void *aux, bool child);
+static struct thread *thread_page_get (void);
+static void thread_page_put (struct thread *);
+static hash_hash_func child_info_hash;
+static hash_less_func child_info_less;
 
 /* For Priority queue of threads. */
-static bool wakeup_time_less (const struct list_elem *lhs, const struct list_elem *rhs, void *aux UNUSED);
-static bool thread_priority_more (const struct list_elem *lhs, const struct list_elem *rhs, void *aux UNUSED);
-static bool lock_priority_more (const struct list_elem *lhs, const struct list_elem *rhs, void *aux UNUSED);
+static bool lock_donation_less (const struct heap_elem *a, const struct heap_elem *b, void *aux UNUSED);
+static int lock_donation (const struct lock *lock);
+static void thread_refresh_priority (struct thread *t);
+
+/* Run queue operations. */
+static void ready_push (struct thread *t);
+static void ready_remove (struct thread *t);
+static int ready_max_priority (void);
+static struct thread *ready_pop (void);
+static struct thread *rt_pick (void);
+static void rt_replenish (struct cpu *);
+static void rt_release (struct thread *);
+static unsigned rt_util (int runtime, int period);
+static bool thread_preempted (struct thread *);
+
+static void recent_cpu_catch_up (struct thread *t);
+static int mlfqs_priority (const struct thread *t);
 
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
@@ -113,14 +229,26 @@ static bool lock_priority_more (const struct list_elem *lhs, const struct list_e
 void
 thread_init (void) 
 {
+  int i;
+
   ASSERT (intr_get_level () == INTR_OFF);
+  /* The members at the top of struct thread share a cache line. */
+  ASSERT (offsetof (struct thread, name) <= 64);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
-  list_init (&sleep_list);
-  list_init (&file_list);
+  for (i = 0; i <= PRI_MAX; i++)
+    list_init (&this_cpu ()->ready_queues[i]);
+  list_init (&this_cpu ()->rt_queue);
+  list_init (&this_cpu ()->rt_threads);
   list_init (&all_list);
-  list_init (&child_list);
+  list_init (&idle_work_list);
+  lock_init (&child_table_lock);
+  slab_cache_init (&child_info_cache, "child_info",
+                   sizeof (struct child_info), NULL);
+  slab_cache_init (&file_info_cache, "file_info",
+                   sizeof (struct file_info), NULL);
+  slab_cache_init (&mmap_handler_cache, "mmap_handler",
+                   sizeof (struct mmap_handler), NULL);
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
@@ -136,6 +264,10 @@ thread_init (void)
 void
 thread_start (void) 
 {
+  /* Needs malloc(), which is not up yet in thread_init(). */
+  if (!hash_init (&child_table, child_info_hash, child_info_less, NULL))
+    PANIC ("out of memory for child table");
+
   /* Create the idle thread. */
   struct semaphore idle_started;
   sema_init (&idle_started, 0);
@@ -154,80 +286,232 @@ void
 thread_tick (void) 
 {
   struct thread *t = thread_current ();
+  struct cpu *c = this_cpu ();
 
-  /* Update statistics. */
-  if (t == idle_thread)
-    idle_ticks++;
+  /* Update statistics, and under the MLFQS charge the tick to
+     the running thread's recent_cpu. */
+  if (t == c->idle_thread)
+    c->idle_ticks++;
+  else
+    {
 #ifdef USERPROG
-  else if (t->pagedir != NULL)
-    user_ticks++;
+      if (t->pagedir != NULL)
+        c->user_ticks++;
+      else
 #endif
-  else
-    kernel_ticks++;
+        c->kernel_ticks++;
+      if (thread_mlfqs)
+        t->recent_cpu = ADD_INT (t->recent_cpu, 1);
+    }
 
-  /* Enforce preemption. */
-  if (++thread_ticks >= TIME_SLICE)
+  /* Charge a deadline thread for the tick, and start new periods. */
+  if (t->rt_period > 0 && t->rt_budget > 0)
+    t->rt_budget--;
+  if (!list_empty (&c->rt_threads))
+    rt_replenish (c);
+
+  /* Enforce preemption.  A deadline thread with budget left runs
+     until one with an earlier deadline is ready; one without
+     must wait for its next period. */
+  if (t->rt_period > 0 && t->rt_budget > 0 ? thread_preempted (t)
+      : (t->rt_period > 0
+         || ++thread_ticks >= thread_time_slice (t->priority)
+         || rt_pick () != NULL))
     intr_yield_on_return ();
-
-  /* Check the block threads whether to wake up. */
-  thread_wakeup();  
 }
 
-/* Make the thread sleep. */
-void
-thread_sleep (int64_t ticks)
+/* Puts the running thread in the deadline class, reserving it
+   RUNTIME ticks of CPU time out of every PERIOD ticks, starting
+   now, or takes it out of the class if RUNTIME is 0.  Until its
+   reservation runs out each period, it runs ahead of threads of
+   any priority, and of deadline threads whose periods end later;
+   once it has, it waits for its next period.  Returns false,
+   changing nothing, if RUNTIME or PERIOD is out of range or the
+   CPU has too little time left to reserve.  Threads it creates
+   do not inherit the reservation. */
+bool
+thread_set_reservation (int runtime, int period)
 {
-  struct thread* current_thread = thread_current();
-  ASSERT(current_thread ->status == THREAD_RUNNING);
-  current_thread ->wakeup_time = timer_ticks() + ticks;
+  struct thread *cur = thread_current ();
+  struct cpu *c = this_cpu ();
+  enum intr_level old_level;
+  unsigned old_util, new_util;
 
-  enum intr_level old_level = intr_disable();
-  list_insert_ordered (&sleep_list, &current_thread->elem, wakeup_time_less, NULL);
-  thread_block ();
-  intr_set_level(old_level);
-}
+  if (runtime < 0 || (runtime > 0 && (period < runtime
+                                      || period > RT_PERIOD_MAX)))
+    return false;
+  if (is_idle_thread (cur))
+    return false;
 
-/* Check the block thread. */
-void
-thread_wakeup (void)
-{  
-  if (list_empty (&sleep_list)) return;
-  struct list_elem *cur = list_begin (&sleep_list);
-  struct list_elem *next;
-  
-  while (cur != list_end (&sleep_list))
+  old_level = intr_disable ();
+  if (runtime == 0)
     {
-      next = list_next (cur);
-      struct thread *t = list_entry (cur, struct thread, elem);
-      if (t->wakeup_time > timer_ticks()) break;
-      t->wakeup_time = 0;
+      if (cur->rt_period > 0)
+        rt_release (cur);
+      thread_cond_yield ();
+      intr_set_level (old_level);
+      return true;
+    }
 
-      enum intr_level old_level = intr_disable();
-      list_remove (cur);
-      thread_unblock (t);
+  old_util = cur->rt_period > 0 ? rt_util (cur->rt_runtime, cur->rt_period) : 0;
+  new_util = rt_util (runtime, period);
+  if (c->rt_util - old_util + new_util > RT_UTIL_MAX)
+    {
       intr_set_level (old_level);
-      
-      cur = next;
+      return false;
     }
+  c->rt_util = c->rt_util - old_util + new_util;
+  if (cur->rt_period == 0)
+    list_push_back (&c->rt_threads, &cur->rtelem);
+  cur->rt_runtime = runtime;
+  cur->rt_period = period;
+  cur->rt_budget = runtime;
+  cur->rt_deadline = timer_ticks () + period;
+  thread_cond_yield ();
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Returns the thousandths of a CPU that RUNTIME ticks out of
+   every PERIOD take, rounded up. */
+static unsigned
+rt_util (int runtime, int period)
+{
+  return ((unsigned) runtime * 1000 + period - 1) / period;
+}
+
+/* Takes running thread T out of the deadline class, freeing its
+   reservation.  Interrupts must be off. */
+static void
+rt_release (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->status == THREAD_RUNNING || t->status == THREAD_DYING);
+
+  list_remove (&t->rtelem);
+  this_cpu ()->rt_util -= rt_util (t->rt_runtime, t->rt_period);
+  t->rt_period = 0;
+}
+
+/* Starts a new period, with a full budget, for each of C's
+   deadline threads whose deadline has passed. */
+static void
+rt_replenish (struct cpu *c)
+{
+  int64_t now = timer_ticks ();
+  struct list_elem *e;
+
+  for (e = list_begin (&c->rt_threads); e != list_end (&c->rt_threads);
+       e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct thread, rtelem);
+
+      if (now >= t->rt_deadline)
+        {
+          t->rt_deadline += ((now - t->rt_deadline) / t->rt_period + 1)
+                            * t->rt_period;
+          t->rt_budget = t->rt_runtime;
+        }
+    }
+}
+
+/* Sets the time slice to HIGH ticks for threads at PRI_MAX and LOW
+   ticks for threads at PRI_MIN, with priorities in between, which
+   under the MLFQS are its levels, getting slices in proportion.
+   Returns false, changing nothing, unless both are between 1 and
+   TIME_SLICE_MAX. */
+bool
+thread_set_time_slice (int high, int low)
+{
+  enum intr_level old_level;
+
+  if (high < 1 || high > TIME_SLICE_MAX || low < 1 || low > TIME_SLICE_MAX)
+    return false;
+  old_level = intr_disable ();
+  slice_high = high;
+  slice_low = low;
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Returns the number of timer ticks a thread at PRIORITY runs
+   before it is preempted in favor of another at the same
+   priority. */
+unsigned
+thread_time_slice (int priority)
+{
+  int span = (int) slice_high - (int) slice_low;
+
+  return slice_low + span * (priority - PRI_MIN) / (PRI_MAX - PRI_MIN);
+}
+
+/* Called by the tickless timer for each tick the CPU spent
+   halted in the idle thread without a timer interrupt. */
+void
+thread_tick_idle (void)
+{
+  this_cpu ()->idle_ticks++;
+}
+
+/* Returns true if the idle thread is running and no other
+   thread is ready.  Interrupts must be off. */
+bool
+thread_cpu_idle (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  struct cpu *c = this_cpu ();
+
+  return c->idle_thread != NULL && thread_current () == c->idle_thread
+         && c->ready_cnt == 0;
 }
 
 /* Prints thread statistics. */
 void
 thread_print_stats (void) 
 {
+  struct cpu *c = this_cpu ();
+
   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
-          idle_ticks, kernel_ticks, user_ticks);
+          c->idle_ticks, c->kernel_ticks, c->user_ticks);
+}
+
+/* Hashes a child_info by its tid. */
+static unsigned
+child_info_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct child_info, hash_elem)->child_id);
+}
+
+/* Orders child_infos by tid. */
+static bool
+child_info_less (const struct hash_elem *a, const struct hash_elem *b,
+                 void *aux UNUSED)
+{
+  return (hash_entry (a, struct child_info, hash_elem)->child_id
+          < hash_entry (b, struct child_info, hash_elem)->child_id);
 }
 
+/* Returns the child_info of the thread with TID, or a null
+   pointer if it has none, because its parent already freed it. */
 struct child_info* get_child_info(tid_t tid) {
-  struct list_elem *e;
-  struct child_info *ret;
-  for(e = list_begin(&child_list); e != list_end(&child_list); e = list_next(e)) {
-    ret = list_entry(e, struct child_info, allelem);
-    if(ret->child_id == tid)
-      return ret;
-  }
-  return NULL;
+  struct child_info key;
+  struct hash_elem *e;
+
+  key.child_id = tid;
+  lock_acquire (&child_table_lock);
+  e = hash_find (&child_table, &key.hash_elem);
+  lock_release (&child_table_lock);
+  return e != NULL ? hash_entry (e, struct child_info, hash_elem) : NULL;
+}
+
+/* Forgets and frees INFO.  Its parent must have removed it from
+   its child_list already. */
+void free_child_info(struct child_info *info) {
+  lock_acquire (&child_table_lock);
+  hash_delete (&child_table, &info->hash_elem);
+  lock_release (&child_table_lock);
+  slab_free (&child_info_cache, info);
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -248,6 +532,27 @@ struct child_info* get_child_info(tid_t tid) {
 tid_t
 thread_create (const char *name, int priority,
                thread_func *function, void *aux) 
+{
+  return create_thread (name, priority, function, aux, false);
+}
+
+/* Like thread_create(), but also records a child_info for the new
+   thread in the running thread's child_list, through which
+   process_wait() can wait for it and collect its exit status.
+   For threads that run user programs; a kernel thread nobody
+   waits for needs none. */
+tid_t
+thread_create_child (const char *name, int priority,
+                     thread_func *function, void *aux)
+{
+  return create_thread (name, priority, function, aux, true);
+}
+
+/* Does the work of thread_create() and, if CHILD is true, of
+   thread_create_child(). */
+static tid_t
+create_thread (const char *name, int priority,
+               thread_func *function, void *aux, bool child)
 {
 //  printf("before create have %d thread in ready_list\n", list_size(&ready_list));
   struct thread *t;
@@ -259,7 +564,7 @@ thread_create (const char *name, int priority,
   ASSERT (function != NULL);
 
   /* Allocate thread. */
-  t = palloc_get_page (PAL_ZERO);
+  t = thread_page_get ();
   if (t == NULL)
     return TID_ERROR;
 
@@ -267,17 +572,34 @@ thread_create (const char *name, int priority,
   init_thread (t, name, priority);
   tid = t->tid = allocate_tid ();
 
-  struct child_info *info = palloc_get_page(PAL_ZERO);
-  info->child_id = tid;
-  info->child_thread = t;
-  info->exited = false;
-  info->terminated = false;
-  info->load_failed = false;
-  info->sema_start = &t->sema_start;
-  info->sema_finish = &t->sema_finish;
-  info->ret_value = 0;
-  list_push_back(&child_list, &info->allelem);
-  t->message_to_parent = info;
+  if (child)
+    {
+      struct child_info *info = slab_alloc(&child_info_cache);
+      if (info == NULL)
+        {
+          enum intr_level old_level = intr_disable ();
+          list_remove (&t->allelem);
+          thread_page_put (t);
+          intr_set_level (old_level);
+          return TID_ERROR;
+        }
+      info->child_id = tid;
+      info->child_thread = t;
+      info->exited = false;
+      info->terminated = false;
+      info->load_failed = false;
+      info->sema_start = &t->sema_start;
+      info->sema_finish = &t->sema_finish;
+      info->ret_value = 0;
+      info->parent = thread_current ();
+      info->uthread = false;
+      info->joined = false;
+      lock_acquire (&child_table_lock);
+      hash_insert (&child_table, &info->hash_elem);
+      lock_release (&child_table_lock);
+      list_push_back (&thread_current ()->child_list, &info->elem);
+      t->message_to_parent = info;
+    }
 
   /* Stack frame for kernel_thread(). */
   kf = alloc_frame (t, sizeof *kf);
@@ -356,11 +678,47 @@ thread_unblock (struct thread *t)
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  list_insert_ordered (&ready_list, &t->elem, thread_priority_more, NULL);
+  ready_push (t);
   t->status = THREAD_READY;
   intr_set_level (old_level);
 }
 
+/* Unblocks T and, if it outranks the running thread and every
+   ready thread, switches to it at once without passing it
+   through the run queue.  Otherwise acts like thread_unblock()
+   followed by thread_cond_yield().  Interrupts must be off, and
+   an interrupt handler must use thread_unblock() instead. */
+void
+thread_unblock_switch (struct thread *t)
+{
+  struct thread *cur = thread_current ();
+
+  ASSERT (is_thread (t));
+  ASSERT (!intr_context ());
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->status == THREAD_BLOCKED);
+
+  if (thread_mlfqs)
+    {
+      recent_cpu_catch_up (t);
+      t->priority = mlfqs_priority (t);
+    }
+  if (is_idle_thread (cur) || t->priority <= cur->priority
+      || t->priority <= ready_max_priority ()
+      || cur->rt_period > 0 || t->rt_period > 0
+      || !list_empty (&this_cpu ()->rt_queue))
+    {
+      thread_unblock (t);
+      thread_cond_yield ();
+      return;
+    }
+
+  ready_push (cur);
+  cur->status = THREAD_READY;
+  t->status = THREAD_READY;
+  switch_to (t);
+}
+
 /* Returns the name of the running thread. */
 const char *
 thread_name (void) 
@@ -376,13 +734,16 @@ thread_current (void)
 {
   struct thread *t = running_thread ();
   
+#ifndef STACK_GUARD
   /* Make sure T is really a thread.
      If either of these assertions fire, then your thread may
      have overflowed its stack.  Each thread has less than 4 kB
      of stack, so a few big automatic arrays or moderate
-     recursion can cause stack overflow. */
+     recursion can cause stack overflow.  Under STACK_GUARD the
+     guard page below the stack catches that instead. */
   ASSERT (is_thread (t));
   ASSERT (t->status == THREAD_RUNNING);
+#endif
 
   return t;
 }
@@ -408,22 +769,19 @@ thread_exit (void)
 
   struct thread *cur = thread_current();
   /* Close all the file current open and belong to this thread. */
-
-
-
-  if (!list_empty(&file_list)) {
-    struct list_elem *e;
-    for (e = list_begin(&file_list); e != list_end(&file_list); e = list_next(e)) {
-      struct file_info *fd;
-      fd = list_entry(e, struct file_info, elem);
-      if (fd->thread_num == cur) {
-        close_file(fd->opened_file);
-        e = list_prev(e);
-        list_remove(&(fd->elem));
-        free(fd);
-      }
+  for (size_t i = 0; i < cur->fd_cap; i++) {
+    struct file_info *fd = cur->fd_table[i];
+    if (fd != NULL) {
+      if (fd->pipe != NULL)
+        pipe_close(fd->pipe, fd->pipe_writer);
+      close_file(fd->opened_file);
+      slab_free(&file_info_cache, fd);
     }
   }
+  free(cur->fd_table);
+  bitmap_destroy(cur->fd_used);
+  cur->fd_table = NULL;
+  cur->fd_cap = 0;
   if(cur->exec_file != NULL) {
     file_allow_write(cur->exec_file);
     close_file(cur->exec_file);
@@ -435,6 +793,8 @@ thread_exit (void)
      when it calls thread_schedule_tail(). */
   intr_disable ();
   list_remove (&thread_current()->allelem);
+  if (thread_current ()->rt_period > 0)
+    rt_release (thread_current ());
   thread_current ()->status = THREAD_DYING;
   schedule ();
   NOT_REACHED ();
@@ -451,8 +811,8 @@ thread_yield (void)
   ASSERT (!intr_context ());
 
   old_level = intr_disable ();
-  if (cur != idle_thread) 
-    list_insert_ordered (&ready_list, &cur->elem, thread_priority_more, NULL);
+  if (!is_idle_thread (cur)) 
+    ready_push (cur);
   cur->status = THREAD_READY;
   schedule ();
   intr_set_level (old_level);
@@ -460,12 +820,27 @@ thread_yield (void)
 void
 thread_cond_yield (void)
 {
-  if (thread_current () != idle_thread &&
-      !list_empty (&ready_list) &&
-      thread_current ()->priority < list_entry (list_begin (&ready_list), struct thread, elem)->priority)
+  enum intr_level old_level = intr_disable ();
+
+  if (!is_idle_thread (thread_current ()) &&
+      thread_preempted (thread_current ()))
 
     thread_yield ();
+  intr_set_level (old_level);
+}
+
+/* Returns true if a ready thread should run instead of running
+   thread CUR: a deadline thread with budget left, whose deadline
+   is earlier than CUR's if CUR is one too, or, unless CUR is, a
+   thread of higher priority.  Interrupts must be off. */
+static bool
+thread_preempted (struct thread *cur)
+{
+  struct thread *rt = rt_pick ();
 
+  if (cur->rt_period > 0 && cur->rt_budget > 0)
+    return rt != NULL && rt->rt_deadline < cur->rt_deadline;
+  return rt != NULL || cur->priority < ready_max_priority ();
 }
 
 /* Invoke function 'func' on all threads, passing along 'aux'.
@@ -495,11 +870,9 @@ thread_set_priority (int new_priority)
   struct thread *t = thread_current();
   int old_priority = t->priority;
   t->old_priority = new_priority;
-  if (list_empty (&t->locks) || new_priority > old_priority)
-  {
-    t->priority = new_priority;
+  thread_refresh_priority (t);
+  if (heap_empty (&t->locks) || new_priority > old_priority)
     thread_yield ();
-  }
   intr_set_level (old_level);
 }
 
@@ -510,22 +883,53 @@ thread_get_priority (void)
   return thread_current ()->priority;
 }
 
-/* Update the priority of the thread. */
+/* Update the priority of the thread, moving it to its new run
+   queue if it is ready. */
 void
 update_priority (struct thread *t, void *aux UNUSED)
 {
-  if (t == idle_thread) return;
-  t->priority = PRI_MAX - CONVERT_TO_INT_ROUND (DIV_INT (t->recent_cpu, 4)) - t->nice * 2;
-  t->priority = t->priority < PRI_MIN ? PRI_MIN : t->priority;
-  t->priority = t->priority > PRI_MAX ? PRI_MAX : t->priority;
+  if (is_idle_thread (t)) return;
+  enum intr_level old_level = intr_disable ();
+  recent_cpu_catch_up (t);
+  int priority = mlfqs_priority (t);
+  if (priority == t->priority)
+    ;
+  else if (t->status == THREAD_READY)
+  {
+    ready_remove (t);
+    t->priority = priority;
+    ready_push (t);
+  }
+  else
+    t->priority = priority;
+  intr_set_level (old_level);
 }
 
-/* Update the priority of thread for each. */
+/* Update the priority of the running thread, and of the longest
+   waiting thread in the lowest ready queue so that ready threads
+   whose recent_cpu has decayed are eventually promoted.  Runs in
+   constant time; other threads catch up when they are queued. */
 void
-update_priority_for_each (void)
+update_priority_running (void)
 {
-  thread_foreach (update_priority, NULL);
-  list_sort (&ready_list, thread_priority_more, NULL);
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  struct cpu *c = this_cpu ();
+  update_priority (thread_current (), NULL);
+
+  int i, level = PRI_MAX + 1;
+  for (i = 0; i < (int) (sizeof c->ready_mask / sizeof *c->ready_mask); i++)
+    if (c->ready_mask[i] != 0)
+    {
+      level = i * 32 + __builtin_ctz (c->ready_mask[i]);
+      break;
+    }
+  if (level > PRI_MAX)
+    return;
+  struct thread *t = list_entry (list_front (&c->ready_queues[level]),
+                                 struct thread, elem);
+  ready_remove (t);
+  ready_push (t);
 }
 
 /* Sets the current thread's nice value to NICE. */
@@ -534,12 +938,10 @@ thread_set_nice (int nice UNUSED)
 {
   if(nice > NICE_MAX || nice < NICE_MIN) return;
   struct thread *t = thread_current();
-  if (t == idle_thread) return;
+  if (is_idle_thread (t)) return;
   t->nice = nice;
   update_priority(t, NULL);
-  if (t->status == THREAD_READY)
-    list_sort (&ready_list, thread_priority_more, NULL);
-  else if (t->status == THREAD_RUNNING)
+  if (t->status == THREAD_RUNNING)
   {
     /*int max_priority = list_entry (list_begin (&ready_list), struct thread, elem)->priority;
     if (max_priority > t->priority) thread_yield ();*/
@@ -567,8 +969,13 @@ update_load_avg (void)
 {
   ASSERT(thread_mlfqs);
 
-  int ready_threads = (thread_current () != idle_thread) ? list_size (&ready_list) + 1 : list_size (&ready_list);
+  size_t ready_cnt = this_cpu ()->ready_cnt;
+  int ready_threads = !is_idle_thread (thread_current ()) ? ready_cnt + 1 : ready_cnt;
   load_avg = MULT (DIV_INT (CONVERT_TO_FP (59), 60), load_avg) + MULT_INT (DIV_INT (CONVERT_TO_FP (1), 60), ready_threads);
+
+  decay_epoch++;
+  decay_history[decay_epoch % DECAY_HISTORY] = DIV (MULT_INT (load_avg, 2), ADD_INT (MULT_INT (load_avg, 2), 1));
+  recent_cpu_catch_up (thread_current ());
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
@@ -578,62 +985,137 @@ thread_get_recent_cpu (void)
   return CONVERT_TO_INT_ROUND (MULT_INT (thread_current ()->recent_cpu, 100));
 }
 
-/* Update the recent_cpu of thread for each. */
-void
-update_recent_cpu_for_each (void)
+/* Describes up to MAX threads in INFO and returns the number of
+   threads there are, which may be more than MAX. */
+int
+thread_get_info (struct sysinfo_thread *info, int max)
 {
-  ASSERT(thread_mlfqs);
+  enum intr_level old_level = intr_disable ();
+  struct list_elem *e;
+  int cnt = 0;
+
+  for (e = list_begin (&all_list); e != list_end (&all_list);
+       e = list_next (e), cnt++)
+    {
+      struct thread *t = list_entry (e, struct thread, allelem);
+      struct sysinfo_thread *i;
+
+      if (cnt >= max)
+        continue;
+      i = &info[cnt];
+      recent_cpu_catch_up (t);
+      i->tid = t->tid;
+      strlcpy (i->name, t->name, sizeof i->name);
+      /* The SYSINFO_* statuses follow enum thread_status. */
+      i->status = t->status;
+      i->priority = t->priority;
+      i->nice = t->nice;
+      i->recent_cpu = CONVERT_TO_INT_ROUND (MULT_INT (t->recent_cpu, 100));
+    }
+  intr_set_level (old_level);
+  return cnt;
+}
 
-  thread_foreach (update_recent_cpu, NULL);
+/* Restricts T to the CPUs in MASK, bit N standing for CPU N.
+   Returns false, changing nothing, if MASK names no CPU that is
+   up.  T stays where it is until it next joins a run queue.
+   Threads T creates inherit its mask. */
+bool
+thread_set_affinity (struct thread *t, unsigned mask)
+{
+  ASSERT (is_thread (t));
+
+  if ((mask & CPUS_ONLINE) == 0)
+    return false;
+  t->cpu_mask = mask;
+  return true;
 }
 
 /* Update the recent_cpu of thread. */
 void
 update_recent_cpu (struct thread *t, void *aux UNUSED)
 {
-  if (t == idle_thread) return;
-  int coefficient = DIV (MULT_INT (load_avg, 2), ADD_INT (MULT_INT (load_avg, 2), 1));
+  if (is_idle_thread (t)) return;
+  fixed_t coefficient = DIV (MULT_INT (load_avg, 2), ADD_INT (MULT_INT (load_avg, 2), 1));
   t->recent_cpu = ADD_INT (MULT (coefficient, t->recent_cpu), t->nice);
 }
 
-/* Increase the recent_cpu of the current thread by one. */
-void
-increase_recent_cpu (void)
+/* Applies the decay of every second since T's recent_cpu was last
+   brought up to date.  For each second the update is
+   recent_cpu = c * recent_cpu + nice; N such steps with the same
+   coefficient are applied in O(log N) by squaring the affine map. */
+static void
+recent_cpu_catch_up (struct thread *t)
 {
-  ASSERT(thread_mlfqs);
+  int missed = decay_epoch - t->decay_epoch;
+  int k;
 
-  struct thread *t = thread_current ();
-  if (t == idle_thread) return;
-  if (t->status == THREAD_RUNNING)
-  {
-    t->recent_cpu = ADD_INT (t->recent_cpu, 1);
-  }
+  if (is_idle_thread (t) || missed <= 0)
+    {
+      t->decay_epoch = decay_epoch;
+      return;
+    }
+
+  if (missed > DECAY_HISTORY)
+    {
+      /* (a, b) is r -> a * r + b; start from the identity. */
+      fixed_t a = CONVERT_TO_FP (1), b = 0;
+      fixed_t base_a = decay_history[(decay_epoch + 1) % DECAY_HISTORY];
+      fixed_t base_b = CONVERT_TO_FP ((fixed_t) t->nice);
+      int n = missed - DECAY_HISTORY;
+
+      for (; n > 0; n >>= 1)
+        {
+          if (n & 1)
+            {
+              b = MULT (base_a, b) + base_b;
+              a = MULT (base_a, a);
+            }
+          base_b = MULT (base_a, base_b) + base_b;
+          base_a = MULT (base_a, base_a);
+        }
+      t->recent_cpu = MULT (a, t->recent_cpu) + b;
+      missed = DECAY_HISTORY;
+    }
+
+  for (k = decay_epoch - missed + 1; k <= decay_epoch; k++)
+    t->recent_cpu = ADD_INT (MULT (decay_history[k % DECAY_HISTORY], t->recent_cpu), t->nice);
+  t->decay_epoch = decay_epoch;
 }
 
-/* Let the thread hold the lock. */
+/* Returns the MLFQS priority for T's current recent_cpu and nice. */
+static int
+mlfqs_priority (const struct thread *t)
+{
+  int priority = PRI_MAX - CONVERT_TO_INT_ROUND (DIV_INT (t->recent_cpu, 4)) - t->nice * 2;
+  priority = priority < PRI_MIN ? PRI_MIN : priority;
+  priority = priority > PRI_MAX ? PRI_MAX : priority;
+  return priority;
+}
+
+/* Let the current thread hold the lock, inheriting the priority
+   of any threads still waiting for it. */
 void
 thread_hold_the_lock (struct lock *lock)
 {
-  list_insert_ordered (&thread_current ()->locks, &lock->elem, lock_priority_more, NULL);
+  enum intr_level old_level = intr_disable ();
+  struct thread *cur = thread_current ();
+  heap_push (&cur->locks, &lock->elem);
+  thread_refresh_priority (cur);
+  intr_set_level (old_level);
 }
 
-/* Let the current thread donate its priority to thread t. */
-void 
-thread_donate_priority (struct thread *t)
+/* Called after the set or the priorities of the threads waiting for
+   LOCK changed: passes the new donation on to its holder. */
+void
+thread_lock_waiters_changed (struct lock *lock)
 {
-  enum intr_level old_level = intr_disable();
-  t->priority = thread_current ()->priority;
-  if (t->status == THREAD_READY)
-  {
-    list_remove (&t->elem);
-    list_insert_ordered (&ready_list, &t->elem, thread_priority_more, NULL);
-  } 
-  else if (t->status == THREAD_RUNNING)
-  {
-    thread_cond_yield ();
-  }
+  ASSERT (intr_get_level () == INTR_OFF);
 
-  intr_set_level (old_level);
+  if (lock->holder == NULL)
+    return;
+  heap_update (&lock->holder->locks, &lock->elem);
+  thread_refresh_priority (lock->holder);
 }
 
 /* Remove the lock from the current thread. */
@@ -641,20 +1123,58 @@ void
 thread_remove_lock (struct lock *lock)
 {
   enum intr_level old_level = intr_disable ();
-  list_remove (&lock->elem);
   struct thread *cur = thread_current ();
-  if (list_empty (&cur->locks))
-  {
-    cur->priority = cur->old_priority;
-  } 
-  else
-  {
-    int lock_priority = list_entry (list_front (&cur->locks), struct lock, elem)->max_priority;
-    if(lock_priority > cur->old_priority)
-      cur->priority = lock_priority;
-  }
+  heap_remove (&cur->locks, &lock->elem);
+  thread_refresh_priority (cur);
   intr_set_level (old_level);
 }
+
+/* Recomputes T's priority as the greater of its own and the
+   greatest donation through the locks it holds, moving T within
+   the ready queues or the semaphore it waits on.  If T is waiting
+   for a lock, the change is passed on to that lock's holder, and
+   so on down the chain: each step costs O(log n) in the heaps it
+   touches. */
+static void
+thread_refresh_priority (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (t != NULL)
+    {
+      int priority = t->old_priority;
+      if (!heap_empty (&t->locks))
+        {
+          int donation = lock_donation (heap_entry (heap_top (&t->locks),
+                                                    struct lock, elem));
+          if (donation > priority)
+            priority = donation;
+        }
+      if (priority == t->priority)
+        return;
+
+      if (t->status == THREAD_READY)
+        {
+          ready_remove (t);
+          t->priority = priority;
+          ready_push (t);
+        }
+      else if (t->status == THREAD_BLOCKED && t->wait_queue != NULL)
+        {
+          bool raised = priority > t->priority;
+          t->priority = priority;
+          wait_queue_update (t->wait_queue, t, raised);
+        }
+      else
+        t->priority = priority;
+
+      if (t->lock_waiting == NULL || t->lock_waiting->holder == NULL)
+        return;
+      heap_update (&t->lock_waiting->holder->locks, &t->lock_waiting->elem);
+      t = t->lock_waiting->holder;
+    }
+}
+
 
 /* Idle thread.  Executes when no other thread is ready to run.
 
@@ -669,11 +1189,17 @@ static void
 idle (void *idle_started_ UNUSED) 
 {
   struct semaphore *idle_started = idle_started_;
-  idle_thread = thread_current ();
+  this_cpu ()->idle_thread = thread_current ();
   sema_up (idle_started);
 
   for (;;) 
     {
+      /* Do background work while there is nothing else to do,
+         until there is none left or a thread becomes ready.  A
+         chunk in progress is preempted as usual. */
+      while (run_idle_work ())
+        continue;
+
       /* Let someone else run. */
       intr_disable ();
       thread_block ();
@@ -694,6 +1220,41 @@ idle (void *idle_started_ UNUSED)
     }
 }
 
+/* Runs one chunk of each idle work in turn.  Returns true if
+   any may have more to do and no thread has become ready. */
+static bool
+run_idle_work (void)
+{
+  struct list_elem *e;
+  bool more = false;
+
+  for (e = list_begin (&idle_work_list); e != list_end (&idle_work_list);
+       e = list_next (e))
+    {
+      struct idle_work *w = list_entry (e, struct idle_work, elem);
+
+      if (this_cpu ()->ready_cnt > 0)
+        return false;
+      if (w->func ())
+        more = true;
+    }
+  return more && this_cpu ()->ready_cnt == 0;
+}
+
+/* Adds W, which calls FUNC, to the work the idle thread does
+   while no other thread is ready.  W must stay put for as long
+   as the kernel runs. */
+void
+thread_add_idle_work (struct idle_work *w, idle_work_func *func)
+{
+  enum intr_level old_level;
+
+  w->func = func;
+  old_level = intr_disable ();
+  list_push_back (&idle_work_list, &w->elem);
+  intr_set_level (old_level);
+}
+
 /* Function used as the basis for a kernel thread. */
 static void
 kernel_thread (thread_func *function, void *aux) 
@@ -743,7 +1304,7 @@ init_thread (struct thread *t, const char *name, int priority)
   t->stack = (uint8_t *) t + PGSIZE;
   t->priority = priority;
   t->magic = THREAD_MAGIC;
-  t->wakeup_time = 0;
+  t->decay_epoch = decay_epoch;
   if (t == initial_thread)
   {
     t->nice = 0;
@@ -757,8 +1318,11 @@ init_thread (struct thread *t, const char *name, int priority)
   t->recent_cpu = 0;*/
 
   t->old_priority = priority;
-  list_init (&t->locks);
+  heap_init (&t->locks, lock_donation_less, NULL);
+  t->cpu_mask = (t == initial_thread ? CPU_MASK_ALL
+                 : running_thread ()->cpu_mask);
   t->lock_waiting = NULL;
+  t->wait_queue = NULL;
 
   t->return_value = 0;
   t->parent_die = false;
@@ -768,13 +1332,33 @@ init_thread (struct thread *t, const char *name, int priority)
 
   t->cwd = NULL;
 
+#ifdef USERPROG
+  t->fd_table = NULL;
+  t->fd_cap = 0;
+  t->fd_used = NULL;
+  t->aio = NULL;
+  t->leader = t;
+  lock_init (&t->fd_lock);
+  lock_init (&t->mm_lock);
+  list_init (&t->uthreads);
+  t->uthread_cnt = 0;
+  sema_init (&t->uthreads_done, 0);
+  t->exiting = false;
+  t->uthread_exiting = false;
+#endif
+
 #ifdef VM
   list_init(&t->mmap_file_list);
   t->next_mapid = 1;
+  t->last_fault = NULL;
+  t->fault_window = 0;
+  t->stack_prefault = (t == initial_thread ? PAGE_STACK_PREFAULT
+                       : running_thread ()->stack_prefault);
+  t->frame_limit = t == initial_thread ? 0 : running_thread ()->frame_limit;
 #endif
 
   old_level = intr_disable ();
-  list_insert_ordered (&all_list, &t->allelem, thread_priority_more, NULL);
+  list_push_back (&all_list, &t->allelem);
   intr_set_level (old_level);
 }
 
@@ -795,14 +1379,117 @@ alloc_frame (struct thread *t, size_t size)
    return a thread from the run queue, unless the run queue is
    empty.  (If the running thread can continue running, then it
    will be in the run queue.)  If the run queue is empty, return
-   idle_thread. */
+   the CPU's idle thread.  Deadline threads come first, but only
+   while they have budget left. */
 static struct thread *
 next_thread_to_run (void)
 {
-  if (list_empty (&ready_list))
-    return idle_thread;
+  struct cpu *c = this_cpu ();
+  struct thread *t;
+
+  if (c->ready_cnt == 0)
+    return c->idle_thread;
+  t = rt_pick ();
+  if (t != NULL)
+    {
+      ready_remove (t);
+      return t;
+    }
+  if (ready_max_priority () < PRI_MIN)
+    return c->idle_thread;
+  return ready_pop ();
+}
+
+/* Returns the ready deadline thread with budget left whose
+   deadline is earliest, or a null pointer if there is none.
+   Interrupts must be off. */
+static struct thread *
+rt_pick (void)
+{
+  struct cpu *c = this_cpu ();
+  struct thread *best = NULL;
+  struct list_elem *e;
+
+  for (e = list_begin (&c->rt_queue); e != list_end (&c->rt_queue);
+       e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct thread, elem);
+      if (t->rt_budget > 0
+          && (best == NULL || t->rt_deadline < best->rt_deadline))
+        best = t;
+    }
+  return best;
+}
+
+/* Appends T to the run queue for its priority. */
+static void
+ready_push (struct thread *t)
+{
+  struct cpu *c = this_cpu ();
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  if (thread_mlfqs && t != c->idle_thread)
+    {
+      recent_cpu_catch_up (t);
+      t->priority = mlfqs_priority (t);
+    }
+  ASSERT (t->priority >= PRI_MIN && t->priority <= PRI_MAX);
+
+  if (t->rt_period > 0)
+    list_push_back (&c->rt_queue, &t->elem);
   else
-    return list_entry (list_pop_front (&ready_list), struct thread, elem);
+    {
+      list_push_back (&c->ready_queues[t->priority], &t->elem);
+      c->ready_mask[t->priority / 32] |= 1u << (t->priority % 32);
+    }
+  c->ready_cnt++;
+}
+
+/* Removes ready thread T from its run queue.  T's priority must
+   not have changed since it was pushed. */
+static void
+ready_remove (struct thread *t)
+{
+  struct cpu *c = this_cpu ();
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  list_remove (&t->elem);
+  if (t->rt_period == 0 && list_empty (&c->ready_queues[t->priority]))
+    c->ready_mask[t->priority / 32] &= ~(1u << (t->priority % 32));
+  c->ready_cnt--;
+}
+
+/* Returns the highest priority among ready threads, or
+   PRI_MIN - 1 if no thread is ready. */
+static int
+ready_max_priority (void)
+{
+  struct cpu *c = this_cpu ();
+  int i;
+
+  for (i = (int) (sizeof c->ready_mask / sizeof *c->ready_mask) - 1; i >= 0; i--)
+    if (c->ready_mask[i] != 0)
+      return i * 32 + 31 - __builtin_clz (c->ready_mask[i]);
+  return PRI_MIN - 1;
+}
+
+/* Removes and returns the first thread of the highest non-empty
+   run queue.  Some thread must be ready. */
+static struct thread *
+ready_pop (void)
+{
+  struct cpu *c = this_cpu ();
+  struct thread *t;
+
+  ASSERT (c->ready_cnt > 0);
+
+  t = list_entry (list_front (&c->ready_queues[ready_max_priority ()]),
+                  struct thread, elem);
+  ready_remove (t);
+  if (thread_mlfqs)
+    recent_cpu_catch_up (t);
+  return t;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -847,10 +1534,82 @@ thread_schedule_tail (struct thread *prev)
   if (prev != NULL && prev->status == THREAD_DYING && prev != initial_thread) 
     {
       ASSERT (prev != cur);
-      palloc_free_page (prev);
+      thread_page_put (prev);
+    }
+}
+
+/* Returns a page for a new thread, reusing a dead thread's if one
+   is pooled, or a null pointer if out of memory.  The page is not
+   zeroed. */
+static struct thread *
+thread_page_get (void)
+{
+  enum intr_level old_level = intr_disable ();
+  void *page = thread_pool;
+  if (page != NULL)
+    {
+      thread_pool = *(void **) page;
+      thread_pool_cnt--;
+    }
+  intr_set_level (old_level);
+#ifdef STACK_GUARD
+  if (page == NULL)
+    {
+      uint8_t *pages = palloc_get_multiple (0, 2);
+      if (pages != NULL)
+        {
+          page = pages + PGSIZE;
+          set_guard (page, false);
+        }
+    }
+  return page;
+#else
+  return page != NULL ? page : palloc_get_page (0);
+#endif
+}
+
+/* Pools the page of dead thread T, or frees it if the pool is
+   full.  Interrupts must be off. */
+static void
+thread_page_put (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (thread_pool_cnt < THREAD_POOL_MAX)
+    {
+      *(void **) t = thread_pool;
+      thread_pool = t;
+      thread_pool_cnt++;
+    }
+  else
+    {
+#ifdef STACK_GUARD
+      set_guard (t, true);
+      palloc_free_multiple ((uint8_t *) t - PGSIZE, 2);
+#else
+      palloc_free_page (t);
+#endif
     }
 }
 
+#ifdef STACK_GUARD
+/* Maps the guard page below T if MAPPED is true, else unmaps it.
+   The kernel page tables are shared by every page directory, and
+   their entries are global, so the TLB entry is flushed here. */
+static void
+set_guard (struct thread *t, bool mapped)
+{
+  uint8_t *guard = (uint8_t *) t - PGSIZE;
+  uint32_t *pte = pde_get_pt (init_page_dir[pd_no (guard)]) + pt_no (guard);
+
+  if (mapped)
+    *pte |= PTE_P;
+  else
+    *pte &= ~PTE_P;
+  asm volatile ("invlpg (%0)" : : "r" (guard) : "memory");
+}
+#endif
+
 /* Schedules a new process.  At entry, interrupts must be off and
    the running process's state must have been changed from
    running to some other state.  This function finds another
@@ -860,17 +1619,30 @@ thread_schedule_tail (struct thread *prev)
    has completed. */
 static void
 schedule (void) 
+{
+  switch_to (next_thread_to_run ());
+}
+
+/* Switches to NEXT, which is ready but not on the run queue, and
+   is the idle thread only if nothing else is ready.  The same
+   conditions apply as for schedule(). */
+static void
+switch_to (struct thread *next)
 {
   struct thread *cur = running_thread ();
-  struct thread *next = next_thread_to_run ();
   struct thread *prev = NULL;
 
   ASSERT (intr_get_level () == INTR_OFF);
   ASSERT (cur->status != THREAD_RUNNING);
   ASSERT (is_thread (next));
 
+  if (is_idle_thread (cur))
+    timer_idle_exit ();
   if (cur != next)
-    prev = switch_threads (cur, next);
+    {
+      KTRACE (KTRACE_SCHEDULE, next->tid, cur->status);
+      prev = switch_threads (cur, next);
+    }
   thread_schedule_tail (prev);
 }
 
@@ -888,66 +1660,127 @@ allocate_tid (void)
   return tid;
 }
 
-static bool
-wakeup_time_less (const struct list_elem *lhs, const struct list_elem *rhs, void *aux UNUSED)
+/* Returns the priority LOCK donates to its holder: that of its
+   highest-priority waiter, or PRI_MIN - 1 if nobody waits. */
+static int
+lock_donation (const struct lock *lock)
 {
-  struct thread *a, *b;
-  
-  ASSERT (lhs != NULL && rhs != NULL);
-  
-  a = list_entry (lhs, struct thread, elem);
-  b = list_entry (rhs, struct thread, elem);
-  
-  return (a->wakeup_time < b->wakeup_time);
+  return wait_queue_max_priority (&lock->semaphore.waiters);
 }
 
 static bool
-thread_priority_more (const struct list_elem *lhs, const struct list_elem *rhs, void *aux UNUSED)
+lock_donation_less (const struct heap_elem *a, const struct heap_elem *b, void *aux UNUSED)
 {
-  struct thread *a, *b;
-  
-  ASSERT (lhs != NULL && rhs != NULL);
-  
-  a = list_entry (lhs, struct thread, elem);
-  b = list_entry (rhs, struct thread, elem);
-  
-  return (a->priority > b->priority);
+  return (lock_donation (heap_entry (a, struct lock, elem))
+          < lock_donation (heap_entry (b, struct lock, elem)));
 }
 
-static bool
-lock_priority_more (const struct list_elem *lhs, const struct list_elem *rhs, void *aux UNUSED)
-{
-  struct lock *a, *b;
-  
-  ASSERT (lhs != NULL && rhs != NULL);
-  
-  a = list_entry (lhs, struct lock, elem);
-  b = list_entry (rhs, struct lock, elem);
-  
-  return (a->max_priority > b->max_priority);
+#ifdef USERPROG
+/* Returns the current process's open file with descriptor FD, or
+   a null pointer if FD is not open.  The table is shared by the
+   process's threads; fd_lock only keeps it intact as it grows. */
+struct file_info* get_file_info (int fd) {
+  struct thread *cur = thread_current()->leader;
+  struct file_info *info = NULL;
+  lock_acquire(&cur->fd_lock);
+  if (fd >= FD_MIN && (size_t) (fd - FD_MIN) < cur->fd_cap)
+    info = cur->fd_table[fd - FD_MIN];
+  lock_release(&cur->fd_lock);
+  return info;
 }
 
-struct file_info* get_file_info (int fd) {
-  struct thread *cur = thread_current();
-  struct list_elem *i;
-  for (i = list_begin(&file_list); i != list_end(&file_list); i = list_next(i)) {
-    struct file_info *l;
-    l = list_entry(i, struct file_info, elem);
-    if (l->fd == fd) {
-      if (l->thread_num == cur)
-        return l;
-      return NULL;
+/* Gives INFO the lowest free descriptor of the current process and
+   stores it in INFO->fd, doubling the table when it is full.
+   Returns false if out of memory. */
+bool
+add_file_info (struct file_info *info) {
+  struct thread *cur = thread_current()->leader;
+  lock_acquire(&cur->fd_lock);
+  size_t slot = cur->fd_used != NULL
+                ? bitmap_scan(cur->fd_used, 0, 1, false) : BITMAP_ERROR;
+
+  if (slot == BITMAP_ERROR) {
+    size_t cap = cur->fd_cap > 0 ? cur->fd_cap * 2 : FD_TABLE_MIN;
+    struct file_info **table = realloc(cur->fd_table, cap * sizeof *table);
+    struct bitmap *used = bitmap_create(cap);
+    if (table == NULL || used == NULL) {
+      if (table != NULL)
+        cur->fd_table = table;
+      bitmap_destroy(used);
+      lock_release(&cur->fd_lock);
+      return false;
     }
+    memset(table + cur->fd_cap, 0, (cap - cur->fd_cap) * sizeof *table);
+    bitmap_set_multiple(used, 0, cur->fd_cap, true);
+    bitmap_destroy(cur->fd_used);
+    slot = cur->fd_cap;
+    cur->fd_table = table;
+    cur->fd_used = used;
+    cur->fd_cap = cap;
   }
-  return NULL;
+  bitmap_mark(cur->fd_used, slot);
+  cur->fd_table[slot] = info;
+  info->fd = slot + FD_MIN;
+  lock_release(&cur->fd_lock);
+  return true;
 }
 
+/* Frees INFO's descriptor for reuse.  Does not close the file. */
 void
-add_file_list (struct file_info *info) {
-  list_push_back(&file_list, &(info->elem));
+remove_file_info (struct file_info *info) {
+  struct thread *cur = thread_current()->leader;
+  size_t slot = info->fd - FD_MIN;
+
+  lock_acquire(&cur->fd_lock);
+  ASSERT (slot < cur->fd_cap && cur->fd_table[slot] == info);
+  cur->fd_table[slot] = NULL;
+  bitmap_reset(cur->fd_used, slot);
+  lock_release(&cur->fd_lock);
+}
+
+#ifdef VM
+/* Gives the current thread, which has no open files yet, its own
+   copy of each of PARENT's under the same descriptor and at the
+   same position, as fork does.  Returns false if out of memory;
+   whatever was copied is closed at exit. */
+bool
+fork_file_infos (struct thread *parent) {
+  struct thread *cur = thread_current();
+  size_t i;
+
+  ASSERT (cur->fd_cap == 0);
+  if (parent->fd_cap == 0)
+    return true;
+  cur->fd_table = calloc(parent->fd_cap, sizeof *cur->fd_table);
+  cur->fd_used = bitmap_create(parent->fd_cap);
+  if (cur->fd_table == NULL || cur->fd_used == NULL)
+    return false;
+  cur->fd_cap = parent->fd_cap;
+  for (i = 0; i < parent->fd_cap; i++) {
+    struct file_info *p = parent->fd_table[i];
+    struct file_info *info;
+    if (p == NULL)
+      continue;
+    info = slab_alloc(&file_info_cache);
+    if (info == NULL)
+      return false;
+    *info = *p;
+    cur->fd_table[i] = info;
+    bitmap_mark(cur->fd_used, i);
+    if (p->pipe != NULL) {
+      pipe_open(p->pipe, p->pipe_writer);
+      continue;
+    }
+    info->opened_file = file_reopen(p->opened_file);
+    info->opened_dir = p->opened_dir != NULL ? dir_reopen(p->opened_dir) : NULL;
+    if (info->opened_file == NULL)
+      return false;
+  }
+  return true;
 }
+#endif
+#endif
 
 /* Offset of `stack' member within `struct thread'.
    Used by switch.S, which can't figure it out on its own. */
 uint32_t thread_stack_ofs = offsetof (struct thread, stack);
-
@@ -2,9 +2,20 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <hash.h>
 #include <list.h>
 #include <stdint.h>
+#include "threads/slab.h"
 #include "threads/synch.h"
+#ifdef VM
+#include <syscall-nr.h>
+#endif
+
+struct bitmap;
+struct sysinfo_thread;
+struct aio_context;
+struct shm;
+struct pipe;
 
 /* States in a thread's life cycle. */
 enum thread_status
@@ -30,6 +41,10 @@ typedef int off_t;
 #define NICE_DEFAULT 0                  /* Default nice. */
 #define NICE_MAX 20                     /* Highest nice. */
 
+/* File descriptors. */
+#define FD_MIN 2                        /* Lowest fd; 0 and 1 are the console. */
+#define FD_TABLE_MIN 16                 /* Initial size of a thread's fd table. */
+
 struct thread;
 
 struct mmap_handler{
@@ -44,6 +59,10 @@ struct mmap_handler{
     bool is_static_data; 
     int num_page_with_segment;
     off_t file_ofs;
+    struct shm* shm;		/* Shared memory object mapped, in which
+				   case mmap_file is null; else null. */
+    int advice;			/* MADV_NORMAL, MADV_SEQUENTIAL or
+				   MADV_RANDOM, from madvise. */
 };
 
 struct child_info
@@ -56,16 +75,21 @@ struct child_info
   int ret_value;
   struct semaphore *sema_start;
   struct semaphore *sema_finish;
-  struct list_elem elem;
-  struct list_elem allelem;
+  struct thread *parent;        /* Thread that created the child. */
+  bool uthread;                 /* A thread of the parent's process,
+                                   started by SYS_UTHREAD_CREATE? */
+  bool joined;                  /* Being joined, if a uthread. */
+  struct list_elem elem;        /* Element in the parent's child_list. */
+  struct hash_elem hash_elem;   /* Element in child_table, by child_id. */
 };
 struct file_info{
   int fd;
   struct file* opened_file;
   struct dir* opened_dir;
-  struct thread* thread_num;
-
-  struct list_elem elem;
+  unsigned pos;                 /* Position for read, write, seek and tell. */
+  struct pipe *pipe;            /* If an end of a pipe, the pipe, in
+                                   which case opened_file is null. */
+  bool pipe_writer;             /* If so, whether its write end. */
 };
 
 
@@ -95,8 +119,8 @@ struct file_info{
              |              magic              |
              |                :                |
              |                :                |
-             |               name              |
              |              status             |
+             |              stack              |
         0 kB +---------------------------------+
 
    The upshot of this is twofold:
@@ -127,25 +151,43 @@ struct file_info{
    blocked state is on a semaphore wait list. */
 struct thread
   {
-    /* Owned by thread.c. */
-    tid_t tid;                          /* Thread identifier. */
-    enum thread_status status;          /* Thread state. */
-    char name[16];                      /* Name (for debugging purposes). */
+    /* Read or written on every switch, block, wakeup and tick;
+       together they fill the first 64-byte cache line, which the
+       page alignment above lines up with. */
     uint8_t *stack;                     /* Saved stack pointer. */
+    enum thread_status status;          /* Thread state. */
     int priority;                       /* Priority. */
-    struct list_elem allelem;           /* List element for all threads list. */
-
-    /* Shared between thread.c and synch.c. */
-    struct list_elem elem;              /* List element. */
-
-    /* My attempt and owned by thread.c. */
-    int64_t wakeup_time;                /* Time to wake up after sleep. */
+    struct list_elem elem;              /* List element, see above. */
+    tid_t tid;                          /* Thread identifier. */
     int recent_cpu;                     /* Recent_CPU for priority. */
     int nice;                           /* Nice for priority. */
+    int decay_epoch;                    /* Last second applied to recent_cpu. */
+    struct wait_queue *wait_queue;      /* Queue we are blocked on, if any. */
+    struct heap_elem waitelem;          /* Heap element in `wait_queue'. */
+    unsigned wait_seq;                  /* Arrival order among equal priorities. */
+    struct lock *lock_waiting;          /* The lock that the thread is waiting for. */
+#ifdef USERPROG
+    uint32_t *pagedir;                  /* Page directory, loaded on switch;
+                                           owned by userprog/process.c. */
+#endif
 
+    /* Owned by thread.c. */
+    char name[16];                      /* Name (for debugging purposes). */
+    struct list_elem allelem;           /* List element for all threads list. */
     int old_priority;                   /* Old priority. */
-    struct list locks;                  /* Locks tat the thread is holding. */
-    struct lock *lock_waiting;          /* The lock that the thread is waiting for. */
+    struct heap locks;                  /* Held locks, greatest donation on top. */
+    unsigned cpu_mask;                  /* CPUs it may run on, bit N for CPU N. */
+
+    /* Deadline class, if rt_period is nonzero; owned by thread.c. */
+    int rt_runtime;                     /* Ticks reserved per period. */
+    int rt_period;                      /* Ticks per period. */
+    int rt_budget;                      /* Reserved ticks left this period. */
+    int64_t rt_deadline;                /* Tick the period ends. */
+    struct list_elem rtelem;            /* Element in the CPU's rt_threads. */
+    struct dir* cwd;
+    int journal_depth;                  /* Nested journal_begin() calls. */
+    int io_class;                       /* Class of its block requests,
+                                           see block_set_io_class(). */
 
     int return_value;
     struct list child_list;
@@ -154,21 +196,51 @@ struct thread
     bool parent_die;
     struct child_info *message_to_parent;
 #ifdef USERPROG
-    /* Owned by userprog/process.c. */
-    uint32_t *pagedir;                  /* Page directory. */
+    /* Owned by userprog/process.c.  A thread started by
+       SYS_UTHREAD_CREATE shares the process state of the
+       process's first thread, its leader, and uses only its own
+       pagedir, page_table and esp, which are copies; see
+       process_current(). */
+    struct thread *leader;              /* Holds this process's state. */
     struct file* exec_file;
+    struct exec_image *exec_image;      /* Segments to read in on demand, if any. */
+    struct file_info **fd_table;        /* Open files, indexed by fd - FD_MIN. */
+    size_t fd_cap;                      /* Number of slots in fd_table. */
+    struct bitmap *fd_used;             /* Bit set for each slot in use. */
+    uint8_t *heap_start;                /* First page past the segments. */
+    uint8_t *heap_brk;                  /* End of the heap, see sbrk. */
+    struct aio_context *aio;            /* Asynchronous I/O, or null. */
+    struct lock fd_lock;                /* Guards the fd table. */
+    struct lock mm_lock;                /* Serializes sbrk, mmap, munmap. */
+
+    /* The leader's other threads. */
+    struct list uthreads;               /* Their child_infos. */
+    int uthread_cnt;                    /* Number not yet exited. */
+    struct semaphore uthreads_done;     /* Upped when that reaches 0. */
+    bool exiting;                       /* All of them are to exit. */
+    bool uthread_exiting;               /* This thread is leaving by
+                                           SYS_UTHREAD_EXIT alone. */
 #endif
 
 #ifdef VM
-    struct hash* page_table;
+    struct ptrmap* page_table;
     void* esp;
     struct list mmap_file_list;
     mapid_t next_mapid;
+    void* last_fault;                   /* Last page faulted in from disk. */
+    int fault_window;                   /* Pages read ahead of it, see vm/page.c. */
+    int stack_prefault;                 /* Most stack pages mapped per fault. */
+    int frame_limit;                    /* Most frames it may hold, 0 for
+                                           no limit; see vm/frame.c. */
+    int frame_cnt;                      /* Frames it owns now.  Under all_lock. */
+    struct vm_stats vm_stats;           /* Fault and eviction counts; the
+                                           page counts are filled in
+                                           when read.  Under page_lock. */
 #endif
 
-    /* Owned by thread.c. */
+    /* Owned by thread.c.  Last, so that an overflowing stack
+       reaches it before anything else. */
     unsigned magic;                     /* Detects stack overflow. */
-    struct dir* cwd;
   };
 
 struct file_handle{
@@ -183,19 +255,44 @@ struct file_handle{
    Controlled by kernel command-line option "-o mlfqs". */
 extern bool thread_mlfqs;
 
+/* Caches for the per-process bookkeeping structures above. */
+extern struct slab_cache child_info_cache;
+extern struct slab_cache file_info_cache;
+extern struct slab_cache mmap_handler_cache;
+
 void thread_init (void);
 void thread_start (void);
 
 void thread_tick (void);
-void thread_sleep (int64_t ticks);
-void thread_wakeup (void);
+bool thread_set_time_slice (int high, int low);
+bool thread_set_reservation (int runtime, int period);
+unsigned thread_time_slice (int priority);
+void thread_tick_idle (void);
+bool thread_cpu_idle (void);
 void thread_print_stats (void);
 
+/* Background work that the idle thread does, in bounded chunks,
+   while no other thread is ready.  The function does one chunk
+   with interrupts on and returns true if there may be more.  It
+   runs in the idle thread, so it must not sleep; work that may
+   sleep should queue itself on a work queue (see
+   threads/workqueue.h) instead of doing it. */
+typedef bool idle_work_func (void);
+struct idle_work
+  {
+    idle_work_func *func;       /* Does one chunk. */
+    struct list_elem elem;      /* Element in the idle work list. */
+  };
+void thread_add_idle_work (struct idle_work *, idle_work_func *);
+
 typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
+tid_t thread_create_child (const char *name, int priority,
+                           thread_func *, void *);
 
 void thread_block (void);
 void thread_unblock (struct thread *);
+void thread_unblock_switch (struct thread *);
 
 struct thread *thread_current (void);
 tid_t thread_tid (void);
@@ -216,21 +313,26 @@ int thread_get_nice (void);
 void thread_set_nice (int);
 int thread_get_recent_cpu (void);
 int thread_get_load_avg (void);
+int thread_get_info (struct sysinfo_thread *, int max);
+bool thread_set_affinity (struct thread *, unsigned mask);
 
-void increase_recent_cpu (void);
 void update_priority (struct thread *t, void *aux UNUSED);
-void update_priority_for_each (void);
+void update_priority_running (void);
 
 void update_load_avg (void);
 void update_recent_cpu (struct thread *t, void *aux UNUSED);
-void update_recent_cpu_for_each (void);
 
 void thread_hold_the_lock (struct lock *lock);
-void thread_donate_priority (struct thread *t);
+void thread_lock_waiters_changed (struct lock *lock);
 void thread_remove_lock (struct lock *lock);
 
 struct file_info* get_file_info(int fd);
 struct child_info* get_child_info(tid_t tid);
-void add_file_list(struct file_info *info);
+void free_child_info(struct child_info *info);
+bool add_file_info(struct file_info *info);
+void remove_file_info(struct file_info *info);
+#ifdef VM
+bool fork_file_infos(struct thread *parent);
+#endif
 
 #endif /* threads/thread.h */
@@ -0,0 +1,300 @@
+#include "threads/workqueue.h"
+#include <debug.h>
+#include <hist.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Number of worker threads. */
+#define WORKER_CNT 4
+
+/* All queues, highest priority first.  The queues' pending lists
+   and counts are shared with interrupt handlers, so they are only
+   touched with interrupts off. */
+static struct list all_queues;
+
+/* Counts queued items, so idle workers sleep until there is one.
+   May run ahead of the items actually queued after work_cancel(),
+   in which case a worker just finds none and sleeps again. */
+static struct semaphore work_ready;
+
+/* A thread waiting in workqueue_flush(). */
+struct flusher
+  {
+    struct list_elem elem;      /* Element in the queue's flushers. */
+    struct semaphore done;      /* Upped when the queue drains. */
+  };
+
+static thread_func worker NO_RETURN;
+static void enqueue (struct workqueue *, struct work *);
+static void delayed_expire (void *work);
+static struct work *take_work (struct workqueue **);
+static void retire (struct workqueue *);
+
+/* Initializes the work queue subsystem and starts the worker
+   threads.  Must be called before any other function here. */
+void
+workqueue_start (void)
+{
+  int i;
+
+  list_init (&all_queues);
+  sema_init (&work_ready, 0);
+  for (i = 0; i < WORKER_CNT; i++)
+    {
+      char name[16];
+      snprintf (name, sizeof name, "worker-%d", i);
+      if (thread_create (name, PRI_DEFAULT, worker, NULL) == TID_ERROR)
+        PANIC ("could not start worker threads");
+    }
+}
+
+/* Initializes WQ as an empty queue named NAME whose items run at
+   PRIORITY. */
+void
+workqueue_init (struct workqueue *wq, const char *name, int priority)
+{
+  enum intr_level old_level;
+  struct list_elem *e;
+
+  ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
+
+  wq->name = name;
+  wq->priority = priority;
+  list_init (&wq->pending);
+  wq->active = 0;
+  list_init (&wq->flushers);
+  wq->run_cnt = wq->delayed_cnt = wq->run_cycles = 0;
+  memset (wq->hist, 0, sizeof wq->hist);
+
+  old_level = intr_disable ();
+  for (e = list_begin (&all_queues); e != list_end (&all_queues);
+       e = list_next (e))
+    if (list_entry (e, struct workqueue, elem)->priority < priority)
+      break;
+  list_insert (e, &wq->elem);
+  intr_set_level (old_level);
+}
+
+/* Waits until WQ has no items pending or running, including any
+   queued while waiting. */
+void
+workqueue_flush (struct workqueue *wq)
+{
+  enum intr_level old_level;
+  struct flusher f;
+
+  ASSERT (!intr_context ());
+
+  old_level = intr_disable ();
+  if (wq->active > 0)
+    {
+      sema_init (&f.done, 0);
+      list_push_back (&wq->flushers, &f.elem);
+      sema_down (&f.done);
+    }
+  intr_set_level (old_level);
+}
+
+/* Prints statistics for each queue that has run any work. */
+void
+workqueue_print_stats (void)
+{
+  struct list_elem *e;
+  int b;
+
+  for (e = list_begin (&all_queues); e != list_end (&all_queues);
+       e = list_next (e))
+    {
+      struct workqueue *wq = list_entry (e, struct workqueue, elem);
+      if (wq->run_cnt == 0)
+        continue;
+      printf ("Workqueue %s: %llu runs, %llu delayed, %llu cycles running\n",
+              wq->name, wq->run_cnt, wq->delayed_cnt, wq->run_cycles);
+      printf ("Workqueue %s latency (log2 cycles: runs):", wq->name);
+      for (b = 0; b < WORKQUEUE_HIST_BUCKETS; b++)
+        if (wq->hist[b] > 0)
+          printf (" %d: %llu", b, wq->hist[b]);
+      printf ("\n");
+    }
+}
+
+/* Initializes WORK to call FUNC, passing WORK itself. */
+void
+work_init (struct work *work, work_func *func)
+{
+  ASSERT (func != NULL);
+
+  work->func = func;
+  work->wq = NULL;
+  work->pending = false;
+  timer_event_init (&work->timer, delayed_expire, work);
+}
+
+/* Queues WORK on WQ.  Returns false, doing nothing, if WORK is
+   already pending.  May be called from an interrupt handler. */
+bool
+work_queue (struct workqueue *wq, struct work *work)
+{
+  enum intr_level old_level = intr_disable ();
+  bool queued = !work->pending;
+
+  if (queued)
+    {
+      work->pending = true;
+      wq->active++;
+      enqueue (wq, work);
+    }
+  intr_set_level (old_level);
+  return queued;
+}
+
+/* Queues WORK on WQ once TICKS timer ticks have passed, or at
+   once if TICKS is not positive.  Returns false, doing nothing,
+   if WORK is already pending.  May be called from an interrupt
+   handler. */
+bool
+work_queue_delayed (struct workqueue *wq, struct work *work, int64_t ticks)
+{
+  enum intr_level old_level;
+  bool queued;
+
+  if (ticks <= 0)
+    return work_queue (wq, work);
+
+  old_level = intr_disable ();
+  queued = !work->pending;
+  if (queued)
+    {
+      work->pending = true;
+      work->wq = wq;
+      wq->active++;
+      timer_event_add (&work->timer, timer_ticks () + ticks);
+    }
+  intr_set_level (old_level);
+  return queued;
+}
+
+/* Keeps WORK from running if it is still pending.  Returns true
+   if it was, false if it was never queued or has already started
+   (and may still be running). */
+bool
+work_cancel (struct work *work)
+{
+  enum intr_level old_level = intr_disable ();
+  bool pending = work->pending;
+
+  if (pending)
+    {
+      struct workqueue *wq = work->wq;
+      if (!timer_event_cancel (&work->timer))
+        list_remove (&work->elem);
+      work->pending = false;
+      retire (wq);
+    }
+  intr_set_level (old_level);
+  return pending;
+}
+
+/* Adds pending WORK to the back of WQ and wakes a worker.
+   Interrupts must be off. */
+static void
+enqueue (struct workqueue *wq, struct work *work)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  work->wq = wq;
+  work->queued_tsc = timer_tsc ();
+  list_push_back (&wq->pending, &work->elem);
+  sema_up (&work_ready);
+}
+
+/* Timer callback that queues delayed WORK. */
+static void
+delayed_expire (void *work_)
+{
+  struct work *work = work_;
+
+  work->wq->delayed_cnt++;
+  enqueue (work->wq, work);
+}
+
+/* Removes and returns the oldest item of the highest-priority
+   queue that has one, storing its queue in *WQ, or returns a null
+   pointer if there is none.  Interrupts must be off. */
+static struct work *
+take_work (struct workqueue **wq)
+{
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (&all_queues); e != list_end (&all_queues);
+       e = list_next (e))
+    {
+      struct workqueue *q = list_entry (e, struct workqueue, elem);
+      if (!list_empty (&q->pending))
+        {
+          struct work *work = list_entry (list_pop_front (&q->pending),
+                                          struct work, elem);
+          work->pending = false;
+          *wq = q;
+          return work;
+        }
+    }
+  return NULL;
+}
+
+/* Notes that one of WQ's items has run or been cancelled, and
+   wakes any flushers if it was the last.  Interrupts must be
+   off. */
+static void
+retire (struct workqueue *wq)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (--wq->active == 0)
+    while (!list_empty (&wq->flushers))
+      sema_up (&list_entry (list_pop_front (&wq->flushers),
+                            struct flusher, elem)->done);
+}
+
+/* Worker thread: runs queued work for ever. */
+static void
+worker (void *aux UNUSED)
+{
+  for (;;)
+    {
+      enum intr_level old_level;
+      struct workqueue *wq;
+      struct work *work;
+      uint64_t start, cycles;
+      int bucket;
+
+      sema_down (&work_ready);
+      old_level = intr_disable ();
+      work = take_work (&wq);
+      intr_set_level (old_level);
+      if (work == NULL)
+        continue;
+
+      if (thread_get_priority () != wq->priority)
+        thread_set_priority (wq->priority);
+
+      /* WORK may be freed or queued again by its function, so
+         only WQ is used afterward. */
+      start = timer_tsc ();
+      bucket = hist_bucket (start - work->queued_tsc, WORKQUEUE_HIST_BUCKETS);
+      work->func (work);
+      cycles = timer_tsc () - start;
+
+      old_level = intr_disable ();
+      wq->hist[bucket]++;
+      wq->run_cnt++;
+      wq->run_cycles += cycles;
+      retire (wq);
+      intr_set_level (old_level);
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef THREADS_WORKQUEUE_H
+#define THREADS_WORKQUEUE_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "devices/timer.h"
+
+/* Work queues.
+
+   A work item is a function to be called later, in process
+   context, by one of a fixed set of kernel worker threads shared
+   by every queue.  Subsystems that need background activity queue
+   work instead of each running a thread of their own.
+
+   Each queue has a priority.  An idle worker takes the oldest
+   item of the highest-priority queue that has any, and runs it
+   at that queue's priority, so urgent work is neither starved by
+   bulk work nor made to wait behind it in a worker's ready
+   queue.
+
+   Items may be queued from interrupt handlers, and may be
+   delayed by a number of timer ticks.  An item is queued at most
+   once at a time; once its function has started, it may queue
+   itself again or be freed by the function.
+
+   workqueue_start() must be called before any other function
+   here. */
+
+struct work;
+typedef void work_func (struct work *);
+
+/* A work item.  Embed it in the structure the function needs. */
+struct work
+  {
+    work_func *func;            /* Function to run. */
+    struct workqueue *wq;       /* Queue it goes on, while pending. */
+    bool pending;               /* Queued or delayed, not yet started? */
+    uint64_t queued_tsc;        /* CPU cycle counter when queued. */
+    struct list_elem elem;      /* Element in the queue's pending list. */
+    struct timer_event timer;   /* Fires delayed work. */
+  };
+
+/* Latency buckets in struct workqueue.  Bucket I counts items
+   that waited from 2**I up to 2**(I+1) CPU cycles to start; the
+   last one also counts anything slower. */
+#define WORKQUEUE_HIST_BUCKETS 40
+
+/* A work queue. */
+struct workqueue
+  {
+    const char *name;           /* Name, for workqueue_print_stats(). */
+    int priority;               /* Priority its items run at. */
+    struct list pending;        /* Items waiting for a worker. */
+    int active;                 /* Items pending or running. */
+    struct list flushers;       /* Threads in workqueue_flush(). */
+    struct list_elem elem;      /* Element in list of all queues. */
+
+    /* Statistics. */
+    unsigned long long run_cnt;         /* Items run. */
+    unsigned long long delayed_cnt;     /* Items queued after a delay. */
+    unsigned long long run_cycles;      /* Cycles spent running items. */
+    unsigned long long hist[WORKQUEUE_HIST_BUCKETS]; /* Queue latency. */
+  };
+
+void workqueue_start (void);
+void workqueue_init (struct workqueue *, const char *name, int priority);
+void workqueue_flush (struct workqueue *);
+void workqueue_print_stats (void);
+
+void work_init (struct work *, work_func *);
+bool work_queue (struct workqueue *, struct work *);
+bool work_queue_delayed (struct workqueue *, struct work *, int64_t ticks);
+bool work_cancel (struct work *);
+
+#endif /* threads/workqueue.h */
@@ -0,0 +1,349 @@
+#include "userprog/aio.h"
+#include <debug.h>
+#include <list.h>
+#include <stddef.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "threads/workqueue.h"
+#include "userprog/pagedir.h"
+#include "userprog/syscall.h"
+
+/* Most pages one request's buffer may span. */
+#define AIO_PAGES_MAX (AIO_IO_MAX / PGSIZE + 1)
+
+/* A process's asynchronous I/O state. */
+struct aio_context
+  {
+    struct aio_ring *ring;      /* Ring in user memory. */
+    struct lock lock;           /* Guards the members below. */
+    struct condition completed; /* Signaled as requests complete. */
+    struct list done;           /* Completed, not yet reaped. */
+    int inflight;               /* Submitted, not yet completed. */
+    int outstanding;            /* Submitted, not yet reaped. */
+  };
+
+/* One request, from submission until it is reaped. */
+struct aio_request
+  {
+    struct work work;           /* Runs the request on a worker. */
+    struct aio_context *ctx;    /* Context that submitted it. */
+    struct aio_sqe sqe;         /* The request, copied from the ring. */
+    struct file *file;          /* Private handle on the file. */
+    void *kpages[AIO_PAGES_MAX]; /* Kernel addresses of sqe.buf's pages. */
+    bool pinned;                /* Is sqe.buf still pinned? */
+    int res;                    /* Result, once completed. */
+    struct list_elem elem;      /* Element in the context's done list. */
+  };
+
+/* Queue that all requests run on. */
+static struct workqueue aio_wq;
+
+static int submit (struct aio_context *, const struct aio_sqe *);
+static void aio_run (struct work *);
+static void complete (struct aio_request *);
+static void release (struct aio_request *);
+
+/* Initializes asynchronous I/O.  Must be called after
+   workqueue_start(). */
+void
+aio_init (void)
+{
+  workqueue_init (&aio_wq, "aio", PRI_DEFAULT);
+}
+
+/* Returns a new context for the current process that uses RING,
+   which the caller has checked is writable user memory, with
+   both of its queues emptied.  Returns a null pointer if memory
+   is short or RING cannot be brought in. */
+struct aio_context *
+aio_create (struct aio_ring *ring)
+{
+  struct aio_context *ctx;
+
+  if (!pin_user (ring, sizeof *ring, true))
+    return NULL;
+  ring->sq_head = ring->sq_tail = 0;
+  ring->cq_head = ring->cq_tail = 0;
+  unpin_user (ring, sizeof *ring);
+
+  ctx = malloc (sizeof *ctx);
+  if (ctx == NULL)
+    return NULL;
+  ctx->ring = ring;
+  lock_init (&ctx->lock);
+  cond_init (&ctx->completed);
+  list_init (&ctx->done);
+  ctx->inflight = 0;
+  ctx->outstanding = 0;
+  return ctx;
+}
+
+/* Submits the requests queued in CTX's submission queue, as many
+   as fit under AIO_RING_ENTRIES outstanding, then waits until at
+   least MIN_COMPLETE have completed, or as many as are
+   outstanding or fit in the completion queue if fewer, and moves
+   every completed one that fits into the completion queue.
+   Returns the number moved, or -1 if the ring or a request's
+   buffer is not valid user memory, in which case the caller
+   should kill the process.
+
+   A request for a bad file descriptor or operation, or one
+   longer than AIO_IO_MAX, completes at once with result -1. */
+int
+aio_enter (struct aio_context *ctx, unsigned min_complete)
+{
+  struct aio_ring *ring = ctx->ring;
+  struct list reaped;
+  unsigned space;
+  int cnt = 0;
+
+  if (!check_user ((const char *) ring, sizeof *ring, true)
+      || !pin_user (ring, sizeof *ring, true))
+    return -1;
+
+  /* Submit. */
+  if (ring->sq_tail - ring->sq_head > AIO_RING_ENTRIES)
+    goto bad_ring;
+  while (ring->sq_head != ring->sq_tail
+         && ctx->outstanding < AIO_RING_ENTRIES)
+    {
+      struct aio_sqe sqe = ring->sq[ring->sq_head % AIO_RING_ENTRIES];
+      int ret = submit (ctx, &sqe);
+      if (ret < 0)
+        goto bad_ring;
+      else if (ret == 0)
+        break;
+      ring->sq_head++;
+    }
+
+  /* Wait. */
+  space = AIO_RING_ENTRIES - (ring->cq_tail - ring->cq_head);
+  if (space > AIO_RING_ENTRIES)
+    goto bad_ring;
+  list_init (&reaped);
+  lock_acquire (&ctx->lock);
+  if (min_complete > (unsigned) ctx->outstanding)
+    min_complete = ctx->outstanding;
+  if (min_complete > space)
+    min_complete = space;
+  while (list_size (&ctx->done) < min_complete)
+    cond_wait (&ctx->completed, &ctx->lock);
+  while (!list_empty (&ctx->done) && (unsigned) cnt < space)
+    {
+      list_push_back (&reaped, list_pop_front (&ctx->done));
+      ctx->outstanding--;
+      cnt++;
+    }
+  lock_release (&ctx->lock);
+
+  /* Reap. */
+  while (!list_empty (&reaped))
+    {
+      struct aio_request *r = list_entry (list_pop_front (&reaped),
+                                          struct aio_request, elem);
+      struct aio_cqe *cqe = &ring->cq[ring->cq_tail++ % AIO_RING_ENTRIES];
+
+      cqe->user_data = r->sqe.user_data;
+      cqe->res = r->res;
+      release (r);
+      free (r);
+    }
+  unpin_user (ring, sizeof *ring);
+  return cnt;
+
+ bad_ring:
+  unpin_user (ring, sizeof *ring);
+  return -1;
+}
+
+/* Submits SQE for CTX.  Returns 1 if it was submitted or
+   completed at once, 0 if memory is short and it should be
+   retried later, or -1 if its buffer is bad. */
+static int
+submit (struct aio_context *ctx, const struct aio_sqe *sqe)
+{
+  struct thread *cur = thread_current ();
+  struct aio_request *r;
+  struct file_info *info;
+  bool to_user = sqe->op == AIO_READ;
+
+  r = malloc (sizeof *r);
+  if (r == NULL)
+    return 0;
+  r->ctx = ctx;
+  r->sqe = *sqe;
+  r->file = NULL;
+  r->pinned = false;
+  r->res = -1;
+
+  info = get_file_info (sqe->fd);
+  if (info == NULL || info->opened_dir != NULL || info->pipe != NULL
+      || (sqe->op != AIO_READ && sqe->op != AIO_WRITE
+          && sqe->op != AIO_FSYNC)
+      || (sqe->op != AIO_FSYNC && sqe->len > AIO_IO_MAX))
+    goto done;
+
+  /* Pin the buffer and find its frames, which the worker reads or
+     writes through their kernel addresses. */
+  if (sqe->op != AIO_FSYNC && sqe->len > 0)
+    {
+      uint8_t *upage = pg_round_down (sqe->buf);
+      uint8_t *last = pg_round_down ((uint8_t *) sqe->buf + sqe->len - 1);
+      int i;
+
+      if (!check_user (sqe->buf, sqe->len, to_user)
+          || !pin_user (sqe->buf, sqe->len, to_user))
+        {
+          free (r);
+          return -1;
+        }
+      r->pinned = true;
+      for (i = 0; upage <= last; i++, upage += PGSIZE)
+        {
+          r->kpages[i] = pagedir_get_page (cur->pagedir, upage);
+          ASSERT (r->kpages[i] != NULL);
+        }
+    }
+
+  /* The process may close the fd before the request runs. */
+  r->file = file_reopen (info->opened_file);
+  if (r->file == NULL)
+    goto done;
+
+  lock_acquire (&ctx->lock);
+  ctx->inflight++;
+  ctx->outstanding++;
+  lock_release (&ctx->lock);
+  work_init (&r->work, aio_run);
+  work_queue (&aio_wq, &r->work);
+  return 1;
+
+ done:
+  lock_acquire (&ctx->lock);
+  ctx->inflight++;
+  ctx->outstanding++;
+  lock_release (&ctx->lock);
+  complete (r);
+  return 1;
+}
+
+/* Carries out a request on a worker thread. */
+static void
+aio_run (struct work *w)
+{
+  struct aio_request *r = (struct aio_request *)
+    ((uint8_t *) w - offsetof (struct aio_request, work));
+  const struct aio_sqe *sqe = &r->sqe;
+
+  if (sqe->op == AIO_FSYNC)
+    {
+      file_sync (r->file);
+      r->res = 0;
+    }
+  else
+    {
+      unsigned ofs = pg_ofs (sqe->buf);
+      unsigned done = 0;
+
+      while (done < sqe->len)
+        {
+          uint8_t *kaddr = (uint8_t *) r->kpages[(ofs + done) / PGSIZE]
+                           + (ofs + done) % PGSIZE;
+          unsigned chunk = PGSIZE - (ofs + done) % PGSIZE;
+          off_t n;
+
+          if (chunk > sqe->len - done)
+            chunk = sqe->len - done;
+          if (sqe->op == AIO_READ)
+            n = file_read_at (r->file, kaddr, chunk, sqe->pos + done);
+          else
+            n = file_write_at (r->file, kaddr, chunk, sqe->pos + done);
+          if (n <= 0)
+            break;
+          done += n;
+          if ((unsigned) n < chunk)
+            break;
+        }
+      r->res = done;
+    }
+  file_close (r->file);
+  r->file = NULL;
+  complete (r);
+}
+
+/* Moves R to its context's done list.  R's context may be freed
+   as soon as this returns. */
+static void
+complete (struct aio_request *r)
+{
+  struct aio_context *ctx = r->ctx;
+
+  lock_acquire (&ctx->lock);
+  ctx->inflight--;
+  list_push_back (&ctx->done, &r->elem);
+  cond_broadcast (&ctx->completed, &ctx->lock);
+  lock_release (&ctx->lock);
+}
+
+/* Unpins R's buffer, if it is still pinned.  Must run in the
+   context of the process that submitted R.
+
+   A read fills the buffer through kernel addresses, which leaves
+   the user PTEs clean, so its pages are first marked dirty.
+   Otherwise eviction would drop them without writing them out,
+   losing the data read. */
+static void
+release (struct aio_request *r)
+{
+  if (r->pinned)
+    {
+      if (r->sqe.op == AIO_READ)
+        {
+          uint32_t *pd = thread_current ()->pagedir;
+          uint8_t *upage = pg_round_down (r->sqe.buf);
+          uint8_t *last = pg_round_down ((uint8_t *) r->sqe.buf
+                                         + r->sqe.len - 1);
+
+          for (; upage <= last; upage += PGSIZE)
+            pagedir_set_dirty (pd, upage, true);
+        }
+      unpin_user (r->sqe.buf, r->sqe.len);
+      r->pinned = false;
+    }
+}
+
+/* Waits for every request CTX has in flight to complete and
+   unpins their buffers, leaving the completions to be reaped.
+   Afterward, until the next aio_enter(), no request refers to
+   the process's memory. */
+void
+aio_quiesce (struct aio_context *ctx)
+{
+  struct list_elem *e;
+
+  lock_acquire (&ctx->lock);
+  while (ctx->inflight > 0)
+    cond_wait (&ctx->completed, &ctx->lock);
+  lock_release (&ctx->lock);
+
+  /* Nothing else touches the done list with none in flight. */
+  for (e = list_begin (&ctx->done); e != list_end (&ctx->done);
+       e = list_next (e))
+    release (list_entry (e, struct aio_request, elem));
+}
+
+/* Waits for CTX's requests to complete, then frees it along with
+   any completions not reaped. */
+void
+aio_destroy (struct aio_context *ctx)
+{
+  aio_quiesce (ctx);
+  while (!list_empty (&ctx->done))
+    free (list_entry (list_pop_front (&ctx->done),
+                      struct aio_request, elem));
+  free (ctx);
+}
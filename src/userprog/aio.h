@@ -0,0 +1,28 @@
+#ifndef USERPROG_AIO_H
+#define USERPROG_AIO_H
+
+#include <stdbool.h>
+#include <syscall-nr.h>
+
+/* Asynchronous file I/O for user processes.
+
+   A process registers a struct aio_ring in its own memory with
+   aio_create(), queues requests in the ring's submission queue,
+   and calls aio_enter() to hand them to the kernel and to collect
+   those that have completed.  Each request runs on the shared
+   kernel worker pool (see threads/workqueue.h), so a process can
+   keep several in flight while it computes.
+
+   A request's buffer stays pinned from submission until
+   aio_enter() reaps it.  Calls that unmap memory or copy the
+   address space must first call aio_quiesce(). */
+
+struct aio_context;
+
+void aio_init (void);
+struct aio_context *aio_create (struct aio_ring *);
+int aio_enter (struct aio_context *, unsigned min_complete);
+void aio_quiesce (struct aio_context *);
+void aio_destroy (struct aio_context *);
+
+#endif /* userprog/aio.h */
@@ -2,14 +2,21 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include "userprog/gdt.h"
+#include "userprog/process.h"
+#include "userprog/tss.h"
+#include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "userprog/syscall.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
 
 static void kill (struct intr_frame *);
+static void debug_exception (struct intr_frame *);
 static void page_fault (struct intr_frame *);
 
 /* Registers handlers for interrupts that can be caused by user
@@ -44,7 +51,7 @@ exception_init (void)
      caused indirectly, e.g. #DE can be caused by dividing by
      0.  */
   intr_register_int (0, 0, INTR_ON, kill, "#DE Divide Error");
-  intr_register_int (1, 0, INTR_ON, kill, "#DB Debug Exception");
+  intr_register_int (1, 0, INTR_ON, debug_exception, "#DB Debug Exception");
   intr_register_int (6, 0, INTR_ON, kill, "#UD Invalid Opcode Exception");
   intr_register_int (7, 0, INTR_ON, kill,
                      "#NM Device Not Available Exception");
@@ -59,6 +66,11 @@ exception_init (void)
      We need to disable interrupts for page faults because the
      fault address is stored in CR2 and needs to be preserved. */
   intr_register_int (14, 0, INTR_OFF, page_fault, "#PF Page-Fault Exception");
+
+#ifdef STACK_GUARD
+  /* A double fault gets a stack of its own; see tss.c. */
+  intr_register_task (8, SEL_DFTSS, "#DF Double Fault Exception");
+#endif
 }
 
 /* Prints exception statistics. */
@@ -109,6 +121,23 @@ kill (struct intr_frame *f)
     }
 }
 
+/* Debug exception handler.  A user program that single-steps
+   into SYSENTER takes the trap on the first instruction of
+   sysenter_entry(), still on its trampoline stack, where
+   thread_current() would not work; the kernel does not honor
+   single-stepping, so it clears the trap flag there and carries
+   on.  Any other debug exception is handled like the rest. */
+static void
+debug_exception (struct intr_frame *f)
+{
+  if (f->cs == SEL_KCSEG && f->eip == sysenter_entry)
+    {
+      f->eflags &= ~FLAG_TF;
+      return;
+    }
+  kill (f);
+}
+
 /* Page fault handler.  This is a skeleton that must be filled in
    to implement virtual memory.  Some solutions to project 2 may
    also require modifying this code.
@@ -137,16 +166,19 @@ page_fault (struct intr_frame *f)
      (#PF)". */
   asm ("movl %%cr2, %0" : "=r" (fault_addr));
 
+  /* Turn interrupts back on (they were only off so that we could
+     be assured of reading CR2 before it changed). */
+  intr_enable ();
+
 #ifndef VM
+  /* A page of the executable not read in yet, with -demand-load. */
+  if((f->error_code & PF_P) == 0 && process_demand_load(fault_addr))
+    return;
   if(!check_translate_user(fault_addr, false)) {
     exit_status(f, -1);
   }
 #endif
 
-  /* Turn interrupts back on (they were only off so that we could
-     be assured of reading CR2 before it changed). */
-  intr_enable ();
-
   /* Count page faults. */
   page_fault_cnt++;
 
@@ -156,7 +188,9 @@ page_fault (struct intr_frame *f)
   user = (f->error_code & PF_U) != 0;
 
 #ifdef VM
-  if(not_present && page_fault_handler(fault_addr, write, user ? f->esp : thread_current()->esp))
+  /* A write to a present page may be the first to a page still
+     mapped to the zero frame. */
+  if((not_present || write) && page_fault_handler(fault_addr, write, user ? f->esp : thread_current()->esp))
       return;
   else
       exit_status(f, -1);
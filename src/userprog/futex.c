@@ -0,0 +1,150 @@
+#include "userprog/futex.h"
+#include <hash.h>
+#include <list.h>
+#include <stdint.h>
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "userprog/process.h"
+#include "userprog/syscall.h"
+
+/* Number of wait queues.  A power of 2. */
+#define FUTEX_BUCKETS 64
+
+/* What a futex is known by: a user address in one address space.
+   Two processes never share a key, even where they map the same
+   file page. */
+struct futex_key
+  {
+    uint32_t *pagedir;          /* Address space. */
+    const int *uaddr;           /* User address waited on. */
+  };
+
+/* A thread blocked in futex_wait(). */
+struct futex_waiter
+  {
+    struct futex_key key;       /* Futex waited on. */
+    struct semaphore woken;     /* Upped by futex_wake(). */
+    struct list_elem elem;      /* Element in its bucket's waiters. */
+  };
+
+/* Wait queue for the futexes whose keys hash to it. */
+struct futex_bucket
+  {
+    struct lock lock;           /* Guards waiters. */
+    struct list waiters;        /* struct futex_waiter, oldest first. */
+  };
+
+static struct futex_bucket buckets[FUTEX_BUCKETS];
+
+/* Initializes the futex wait queues. */
+void
+futex_init (void)
+{
+  size_t i;
+
+  for (i = 0; i < FUTEX_BUCKETS; i++)
+    {
+      lock_init (&buckets[i].lock);
+      list_init (&buckets[i].waiters);
+    }
+}
+
+/* Fills in KEY for UADDR in the current process and returns its
+   bucket. */
+static struct futex_bucket *
+lookup (struct futex_key *key, const int *uaddr)
+{
+  key->pagedir = process_current ()->pagedir;
+  key->uaddr = uaddr;
+  return &buckets[hash_bytes (key, sizeof *key) & (FUTEX_BUCKETS - 1)];
+}
+
+/* Blocks the current thread until futex_wake() is called for
+   UADDR, if the int there is still VAL.  The test and the wait
+   are atomic with respect to futex_wake(), so a wake issued
+   after the int is changed is never missed.  Returns 1 after
+   being woken, 0 if the int was not VAL or the process is
+   exiting, or -1 if UADDR is not readable user memory. */
+int
+futex_wait (const int *uaddr, int val)
+{
+  struct futex_waiter w;
+  struct futex_bucket *b = lookup (&w.key, uaddr);
+  int cur;
+
+  if (!check_user ((const char *) uaddr, sizeof *uaddr, false))
+    return -1;
+  lock_acquire (&b->lock);
+  if (!pin_user (uaddr, sizeof *uaddr, false))
+    {
+      lock_release (&b->lock);
+      return -1;
+    }
+  cur = *uaddr;
+  unpin_user (uaddr, sizeof *uaddr);
+  if (cur != val || process_current ()->exiting)
+    {
+      lock_release (&b->lock);
+      return 0;
+    }
+  sema_init (&w.woken, 0);
+  list_push_back (&b->waiters, &w.elem);
+  lock_release (&b->lock);
+
+  sema_down (&w.woken);
+  return 1;
+}
+
+/* Wakes up to CNT of the current process's threads waiting on
+   UADDR, oldest first, and returns the number woken. */
+int
+futex_wake (const int *uaddr, int cnt)
+{
+  struct futex_key key;
+  struct futex_bucket *b = lookup (&key, uaddr);
+  struct list_elem *e;
+  int woken = 0;
+
+  lock_acquire (&b->lock);
+  for (e = list_begin (&b->waiters);
+       e != list_end (&b->waiters) && woken < cnt; )
+    {
+      struct futex_waiter *w = list_entry (e, struct futex_waiter, elem);
+      e = list_next (e);
+      if (w->key.pagedir == key.pagedir && w->key.uaddr == key.uaddr)
+        {
+          list_remove (&w->elem);
+          sema_up (&w->woken);
+          woken++;
+        }
+    }
+  lock_release (&b->lock);
+  return woken;
+}
+
+/* Wakes every thread of LEADER's process waiting on any futex,
+   as the process exits. */
+void
+futex_wake_all (struct thread *leader)
+{
+  size_t i;
+
+  for (i = 0; i < FUTEX_BUCKETS; i++)
+    {
+      struct futex_bucket *b = &buckets[i];
+      struct list_elem *e;
+
+      lock_acquire (&b->lock);
+      for (e = list_begin (&b->waiters); e != list_end (&b->waiters); )
+        {
+          struct futex_waiter *w = list_entry (e, struct futex_waiter, elem);
+          e = list_next (e);
+          if (w->key.pagedir == leader->pagedir)
+            {
+              list_remove (&w->elem);
+              sema_up (&w->woken);
+            }
+        }
+      lock_release (&b->lock);
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef USERPROG_FUTEX_H
+#define USERPROG_FUTEX_H
+
+#include <stdbool.h>
+
+struct thread;
+
+/* Futexes: waiting on and waking an int in user memory, from
+   which the threads of one user process build their locks and
+   condition variables.  User code changes the int with atomic
+   instructions and enters the kernel only to sleep or to wake a
+   sleeper, so an uncontended lock costs no system call.
+
+   Waiters are kept in a fixed set of wait queues, hashed by
+   page directory and user address, so a futex is private to its
+   process. */
+
+void futex_init (void);
+int futex_wait (const int *uaddr, int val);
+int futex_wake (const int *uaddr, int cnt);
+void futex_wake_all (struct thread *leader);
+
+#endif /* userprog/futex.h */
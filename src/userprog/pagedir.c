@@ -3,11 +3,33 @@
 #include <stddef.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 
+/* Page directories and page tables freed by pagedir_destroy(),
+   kept for reuse so that exec and exit cycles skip the page
+   allocator, the zeroing of page tables and the copying of
+   init_page_dir.  A cached page table is all zeros, and a cached
+   page directory is a copy of init_page_dir, except for the first
+   word of each, which links the cache; nothing changes the kernel
+   PDEs after paging_init(), so the copy stays current.
+   Guarded by disabling interrupts. */
+struct page_cache
+  {
+    void *first;                /* First cached page, or null. */
+    size_t cnt;                 /* Number of cached pages. */
+    size_t max;                 /* Most pages to keep. */
+  };
+static struct page_cache pd_cache = { NULL, 0, 4 };
+static struct page_cache pt_cache = { NULL, 0, 16 };
+
+static void *cache_pop (struct page_cache *);
+static void cache_push (struct page_cache *, void *page);
 static uint32_t *active_pd (void);
+static void load_pd (uint32_t *);
 static void invalidate_pagedir (uint32_t *);
+static void invalidate_page (uint32_t *, const void *);
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
@@ -16,14 +38,22 @@ static void invalidate_pagedir (uint32_t *);
 uint32_t *
 pagedir_create (void) 
 {
-  uint32_t *pd = palloc_get_page (0);
+  uint32_t *pd = cache_pop (&pd_cache);
   if (pd != NULL)
-    memcpy (pd, init_page_dir, PGSIZE);
+    pd[0] = init_page_dir[0];
+  else
+    {
+      pd = palloc_get_page (0);
+      if (pd != NULL)
+        memcpy (pd, init_page_dir, PGSIZE);
+    }
   return pd;
 }
 
 /* Destroys page directory PD, freeing all the pages it
-   references. */
+   references.  Each entry is cleared as it is visited, so that
+   PD and its page tables can be cached for reuse without being
+   zeroed again. */
 void
 pagedir_destroy (uint32_t *pd) 
 {
@@ -34,17 +64,58 @@ pagedir_destroy (uint32_t *pd)
 
   ASSERT (pd != init_page_dir);
   for (pde = pd; pde < pd + pd_no (PHYS_BASE); pde++)
-    if (*pde & PTE_P) 
+    if (*pde != 0) 
       {
         uint32_t *pt = pde_get_pt (*pde);
         uint32_t *pte;
         
         for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
-          if (*pte & PTE_P) 
-            palloc_free_page (pte_get_page (*pte));
-        palloc_free_page (pt);
+          if (*pte != 0)
+            {
+              if (*pte & PTE_P) 
+                palloc_free_page (pte_get_page (*pte));
+              *pte = 0;
+            }
+        cache_push (&pt_cache, pt);
+        *pde = 0;
       }
-  palloc_free_page (pd);
+  cache_push (&pd_cache, pd);
+}
+
+/* Returns a page from CACHE with its link word cleared, or a null
+   pointer if CACHE is empty. */
+static void *
+cache_pop (struct page_cache *cache)
+{
+  enum intr_level old_level = intr_disable ();
+  void **page = cache->first;
+
+  if (page != NULL)
+    {
+      cache->first = *page;
+      cache->cnt--;
+      *page = NULL;
+    }
+  intr_set_level (old_level);
+  return page;
+}
+
+/* Adds PAGE to CACHE, or frees it if CACHE is full. */
+static void
+cache_push (struct page_cache *cache, void *page)
+{
+  enum intr_level old_level = intr_disable ();
+  bool cached = cache->cnt < cache->max;
+
+  if (cached)
+    {
+      *(void **) page = cache->first;
+      cache->first = page;
+      cache->cnt++;
+    }
+  intr_set_level (old_level);
+  if (!cached)
+    palloc_free_page (page);
 }
 
 /* Returns the address of the page table entry for virtual
@@ -70,7 +141,9 @@ lookup_page (uint32_t *pd, const void *vaddr, bool create)
     {
       if (create)
         {
-          pt = palloc_get_page (PAL_ZERO);
+          pt = cache_pop (&pt_cache);
+          if (pt == NULL)
+            pt = palloc_get_page (PAL_ZERO);
           if (pt == NULL) 
             return NULL; 
       
@@ -152,7 +225,7 @@ pagedir_clear_page (uint32_t *pd, void *upage)
   if (pte != NULL && (*pte & PTE_P) != 0)
     {
       *pte &= ~PTE_P;
-      invalidate_pagedir (pd);
+      invalidate_page (pd, upage);
     }
 }
 
@@ -177,10 +250,10 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
     {
       if (dirty)
         *pte |= PTE_D;
-      else 
+      else if (*pte & PTE_D)
         {
           *pte &= ~(uint32_t) PTE_D;
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
@@ -206,22 +279,87 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
     {
       if (accessed)
         *pte |= PTE_A;
-      else 
+      else if (*pte & PTE_A)
         {
           *pte &= ~(uint32_t) PTE_A; 
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
 
+/* Initializes BATCH to hold no deferred invalidations. */
+void
+pagedir_batch_init (struct pagedir_batch *batch)
+{
+  batch->pd = NULL;
+  batch->cnt = 0;
+}
+
+/* Returns true if the PTE for virtual page VPAGE in PD has been
+   accessed recently, like pagedir_is_accessed(), and clears its
+   accessed bit.  The TLB entry for VPAGE is not invalidated until
+   pagedir_batch_flush(BATCH), so that a clock sweep flushes once
+   at its end.  Until then the CPU may use the stale entry without
+   setting the bit again, which at worst makes the page look idle
+   to a second pass of the same sweep. */
+bool
+pagedir_test_and_clear_accessed (uint32_t *pd, const void *vpage,
+                                 struct pagedir_batch *batch)
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+
+  if (pte == NULL || (*pte & PTE_A) == 0)
+    return false;
+  *pte &= ~(uint32_t) PTE_A;
+
+  /* Only the active page directory's entries can be in the TLB.
+     A sweep runs in one thread, so that is the same one for every
+     page in the batch. */
+  if (active_pd () == pd)
+    {
+      batch->pd = pd;
+      if (batch->cnt < PAGEDIR_BATCH_MAX)
+        batch->pages[batch->cnt] = vpage;
+      batch->cnt++;
+    }
+  return true;
+}
+
+/* Carries out the invalidations deferred in BATCH, one page at a
+   time, or by flushing the whole TLB if there were more than
+   PAGEDIR_BATCH_MAX.  Leaves BATCH empty. */
+void
+pagedir_batch_flush (struct pagedir_batch *batch)
+{
+  size_t i;
+
+  if (batch->cnt > PAGEDIR_BATCH_MAX)
+    invalidate_pagedir (batch->pd);
+  else
+    for (i = 0; i < batch->cnt; i++)
+      invalidate_page (batch->pd, batch->pages[i]);
+  pagedir_batch_init (batch);
+}
+
 /* Loads page directory PD into the CPU's page directory base
-   register. */
+   register, unless it is already loaded: switching between
+   threads that share a page directory, such as kernel threads,
+   then keeps the TLB.  Kernel mappings are global and stay in
+   the TLB either way. */
 void
 pagedir_activate (uint32_t *pd) 
 {
   if (pd == NULL)
     pd = init_page_dir;
+  if (active_pd () != pd)
+    load_pd (pd);
+}
 
+/* Loads page directory PD into CR3, flushing the TLB of every
+   mapping but global ones. */
+static void
+load_pd (uint32_t *pd)
+{
   /* Store the physical address of the page directory into CR3
      aka PDBR (page directory base register).  This activates our
      new page tables immediately.  See [IA32-v2a] "MOV--Move
@@ -248,16 +386,26 @@ active_pd (void)
    table.  When this happens, we have to "invalidate" the TLB by
    re-activating it.
 
-   This function invalidates the TLB if PD is the active page
-   directory.  (If PD is not active then its entries are not in
+   This function invalidates the whole TLB, but for global kernel
+   mappings, if PD is the active page directory.  (If PD is not active then its entries are not in
    the TLB, so there is no need to invalidate anything.) */
 static void
 invalidate_pagedir (uint32_t *pd) 
 {
   if (active_pd () == pd) 
     {
-      /* Re-activating PD clears the TLB.  See [IA32-v3a] 3.12
+      /* Reloading PD clears the TLB.  See [IA32-v3a] 3.12
          "Translation Lookaside Buffers (TLBs)". */
-      pagedir_activate (pd);
+      load_pd (pd);
     } 
 }
+
+/* Invalidates the TLB entry for user virtual page VPAGE if PD
+   is the active page directory, leaving the rest of the TLB
+   alone.  See [IA32-v2a] "INVLPG--Invalidate TLB Entry". */
+static void
+invalidate_page (uint32_t *pd, const void *vpage)
+{
+  if (active_pd () == pd)
+    asm volatile ("invlpg (%0)" : : "r" (vpage) : "memory");
+}
@@ -2,8 +2,22 @@
 #define USERPROG_PAGEDIR_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+/* Most TLB invalidations a struct pagedir_batch defers one by
+   one; past that, flushing the whole TLB is cheaper. */
+#define PAGEDIR_BATCH_MAX 16
+
+/* TLB invalidations deferred over a run of page table changes,
+   such as a sweep of the clock. */
+struct pagedir_batch
+  {
+    uint32_t *pd;               /* Page directory the pages are in. */
+    size_t cnt;                 /* Number of pages to invalidate. */
+    const void *pages[PAGEDIR_BATCH_MAX]; /* The first of them. */
+  };
+
 uint32_t *pagedir_create (void);
 void pagedir_destroy (uint32_t *pd);
 bool pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool rw);
@@ -13,6 +27,10 @@ bool pagedir_is_dirty (uint32_t *pd, const void *upage);
 void pagedir_set_dirty (uint32_t *pd, const void *upage, bool dirty);
 bool pagedir_is_accessed (uint32_t *pd, const void *upage);
 void pagedir_set_accessed (uint32_t *pd, const void *upage, bool accessed);
+void pagedir_batch_init (struct pagedir_batch *);
+bool pagedir_test_and_clear_accessed (uint32_t *pd, const void *upage,
+                                      struct pagedir_batch *);
+void pagedir_batch_flush (struct pagedir_batch *);
 void pagedir_activate (uint32_t *pd);
 
 #endif /* userprog/pagedir.h */
@@ -0,0 +1,164 @@
+#include "userprog/pipe.h"
+#include <debug.h>
+#include <stdint.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Bytes a pipe buffers. */
+#define PIPE_SIZE PGSIZE
+
+/* A pipe. */
+struct pipe
+  {
+    struct lock lock;           /* Guards the members below. */
+    struct condition readable;  /* Signaled as data arrives or the
+                                   last writer goes. */
+    struct condition writable;  /* Signaled as room frees up or the
+                                   last reader goes. */
+    uint8_t *buffer;            /* PIPE_SIZE bytes, a ring. */
+    unsigned head, tail;        /* Read and write indexes, which
+                                   count up and wrap. */
+    int readers, writers;       /* Open descriptors on each end. */
+  };
+
+/* Returns a new, empty pipe with one descriptor open on each end,
+   or a null pointer if memory is short. */
+struct pipe *
+pipe_create (void)
+{
+  struct pipe *p = malloc (sizeof *p);
+
+  if (p == NULL)
+    return NULL;
+  p->buffer = palloc_get_page (0);
+  if (p->buffer == NULL)
+    {
+      free (p);
+      return NULL;
+    }
+  lock_init (&p->lock);
+  cond_init (&p->readable);
+  cond_init (&p->writable);
+  p->head = p->tail = 0;
+  p->readers = p->writers = 1;
+  return p;
+}
+
+/* Counts another descriptor open on P's write end if WRITER, or
+   else on its read end. */
+void
+pipe_open (struct pipe *p, bool writer)
+{
+  lock_acquire (&p->lock);
+  ASSERT (writer ? p->writers > 0 : p->readers > 0);
+  if (writer)
+    p->writers++;
+  else
+    p->readers++;
+  lock_release (&p->lock);
+}
+
+/* Closes a descriptor on P's write end if WRITER, or else on its
+   read end, waking the other end's waiters if it was the last,
+   and frees P once both ends are closed. */
+void
+pipe_close (struct pipe *p, bool writer)
+{
+  bool dead;
+
+  lock_acquire (&p->lock);
+  if (writer && --p->writers == 0)
+    cond_broadcast (&p->readable, &p->lock);
+  else if (!writer && --p->readers == 0)
+    cond_broadcast (&p->writable, &p->lock);
+  dead = p->readers == 0 && p->writers == 0;
+  lock_release (&p->lock);
+
+  if (dead)
+    {
+      palloc_free_page (p->buffer);
+      free (p);
+    }
+}
+
+/* Copies SIZE bytes at SRC into P's ring at its tail, which has
+   room for them.  P's lock must be held. */
+static void
+put (struct pipe *p, const uint8_t *src, unsigned size)
+{
+  unsigned ofs = p->tail % PIPE_SIZE;
+  unsigned chunk = size < PIPE_SIZE - ofs ? size : PIPE_SIZE - ofs;
+
+  memcpy (p->buffer + ofs, src, chunk);
+  memcpy (p->buffer, src + chunk, size - chunk);
+  p->tail += size;
+}
+
+/* Copies SIZE bytes from P's ring at its head to DST.  P's lock
+   must be held. */
+static void
+get (struct pipe *p, uint8_t *dst, unsigned size)
+{
+  unsigned ofs = p->head % PIPE_SIZE;
+  unsigned chunk = size < PIPE_SIZE - ofs ? size : PIPE_SIZE - ofs;
+
+  memcpy (dst, p->buffer + ofs, chunk);
+  memcpy (dst + chunk, p->buffer, size - chunk);
+  p->head += size;
+}
+
+/* Reads up to SIZE bytes from P into BUFFER, which the caller has
+   pinned, waiting until there is at least one byte or no writer
+   is left.  Returns the number of bytes read, 0 meaning the end
+   of the data. */
+int
+pipe_read (struct pipe *p, void *buffer, unsigned size)
+{
+  unsigned cnt;
+
+  if (size == 0)
+    return 0;
+  lock_acquire (&p->lock);
+  while (p->tail == p->head && p->writers > 0)
+    cond_wait (&p->readable, &p->lock);
+  cnt = p->tail - p->head;
+  if (cnt > size)
+    cnt = size;
+  get (p, buffer, cnt);
+  if (cnt > 0)
+    cond_broadcast (&p->writable, &p->lock);
+  lock_release (&p->lock);
+  return cnt;
+}
+
+/* Writes the SIZE bytes at BUFFER, which the caller has pinned,
+   to P, waiting for room as needed.  Returns SIZE, or fewer if
+   the last reader closed the pipe midway, or -1 if it had before
+   any byte was written. */
+int
+pipe_write (struct pipe *p, const void *buffer, unsigned size)
+{
+  const uint8_t *src = buffer;
+  unsigned done = 0;
+
+  lock_acquire (&p->lock);
+  while (done < size && p->readers > 0)
+    {
+      unsigned room = PIPE_SIZE - (p->tail - p->head);
+      unsigned cnt = size - done < room ? size - done : room;
+
+      if (cnt == 0)
+        {
+          cond_wait (&p->writable, &p->lock);
+          continue;
+        }
+      put (p, src + done, cnt);
+      done += cnt;
+      cond_broadcast (&p->readable, &p->lock);
+    }
+  lock_release (&p->lock);
+  return done > 0 || size == 0 ? (int) done : -1;
+}
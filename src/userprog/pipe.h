@@ -0,0 +1,26 @@
+#ifndef USERPROG_PIPE_H
+#define USERPROG_PIPE_H
+
+#include <stdbool.h>
+
+/* Pipes: a one-way channel between file descriptors, buffered in
+   a page of kernel memory.  Reads block while the pipe is empty
+   and writes while it is full, so data moves between processes
+   without touching the file system.  A write copies in as much
+   as fits and waits for room for the rest, so a reader may get
+   the start of a large write before its end is written.
+
+   Each pipe counts the descriptors open on its read and its write
+   end; fork() adds to them.  Once every write end is closed,
+   reads return 0 at the end of the data, and once every read end
+   is closed, writes fail. */
+
+struct pipe;
+
+struct pipe *pipe_create (void);
+void pipe_open (struct pipe *, bool writer);
+void pipe_close (struct pipe *, bool writer);
+int pipe_read (struct pipe *, void *buffer, unsigned size);
+int pipe_write (struct pipe *, const void *buffer, unsigned size);
+
+#endif /* userprog/pipe.h */
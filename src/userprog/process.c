@@ -5,25 +5,92 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "userprog/aio.h"
+#include "userprog/futex.h"
 #include "userprog/gdt.h"
 #include "userprog/pagedir.h"
 #include "userprog/tss.h"
+#include "userprog/uinfo.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "gdt.h"
 #include "pagedir.h"
+#ifdef VM
+#include "userprog/syscall.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/shm.h"
+#endif
 
 static thread_func start_process NO_RETURN;
+static thread_func uthread_start NO_RETURN;
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
+static void exec_image_put (struct exec_image *);
 bool delete_mmap_handle(struct mmap_handler *mh);
 
+/* A command line split into words, packed one after another,
+   each null-terminated, so that start_process() can copy them onto
+   the new process's stack in one go.  Lives in one page. */
+struct exec_args
+  {
+    int argc;                   /* Number of words. */
+    size_t size;                /* Bytes used in `words'. */
+    char words[];               /* The words, in order. */
+  };
+
+/* Returns a new, empty argument block, or a null pointer if out
+   of memory.  It is released by process_spawn(), or else with
+   exec_args_destroy(). */
+struct exec_args *
+exec_args_create (void)
+{
+  struct exec_args *args = palloc_get_page (0);
+  if (args != NULL)
+    {
+      args->argc = 0;
+      args->size = 0;
+    }
+  return args;
+}
+
+/* Releases ARGS. */
+void
+exec_args_destroy (struct exec_args *args)
+{
+  palloc_free_page (args);
+}
+
+/* Appends the LEN bytes of WORD to ARGS as one more word.
+   Returns false, leaving ARGS unchanged, if the words and the
+   argv array pointing to them would no longer fit in the stack
+   page start_process() sets up. */
+bool
+exec_args_push (struct exec_args *args, const char *word, size_t len)
+{
+  /* Words, alignment, argv[] with its null sentinel, then argv,
+     argc and the return address. */
+  size_t stack = (args->size + len + 1 + sizeof (void *)
+                  + (args->argc + 2) * sizeof (char *)
+                  + 3 * sizeof (void *));
+  if (stack > PGSIZE)
+    return false;
+  memcpy (args->words + args->size, word, len);
+  args->words[args->size + len] = '\0';
+  args->size += len + 1;
+  args->argc++;
+  return true;
+}
+
 /* Starts a new thread running a user program loaded from
    FILENAME.  The new thread may be scheduled (and may even exit)
    before process_execute() returns.  Returns the new process's
@@ -31,38 +98,63 @@ bool delete_mmap_handle(struct mmap_handler *mh);
 tid_t
 process_execute (const char *file_name) 
 {
-  char *fn_copy;
-  tid_t tid;
-  char *name;
-  name = palloc_get_page(0);
-  strlcpy(name, file_name, PGSIZE);
-
-  /* Make a copy of FILE_NAME.
-     Otherwise there's a race between the caller and load(). */
-  fn_copy = palloc_get_page (0);
-  if (fn_copy == NULL)
+  struct exec_args *args = exec_args_create ();
+  const char *p = file_name;
+
+  if (args == NULL)
     return TID_ERROR;
-  strlcpy (fn_copy, file_name, PGSIZE);
 
-  /* Parse the real name of the executeable*/
-  char *real_name, *save_ptr;
-  real_name = strtok_r(name, " ", &save_ptr);
+  /* Split at spaces while copying, so the command line is read
+     just once. */
+  for (;;)
+    {
+      size_t len;
+
+      while (*p == ' ')
+        p++;
+      if (*p == '\0')
+        break;
+      len = strcspn (p, " ");
+      if (!exec_args_push (args, p, len))
+        {
+          exec_args_destroy (args);
+          return TID_ERROR;
+        }
+      p += len;
+    }
+  return process_spawn (args);
+}
+
+/* Starts a new thread running the user program named by the first
+   word of ARGS, with ARGS as its arguments.  Takes ownership of
+   ARGS.  Otherwise like process_execute(). */
+tid_t
+process_spawn (struct exec_args *args)
+{
+  tid_t tid;
+
+  if (args->argc == 0)
+    {
+      exec_args_destroy (args);
+      return TID_ERROR;
+    }
 
-  /* Create a new thread to execute FILE_NAME. */
-  tid = thread_create (real_name, PRI_DEFAULT, start_process, fn_copy);
+  /* Create a new thread to execute the program, named after it. */
+  tid = thread_create_child (args->words, PRI_DEFAULT, start_process, args);
   if (tid == TID_ERROR)
-    palloc_free_page (fn_copy);
-  palloc_free_page(name);
-  list_push_back(&thread_current() ->child_list, &get_child_info(tid) ->elem);
+    {
+      exec_args_destroy (args);
+      return TID_ERROR;
+    }
   return tid;
 }
 
 /* A thread function that loads a user process and starts it
    running. */
 static void
-start_process (void *file_name_)
+start_process (void *args_)
 {
-  char *file_name = file_name_;
+  struct exec_args *args = args_;
   struct intr_frame if_;
   bool success;
 
@@ -72,11 +164,7 @@ start_process (void *file_name_)
   if_.cs = SEL_UCSEG;
   if_.eflags = FLAG_IF | FLAG_MBS;
 
-  /* Parse the input name to get the real executable name */
-  char *save_ptr, *token;
-  token = strtok_r(file_name, " ", &save_ptr);
-
-  success = load (token, &if_.eip, &if_.esp);
+  success = load (args->words, &if_.eip, &if_.esp);
 /*
   if (pcb->parent_thread != NULL && pcb->parent_thread->cwd != NULL) {
     // child process inherits the CWD
@@ -89,7 +177,7 @@ start_process (void *file_name_)
   /* If load failed, quit. */
   //palloc_free_page (file_name);
   if (!success) {
-    palloc_free_page(file_name);
+    exec_args_destroy(args);
     thread_current() -> message_to_parent -> load_failed = true;
     thread_current() -> message_to_parent -> ret_value = -1;
     thread_current() -> return_value = -1;
@@ -104,34 +192,418 @@ start_process (void *file_name_)
      arguments on the stack in the form of a `struct intr_frame',
      we just point the stack pointer (%esp) to our stack frame
      and jump to it. */
-  char *esp = (char *)if_.esp;
-  char *args[256];
-  int i, n = 0;
-  for(; token != NULL; token = strtok_r(NULL, " ", &save_ptr)) {
-//    printf("%s\n", token);
-    esp -= strlen(token) + 1;
-    strlcpy(esp, token, strlen(token) + 1);
-    args[n++] = esp;
-  }
-//  esp -= (int)esp % 4;
-  while((int)esp % 4)
-    esp--;
-  int *p = esp - 4;
-  *p-- = 0;
-  for(int i = n - 1; i >= 0; --i) {
-    *p-- = args[i];
+  char *words = (char *) if_.esp - args->size;
+  char **argv = ((char **) ROUND_DOWN ((uintptr_t) words, sizeof (char *))
+                 - (args->argc + 1));
+  void **p = (void **) argv;
+  memcpy(words, args->words, args->size);
+  for(int i = 0; i < args->argc; i++) {
+    argv[i] = words;
+    words += strlen(words) + 1;
   }
-  *p-- = p + 1;
-  *p-- = n;
-  *p-- = 0;
-  esp = p + 1;
-  if_.esp = esp;
-  palloc_free_page(file_name);
+  argv[args->argc] = NULL;
+  *--p = argv;
+  *--p = (void *) args->argc;
+  *--p = NULL;
+  if_.esp = p;
+  exec_args_destroy(args);
+
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+#ifdef VM
+/* What fork_process() needs from the parent it copies. */
+struct fork_info
+  {
+    struct thread *parent;
+    const struct intr_frame *if_;   /* Parent's user context. */
+    bool success;                   /* Whether the copy succeeded. */
+    struct semaphore done;          /* Upped once the copy is made. */
+  };
+
+static thread_func fork_process NO_RETURN;
+
+/* Starts a child process that is a copy of the current one,
+   resuming from the system call that interrupted it at F with 0
+   as its result.  Memory is shared copy-on-write, so the copy
+   costs page table entries rather than whole pages.  Returns the
+   child's thread id, or TID_ERROR if it cannot be created. */
+tid_t
+process_fork (const struct intr_frame *f)
+{
+  struct fork_info info;
+  tid_t tid;
+
+  info.parent = process_current ();
+  info.if_ = f;
+  info.success = false;
+  sema_init (&info.done, 0);
+  tid = thread_create_child (thread_name (), PRI_DEFAULT, fork_process, &info);
+  if (tid == TID_ERROR)
+    return TID_ERROR;
+
+  /* The parent's pages must stay as they are until copied. */
+  sema_down (&info.done);
+  if (!info.success)
+    {
+      process_wait (tid);
+      return TID_ERROR;
+    }
+  return tid;
+}
+
+/* Gives the current thread a copy of each of PARENT's mmap
+   handlers, under the same mapid.  Those of segments are backed
+   by the current thread's own executable, as in load(), and
+   those of shared memory objects map the same object. */
+static bool
+fork_mmaps (struct thread *parent)
+{
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&parent->mmap_file_list);
+       e != list_end (&parent->mmap_file_list); e = list_next (e))
+    {
+      struct mmap_handler *pmh = list_entry (e, struct mmap_handler, elem);
+      struct mmap_handler *mh = slab_alloc (&mmap_handler_cache);
+      if (mh == NULL)
+        return false;
+      *mh = *pmh;
+      if (pmh->shm != NULL)
+        shm_dup (pmh->shm);
+      else
+        {
+          mh->mmap_file = (pmh->is_segment ? cur->exec_file
+                           : file_reopen (pmh->mmap_file));
+          if (mh->mmap_file == NULL)
+            {
+              slab_free (&mmap_handler_cache, mh);
+              return false;
+            }
+        }
+      list_push_back (&cur->mmap_file_list, &mh->elem);
+    }
+  cur->next_mapid = parent->next_mapid;
+  return true;
+}
+
+/* A thread function that makes the current thread a copy of the
+   parent process in INFO_ and returns to user mode where the
+   parent left it. */
+static void
+fork_process (void *info_)
+{
+  struct fork_info *info = info_;
+  struct thread *parent = info->parent;
+  struct thread *cur = thread_current ();
+  struct intr_frame if_;
+  bool success = false;
+
+  if_ = *info->if_;
+  if_.eax = 0;
+
+  cur->page_table = page_create ();
+  if (cur->page_table == NULL)
+    goto done;
+  cur->pagedir = pagedir_create ();
+  if (cur->pagedir == NULL || !uinfo_map (cur->pagedir))
+    goto done;
+  process_activate ();
+
+  cur->exec_file = file_reopen (parent->exec_file);
+  if (cur->exec_file == NULL)
+    goto done;
+  file_deny_write (cur->exec_file);
+  cur->esp = info->if_->esp;
+  cur->heap_start = parent->heap_start;
+  cur->heap_brk = parent->heap_brk;
+  success = (fork_mmaps (parent) && fork_file_infos (parent)
+             && page_fork (parent, cur));
 
+ done:
+  info->success = success;
+  sema_up (&info->done);
+  if (!success)
+    {
+      cur->message_to_parent->ret_value = -1;
+      cur->return_value = -1;
+      thread_exit ();
+    }
+
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+#endif
+
+/* Returns the thread that holds the current process's state:
+   the current thread, unless it was started by
+   process_uthread_create(), in which case the process's first
+   thread. */
+struct thread *
+process_current (void)
+{
+  return thread_current ()->leader;
+}
+
+/* What uthread_start() needs from its creator. */
+struct uthread_info
+  {
+    struct thread *leader;          /* Process to join. */
+    void (*eip) (void);             /* Where to start in user mode. */
+    void *esp;                      /* Initial user stack pointer. */
+    bool success;                   /* Whether it joined the process. */
+    struct semaphore started;       /* Upped once it has. */
+  };
+
+/* Starts a new thread in the current process, running in user
+   mode at EIP with the stack pointer at ESP, for which the caller
+   has set up a stack.  The thread shares the process's address
+   space, open files and other state, and has a working directory
+   of its own, first the creator's.  Returns its thread id, or
+   TID_ERROR if it cannot be created or the process is exiting. */
+tid_t
+process_uthread_create (void (*eip) (void), void *esp)
+{
+  struct uthread_info info;
+  tid_t tid;
+
+  if (!is_user_vaddr (eip) || !is_user_vaddr (esp))
+    return TID_ERROR;
+  info.leader = process_current ();
+  info.eip = eip;
+  info.esp = esp;
+  info.success = false;
+  sema_init (&info.started, 0);
+  tid = thread_create_child (info.leader->name, thread_get_priority (),
+                             uthread_start, &info);
+  if (tid == TID_ERROR)
+    return TID_ERROR;
+
+  sema_down (&info.started);
+  if (!info.success)
+    {
+      process_wait (tid);
+      return TID_ERROR;
+    }
+  return tid;
+}
+
+/* A thread function that joins the process in INFO_ and enters
+   user mode where it says. */
+static void
+uthread_start (void *info_)
+{
+  struct uthread_info *info = info_;
+  struct thread *leader = info->leader;
+  struct thread *cur = thread_current ();
+  struct child_info *self = cur->message_to_parent;
+  struct intr_frame if_;
+  enum intr_level old_level;
+  bool success;
+
+  memset (&if_, 0, sizeof if_);
+  if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
+  if_.cs = SEL_UCSEG;
+  if_.eflags = FLAG_IF | FLAG_MBS;
+  if_.eip = info->eip;
+  if_.esp = info->esp;
+
+  /* Move from the creator's children to the leader's threads,
+     unless the process has begun to exit.  The creator is
+     waiting, so its child_list holds still. */
+  old_level = intr_disable ();
+  success = !leader->exiting;
+  if (success)
+    {
+      list_remove (&self->elem);
+      self->uthread = true;
+      self->parent = leader;
+      list_push_back (&leader->uthreads, &self->elem);
+      leader->uthread_cnt++;
+      cur->leader = leader;
+      cur->pagedir = leader->pagedir;
+#ifdef VM
+      cur->page_table = leader->page_table;
+      cur->esp = info->esp;
+#endif
+    }
+  intr_set_level (old_level);
+  info->success = success;
+  sema_up (&info->started);
+  if (!success)
+    thread_exit ();
+
+  process_activate ();
   asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
   NOT_REACHED ();
 }
 
+/* Waits for thread TID of the current process, started by
+   process_uthread_create(), to exit.  Returns 0 once it has, or
+   -1 at once if TID is no such thread, is the current thread or
+   is already being joined. */
+int
+process_uthread_join (tid_t tid)
+{
+  struct thread *leader = process_current ();
+  struct child_info *l = get_child_info (tid);
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (l == NULL || !l->uthread || l->parent != leader || l->joined
+      || l->child_thread == thread_current ())
+    {
+      intr_set_level (old_level);
+      return -1;
+    }
+  l->joined = true;
+  intr_set_level (old_level);
+
+  if (!l->terminated)
+    sema_down (l->sema_finish);
+  old_level = intr_disable ();
+  list_remove (&l->elem);
+  intr_set_level (old_level);
+  free_child_info (l);
+  return 0;
+}
+
+/* Prepares the current thread to exit by itself, leaving the rest
+   of its process running.  Returns false for a thread started by
+   process_uthread_create(), which should then call thread_exit().
+   For the process's first thread, whose exit ends the process,
+   waits for the others to exit and returns true. */
+bool
+process_uthread_exit (void)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  bool others;
+
+  if (cur->leader != cur)
+    {
+      cur->uthread_exiting = true;
+      return false;
+    }
+  old_level = intr_disable ();
+  others = cur->uthread_cnt > 0;
+  intr_set_level (old_level);
+  if (others)
+    sema_down (&cur->uthreads_done);
+  return true;
+}
+
+/* Restricts every thread of the current process to the CPUs in
+   MASK, as thread_set_affinity() does for one.  Threads it starts
+   later inherit the mask.  Returns false, changing nothing, if
+   MASK names no CPU that is up. */
+bool
+process_set_affinity (unsigned mask)
+{
+  struct thread *leader = process_current ();
+  enum intr_level old_level;
+  struct list_elem *e;
+
+  old_level = intr_disable ();
+  if (!thread_set_affinity (leader, mask))
+    {
+      intr_set_level (old_level);
+      return false;
+    }
+  for (e = list_begin (&leader->uthreads); e != list_end (&leader->uthreads);
+       e = list_next (e))
+    {
+      struct child_info *l = list_entry (e, struct child_info, elem);
+      if (!l->terminated)
+        thread_set_affinity (l->child_thread, mask);
+    }
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Makes LEADER's process exit with STATUS, unless it is exiting
+   already: its threads exit on their next way back to user mode,
+   and those in futex_wait() are woken for it. */
+static void
+process_stop (struct thread *leader, int status)
+{
+  enum intr_level old_level = intr_disable ();
+  bool first = !leader->exiting;
+
+  leader->exiting = true;
+  if (first)
+    leader->return_value = status;
+  intr_set_level (old_level);
+  if (first)
+    futex_wake_all (leader);
+}
+
+/* Called on each return to user mode, from interrupt handlers
+   with interrupts in any state.  Makes the current thread exit if
+   its process is exiting. */
+void
+process_check_exit (void)
+{
+  if (thread_current ()->leader->exiting)
+    {
+      intr_enable ();
+      thread_exit ();
+    }
+}
+
+/* Tells the live ones among the current thread's child processes
+   that their parent is gone, and forgets all of them. */
+static void
+orphan_children (struct thread *cur)
+{
+  /* A child that has terminated may be gone, and its page reused
+     by another thread, so only tell the live ones.  Interrupts
+     are off so none terminates in between. */
+  struct child_info *l;
+  while (!list_empty(&cur->child_list)) {
+    l = list_entry(list_pop_front(&cur->child_list), struct child_info, elem);
+    enum intr_level old_level = intr_disable();
+    if (!l->terminated)
+      l->child_thread->parent_die = true;
+    intr_set_level(old_level);
+    free_child_info(l);
+  }
+}
+
+/* Leaves the process of the current thread, one started by
+   process_uthread_create(), without touching the state it shares
+   with the process, which its leader frees once every such thread
+   has left. */
+static void
+uthread_leave (struct thread *cur)
+{
+  struct thread *leader = cur->leader;
+  enum intr_level old_level;
+
+  /* Leaving any way but SYS_UTHREAD_EXIT ends the process. */
+  if (!cur->uthread_exiting)
+    process_stop (leader, cur->return_value);
+
+  if (cur->cwd)
+    dir_close (cur->cwd);
+  orphan_children (cur);
+
+  /* As in process_exit(). */
+  cur->pagedir = NULL;
+#ifdef VM
+  cur->page_table = NULL;
+#endif
+  pagedir_activate (NULL);
+
+  old_level = intr_disable ();
+  cur->message_to_parent->terminated = true;
+  if (--leader->uthread_cnt == 0)
+    sema_up (&leader->uthreads_done);
+  intr_set_level (old_level);
+}
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -146,23 +618,16 @@ process_wait (tid_t child_tid)
 {
   if (child_tid == -1)
     return -1;
-  struct list_elem *e;
-  struct thread *cur = thread_current();
-  struct child_info *l;
-  for(e = list_begin(&cur->child_list); e != list_end(&cur->child_list); e = list_next(e)) {
-    l = list_entry(e, struct child_info, elem);
-    if (l -> child_id == child_tid) {
-      if (!l->terminated) {
-        sema_down(l->sema_finish);
-      }
-      int return_value = l->exited ? l->ret_value : -1;
-      list_remove(e);
-      list_remove(&l->allelem);
-      palloc_free_page(l);
-      return return_value;
-    }
+  struct child_info *l = get_child_info(child_tid);
+  if (l == NULL || l->parent != thread_current())
+    return -1;
+  if (!l->terminated) {
+    sema_down(l->sema_finish);
   }
-  return -1;
+  int return_value = l->exited ? l->ret_value : -1;
+  list_remove(&l->elem);
+  free_child_info(l);
+  return return_value;
 }
 
 /* Free the current process's resources. */
@@ -172,32 +637,72 @@ process_exit (void)
   struct thread *cur = thread_current ();
   uint32_t *pd;
 
+  if (cur->leader != cur)
+    {
+      uthread_leave (cur);
+      return;
+    }
+
+  /* The other threads use everything freed below, so stop them
+     and wait until they have left.  None can join once
+     exiting is set. */
+  if (!list_empty (&cur->uthreads))
+    {
+      enum intr_level old_level;
+      bool others;
+
+      process_stop (cur, cur->return_value);
+      old_level = intr_disable ();
+      others = cur->uthread_cnt > 0;
+      intr_set_level (old_level);
+      if (others)
+        sema_down (&cur->uthreads_done);
+      while (!list_empty (&cur->uthreads))
+        free_child_info (list_entry (list_pop_front (&cur->uthreads),
+                                     struct child_info, elem));
+    }
+
+  /* Requests in flight still refer to the address space. */
+  if (cur->aio != NULL)
+    {
+      aio_destroy (cur->aio);
+      cur->aio = NULL;
+    }
+
 #ifdef VM
+  /* Tear the address space down in one pass, writing back dirty
+     mmap pages, before the handlers they refer to go. */
+  page_exit_report();
+  if (cur->page_table != NULL)
+    {
+      page_teardown (cur->page_table);
+      cur->page_table = NULL;
+    }
   struct list* mmap_list = &cur->mmap_file_list;
   struct mmap_handler* mh;
   while (!list_empty(mmap_list)) {
       mh = list_entry(list_pop_front (mmap_list), struct mmap_handler, elem);
-      for (int i = 0; i < mh->num_page_with_segment; i++) {
-	  page_unmap(cur->page_table, mh->mmap_addr + i * PGSIZE);
-      }
-      delete_mmap_handle(mh);
+      /* Segments share exec_file, which thread_exit() closes. */
+      if (!mh->is_segment)
+        close_file(mh->mmap_file);
+      if (mh->shm != NULL)
+        shm_put(mh->shm);
+      slab_free(&mmap_handler_cache, mh);
   }
 #endif
 
   if(cur->cwd) dir_close (cur->cwd);
 
-  struct child_info *l;
-  while (!list_empty(&cur->child_list)) {
-    l = list_entry(list_pop_front(&cur->child_list), struct child_info, elem);
-    list_remove(&l->allelem);
-    l->child_thread->parent_die = true;
-    palloc_free_page(l);
-  }
+#ifndef VM
+  if (cur->exec_image != NULL)
+    {
+      exec_image_put (cur->exec_image);
+      cur->exec_image = NULL;
+    }
+#endif
 
+  orphan_children (cur);
 
-#ifdef VM
-  page_destroy(cur->page_table);
-#endif
 
   /* Destroy the current process's page directory and switch back
      to the kernel-only page directory. */
@@ -213,14 +718,18 @@ process_exit (void)
          that's been freed (and cleared). */
       cur->pagedir = NULL;
       pagedir_activate (NULL);
+      uinfo_unmap (pd);
       pagedir_destroy (pd);
 
       printf ("%s: exit(%d)\n",cur->name, cur->return_value);
     }
-  if (!cur->parent_die) {
+  enum intr_level old_level = intr_disable();
+  /* Kernel threads have no child_info. */
+  if (!cur->parent_die && cur->message_to_parent != NULL) {
     //printf("not die");
     cur->message_to_parent->terminated = true;
   }
+  intr_set_level(old_level);
 }
 
 /* Sets up the CPU for running user code in the current
@@ -234,6 +743,10 @@ process_activate (void)
   /* Activate thread's page tables. */
   pagedir_activate (t->pagedir);
 
+  /* Let its user code read whose ids it holds. */
+  if (t->pagedir != NULL)
+    uinfo_switch (t);
+
   /* Set thread's kernel stack for use in processing
      interrupts. */
   tss_update ();
@@ -302,11 +815,61 @@ struct Elf32_Phdr
 #define PF_W 2          /* Writable. */
 #define PF_R 4          /* Readable. */
 
+/* A PT_LOAD segment, as load_segment() takes it. */
+struct exec_segment
+  {
+    uint32_t file_page;         /* Page-aligned offset in the file. */
+    uint32_t mem_page;          /* Page-aligned user virtual address. */
+    uint32_t read_bytes;        /* Bytes read from the file. */
+    uint32_t zero_bytes;        /* Bytes zeroed after them. */
+    bool writable;              /* Writable by the user process? */
+  };
+
+/* An executable's headers, parsed and checked.
+
+   Exec tends to run the same few programs over and over, so the
+   last EXEC_CACHE_CNT images are kept, keyed by inode number and
+   write generation.  Any write to the file changes its
+   generation, so a stale image is never found again and simply
+   ages out.  Images never change once built and are freed when
+   evicted and no longer in use. */
+struct exec_image
+  {
+    struct list_elem elem;      /* Element in exec_cache, if cached. */
+    block_sector_t inumber;     /* Inode number of the file. */
+    unsigned generation;        /* Its write generation when parsed. */
+    int ref_cnt;                /* Loaders using it, plus 1 if cached. */
+    uint32_t entry;             /* Entry point. */
+    size_t seg_cnt;             /* Number of segments. */
+    struct exec_segment segs[]; /* The PT_LOAD segments. */
+  };
+
+/* Maximum number of cached images. */
+#define EXEC_CACHE_CNT 8
+
+static struct list exec_cache;  /* Cached images, most recently used first. */
+static struct lock exec_cache_lock;
+
+#ifndef VM
+/* -demand-load: leave segments unread until first touched.  The
+   image stays referenced by the process until it exits. */
+static bool demand_load;
+#endif
+
 static bool setup_stack (void **esp);
 static bool validate_segment (const struct Elf32_Phdr *, struct file *);
 static bool load_segment (struct file *file, off_t ofs, uint8_t *upage,
                           uint32_t read_bytes, uint32_t zero_bytes,
                           bool writable);
+static struct exec_image *exec_image_get (struct file *, const char *file_name);
+
+/* Initializes the executable image cache. */
+void
+process_init (void)
+{
+  list_init (&exec_cache);
+  lock_init (&exec_cache_lock);
+}
 
 /* Loads an ELF executable from FILE_NAME into the current thread.
    Stores the executable's entry point into *EIP
@@ -316,11 +879,10 @@ bool
 load (const char *file_name, void (**eip) (void), void **esp) 
 {
   struct thread *t = thread_current ();
-  struct Elf32_Ehdr ehdr;
+  struct exec_image *image = NULL;
   struct file *file = NULL;
-  off_t file_ofs;
   bool success = false;
-  int i;
+  size_t i;
 
 #ifdef VM
   t->page_table = page_create();
@@ -329,7 +891,7 @@ load (const char *file_name, void (**eip) (void), void **esp)
 
   /* Allocate and activate page directory. */
   t->pagedir = pagedir_create ();
-  if (t->pagedir == NULL) 
+  if (t->pagedir == NULL || !uinfo_map (t->pagedir))
     goto done;
   process_activate ();
 
@@ -341,6 +903,92 @@ load (const char *file_name, void (**eip) (void), void **esp)
       goto done; 
     }
 
+  /* Get the headers, parsing them only if not cached. */
+  image = exec_image_get (file, file_name);
+  if (image == NULL)
+    goto done;
+
+  /* The heap starts empty, at the first page past the segments. */
+  for (i = 0; i < image->seg_cnt; i++)
+    {
+      const struct exec_segment *seg = &image->segs[i];
+      uint8_t *end = ((uint8_t *) seg->mem_page
+                      + seg->read_bytes + seg->zero_bytes);
+      if (end > t->heap_start)
+        t->heap_start = end;
+    }
+  t->heap_brk = t->heap_start;
+
+  /* Map the segments, or with -demand-load leave them to be read
+     in by process_demand_load() as they are touched. */
+#ifndef VM
+  if (demand_load)
+    {
+      t->exec_image = image;
+      image = NULL;
+    }
+  else
+#endif
+  for (i = 0; i < image->seg_cnt; i++)
+    {
+      const struct exec_segment *seg = &image->segs[i];
+      if (!load_segment (file, seg->file_page, (void *) seg->mem_page,
+                         seg->read_bytes, seg->zero_bytes, seg->writable))
+        goto done;
+    }
+
+  /* Set up stack. */
+  if (!setup_stack (esp))
+    goto done;
+
+  /* Start address. */
+  *eip = (void (*) (void)) image->entry;
+
+  success = true;
+  t->exec_file = file;
+  file_deny_write(file);
+
+ done:
+  /* We arrive here whether the load is successful or not. */
+  if (image != NULL)
+    exec_image_put (image);
+  if(!success)
+    file_close (file);
+  return success;
+}
+
+/* Returns the headers of FILE, named FILE_NAME, from the cache,
+   or else reads, checks and caches them.  Returns a null pointer
+   if FILE is not a valid executable or memory runs out.  The
+   caller must release the image with exec_image_put(). */
+static struct exec_image *
+exec_image_get (struct file *file, const char *file_name)
+{
+  struct inode *inode = file_get_inode (file);
+  block_sector_t inumber = inode_get_inumber (inode);
+  unsigned generation = inode_get_generation (inode);
+  struct exec_image *image;
+  struct Elf32_Ehdr ehdr;
+  off_t file_ofs;
+  struct list_elem *e;
+  int i;
+
+  lock_acquire (&exec_cache_lock);
+  for (e = list_begin (&exec_cache); e != list_end (&exec_cache);
+       e = list_next (e))
+    {
+      image = list_entry (e, struct exec_image, elem);
+      if (image->inumber == inumber && image->generation == generation)
+        {
+          list_remove (&image->elem);
+          list_push_front (&exec_cache, &image->elem);
+          image->ref_cnt++;
+          lock_release (&exec_cache_lock);
+          return image;
+        }
+    }
+  lock_release (&exec_cache_lock);
+
   /* Read and verify executable header. */
   if (file_read (file, &ehdr, sizeof ehdr) != sizeof ehdr
       || memcmp (ehdr.e_ident, "\177ELF\1\1\1", 7)
@@ -351,9 +999,19 @@ load (const char *file_name, void (**eip) (void), void **esp)
       || ehdr.e_phnum > 1024) 
     {
       printf ("load: %s: error loading executable\n", file_name);
-      goto done; 
+      return NULL;
     }
 
+  /* Room for every program header to be PT_LOAD. */
+  image = malloc (sizeof *image + ehdr.e_phnum * sizeof *image->segs);
+  if (image == NULL)
+    return NULL;
+  image->inumber = inumber;
+  image->generation = generation;
+  image->ref_cnt = 1;
+  image->entry = ehdr.e_entry;
+  image->seg_cnt = 0;
+
   /* Read program headers. */
   file_ofs = ehdr.e_phoff;
   for (i = 0; i < ehdr.e_phnum; i++) 
@@ -361,11 +1019,11 @@ load (const char *file_name, void (**eip) (void), void **esp)
       struct Elf32_Phdr phdr;
 
       if (file_ofs < 0 || file_ofs > file_length (file))
-        goto done;
+        goto fail;
       file_seek (file, file_ofs);
 
       if (file_read (file, &phdr, sizeof phdr) != sizeof phdr)
-        goto done;
+        goto fail;
       file_ofs += sizeof phdr;
       switch (phdr.p_type) 
         {
@@ -379,56 +1037,69 @@ load (const char *file_name, void (**eip) (void), void **esp)
         case PT_DYNAMIC:
         case PT_INTERP:
         case PT_SHLIB:
-          goto done;
+          goto fail;
         case PT_LOAD:
           if (validate_segment (&phdr, file)) 
             {
-              bool writable = (phdr.p_flags & PF_W) != 0;
-              uint32_t file_page = phdr.p_offset & ~PGMASK;
-              uint32_t mem_page = phdr.p_vaddr & ~PGMASK;
+              struct exec_segment *seg = &image->segs[image->seg_cnt++];
               uint32_t page_offset = phdr.p_vaddr & PGMASK;
-              uint32_t read_bytes, zero_bytes;
+              seg->writable = (phdr.p_flags & PF_W) != 0;
+              seg->file_page = phdr.p_offset & ~PGMASK;
+              seg->mem_page = phdr.p_vaddr & ~PGMASK;
               if (phdr.p_filesz > 0)
                 {
                   /* Normal segment.
                      Read initial part from disk and zero the rest. */
-                  read_bytes = page_offset + phdr.p_filesz;
-                  zero_bytes = (ROUND_UP (page_offset + phdr.p_memsz, PGSIZE)
-                                - read_bytes);
+                  seg->read_bytes = page_offset + phdr.p_filesz;
+                  seg->zero_bytes = (ROUND_UP (page_offset + phdr.p_memsz, PGSIZE)
+                                     - seg->read_bytes);
                 }
               else 
                 {
                   /* Entirely zero.
                      Don't read anything from disk. */
-                  read_bytes = 0;
-                  zero_bytes = ROUND_UP (page_offset + phdr.p_memsz, PGSIZE);
+                  seg->read_bytes = 0;
+                  seg->zero_bytes = ROUND_UP (page_offset + phdr.p_memsz, PGSIZE);
                 }
-              if (!load_segment (file, file_page, (void *) mem_page,
-                                 read_bytes, zero_bytes, writable))
-                goto done;
             }
           else
-            goto done;
+            goto fail;
           break;
         }
     }
 
-  /* Set up stack. */
-  if (!setup_stack (esp))
-    goto done;
+  /* Cache it, evicting the least recently used image if full.
+     Another loader may have cached the same one meanwhile, which
+     is harmless: the older copy is never first to be found. */
+  lock_acquire (&exec_cache_lock);
+  if (list_size (&exec_cache) >= EXEC_CACHE_CNT)
+    {
+      struct exec_image *victim = list_entry (list_pop_back (&exec_cache),
+                                              struct exec_image, elem);
+      if (--victim->ref_cnt == 0)
+        free (victim);
+    }
+  list_push_front (&exec_cache, &image->elem);
+  image->ref_cnt++;
+  lock_release (&exec_cache_lock);
+  return image;
 
-  /* Start address. */
-  *eip = (void (*) (void)) ehdr.e_entry;
+ fail:
+  free (image);
+  return NULL;
+}
 
-  success = true;
-  t->exec_file = file;
-  file_deny_write(file);
+/* Releases IMAGE, obtained from exec_image_get(). */
+static void
+exec_image_put (struct exec_image *image)
+{
+  bool dead;
 
- done:
-  /* We arrive here whether the load is successful or not. */
-  if(!success)
-    file_close (file);
-  return success;
+  lock_acquire (&exec_cache_lock);
+  dead = --image->ref_cnt == 0;
+  lock_release (&exec_cache_lock);
+  if (dead)
+    free (image);
 }
 
 /* load() helpers. */
@@ -476,6 +1147,11 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
   if (phdr->p_vaddr < PGSIZE)
     return false;
 
+  /* The user info page is already mapped. */
+  if (phdr->p_vaddr < USER_INFO_PAGE + PGSIZE
+      && phdr->p_vaddr + phdr->p_memsz > USER_INFO_PAGE)
+    return false;
+
   /* It's okay. */
   return true;
 }
@@ -605,9 +1281,142 @@ install_page (void *upage, void *kpage, bool writable)
 
 }
 
+#ifndef VM
+/* Unmaps the current process's pages from FIRST up to END and
+   frees their frames. */
+static void
+unmap_pages (uint8_t *first, uint8_t *end)
+{
+  uint32_t *pd = thread_current ()->pagedir;
+
+  for (; first < end; first += PGSIZE)
+    {
+      void *kpage = pagedir_get_page (pd, first);
+      if (kpage != NULL)
+        {
+          pagedir_clear_page (pd, first);
+          palloc_free_page (kpage);
+        }
+    }
+}
+#endif
+
+/* Moves the end of the current process's heap, its break, by
+   INCREMENT bytes, as sbrk() does, and returns the old break, or
+   a null pointer if the heap cannot shrink or grow that far.
+   Pages wholly past the new break are freed; new pages read as
+   zeros.  With VM they are only given frames as they are touched,
+   like stack pages, so a program pays for the heap it uses rather
+   than the heap it reserves. */
+void *
+process_sbrk (intptr_t increment)
+{
+  struct thread *t = process_current ();
+  uint8_t *old_brk = t->heap_brk;
+  uint8_t *new_brk = old_brk + increment;
+  uint8_t *old_end = pg_round_up (old_brk);
+  uint8_t *new_end;
+
+  if (t->heap_start == NULL
+      || (increment > 0 ? new_brk < old_brk : new_brk > old_brk)
+      || new_brk < t->heap_start
+      || new_brk > (uint8_t *) PHYS_BASE - PGSIZE)
+    return NULL;
+  new_end = pg_round_up (new_brk);
+
+  if (new_end > old_end)
+    {
+#ifdef VM
+      if (!mmap_check_mmap_vaddr (t, old_end, (new_end - old_end) / PGSIZE))
+        return NULL;
+#else
+      uint8_t *upage;
+      for (upage = old_end; upage < new_end; upage += PGSIZE)
+        {
+          uint8_t *kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+          if (kpage == NULL || !install_page (upage, kpage, true))
+            {
+              if (kpage != NULL)
+                palloc_free_page (kpage);
+              unmap_pages (old_end, upage);
+              return NULL;
+            }
+        }
+#endif
+    }
+  else if (new_end < old_end)
+    {
+#ifdef VM
+      page_unmap_heap (new_end, old_end);
+#else
+      unmap_pages (new_end, old_end);
+#endif
+    }
+
+  t->heap_brk = new_brk;
+  return old_brk;
+}
+
+#ifndef VM
+/* Sets whether executables are read in page by page as they are
+   touched, instead of all at once by load(). */
+void
+process_set_demand_load (bool on)
+{
+  demand_load = on;
+}
+
+/* Reads in and maps the page of the current process's executable
+   that VADDR falls in, if it is one not yet read.  Returns true
+   if so, false if VADDR is in no segment or memory runs out. */
+bool
+process_demand_load (const void *vaddr)
+{
+  struct thread *t = process_current ();
+  struct exec_image *image = t->exec_image;
+  uint8_t *upage = pg_round_down (vaddr);
+  size_t i;
+
+  if (image == NULL || !is_user_vaddr (vaddr)
+      || pagedir_get_page (t->pagedir, upage) != NULL)
+    return false;
+  for (i = 0; i < image->seg_cnt; i++)
+    {
+      const struct exec_segment *seg = &image->segs[i];
+      uint8_t *start = (uint8_t *) seg->mem_page;
+      uint32_t ofs, page_read_bytes;
+      uint8_t *kpage;
+
+      if (upage < start || upage >= start + seg->read_bytes + seg->zero_bytes)
+        continue;
+      ofs = upage - start;
+      page_read_bytes = (ofs >= seg->read_bytes ? 0
+                         : seg->read_bytes - ofs < PGSIZE
+                         ? seg->read_bytes - ofs : PGSIZE);
+      kpage = palloc_get_page (PAL_USER);
+      if (kpage == NULL)
+        return false;
+      if (file_read_at (t->exec_file, kpage, page_read_bytes,
+                        seg->file_page + ofs) != (off_t) page_read_bytes)
+        {
+          palloc_free_page (kpage);
+          return false;
+        }
+      memset (kpage + page_read_bytes, 0, PGSIZE - page_read_bytes);
+      if (!install_page (upage, kpage, seg->writable))
+        {
+          palloc_free_page (kpage);
+          return false;
+        }
+      return true;
+    }
+  return false;
+}
+#endif
+
 struct mmap_handler* syscall_get_mmap_handle(mapid_t mapid) {
 #ifdef VM
-  struct thread* cur = thread_current();
+  struct thread* cur = process_current();
   struct list_elem *i;
   struct mmap_handler *mh;
   if (!list_empty(&cur->mmap_file_list)) {
@@ -622,7 +1431,7 @@ struct mmap_handler* syscall_get_mmap_handle(mapid_t mapid) {
 
 bool delete_mmap_handle(struct mmap_handler *mh) {
 #ifdef VM
-  struct thread* cur = thread_current();
+  struct thread* cur = process_current();
   struct list_elem *i;
   struct mmap_handler *tmp_mh;
   if (!list_empty(&cur->mmap_file_list)) {
@@ -630,9 +1439,14 @@ bool delete_mmap_handle(struct mmap_handler *mh) {
       tmp_mh = list_entry(i, struct mmap_handler, elem);
       if (tmp_mh == mh)
       {
+        /* Page faults of other threads walk the list. */
+        page_table_lock();
         list_remove(i);
+        page_table_unlock();
         close_file(mh->mmap_file);
-        free(mh);
+        if (mh->shm != NULL)
+          shm_put(mh->shm);
+        slab_free(&mmap_handler_cache, mh);
         return true;
       }
     }
@@ -3,7 +3,27 @@
 
 #include "threads/thread.h"
 
+struct intr_frame;
+struct exec_args;
+
+void process_init (void);
+struct exec_args *exec_args_create (void);
+void exec_args_destroy (struct exec_args *);
+bool exec_args_push (struct exec_args *, const char *word, size_t len);
 tid_t process_execute (const char *file_name);
+tid_t process_spawn (struct exec_args *);
+#ifndef VM
+void process_set_demand_load (bool);
+bool process_demand_load (const void *vaddr);
+#endif
+tid_t process_fork (const struct intr_frame *);
+struct thread *process_current (void);
+tid_t process_uthread_create (void (*eip) (void), void *esp);
+int process_uthread_join (tid_t);
+bool process_uthread_exit (void);
+void process_check_exit (void);
+bool process_set_affinity (unsigned mask);
+void *process_sbrk (intptr_t increment);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (void);
@@ -1,20 +1,34 @@
 #include "userprog/syscall.h"
+#include <hist.h>
+#include <round.h>
 #include <stdio.h>
+#include <string.h>
 #include <syscall-nr.h>
 #include <threads/vaddr.h>
 #include "threads/interrupt.h"
+#include "threads/ktrace.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/thread.h"
 #include "devices/shutdown.h"
+#include "devices/timer.h"
 #include "devices/input.h"
 #include "process.h"
+#include "userprog/aio.h"
+#include "userprog/futex.h"
+#include "userprog/pipe.h"
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "pagedir.h"
 #ifdef VM
+#include "vm/frame.h"
 #include "vm/page.h"
+#include "vm/shm.h"
+#include "vm/swap.h"
 #endif
 #ifdef FILESYS
+#include "filesys/directory.h"
 #include "filesys/inode.h"
 #endif
 
@@ -23,6 +37,7 @@ static void syscall_handler (struct intr_frame *);
 static void sys_halt(struct intr_frame *f);
 static void sys_exit(struct intr_frame *f, int status);
 static void sys_exec(struct intr_frame *f, const char *cmd_line);
+static void sys_spawn(struct intr_frame *f, const char **argv);
 static void sys_wait(struct intr_frame *f, pid_t pid);
 static void sys_create(struct intr_frame *f, const char *name, unsigned initial_size);
 static void sys_remove(struct intr_frame *f, const char *file);
@@ -33,21 +48,147 @@ static void sys_write(struct intr_frame *f, int fd, const void *buffer, unsigned
 static void sys_seek(struct intr_frame *f, int fd, unsigned position);
 static void sys_tell(struct intr_frame *f, int fd);
 static void sys_close(struct intr_frame *f, int fd);
+static void sys_pread(struct intr_frame *f, int fd, void *buffer, unsigned size, unsigned position);
+static void sys_pwrite(struct intr_frame *f, int fd, const void *buffer, unsigned size, unsigned position);
+static void sys_readv(struct intr_frame *f, int fd, const struct iovec *iov, int iovcnt);
+static void sys_writev(struct intr_frame *f, int fd, const struct iovec *iov, int iovcnt);
+static void sys_copy_file_range(struct intr_frame *f, int fd_in, int fd_out, unsigned size);
+static void sys_stats(struct intr_frame *f, unsigned nr, struct syscall_stats *buffer);
+static void sys_sbrk(struct intr_frame *f, intptr_t increment);
+static void sys_fsync(struct intr_frame *f, int fd);
+static void sys_sync(struct intr_frame *f);
+static void sys_fallocate(struct intr_frame *f, int fd, unsigned offset, unsigned length);
+static void sys_fadvise(struct intr_frame *f, int fd, unsigned offset, unsigned length, int advice);
+static void sys_clock(struct intr_frame *f, struct clock_time *buffer);
+static void sys_sysinfo(struct intr_frame *f, struct sysinfo *buffer);
+static void sys_aio_setup(struct intr_frame *f, struct aio_ring *ring);
+static void sys_aio_enter(struct intr_frame *f, unsigned min_complete);
+static void sys_uthread_create(struct intr_frame *f, void (*eip)(void), void *esp);
+static void sys_uthread_exit(struct intr_frame *f);
+static void sys_uthread_join(struct intr_frame *f, tid_t tid);
+static void sys_futex_wait(struct intr_frame *f, const int *uaddr, int val);
+static void sys_futex_wake(struct intr_frame *f, const int *uaddr, int cnt);
+static void sys_pipe(struct intr_frame *f, int *fds);
+static void sys_sched_setaffinity(struct intr_frame *f, unsigned mask);
+static void sys_sched_getaffinity(struct intr_frame *f);
+static void sys_sched_reserve(struct intr_frame *f, int runtime, int period);
+#ifdef VM
+static void sys_fork(struct intr_frame *f);
+static void sys_vmstats(struct intr_frame *f, struct vm_stats *buffer);
+static void sys_stack_prefault(struct intr_frame *f, int pages);
+static void sys_memlimit(struct intr_frame *f, int pages);
+#endif
 
-static void syscall_mmap(struct intr_frame *f, int fd, const void *obj_vaddr);
+static void syscall_mmap(struct intr_frame *f, int fd, const void *obj_vaddr, int flags);
 static void syscall_munmap(struct intr_frame *f, mapid_t mapid);
+#ifdef VM
+static void sys_shm_open(struct intr_frame *f, const char *name, unsigned size, void *addr);
+static void sys_shm_unlink(struct intr_frame *f, const char *name);
+static void sys_msync(struct intr_frame *f, mapid_t mapid);
+static void sys_madvise(struct intr_frame *f, void *addr, unsigned length, int advice);
+#endif
 
 static void sys_chdir(struct intr_frame *f, const char *name);
 static void sys_mkdir(struct intr_frame *f, const char *name);
 static void sys_readdir(struct intr_frame *f, int fd, char *name);
+static void sys_getdents(struct intr_frame *f, int fd, struct dirent *entries, unsigned cnt);
 static void sys_isdir(struct intr_frame *f, int fd);
 static void sys_inumber(struct intr_frame *f, int fd);
 
-static struct lock filesys_lock;
+/* A system call handler.  Handlers take their arguments as
+   pointer-sized values following the frame; each is cast to this
+   type in syscall_table.  Under the i386 cdecl convention the
+   caller pops the arguments, so passing a handler more arguments
+   than it declares is harmless. */
+typedef void syscall_func (struct intr_frame *, uint32_t, uint32_t, uint32_t, uint32_t);
+
+/* Most arguments any system call takes. */
+#define SYSCALL_ARGS_MAX 4
+
+/* How to dispatch one system call. */
+struct syscall_desc {
+  syscall_func *func;           /* Handler, or null if not built in. */
+  int argc;                     /* Number of 32-bit arguments. */
+  const char *name;             /* Name for statistics. */
+};
+
+/* The cast goes through a generic function pointer type, which
+   GCC accepts without complaint about mismatched parameters. */
+#define SYSCALL(NR, FUNC, ARGC, NAME) \
+  [NR] = { (syscall_func *) (void (*) (void)) (FUNC), (ARGC), (NAME) }
+
+/* Handlers, indexed by system call number. */
+static const struct syscall_desc syscall_table[] = {
+  SYSCALL(SYS_HALT, sys_halt, 0, "halt"),
+  SYSCALL(SYS_EXIT, sys_exit, 1, "exit"),
+  SYSCALL(SYS_EXEC, sys_exec, 1, "exec"),
+  SYSCALL(SYS_WAIT, sys_wait, 1, "wait"),
+  SYSCALL(SYS_CREATE, sys_create, 2, "create"),
+  SYSCALL(SYS_REMOVE, sys_remove, 1, "remove"),
+  SYSCALL(SYS_OPEN, sys_open, 1, "open"),
+  SYSCALL(SYS_FILESIZE, sys_filesize, 1, "filesize"),
+  SYSCALL(SYS_READ, sys_read, 3, "read"),
+  SYSCALL(SYS_WRITE, sys_write, 3, "write"),
+  SYSCALL(SYS_SEEK, sys_seek, 2, "seek"),
+  SYSCALL(SYS_TELL, sys_tell, 1, "tell"),
+  SYSCALL(SYS_CLOSE, sys_close, 1, "close"),
+#ifdef VM
+  SYSCALL(SYS_MMAP, syscall_mmap, 3, "mmap"),
+  SYSCALL(SYS_MUNMAP, syscall_munmap, 1, "munmap"),
+  SYSCALL(SYS_SHM_OPEN, sys_shm_open, 3, "shm_open"),
+  SYSCALL(SYS_SHM_UNLINK, sys_shm_unlink, 1, "shm_unlink"),
+  SYSCALL(SYS_MSYNC, sys_msync, 1, "msync"),
+  SYSCALL(SYS_MADVISE, sys_madvise, 3, "madvise"),
+#endif
+#ifdef FILESYS
+  SYSCALL(SYS_CHDIR, sys_chdir, 1, "chdir"),
+  SYSCALL(SYS_MKDIR, sys_mkdir, 1, "mkdir"),
+  SYSCALL(SYS_READDIR, sys_readdir, 2, "readdir"),
+  SYSCALL(SYS_ISDIR, sys_isdir, 1, "isdir"),
+  SYSCALL(SYS_INUMBER, sys_inumber, 1, "inumber"),
+  SYSCALL(SYS_GETDENTS, sys_getdents, 3, "getdents"),
+#endif
+  SYSCALL(SYS_PREAD, sys_pread, 4, "pread"),
+  SYSCALL(SYS_PWRITE, sys_pwrite, 4, "pwrite"),
+  SYSCALL(SYS_READV, sys_readv, 3, "readv"),
+  SYSCALL(SYS_WRITEV, sys_writev, 3, "writev"),
+  SYSCALL(SYS_COPY_FILE_RANGE, sys_copy_file_range, 3, "copy_file_range"),
+  SYSCALL(SYS_STATS, sys_stats, 2, "stats"),
+  SYSCALL(SYS_SPAWN, sys_spawn, 1, "spawn"),
+  SYSCALL(SYS_SBRK, sys_sbrk, 1, "sbrk"),
+  SYSCALL(SYS_FSYNC, sys_fsync, 1, "fsync"),
+  SYSCALL(SYS_SYNC, sys_sync, 0, "sync"),
+  SYSCALL(SYS_FALLOCATE, sys_fallocate, 3, "fallocate"),
+  SYSCALL(SYS_CLOCK, sys_clock, 1, "clock"),
+  SYSCALL(SYS_SYSINFO, sys_sysinfo, 1, "sysinfo"),
+  SYSCALL(SYS_AIO_SETUP, sys_aio_setup, 1, "aio_setup"),
+  SYSCALL(SYS_AIO_ENTER, sys_aio_enter, 1, "aio_enter"),
+  SYSCALL(SYS_UTHREAD_CREATE, sys_uthread_create, 2, "uthread_create"),
+  SYSCALL(SYS_UTHREAD_EXIT, sys_uthread_exit, 0, "uthread_exit"),
+  SYSCALL(SYS_UTHREAD_JOIN, sys_uthread_join, 1, "uthread_join"),
+  SYSCALL(SYS_FUTEX_WAIT, sys_futex_wait, 2, "futex_wait"),
+  SYSCALL(SYS_FUTEX_WAKE, sys_futex_wake, 2, "futex_wake"),
+  SYSCALL(SYS_PIPE, sys_pipe, 1, "pipe"),
+  SYSCALL(SYS_SCHED_SETAFFINITY, sys_sched_setaffinity, 1, "sched_setaffinity"),
+  SYSCALL(SYS_SCHED_GETAFFINITY, sys_sched_getaffinity, 0, "sched_getaffinity"),
+  SYSCALL(SYS_SCHED_RESERVE, sys_sched_reserve, 2, "sched_reserve"),
+  SYSCALL(SYS_FADVISE, sys_fadvise, 4, "fadvise"),
+#ifdef VM
+  SYSCALL(SYS_FORK, sys_fork, 0, "fork"),
+  SYSCALL(SYS_VMSTATS, sys_vmstats, 1, "vmstats"),
+  SYSCALL(SYS_STACK_PREFAULT, sys_stack_prefault, 1, "stack_prefault"),
+  SYSCALL(SYS_MEMLIMIT, sys_memlimit, 1, "memlimit"),
+#endif
+};
+
+#define SYSCALL_CNT (sizeof syscall_table / sizeof *syscall_table)
+
+/* Invocations of each system call and CPU cycles spent in it.
+   Updated with interrupts off, since every process shares them. */
+static struct syscall_stats stats_table[SYSCALL_CNT];
 
 void
 syscall_init (void)  {
-  lock_init(&filesys_lock);
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
@@ -68,12 +209,18 @@ check_translate_user(const char *vaddr, bool write) {
   if (base == NULL) return page_fault_handler(vaddr, write, thread_current()->esp);
   else return !(write && !(base->writable));
 #else
-  return pagedir_get_page(thread_current() -> pagedir, vaddr) != NULL;
+  return (pagedir_get_page(thread_current() -> pagedir, vaddr) != NULL
+          || process_demand_load(vaddr));
 #endif
 }
 
 bool
 check_user(const char *vaddr, int size, bool write) {
+#ifdef VM
+  if(size < 0)
+    return false;
+  return page_check_range(vaddr, size, write, thread_current()->esp);
+#else
   if(!check_translate_user(vaddr + size - 1, write))
     return false;
   size >>= 12;
@@ -83,6 +230,7 @@ check_user(const char *vaddr, int size, bool write) {
     vaddr += (1<<12);
   } while(size--);
   return true;
+#endif
 }
 
 
@@ -96,83 +244,32 @@ syscall_handler (struct intr_frame *f /*UNUSED*/)  {
 
   if(!check_user(f->esp, 4, false))
     exit_status(f, -1);
-  int syscall_num = *((int*)f->esp);
-  void *arg1 = f->esp + 4, *arg2 = f->esp + 8, *arg3 = f->esp + 12;
+  unsigned syscall_num = *((unsigned *)f->esp);
+  if(syscall_num >= SYSCALL_CNT || syscall_table[syscall_num].func == NULL)
+    return;
 
-  switch (syscall_num) {
-    case SYS_EXIT: case SYS_EXEC: case SYS_WAIT: case SYS_TELL:  case SYS_REMOVE: case SYS_FILESIZE: case SYS_OPEN: case SYS_CLOSE:
-#ifdef VM
-    case SYS_MUNMAP:
-#endif
-#ifdef FILESYS
-    case SYS_MKDIR: case SYS_CHDIR: case SYS_ISDIR: case SYS_INUMBER:
-#endif
-      if(!check_user(arg1, 4, false))
-        exit_status(f, -1);
-      break;
-    case SYS_SEEK: case SYS_CREATE:
-#ifdef VM
-    case SYS_MMAP:
-#endif
-#ifdef FILESYS
-    case SYS_READDIR:
-#endif
-      if(!check_user(arg1, 8, false))
-        exit_status(f, -1);
-      break;
-    case SYS_READ: case SYS_WRITE:
-      if(!check_user(arg1, 12, false))
-        exit_status(f, -1);
-      break;
-    default:;
-  }
-  switch (syscall_num) {
-    case SYS_HALT:
-      sys_halt(f); break;
-    case SYS_EXIT:
-      sys_exit(f, *((int *)arg1)); break;
-    case SYS_EXEC:
-      sys_exec(f, *((void **) arg1)); break;
-    case SYS_WAIT:
-      sys_wait(f, *((int *)arg1)); break;
-    case SYS_CREATE:
-      sys_create(f, *((void **) arg1), *((unsigned *) arg2)); break;
-    case SYS_REMOVE:
-      sys_remove(f, *((void **) arg1)); break;
-    case SYS_OPEN:
-      sys_open(f, *((void **) arg1)); break;
-    case SYS_FILESIZE:
-      sys_filesize(f, *((int *)arg1)); break;
-    case SYS_READ:
-      sys_read(f, *((int *)arg1), *((void **) arg2), *((unsigned *) arg3)); break;
-    case SYS_WRITE:
-      sys_write(f, *((int *)arg1), *((void **) arg2), *((unsigned *) arg3)); break;
-    case SYS_SEEK:
-      sys_seek(f, *((int *)arg1), *((unsigned *) arg2)); break;
-    case SYS_TELL:
-      sys_tell(f, *((int *)arg1)); break;
-    case SYS_CLOSE:
-      sys_close(f, *((int *)arg1)); break;
-#ifdef VM
-    case SYS_MUNMAP:
-      syscall_munmap(f, *((mapid_t *) arg1)); break;
-    case SYS_MMAP:
-      syscall_mmap(f, *((int *) arg1), *((void **) arg2)); break;
-#endif
-#ifdef FILESYS
-    case SYS_CHDIR:
-      sys_chdir(f, *((void **) arg1)); break;
-    case SYS_MKDIR:
-      sys_mkdir(f, *((void **) arg1)); break;
-    case SYS_READDIR:
-      sys_readdir(f, *((int *)arg1), *((void **) arg2)); break;
-    case SYS_ISDIR:
-      sys_isdir(f, *((int *)arg1));
-    case SYS_INUMBER:
-      sys_inumber(f, *((int *)arg1));
-#endif
-  }
+  /* Copy just the arguments this call takes, after checking them. */
+  const struct syscall_desc *d = &syscall_table[syscall_num];
+  uint32_t args[SYSCALL_ARGS_MAX] = {0};
+  if(d->argc > 0 && !check_user(f->esp + 4, 4 * d->argc, false))
+    exit_status(f, -1);
+  memcpy(args, f->esp + 4, 4 * d->argc);
 
+  /* Calls that exit never come back, so count the call first. */
+  struct syscall_stats *stat = &stats_table[syscall_num];
+  enum intr_level old_level = intr_disable();
+  stat->calls++;
+  intr_set_level(old_level);
+  KTRACE(KTRACE_SYSCALL, syscall_num);
+  uint64_t start = timer_tsc();
+  d->func(f, args[0], args[1], args[2], args[3]);
+  uint64_t cycles = timer_tsc() - start;
+  KTRACE(KTRACE_SYSCALL_DONE, syscall_num, f->eax);
+  int bucket = hist_bucket(cycles, SYSCALL_HIST_BUCKETS);
+  old_level = intr_disable();
+  stat->cycles += cycles;
+  stat->hist[bucket]++;
+  intr_set_level(old_level);
 }
 
 static void
@@ -188,7 +285,7 @@ sys_wait(struct intr_frame *f, pid_t pid) {
 
 static void
 sys_exit(struct intr_frame *f, int status) {
-  struct thread *cur = thread_current();
+  struct thread *cur = process_current();
   if (!cur->parent_die) {
     cur->message_to_parent->exited = true;
     cur->message_to_parent->ret_value = status;
@@ -196,6 +293,30 @@ sys_exit(struct intr_frame *f, int status) {
   exit_status(f, status);
 }
 
+/* Pins the SIZE bytes at BUFFER, already checked by check_user(),
+   in memory until unpin_user(), so that file I/O into or out of
+   it never faults and cannot have its frames evicted midway.
+   Returns false if the pages could not all be brought in. */
+bool
+pin_user(const void *buffer, unsigned size, bool write) {
+  if(size == 0)
+    return true;
+#ifdef VM
+  return page_pin_range(buffer, size, write, thread_current()->esp);
+#else
+  return check_user(buffer, size, write);
+#endif
+}
+
+/* Undoes pin_user(). */
+void
+unpin_user(const void *buffer UNUSED, unsigned size UNUSED) {
+#ifdef VM
+  if(size > 0)
+    page_unpin_range(buffer, size);
+#endif
+}
+
 static void
 sys_write(struct intr_frame *f, int fd, const void *buffer, unsigned size) {
   if (!check_user(buffer, size, false)) {
@@ -211,10 +332,22 @@ sys_write(struct intr_frame *f, int fd, const void *buffer, unsigned size) {
     putbuf(buffer, size);
   } else {
     struct file_info *info = get_file_info(fd);
-    if(info != NULL && info->opened_dir == NULL) {
-      lock_acquire(&filesys_lock);
-      f->eax = (uint32_t)file_write(info->opened_file, buffer, size);
-      lock_release(&filesys_lock);
+    if(info != NULL && info->pipe != NULL) {
+      if(!info->pipe_writer) {
+        f->eax = (uint32_t)-1;
+        return;
+      }
+      if(!pin_user(buffer, size, false))
+        exit_status(f, -1);
+      f->eax = (uint32_t)pipe_write(info->pipe, buffer, size);
+      unpin_user(buffer, size);
+    } else if(info != NULL && info->opened_dir == NULL) {
+      if(!pin_user(buffer, size, false))
+        exit_status(f, -1);
+      off_t written = file_write_at(info->opened_file, buffer, size, info->pos);
+      unpin_user(buffer, size);
+      info->pos += written;
+      f->eax = (uint32_t)written;
     } else {
 //      printf("not open");
       exit_status(f, -1);
@@ -230,25 +363,457 @@ sys_read(struct intr_frame *f, int fd, const void *buffer, unsigned size) {
     exit_status(f, -1);
   uint8_t *str = buffer;
   if(fd == STDIN_FILENO) {
-    while(size--) {
-      *(char *)str++ = input_getc();
-    }
+    f->eax = input_read(str, size);
   } else {
     struct file_info *info = get_file_info(fd);
-    if(info != NULL) {
-      lock_acquire(&filesys_lock);
-      f->eax = (uint32_t)file_read(info->opened_file, (void *)buffer, size);
-      lock_release(&filesys_lock);
+    if(info != NULL && info->pipe != NULL) {
+      if(info->pipe_writer) {
+        f->eax = (uint32_t)-1;
+        return;
+      }
+      if(!pin_user(buffer, size, true))
+        exit_status(f, -1);
+      f->eax = (uint32_t)pipe_read(info->pipe, (void *)buffer, size);
+      unpin_user(buffer, size);
+    } else if(info != NULL) {
+      if(!pin_user(buffer, size, true))
+        exit_status(f, -1);
+      off_t read = file_read_at(info->opened_file, (void *)buffer, size, info->pos);
+      unpin_user(buffer, size);
+      info->pos += read;
+      f->eax = (uint32_t)read;
     } else {
       exit_status(f, -1);
     }
   }
 }
 
+/* Like sys_read(), but reads at POSITION and leaves the fd's
+   position alone, so random I/O needs no seek in between. */
+static void
+sys_pread(struct intr_frame *f, int fd, void *buffer, unsigned size, unsigned position) {
+  if(!check_user(buffer, size, true))
+    exit_status(f, -1);
+  struct file_info *info = get_file_info(fd);
+  if(info != NULL && info->opened_dir == NULL && info->pipe == NULL) {
+    if(!pin_user(buffer, size, true))
+      exit_status(f, -1);
+    f->eax = (uint32_t)file_read_at(info->opened_file, buffer, size, position);
+    unpin_user(buffer, size);
+  } else {
+    exit_status(f, -1);
+  }
+}
+
+/* Like sys_write(), but writes at POSITION and leaves the fd's
+   position alone. */
+static void
+sys_pwrite(struct intr_frame *f, int fd, const void *buffer, unsigned size, unsigned position) {
+  if(!check_user(buffer, size, false))
+    exit_status(f, -1);
+  struct file_info *info = get_file_info(fd);
+  if(info != NULL && info->opened_dir == NULL && info->pipe == NULL) {
+    if(!pin_user(buffer, size, false))
+      exit_status(f, -1);
+    f->eax = (uint32_t)file_write_at(info->opened_file, buffer, size, position);
+    unpin_user(buffer, size);
+  } else {
+    exit_status(f, -1);
+  }
+}
+
+/* Checks the IOVCNT buffers of IOV, killing the process if the
+   array or any buffer is bad, and returns their total size. */
+static unsigned
+check_iovec(struct intr_frame *f, const struct iovec *iov, int iovcnt, bool write) {
+  unsigned total = 0;
+  if(iovcnt < 0 || iovcnt > IOV_MAX)
+    exit_status(f, -1);
+  if(iovcnt == 0)
+    return 0;
+  if(!check_user((const char *) iov, iovcnt * sizeof *iov, false))
+    exit_status(f, -1);
+  for(int i = 0; i < iovcnt; i++) {
+    if(iov[i].iov_len > 0 && !check_user(iov[i].iov_base, iov[i].iov_len, write))
+      exit_status(f, -1);
+    total += iov[i].iov_len;
+  }
+  return total;
+}
+
+/* Like sys_read(), but fills the IOVCNT buffers of IOV in order in
+   a single system call.  Stops at the first short read. */
+static void
+sys_readv(struct intr_frame *f, int fd, const struct iovec *iov, int iovcnt) {
+  check_iovec(f, iov, iovcnt, true);
+  if(fd == STDOUT_FILENO)
+    exit_status(f, -1);
+  off_t total = 0;
+  if(fd == STDIN_FILENO) {
+    for(int i = 0; i < iovcnt; i++) {
+      size_t got = input_read(iov[i].iov_base, iov[i].iov_len);
+      total += got;
+      if(got < iov[i].iov_len)
+        break;
+    }
+    f->eax = total;
+    return;
+  }
+  struct file_info *info = get_file_info(fd);
+  if(info == NULL || info->opened_dir != NULL || (info->pipe != NULL && info->pipe_writer))
+    exit_status(f, -1);
+  for(int i = 0; i < iovcnt; i++) {
+    if(!pin_user(iov[i].iov_base, iov[i].iov_len, true))
+      exit_status(f, -1);
+    off_t read = info->pipe != NULL
+                 ? pipe_read(info->pipe, iov[i].iov_base, iov[i].iov_len)
+                 : file_read_at(info->opened_file, iov[i].iov_base, iov[i].iov_len, info->pos);
+    unpin_user(iov[i].iov_base, iov[i].iov_len);
+    info->pos += read;
+    total += read;
+    if(read < (off_t) iov[i].iov_len)
+      break;
+  }
+  f->eax = (uint32_t)total;
+}
+
+/* Like sys_write(), but writes the IOVCNT buffers of IOV in order
+   in a single system call.  Stops at the first short write. */
+static void
+sys_writev(struct intr_frame *f, int fd, const struct iovec *iov, int iovcnt) {
+  unsigned size = check_iovec(f, iov, iovcnt, false);
+  if(fd == STDIN_FILENO)
+    exit_status(f, -1);
+  off_t total = 0;
+  if(fd == STDOUT_FILENO) {
+    for(int i = 0; i < iovcnt; i++)
+      putbuf(iov[i].iov_base, iov[i].iov_len);
+    f->eax = size;
+    return;
+  }
+  struct file_info *info = get_file_info(fd);
+  if(info == NULL || info->opened_dir != NULL || (info->pipe != NULL && !info->pipe_writer))
+    exit_status(f, -1);
+  for(int i = 0; i < iovcnt; i++) {
+    if(!pin_user(iov[i].iov_base, iov[i].iov_len, false))
+      exit_status(f, -1);
+    off_t written = info->pipe != NULL
+                    ? pipe_write(info->pipe, iov[i].iov_base, iov[i].iov_len)
+                    : file_write_at(info->opened_file, iov[i].iov_base, iov[i].iov_len, info->pos);
+    unpin_user(iov[i].iov_base, iov[i].iov_len);
+    if(written < 0) {
+      /* The pipe has no reader left. */
+      if(total == 0)
+        total = -1;
+      break;
+    }
+    info->pos += written;
+    total += written;
+    if(written < (off_t) iov[i].iov_len)
+      break;
+  }
+  f->eax = (uint32_t)total;
+}
+
+/* Copies up to SIZE bytes from FD_IN to FD_OUT, starting at and
+   advancing each fd's position.  The data goes from cache to
+   cache in the kernel and never through a user buffer. */
+static void
+sys_copy_file_range(struct intr_frame *f, int fd_in, int fd_out, unsigned size) {
+  struct file_info *in = get_file_info(fd_in);
+  struct file_info *out = get_file_info(fd_out);
+  if(in == NULL || out == NULL || in->opened_dir != NULL || out->opened_dir != NULL
+     || in->pipe != NULL || out->pipe != NULL)
+    exit_status(f, -1);
+  off_t copied = file_copy_at(out->opened_file, out->pos, in->opened_file, in->pos, size);
+  in->pos += copied;
+  if(out != in)
+    out->pos += copied;
+  f->eax = (uint32_t)copied;
+}
+
+/* Copies the statistics of system call NR to BUFFER.  Returns
+   false if NR is not a system call. */
+static void
+sys_stats(struct intr_frame *f, unsigned nr, struct syscall_stats *buffer) {
+  struct syscall_stats snapshot;
+  if(!check_user((const char *) buffer, sizeof *buffer, true))
+    exit_status(f, -1);
+  if(nr >= SYSCALL_CNT || syscall_table[nr].func == NULL) {
+    f->eax = false;
+    return;
+  }
+  /* Take a consistent copy first; touching user memory with
+     interrupts off could fault. */
+  enum intr_level old_level = intr_disable();
+  snapshot = stats_table[nr];
+  intr_set_level(old_level);
+  if(!pin_user(buffer, sizeof *buffer, true))
+    exit_status(f, -1);
+  memcpy(buffer, &snapshot, sizeof *buffer);
+  unpin_user(buffer, sizeof *buffer);
+  f->eax = true;
+}
+
+#ifdef VM
+static void
+sys_fork(struct intr_frame *f) {
+  /* The child must not share frames still pinned for I/O. */
+  if(process_current()->aio != NULL)
+    aio_quiesce(process_current()->aio);
+  f->eax = (uint32_t)process_fork(f);
+}
+
+/* Copies the current process's paging counters to BUFFER. */
+static void
+sys_vmstats(struct intr_frame *f, struct vm_stats *buffer) {
+  struct vm_stats snapshot;
+  if(!check_user((const char *) buffer, sizeof *buffer, true))
+    exit_status(f, -1);
+  /* Count first; copying out may fault pages in. */
+  page_get_stats(&snapshot);
+  if(!pin_user(buffer, sizeof *buffer, true))
+    exit_status(f, -1);
+  memcpy(buffer, &snapshot, sizeof *buffer);
+  unpin_user(buffer, sizeof *buffer);
+  f->eax = true;
+}
+
+/* Sets the most stack pages one fault may map for the current
+   process, and the processes it starts, to PAGES, unless it is
+   negative.  Returns the previous value. */
+static void
+sys_stack_prefault(struct intr_frame *f, int pages) {
+  struct thread *cur = process_current();
+  f->eax = cur->stack_prefault;
+  if(pages >= 0)
+    cur->stack_prefault = pages < PAGE_STACK_PREFAULT_MAX ? pages : PAGE_STACK_PREFAULT_MAX;
+}
+
+/* Sets the most frames the current process, and the processes it
+   starts, may hold to PAGES, or lifts the limit if PAGES is 0,
+   unless PAGES is negative.  Returns the previous value.  Past
+   its limit, a process's faults evict its own pages first. */
+static void
+sys_memlimit(struct intr_frame *f, int pages) {
+  struct thread *cur = process_current();
+  f->eax = cur->frame_limit;
+  if(pages >= 0)
+    cur->frame_limit = pages;
+}
+#endif
+
+/* Moves the end of the current process's heap by INCREMENT bytes
+   and returns the old end, or -1 if it cannot be moved. */
+static void
+sys_sbrk(struct intr_frame *f, intptr_t increment) {
+  struct thread *cur = process_current();
+  lock_acquire(&cur->mm_lock);
+  if(increment < 0 && cur->aio != NULL)
+    aio_quiesce(cur->aio);
+  void *old_brk = process_sbrk(increment);
+  lock_release(&cur->mm_lock);
+  f->eax = old_brk != NULL ? (uint32_t)old_brk : (uint32_t)-1;
+}
+
+/* Writes the data of the file or directory open as FD to disk,
+   leaving the rest of the cache alone.  Returns false if FD is
+   not open. */
+static void
+sys_fsync(struct intr_frame *f, int fd) {
+  struct file_info *info = get_file_info(fd);
+  if(info == NULL || info->pipe != NULL) {
+    f->eax = false;
+    return;
+  }
+  file_sync(info->opened_file);
+  f->eax = true;
+}
+
+/* Writes everything cached for the file system to disk. */
+static void
+sys_sync(struct intr_frame *f UNUSED) {
+  filesys_sync();
+}
+
+/* Reserves disk space, contiguous if possible, for LENGTH bytes
+   of the file open as FD starting at OFFSET, extending the file
+   with zeros to cover them.  Returns false if FD is not a file
+   open for writing or the disk is too full. */
+static void
+sys_fallocate(struct intr_frame *f, int fd, unsigned offset, unsigned length) {
+  struct file_info *info = get_file_info(fd);
+  if(info == NULL || info->opened_dir != NULL || info->pipe != NULL
+     || offset > INT32_MAX || length > INT32_MAX - offset) {
+    f->eax = false;
+    return;
+  }
+  f->eax = file_preallocate(info->opened_file, offset, length);
+}
+
+/* Takes ADVICE, one of the MADV_* values, about how LENGTH bytes
+   of the file open as FD starting at OFFSET will be read; see
+   inode_advise().  Returns false if FD is not a file or ADVICE is
+   unknown. */
+static void
+sys_fadvise(struct intr_frame *f, int fd, unsigned offset, unsigned length, int advice) {
+  struct file_info *info = get_file_info(fd);
+  if(info == NULL || info->opened_dir != NULL || info->pipe != NULL
+     || offset > INT32_MAX || length > INT32_MAX - offset) {
+    f->eax = false;
+    return;
+  }
+  f->eax = file_advise(info->opened_file, offset, length, advice);
+}
+
+/* Stores the time since boot and the CPU cycle counter in
+   BUFFER. */
+static void
+sys_clock(struct intr_frame *f, struct clock_time *buffer) {
+  struct clock_time now;
+  if(!check_user((const char *) buffer, sizeof *buffer, true)
+     || !pin_user(buffer, sizeof *buffer, true))
+    exit_status(f, -1);
+  /* Read the clock once the buffer is in memory, so that no page
+     fault lands between the reading and the return. */
+  now.cycles = timer_tsc();
+  now.ns = timer_ns();
+  memcpy(buffer, &now, sizeof *buffer);
+  unpin_user(buffer, sizeof *buffer);
+  f->eax = true;
+}
+
+/* Stores the state of threads, memory and the buffer cache in
+   BUFFER. */
+static void
+sys_sysinfo(struct intr_frame *f, struct sysinfo *buffer) {
+  struct sysinfo *info;
+  size_t sectors, frames = 0, frames_used = 0, slots = 0, slots_used = 0;
+  if(!check_user((const char *) buffer, sizeof *buffer, true))
+    exit_status(f, -1);
+  /* Too big for the kernel stack, and gathered before pinning,
+     like sys_vmstats(), since copying out may fault pages in. */
+  info = calloc(1, sizeof *info);
+  if(info == NULL) {
+    f->eax = false;
+    return;
+  }
+  info->ticks = timer_ticks();
+  info->load_avg = thread_get_load_avg();
+  info->kernel_pages = palloc_page_cnt(0);
+  info->kernel_free = palloc_free_cnt(0);
+  info->user_pages = palloc_page_cnt(PAL_USER);
+  info->user_free = palloc_free_cnt(PAL_USER);
+  cache_get_stats(&sectors, &info->cache_lookups, &info->cache_hits);
+  info->cache_sectors = sectors;
+#ifdef VM
+  frame_get_stats(&frames, &frames_used);
+  swap_get_stats(&slots, &slots_used);
+#endif
+  info->frames = frames;
+  info->frames_used = frames_used;
+  info->swap_slots = slots;
+  info->swap_used = slots_used;
+  info->thread_cnt = thread_get_info(info->threads, SYSINFO_THREADS_MAX);
+  if(!pin_user(buffer, sizeof *buffer, true)) {
+    free(info);
+    exit_status(f, -1);
+  }
+  memcpy(buffer, info, sizeof *buffer);
+  unpin_user(buffer, sizeof *buffer);
+  free(info);
+  f->eax = true;
+}
+
+/* Registers RING as the current process's asynchronous I/O ring
+   and empties its queues.  Returns false if the process already
+   has one or memory is short. */
+static void
+sys_aio_setup(struct intr_frame *f, struct aio_ring *ring) {
+  struct thread *cur = process_current();
+  if(!check_user((const char *) ring, sizeof *ring, true))
+    exit_status(f, -1);
+  if(cur->aio != NULL) {
+    f->eax = false;
+    return;
+  }
+  cur->aio = aio_create(ring);
+  f->eax = cur->aio != NULL;
+}
+
+/* Submits the requests queued in the current process's ring and
+   waits for MIN_COMPLETE completions; see aio_enter().  Returns
+   the number of completions added to the ring, or -1 if there is
+   no ring. */
+static void
+sys_aio_enter(struct intr_frame *f, unsigned min_complete) {
+  struct thread *cur = process_current();
+  if(cur->aio == NULL) {
+    f->eax = -1;
+    return;
+  }
+  int cnt = aio_enter(cur->aio, min_complete);
+  if(cnt < 0)
+    exit_status(f, -1);
+  f->eax = cnt;
+}
+
+/* Starts a thread in this process at EIP, with its stack pointer
+   at ESP.  Returns its thread id, or -1 if it cannot be started. */
+static void
+sys_uthread_create(struct intr_frame *f, void (*eip)(void), void *esp) {
+  f->eax = process_uthread_create(eip, esp);
+}
+
+/* Ends the calling thread alone.  For the process's first thread,
+   that means exiting with status 0 once all the others have. */
+static void
+sys_uthread_exit(struct intr_frame *f) {
+  if(process_uthread_exit())
+    sys_exit(f, 0);
+  thread_exit();
+}
+
+/* Waits for thread TID of this process to exit.  Returns 0, or -1
+   if TID cannot be joined. */
+static void
+sys_uthread_join(struct intr_frame *f, tid_t tid) {
+  f->eax = process_uthread_join(tid);
+}
+
+/* Sleeps until woken by futex_wake() on UADDR, if the int there
+   is still VAL.  Returns true if woken, false if it was not VAL. */
+static void
+sys_futex_wait(struct intr_frame *f, const int *uaddr, int val) {
+  int r = futex_wait(uaddr, val);
+  if(r < 0)
+    exit_status(f, -1);
+  f->eax = r == 1;
+}
+
+/* Wakes up to CNT threads waiting on UADDR.  Returns how many. */
+static void
+sys_futex_wake(struct intr_frame *f, const int *uaddr, int cnt) {
+  f->eax = futex_wake(uaddr, cnt);
+}
+
+static void
+sys_sched_setaffinity(struct intr_frame *f, unsigned mask) {
+  f->eax = process_set_affinity(mask);
+}
+
+static void
+sys_sched_getaffinity(struct intr_frame *f) {
+  f->eax = thread_current()->cpu_mask;
+}
+
+static void
+sys_sched_reserve(struct intr_frame *f, int runtime, int period) {
+  f->eax = thread_set_reservation(runtime, period);
+}
+
 void close_file(struct file *file1) {
-  lock_acquire(&filesys_lock);
   file_close(file1);
-  lock_release(&filesys_lock);
 }
 
 bool
@@ -268,45 +833,150 @@ check_string(const char *str) {
   return true;
 }
 
-static void
-sys_exec(struct intr_frame *f, const char *cmd_line) {
-  if(!check_string(cmd_line)) {
+/* True if any byte of W is zero. */
+#define HAS_ZERO_BYTE(W) ((((W) - 0x01010101u) & ~(W) & 0x80808080u) != 0)
+
+/* Copies the null-terminated string at user address USTR into
+   DST, which holds SIZE bytes, checking each page of it once on
+   the way and moving a word at a time within a page.  Returns the
+   string's length, or -1 if it is not valid user memory or does
+   not fit. */
+static int
+copy_in_string_buf(char *dst, const char *ustr, size_t size) {
+  const char *p = ustr;
+  char *q = dst;
+  char *end = dst + size;
+
+  while(q < end) {
+    const char *page_end = (const char *) pg_round_down(p) + PGSIZE;
+    if(!check_translate_user(p, false))
+      return -1;
+
+    /* Up to a word boundary, then whole words up to one with a
+       null in it, then what is left of the page. */
+    while(p < page_end && q < end && ((uintptr_t) p & 3) != 0)
+      if((*q++ = *p++) == '\0')
+        return q - dst - 1;
+    while(p < page_end && end - q >= 4) {
+      uint32_t w = *(const uint32_t *) p;
+      if(HAS_ZERO_BYTE(w))
+        break;
+      memcpy(q, &w, 4);
+      p += 4;
+      q += 4;
+    }
+    while(p < page_end && q < end)
+      if((*q++ = *p++) == '\0')
+        return q - dst - 1;
+  }
+  return -1;
+}
+
+/* Copies the null-terminated string at user address USTR into a
+   new page, so that the kernel reads it once and never again
+   touches user memory for it.  Kills the process if USTR is not
+   a valid user string shorter than a page.  Returns the copy,
+   which the caller frees with palloc_free_page(), or a null
+   pointer if no page is free. */
+static char *
+copy_in_string(struct intr_frame *f, const char *ustr) {
+  char *kstr = palloc_get_page(0);
+  if(kstr == NULL)
+    return NULL;
+  if(copy_in_string_buf(kstr, ustr, PGSIZE) < 0) {
+    palloc_free_page(kstr);
     exit_status(f, -1);
   }
-  lock_acquire(&filesys_lock);
+  return kstr;
+}
+
+/* Waits until the child whose tid is in F->eax has loaded, and
+   sets F->eax to -1 if it failed to. */
+static void
+wait_for_load(struct intr_frame *f) {
+  struct child_info *l = get_child_info(f->eax);
+  if(l != NULL && l->parent == thread_current()) {
+    sema_down(l->sema_start);
+    if(l->load_failed)
+      f->eax = (uint32_t)-1;
+  }
+}
+
+static void
+sys_exec(struct intr_frame *f, const char *ucmd_line) {
+  char *cmd_line = copy_in_string(f, ucmd_line);
+  if(cmd_line == NULL) {
+    f->eax = (uint32_t)-1;
+    return;
+  }
   f->eax = (uint32_t)process_execute(cmd_line);
-  lock_release(&filesys_lock);
-  struct list_elem *e;
-  struct thread *cur = thread_current();
-  struct child_info *l;
-  for(e = list_begin(&cur->child_list); e != list_end(&cur->child_list); e = list_next(e)) {
-    l = list_entry(e, struct child_info, elem);
-    if(l->child_id == f->eax) {
-      sema_down(l->sema_start);
-      if(l->load_failed)
-        f->eax = (uint32_t)-1;
+  palloc_free_page(cmd_line);
+  wait_for_load(f);
+}
+
+/* Like sys_exec(), but takes the command line already split into
+   words, in the null-terminated array ARGV. */
+static void
+sys_spawn(struct intr_frame *f, const char **argv) {
+  struct exec_args *args = exec_args_create();
+  char *word = palloc_get_page(0);
+  int len;
+  if(args == NULL || word == NULL) {
+    if(args != NULL)
+      exec_args_destroy(args);
+    if(word != NULL)
+      palloc_free_page(word);
+    f->eax = (uint32_t)-1;
+    return;
+  }
+  for(;; argv++) {
+    if(!check_user((const char *)argv, sizeof *argv, false))
+      goto bad;
+    if(*argv == NULL)
+      break;
+    len = copy_in_string_buf(word, *argv, PGSIZE);
+    if(len < 0)
+      goto bad;
+    if(!exec_args_push(args, word, len)) {
+      exec_args_destroy(args);
+      palloc_free_page(word);
+      f->eax = (uint32_t)-1;
       return;
     }
   }
+  palloc_free_page(word);
+  f->eax = (uint32_t)process_spawn(args);
+  wait_for_load(f);
+  return;
+
+ bad:
+  exec_args_destroy(args);
+  palloc_free_page(word);
+  exit_status(f, -1);
 }
 
 static void
-sys_open(struct intr_frame *f, const char *name) {
-  if(!check_string(name))
-    exit_status(f, -1);
-  lock_acquire(&filesys_lock);
+sys_open(struct intr_frame *f, const char *uname) {
+  char *name = copy_in_string(f, uname);
+  if(name == NULL) {
+    f->eax = (uint32_t)-1;
+    return ;
+  }
   struct file *tmp = filesys_open(name);
-  lock_release(&filesys_lock);
+  palloc_free_page(name);
   if(tmp == NULL) {
     f->eax = (uint32_t)-1;
     return ;
   }
-  static uint32_t fd_next = 2;
-  struct file_info *info = malloc(sizeof(struct file_info));
+  struct file_info *info = slab_alloc(&file_info_cache);
+  if(info == NULL) {
+    file_close(tmp);
+    f->eax = (uint32_t)-1;
+    return ;
+  }
   info->opened_file = tmp;
-  info->thread_num = thread_current();
-  info->fd = fd_next++;
-  lock_acquire(&filesys_lock);
+  info->pos = 0;
+  info->pipe = NULL;
   struct inode *inode = file_get_inode(info->opened_file);
   if(inode != NULL && inode_is_dir(inode)) {
     info->opened_dir = dir_open( inode_reopen(inode) );
@@ -314,36 +984,97 @@ sys_open(struct intr_frame *f, const char *name) {
   else
     info->opened_dir = NULL;
 
-  lock_release(&filesys_lock);
-  add_file_list(info);
+  if(!add_file_info(info)) {
+    if(info->opened_dir != NULL)
+      dir_close(info->opened_dir);
+    file_close(tmp);
+    slab_free(&file_info_cache, info);
+    f->eax = (uint32_t)-1;
+    return ;
+  }
   f->eax = (uint32_t)info->fd;
 }
 
+/* Returns a new descriptor for the write end of pipe P if WRITER,
+   or else its read end, or -1 if there is no memory for it. */
+static int
+open_pipe_end(struct pipe *p, bool writer) {
+  struct file_info *info = slab_alloc(&file_info_cache);
+  if(info == NULL)
+    return -1;
+  info->opened_file = NULL;
+  info->opened_dir = NULL;
+  info->pos = 0;
+  info->pipe = p;
+  info->pipe_writer = writer;
+  if(!add_file_info(info)) {
+    slab_free(&file_info_cache, info);
+    return -1;
+  }
+  return info->fd;
+}
+
+/* Creates a pipe and stores descriptors for its read and write
+   ends in FDS[0] and FDS[1].  Returns false if out of memory. */
 static void
-sys_create(struct intr_frame *f, const char *name, unsigned initial_size) {
-  if(!check_string(name))
+sys_pipe(struct intr_frame *f, int *fds) {
+  int ends[2];
+  if(!check_user((const char *) fds, sizeof ends, true))
+    exit_status(f, -1);
+  f->eax = false;
+  struct pipe *p = pipe_create();
+  if(p == NULL)
+    return;
+  ends[0] = open_pipe_end(p, false);
+  if(ends[0] < 0) {
+    pipe_close(p, false);
+    pipe_close(p, true);
+    return;
+  }
+  ends[1] = open_pipe_end(p, true);
+  if(ends[1] < 0) {
+    /* Closing the read end's descriptor closes that end. */
+    struct file_info *info = get_file_info(ends[0]);
+    remove_file_info(info);
+    slab_free(&file_info_cache, info);
+    pipe_close(p, false);
+    pipe_close(p, true);
+    return;
+  }
+  if(!pin_user(fds, sizeof ends, true))
     exit_status(f, -1);
-  lock_acquire(&filesys_lock);
+  memcpy(fds, ends, sizeof ends);
+  unpin_user(fds, sizeof ends);
+  f->eax = true;
+}
+
+static void
+sys_create(struct intr_frame *f, const char *uname, unsigned initial_size) {
+  char *name = copy_in_string(f, uname);
+  f->eax = false;
+  if(name == NULL)
+    return;
   f->eax = (uint32_t)filesys_create(name, initial_size, false);
-  lock_release(&filesys_lock);
+  palloc_free_page(name);
 }
 
 static void
-sys_remove(struct intr_frame *f, const char *name) {
-  if(!check_string(name))
-    exit_status(f, -1);
-  lock_acquire(&filesys_lock);
+sys_remove(struct intr_frame *f, const char *uname) {
+  char *name = copy_in_string(f, uname);
+  f->eax = false;
+  if(name == NULL)
+    return;
   f->eax = (uint32_t)filesys_remove(name);
-  lock_release(&filesys_lock);
+  palloc_free_page(name);
 }
 
 static void
 sys_filesize(struct intr_frame *f, int fd) {
   struct file_info *info = get_file_info(fd);
-  if(info != NULL) {
-    lock_acquire(&filesys_lock);
+  if(info != NULL && info->pipe != NULL) {
+    f->eax = (uint32_t)-1;
+  } else if(info != NULL) {
     f->eax = (uint32_t)file_length(info->opened_file);
-    lock_release(&filesys_lock);
   } else {
     exit_status(f, -1);
   }
@@ -353,13 +1084,13 @@ static void
 sys_close(struct intr_frame *f, int fd) {
   struct file_info *info = get_file_info(fd);
   if(info != NULL) {
-    lock_acquire(&filesys_lock);
+    if(info->pipe != NULL)
+      pipe_close(info->pipe, info->pipe_writer);
     file_close(info->opened_file);
     if(info->opened_dir != NULL)
       dir_close(info->opened_dir);
-    lock_release(&filesys_lock);
-    list_remove(&info->elem);
-    free(info);
+    remove_file_info(info);
+    slab_free(&file_info_cache, info);
   } else {
     exit_status(f, -1);
   }
@@ -368,10 +1099,8 @@ sys_close(struct intr_frame *f, int fd) {
 static void
 sys_tell(struct intr_frame *f, int fd) {
   struct file_info *info = get_file_info(fd);
-  if(info != NULL) {//--------------------need change after filesys finished -------
-    lock_acquire(&filesys_lock);
-    f->eax = (uint32_t)file_tell(info->opened_file);
-    lock_release(&filesys_lock);
+  if(info != NULL) {
+    f->eax = info->pos;
   } else {
     exit_status(f, -1);
   }
@@ -381,33 +1110,44 @@ static void
 sys_seek(struct intr_frame *f, int fd, unsigned position) {
   struct file_info *info = get_file_info(fd);
   if(info != NULL) {
-    lock_acquire(&filesys_lock);
-    file_seek(info->opened_file, position);
-    lock_release(&filesys_lock);
+    info->pos = position;
   } else {
     exit_status(f, -1);
   }
 }
 
 #ifdef VM
+/* Returns true if NUM_PAGE pages at VADDR are free for a new
+   region.  Below the stack, every page table entry belongs to a
+   region or to the heap, so it is enough to check those and the
+   end of the range, whatever the size of the mapping. */
 bool mmap_check_mmap_vaddr(struct thread *cur, const void *vaddr, int num_page) {
-    bool res = true;
-    for (int i = 0; i < num_page; i++)
-	if (!page_upage_accessable(cur->page_table, i * PGSIZE + vaddr))
-	    res = false;
-    return res;
+    const void *end = vaddr + num_page * PGSIZE;
+    struct list_elem *e;
+    if (num_page == 0) return true;
+    if (end <= vaddr || !page_upage_accessable(cur->page_table, end - PGSIZE)) return false;
+    if (vaddr < (const void *) (USER_INFO_PAGE + PGSIZE) && (const void *) USER_INFO_PAGE < end) return false;
+    /* Heap pages too only get entries once touched. */
+    if (vaddr < pg_round_up(cur->heap_brk) && (const void *) cur->heap_start < end) return false;
+    for (e = list_begin(&cur->mmap_file_list); e != list_end(&cur->mmap_file_list); e = list_next(e)) {
+	struct mmap_handler *mh = list_entry(e, struct mmap_handler, elem);
+	if (vaddr < mh->mmap_addr + mh->num_page_with_segment * PGSIZE && mh->mmap_addr < end)
+	    return false;
+    }
+    return true;
 }
 
-bool mmap_install_page(struct thread *cur, struct mmap_handler *mh) {
-    bool res = true;
-    for (int i = 0; i < mh->num_page; i++)
-	if (!page_install_file(cur->page_table, mh, mh->mmap_addr + i * PGSIZE))
-	    res = false;
-    if (mh->is_segment)
-	for (int i = mh->num_page; i < mh->num_page_with_segment; i++)
-	    if (!page_install_file(cur->page_table, mh, mh->mmap_addr + i * PGSIZE))
-		res = false;
-    return res;
+/* Returns CUR's mmap handler whose region holds UPAGE, or NULL if
+   there is none.  The region is all the pages of the handler,
+   which get page table entries only once used; see vm/page.c. */
+struct mmap_handler *mmap_find_region(struct thread *cur, const void *upage) {
+    struct list_elem *e;
+    for (e = list_begin(&cur->mmap_file_list); e != list_end(&cur->mmap_file_list); e = list_next(e)) {
+	struct mmap_handler *mh = list_entry(e, struct mmap_handler, elem);
+	if (upage >= mh->mmap_addr && upage < mh->mmap_addr + mh->num_page_with_segment * PGSIZE)
+	    return mh;
+    }
+    return NULL;
 }
 
 void mmap_read_file(struct mmap_handler* mh, void *upage, void *kpage) {
@@ -429,29 +1169,42 @@ void mmap_read_file(struct mmap_handler* mh, void *upage, void *kpage) {
     }
 }
 
-void mmap_write_file(struct mmap_handler* mh, void* upage, void *kpage) {
-    if (mh->writable) {
-	if (mh->is_segment) {
-	    void* addr = mh->mmap_addr + mh->num_page * PGSIZE + mh->last_page_size;
-	    if (addr > upage) {
-		if (addr - upage < PGSIZE) file_write_at(mh->mmap_file, kpage, mh->last_page_size, upage - mh->mmap_addr + mh->file_ofs);
-		else file_write_at(mh->mmap_file, kpage, PGSIZE, upage - mh->mmap_addr + mh->file_ofs);
-	    }
-	} else {
-	    if (mh->mmap_addr + file_length(mh->mmap_file) - upage < PGSIZE)
-		file_write_at(mh->mmap_file, kpage, mh->last_page_size, upage - mh->mmap_addr + mh->file_ofs);
-	    else
-		file_write_at(mh->mmap_file, kpage, PGSIZE, upage - mh->mmap_addr + mh->file_ofs);
-	}
+/* Returns true if UPAGE of MH lies wholly past the data of its
+   segment, so that mmap_read_file() would only zero it. */
+bool mmap_page_is_zero(struct mmap_handler* mh, void *upage) {
+    if (!mh->is_segment) return false;
+    void* addr = mh->mmap_addr + mh->num_page * PGSIZE + mh->last_page_size;
+    if (mh->last_page_size != 0)
+	addr -= PGSIZE;
+    return addr <= upage;
+}
+
+/* Returns how many bytes of UPAGE of MH mmap_write_file() writes
+   back: a whole page, the part of the last one the file covers,
+   or none for a read-only mapping or a page past the data. */
+off_t mmap_write_size(struct mmap_handler* mh, void* upage) {
+    if (!mh->writable) return 0;
+    if (mh->is_segment) {
+	void* addr = mh->mmap_addr + mh->num_page * PGSIZE + mh->last_page_size;
+	if (addr <= upage) return 0;
+	return addr - upage < PGSIZE ? mh->last_page_size : PGSIZE;
     }
+    return mh->mmap_addr + file_length(mh->mmap_file) - upage < PGSIZE ? mh->last_page_size : PGSIZE;
+}
+
+void mmap_write_file(struct mmap_handler* mh, void* upage, void *kpage) {
+    off_t size = mmap_write_size(mh, upage);
+    if (size > 0) file_write_back_at(mh->mmap_file, kpage, size, upage - mh->mmap_addr + mh->file_ofs);
 }
 
 bool mmap_load_segment(struct file *file, off_t ofs, uint8_t *upage, uint32_t read_bytes, uint32_t zero_bytes, bool writable) {
-    ASSERT(!((read_bytes + zero_bytes) & PGMASK)) struct thread* cur = thread_current();
+    ASSERT(!((read_bytes + zero_bytes) & PGMASK));
+    struct thread* cur = thread_current();
     mapid_t mapid = cur->next_mapid++;
-    struct mmap_handler* mh = malloc(sizeof(struct mmap_handler));
+    struct mmap_handler* mh = slab_alloc(&mmap_handler_cache);
     mh->mapid = mapid;
     mh->mmap_file = file;
+    mh->shm = NULL;
     mh->writable = writable;
     mh->is_static_data = writable;
     int num_page = read_bytes / PGSIZE;
@@ -465,13 +1218,18 @@ bool mmap_load_segment(struct file *file, off_t ofs, uint8_t *upage, uint32_t re
     mh->num_page_with_segment = total_num_page;
     mh->is_segment = true;
     mh ->file_ofs = ofs;
+    mh->advice = MADV_NORMAL;
     list_push_back(&(cur->mmap_file_list), &(mh->elem));
-    return mmap_install_page(cur, mh);
+    return true;
 }
 
 
-static void syscall_mmap(struct intr_frame* f, int fd, const void* obj_vaddr) {
-    if (fd == 0 || fd == 1) {
+/* Maps the file open as FD at OBJ_VADDR, returning a mapid for
+   munmap(), or -1.  Its pages are read in as they are used, or
+   with MAP_POPULATE in FLAGS all at once now, as far as frames
+   are plentiful; see page_advise(). */
+static void syscall_mmap(struct intr_frame* f, int fd, const void* obj_vaddr, int flags) {
+    if (fd == 0 || fd == 1 || (flags & ~MAP_POPULATE) != 0) {
 	f->eax = -1;
 	return;
     }
@@ -479,13 +1237,15 @@ static void syscall_mmap(struct intr_frame* f, int fd, const void* obj_vaddr) {
 	f->eax = -1;
 	return;
     }
-    struct thread* cur = thread_current();
+    struct thread* cur = process_current();
     struct file_info* fh = get_file_info(fd);
-    if (fh != NULL) {
+    lock_acquire(&cur->mm_lock);
+    if (fh != NULL && fh->pipe == NULL) {
 	mapid_t mapid = cur->next_mapid++;
-	struct mmap_handler *mh = malloc(sizeof(struct mmap_handler));
+	struct mmap_handler *mh = slab_alloc(&mmap_handler_cache);
 	mh->mapid = mapid;
 	mh->mmap_file = file_reopen(fh->opened_file);
+	mh->shm = NULL;
 	mh->writable = true;
 	mh->is_segment = false;
 	mh->is_static_data = false;
@@ -495,6 +1255,7 @@ static void syscall_mmap(struct intr_frame* f, int fd, const void* obj_vaddr) {
 	int last_page_used = file_size % PGSIZE;
 	if (last_page_used != 0) num_page++;
 	if (!mmap_check_mmap_vaddr(cur, obj_vaddr, num_page)) {
+	    lock_release(&cur->mm_lock);
 	    f->eax = -1;
 	    return;
 	}
@@ -502,71 +1263,172 @@ static void syscall_mmap(struct intr_frame* f, int fd, const void* obj_vaddr) {
 	mh->num_page = num_page;
 	mh->num_page_with_segment = num_page;
 	mh->last_page_size = last_page_used;
+	mh->advice = MADV_NORMAL;
+	/* Page faults of other threads walk the list. */
+	page_table_lock();
 	list_push_back(&(cur->mmap_file_list), &(mh->elem));
-	if(!mmap_install_page(cur, mh)) {
-	    f->eax = -1;
-	    return;
-	}
+	page_table_unlock();
+	if (flags & MAP_POPULATE)
+	    page_advise(mh, mh->mmap_addr, (uint8_t *) mh->mmap_addr + num_page * PGSIZE, MADV_WILLNEED);
 	f->eax = (uint32_t) mapid;
     } else {
 	f->eax = -1;
-	return;
     }
+    lock_release(&cur->mm_lock);
 }
 
 static void syscall_munmap(struct intr_frame *f, mapid_t mapid) {
-    struct thread* cur = thread_current();
-    if (list_empty(&cur->mmap_file_list)) {
-	f->eax = -1;
-	return;
-    }
+    struct thread* cur = process_current();
+    lock_acquire(&cur->mm_lock);
     struct mmap_handler* mh = syscall_get_mmap_handle(mapid);
     if (mh == NULL) {
 	f->eax = -1;
-	return;
-    }
-    for (int i = 0; i < mh->num_page; i++) {
-	if (!page_unmap(cur->page_table, mh->mmap_addr + i * PGSIZE)) {
+    } else {
+	if (cur->aio != NULL) aio_quiesce(cur->aio);
+	if (!page_unmap_region(mh, mh->num_page)) {
 	    delete_mmap_handle(mh);
 	    f->eax = -1;
-	    return;
+	} else if (!delete_mmap_handle(mh)) {
+	    f->eax = -1;
 	}
     }
-    if (!delete_mmap_handle(mh)) {
-	f->eax = -1;
+    lock_release(&cur->mm_lock);
+}
+
+/* Writes the dirty pages of mapping MAPID back to its file,
+   leaving them mapped.  Returns false if there is no such
+   mapping. */
+static void sys_msync(struct intr_frame *f, mapid_t mapid) {
+    struct thread* cur = process_current();
+    lock_acquire(&cur->mm_lock);
+    struct mmap_handler* mh = syscall_get_mmap_handle(mapid);
+    f->eax = mh != NULL;
+    if (mh != NULL) page_sync_region(mh);
+    lock_release(&cur->mm_lock);
+}
+
+/* Takes ADVICE, one of the MADV_* values, about how the LENGTH
+   bytes of memory at ADDR will be used; see page_advise().  Each
+   mapping the range overlaps takes the advice for its part of
+   it.  Returns false if ADDR is not page-aligned, ADVICE is
+   unknown, or the range overlaps no mapping. */
+static void sys_madvise(struct intr_frame *f, void *addr, unsigned length, int advice) {
+    struct thread* cur = process_current();
+    uint8_t *first = addr, *end = first + ROUND_UP(length, PGSIZE);
+    struct list_elem *e;
+    bool found = false;
+    f->eax = false;
+    if (pg_ofs(addr) != 0 || end < first || !is_user_vaddr(end - 1)
+	|| advice < MADV_NORMAL || advice > MADV_DONTNEED)
 	return;
+    lock_acquire(&cur->mm_lock);
+    if (advice == MADV_DONTNEED && cur->aio != NULL) aio_quiesce(cur->aio);
+    for (e = list_begin(&cur->mmap_file_list); e != list_end(&cur->mmap_file_list); e = list_next(e)) {
+	struct mmap_handler *mh = list_entry(e, struct mmap_handler, elem);
+	uint8_t *start = mh->mmap_addr;
+	uint8_t *stop = start + mh->num_page_with_segment * PGSIZE;
+	if (start >= end || stop <= first) continue;
+	page_advise(mh, start > first ? start : first, stop < end ? stop : end, advice);
+	found = true;
     }
+    lock_release(&cur->mm_lock);
+    f->eax = found;
+}
+
+/* Maps the shared memory object NAME at ADDR, first creating it
+   with SIZE bytes if there is none; SIZE may be 0 to map an
+   existing one whole.  Returns a mapid for munmap(), or -1. */
+static void sys_shm_open(struct intr_frame *f, const char *uname, unsigned size, void *addr) {
+    char *name = copy_in_string(f, uname);
+    f->eax = -1;
+    if (name == NULL)
+	return;
+    if (addr == NULL || pg_ofs(addr) != 0 || !is_user_vaddr(addr)) {
+	palloc_free_page(name);
+	return;
+    }
+    struct thread* cur = process_current();
+    lock_acquire(&cur->mm_lock);
+    struct shm* shm = shm_get(name, size);
+    palloc_free_page(name);
+    if (shm == NULL) {
+	lock_release(&cur->mm_lock);
+	return;
+    }
+    int num_page = shm_page_cnt(shm);
+    struct mmap_handler *mh = slab_alloc(&mmap_handler_cache);
+    if (mh == NULL || !mmap_check_mmap_vaddr(cur, addr, num_page)) {
+	if (mh != NULL) slab_free(&mmap_handler_cache, mh);
+	shm_put(shm);
+	lock_release(&cur->mm_lock);
+	return;
+    }
+    mh->mapid = cur->next_mapid++;
+    mh->mmap_file = NULL;
+    mh->shm = shm;
+    mh->writable = true;
+    mh->is_segment = false;
+    mh->is_static_data = false;
+    mh->file_ofs = 0;
+    mh->mmap_addr = addr;
+    mh->num_page = num_page;
+    mh->num_page_with_segment = num_page;
+    mh->last_page_size = 0;
+    mh->advice = MADV_NORMAL;
+    page_table_lock();
+    list_push_back(&cur->mmap_file_list, &mh->elem);
+    page_table_unlock();
+    if (page_map_shared(mh))
+	f->eax = mh->mapid;
+    else {
+	page_unmap_region(mh, num_page);
+	delete_mmap_handle(mh);
+    }
+    lock_release(&cur->mm_lock);
+}
+
+/* Removes the name of the shared memory object NAME, which goes
+   once no process maps it.  Returns false if there is none. */
+static void sys_shm_unlink(struct intr_frame *f, const char *uname) {
+    char *name = copy_in_string(f, uname);
+    f->eax = false;
+    if (name == NULL)
+	return;
+    f->eax = shm_unlink(name);
+    palloc_free_page(name);
 }
 
 #endif
 #ifdef FILESYS
 
 static void
-sys_chdir(struct intr_frame *f, const char *name)
+sys_chdir(struct intr_frame *f, const char *uname)
 {
-  if(!check_string(name))
-    exit_status(f, -1);
+  char *name = copy_in_string(f, uname);
+  f->eax = false;
+  if(name == NULL)
+    return;
 //  bool return_code;
 //  check_user((const uint8_t*) filename);
 
-  lock_acquire (&filesys_lock);
   f->eax = filesys_chdir(name);
-  lock_release (&filesys_lock);
+  palloc_free_page(name);
 
 //  return return_code;
 }
 
 static void
-sys_mkdir(struct intr_frame *f, const char *name)
+sys_mkdir(struct intr_frame *f, const char *uname)
 {
-  if(!check_string(name))
-    exit_status(f, -1);
+  char *name = copy_in_string(f, uname);
+  f->eax = false;
+  if(name == NULL)
+    return;
 //  bool return_code;
 //  check_user((const uint8_t*) filename);
 
-  lock_acquire (&filesys_lock);
   f->eax = filesys_create(name, 0, true);
-  lock_release (&filesys_lock);
+  palloc_free_page(name);
 
 //  return return_code;
 }
@@ -581,7 +1443,6 @@ sys_readdir(struct intr_frame *f, int fd, char *name)
 //  bool ret = false;
   f->eax = 0;
 
-  lock_acquire (&filesys_lock);
   //file_d = find_file_desc(thread_current(), fd, FD_DIRECTORY);
   struct file_info *info = get_file_info(fd);
   if (info == NULL) goto done;
@@ -599,42 +1460,92 @@ sys_readdir(struct intr_frame *f, int fd, char *name)
 //  ASSERT (file_d->dir != NULL); // see sys_open()
   f->eax = dir_readdir (info->opened_dir, name);
 
-  done:
-  lock_release (&filesys_lock);
+  done:;
 //  return ret;
 }
 
+/* Reads up to CNT entries of the directory open as FD into
+   ENTRIES, continuing where the last readdir() or getdents() left
+   off.  Returns the number read, 0 at the end of the directory,
+   or -1 if FD is not a directory. */
 static void
-sys_isdir(struct intr_frame *f, int fd)
+sys_getdents(struct intr_frame *f, int fd, struct dirent *entries, unsigned cnt)
 {
-  lock_acquire (&filesys_lock);
+  if(cnt > INT32_MAX / sizeof *entries
+     || !check_user((const char *) entries, cnt * sizeof *entries, true))
+    exit_status(f, -1);
+
+  struct file_info *info = get_file_info(fd);
+  if(info == NULL || info->opened_dir == NULL) {
+    f->eax = -1;
+    return;
+  }
+  if(!pin_user(entries, cnt * sizeof *entries, true))
+    exit_status(f, -1);
+  f->eax = dir_readdir_batch(info->opened_dir, entries, cnt);
+  unpin_user(entries, cnt * sizeof *entries);
+}
 
+static void
+sys_isdir(struct intr_frame *f, int fd)
+{
   struct file_info *info = get_file_info(fd);
-  if (info == NULL) {
+  if (info == NULL || info->pipe != NULL) {
     f->eax = 0;
     return ;
   }
   f->eax = inode_is_dir (file_get_inode(info->opened_file));
 
-  lock_release (&filesys_lock);
 //  return ret;
 }
 
 static void
 sys_inumber(struct intr_frame *f, int fd)
 {
-  lock_acquire (&filesys_lock);
-
 //  struct file_desc* file_d = find_file_desc(thread_current(), fd, FD_FILE | FD_DIRECTORY);
   struct file_info *info = get_file_info(fd);
-  if (info == NULL) {
+  if (info == NULL || info->pipe != NULL) {
     f->eax = 0;
     return ;
   }
   f->eax = (int) inode_get_inumber (file_get_inode(info->opened_file));
 
-  lock_release (&filesys_lock);
 //  return ret;
 }
 
 #endif
+
+/* Prints the calls made to each system call and the average CPU
+   cycles and time each took. */
+void
+syscall_print_stats (void) {
+  size_t i;
+
+  for (i = 0; i < SYSCALL_CNT; i++)
+    if (stats_table[i].calls > 0)
+      {
+        uint64_t each = stats_table[i].cycles / stats_table[i].calls;
+        printf ("Syscall %s: %llu calls, %llu cycles (%llu ns) each\n",
+                syscall_table[i].name, stats_table[i].calls,
+                each, timer_tsc_to_ns (each));
+      }
+}
+
+/* Prints the latency histogram of each system call used so far,
+   one line per call listing the nonzero log2 cycle buckets.
+   This is the "syscall-stats" kernel action. */
+void
+syscall_print_histograms (char **argv UNUSED) {
+  size_t i;
+  int b;
+
+  for (i = 0; i < SYSCALL_CNT; i++)
+    if (stats_table[i].calls > 0)
+      {
+        printf ("Syscall %s latency (log2 cycles: calls):", syscall_table[i].name);
+        for (b = 0; b < SYSCALL_HIST_BUCKETS; b++)
+          if (stats_table[i].hist[b] > 0)
+            printf (" %d: %llu", b, stats_table[i].hist[b]);
+        printf ("\n");
+      }
+}
@@ -12,15 +12,22 @@
 typedef int pid_t;
 
 void syscall_init (void);
+void syscall_print_stats (void);
+void syscall_print_histograms (char **argv);
 void close_file(struct file *);
 void exit_status(struct intr_frame *f, int status);
 bool check_translate_user(const char *vaddr, bool write);
+bool check_user(const char *vaddr, int size, bool write);
+bool pin_user(const void *buffer, unsigned size, bool write);
+void unpin_user(const void *buffer, unsigned size);
 
 #ifdef VM
 bool mmap_check_mmap_vaddr(struct thread *cur, const void *vaddr, int num_page);
-bool mmap_install_page(struct thread *cur, struct mmap_handler *mh);
+struct mmap_handler *mmap_find_region(struct thread *cur, const void *upage);
 void mmap_read_file(struct mmap_handler* mh, void *upage, void *kpage);
+off_t mmap_write_size(struct mmap_handler* mh, void *upage);
 void mmap_write_file(struct mmap_handler* mh, void *upage, void *kpage);
+bool mmap_page_is_zero(struct mmap_handler* mh, void *upage);
 bool mmap_load_segment(struct file *file, off_t ofs, uint8_t *upage, uint32_t read_bytes, uint32_t zero_bytes, bool writable);
 #endif
 
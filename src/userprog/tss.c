@@ -1,10 +1,15 @@
 #include "userprog/tss.h"
 #include <debug.h>
+#include <inttypes.h>
 #include <stddef.h>
+#include <sysenter.h>
 #include "userprog/gdt.h"
+#include "threads/flags.h"
+#include "threads/init.h"
 #include "threads/thread.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
+#include "devices/shutdown.h"
 
 /* The Task-State Segment (TSS).
 
@@ -75,6 +80,38 @@ struct tss
 /* Kernel TSS. */
 static struct tss *tss;
 
+/* SYSENTER model-specific registers.  See [IA32-v3a] 4.8.7
+   "Fast System Calls". */
+#define MSR_SYSENTER_CS 0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+/* Stack SYSENTER first lands on.  sysenter_entry() leaves it at
+   once for the kernel stack named by sysenter_esp0, so it is only
+   ever used by a debug trap taken on that first instruction. */
+static uint8_t sysenter_stack[1024];
+
+/* Where sysenter_entry() finds the running thread's kernel stack:
+   the TSS's esp0. */
+void **sysenter_esp0;
+
+#ifdef STACK_GUARD
+/* TSS of the double fault task, followed on its page by the
+   task's stack.  When a kernel stack overflows into the unmapped
+   guard page below it, the CPU cannot push the page fault's frame
+   on that stack either, and raises a double fault; handled on the
+   same stack, that would reset the machine instead. */
+static struct tss *df_tss;
+static void double_fault (void) NO_RETURN;
+#endif
+
+/* Sets model-specific register MSR to VALUE. */
+static void
+write_msr (uint32_t msr, uint32_t value)
+{
+  asm volatile ("wrmsr" : : "c" (msr), "a" (value), "d" (0));
+}
+
 /* Initializes the kernel TSS. */
 void
 tss_init (void) 
@@ -86,6 +123,30 @@ tss_init (void)
   tss->ss0 = SEL_KDSEG;
   tss->bitmap = 0xdfff;
   tss_update ();
+
+  /* SYSEXIT returns to the segments 16 and 24 bytes past the
+     kernel code segment, which the GDT puts the user segments
+     at. */
+  if (sysenter_supported ())
+    {
+      sysenter_esp0 = &tss->esp0;
+      write_msr (MSR_SYSENTER_CS, SEL_KCSEG);
+      write_msr (MSR_SYSENTER_ESP,
+                 (uint32_t) (sysenter_stack + sizeof sysenter_stack));
+      write_msr (MSR_SYSENTER_EIP, (uint32_t) sysenter_entry);
+    }
+
+#ifdef STACK_GUARD
+  df_tss = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+  df_tss->cr3 = vtop (init_page_dir);
+  df_tss->eip = double_fault;
+  df_tss->eflags = FLAG_MBS;
+  df_tss->esp = (uint32_t) df_tss + PGSIZE;
+  df_tss->cs = SEL_KCSEG;
+  df_tss->ss = df_tss->ds = df_tss->es = SEL_KDSEG;
+  df_tss->fs = df_tss->gs = SEL_KDSEG;
+  df_tss->bitmap = 0xdfff;
+#endif
 }
 
 /* Returns the kernel TSS. */
@@ -96,6 +157,30 @@ tss_get (void)
   return tss;
 }
 
+#ifdef STACK_GUARD
+/* Returns the TSS of the double fault task. */
+struct tss *
+tss_get_double_fault (void)
+{
+  ASSERT (df_tss != NULL);
+  return df_tss;
+}
+
+/* Runs as the double fault task.  The CPU saved the registers of
+   the faulting code in the kernel TSS.  That code's struct
+   thread, at the bottom of the overflowed stack, is overwritten
+   by the time the guard page is reached, so it cannot be named;
+   nor can the usual power off run, since its locks need a
+   thread.  Pintos halts after the panic message instead. */
+static void
+double_fault (void)
+{
+  shutdown_configure (SHUTDOWN_NONE);
+  PANIC ("double fault, probably a kernel stack overflow: "
+         "esp=%#"PRIx32" eip=%p", tss->esp, tss->eip);
+}
+#endif
+
 /* Sets the ring 0 stack pointer in the TSS to point to the end
    of the thread stack. */
 void
@@ -6,6 +6,12 @@
 struct tss;
 void tss_init (void);
 struct tss *tss_get (void);
+#ifdef STACK_GUARD
+struct tss *tss_get_double_fault (void);
+#endif
 void tss_update (void);
 
+/* SYSENTER system call entry, in sysenter.S. */
+void sysenter_entry (void);
+
 #endif /* userprog/tss.h */
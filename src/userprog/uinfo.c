@@ -0,0 +1,61 @@
+#include "userprog/uinfo.h"
+#include <debug.h>
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "userprog/pagedir.h"
+
+/* The page every process maps, or a null pointer before
+   uinfo_init(). */
+static struct user_info *info;
+
+/* Allocates the user info page.  Must be called before
+   interrupts are turned on. */
+void
+uinfo_init (void)
+{
+  info = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+}
+
+/* Maps the user info page read-only into PD at USER_INFO_PAGE.
+   Returns false if memory for a page table runs out. */
+bool
+uinfo_map (uint32_t *pd)
+{
+  return pagedir_set_page (pd, (void *) USER_INFO_PAGE, info, false);
+}
+
+/* Unmaps the user info page from PD, which must be done before
+   pagedir_destroy(), since the page is not the process's to
+   free.  PD need not have it mapped. */
+void
+uinfo_unmap (uint32_t *pd)
+{
+  pagedir_clear_page (pd, (void *) USER_INFO_PAGE);
+}
+
+/* Publishes TICKS, the new tick count.  Called by the timer
+   interrupt. */
+void
+uinfo_tick (int64_t ticks)
+{
+  if (info == NULL)
+    return;
+
+  /* A reader that sees SEQ odd, or changed across its read, was
+     interrupted midway and rereads. */
+  info->seq++;
+  barrier ();
+  info->ticks = ticks;
+  barrier ();
+  info->seq++;
+}
+
+/* Publishes the ids of T, which is about to run user code.
+   Called on every context switch into a process. */
+void
+uinfo_switch (const struct thread *t)
+{
+  info->pid = t->leader->tid;
+  info->tid = t->tid;
+}
@@ -0,0 +1,25 @@
+#ifndef USERPROG_UINFO_H
+#define USERPROG_UINFO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <syscall-nr.h>
+
+struct thread;
+
+/* The user info page: one page of kernel memory, mapped read-only
+   at USER_INFO_PAGE in every process, holding a struct user_info
+   that the kernel keeps current.  User code reads the tick count
+   and its own ids from it without a system call.
+
+   The timer updates the tick count on every tick, and each
+   context switch into a process stores that process's ids, so
+   whichever process reads them finds its own. */
+
+void uinfo_init (void);
+bool uinfo_map (uint32_t *pd);
+void uinfo_unmap (uint32_t *pd);
+void uinfo_tick (int64_t ticks);
+void uinfo_switch (const struct thread *);
+
+#endif /* userprog/uinfo.h */
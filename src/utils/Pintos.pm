@@ -220,6 +220,10 @@ sub assemble_disk {
 
     my ($source);
     my ($fn) = $p->{FILE};
+    if ($fn eq '/dev/zero') {
+      write_zeros ($disk, $disk_fn, $p->{SECTORS} * 512);
+      next;
+    }
     open ($source, '<', $fn) or die "$fn: open: $!\n";
     if ($p->{OFFSET}) {
       sysseek ($source, $p->{OFFSET}, 0) == $p->{OFFSET}
@@ -313,9 +317,22 @@ sub write_fully {
   die "$file_name: short write\n" if $written_bytes != length $data;
 }
 
+# write_zeros($handle, $file_name, $size)
+#
+# Writes $size zero bytes to $handle.  At the end of a regular file,
+# extends the file instead, leaving a hole that reads back as zeros
+# without taking the time or space to write them.
+# $file_name is used in error messages.
 sub write_zeros {
   my ($handle, $file_name, $size) = @_;
 
+  my ($pos) = -f $handle ? sysseek ($handle, 0, 1) : undef;
+  if (defined ($pos) && $pos >= (-s $handle || 0)) {
+    truncate ($handle, $pos + $size) or die "$file_name: truncate: $!\n";
+    sysseek ($handle, $pos + $size, 0) or die "$file_name: seek: $!\n";
+    return;
+  }
+
   while ($size > 0) {
     my ($chunk_size) = 4096;
     $chunk_size = $size if $chunk_size > $size;
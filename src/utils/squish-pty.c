@@ -8,10 +8,12 @@
 #include <stdlib.h>
 #include <string.h>
 // #include <stropts.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <termios.h>
 #include <unistd.h>
@@ -106,19 +108,109 @@ handle_error (ssize_t retval, int *fd, bool fd_is_pty, const char *call)
     }
 }
 
+/* Size of each direction's relay buffer.  Big enough to absorb a
+   long burst of guest output while stdout catches up. */
+#define RELAY_BUF_SIZE (64 * 1024)
+
+/* One direction of the relay: a ring buffer of data read from IN
+   that has not yet been written to OUT. */
+struct pipe 
+  {
+    int in, out;
+    char buf[RELAY_BUF_SIZE];
+    size_t size, ofs;           /* Bytes buffered, and where they start. */
+    bool active;                /* Has anything been read from IN? */
+  };
+
+/* Reads from P->in into P's buffer until the buffer is full or a
+   read returns end-of-file, an error, or nothing available.
+   Returns the value of the last read, or 1 if the buffer was
+   already full. */
+static ssize_t
+pipe_fill (struct pipe *p) 
+{
+  ssize_t n = 1;
+
+  while (p->size < sizeof p->buf)
+    {
+      struct iovec iov[2];
+      size_t end = p->ofs + p->size;
+      int cnt = 1;
+
+      if (end < sizeof p->buf)
+        {
+          iov[0].iov_base = p->buf + end;
+          iov[0].iov_len = sizeof p->buf - end;
+          iov[1].iov_base = p->buf;
+          iov[1].iov_len = p->ofs;
+          if (p->ofs > 0)
+            cnt = 2;
+        }
+      else
+        {
+          end -= sizeof p->buf;
+          iov[0].iov_base = p->buf + end;
+          iov[0].iov_len = p->ofs - end;
+        }
+
+      n = readv (p->in, iov, cnt);
+      if (n <= 0)
+        break;
+      p->active = true;
+      p->size += n;
+    }
+  return n;
+}
+
+/* Writes P's buffer to P->out until it is empty or a write
+   fails or would block.  Returns the value of the last write, or
+   1 if the buffer was already empty. */
+static ssize_t
+pipe_drain (struct pipe *p) 
+{
+  ssize_t n = 1;
+
+  while (p->size > 0)
+    {
+      struct iovec iov[2];
+      int cnt = 1;
+
+      iov[0].iov_base = p->buf + p->ofs;
+      iov[0].iov_len = p->size;
+      if (p->ofs + p->size > sizeof p->buf)
+        {
+          iov[0].iov_len = sizeof p->buf - p->ofs;
+          iov[1].iov_base = p->buf;
+          iov[1].iov_len = p->size - iov[0].iov_len;
+          cnt = 2;
+        }
+
+      n = writev (p->out, iov, cnt);
+      if (n <= 0)
+        break;
+      p->ofs = (p->ofs + n) % sizeof p->buf;
+      p->size -= n;
+    }
+  if (p->size == 0)
+    p->ofs = 0;
+  return n;
+}
+
+/* Returns true if N, the result of pipe_fill() or pipe_drain(),
+   means end-of-file or an error, as opposed to running out of
+   data or buffer space. */
+static bool
+pipe_failed (ssize_t n) 
+{
+  return n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+}
+
 /* Copies data from stdin to PTY and from PTY to stdout until no
    more data can be read or written. */
 static void
 relay (int pty, int dead_child_fd) 
 {
-  struct pipe 
-    {
-      int in, out;
-      char buf[BUFSIZ];
-      size_t size, ofs;
-      bool active;
-    };
-  struct pipe pipes[2];
+  static struct pipe pipes[2];
 
   /* Make PTY, stdin, and stdout non-blocking. */
   make_nonblocking (pty, true);
@@ -140,71 +232,68 @@ relay (int pty, int dead_child_fd)
   
   while (pipes[1].in != -1)
     {
-      fd_set read_fds, write_fds;
+      struct pollfd fds[5];
+      int in_idx[2];
+      nfds_t nfds = 0;
       int retval;
       int i;
 
-      FD_ZERO (&read_fds);
-      FD_ZERO (&write_fds);
       for (i = 0; i < 2; i++)
         {
           struct pipe *p = &pipes[i];
 
+          in_idx[i] = -1;
+
           /* Don't do anything with the stdin->pty pipe until we
              have some data for the pty->stdout pipe.  If we get
              too eager, Bochs will throw away our input. */
           if (i == 0 && !pipes[1].active)
             continue;
           
-          if (p->in != -1 && p->size + p->ofs < sizeof p->buf)
-            FD_SET (p->in, &read_fds);
+          if (p->in != -1 && p->size < sizeof p->buf)
+            {
+              in_idx[i] = nfds;
+              fds[nfds].fd = p->in;
+              fds[nfds++].events = POLLIN;
+            }
           if (p->out != -1 && p->size > 0)
-            FD_SET (p->out, &write_fds); 
+            {
+              fds[nfds].fd = p->out;
+              fds[nfds++].events = POLLOUT;
+            }
         }
-      FD_SET (dead_child_fd, &read_fds);
+      fds[nfds].fd = dead_child_fd;
+      fds[nfds++].events = POLLIN;
 
       do 
         {
-          retval = select (FD_SETSIZE, &read_fds, &write_fds, NULL, NULL); 
+          retval = poll (fds, nfds, -1); 
         }
       while (retval < 0 && errno == EINTR);
       if (retval < 0) 
-        fail_io ("select");
+        fail_io ("poll");
 
-      if (FD_ISSET (dead_child_fd, &read_fds))
+      if (fds[nfds - 1].revents != 0)
         break;
 
       for (i = 0; i < 2; i++) 
         {
           struct pipe *p = &pipes[i];
-          if (p->in != -1 && FD_ISSET (p->in, &read_fds))
+          ssize_t n;
+
+          if (in_idx[i] >= 0 && fds[in_idx[i]].revents != 0)
             {
-              ssize_t n = read (p->in, p->buf + p->ofs + p->size,
-                                sizeof p->buf - p->ofs - p->size);
-              if (n > 0) 
-                {
-                  p->active = true;
-                  p->size += n;
-                  if (p->size == BUFSIZ && p->ofs != 0)
-                    {
-                      memmove (p->buf, p->buf + p->ofs, p->size);
-                      p->ofs = 0;
-                    }
-                }
-              else
+              n = pipe_fill (p);
+              if (pipe_failed (n))
                 handle_error (n, &p->in, p->in == pty, "read");
             }
-          if (p->out != -1 && FD_ISSET (p->out, &write_fds)) 
+
+          /* Write out whatever is buffered now, all at once,
+             rather than waiting for another round of poll(). */
+          if (p->out != -1 && p->size > 0)
             {
-              ssize_t n = write (p->out, p->buf + p->ofs, p->size);
-              if (n > 0) 
-                {
-                  p->ofs += n;
-                  p->size -= n;
-                  if (p->size == 0)
-                    p->ofs = 0;
-                }
-              else
+              n = pipe_drain (p);
+              if (pipe_failed (n))
                 handle_error (n, &p->out, p->out == pty, "write");
             }
         }
@@ -217,23 +306,11 @@ relay (int pty, int dead_child_fd)
     for (;;)
       {
         struct pipe *p = &pipes[1];
-        ssize_t n;
-
-        /* Write buffer. */
-        while (p->size > 0) 
-          {
-            n = write (p->out, p->buf + p->ofs, p->size);
-            if (n < 0)
-              fail_io ("write");
-            else if (n == 0)
-              fail_io ("zero-length write");
-            p->ofs += n;
-            p->size -= n;
-          }
-        p->ofs = 0;
-
-        p->size = n = read (p->in, p->buf, sizeof p->buf);
-        if (n <= 0)
+
+        if (pipe_drain (p) <= 0)
+          fail_io ("write");
+        pipe_fill (p);
+        if (p->size == 0)
           return;
       }
 }
@@ -13,6 +13,7 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -99,19 +100,109 @@ handle_error (ssize_t retval, int *fd, bool fd_is_sock, const char *call)
     fail_io ("%s", call); 
 }
 
+/* Size of each direction's relay buffer.  Big enough to absorb a
+   long burst of guest output while stdout catches up. */
+#define RELAY_BUF_SIZE (64 * 1024)
+
+/* One direction of the relay: a ring buffer of data read from IN
+   that has not yet been written to OUT. */
+struct pipe 
+  {
+    int in, out;
+    char buf[RELAY_BUF_SIZE];
+    size_t size, ofs;           /* Bytes buffered, and where they start. */
+    bool active;                /* Has anything been read from IN? */
+  };
+
+/* Reads from P->in into P's buffer until the buffer is full or a
+   read returns end-of-file, an error, or nothing available.
+   Returns the value of the last read, or 1 if the buffer was
+   already full. */
+static ssize_t
+pipe_fill (struct pipe *p) 
+{
+  ssize_t n = 1;
+
+  while (p->size < sizeof p->buf)
+    {
+      struct iovec iov[2];
+      size_t end = p->ofs + p->size;
+      int cnt = 1;
+
+      if (end < sizeof p->buf)
+        {
+          iov[0].iov_base = p->buf + end;
+          iov[0].iov_len = sizeof p->buf - end;
+          iov[1].iov_base = p->buf;
+          iov[1].iov_len = p->ofs;
+          if (p->ofs > 0)
+            cnt = 2;
+        }
+      else
+        {
+          end -= sizeof p->buf;
+          iov[0].iov_base = p->buf + end;
+          iov[0].iov_len = p->ofs - end;
+        }
+
+      n = readv (p->in, iov, cnt);
+      if (n <= 0)
+        break;
+      p->active = true;
+      p->size += n;
+    }
+  return n;
+}
+
+/* Writes P's buffer to P->out until it is empty or a write
+   fails or would block.  Returns the value of the last write, or
+   1 if the buffer was already empty. */
+static ssize_t
+pipe_drain (struct pipe *p) 
+{
+  ssize_t n = 1;
+
+  while (p->size > 0)
+    {
+      struct iovec iov[2];
+      int cnt = 1;
+
+      iov[0].iov_base = p->buf + p->ofs;
+      iov[0].iov_len = p->size;
+      if (p->ofs + p->size > sizeof p->buf)
+        {
+          iov[0].iov_len = sizeof p->buf - p->ofs;
+          iov[1].iov_base = p->buf;
+          iov[1].iov_len = p->size - iov[0].iov_len;
+          cnt = 2;
+        }
+
+      n = writev (p->out, iov, cnt);
+      if (n <= 0)
+        break;
+      p->ofs = (p->ofs + n) % sizeof p->buf;
+      p->size -= n;
+    }
+  if (p->size == 0)
+    p->ofs = 0;
+  return n;
+}
+
+/* Returns true if N, the result of pipe_fill() or pipe_drain(),
+   means end-of-file or an error, as opposed to running out of
+   data or buffer space. */
+static bool
+pipe_failed (ssize_t n) 
+{
+  return n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+}
+
 /* Copies data from stdin to SOCK and from SOCK to stdout until no
    more data can be read or written. */
 static void
 relay (int sock) 
 {
-  struct pipe 
-    {
-      int in, out;
-      char buf[BUFSIZ];
-      size_t size, ofs;
-      bool active;
-    };
-  struct pipe pipes[2];
+  static struct pipe pipes[2];
 
   /* In case stdin is a file, go back to the beginning.
      This allows replaying the input on reset. */
@@ -152,7 +243,7 @@ relay (int sock)
           if (i == 0 && !pipes[1].active)
             continue;
           
-          if (p->in != -1 && p->size + p->ofs < sizeof p->buf)
+          if (p->in != -1 && p->size < sizeof p->buf)
             FD_SET (p->in, &read_fds);
           if (p->out != -1 && p->size > 0)
             FD_SET (p->out, &write_fds); 
@@ -171,23 +262,10 @@ relay (int sock)
               make_nonblocking (STDOUT_FILENO, false);
               for (;;) 
                 {
-                  ssize_t n;
-                  
-                  /* Write buffer. */
-                  while (p->size > 0) 
-                    {
-                      n = write (p->out, p->buf + p->ofs, p->size);
-                      if (n < 0)
-                        fail_io ("write");
-                      else if (n == 0)
-                        fail_io ("zero-length write");
-                      p->ofs += n;
-                      p->size -= n;
-                    }
-                  p->ofs = 0;
-
-                  p->size = n = read (p->in, p->buf, sizeof p->buf);
-                  if (n <= 0)
+                  if (pipe_drain (p) <= 0)
+                    fail_io ("write");
+                  pipe_fill (p);
+                  if (p->size == 0)
                     exit (0);
                 }
             }
@@ -197,34 +275,23 @@ relay (int sock)
       for (i = 0; i < 2; i++) 
         {
           struct pipe *p = &pipes[i];
+          ssize_t n;
+
           if (p->in != -1 && FD_ISSET (p->in, &read_fds))
             {
-              ssize_t n = read (p->in, p->buf + p->ofs + p->size,
-                                sizeof p->buf - p->ofs - p->size);
-              if (n > 0) 
-                {
-                  p->active = true;
-                  p->size += n;
-                  if (p->size == BUFSIZ && p->ofs != 0)
-                    {
-                      memmove (p->buf, p->buf + p->ofs, p->size);
-                      p->ofs = 0;
-                    }
-                }
-              else if (!handle_error (n, &p->in, p->in == sock, "read"))
+              n = pipe_fill (p);
+              if (pipe_failed (n)
+                  && !handle_error (n, &p->in, p->in == sock, "read"))
                 return;
             }
-          if (p->out != -1 && FD_ISSET (p->out, &write_fds)) 
+
+          /* Write out whatever is buffered now, all at once,
+             rather than waiting for another round of pselect(). */
+          if (p->out != -1 && p->size > 0)
             {
-              ssize_t n = write (p->out, p->buf + p->ofs, p->size);
-              if (n > 0) 
-                {
-                  p->ofs += n;
-                  p->size -= n;
-                  if (p->size == 0)
-                    p->ofs = 0;
-                }
-              else if (!handle_error (n, &p->out, p->out == sock, "write"))
+              n = pipe_drain (p);
+              if (pipe_failed (n)
+                  && !handle_error (n, &p->out, p->out == sock, "write"))
                 return;
             }
         }
@@ -4,21 +4,59 @@
 #include <string.h>
 #include <hash.h>
 #include <list.h>
+#include "devices/timer.h"
+#include "threads/ktrace.h"
 #include "threads/vaddr.h"
 #include "threads/thread.h"
+#include "threads/synch.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
 #include "userprog/syscall.h"
 #include "userprog/pagedir.h"
+#include "userprog/process.h"
+#include "filesys/cache.h"
+#include "filesys/inode.h"
 #include "frame.h"
 #include "page.h"
 #include "swap.h"
 
 typedef uint32_t index_t;
 
-static struct hash frame_table;
+/* One frame_item per page of the user pool, indexed by its place
+   in the pool, so that looking a frame up takes no search and
+   getting one no allocation.  Guarded by all_lock. */
+static struct frame_item* frame_table;
+
+/* Maps a file page to the frame_item sharing it between every
+   process that maps it: read-only pages of executables, and pages
+   of mmap'd files, which the file system also reads and writes in
+   place (see frame_file_read()), so that the frame is the one copy
+   of the page that everybody sees.  Changed under page_lock and
+   all_lock both. */
+static struct hash frame_share_table;
 static struct list frame_clock_list;
 static struct lock all_lock;
+
+/* Every frame_mapper on a frame_item's mappers list. */
+static struct slab_cache mapper_cache;
 struct frame_item* current_frame;
 
+/* Replacement policy in use, set by frame_set_policy(). */
+static enum frame_policy policy = FRAME_CLOCK;
+
+/* Under FRAME_WSCLOCK, pages not accessed for this many timer
+   ticks are taken to have left their process's working set. */
+#define FRAME_WS_TAU TIMER_FREQ
+
+/* The pageout thread is woken when fewer than pageout_low user
+   frames are free and evicts until pageout_high are, so that page
+   faults usually find a free frame without writing one back.  Both
+   are set from the size of the user pool; zero disables it. */
+static size_t pageout_low, pageout_high;
+static struct semaphore pageout_sema;
+static bool pageout_pending;
+static thread_func pageout_daemon;
+
 void frame_swap_next() {
     ASSERT(current_frame != NULL);
     if (list_size(&frame_clock_list) == 1) return;;
@@ -27,85 +65,432 @@ void frame_swap_next() {
 }
 
 
-static bool frame_hash_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED) {
-    const struct frame_item* ta = hash_entry(a, struct frame_item, hash_elem);
-    const struct frame_item* tb = hash_entry(b, struct frame_item, hash_elem);
-    return ta->frame < tb->frame;
+static bool frame_share_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED) {
+    const struct frame_item* ta = hash_entry(a, struct frame_item, share_elem);
+    const struct frame_item* tb = hash_entry(b, struct frame_item, share_elem);
+    return ta->inode < tb->inode || (ta->inode == tb->inode && ta->ofs < tb->ofs);
 }
 
-static unsigned frame_hash(const struct hash_elem *e, void* aux UNUSED) {
-    struct frame_item* tmp = hash_entry(e, struct frame_item, hash_elem);
-    return hash_bytes(&tmp->frame, sizeof(tmp->frame));
+static unsigned frame_share_hash(const struct hash_elem *e, void* aux UNUSED) {
+    struct frame_item* tmp = hash_entry(e, struct frame_item, share_elem);
+    return hash_ptr(tmp->inode) ^ hash_int(tmp->ofs);
+}
+
+/* Returns whether F has been accessed through any of its mappings
+   since the clock last passed it, and clears the accessed bits,
+   deferring the TLB invalidations to BATCH. */
+static bool frame_test_and_clear_accessed(struct frame_item* f, struct pagedir_batch* batch) {
+    bool accessed = false;
+    if (list_empty(&f->mappers)) {
+	accessed = pagedir_test_and_clear_accessed(f->t->pagedir, f->upage, batch);
+    } else {
+	struct list_elem* e;
+	for (e = list_begin(&f->mappers); e != list_end(&f->mappers); e = list_next(e)) {
+	    struct frame_mapper* m = list_entry(e, struct frame_mapper, elem);
+	    accessed |= pagedir_test_and_clear_accessed(m->t->pagedir, m->upage, batch);
+	}
+    }
+    return accessed;
+}
+
+/* Returns whether F has been written through any of its mappings
+   since it was last written back. */
+static bool frame_is_dirty(struct frame_item* f) {
+    struct list_elem* e;
+    if (list_empty(&f->mappers)) return pagedir_is_dirty(f->t->pagedir, f->upage);
+    for (e = list_begin(&f->mappers); e != list_end(&f->mappers); e = list_next(e)) {
+	struct frame_mapper* m = list_entry(e, struct frame_mapper, elem);
+	if (pagedir_is_dirty(m->t->pagedir, m->upage)) return true;
+    }
+    return false;
+}
+
+/* Returns true if F is mapped by T at UPAGE. */
+static bool frame_mapped_by(struct frame_item* f, struct thread* t, void* upage) {
+    struct list_elem* e;
+    if (list_empty(&f->mappers)) return f->t == t && f->upage == upage;
+    for (e = list_begin(&f->mappers); e != list_end(&f->mappers); e = list_next(e)) {
+	struct frame_mapper* m = list_entry(e, struct frame_mapper, elem);
+	if (m->t == t && m->upage == upage) return true;
+    }
+    return false;
+}
+
+/* Returns true if T maps shared frame F anywhere. */
+static bool frame_mapped_by_thread(struct frame_item* f, struct thread* t) {
+    struct list_elem* e;
+    for (e = list_begin(&f->mappers); e != list_end(&f->mappers); e = list_next(e))
+	if (list_entry(e, struct frame_mapper, elem)->t == t) return true;
+    return false;
+}
+
+/* Selects the replacement policy named NAME, which is "clock" or
+   "wsclock".  Returns false if NAME is not a known policy. */
+bool frame_set_policy(const char* name) {
+    if (!strcmp(name, "clock")) policy = FRAME_CLOCK;
+    else if (!strcmp(name, "wsclock")) policy = FRAME_WSCLOCK;
+    else return false;
+    return true;
+}
+
+/* Moves the clock hand to the victim under FRAME_CLOCK: the first
+   unpinned frame not accessed since the hand last passed it, or
+   streaming whether accessed or not.  If ONLY is non-null, frames
+   owned by other processes are passed over untouched.  Returns
+   false if every frame is pinned or passed over.  all_lock must
+   be held and the clock not empty. */
+static bool frame_pick_clock(struct pagedir_batch* batch, struct thread* only) {
+    /* Pinned frames are passed over; after two full turns of
+       the clock every unpinned frame has had its accessed bit
+       cleared, so only pins can be left. */
+    size_t turns = 2 * list_size(&frame_clock_list);
+    while((only != NULL && current_frame->t != only)
+	  || (frame_test_and_clear_accessed(current_frame, batch) && !current_frame->streaming)
+	  || current_frame->pin_cnt > 0) {
+	if (turns-- == 0) return false;
+	frame_swap_next();
+	ASSERT( current_frame != NULL );
+    }
+    return true;
+}
+
+/* Moves the clock hand to the victim under FRAME_WSCLOCK.  One turn
+   of the clock stamps accessed frames as used now and looks for a
+   frame outside its process's working set, idle for more than
+   FRAME_WS_TAU ticks.  A clean one is taken at once, since it may
+   need no write-back; failing that, the first idle dirty one; and
+   failing that, the unpinned frame idle longest, as in a clock.
+   A streaming frame is taken at once, like a clean idle one.
+   Frames not owned by ONLY, if it is non-null, are passed over.
+   Returns false if every frame is pinned or passed over.
+   all_lock must be held and the clock not empty. */
+static bool frame_pick_wsclock(struct pagedir_batch* batch, struct thread* only) {
+    int64_t now = timer_ticks();
+    struct frame_item* idle_dirty = NULL;
+    struct frame_item* oldest = NULL;
+    size_t n = list_size(&frame_clock_list);
+    while (n-- > 0) {
+	struct frame_item* f = current_frame;
+	if (f->pin_cnt == 0 && (only == NULL || f->t == only)) {
+	    if (frame_test_and_clear_accessed(f, batch)) f->last_use = now;
+	    if (f->streaming) return true;
+	    else if (now - f->last_use > FRAME_WS_TAU) {
+		if (!frame_is_dirty(f)) return true;
+		if (idle_dirty == NULL) idle_dirty = f;
+	    }
+	    if (oldest == NULL || f->last_use < oldest->last_use) oldest = f;
+	}
+	frame_swap_next();
+    }
+    if (idle_dirty == NULL) idle_dirty = oldest;
+    if (idle_dirty == NULL) return false;
+    current_frame = idle_dirty;
+    return true;
 }
 
 void frame_init(void) {
-    hash_init(&frame_table, frame_hash, frame_hash_less, NULL);
+    size_t user_frames = palloc_user_cnt();
+    frame_table = calloc(user_frames, sizeof *frame_table);
+    if (frame_table == NULL) PANIC("frame_init: cannot allocate frame table");
+    hash_init_sized(&frame_share_table, frame_share_hash, frame_share_less, NULL,
+		    user_frames / 4);
     list_init(&frame_clock_list);
-    lock_init(&all_lock);
+    lock_init_named(&all_lock, "all_lock");
+    slab_cache_init(&mapper_cache, "frame_mapper", sizeof(struct frame_mapper), NULL);
     current_frame = NULL;
+
+    pageout_low = user_frames / 32;
+    pageout_high = user_frames / 16;
+    sema_init(&pageout_sema, 0);
+    pageout_pending = false;
+    if (pageout_low > 0
+	&& thread_create("pageout", PRI_DEFAULT, pageout_daemon, NULL) == TID_ERROR)
+	PANIC("pageout thread creation failed");
 }
 
-void* frame_get(enum palloc_flags flag, void* upage) {
+/* Evicts T, a copy-on-write frame that frame_evict() has taken off
+   the clock and frame table, with page_lock and all_lock held.
+   Like a private frame, it is written out without either, but to
+   one swap slot that every mapper then shares.  Returns the frame,
+   or NULL if swap is full, having put T back.  Releases both
+   locks. */
+static void* frame_evict_cow(struct frame_item* t) {
+    struct list_elem* e;
+    void* frame = t->frame;
+    bool dirty;
+    lock_release(&all_lock);
+    for (e = list_begin(&t->mappers); e != list_end(&t->mappers); e = list_next(e)) {
+	struct frame_mapper* m = list_entry(e, struct frame_mapper, elem);
+	page_evict_begin(m->t, m->upage, &dirty);
+    }
+    page_table_unlock();
+
+    index_t index = swap_store(frame, SWAP_NONE);
+
+    page_table_lock();
+    for (e = list_begin(&t->mappers); e != list_end(&t->mappers); e = list_next(e)) {
+	struct frame_mapper* m = list_entry(e, struct frame_mapper, elem);
+	struct page_table_elem* pe = page_find(m->t->page_table, m->upage);
+	if (index == SWAP_NONE) page_evict_abort(m->t, pe, false);
+	else {
+	    if (e != list_begin(&t->mappers)) swap_dup(index);
+	    pe->cow = false;
+	    page_evict_end(pe, (void*) index, true);
+	}
+    }
+    if (index == SWAP_NONE) {
+	lock_acquire(&all_lock);
+	t->in_use = true;
+	t->t->frame_cnt++;
+	list_push_back(&frame_clock_list, &t->list_elem);
+	if (current_frame == NULL) current_frame = t;
+	lock_release(&all_lock);
+	frame = NULL;
+    } else {
+	while (!list_empty(&t->mappers))
+	    slab_free(&mapper_cache, list_entry(list_pop_front(&t->mappers), struct frame_mapper, elem));
+    }
+    page_table_unlock();
+    return frame;
+}
+
+/* Evicts a page picked by the clock and returns its frame, or
+   NULL if every frame is pinned or swap is full.  If ONLY is
+   non-null, the victim is one of the frames that process owns,
+   and NULL is also returned if it owns none that can go.
+
+   The victim is picked and unmapped under page_lock and
+   all_lock, but written back with neither held, so that other
+   page faults and frame operations go on during the disk I/O;
+   its owner waits only if it faults on the victim itself. */
+static void* frame_evict(struct thread* only) {
+    struct pagedir_batch batch;
+    bool picked;
+    page_table_lock();
     lock_acquire(&all_lock);
+    if (current_frame == NULL) {
+	lock_release(&all_lock);
+	page_table_unlock();
+	return NULL;
+    }
+    pagedir_batch_init(&batch);
+    picked = (policy == FRAME_WSCLOCK ? frame_pick_wsclock(&batch, only)
+	      : frame_pick_clock(&batch, only));
+    pagedir_batch_flush(&batch);
+    if (!picked) {
+	lock_release(&all_lock);
+	page_table_unlock();
+	return NULL;
+    }
+    struct frame_item* t = current_frame;
+    struct thread* owner = t->t;
+    void* upage = t->upage;
+    void* frame = t->frame;
+    list_remove(&t->list_elem);
+    if (list_empty(&frame_clock_list)) current_frame = NULL;
+    else frame_swap_next();
+    t->in_use = false;
+    owner->frame_cnt--;
+    if (t->inode != NULL) {
+	/* A shared page only has to be unmapped from every process,
+	   unless one of them wrote it since it was last written
+	   back.  Then it is written back to its file with page_lock
+	   still held, so that no process reads the page in from the
+	   file before its data gets there. */
+	struct mmap_handler* mh = NULL;
+	void* mh_upage = NULL;
+	hash_delete(&frame_share_table, &t->share_elem);
+	if (t->valid >= 0) inode_count_pages(t->inode, -1);
+	while (!list_empty(&t->mappers)) {
+	    struct frame_mapper* m = list_entry(list_pop_front(&t->mappers), struct frame_mapper, elem);
+	    struct page_table_elem* pe = page_find(m->t->page_table, m->upage);
+	    page_evict_shared(m->t, m->upage);
+	    /* Read after the unmapping, so no write can slip in. */
+	    if (mh == NULL && t->valid >= 0 && pagedir_is_dirty(m->t->pagedir, m->upage)) {
+		mh = pe->origin;
+		mh_upage = m->upage;
+	    }
+	    slab_free(&mapper_cache, m);
+	}
+	lock_release(&all_lock);
+	if (mh != NULL) mmap_write_file(mh, mh_upage, frame);
+	page_table_unlock();
+	return frame;
+    }
+    if (!list_empty(&t->mappers)) return frame_evict_cow(t);
+    lock_release(&all_lock);
+
+    bool dirty;
+    struct page_table_elem *e = page_evict_begin(owner, upage, &dirty);
+    struct mmap_handler *mh = e->origin;
+    bool to_swap = mh == NULL || mh->is_static_data;
+    index_t index = e->swap_slot;
+    index_t hint = to_swap && index == SWAP_NONE ? page_swap_hint(owner, upage) : SWAP_NONE;
+    page_table_unlock();
+
+    /* A clean page is only written if it has no copy yet: in the
+       swap slot it came from, or else in its file. */
+    if (to_swap) {
+	if (index != SWAP_NONE) {
+	    if (dirty) swap_rewrite(index, frame);
+	} else if (dirty || mh == NULL) index = swap_store(frame, hint);
+	else to_swap = false;
+    } else if (dirty) mmap_write_file(mh, upage, frame);
+
+    page_table_lock();
+    if (to_swap && index == SWAP_NONE) {
+	/* Out of swap: give the frame back to its owner. */
+	page_evict_abort(owner, e, dirty);
+	lock_acquire(&all_lock);
+	t->in_use = true;
+	owner->frame_cnt++;
+	t->last_use = timer_ticks();
+	list_push_back(&frame_clock_list, &t->list_elem);
+	if (current_frame == NULL) current_frame = t;
+	lock_release(&all_lock);
+	page_table_unlock();
+	return NULL;
+    }
+    page_evict_end(e, (void*) index, to_swap);
+    page_table_unlock();
+    return frame;
+}
+
+/* Returns a frame for OWNER's UPAGE, evicting a page if memory is
+   short.  An OWNER that holds as many frames as its frame_limit
+   gets one of its own pages' frames instead, if it has one the
+   clock can take, so that a process outgrowing its limit pages
+   against itself rather than against everybody else.  A null
+   OWNER leaves the frame charged to no process.  Must not be
+   called with page_lock held. */
+static void* frame_alloc(enum palloc_flags flag, void* upage, struct thread* owner) {
     ASSERT (pg_ofs (upage) == 0);
     ASSERT (is_user_vaddr (upage));
-    void *frame = palloc_get_page(PAL_USER | flag);
-    if (frame == NULL) {
-	ASSERT(current_frame != NULL);
-	while(pagedir_is_accessed(((struct thread*)(current_frame->t))->pagedir, current_frame->upage)) {
-	    pagedir_set_accessed(current_frame->t->pagedir, current_frame->upage, false);
-	    frame_swap_next();
-	    ASSERT( current_frame != NULL );
-	}
-	struct frame_item* t = current_frame;
-	frame = t->frame;
-	index_t index = (index_t)-1;
-	ASSERT(page_find(current_frame->t->page_table, current_frame->upage) != NULL);
-	struct page_table_elem *e = page_find(current_frame->t->page_table, current_frame->upage); 
-	if (e == NULL || e->origin == NULL || ((struct mmap_handler *)(e->origin))->is_static_data) {
-	    index = swap_store(current_frame->frame);
-	    if (index == -1) return NULL;
-	    ASSERT(page_status_exp(current_frame->t, current_frame->upage, (void*) index, true));
-	} else {
-	    mmap_write_file(e->origin, current_frame->upage, frame);
-	    ASSERT(page_status_exp(current_frame->t, current_frame->upage, (void*) index, false));
-	}
-	list_remove(&t->list_elem);
-	if (list_empty(&frame_clock_list)) current_frame = NULL;
-	else frame_swap_next();
-	hash_delete(&frame_table, &t->hash_elem);
-	free(t);
-	if (flag & PAL_ZERO) memset (frame, 0, PGSIZE);
-	if (flag & PAL_ASSERT) PANIC ("frame_get: out of pages");
+    KTRACE(KTRACE_FRAME_GET, (uintptr_t) upage);
+    void *frame = NULL;
+    bool evicted = false;
+    lock_acquire(&all_lock);
+    bool over = (owner != NULL && owner->frame_limit > 0
+		 && owner->frame_cnt >= owner->frame_limit);
+    lock_release(&all_lock);
+    if (over) {
+	frame = frame_evict(owner);
+	evicted = frame != NULL;
     }
     if (frame == NULL) {
+	lock_acquire(&all_lock);
+	frame = palloc_get_page(PAL_USER | flag);
+	/* Take back pages the buffer cache borrowed before evicting. */
+	while (frame == NULL && cache_shrink())
+	    frame = palloc_get_page(PAL_USER | flag);
+	if (palloc_free_cnt(PAL_USER) < pageout_low && !pageout_pending) {
+	    pageout_pending = true;
+	    sema_up(&pageout_sema);
+	}
 	lock_release(&all_lock);
-	return NULL;
+	if (frame == NULL) {
+	    frame = frame_evict(NULL);
+	    if (frame == NULL) {
+		if (flag & PAL_ASSERT) PANIC ("frame_get: out of pages");
+		KTRACE(KTRACE_FRAME_GET_DONE, (uintptr_t) upage, 0);
+		return NULL;
+	    }
+	    evicted = true;
+	}
     }
+    /* An evicted frame still holds its old page. */
+    if (evicted && (flag & PAL_ZERO)) memset (frame, 0, PGSIZE);
     ASSERT(pg_ofs(frame) == 0);
-    struct frame_item* tmp = (struct frame_item*) malloc(sizeof(struct frame_item));
+    size_t i = palloc_user_index(frame);
+    ASSERT(i != SIZE_MAX);
+    struct frame_item* tmp = &frame_table[i];
+    lock_acquire(&all_lock);
+    ASSERT(!tmp->in_use);
     tmp->frame = frame;
     tmp->upage = upage;
-    tmp->t = thread_current();
+    tmp->t = owner;
+    if (owner != NULL) owner->frame_cnt++;
     tmp->swapable = true;
-    hash_insert(&frame_table, &tmp->hash_elem);
+    tmp->pin_cnt = 0;
+    tmp->last_use = timer_ticks();
+    tmp->streaming = false;
+    tmp->inode = NULL;
+    list_init(&tmp->mappers);
+    tmp->in_use = true;
     lock_release(&all_lock);
+    KTRACE(KTRACE_FRAME_GET_DONE, (uintptr_t) upage, (uintptr_t) frame);
     return frame;
 }
 
+/* Returns a frame for the current process's UPAGE, charged to
+   it.  See frame_alloc(). */
+void* frame_get(enum palloc_flags flag, void* upage) {
+    return frame_alloc(flag, upage, process_current());
+}
+
+/* Returns a frame charged to no process, for memory that outlives
+   the process that asks for it, such as a shared memory object.
+   It counts against no frame_limit.  It must never go on the
+   clock, as eviction needs an owner, and is released with
+   frame_free(). */
+void* frame_get_unowned(enum palloc_flags flag) {
+    return frame_alloc(flag, NULL, NULL);
+}
+
+/* Refills the free-frame reserve each time frame_get() finds it
+   below pageout_low.  Gives up early if the clock finds nothing
+   it can evict, rather than spinning on pinned frames. */
+static void pageout_daemon(void *aux UNUSED) {
+    block_set_io_class(BLOCK_IO_WRITEBACK);
+    for (;;) {
+	sema_down(&pageout_sema);
+	while (palloc_free_cnt(PAL_USER) < pageout_high) {
+	    void *frame = frame_evict(NULL);
+	    if (frame == NULL) break;
+	    palloc_free_page(frame);
+	}
+	lock_acquire(&all_lock);
+	pageout_pending = false;
+	lock_release(&all_lock);
+    }
+}
+
+/* Returns the frame_item of FRAME, or NULL if it is not an
+   allocated frame.  all_lock must be held. */
 struct frame_item* frame_get_item(void *frame) {
-    struct frame_item p;
-    struct hash_elem * e;
-    p.frame = frame;
-    e = hash_find(&frame_table, &p.hash_elem);
-    if (e) return hash_entry(e, struct frame_item, hash_elem);
-    else return NULL;
+    size_t i = palloc_user_index(frame);
+    return i != SIZE_MAX && frame_table[i].in_use ? &frame_table[i] : NULL;
 }
 
+/* Releases the current thread's FRAME.  A shared or copy-on-write
+   frame is only given back once its last mapper releases it.  An
+   unowned frame may be released by any thread. */
 void frame_free(void *frame) {
     lock_acquire(&all_lock);
     struct frame_item* t = frame_get_item(frame);
     if (t == NULL) PANIC("try_free_a frame_that_not_exist!!");
+    if (!list_empty(&t->mappers)) {
+	struct thread* cur = process_current();
+	struct list_elem* e;
+	for (e = list_begin(&t->mappers); e != list_end(&t->mappers); e = list_next(e))
+	    if (list_entry(e, struct frame_mapper, elem)->t == cur) break;
+	ASSERT(e != list_end(&t->mappers));
+	list_remove(e);
+	slab_free(&mapper_cache, list_entry(e, struct frame_mapper, elem));
+	if (!list_empty(&t->mappers)) {
+	    struct frame_mapper* m = list_entry(list_front(&t->mappers), struct frame_mapper, elem);
+	    t->t->frame_cnt--;
+	    m->t->frame_cnt++;
+	    t->t = m->t;
+	    t->upage = m->upage;
+	    lock_release(&all_lock);
+	    return;
+	}
+	if (t->inode != NULL) {
+	    hash_delete(&frame_share_table, &t->share_elem);
+	    if (t->valid >= 0) inode_count_pages(t->inode, -1);
+	}
+    }
     if (!t->swapable) {
 	if (current_frame == t) {
 	    if (list_empty(&frame_clock_list)) current_frame = NULL;
@@ -113,12 +498,24 @@ void frame_free(void *frame) {
 	}
 	list_remove(&t->list_elem);
     }
-    hash_delete(&frame_table, &t->hash_elem);
-    free(t);
+    t->in_use = false;
+    if (t->t != NULL) t->t->frame_cnt--;
     palloc_free_page(frame);
     lock_release(&all_lock);
 }
 
+/* Stores the number of frames in the frame table in *FRAMES and
+   the number holding a user page in *USED. */
+void frame_get_stats(size_t* frames, size_t* used) {
+    size_t i, n = palloc_user_cnt();
+    *used = 0;
+    lock_acquire(&all_lock);
+    for (i = 0; i < n; i++)
+	if (frame_table[i].in_use) (*used)++;
+    lock_release(&all_lock);
+    *frames = n;
+}
+
 bool frame_set_unswapable(void* frame) {
     lock_acquire(&all_lock);
     struct frame_item* t = frame_get_item(frame);
@@ -137,3 +534,200 @@ bool frame_set_unswapable(void* frame) {
     return true;
 }
 
+/* Marks FRAME as STREAMING or not: a page of a mapping read once
+   in order, which the clock takes before pages that are used
+   again, so that streaming through a big file does not push out
+   the working sets of other processes. */
+void frame_set_streaming(void* frame, bool streaming) {
+    lock_acquire(&all_lock);
+    struct frame_item* t = frame_get_item(frame);
+    if (t != NULL) t->streaming = streaming;
+    lock_release(&all_lock);
+}
+
+/* Keeps FRAME, which must hold the current thread's UPAGE, from
+   being evicted until frame_unpin().  Pins nest.  Returns false
+   if FRAME no longer holds UPAGE, having been evicted since the
+   caller looked it up. */
+bool frame_pin(void *frame, void *upage) {
+    lock_acquire(&all_lock);
+    struct frame_item* t = frame_get_item(frame);
+    bool success = t != NULL && frame_mapped_by(t, process_current(), upage);
+    if (success) t->pin_cnt++;
+    lock_release(&all_lock);
+    return success;
+}
+
+/* Undoes one frame_pin() of FRAME. */
+void frame_unpin(void *frame) {
+    lock_acquire(&all_lock);
+    struct frame_item* t = frame_get_item(frame);
+    ASSERT(t != NULL && t->pin_cnt > 0);
+    t->pin_cnt--;
+    lock_release(&all_lock);
+}
+
+/* Returns the frame_item sharing the page at byte OFS of INODE,
+   or NULL if there is none.  all_lock must be held. */
+static struct frame_item* frame_share_lookup(struct inode* inode, off_t ofs) {
+    struct frame_item key;
+    struct hash_elem* e;
+    key.inode = inode;
+    key.ofs = ofs;
+    e = hash_find(&frame_share_table, &key.share_elem);
+    return e != NULL ? hash_entry(e, struct frame_item, share_elem) : NULL;
+}
+
+/* Looks for the frame holding the page at byte OFS of INODE for
+   some process, as set up by frame_share() with the same kind of
+   VALID, and with at least VALID bytes of the file if that is not
+   -1.  If there is one, maps it for the current thread at UPAGE
+   and returns it; the caller installs it, read-only for the page
+   of an executable.  page_lock must be held. */
+void* frame_share_find(struct inode* inode, off_t ofs, off_t valid, void* upage) {
+    struct frame_item* t;
+    void* frame = NULL;
+    lock_acquire(&all_lock);
+    t = frame_share_lookup(inode, ofs);
+    /* A process mapping one page twice keeps a frame for each,
+       since frame_free() tells mappers apart by thread. */
+    if (t != NULL && (t->valid < 0) == (valid < 0) && t->valid >= valid
+	&& !frame_mapped_by_thread(t, process_current())) {
+	struct frame_mapper* m = slab_alloc(&mapper_cache);
+	if (m != NULL) {
+	    m->t = process_current();
+	    m->upage = upage;
+	    list_push_back(&t->mappers, &m->elem);
+	    frame = t->frame;
+	}
+    }
+    lock_release(&all_lock);
+    return frame;
+}
+
+/* Offers FRAME, which the current thread has just filled with the
+   page at byte OFS of INODE, to other processes mapping the same
+   page.  VALID is -1 for a read-only page of an executable, or
+   else the number of bytes of the file's data the page holds.
+   Returns false, leaving FRAME private, if out of memory or if
+   another frame already shares the page, as it may if it was
+   found unsuitable by frame_share_find().  page_lock must be
+   held. */
+bool frame_share(void* frame, struct inode* inode, off_t ofs, off_t valid) {
+    struct frame_mapper* m = slab_alloc(&mapper_cache);
+    if (m == NULL) return false;
+    lock_acquire(&all_lock);
+    struct frame_item* t = frame_get_item(frame);
+    ASSERT(t != NULL && t->inode == NULL && t->t == process_current());
+    t->inode = inode;
+    t->ofs = ofs;
+    t->valid = valid;
+    if (hash_insert(&frame_share_table, &t->share_elem) != NULL) {
+	t->inode = NULL;
+	lock_release(&all_lock);
+	slab_free(&mapper_cache, m);
+	return false;
+    }
+    m->t = t->t;
+    m->upage = t->upage;
+    list_push_back(&t->mappers, &m->elem);
+    if (valid >= 0) inode_count_pages(inode, 1);
+    lock_release(&all_lock);
+    return true;
+}
+
+/* Copies to DST up to SIZE bytes of INODE at OFS, but not past the
+   end of its page, from the frame of an mmap'd file holding that
+   page, if there is one.  The frame may hold data written through
+   a mapping and not yet written back, which this way a read of
+   the file sees at once.  Returns the number of bytes copied, or
+   0 if there is no such frame and the file system must read the
+   data itself.  DST must not fault: it is kernel memory or a
+   pinned user buffer. */
+off_t frame_file_read(struct inode* inode, void* dst, off_t ofs, off_t size) {
+    struct frame_item* t;
+    off_t n = 0;
+    lock_acquire(&all_lock);
+    t = frame_share_lookup(inode, ofs - pg_ofs((void*) ofs));
+    if (t != NULL && t->valid > (off_t) pg_ofs((void*) ofs)) {
+	n = t->valid - pg_ofs((void*) ofs);
+	if (n > size) n = size;
+	memmove(dst, (uint8_t*) t->frame + pg_ofs((void*) ofs), n);
+    }
+    lock_release(&all_lock);
+    return n;
+}
+
+/* Copies SIZE bytes at SRC, which the file system has just written
+   to INODE at OFS, into the frame of an mmap'd file holding that
+   page, if there is one, so that processes mapping it see the
+   write.  The bytes must all lie in one page.  SRC must not fault,
+   as for frame_file_read().  Writes back from frames go through
+   inode_write_back_at(), which does not call this. */
+void frame_file_write(struct inode* inode, const void* src, off_t ofs, off_t size) {
+    struct frame_item* t;
+    off_t page_ofs = pg_ofs((void*) ofs);
+    ASSERT(page_ofs + size <= PGSIZE);
+    lock_acquire(&all_lock);
+    t = frame_share_lookup(inode, ofs - page_ofs);
+    if (t != NULL && t->valid >= 0) {
+	memmove((uint8_t*) t->frame + page_ofs, src, size);
+	if (page_ofs <= t->valid && page_ofs + size > t->valid) t->valid = page_ofs + size;
+    }
+    lock_release(&all_lock);
+}
+
+/* Maps FRAME, which some process maps at UPAGE, for T at UPAGE too,
+   as fork does for every resident page.  A private frame becomes
+   copy-on-write, to be mapped read-only by both until one of them
+   writes it.  Returns false if out of memory.  page_lock must be
+   held. */
+bool frame_cow_share(void* frame, struct thread* t, void* upage) {
+    struct frame_mapper* m = slab_alloc(&mapper_cache);
+    struct frame_mapper* owner = slab_alloc(&mapper_cache);
+    if (m == NULL || owner == NULL) {
+	slab_free(&mapper_cache, m);
+	slab_free(&mapper_cache, owner);
+	return false;
+    }
+    lock_acquire(&all_lock);
+    struct frame_item* f = frame_get_item(frame);
+    ASSERT(f != NULL);
+    if (list_empty(&f->mappers)) {
+	owner->t = f->t;
+	owner->upage = f->upage;
+	list_push_back(&f->mappers, &owner->elem);
+	owner = NULL;
+    }
+    m->t = t;
+    m->upage = upage;
+    list_push_back(&f->mappers, &m->elem);
+    lock_release(&all_lock);
+    slab_free(&mapper_cache, owner);
+    return true;
+}
+
+/* Makes FRAME, a copy-on-write frame of the current thread, private
+   to it if no other process maps it any more, and returns whether
+   it is now private.  page_lock must be held. */
+bool frame_cow_claim(void* frame) {
+    bool sole;
+    lock_acquire(&all_lock);
+    struct frame_item* f = frame_get_item(frame);
+    ASSERT(f != NULL && f->inode == NULL);
+    sole = list_size(&f->mappers) <= 1;
+    if (!list_empty(&f->mappers)) {
+	struct frame_mapper* m = list_entry(list_front(&f->mappers), struct frame_mapper, elem);
+	if (sole) {
+	    ASSERT(m->t == process_current());
+	    f->t->frame_cnt--;
+	    m->t->frame_cnt++;
+	    f->t = m->t;
+	    f->upage = m->upage;
+	    list_remove(&m->elem);
+	    slab_free(&mapper_cache, m);
+	}
+    }
+    lock_release(&all_lock);
+    return sole;
+}
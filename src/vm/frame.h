@@ -2,22 +2,64 @@
 #define VM_FRAME_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <list.h>
 #include <hash.h>
 #include "../threads/palloc.h"
+#include "filesys/off_t.h"
+
+struct inode;
+
+/* A process mapping a shared or copy-on-write frame. */
+struct frame_mapper {
+    struct thread* t;
+    void* upage;
+    struct list_elem elem;
+};
+
+/* Page replacement policies. */
+enum frame_policy {
+    FRAME_CLOCK,              /* Second chance on the accessed bits. */
+    FRAME_WSCLOCK             /* Also prefers pages idle longer than
+                                 FRAME_WS_TAU, and clean ones. */
+};
 
 struct frame_item {
     void* frame;
     void* upage;
     struct thread* t;
     bool swapable;
-    struct hash_elem hash_elem;
+    int pin_cnt;              /* While positive, the clock skips this frame. */
+    int64_t last_use;         /* Timer tick it was last seen accessed. */
+    bool streaming;           /* Of a mapping advised MADV_SEQUENTIAL, so
+                                 evicted with no second chance. */
+    struct inode* inode;      /* If shared, the file page it holds, */
+    off_t ofs;                /* ...at OFS; else NULL. */
+    off_t valid;              /* If a page of an mmap'd file, how many bytes
+                                 at OFS match the file; -1 for a read-only
+                                 page of an executable. */
+    struct list mappers;      /* If shared or copy-on-write since a fork,
+                                 its frame_mappers; else empty. */
+    struct hash_elem share_elem;  /* If shared, element in frame_share_table. */
+    bool in_use;              /* Whether it describes an allocated frame. */
     struct list_elem list_elem;
 };
 
+bool frame_set_policy(const char* name);
 void frame_init(void);
 void* frame_get(enum palloc_flags flag, void *upage);
+void* frame_get_unowned(enum palloc_flags flag);
 void frame_free(void *frame);
+void frame_get_stats(size_t* frames, size_t* used);
 bool frame_set_unswapable(void* frame);
+void frame_set_streaming(void* frame, bool streaming);
+bool frame_pin(void *frame, void *upage);
+void* frame_share_find(struct inode* inode, off_t ofs, off_t valid, void* upage);
+bool frame_share(void* frame, struct inode* inode, off_t ofs, off_t valid);
+off_t frame_file_read(struct inode* inode, void* dst, off_t ofs, off_t size);
+void frame_file_write(struct inode* inode, const void* src, off_t ofs, off_t size);
+bool frame_cow_share(void* frame, struct thread* t, void* upage);
+bool frame_cow_claim(void* frame);
+void frame_unpin(void *frame);
 
 #endif /* vm/frame.h */
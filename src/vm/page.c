@@ -1,141 +1,784 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <debug.h>
 #include <stddef.h>
-#include <hash.h>
+#include <string.h>
+#include <ptrmap.h>
+#include <syscall-nr.h>
 #include "page.h"
 #include "frame.h"
+#include "shm.h"
 #include "swap.h"
+#include "filesys/file.h"
 #include "userprog/pagedir.h"
+#include "userprog/process.h"
 #include "userprog/syscall.h"
+#include "threads/ktrace.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/slab.h"
+#include "threads/workqueue.h"
 
 #define PAGE_PAL_FLAG			0
 #define PAGE_INST_MARGIN		32
 #define PAGE_STACK_SIZE			0x800000
 #define PAGE_STACK_UNDERLINE	(PHYS_BASE - PAGE_STACK_SIZE)
 
+/* Most pages brought in after a faulting one, and the number of
+   user frames that must stay free for any of them to be. */
+#define PAGE_AROUND_MAX			8
+#define PAGE_AROUND_RESERVE		32
+
+/* Pages brought in after each fault in a region advised
+   MADV_SEQUENTIAL. */
+#define PAGE_AROUND_SEQUENTIAL		32
+
+/* How many pages ahead of the one it is reading MADV_WILLNEED
+   queues file sectors with the buffer cache's read-ahead thread. */
+#define PAGE_PREFETCH_AHEAD		4
+
 static struct lock page_lock;
 
-bool page_hash_less(const struct hash_elem* lhs, const struct hash_elem* rhs, void *aux UNUSED) {
-    return hash_entry(lhs, struct page_table_elem, elem)->key < hash_entry(rhs, struct page_table_elem, elem)->key;
-}
+/* Supplemental page table entries. */
+static struct slab_cache pte_cache;
+
+/* Broadcast under page_lock whenever an EVICTING page settles. */
+static struct condition evict_done;
+
+/* A kernel page of zeros that every ZERO page maps read-only until
+   its first write. */
+static void* zero_frame;
+
+/* -vmstat: print each process's paging counters as it exits. */
+static bool exit_report;
+
+/* Swap compaction.  Pages that one process swapped out at
+   different times can land far apart on the swap device, so that
+   fault-around seeks between them.  While the CPU is idle, after
+   slots have been freed, the compactor moves swapped-out pages
+   into the free slot just after that of the page below them,
+   process by process, PAGE_COMPACT_BATCH pages per work item at
+   the lowest priority.  A page is EVICTING while it moves, so
+   faults on it wait as they do for an eviction. */
+#define PAGE_COMPACT_BATCH		8
+
+static struct idle_work compact_hook;
+static struct workqueue compact_wq;
+static struct work compact_work;
+static bool compact_wanted;	/* Worth another work item? */
+static bool compact_moved;	/* Moved a page in this pass? */
+static tid_t compact_tid;	/* Process the pass is past. */
 
-unsigned page_hash(const struct hash_elem* e, void* aux UNUSED){
-    struct page_table_elem *t = hash_entry(e, struct page_table_elem, elem);
-    return hash_bytes(&(t->key), sizeof(t->key));
+static void page_sync_pages(struct mmap_handler *mh, uint8_t *first, uint8_t *end);
+static bool page_unmap_pages(uint8_t *first, uint8_t *end);
+
+static idle_work_func page_compact_idle;
+static work_func page_swap_compact;
+
+/* Maps UPAGE to KPAGE in PD, panicking if PD has no memory for
+   the page table.  A call, not an ASSERT, so that NDEBUG builds
+   still map the page. */
+static void page_map(uint32_t* pd, void* upage, void* kpage, bool writable) {
+    if (!pagedir_set_page(pd, upage, kpage, writable)) PANIC("page: cannot map %p", upage);
 }
 
-struct page_table_elem* page_find(struct hash* page_table, void* upage) {
-    struct hash_elem *e;
-    struct page_table_elem tmp;
+struct page_table_elem* page_find(struct ptrmap* page_table, void* upage) {
     ASSERT(page_table != NULL);
-    tmp.key = upage;
-    e = hash_find(page_table, &(tmp.elem));
-    if(e != NULL) return hash_entry(e, struct page_table_elem, elem);
-    else return NULL;
+    return ptrmap_find(page_table, upage);
 }
 
-bool page_upage_accessable(struct hash *page_table, void* upage) {
+bool page_upage_accessable(struct ptrmap *page_table, void* upage) {
     return upage < PAGE_STACK_UNDERLINE && page_find(page_table, upage) == NULL;
 }
 
-bool page_status_exp(struct thread *cur, void* upage, void* index, bool to_swap) {
-    struct page_table_elem* t = page_find(cur->page_table, upage);
-    bool success = true;
-    if(t != NULL && t->status == FRAME) {
-	if(to_swap) {
-	    t->value = index;
-	    t->status = SWAP;
-	} else {
-	    ASSERT(t->origin != NULL);
-	    t->value = t->origin;
-	    t->status = FILE;
-	}
-	pagedir_clear_page(cur->pagedir, upage);
+/* Acquires and releases the lock over every page table.  The
+   frame table takes it before its own lock when evicting. */
+void page_table_lock(void) {
+    lock_acquire(&page_lock);
+}
+
+void page_table_unlock(void) {
+    lock_release(&page_lock);
+}
+
+/* Starts evicting OWNER's resident UPAGE: unmaps it, so that OWNER
+   faults on it, and marks it EVICTING, so that the fault waits
+   for page_evict_end() rather than touching the frame while it is
+   written out.  page_lock must be held; it can be dropped until
+   page_evict_end(), which the caller must call with it held.
+   Sets *DIRTY to whether UPAGE was written since it was loaded;
+   the bit is read after the unmapping, so no write can slip in
+   after it. */
+struct page_table_elem* page_evict_begin(struct thread *owner, void* upage, bool* dirty) {
+    ASSERT(lock_held_by_current_thread(&page_lock));
+    struct page_table_elem* t = page_find(owner->page_table, upage);
+    ASSERT(t != NULL && t->status == FRAME);
+    t->status = EVICTING;
+    pagedir_clear_page(owner->pagedir, upage);
+    *dirty = pagedir_is_dirty(owner->pagedir, upage);
+    owner->vm_stats.evictions++;
+    return t;
+}
+
+/* Returns the swap slot UPAGE of OWNER would best go to: next to
+   the slot of a neighbouring page already in swap, so that the
+   two can be read back together, or SWAP_NONE if neither
+   neighbour is.  page_lock must be held. */
+index_t page_swap_hint(struct thread* owner, void* upage) {
+    ASSERT(lock_held_by_current_thread(&page_lock));
+    struct page_table_elem* t;
+    if(upage >= (void *) PGSIZE) {
+	t = page_find(owner->page_table, upage - PGSIZE);
+	if(t != NULL && t->status == SWAP) return (index_t) t->value + PGSIZE / BLOCK_SECTOR_SIZE;
+    }
+    t = page_find(owner->page_table, upage + PGSIZE);
+    if(t != NULL && t->status == SWAP && (index_t) t->value >= PGSIZE / BLOCK_SECTOR_SIZE)
+	return (index_t) t->value - PGSIZE / BLOCK_SECTOR_SIZE;
+    return SWAP_NONE;
+}
+
+/* Finishes evicting E, now in swap slot VALUE if TO_SWAP or back
+   in its file otherwise, and wakes up threads waiting for it. */
+void page_evict_end(struct page_table_elem* e, void* value, bool to_swap) {
+    ASSERT(lock_held_by_current_thread(&page_lock));
+    ASSERT(e->status == EVICTING);
+    e->swap_slot = SWAP_NONE;
+    if(to_swap) {
+	e->value = value;
+	e->status = SWAP;
     } else {
-	if (t != NULL) printf("%s\n", t->status == FILE ? "flie" : "swap");
-	else puts("NULL");
-	success = false;
+	ASSERT(e->origin != NULL);
+	e->value = e->origin;
+	e->status = FILE;
     }
-    return success;
+    cond_broadcast(&evict_done, &page_lock);
 }
 
-bool page_install_file(struct hash *page_table, struct mmap_handler *mh, void *key) {
+/* Unmaps OWNER's UPAGE, which maps a shared file page that is
+   being evicted, and leaves it to be read in again from the file.
+   The dirty bit stays readable until the page is next mapped.
+   page_lock must be held. */
+void page_evict_shared(struct thread* owner, void* upage) {
+    ASSERT(lock_held_by_current_thread(&page_lock));
+    struct page_table_elem* t = page_find(owner->page_table, upage);
+    ASSERT(t != NULL && t->status == FRAME && t->origin != NULL);
+    pagedir_clear_page(owner->pagedir, upage);
+    t->value = t->origin;
+    t->status = FILE;
+    owner->vm_stats.evictions++;
+}
+
+/* Gives up evicting E, whose frame is still E->value, mapping it
+   back into OWNER's page directory, DIRTY as it was. */
+void page_evict_abort(struct thread* owner, struct page_table_elem* e, bool dirty) {
+    ASSERT(lock_held_by_current_thread(&page_lock));
+    ASSERT(e->status == EVICTING);
+    e->status = FRAME;
+    owner->vm_stats.evictions--;
+    page_map(owner->pagedir, e->key, e->value, e->writable && !e->cow);
+    pagedir_set_dirty(owner->pagedir, e->key, dirty);
+    cond_broadcast(&evict_done, &page_lock);
+}
+
+/* Waits until no page in PAGE_TABLE is EVICTING.  page_lock must
+   be held. */
+static void page_wait_evictions(struct ptrmap* page_table) {
+    struct ptrmap_iterator i;
+    struct page_table_elem *e;
+    bool busy;
+    do {
+	busy = false;
+	ptrmap_first(&i, page_table);
+	while(!busy && (e = ptrmap_next(&i)) != NULL)
+	    busy = e->status == EVICTING;
+	if(busy) cond_wait(&evict_done, &page_lock);
+    } while(busy);
+}
+
+/* Fills CHILD's empty page table and page directory with a copy of
+   PARENT's address space, as fork does.  Resident pages are shared
+   copy-on-write and swapped-out ones share their slot; pages of
+   mmap'd files are written back and left to the child to read in,
+   since both processes write the same file.  CHILD must be the
+   current thread, with a copy of each of PARENT's mmap handlers
+   under the same mapid, and PARENT must be waiting for it.
+   Returns false if out of memory, leaving CHILD's tables for
+   page_teardown() to free. */
+bool page_fork(struct thread *parent, struct thread *child) {
+    struct ptrmap_iterator i;
+    struct page_table_elem *p;
     bool success = true;
+    ASSERT(child == thread_current());
     lock_acquire(&page_lock);
-    if(page_upage_accessable(page_table, key)) {
-	struct page_table_elem *e = malloc(sizeof(*e));
-	e->key = key;
-	e->value = mh;
-	e->status = FILE;
-	e->writable = mh->writable;
-	e->origin = mh;
-	hash_insert(page_table, &e->elem);
-    } else success = false;
+    page_wait_evictions(parent->page_table);
+    /* Sized up front, so that no insertion below can fail. */
+    if(!ptrmap_reserve(child->page_table, ptrmap_size(parent->page_table))) {
+	lock_release(&page_lock);
+	return false;
+    }
+    ptrmap_first(&i, parent->page_table);
+    while(success && (p = ptrmap_next(&i)) != NULL) {
+	struct mmap_handler *pmh = p->origin;
+	struct page_table_elem *c = slab_alloc(&pte_cache);
+	if(c == NULL) {
+	    success = false;
+	    break;
+	}
+	*c = *p;
+	c->swap_slot = SWAP_NONE;
+	if(pmh != NULL) {
+	    c->origin = syscall_get_mmap_handle(pmh->mapid);
+	    ASSERT(c->origin != NULL);
+	}
+	switch(p->status) {
+	    case FILE:
+		c->value = c->origin;
+		break;
+	    case ZERO:
+		if(!pagedir_set_page(child->pagedir, c->key, zero_frame, false)) {
+		    slab_free(&pte_cache, c);
+		    c = NULL;
+		    success = false;
+		}
+		break;
+	    case SWAP:
+		swap_dup((index_t) p->value);
+		break;
+	    case SHARED:
+		/* Still shared, not copy-on-write. */
+		if(!pagedir_set_page(child->pagedir, c->key, c->value, c->writable)) success = false;
+		break;
+	    case FRAME:
+		if(pmh != NULL && !pmh->is_segment) {
+		    if(pagedir_is_dirty(parent->pagedir, p->key)) {
+			mmap_write_file(pmh, p->key, p->value);
+			pagedir_set_dirty(parent->pagedir, p->key, false);
+		    }
+		    c->value = c->origin;
+		    c->status = FILE;
+		    break;
+		}
+		if(!frame_cow_share(p->value, child, c->key)) {
+		    slab_free(&pte_cache, c);
+		    c = NULL;
+		    success = false;
+		    break;
+		}
+		if(p->writable && !p->cow) {
+		    /* Writes now fault, to copy the page first.  A slot
+		       it came from no longer matches every sharer. */
+		    pagedir_clear_page(parent->pagedir, p->key);
+		    page_map(parent->pagedir, p->key, p->value, false);
+		    if(p->swap_slot != SWAP_NONE) swap_free(p->swap_slot);
+		    p->swap_slot = SWAP_NONE;
+		    p->cow = true;
+		}
+		c->cow = p->cow;
+		if(!pagedir_set_page(child->pagedir, c->key, c->value, false)) success = false;
+		break;
+	    default:
+		NOT_REACHED();
+	}
+	if(c != NULL && !ptrmap_insert(child->page_table, c->key, c)) PANIC("page_fork: out of memory");
+    }
     lock_release(&page_lock);
     return success;
 }
 
+/* Returns CUR's page table entry for UPAGE, or NULL if it has
+   none.  A page of an mmap region gets its entry, as a FILE page,
+   only when first looked up here: the mmap handler describes the
+   whole region, so mapping a file costs no memory per page until
+   its pages are used.  Shared memory regions have entries for
+   every page for as long as they are mapped.  page_lock must be
+   held. */
+static struct page_table_elem* page_lookup(struct thread *cur, void *upage) {
+    struct page_table_elem *e = page_find(cur->page_table, upage);
+    struct mmap_handler *mh;
+    ASSERT(lock_held_by_current_thread(&page_lock));
+    if(e != NULL || (mh = mmap_find_region(cur, upage)) == NULL || mh->shm != NULL) return e;
+    e = slab_alloc(&pte_cache);
+    if(e == NULL) return NULL;
+    e->key = upage;
+    e->value = mh;
+    e->status = FILE;
+    e->writable = mh->writable;
+    e->origin = mh;
+    e->swap_slot = SWAP_NONE;
+    e->cow = false;
+    if(!ptrmap_insert(cur->page_table, upage, e)) {
+	slab_free(&pte_cache, e);
+	return NULL;
+    }
+    return e;
+}
+
+void page_set_exit_report(bool on) {
+    exit_report = on;
+}
+
+/* Copies the current process's paging counters to STATS, counting
+   the pages it has in frames and in swap. */
+void page_get_stats(struct vm_stats* stats) {
+    struct thread *cur = process_current();
+    struct ptrmap_iterator i;
+    struct page_table_elem *e;
+    lock_acquire(&page_lock);
+    *stats = cur->vm_stats;
+    stats->resident = stats->swapped = 0;
+    ptrmap_first(&i, cur->page_table);
+    while((e = ptrmap_next(&i)) != NULL) {
+	if(e->status == FRAME || e->status == SHARED) stats->resident++;
+	else if(e->status == SWAP || e->status == EVICTING) stats->swapped++;
+    }
+    lock_release(&page_lock);
+}
+
+/* Prints the current process's paging counters if -vmstat was
+   given.  Called as it exits, before its pages are freed. */
+void page_exit_report(void) {
+    struct vm_stats s;
+    if(!exit_report || process_current()->page_table == NULL) return;
+    page_get_stats(&s);
+    printf("%s: vm: %u minor faults, %u major faults, %u evictions, "
+	   "%u resident, %u swapped\n", thread_name(), s.minor_faults,
+	   s.major_faults, s.evictions, s.resident, s.swapped);
+}
+
 void page_init() {
-    lock_init(&page_lock);
+    lock_init_named(&page_lock, "page_lock");
+    slab_cache_init(&pte_cache, "page_table_elem",
+		    sizeof(struct page_table_elem), NULL);
+    cond_init(&evict_done);
+    zero_frame = palloc_get_page(PAL_ASSERT | PAL_ZERO);
+    workqueue_init(&compact_wq, "swap-compact", PRI_MIN);
+    work_init(&compact_work, page_swap_compact);
+    thread_add_idle_work(&compact_hook, page_compact_idle);
 }
 
-void page_destroy_std(struct hash_elem* e, void* aux UNUSED) {
-    struct page_table_elem* t = hash_entry(e, struct page_table_elem, elem);
-    if(t->status == FRAME) {
-	struct thread* cur = thread_current();
-	pagedir_clear_page(cur->pagedir, t->key);
-	frame_free(t->value);
-    } else if(t->status == SWAP) swap_free((off_t) t->value);
-    free(t);
+/* Idle work: queues a compaction pass if slots have been freed or
+   the last one left more to do. */
+static bool page_compact_idle(void) {
+    if(swap_take_holes()) compact_wanted = true;
+    if(compact_wanted) {
+	compact_wanted = false;
+	work_queue(&compact_wq, &compact_work);
+    }
+    return false;
 }
 
-void page_destroy(struct hash* page_table) {
+/* Finds a page of OWNER worth moving: one alone in a slot of the
+   swap device, whose neighbour below is in a slot that the next
+   one after is free.  Stores that free slot in *TO.  page_lock
+   must be held. */
+static struct page_table_elem* page_compact_find(struct thread* owner, index_t* to) {
+    struct ptrmap_iterator i;
+    struct page_table_elem *e, *below;
+    ptrmap_first(&i, owner->page_table);
+    while((e = ptrmap_next(&i)) != NULL) {
+	if(e->status != SWAP || is_kernel_vaddr(e->value) || e->key < (void *) PGSIZE) continue;
+	below = page_find(owner->page_table, e->key - PGSIZE);
+	if(below == NULL || below->status != SWAP || is_kernel_vaddr(below->value)) continue;
+	*to = (index_t) below->value + PGSIZE / BLOCK_SECTOR_SIZE;
+	if((index_t) e->value != *to && swap_movable((index_t) e->value, *to)) return e;
+    }
+    return NULL;
+}
+
+/* What page_compact_pick() looks for. */
+struct compact_pick {
+    tid_t after;		/* Tid the pass is past. */
+    struct thread* t;		/* Process found, or NULL. */
+};
+
+/* Picks T for PICK if it is the first process past PICK's tid
+   that has a page table. */
+static void page_compact_pick(struct thread* t, void* pick_) {
+    struct compact_pick* pick = pick_;
+    if(t->leader == t && t->page_table != NULL && t->tid > pick->after
+       && (pick->t == NULL || t->tid < pick->t->tid))
+	pick->t = t;
+}
+
+/* Work item: moves up to PAGE_COMPACT_BATCH pages, taking the
+   processes in tid order and going on where the last item
+   stopped.  A process stays put while page_lock is held: its
+   page_teardown() needs the lock, and also waits for any page
+   left EVICTING while the lock is dropped to move one. */
+static void page_swap_compact(struct work* w UNUSED) {
+    void* buffer = palloc_get_page(0);
+    int moved = 0;
+    if(buffer == NULL) return;
     lock_acquire(&page_lock);
-    hash_destroy(page_table, page_destroy_std);
+    while(moved < PAGE_COMPACT_BATCH) {
+	struct compact_pick pick = { compact_tid, NULL };
+	enum intr_level old_level = intr_disable();
+	thread_foreach(page_compact_pick, &pick);
+	intr_set_level(old_level);
+	if(pick.t == NULL) {
+	    /* A pass over every process is done.  Moves can make
+	       room for more, so go round again if there were any. */
+	    compact_tid = 0;
+	    if(compact_moved) compact_wanted = true;
+	    compact_moved = false;
+	    break;
+	}
+
+	index_t to;
+	struct page_table_elem* e = page_compact_find(pick.t, &to);
+	if(e == NULL) {
+	    compact_tid = pick.t->tid;
+	    continue;
+	}
+	index_t from = (index_t) e->value;
+	e->status = EVICTING;
+	lock_release(&page_lock);
+	index_t at = swap_move(from, to, buffer);
+	lock_acquire(&page_lock);
+	e->value = (void *) at;
+	e->status = SWAP;
+	cond_broadcast(&evict_done, &page_lock);
+	if(at == from) {
+	    /* An eviction took the slot meanwhile: leave the rest for
+	       the next pass. */
+	    compact_tid = pick.t->tid;
+	    continue;
+	}
+	moved++;
+	compact_moved = true;
+    }
+    if(moved == PAGE_COMPACT_BATCH) compact_wanted = true;
     lock_release(&page_lock);
+    palloc_free_page(buffer);
 }
 
-bool page_fault_handler(const void* vaddr, bool to_write, void *esp) {
-    struct thread *cur = thread_current();
-    struct hash *page_table = cur->page_table;
+/* A dirty page of an mmap'd file, to be written back at exit. */
+struct page_writeback {
+    struct page_table_elem* e;
+    struct inode* inode;	/* File it goes to. */
+    off_t ofs;			/* Offset in the file. */
+};
+
+/* Orders write-backs by file, then by offset. */
+static int page_writeback_cmp(const void* a_, const void* b_) {
+    const struct page_writeback *a = a_, *b = b_;
+    if(a->inode != b->inode) return a->inode < b->inode ? -1 : 1;
+    return a->ofs < b->ofs ? -1 : a->ofs > b->ofs;
+}
+
+/* Most pages page_write_runs() writes with one file_write_back_at(). */
+#define PAGE_WB_RUN_MAX			16
+
+/* Writes back the dirty pages of mmap'd files in WBS, CNT of them
+   sorted by page_writeback_cmp(), clearing their dirty bits in
+   PAGEDIR first, so that a store made meanwhile dirties the page
+   again.  Pages next to each other in the same file are copied
+   into a kernel buffer and go out in one file_write_back_at() of
+   up to PAGE_WB_RUN_MAX pages, so the inode is walked and its
+   lock taken once per run instead of once per page; if there is
+   no memory for the buffer, each page is written by itself.
+   page_lock must be held. */
+static void page_write_runs(uint32_t* pagedir, struct page_writeback* wbs, size_t cnt) {
+    uint8_t* buffer = NULL;
+    size_t i, j, k;
+    for(i = 0; i < cnt; i++) pagedir_set_dirty(pagedir, wbs[i].e->key, false);
+    if(cnt > 1) buffer = palloc_get_multiple(0, PAGE_WB_RUN_MAX);
+    for(i = 0; i < cnt; i = j) {
+	struct page_table_elem* e = wbs[i].e;
+	struct mmap_handler* mh = e->origin;
+	off_t size = mmap_write_size(mh, e->key);
+	/* Only the last page of a run may be short. */
+	for(j = i + 1; buffer != NULL && j < cnt && j - i < PAGE_WB_RUN_MAX
+		&& size == (off_t) (j - i) * PGSIZE
+		&& wbs[j].inode == wbs[i].inode && wbs[j].ofs == wbs[i].ofs + size; j++)
+	    size += mmap_write_size(wbs[j].e->origin, wbs[j].e->key);
+	if(j - i == 1) mmap_write_file(mh, e->key, e->value);
+	else {
+	    for(k = i; k < j; k++)
+		memcpy(buffer + (k - i) * PGSIZE, wbs[k].e->value, PGSIZE);
+	    file_write_back_at(mh->mmap_file, buffer, size, wbs[i].ofs);
+	}
+    }
+    if(buffer != NULL) palloc_free_multiple(buffer, PAGE_WB_RUN_MAX);
+}
+
+/* Frees resident page E, writing it back first if WB. */
+static void page_teardown_frame(uint32_t* pagedir, struct page_table_elem* e, bool wb) {
+    if(wb) mmap_write_file(e->origin, e->key, e->value);
+    pagedir_clear_page(pagedir, e->key);
+    frame_free(e->value);
+}
+
+/* Tears down the current process's address space, PAGE_TABLE,
+   and frees the table, in one pass over it rather than unmapping
+   each mmap region page by page first.
+   Dirty pages of mmap'd files are written back together at the
+   end, sorted by file and offset, so each file is written in
+   order and the cache sees sequential writes, adjacent pages
+   together as page_write_runs() does; swap slots are
+   released together.  The mmap handlers must stay valid until
+   this returns; freeing them is left to the caller.
+
+   The kernel page directory is made active for the duration, so
+   that clearing each page does not flush the TLB; if the thread
+   is switched out and back in meanwhile, that only costs the
+   flushes again. */
+void page_teardown(struct ptrmap* page_table) {
+    struct thread* cur = process_current();
+    size_t cnt = ptrmap_size(page_table);
+    struct page_writeback* wbs = malloc(cnt * sizeof *wbs);
+    index_t* slots = malloc(cnt * sizeof *slots);
+    size_t wb_cnt = 0, slot_cnt = 0, i;
+    struct ptrmap_iterator it;
+    struct page_table_elem* e;
+
+    pagedir_activate(NULL);
+    lock_acquire(&page_lock);
+    page_wait_evictions(page_table);
+    ptrmap_first(&it, page_table);
+    while((e = ptrmap_next(&it)) != NULL) {
+	struct mmap_handler* mh = e->origin;
+	index_t slot = SWAP_NONE;
+	switch(e->status) {
+	    case FRAME:
+		slot = e->swap_slot;
+		if(mh != NULL && !mh->is_segment && mh->writable
+		   && pagedir_is_dirty(cur->pagedir, e->key)) {
+		    if(wbs != NULL) {
+			wbs[wb_cnt].e = e;
+			wbs[wb_cnt].inode = file_get_inode(mh->mmap_file);
+			wbs[wb_cnt].ofs = (uint8_t*) e->key - (uint8_t*) mh->mmap_addr + mh->file_ofs;
+			wb_cnt++;
+			continue;
+		    }
+		    page_teardown_frame(cur->pagedir, e, true);
+		} else page_teardown_frame(cur->pagedir, e, false);
+		break;
+	    case ZERO:
+	    case SHARED:
+		pagedir_clear_page(cur->pagedir, e->key);
+		break;
+	    case SWAP:
+		slot = (index_t) e->value;
+		break;
+	    case FILE:
+		break;
+	    default:
+		NOT_REACHED();
+	}
+	if(slot != SWAP_NONE) {
+	    if(slots != NULL) slots[slot_cnt++] = slot;
+	    else swap_free(slot);
+	}
+	slab_free(&pte_cache, e);
+    }
+
+    qsort(wbs, wb_cnt, sizeof *wbs, page_writeback_cmp);
+    page_write_runs(cur->pagedir, wbs, wb_cnt);
+    for(i = 0; i < wb_cnt; i++) {
+	e = wbs[i].e;
+	page_teardown_frame(cur->pagedir, e, false);
+	if(e->swap_slot != SWAP_NONE) {
+	    if(slots != NULL) slots[slot_cnt++] = e->swap_slot;
+	    else swap_free(e->swap_slot);
+	}
+	slab_free(&pte_cache, e);
+    }
+    if(slot_cnt > 0) swap_free_many(slots, slot_cnt);
+    ptrmap_destroy(page_table, NULL);
+    lock_release(&page_lock);
+    free(wbs);
+    free(slots);
+    free(page_table);
+    process_activate();
+}
+
+/* Gets a frame for UPAGE, allocated with FLAGS.  page_lock is
+   dropped meanwhile, because evicting another page to make room
+   takes it. */
+static void* page_frame_get(void* upage, enum palloc_flags flags) {
+    lock_release(&page_lock);
+    void* frame = frame_get(PAGE_PAL_FLAG | flags, upage);
+    lock_acquire(&page_lock);
+    return frame;
+}
+
+/* Returns a frame holding UPAGE of T, a FILE page with data from
+   its file, or NULL if out of frames.  Pages of read-only
+   segments are the same in every process running the executable,
+   and pages of an mmap'd file are the file's own, so both kinds
+   share one frame between every process mapping them, found by
+   file and offset in the frame table; a fault on a page that
+   another process already has is served without reading it.
+   Writable data segments are private copies.  page_lock must be
+   held, but is dropped while getting a frame. */
+static void* page_file_frame(struct page_table_elem *t, void *upage) {
+    struct mmap_handler *mh = t->value;
+    struct inode *inode = NULL;
+    off_t ofs = 0, valid = -1;
+    void *dest;
+    if(!mh->is_segment || !mh->writable) {
+	inode = file_get_inode(mh->mmap_file);
+	ofs = (uint8_t *) upage - (uint8_t *) mh->mmap_addr + mh->file_ofs;
+	if(!mh->is_segment) valid = mmap_write_size(mh, upage);
+	dest = frame_share_find(inode, ofs, valid, upage);
+	if(dest != NULL) return dest;
+    }
+    dest = page_frame_get(upage, 0);
+    if(dest == NULL) return NULL;
+    if(inode != NULL) {
+	/* Another process may have read it in meanwhile. */
+	void *shared = frame_share_find(inode, ofs, valid, upage);
+	if(shared != NULL) {
+	    frame_free(dest);
+	    return shared;
+	}
+    }
+    mmap_read_file(mh, upage, dest);
+    if(inode != NULL) frame_share(dest, inode, ofs, valid);
+    return dest;
+}
+
+/* Reads T, a SWAP page, into frame DEST, making it FRAME.  Returns
+   true if no copy is left in swap, so that the page must be marked
+   dirty once mapped, or it would be dropped clean on eviction. */
+static bool page_swap_load(struct page_table_elem *t, void *dest) {
+    index_t index = (index_t) t->value;
+    t->swap_slot = swap_load(index, dest) ? index : SWAP_NONE;
+    t->value = dest;
+    t->status = FRAME;
+    return t->swap_slot == SWAP_NONE;
+}
+
+/* Gives CUR's copy-on-write page T a frame of its own on its first
+   write: the shared one if no other process maps it any more, else
+   a copy.  page_lock must be held, but is dropped while getting a
+   frame. */
+static bool page_break_cow(struct thread *cur, struct page_table_elem *t) {
+    void *upage = t->key;
+    ASSERT(t->status == FRAME && t->cow);
+    if(!frame_cow_claim(t->value)) {
+	void *dest = page_frame_get(upage, 0);
+	if(dest == NULL) return false;
+	/* Our copy may have been evicted meanwhile, or the other
+	   mappers gone. */
+	while(t->status == EVICTING)
+	    cond_wait(&evict_done, &page_lock);
+	if(t->status == SWAP) page_swap_load(t, dest);
+	else if(frame_cow_claim(t->value)) frame_free(dest);
+	else {
+	    memcpy(dest, t->value, PGSIZE);
+	    frame_free(t->value);
+	    t->value = dest;
+	}
+    }
+    t->cow = false;
+    frame_set_unswapable(t->value);
+    pagedir_clear_page(cur->pagedir, upage);
+    page_map(cur->pagedir, upage, t->value, true);
+    pagedir_set_dirty(cur->pagedir, upage, true);
+    return true;
+}
+
+/* Maps T read-only to the zero frame in PAGEDIR, making it ZERO:
+   a page that would only be zero-filled takes no frame until it
+   is written. */
+static void page_map_zero(uint32_t *pagedir, struct page_table_elem *t) {
+    t->value = zero_frame;
+    t->status = ZERO;
+    page_map(pagedir, t->key, zero_frame, false);
+}
+
+/* Adds an entry to CUR's page table for new stack page UPAGE,
+   resident in DEST, which is the zero frame if it is only read so
+   far.  Returns the entry, or NULL if out of memory, in which case
+   the caller still owns DEST.  page_lock must be held. */
+static struct page_table_elem* page_stack_entry(struct thread *cur, void *upage, void *dest) {
+    struct page_table_elem *t = slab_alloc(&pte_cache);
+    if(t == NULL || !ptrmap_insert(cur->page_table, upage, t)) {
+	if(t != NULL) slab_free(&pte_cache, t);
+	return NULL;
+    }
+    t->key = upage;
+    t->value = dest;
+    t->status = FRAME;
+    t->writable = true;
+    t->origin = NULL;
+    t->swap_slot = SWAP_NONE;
+    t->cow = false;
+    return t;
+}
+
+/* Returns true if UPAGE is in CUR's heap, whose pages get entries
+   only when first touched. */
+static bool page_in_heap(struct thread *cur, const void *upage) {
+    return upage >= (void *) cur->heap_start && upage < pg_round_up(cur->heap_brk);
+}
+
+/* Brings the page holding VADDR into a frame, growing the stack
+   if VADDR is just below ESP or mapping a new heap page if it is
+   in the heap.  T is VADDR's page table entry, or NULL if it has
+   none.  page_lock must be held. */
+static bool page_do_load(struct thread *cur, struct page_table_elem *t, const void *vaddr, bool to_write, void *esp) {
     uint32_t *pagedir = cur->pagedir;
     void* upage = pg_round_down(vaddr);
     bool success = true;
-    lock_acquire(&page_lock);
-    struct page_table_elem *t = page_find(page_table, upage);
+    bool dirty = false;
     void *dest = NULL;
+    ASSERT(lock_held_by_current_thread(&page_lock));
     ASSERT(is_user_vaddr(vaddr));
-    ASSERT(!(t != NULL && t->status == FRAME));
+    while(t != NULL && t->status == EVICTING)
+	cond_wait(&evict_done, &page_lock);
+    if(t != NULL && t->status == SHARED) return !(to_write && !t->writable);
+    if(t != NULL && t->status == FRAME) {
+	/* Eviction was given up while we waited, or the page is
+	   copy-on-write. */
+	if(to_write && !t->writable) return false;
+	return !(to_write && t->cow) || page_break_cow(cur, t);
+    }
     if(to_write == true && t != NULL && t->writable == false) return false;
-    if(upage >= PAGE_STACK_UNDERLINE) {
-	if(vaddr >= esp - PAGE_INST_MARGIN) {
+    if(t != NULL && t->status == ZERO) {
+	/* Already mapped, so only a write faults: give the page a
+	   frame of its own. */
+	if(!to_write) return true;
+	dest = page_frame_get(upage, PAL_ZERO);
+	if(dest == NULL) return false;
+	pagedir_clear_page(pagedir, upage);
+	t->value = dest;
+	t->status = FRAME;
+	frame_set_unswapable(dest);
+	page_map(pagedir, t->key, t->value, t->writable);
+	return true;
+    }
+    if(upage >= PAGE_STACK_UNDERLINE || page_in_heap(cur, upage)) {
+	if(upage < PAGE_STACK_UNDERLINE || vaddr >= esp - PAGE_INST_MARGIN) {
 	    if(t == NULL) {
-		dest = frame_get(PAGE_PAL_FLAG, upage);
+		if(!to_write) dest = zero_frame;
+		else dest = page_frame_get(upage, PAL_ZERO);
 		if(dest == NULL) {
 		    success = false;
 		} else {
-		    t = malloc(sizeof(*t));
-		    t->key = upage;
-		    t->value = dest;
-		    t->status = FRAME;
-		    t->writable = true;
-		    t->origin = NULL;
-		    hash_insert(page_table, &t->elem);
+		    t = page_stack_entry(cur, upage, dest);
+		    if(t == NULL) {
+			if(dest != zero_frame) frame_free(dest);
+			return false;
+		    }
+		    if(dest == zero_frame) {
+			page_map_zero(pagedir, t);
+			return true;
+		    }
 		}
 	    } else {
 		switch(t->status) {
 		    case SWAP:
-			dest = frame_get(PAGE_PAL_FLAG, upage);
+			dest = page_frame_get(upage, 0);
 			if(dest == NULL) {
 			    success = false;
 			    break;
 			}
-			swap_load((index_t) t->value, dest);
-			t->value = dest;
-			t->status = FRAME;
+			dirty = page_swap_load(t, dest);
 			break;
 		    default:
 			success = false;
@@ -147,22 +790,33 @@ bool page_fault_handler(const void* vaddr, bool to_write, void *esp) {
 	else {
 	    switch(t->status) {
 		case SWAP:
-		    dest = frame_get(PAGE_PAL_FLAG, upage);
+		    dest = page_frame_get(upage, 0);
 		    if(dest == NULL) {
 			success = false;
 			break;
 		    }
-		    swap_load((index_t)t->value, dest);
-		    t->value = dest;
-		    t->status = FRAME;
+		    dirty = page_swap_load(t, dest);
 		    break;
 		case FILE:
-		    dest = frame_get(PAGE_PAL_FLAG, upage);
-		    if(dest == NULL) {
-			success = false;
-			break;
+		    if(mmap_page_is_zero(t->value, upage)) {
+			/* BSS and the like: share the zero frame until
+			   written, then skip the read. */
+			if(!to_write) {
+			    page_map_zero(pagedir, t);
+			    return true;
+			}
+			dest = page_frame_get(upage, PAL_ZERO);
+			if(dest == NULL) {
+			    success = false;
+			    break;
+			}
+		    } else {
+			dest = page_file_frame(t, upage);
+			if(dest == NULL) {
+			    success = false;
+			    break;
+			}
 		    }
-		    mmap_read_file(t->value, upage, dest);
 		    t->value = dest;
 		    t->status = FRAME;
 		    break;
@@ -172,77 +826,582 @@ bool page_fault_handler(const void* vaddr, bool to_write, void *esp) {
 	}
     }
     frame_set_unswapable(dest);
+    if(success) {
+	page_map(pagedir, t->key, t->value, t->writable);
+	if(dirty) pagedir_set_dirty(pagedir, t->key, true);
+    }
+    return success;
+}
+
+/* Does page_do_load() for a fault on VADDR, counting it in CUR's
+   statistics: as major if the page has to be read from swap or
+   its file, else as minor.  Reading a ZERO page is no fault. */
+static bool page_load(struct thread *cur, struct page_table_elem *t, const void *vaddr, bool to_write, void *esp) {
+    while(t != NULL && t->status == EVICTING)
+	cond_wait(&evict_done, &page_lock);
+    bool major = t != NULL && (t->status == SWAP
+			       || (t->status == FILE && !mmap_page_is_zero(t->value, pg_round_down(vaddr))));
+    bool fault = !(t != NULL && t->status == ZERO && !to_write);
+    bool success = page_do_load(cur, t, vaddr, to_write, esp);
+    if(success && fault) {
+	if(major) cur->vm_stats.major_faults++;
+	else cur->vm_stats.minor_faults++;
+    }
+    return success;
+}
+
+/* Brings in UPAGE of CUR if it is in swap or in its file, as
+   page_load() does, for fault-around.  Returns false if UPAGE is
+   not such a page or there is no frame for it.  page_lock must
+   be held. */
+static bool page_load_around(struct thread *cur, void *upage) {
+    struct page_table_elem *t = page_find(cur->page_table, upage);
+    if(t == NULL || (t->status != SWAP && t->status != FILE)) return false;
+    if(t->status == FILE && mmap_page_is_zero(t->value, upage)) {
+	page_map_zero(cur->pagedir, t);
+	return true;
+    }
+    /* Only CUR moves its pages out of SWAP and FILE, so T is as
+       it was before page_lock was dropped. */
+    void *dest;
+    bool dirty = false;
+    if(t->status == SWAP) {
+	dest = page_frame_get(upage, 0);
+	if(dest == NULL) return false;
+	dirty = page_swap_load(t, dest);
+    } else {
+	dest = page_file_frame(t, upage);
+	if(dest == NULL) return false;
+	t->value = dest;
+	t->status = FRAME;
+    }
+    frame_set_unswapable(dest);
+    page_map(cur->pagedir, t->key, t->value, t->writable);
+    if(dirty) pagedir_set_dirty(cur->pagedir, t->key, true);
+    return true;
+}
+
+/* Called after UPAGE of CUR was read in from swap or a file.  If
+   the fault follows on from the last such fault, within the pages
+   read ahead of it, the process is walking its memory upward, so
+   the read-ahead window doubles up to PAGE_AROUND_MAX; otherwise
+   it halves.  Then that many of the following pages that are not
+   resident are brought in too, while frames are plentiful.
+   ADVICE is that of UPAGE's region, or MADV_NORMAL: a region
+   advised MADV_RANDOM gets no fault-around, and one advised
+   MADV_SEQUENTIAL always PAGE_AROUND_SEQUENTIAL pages, marked
+   streaming along with UPAGE. */
+static void page_fault_around(struct thread *cur, void *upage, int advice) {
+    uint8_t *last = cur->last_fault;
+    int i, window;
+    if(advice == MADV_RANDOM) return;
+    if(last != NULL && (uint8_t *) upage > last
+       && (uint8_t *) upage <= last + (cur->fault_window + 1) * PGSIZE) {
+	cur->fault_window = cur->fault_window > 0 ? cur->fault_window * 2 : 1;
+	if(cur->fault_window > PAGE_AROUND_MAX) cur->fault_window = PAGE_AROUND_MAX;
+    } else cur->fault_window /= 2;
+    cur->last_fault = upage;
+    window = advice == MADV_SEQUENTIAL ? PAGE_AROUND_SEQUENTIAL : cur->fault_window;
+    if(advice == MADV_SEQUENTIAL) frame_set_streaming(page_find(cur->page_table, upage)->value, true);
+    for(i = 1; i <= window; i++) {
+	uint8_t *next = (uint8_t *) upage + i * PGSIZE;
+	if(!is_user_vaddr(next) || palloc_free_cnt(PAL_USER) <= PAGE_AROUND_RESERVE) break;
+	struct page_table_elem *t = page_lookup(cur, next);
+	if(t == NULL || t->status == EVICTING) break;
+	if(t->status != FRAME && t->status != ZERO && !page_load_around(cur, next)) break;
+	if(advice == MADV_SEQUENTIAL && t->status == FRAME) frame_set_streaming(t->value, true);
+    }
+}
+
+/* Called after CUR's stack grew by new page UPAGE on a fault with
+   ESP as the user stack pointer.  If the stack is not mapped just
+   above UPAGE, esp dropped by more than a page at once, as for a
+   large local array, whose pages would otherwise each fault in
+   turn, so zeroed frames are mapped to the unmapped pages from
+   ESP's up to the rest of the stack.  At most CUR's stack_prefault
+   pages are mapped, and none while frames are scarce.  page_lock
+   must be held, but is dropped while getting frames. */
+static void page_grow_stack(struct thread *cur, uint8_t *upage, const uint8_t *esp) {
+    uint8_t *p = upage;
+    int left = cur->stack_prefault;
+    if(esp >= (const uint8_t *) PAGE_STACK_UNDERLINE && esp < upage) p = pg_round_down(esp);
+    for(; left > 0 && is_user_vaddr(p); p += PGSIZE) {
+	if(page_find(cur->page_table, p) != NULL) {
+	    if(p > upage) break;
+	    continue;
+	}
+	if(palloc_free_cnt(PAL_USER) <= PAGE_AROUND_RESERVE) break;
+	void *dest = page_frame_get(p, PAL_ZERO);
+	if(dest == NULL) break;
+	if(page_stack_entry(cur, p, dest) == NULL) {
+	    frame_free(dest);
+	    break;
+	}
+	frame_set_unswapable(dest);
+	page_map(cur->pagedir, p, dest, true);
+	left--;
+    }
+}
+
+/* Fault-around and stack pre-faulting are only done here, not for
+   the ranges checked by system calls: page_pin_range() relies on
+   each page it loads staying resident, and both drop page_lock. */
+bool page_fault_handler(const void* vaddr, bool to_write, void *esp) {
+    struct thread *cur = process_current();
+    void *upage = pg_round_down(vaddr);
+    KTRACE(KTRACE_PAGE_FAULT, (uintptr_t) vaddr, to_write);
+    lock_acquire(&page_lock);
+    struct page_table_elem *t = page_lookup(cur, upage);
+    struct mmap_handler *mh = t != NULL ? t->origin : NULL;
+    bool from_disk = t != NULL && t->status != FRAME && t->status != ZERO;
+    bool new_stack = t == NULL && upage >= PAGE_STACK_UNDERLINE;
+    bool success = page_load(cur, t, vaddr, to_write, esp);
+    if(success && from_disk) page_fault_around(cur, upage, mh != NULL ? mh->advice : MADV_NORMAL);
+    if(success && new_stack) page_grow_stack(cur, upage, esp);
+    lock_release(&page_lock);
+    KTRACE(KTRACE_PAGE_FAULT_DONE, (uintptr_t) vaddr, success);
+    return success;
+}
+
+/* Checks that the SIZE bytes at VADDR are mapped user memory,
+   writable if TO_WRITE, and loads every page of them that is not
+   in a frame yet.  The page table is walked once under a single
+   acquisition of page_lock, rather than once per page. */
+bool page_check_range(const void *vaddr, size_t size, bool to_write, void *esp) {
+    struct thread *cur = process_current();
+    const uint8_t *first = pg_round_down(vaddr);
+    const uint8_t *last = pg_round_down((const uint8_t *) vaddr + (size > 0 ? size - 1 : 0));
+    const uint8_t *upage;
+    bool success = true;
+    if(vaddr == NULL || last < first || !is_user_vaddr(last)) return false;
+    lock_acquire(&page_lock);
+    for(upage = first; success && upage <= last; upage += PGSIZE) {
+	struct page_table_elem *t = page_lookup(cur, (void *) upage);
+	if(t != NULL && t->status == FRAME && !(to_write && t->cow)) success = !(to_write && !t->writable);
+	else success = page_load(cur, t, upage == first ? vaddr : upage, to_write, esp);
+    }
     lock_release(&page_lock);
-    if(success) ASSERT(pagedir_set_page(pagedir, t->key, t->value, t->writable));
     return success;
 }
 
+/* Like page_check_range(), but also pins every page of the range
+   in its frame, so that I/O into or out of it cannot fault.  The
+   caller must undo it with page_unpin_range() on success. */
+bool page_pin_range(const void *vaddr, size_t size, bool to_write, void *esp) {
+    struct thread *cur = process_current();
+    const uint8_t *first = pg_round_down(vaddr);
+    const uint8_t *last = pg_round_down((const uint8_t *) vaddr + (size > 0 ? size - 1 : 0));
+    const uint8_t *upage;
+    bool success = true;
+    if(vaddr == NULL || last < first || !is_user_vaddr(last)) return false;
+    lock_acquire(&page_lock);
+    for(upage = first; success && upage <= last; upage += PGSIZE) {
+	struct page_table_elem *t = page_lookup(cur, (void *) upage);
+	if(t != NULL && t->status == FRAME && !(to_write && t->cow)) success = !(to_write && !t->writable);
+	else success = page_load(cur, t, upage == first ? vaddr : upage, to_write, esp);
+	/* Eviction holds page_lock, so the page is still resident
+	   here, and once pinned it stays so.  The zero frame and
+	   shared memory are never evicted, and a read-only pin never
+	   promotes the zero frame. */
+	if(success) {
+	    t = page_find(cur->page_table, (void *) upage);
+	    ASSERT(t->status == FRAME || t->status == SHARED || (t->status == ZERO && !to_write));
+	    if(t->status == FRAME) {
+		success = frame_pin(t->value, (void *) upage);
+		ASSERT(success);
+	    }
+	}
+    }
+    lock_release(&page_lock);
+    if(!success && upage - PGSIZE > first)
+	page_unpin_range(first, upage - PGSIZE - first);
+    return success;
+}
+
+/* Unpins the SIZE bytes at VADDR, pinned by page_pin_range(). */
+void page_unpin_range(const void *vaddr, size_t size) {
+    struct thread *cur = process_current();
+    const uint8_t *first = pg_round_down(vaddr);
+    const uint8_t *last = pg_round_down((const uint8_t *) vaddr + (size > 0 ? size - 1 : 0));
+    const uint8_t *upage;
+    lock_acquire(&page_lock);
+    for(upage = first; upage <= last; upage += PGSIZE) {
+	struct page_table_elem *t = page_find(cur->page_table, (void *) upage);
+	ASSERT(t != NULL && (t->status == FRAME || t->status == ZERO || t->status == SHARED));
+	if(t->status == FRAME) frame_unpin(t->value);
+    }
+    lock_release(&page_lock);
+}
+
 bool page_set_frame(void* upage, void* kpage, bool wb) {
-    struct thread* cur = thread_current();
-    struct hash* page_table = cur->page_table;
+    struct thread* cur = process_current();
+    struct ptrmap* page_table = cur->page_table;
     uint32_t *pagedir = cur->pagedir;
     bool success = true;
     lock_acquire(&page_lock);
     struct page_table_elem *t = page_find(page_table, upage);
     if(t == NULL) {
-	t = malloc(sizeof(struct page_table_elem));
+	t = slab_alloc(&pte_cache);
+	if(t == NULL || !ptrmap_insert(page_table, upage, t)) {
+	    if(t != NULL) slab_free(&pte_cache, t);
+	    lock_release(&page_lock);
+	    return false;
+	}
 	t->key = upage;
 	t->value = kpage;
 	t->status = FRAME;
 	t->origin = NULL;
+	t->swap_slot = SWAP_NONE;
+	t->cow = false;
 	t->writable = wb;
-	hash_insert(page_table, &t->elem);
     } else success = false;
     lock_release(&page_lock);
-    if(success) ASSERT(pagedir_set_page(pagedir, t->key, t->value, t->writable));
+    if(success) page_map(pagedir, t->key, t->value, t->writable);
     return success;
 }
 
-bool page_accessible_upage(struct hash* page_table, void* upage) {
+bool page_accessible_upage(struct ptrmap* page_table, void* upage) {
     return upage < PAGE_STACK_UNDERLINE && page_find(page_table, upage) != NULL;
 }
 
-bool page_unmap(struct hash* page_table, void* upage) {
-    struct thread *cur = thread_current();
+bool page_unmap(struct ptrmap* page_table, void* upage) {
+    struct thread *cur = process_current();
     bool success = true;
     lock_acquire(&page_lock);
+    while(page_accessible_upage(page_table, upage)
+	  && page_find(page_table, upage)->status == EVICTING)
+	cond_wait(&evict_done, &page_lock);
     if(page_accessible_upage(page_table, upage)) {
 	struct page_table_elem *t = page_find(page_table, upage);
 	ASSERT( t != NULL );
 	switch(t->status) {
+	    case ZERO:
+	    case SHARED:
+		pagedir_clear_page(cur->pagedir, t->key);
+		/* Fall through. */
 	    case FILE:
-		hash_delete(page_table, &(t->elem));
-		free(t);
+		ptrmap_delete(page_table, t->key);
+		slab_free(&pte_cache, t);
 		break;
 	    case FRAME:
 		if(pagedir_is_dirty(cur->pagedir, t->key)) {
 		    mmap_write_file(t->origin, t->key, t->value);
 		}
 		pagedir_clear_page(cur->pagedir, t->key);
-		hash_delete(page_table, &(t->elem));
+		ptrmap_delete(page_table, t->key);
 		frame_free(t->value);
-		free(t);
+		if(t->swap_slot != SWAP_NONE) swap_free(t->swap_slot);
+		slab_free(&pte_cache, t);
 		break;
 	    default:
 		success = false;
 	}
 
-    } else success = false;
+    } else success = upage < PAGE_STACK_UNDERLINE;	/* Never touched. */
+    lock_release(&page_lock);
+    return success;
+}
+
+/* Adds resident page E of the current process to the CNT
+   write-backs in WBS if it is dirty, or writes it back at once
+   if WBS is a null pointer. */
+static void page_sync_collect(struct page_table_elem* e, struct page_writeback* wbs, size_t* cnt) {
+    struct thread *cur = process_current();
+    struct mmap_handler *mh = e->origin;
+    if(e->status != FRAME || !pagedir_is_dirty(cur->pagedir, e->key)) return;
+    if(wbs == NULL) {
+	pagedir_set_dirty(cur->pagedir, e->key, false);
+	mmap_write_file(mh, e->key, e->value);
+	return;
+    }
+    wbs[*cnt].e = e;
+    wbs[*cnt].inode = file_get_inode(mh->mmap_file);
+    wbs[*cnt].ofs = (uint8_t*) e->key - (uint8_t*) mh->mmap_addr + mh->file_ofs;
+    (*cnt)++;
+}
+
+/* Writes the dirty pages of MH's region in the current process
+   back to its file and marks them clean, leaving them mapped,
+   as msync does and munmap does before unmapping.  They are
+   written in order of offset, adjacent ones together, by
+   page_write_runs(), rather than one at a time in page table
+   order.  As in page_unmap_region(), a region bigger than the
+   page table is found through the table.  Shared memory and
+   executable segments are never written back. */
+void page_sync_region(struct mmap_handler *mh) {
+    uint8_t *first = mh->mmap_addr;
+    page_sync_pages(mh, first, first + mh->num_page * PGSIZE);
+}
+
+/* Does page_sync_region() for the pages of MH's region from FIRST
+   up to END only. */
+static void page_sync_pages(struct mmap_handler *mh, uint8_t *first, uint8_t *end) {
+    struct thread *cur = process_current();
+    size_t num_page = (end - first) / PGSIZE;
+    struct page_writeback *wbs;
+    size_t cnt = 0, max;
+    if(mh->mmap_file == NULL || mh->is_segment || !mh->writable) return;
+    lock_acquire(&page_lock);
+    page_wait_evictions(cur->page_table);
+    max = ptrmap_size(cur->page_table);
+    if(num_page < max) max = num_page;
+    wbs = max > 0 ? malloc(max * sizeof *wbs) : NULL;
+    if(num_page > ptrmap_size(cur->page_table)) {
+	struct ptrmap_iterator it;
+	struct page_table_elem *e;
+	ptrmap_first(&it, cur->page_table);
+	while((e = ptrmap_next(&it)) != NULL)
+	    if((uint8_t *) e->key >= first && (uint8_t *) e->key < end)
+		page_sync_collect(e, wbs, &cnt);
+	qsort(wbs, cnt, sizeof *wbs, page_writeback_cmp);
+    } else {
+	uint8_t *upage;
+	for(upage = first; upage < end; upage += PGSIZE) {
+	    struct page_table_elem *e = page_find(cur->page_table, upage);
+	    if(e != NULL) page_sync_collect(e, wbs, &cnt);
+	}
+    }
+    page_write_runs(cur->pagedir, wbs, cnt);
     lock_release(&page_lock);
+    free(wbs);
+}
+
+/* Unmaps the NUM_PAGE pages at MH's region from the current
+   process, as page_unmap() does, first writing back the dirty
+   ones together with page_sync_region().  Untouched pages have
+   no entries, so if the region is bigger than the page table
+   only the entries in it are visited, keeping the cost in line
+   with the pages used rather than the size of the mapping.
+   Returns false if some page could not be unmapped. */
+bool page_unmap_region(struct mmap_handler *mh, int num_page) {
+    uint8_t *first = mh->mmap_addr;
+    page_sync_region(mh);
+    return page_unmap_pages(first, first + num_page * PGSIZE);
+}
+
+/* Unmaps the current process's pages from FIRST up to END, as
+   page_unmap_region() does, but with no write-back first. */
+static bool page_unmap_pages(uint8_t *first, uint8_t *end) {
+    struct thread *cur = process_current();
+    size_t num_page = (end - first) / PGSIZE;
+    void **keys = NULL;
+    size_t cnt = 0, i;
+    bool success = true;
+    lock_acquire(&page_lock);
+    if(num_page > ptrmap_size(cur->page_table)) {
+	struct ptrmap_iterator it;
+	struct page_table_elem *e;
+	keys = malloc(ptrmap_size(cur->page_table) * sizeof *keys);
+	if(keys != NULL) {
+	    ptrmap_first(&it, cur->page_table);
+	    while((e = ptrmap_next(&it)) != NULL) {
+		uint8_t *key = e->key;
+		if(key >= first && key < end) keys[cnt++] = key;
+	    }
+	}
+    }
+    lock_release(&page_lock);
+    if(keys != NULL) {
+	for(i = 0; i < cnt; i++)
+	    success &= page_unmap(cur->page_table, keys[i]);
+	free(keys);
+    } else {
+	for(i = 0; i < num_page; i++)
+	    success &= page_unmap(cur->page_table, first + i * PGSIZE);
+    }
     return success;
 }
 
-struct hash* page_create(void) {
-    struct hash* t = malloc(sizeof(struct hash));
+/* Marks the resident pages of CUR from FIRST up to END streaming
+   if STREAMING, or not; see frame_set_streaming().  page_lock must
+   be held. */
+static void page_mark_streaming(struct thread *cur, uint8_t *first, uint8_t *end, bool streaming) {
+    struct page_table_elem *e;
+    if((size_t) (end - first) / PGSIZE > ptrmap_size(cur->page_table)) {
+	struct ptrmap_iterator it;
+	ptrmap_first(&it, cur->page_table);
+	while((e = ptrmap_next(&it)) != NULL)
+	    if((uint8_t *) e->key >= first && (uint8_t *) e->key < end && e->status == FRAME)
+		frame_set_streaming(e->value, streaming);
+    } else {
+	uint8_t *upage;
+	for(upage = first; upage < end; upage += PGSIZE) {
+	    e = page_find(cur->page_table, upage);
+	    if(e != NULL && e->status == FRAME) frame_set_streaming(e->value, streaming);
+	}
+    }
+}
+
+/* Queues the file sectors of UPAGE of MH, unless it has none or
+   is resident, with the buffer cache's read-ahead thread, which
+   reads each page's worth with one multi-sector command when they
+   are contiguous on disk.  page_lock must be held. */
+static void page_prefetch(struct thread *cur, struct mmap_handler *mh, uint8_t *upage) {
+    int page = (upage - (uint8_t *) mh->mmap_addr) / PGSIZE;
+    struct page_table_elem *e = page_find(cur->page_table, upage);
+    if(mh->mmap_file == NULL || page >= mh->num_page
+       || (e != NULL && (e->status == FRAME || e->status == ZERO))) return;
+    file_advise(mh->mmap_file, mh->file_ofs + page * PGSIZE, PGSIZE, MADV_WILLNEED);
+}
+
+/* Takes ADVICE, one of the MADV_* values, about the pages of MH's
+   region from FIRST up to END, as madvise does:
+
+   MADV_NORMAL, MADV_SEQUENTIAL and MADV_RANDOM set the access
+   pattern of the whole region, on which fault-around and eviction
+   depend; see page_fault_around().  The pages of a sequential
+   region are evicted before any page used again.
+
+   MADV_WILLNEED brings the file or swap pages of the range into
+   frames now, as many as frames are plentiful for, without a page
+   fault for each.  The disk reads for file pages are queued
+   PAGE_PREFETCH_AHEAD pages early, so that they overlap with
+   filling the frames before them.
+
+   MADV_DONTNEED writes back the dirty pages of the range, if MH
+   maps a file, and frees their frames, to be read in again from
+   the file when next used.  Other regions keep their pages.
+
+   The caller must hold the process's mm_lock and have quiesced
+   its asynchronous I/O. */
+void page_advise(struct mmap_handler *mh, void *first_, void *end_, int advice) {
+    struct thread *cur = process_current();
+    uint8_t *first = first_, *end = end_, *upage;
+    switch(advice) {
+	case MADV_NORMAL:
+	case MADV_SEQUENTIAL:
+	case MADV_RANDOM:
+	    mh->advice = advice;
+	    lock_acquire(&page_lock);
+	    page_mark_streaming(cur, mh->mmap_addr,
+				(uint8_t *) mh->mmap_addr + mh->num_page_with_segment * PGSIZE,
+				advice == MADV_SEQUENTIAL);
+	    lock_release(&page_lock);
+	    break;
+	case MADV_WILLNEED:
+	    lock_acquire(&page_lock);
+	    for(upage = first; upage < end && upage < first + PAGE_PREFETCH_AHEAD * PGSIZE; upage += PGSIZE)
+		page_prefetch(cur, mh, upage);
+	    for(upage = first; upage < end; upage += PGSIZE) {
+		if(palloc_free_cnt(PAL_USER) <= PAGE_AROUND_RESERVE) break;
+		if(upage + PAGE_PREFETCH_AHEAD * PGSIZE < end)
+		    page_prefetch(cur, mh, upage + PAGE_PREFETCH_AHEAD * PGSIZE);
+		struct page_table_elem *t = page_lookup(cur, upage);
+		if(t == NULL || t->status == EVICTING) continue;
+		if(page_load_around(cur, upage) && t->status == FRAME
+		   && mh->advice == MADV_SEQUENTIAL)
+		    frame_set_streaming(t->value, true);
+	    }
+	    lock_release(&page_lock);
+	    break;
+	case MADV_DONTNEED:
+	    if(mh->mmap_file != NULL && !mh->is_segment) {
+		page_sync_pages(mh, first, end);
+		page_unmap_pages(first, end);
+	    }
+	    break;
+	default:
+	    NOT_REACHED();
+    }
+}
+
+/* Maps every page of MH's shared memory object into the current
+   process at MH's region, which must be free.  Returns false if
+   out of memory, having mapped only some of them, which
+   page_unmap_region() undoes. */
+bool page_map_shared(struct mmap_handler *mh) {
+    struct thread *cur = process_current();
+    size_t i, cnt = shm_page_cnt(mh->shm);
+    bool success = true;
+    lock_acquire(&page_lock);
+    for(i = 0; success && i < cnt; i++) {
+	void *upage = (uint8_t *) mh->mmap_addr + i * PGSIZE;
+	struct page_table_elem *t = slab_alloc(&pte_cache);
+	if(t == NULL || !ptrmap_insert(cur->page_table, upage, t)) {
+	    if(t != NULL) slab_free(&pte_cache, t);
+	    success = false;
+	    break;
+	}
+	t->key = upage;
+	t->value = shm_frame(mh->shm, i);
+	t->status = SHARED;
+	t->writable = mh->writable;
+	t->origin = mh;
+	t->swap_slot = SWAP_NONE;
+	t->cow = false;
+	page_map(cur->pagedir, upage, t->value, t->writable);
+    }
+    lock_release(&page_lock);
+    return success;
+}
+
+/* Frees CUR's heap page UPAGE, if it was ever touched.  page_lock
+   must be held, and UPAGE must not be EVICTING. */
+static void page_free_heap_page(struct thread *cur, void *upage) {
+    struct page_table_elem *t = page_find(cur->page_table, upage);
+    if(t == NULL) return;
+    ASSERT(t->origin == NULL);
+    switch(t->status) {
+	case FRAME:
+	    page_teardown_frame(cur->pagedir, t, false);
+	    if(t->swap_slot != SWAP_NONE) swap_free(t->swap_slot);
+	    break;
+	case ZERO:
+	    pagedir_clear_page(cur->pagedir, t->key);
+	    break;
+	case SWAP:
+	    swap_free((index_t) t->value);
+	    break;
+	default:
+	    NOT_REACHED();
+    }
+    ptrmap_delete(cur->page_table, upage);
+    slab_free(&pte_cache, t);
+}
+
+/* Frees the current process's heap pages from FIRST up to END,
+   which the break has just moved down past.  As in
+   page_unmap_region(), if the range is bigger than the page table
+   only the entries in it are visited. */
+void page_unmap_heap(void* first_, void* end_) {
+    struct thread *cur = process_current();
+    uint8_t *first = first_, *end = end_, *p;
+    void **keys = NULL;
+    size_t cnt = 0, i;
+    lock_acquire(&page_lock);
+    page_wait_evictions(cur->page_table);
+    if((size_t) (end - first) / PGSIZE > ptrmap_size(cur->page_table)) {
+	struct ptrmap_iterator it;
+	struct page_table_elem *e;
+	keys = malloc(ptrmap_size(cur->page_table) * sizeof *keys);
+	if(keys != NULL) {
+	    ptrmap_first(&it, cur->page_table);
+	    while((e = ptrmap_next(&it)) != NULL) {
+		uint8_t *key = e->key;
+		if(key >= first && key < end) keys[cnt++] = key;
+	    }
+	}
+    }
+    if(keys != NULL) {
+	for(i = 0; i < cnt; i++) page_free_heap_page(cur, keys[i]);
+	free(keys);
+    } else {
+	for(p = first; p < end; p += PGSIZE) page_free_heap_page(cur, p);
+    }
+    lock_release(&page_lock);
+}
+
+struct ptrmap* page_create(void) {
+    struct ptrmap* t = malloc(sizeof(struct ptrmap));
     if(t != NULL) {
-	if (!hash_init(t, page_hash, page_hash_less, NULL)) {
+	if (!ptrmap_init(t)) {
 	    free(t);
 	    return NULL;
 	} else return t;
     } else return NULL;
 }
 
-struct page_table_elem* page_find_lock(struct hash* page_table, void* upage) {
+struct page_table_elem* page_find_lock(struct ptrmap* page_table, void* upage) {
     lock_acquire(&page_lock);
     struct page_table_elem* tmp = page_find(page_table, upage);
     lock_release(&page_lock);
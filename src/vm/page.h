@@ -2,13 +2,24 @@
 #define SUPPLEMENTAL_PAGE_TABLE_MODULE
 
 #include <stdint.h>
-#include <hash.h>
+#include <ptrmap.h>
 #include "threads/thread.h"
+#include "vm/swap.h"
+
+/* Default for the most stack pages one fault maps, inherited by
+   each new thread from its creator.  See page_grow_stack(). */
+#define PAGE_STACK_PREFAULT 16
+
+/* Largest stack_prefault a process may ask for: all of the stack. */
+#define PAGE_STACK_PREFAULT_MAX 2048
 
 enum page_status {
 	FRAME,
 	SWAP,
-	FILE
+	FILE,
+	EVICTING,	/* Being written out of its frame by another thread. */
+	ZERO,		/* Never written, mapped read-only to the zero frame. */
+	SHARED		/* A page of a shared memory object, always mapped. */
 };
 
 struct page_table_elem {
@@ -17,20 +28,40 @@ struct page_table_elem {
 	void* origin;
 	enum page_status status;
 	bool writable;
-	struct hash_elem elem;    
+	index_t swap_slot;	/* While in a frame, the clean copy in swap it
+				   was loaded from, or SWAP_NONE. */
+	bool cow;		/* Writable but mapped read-only, its frame
+				   shared with a forked process. */
 };
 
-struct page_table_elem* page_find(struct hash* page_table, void* upage);
-bool page_status_exp(struct thread* cur, void* upage, void* index, bool to_swap);
-bool page_install_file(struct hash* page_table, struct mmap_handler* mh, void* key);
-bool page_upage_accessable(struct hash* page_table, void* upage);
+struct page_table_elem* page_find(struct ptrmap* page_table, void* upage);
+void page_table_lock(void);
+void page_table_unlock(void);
+struct page_table_elem* page_evict_begin(struct thread* owner, void* upage, bool* dirty);
+index_t page_swap_hint(struct thread* owner, void* upage);
+void page_evict_end(struct page_table_elem* e, void* value, bool to_swap);
+void page_evict_shared(struct thread* owner, void* upage);
+void page_evict_abort(struct thread* owner, struct page_table_elem* e, bool dirty);
+bool page_fork(struct thread* parent, struct thread* child);
+bool page_upage_accessable(struct ptrmap* page_table, void* upage);
 void page_init(void);
-void page_destroy(struct hash* page_table);
+void page_set_exit_report(bool on);
+void page_get_stats(struct vm_stats* stats);
+void page_exit_report(void);
+void page_teardown(struct ptrmap* page_table);
 bool page_fault_handler(const void* vaddr, bool to_write, void* esp);
+bool page_check_range(const void *vaddr, size_t size, bool to_write, void *esp);
+bool page_pin_range(const void *vaddr, size_t size, bool to_write, void *esp);
+void page_unpin_range(const void *vaddr, size_t size);
 bool page_set_frame(void* upage, void* kpage, bool wb);
-bool page_unmap(struct hash* page_table, void* upage);
-struct hash* page_create(void);
-struct page_table_elem* page_find_lock(struct hash* page_table, void* upage);
+bool page_unmap(struct ptrmap* page_table, void* upage);
+void page_sync_region(struct mmap_handler* mh);
+void page_advise(struct mmap_handler* mh, void* first, void* end, int advice);
+bool page_unmap_region(struct mmap_handler* mh, int num_page);
+bool page_map_shared(struct mmap_handler* mh);
+void page_unmap_heap(void* first, void* end);
+struct ptrmap* page_create(void);
+struct page_table_elem* page_find_lock(struct ptrmap* page_table, void* upage);
 
 #endif
 
@@ -0,0 +1,141 @@
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <string.h>
+#include <syscall-nr.h>
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "frame.h"
+#include "shm.h"
+
+struct shm {
+    char name[SHM_NAME_MAX + 1];
+    size_t page_cnt;		/* Size in pages. */
+    void** frames;		/* PAGE_CNT frames, never on the clock. */
+    int maps;			/* Mappings of it in all processes. */
+    bool linked;		/* Still findable by name? */
+    struct list_elem elem;	/* Element in shm_list, while linked. */
+};
+
+/* Linked objects, and the lock over them and every object's maps
+   and linked. */
+static struct list shm_list;
+static struct lock shm_lock;
+
+void shm_init(void) {
+    list_init(&shm_list);
+    lock_init(&shm_lock);
+}
+
+/* Returns the linked object named NAME, or NULL.  shm_lock must
+   be held. */
+static struct shm* shm_find(const char* name) {
+    struct list_elem* e;
+    for (e = list_begin(&shm_list); e != list_end(&shm_list); e = list_next(e)) {
+	struct shm* shm = list_entry(e, struct shm, elem);
+	if (!strcmp(shm->name, name)) return shm;
+    }
+    return NULL;
+}
+
+/* Frees SHM, which nothing maps or can find any more. */
+static void shm_destroy(struct shm* shm) {
+    size_t i;
+    for (i = 0; i < shm->page_cnt; i++) frame_free(shm->frames[i]);
+    free(shm->frames);
+    free(shm);
+}
+
+/* Creates an object named NAME of SIZE bytes, rounded up to whole
+   pages.  Its frames belong to no process, so that the object can
+   outlive the one that creates it, and count against nobody's
+   frame_limit.  shm_lock must be held. */
+static struct shm* shm_create(const char* name, size_t size) {
+    struct shm* shm = malloc(sizeof *shm);
+    size_t i;
+    if (shm == NULL) return NULL;
+    shm->page_cnt = DIV_ROUND_UP(size, PGSIZE);
+    shm->frames = malloc(shm->page_cnt * sizeof *shm->frames);
+    if (shm->frames == NULL) {
+	free(shm);
+	return NULL;
+    }
+    for (i = 0; i < shm->page_cnt; i++) {
+	shm->frames[i] = frame_get_unowned(PAL_ZERO);
+	if (shm->frames[i] == NULL) {
+	    shm->page_cnt = i;
+	    shm_destroy(shm);
+	    return NULL;
+	}
+    }
+    strlcpy(shm->name, name, sizeof shm->name);
+    shm->maps = 0;
+    shm->linked = true;
+    list_push_back(&shm_list, &shm->elem);
+    return shm;
+}
+
+/* Returns the object named NAME, creating it with SIZE bytes if
+   there is none, and counts a mapping of it, to be undone with
+   shm_put().  Returns NULL if the name is too long, an existing
+   object is smaller than SIZE, a new one would be empty or bigger
+   than SHM_SIZE_MAX, or memory is short. */
+struct shm* shm_get(const char* name, size_t size) {
+    struct shm* shm;
+    if (strlen(name) > SHM_NAME_MAX || size > SHM_SIZE_MAX) return NULL;
+    lock_acquire(&shm_lock);
+    shm = shm_find(name);
+    if (shm != NULL && size > shm->page_cnt * PGSIZE) shm = NULL;
+    else if (shm == NULL && size > 0) shm = shm_create(name, size);
+    if (shm != NULL) shm->maps++;
+    lock_release(&shm_lock);
+    return shm;
+}
+
+/* Counts another mapping of SHM, as fork copies one. */
+void shm_dup(struct shm* shm) {
+    lock_acquire(&shm_lock);
+    ASSERT(shm->maps > 0);
+    shm->maps++;
+    lock_release(&shm_lock);
+}
+
+/* Undoes shm_get() or shm_dup(), freeing SHM after its last
+   mapping goes if it is unlinked. */
+void shm_put(struct shm* shm) {
+    bool dead;
+    lock_acquire(&shm_lock);
+    ASSERT(shm->maps > 0);
+    dead = --shm->maps == 0 && !shm->linked;
+    lock_release(&shm_lock);
+    if (dead) shm_destroy(shm);
+}
+
+/* Removes the name NAME, so that shm_get() creates a new object
+   under it.  The object goes once nothing maps it.  Returns false
+   if there is no such object. */
+bool shm_unlink(const char* name) {
+    struct shm* shm;
+    bool dead = false;
+    lock_acquire(&shm_lock);
+    shm = shm_find(name);
+    if (shm != NULL) {
+	list_remove(&shm->elem);
+	shm->linked = false;
+	dead = shm->maps == 0;
+    }
+    lock_release(&shm_lock);
+    if (dead) shm_destroy(shm);
+    return shm != NULL;
+}
+
+size_t shm_page_cnt(const struct shm* shm) {
+    return shm->page_cnt;
+}
+
+/* Returns page I of SHM's frames. */
+void* shm_frame(const struct shm* shm, size_t i) {
+    ASSERT(i < shm->page_cnt);
+    return shm->frames[i];
+}
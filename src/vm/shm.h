@@ -0,0 +1,22 @@
+#ifndef VM_SHM_H
+#define VM_SHM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Named shared memory objects.  Each is a fixed set of zeroed
+   frames that every process mapping the object maps directly, so
+   a write by one is seen by all at once, with no copying.  The
+   frames are never evicted.  An object lives until it is
+   unlinked and no process maps it any more. */
+struct shm;
+
+void shm_init(void);
+struct shm* shm_get(const char* name, size_t size);
+void shm_dup(struct shm* shm);
+void shm_put(struct shm* shm);
+bool shm_unlink(const char* name);
+size_t shm_page_cnt(const struct shm* shm);
+void* shm_frame(const struct shm* shm, size_t i);
+
+#endif /* vm/shm.h */
@@ -1,58 +1,328 @@
 #include <debug.h>
+#include <stdio.h>
+#include <bitmap.h>
 #include <threads/pte.h>
 #include <threads/malloc.h>
-#include <hash.h>
+#include <threads/interrupt.h>
+#include <threads/synch.h>
 #include "swap.h"
+#include "zswap.h"
 
 const int BLOCK_PER_PAGE = PGSIZE / BLOCK_SECTOR_SIZE;
 
-static struct list swap_free_list;
-struct block* swap_block;
-index_t top_index = 0;
+/* An index is either a sector of the swap space or, if it is a
+   kernel virtual address, an entry of the compressed tier. */
+#define swap_in_zswap(INDEX) is_kernel_vaddr((void *) (INDEX))
 
+/* Most swap devices used at once. */
+#define SWAP_DEVICES_MAX 4
+
+/* A swap device.  The swap space is the slots of every device one
+   after another: this one holds slots BASE up to BASE + CNT. */
+struct swap_device {
+    struct block* block;
+    size_t base;
+    size_t cnt;
+};
+
+/* The swap devices: the one cast in the swap role first, then
+   any other swap partitions, in probe order.  Fixed at boot. */
+static struct swap_device swap_devices[SWAP_DEVICES_MAX];
+static size_t swap_device_cnt;
+
+/* Device that swap_store() tries first among equally busy ones,
+   guarded by swap_lock. */
+static size_t swap_next_device;
+
+/* One bit per page-sized slot, set while the slot is in use, and
+   the number of pages sharing each slot in use; more than one
+   after a fork. */
+static struct bitmap* swap_map;
+static uint16_t* swap_refs;
+
+/* Guards swap_map and swap_refs, which evictions update without
+   page_lock.  Never held over I/O. */
+static struct lock swap_lock;
+
+/* Set when a slot is freed, leaving a hole that the compactor
+   (see page_swap_compact()) may be able to use.  Cleared by
+   swap_take_holes(). */
+static bool swap_holes;
+
+/* Slots moved by swap_move(). */
+static unsigned long long move_cnt;
+
+/* Adds BLOCK to the swap space, if it holds a slot and there is
+   room for another device. */
+static void swap_add_device(struct block* block){
+    struct swap_device* d;
+    size_t cnt = block_size(block) / BLOCK_PER_PAGE;
+    if (cnt == 0) return;
+    if (swap_device_cnt >= SWAP_DEVICES_MAX) {
+	printf("swap: ignoring %s, too many swap devices\n", block_name(block));
+	return;
+    }
+    d = &swap_devices[swap_device_cnt];
+    d->block = block;
+    d->base = swap_device_cnt > 0 ? d[-1].base + d[-1].cnt : 0;
+    d->cnt = cnt;
+    if (swap_device_cnt++ > 0) printf("swap: also using %s\n", block_name(block));
+}
+
+/* Returns the device holding SLOT. */
+static struct swap_device* slot_device(size_t slot){
+    size_t i;
+    for (i = 1; i < swap_device_cnt; i++)
+	if (slot < swap_devices[i].base) break;
+    ASSERT(slot < swap_devices[i - 1].base + swap_devices[i - 1].cnt);
+    return &swap_devices[i - 1];
+}
+
+/* Reads the page in slot INDEX into KPAGE, or writes KPAGE there
+   if WRITE, on the device that holds it. */
+static void slot_io(index_t index, void* kpage, bool write){
+    struct swap_device* d = slot_device(index / BLOCK_PER_PAGE);
+    block_sector_t sector = index - d->base * BLOCK_PER_PAGE;
+    if (write) block_write_multiple(d->block, sector, kpage, BLOCK_PER_PAGE);
+    else block_read_multiple(d->block, sector, kpage, BLOCK_PER_PAGE);
+}
+
+/* Takes the first free slot of device D at or after START, which
+   is one of its slots, or else its first free slot, and returns
+   it, or BITMAP_ERROR if D is full.  Must be called with
+   swap_lock held. */
+static size_t take_slot(const struct swap_device* d, size_t start){
+    size_t end = d->base + d->cnt;
+    size_t slot = bitmap_scan(swap_map, start, 1, false);
+    if (slot == BITMAP_ERROR || slot >= end) {
+	slot = bitmap_scan(swap_map, d->base, 1, false);
+	if (slot >= end) return BITMAP_ERROR;
+    }
+    bitmap_mark(swap_map, slot);
+    return slot;
+}
+
+/* Returns the index in swap_devices of the device to store the
+   next page on: the one whose disk has the fewest requests
+   queued, taking equally busy devices in turn, so that pages
+   stored one after another are striped across the disks.  Must
+   be called with swap_lock held. */
+static size_t pick_device(void){
+    size_t best = swap_next_device, depth = block_queue_depth(swap_devices[best].block), i;
+    for (i = 1; i < swap_device_cnt; i++) {
+	size_t d = (swap_next_device + i) % swap_device_cnt;
+	size_t dd = block_queue_depth(swap_devices[d].block);
+	if (dd < depth) {
+	    best = d;
+	    depth = dd;
+	}
+    }
+    swap_next_device = (best + 1) % swap_device_cnt;
+    return best;
+}
+
+/* Sets up the swap space on the device cast in the swap role and
+   every other swap partition. */
 void swap_init(){
-    swap_block = block_get_role(BLOCK_SWAP);
-    ASSERT(swap_block != NULL);
-    list_init(&swap_free_list);
+    struct block* role = block_get_role(BLOCK_SWAP);
+    struct block* block;
+    ASSERT(role != NULL);
+    swap_add_device(role);
+    for (block = block_first(); block != NULL; block = block_next(block))
+	if (block != role && block_type(block) == BLOCK_SWAP) swap_add_device(block);
+    ASSERT(swap_device_cnt > 0);
+    struct swap_device* last = &swap_devices[swap_device_cnt - 1];
+    swap_map = bitmap_create(last->base + last->cnt);
+    swap_refs = calloc(bitmap_size(swap_map), sizeof *swap_refs);
+    if (swap_map == NULL || swap_refs == NULL) PANIC("swap: cannot allocate slot bitmap");
+    lock_init(&swap_lock);
+    zswap_init();
 }
 
-index_t swap_store(void* kpage){
+/* Stores KPAGE in the compressed tier if it fits there, else
+   writes it to a free slot, and returns where it went, or
+   SWAP_NONE if swap is full.  The slot is on the least busy
+   device (see pick_device()), or the next one with room.  On it,
+   the slot is the one at HINT's offset into its own device if
+   that is free, else the first free one after it, so that
+   neighbouring pages of a process tend to land next to each
+   other on each disk; HINT may be SWAP_NONE. */
+index_t swap_store(void* kpage, index_t hint){
     ASSERT(is_kernel_vaddr(kpage));
-    index_t index = (index_t)-1;
-    if (list_empty(&swap_free_list)){
-	if (top_index + BLOCK_PER_PAGE < block_size(swap_block)){
-	    index = top_index;
-	    top_index += BLOCK_PER_PAGE;
-	}
-    } else {
-	struct swap_item* t = list_entry(list_front(&swap_free_list), struct swap_item, list_elem);
-	list_remove(&t->list_elem);
-	index = t->index;
-	free(t);
-    }
-    if (index == (index_t)-1) return index;
-    for (int i = 0; i < BLOCK_PER_PAGE; i++)
-	block_write(swap_block, index + i, kpage + i * BLOCK_SECTOR_SIZE);
+    void* entry = zswap_store(kpage);
+    if (entry != NULL) return (index_t) entry;
+    size_t slot = BITMAP_ERROR, ofs = 0, first, i;
+    lock_acquire(&swap_lock);
+    if (hint != SWAP_NONE && hint / BLOCK_PER_PAGE < bitmap_size(swap_map)) {
+	ASSERT(hint % BLOCK_PER_PAGE == 0);
+	ofs = hint / BLOCK_PER_PAGE - slot_device(hint / BLOCK_PER_PAGE)->base;
+    }
+    first = pick_device();
+    for (i = 0; i < swap_device_cnt && slot == BITMAP_ERROR; i++) {
+	const struct swap_device* d = &swap_devices[(first + i) % swap_device_cnt];
+	slot = take_slot(d, d->base + (ofs < d->cnt ? ofs : 0));
+    }
+    if (slot != BITMAP_ERROR) swap_refs[slot] = 1;
+    lock_release(&swap_lock);
+    if (slot == BITMAP_ERROR) return SWAP_NONE;
+    index_t index = slot * BLOCK_PER_PAGE;
+    swap_rewrite(index, kpage);
     return index;
 }
 
-void swap_free(index_t index){
+/* Overwrites slot INDEX, which its page still owns alone, with
+   KPAGE.  Only such device slots are kept by swap_load(). */
+void swap_rewrite(index_t index, void* kpage){
+    ASSERT(index != SWAP_NONE && !swap_in_zswap(index));
+    ASSERT(is_kernel_vaddr(kpage));
     ASSERT(index % BLOCK_PER_PAGE == 0);
-    if (top_index == index + BLOCK_PER_PAGE) top_index = index;
-    else {
-	struct swap_item* t = malloc(sizeof(struct swap_item));
-	t->index = index;
-	list_push_back(&swap_free_list, &t->list_elem);
+    slot_io(index, kpage, true);
+}
+
+/* Lets one more page share INDEX, as a forked child's copy of its
+   parent's swapped-out page does.  Each sharer frees it once. */
+void swap_dup(index_t index){
+    if (swap_in_zswap(index)) {
+	zswap_dup((void *) index);
+	return;
     }
+    ASSERT(index % BLOCK_PER_PAGE == 0);
+    lock_acquire(&swap_lock);
+    ASSERT(swap_refs[index / BLOCK_PER_PAGE] > 0 && swap_refs[index / BLOCK_PER_PAGE] < UINT16_MAX);
+    swap_refs[index / BLOCK_PER_PAGE]++;
+    lock_release(&swap_lock);
 }
 
-void swap_load(index_t index, void* kpage){
-    ASSERT(index != (index_t)-1);
-    ASSERT(is_kernel_vaddr(kpage));
+/* Drops one page's share of INDEX, freeing it with the last. */
+void swap_free(index_t index){
+    if (swap_in_zswap(index)) {
+	zswap_free((void *) index);
+	return;
+    }
     ASSERT(index % BLOCK_PER_PAGE == 0);
-    for (int i = 0; i < BLOCK_PER_PAGE; i++)
-	block_read(swap_block, index + i, kpage + i * BLOCK_SECTOR_SIZE);
-    swap_free(index);
+    lock_acquire(&swap_lock);
+    ASSERT(bitmap_test(swap_map, index / BLOCK_PER_PAGE));
+    if (--swap_refs[index / BLOCK_PER_PAGE] == 0) {
+	bitmap_reset(swap_map, index / BLOCK_PER_PAGE);
+	swap_holes = true;
+    }
+    lock_release(&swap_lock);
+}
+
+/* Drops one share of each of the CNT slots in INDEXES, as
+   swap_free() does, taking swap_lock just once for those on
+   disk. */
+void swap_free_many(const index_t* indexes, size_t cnt){
+    size_t i;
+    lock_acquire(&swap_lock);
+    for (i = 0; i < cnt; i++) {
+	index_t index = indexes[i];
+	if (swap_in_zswap(index)) continue;
+	ASSERT(index % BLOCK_PER_PAGE == 0);
+	ASSERT(bitmap_test(swap_map, index / BLOCK_PER_PAGE));
+	if (--swap_refs[index / BLOCK_PER_PAGE] == 0) {
+	    bitmap_reset(swap_map, index / BLOCK_PER_PAGE);
+	    swap_holes = true;
+	}
+    }
+    lock_release(&swap_lock);
+    for (i = 0; i < cnt; i++)
+	if (swap_in_zswap(indexes[i])) zswap_free((void *) indexes[i]);
+}
+
+/* Returns true if swap_move() could move slot FROM of the swap
+   device to slot TO: one page owns FROM alone, and TO is free. */
+bool swap_movable(index_t from, index_t to){
+    bool movable;
+    if (to == SWAP_NONE || swap_in_zswap(to) || swap_in_zswap(from)) return false;
+    ASSERT(from % BLOCK_PER_PAGE == 0 && to % BLOCK_PER_PAGE == 0);
+    lock_acquire(&swap_lock);
+    movable = swap_refs[from / BLOCK_PER_PAGE] == 1
+	      && to / BLOCK_PER_PAGE < bitmap_size(swap_map)
+	      && !bitmap_test(swap_map, to / BLOCK_PER_PAGE);
+    lock_release(&swap_lock);
+    return movable;
 }
 
+/* Moves the contents of slot FROM on the swap device, which one
+   page owns alone, to slot TO, if TO is free, copying through
+   BUFFER, a page of kernel memory.  Returns TO, or FROM if it
+   could not be moved.  The owner must keep FROM from being
+   shared or freed meanwhile, as an EVICTING page is. */
+index_t swap_move(index_t from, index_t to, void* buffer){
+    size_t from_slot = from / BLOCK_PER_PAGE, to_slot = to / BLOCK_PER_PAGE;
+    bool moved = false;
+    ASSERT(!swap_in_zswap(from) && from % BLOCK_PER_PAGE == 0);
+    ASSERT(is_kernel_vaddr(buffer));
+    if (to == SWAP_NONE || swap_in_zswap(to)) return from;
+    ASSERT(to % BLOCK_PER_PAGE == 0);
+    lock_acquire(&swap_lock);
+    if (swap_refs[from_slot] == 1 && to_slot < bitmap_size(swap_map)
+	&& !bitmap_test(swap_map, to_slot)) {
+	bitmap_mark(swap_map, to_slot);
+	swap_refs[to_slot] = 1;
+	moved = true;
+    }
+    lock_release(&swap_lock);
+    if (!moved) return from;
+
+    slot_io(from, buffer, false);
+    slot_io(to, buffer, true);
+    lock_acquire(&swap_lock);
+    swap_refs[from_slot] = 0;
+    bitmap_reset(swap_map, from_slot);
+    move_cnt++;
+    lock_release(&swap_lock);
+    return to;
+}
+
+/* Returns true if a slot has been freed since the last call.
+   Never sleeps, so that the idle thread may call it. */
+bool swap_take_holes(void){
+    enum intr_level old_level = intr_disable();
+    bool holes = swap_holes;
+    swap_holes = false;
+    intr_set_level(old_level);
+    return holes;
+}
+
+/* Stores the number of page-sized slots on the swap device in
+   *SLOTS and the number in use in *USED. */
+void swap_get_stats(size_t* slots, size_t* used){
+    lock_acquire(&swap_lock);
+    *slots = bitmap_size(swap_map);
+    *used = bitmap_count(swap_map, 0, *slots, true);
+    lock_release(&swap_lock);
+}
 
+/* Prints swap device statistics. */
+void swap_print_stats(void){
+    size_t slots, used;
+    if (swap_map == NULL) return;
+    swap_get_stats(&slots, &used);
+    printf("Swap: %zu of %zu slots used on %zu devices, %llu moved by compaction\n",
+	   used, slots, swap_device_cnt, move_cnt);
+}
+
+/* Reads INDEX into KPAGE.  Returns true if INDEX stays allocated
+   to the caller, so that the page need not be written again while
+   it stays clean; the caller frees it with swap_free().  Returns
+   false, having dropped the caller's share of INDEX, if it was a
+   compressed entry, which is not worth holding alongside the
+   page, or if other pages still share it, since they need it
+   unchanged. */
+bool swap_load(index_t index, void* kpage){
+    ASSERT(index != SWAP_NONE);
+    ASSERT(is_kernel_vaddr(kpage));
+    if (swap_in_zswap(index)) {
+	zswap_load((void *) index, kpage);
+	return false;
+    }
+    ASSERT(index % BLOCK_PER_PAGE == 0);
+    slot_io(index, kpage, false);
+    lock_acquire(&swap_lock);
+    bool kept = swap_refs[index / BLOCK_PER_PAGE] == 1;
+    lock_release(&swap_lock);
+    if (!kept) swap_free(index);
+    return kept;
+}
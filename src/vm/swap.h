@@ -1,19 +1,24 @@
 #ifndef VM_SWAP_H
 #define VM_SWAP_H
 
-#include <kernel/list.h>
 #include <devices/block.h>
 
 typedef block_sector_t index_t;
 
-struct swap_item {
-    index_t index;
-    struct list_elem list_elem;
-};
+/* No swap slot. */
+#define SWAP_NONE ((index_t) -1)
 
 void swap_init(void);
-index_t swap_store(void* kpage);
+index_t swap_store(void* kpage, index_t hint);
+void swap_rewrite(index_t index, void* kpage);
+void swap_dup(index_t index);
 void swap_free(index_t index);
-void swap_load(index_t index, void* kpage);
+void swap_free_many(const index_t* indexes, size_t cnt);
+bool swap_load(index_t index, void* kpage);
+void swap_get_stats(size_t* slots, size_t* used);
+bool swap_movable(index_t from, index_t to);
+index_t swap_move(index_t from, index_t to, void* buffer);
+bool swap_take_holes(void);
+void swap_print_stats(void);
 
 #endif
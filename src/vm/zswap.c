@@ -0,0 +1,188 @@
+#include <debug.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "zswap.h"
+
+/* Pages are compressed as runs of 32-bit words.  Each record
+   starts with a header byte: if ZSWAP_RUN is set, the next word
+   is repeated (header & ZSWAP_CNT_MASK) + 1 times, otherwise that
+   many literal words follow.  Zero-filled pages, the common case,
+   shrink to a few dozen bytes. */
+#define ZSWAP_WORDS		(PGSIZE / sizeof(uint32_t))
+#define ZSWAP_RUN		0x80
+#define ZSWAP_CNT_MASK		0x7f
+#define ZSWAP_CNT_MAX		(ZSWAP_CNT_MASK + 1)
+
+/* Pages that do not compress to at most this many bytes go
+   straight to the swap device. */
+#define ZSWAP_SIZE_MAX		(PGSIZE / 2)
+
+struct zswap_entry {
+    int refs;			/* Pages sharing it, guarded by zswap_lock. */
+    size_t size;		/* Bytes in DATA. */
+    uint8_t data[];
+};
+
+/* Most bytes of compressed data held, set by zswap_set_limit();
+   0 disables the tier. */
+static size_t zswap_limit;
+
+/* Guards zswap_used and the statistics.  Never held while
+   compressing. */
+static struct lock zswap_lock;
+static size_t zswap_used;
+
+/* Statistics. */
+static unsigned long long store_cnt;	/* # of pages taken in. */
+static unsigned long long reject_cnt;	/* # of pages that compressed badly. */
+static unsigned long long full_cnt;	/* # of pages turned away by the limit. */
+static unsigned long long load_cnt;	/* # of pages read back. */
+
+/* Lets the compressed tier hold up to PAGES pages' worth of
+   compressed data in the kernel pool.  Must be called before
+   zswap_init(). */
+void zswap_set_limit(size_t pages) {
+    zswap_limit = pages * PGSIZE;
+}
+
+void zswap_init(void) {
+    lock_init(&zswap_lock);
+    zswap_used = 0;
+}
+
+/* Returns the number of consecutive words starting at W[I] that
+   equal W[I], at most ZSWAP_CNT_MAX. */
+static size_t zswap_run(const uint32_t* w, size_t i) {
+    size_t run = 1;
+    while (i + run < ZSWAP_WORDS && run < ZSWAP_CNT_MAX && w[i + run] == w[i]) run++;
+    return run;
+}
+
+/* Compresses the page at KPAGE into OUT, or only measures it if
+   OUT is null.  Returns the compressed size, or SIZE_MAX as soon
+   as it would exceed ZSWAP_SIZE_MAX. */
+static size_t zswap_compress(const void* kpage, uint8_t* out) {
+    const uint32_t* w = kpage;
+    size_t i = 0, size = 0;
+    while (i < ZSWAP_WORDS) {
+	size_t run = zswap_run(w, i);
+	size_t cnt, record;
+	if (run > 1) {
+	    cnt = run;
+	    record = 1 + sizeof *w;
+	} else {
+	    /* Literals up to the start of the next run. */
+	    for (cnt = 1; i + cnt < ZSWAP_WORDS && cnt < ZSWAP_CNT_MAX; cnt++)
+		if (i + cnt + 1 < ZSWAP_WORDS && w[i + cnt] == w[i + cnt + 1]) break;
+	    record = 1 + cnt * sizeof *w;
+	}
+	if (size + record > ZSWAP_SIZE_MAX) return SIZE_MAX;
+	if (out != NULL) {
+	    out[size] = (run > 1 ? ZSWAP_RUN : 0) | (cnt - 1);
+	    memcpy(out + size + 1, w + i, record - 1);
+	}
+	size += record;
+	i += cnt;
+    }
+    return size;
+}
+
+/* Expands the SIZE bytes of compressed data at IN into KPAGE. */
+static void zswap_decompress(const uint8_t* in, size_t size, void* kpage) {
+    uint32_t* w = kpage;
+    size_t pos = 0, i = 0;
+    while (pos < size) {
+	uint8_t header = in[pos++];
+	size_t cnt = (header & ZSWAP_CNT_MASK) + 1;
+	ASSERT(i + cnt <= ZSWAP_WORDS);
+	if (header & ZSWAP_RUN) {
+	    uint32_t word;
+	    memcpy(&word, in + pos, sizeof word);
+	    pos += sizeof word;
+	    while (cnt-- > 0) w[i++] = word;
+	} else {
+	    memcpy(w + i, in + pos, cnt * sizeof *w);
+	    pos += cnt * sizeof *w;
+	    i += cnt;
+	}
+    }
+    ASSERT(i == ZSWAP_WORDS);
+}
+
+/* Tries to keep a compressed copy of KPAGE in memory.  Returns
+   the entry holding it, a kernel virtual address, or a null
+   pointer if the tier is disabled or full or the page does not
+   compress well, in which case it belongs on the swap device. */
+void* zswap_store(const void* kpage) {
+    if (zswap_limit == 0) return NULL;
+    size_t size = zswap_compress(kpage, NULL);
+    lock_acquire(&zswap_lock);
+    if (size == SIZE_MAX) {
+	reject_cnt++;
+	lock_release(&zswap_lock);
+	return NULL;
+    }
+    if (zswap_used + size > zswap_limit) {
+	full_cnt++;
+	lock_release(&zswap_lock);
+	return NULL;
+    }
+    zswap_used += size;
+    lock_release(&zswap_lock);
+
+    struct zswap_entry* e = malloc(sizeof *e + size);
+    if (e == NULL) {
+	lock_acquire(&zswap_lock);
+	zswap_used -= size;
+	full_cnt++;
+	lock_release(&zswap_lock);
+	return NULL;
+    }
+    e->refs = 1;
+    e->size = size;
+    zswap_compress(kpage, e->data);
+    lock_acquire(&zswap_lock);
+    store_cnt++;
+    lock_release(&zswap_lock);
+    return e;
+}
+
+/* Reads ENTRY back into KPAGE and drops the caller's share of it:
+   a resident page is not worth keeping a compressed copy of. */
+void zswap_load(void* entry, void* kpage) {
+    struct zswap_entry* e = entry;
+    zswap_decompress(e->data, e->size, kpage);
+    lock_acquire(&zswap_lock);
+    load_cnt++;
+    lock_release(&zswap_lock);
+    zswap_free(e);
+}
+
+/* Lets one more page share ENTRY. */
+void zswap_dup(void* entry) {
+    struct zswap_entry* e = entry;
+    lock_acquire(&zswap_lock);
+    e->refs++;
+    lock_release(&zswap_lock);
+}
+
+/* Drops one page's share of ENTRY, freeing it with the last. */
+void zswap_free(void* entry) {
+    struct zswap_entry* e = entry;
+    lock_acquire(&zswap_lock);
+    bool last = --e->refs == 0;
+    if (last) zswap_used -= e->size;
+    lock_release(&zswap_lock);
+    if (last) free(e);
+}
+
+void zswap_print_stats(void) {
+    if (zswap_limit == 0) return;
+    printf("Zswap: %zu of %zu bytes used, %llu pages stored, %llu loaded, "
+	   "%llu incompressible, %llu turned away\n",
+	   zswap_used, zswap_limit, store_cnt, load_cnt, reject_cnt, full_cnt);
+}
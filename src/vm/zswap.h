@@ -0,0 +1,17 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Compressed in-memory tier in front of the swap device. */
+
+void zswap_set_limit(size_t pages);
+void zswap_init(void);
+void* zswap_store(const void* kpage);
+void zswap_load(void* entry, void* kpage);
+void zswap_dup(void* entry);
+void zswap_free(void* entry);
+void zswap_print_stats(void);
+
+#endif /* vm/zswap.h */